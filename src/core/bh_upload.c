@@ -34,7 +34,10 @@
 
 #include "common.h"
 
+#include <zlib.h>
+
 #include "bh_upload.h"
+#include "settings.h"
 #include "share.h"
 #include "bsched.h"
 #include "tx.h"
@@ -52,17 +55,26 @@
 #include "if/gnet_property_priv.h"
 
 #include "lib/array.h"
+#include "lib/atoms.h"
+#include "lib/bg.h"
 #include "lib/concat.h"
+#include "lib/cq.h"
+#include "lib/fd.h"
+#include "lib/file.h"
 #include "lib/gnet_host.h"
 #include "lib/halloc.h"
 #include "lib/header.h"
 #include "lib/hstrfn.h"
+#include "lib/path.h"
 #include "lib/product.h"
 #include "lib/pslist.h"
+#include "lib/str.h"
 #include "lib/stringify.h"
+#include "lib/tm.h"
 #include "lib/unsigned.h"
 #include "lib/url.h"
 #include "lib/walloc.h"
+#include "lib/zlib_util.h"
 
 #include "lib/override.h"	/* Must be the last header included */
 
@@ -541,17 +553,42 @@ browse_host_flush(struct special_upload *ctx,
 }
 
 /**
- * Closes the browse host context and releases its memory.
- *
- * @return An initialized browse host context.
+ * Account for a browse host request being served with given flags.
  */
 static void
-browse_host_close(struct special_upload *ctx, bool fully_served)
+browse_host_stats_count(int flags)
 {
-	struct browse_host_upload *bh = cast_to_browse_host_upload(ctx);
-	pslist_t *sl;
+	if (flags & BH_F_HTML) {
+		gnet_prop_incr_guint32(PROP_HTML_BROWSE_COUNT);
+	} else if (flags & BH_F_G2) {
+		gnet_prop_incr_guint32(PROP_G2_BROWSE_COUNT);
+	} else if (flags & BH_F_QHITS) {
+		gnet_prop_incr_guint32(PROP_QHITS_BROWSE_COUNT);
+	}
+}
 
-	g_assert(bh);
+/**
+ * Account for a browse host request fully served with given flags.
+ */
+static void
+browse_host_stats_served(int flags)
+{
+	if (flags & BH_F_HTML) {
+		gnet_prop_incr_guint32(PROP_HTML_BROWSE_SERVED);
+	} else if (flags & BH_F_G2) {
+		gnet_prop_incr_guint32(PROP_G2_BROWSE_SERVED);
+	} else if (flags & BH_F_QHITS) {
+		gnet_prop_incr_guint32(PROP_QHITS_BROWSE_SERVED);
+	}
+}
+
+/**
+ * Release the data generation part of a browse host context.
+ */
+static void
+browse_host_release(struct browse_host_upload *bh)
+{
+	pslist_t *sl;
 
 	PSLIST_FOREACH(bh->hits, sl) {
 		pmsg_t *mb = sl->data;
@@ -563,26 +600,58 @@ browse_host_close(struct special_upload *ctx, bool fully_served)
 		wfree(bh->w_buf, bh->w_buf_size);
 		bh->w_buf = NULL;
 	}
+}
+
+/**
+ * Closes the browse host context and releases its memory.
+ *
+ * @return An initialized browse host context.
+ */
+static void
+browse_host_close(struct special_upload *ctx, bool fully_served)
+{
+	struct browse_host_upload *bh = cast_to_browse_host_upload(ctx);
+
+	g_assert(bh);
+
+	browse_host_release(bh);
 	tx_free(bh->tx);
 
 	/*
 	 * Update statistics if fully served.
 	 */
 
-	if (fully_served) {
-		if (bh->flags & BH_F_HTML) {
-			gnet_prop_incr_guint32(PROP_HTML_BROWSE_SERVED);
-		} else if (bh->flags & BH_F_G2) {
-			gnet_prop_incr_guint32(PROP_G2_BROWSE_SERVED);
-		} else if (bh->flags & BH_F_QHITS) {
-			gnet_prop_incr_guint32(PROP_QHITS_BROWSE_SERVED);
-		}
-	}
+	if (fully_served)
+		browse_host_stats_served(bh->flags);
 
 	ctx->magic = 0;
 	WFREE(bh);
 }
 
+/**
+ * Initialize the data generation part of a browse host context.
+ */
+static void
+browse_host_setup(struct browse_host_upload *bh, int flags)
+{
+	/* BH_HTML xor BH_QHITS set */
+	g_assert(flags & (BH_F_HTML|BH_F_QHITS));
+	g_assert((flags & (BH_F_HTML|BH_F_QHITS)) != (BH_F_HTML|BH_F_QHITS));
+
+	bh->special.magic = SPECIAL_UPLOAD_BROWSE_MAGIC;
+	bh->special.read  = (flags & BH_F_HTML)
+						? browse_host_read_html
+						: browse_host_read_qhits;
+	bh->special.write = browse_host_write;
+	bh->special.flush = browse_host_flush;
+	bh->special.close = browse_host_close;
+
+	browse_host_next_state(bh, BH_STATE_HEADER);
+	bh->hits = NULL;
+	bh->file_index = 0;
+	bh->flags = flags;
+}
+
 /**
  * Creates a new browse host context. The context must be freed with
  * browse_host_close().
@@ -609,23 +678,8 @@ browse_host_open(
 {
 	struct browse_host_upload *bh;
 
-	/* BH_HTML xor BH_QHITS set */
-	g_assert(flags & (BH_F_HTML|BH_F_QHITS));
-	g_assert((flags & (BH_F_HTML|BH_F_QHITS)) != (BH_F_HTML|BH_F_QHITS));
-
 	WALLOC(bh);
-	bh->special.magic = SPECIAL_UPLOAD_BROWSE_MAGIC;
-	bh->special.read  = (flags & BH_F_HTML)
-						? browse_host_read_html
-						: browse_host_read_qhits;
-	bh->special.write = browse_host_write;
-	bh->special.flush = browse_host_flush;
-	bh->special.close = browse_host_close;
-
-	browse_host_next_state(bh, BH_STATE_HEADER);
-	bh->hits = NULL;
-	bh->file_index = 0;
-	bh->flags = flags;
+	browse_host_setup(bh, flags);
 
 	/*
 	 * Instantiate the TX stack.
@@ -680,14 +734,622 @@ browse_host_open(
 	 * Update statistics.
 	 */
 
-	if (flags & BH_F_HTML) {
-		gnet_prop_incr_guint32(PROP_HTML_BROWSE_COUNT);
-	} else if (flags & BH_F_G2) {
-		gnet_prop_incr_guint32(PROP_G2_BROWSE_COUNT);
-	} else if (flags & BH_F_QHITS) {
-		gnet_prop_incr_guint32(PROP_QHITS_BROWSE_COUNT);
-	}
+	browse_host_stats_count(flags);
 	return &bh->special;
 }
 
+/***
+ *** Browse Host snapshots.
+ ***
+ *** Generating the whole library listing for each browsing request is
+ *** expensive for large libraries, and most of that work is redone over
+ *** and over with identical results until the library changes.
+ ***
+ *** We therefore build, once per library generation and in the background,
+ *** a deflated image of each output format, stored in a file.  Browsing
+ *** requests accepting deflated output are then served from that file as
+ *** a regular file upload, which can use sendfile().
+ ***/
+
+#define BH_SNAPSHOT_DIR		"browse_cache"	/**< Sub-directory in config dir */
+#define BH_SNAPSHOT_DELAY	(10 * 1000)		/**< ms, after library rebuild */
+#define BH_SNAPSHOT_MAX_AGE	(30 * 60)		/**< secs, refresh after that */
+#define BH_SNAPSHOT_MODE	(S_IRUSR | S_IWUSR)	/* 0600 */
+
+enum bh_snapshot_kind {
+	BH_SNAP_HTML = 0,		/**< HTML output */
+	BH_SNAP_QHITS,			/**< Gnutella query hits */
+	BH_SNAP_G2,				/**< G2 query hits */
+
+	BH_SNAP_COUNT
+};
+
+static const int bh_snapshot_flags[BH_SNAP_COUNT] = {
+	BH_F_HTML | BH_F_DEFLATE,				/* BH_SNAP_HTML */
+	BH_F_QHITS | BH_F_DEFLATE,				/* BH_SNAP_QHITS */
+	BH_F_QHITS | BH_F_G2 | BH_F_DEFLATE,	/* BH_SNAP_G2 */
+};
+
+static const char * const bh_snapshot_name[BH_SNAP_COUNT] = {
+	"html",									/* BH_SNAP_HTML */
+	"qhits",								/* BH_SNAP_QHITS */
+	"g2",									/* BH_SNAP_G2 */
+};
+
+enum bh_snapshot_magic { BH_SNAPSHOT_MAGIC = 0x4c3e9a71 };
+
+/**
+ * A browse host snapshot, reference-counted since uploads can still be
+ * serving it after it was superseded.  The file is removed when the last
+ * reference goes.
+ */
+struct bh_snapshot {
+	enum bh_snapshot_magic magic;
+	int refcnt;					/**< Reference count */
+	int flags;					/**< Browse host flags used to build it */
+	const char *path;			/**< Snapshot pathname (atom) */
+	filesize_t size;			/**< Size of the deflated data */
+	time_t built;				/**< When snapshot was built */
+};
+
+static inline void
+bh_snapshot_check(const struct bh_snapshot * const bs)
+{
+	g_assert(bs != NULL);
+	g_assert(BH_SNAPSHOT_MAGIC == bs->magic);
+	g_assert(bs->refcnt > 0);
+}
+
+enum bh_snapshot_build_magic { BH_SNAPSHOT_BUILD_MAGIC = 0x1f9b2ed4 };
+
+/**
+ * Background snapshot building context.
+ */
+struct bh_snapshot_build {
+	enum bh_snapshot_build_magic magic;
+	struct browse_host_upload bh;	/**< Headless data generator */
+	uint kind;						/**< Snapshot kind being built */
+	uint generation;				/**< Library generation when started */
+	z_stream z;						/**< Compressor */
+	bool zinit;						/**< Whether compressor was initialized */
+	int fd;							/**< Snapshot file being written */
+	char *path;						/**< Pathname of file being written */
+	filesize_t size;				/**< Deflated size written so far */
+	char ibuf[BH_BUFSIZ];			/**< Generated data */
+	char obuf[BH_BUFSIZ];			/**< Compressed data */
+};
+
+static inline void
+bh_snapshot_build_check(const struct bh_snapshot_build * const sb)
+{
+	g_assert(sb != NULL);
+	g_assert(BH_SNAPSHOT_BUILD_MAGIC == sb->magic);
+}
+
+static struct bh_snapshot *bh_snapshots[BH_SNAP_COUNT];
+static uint bh_snapshot_generation;	/**< Bumped when library changes */
+static uint bh_snapshot_serial;		/**< For unique snapshot file names */
+static bgtask_t *bh_snapshot_task;	/**< Running snapshot builder */
+static cevent_t *bh_snapshot_ev;	/**< Scheduled snapshot building */
+static char *bh_snapshot_dir;		/**< Directory holding snapshots */
+
+static void bh_snapshot_schedule(void);
+
+/**
+ * @return the snapshot kind to use for given browse host flags.
+ */
+static enum bh_snapshot_kind
+bh_snapshot_kind(int flags)
+{
+	if (flags & BH_F_HTML)
+		return BH_SNAP_HTML;
+
+	return (flags & BH_F_G2) ? BH_SNAP_G2 : BH_SNAP_QHITS;
+}
+
+/**
+ * Remove a snapshot file.
+ */
+static void
+bh_snapshot_unlink(const char *path)
+{
+	if (-1 == unlink(path) && ENOENT != errno)
+		g_warning("%s(): cannot unlink \"%s\": %m", G_STRFUNC, path);
+}
+
+/**
+ * Remove a reference on a snapshot, nullifying its pointer.
+ *
+ * The snapshot file is removed when the last reference is gone.
+ */
+void
+browse_host_snapshot_release(struct bh_snapshot **bs_ptr)
+{
+	struct bh_snapshot *bs = *bs_ptr;
+
+	if (bs != NULL) {
+		bh_snapshot_check(bs);
+
+		if (0 == --bs->refcnt) {
+			bh_snapshot_unlink(bs->path);
+			atom_str_free_null(&bs->path);
+			bs->magic = 0;
+			WFREE(bs);
+		}
+		*bs_ptr = NULL;
+	}
+}
+
+/**
+ * Drop all the current snapshots.
+ */
+static void
+bh_snapshot_invalidate(void)
+{
+	uint i;
+
+	for (i = 0; i < N_ITEMS(bh_snapshots); i++) {
+		browse_host_snapshot_release(&bh_snapshots[i]);
+	}
+}
+
+/**
+ * Get a reference on the current snapshot for given browse host flags.
+ *
+ * Only deflated output is pre-computed.  Since query hits embed our
+ * address and push-proxies, which can change, snapshots are refreshed
+ * when they get too old.
+ *
+ * @return snapshot to serve, NULL if none is available.
+ */
+struct bh_snapshot *
+browse_host_snapshot_get(int flags)
+{
+	enum bh_snapshot_kind kind;
+	struct bh_snapshot *bs;
+
+	if (!(flags & BH_F_DEFLATE))
+		return NULL;
+
+	kind = bh_snapshot_kind(flags);
+	bs = bh_snapshots[kind];
+
+	if (NULL == bs)
+		return NULL;
+
+	bh_snapshot_check(bs);
+
+	if (delta_time(tm_time(), bs->built) > BH_SNAPSHOT_MAX_AGE) {
+		browse_host_snapshot_release(&bh_snapshots[kind]);
+		bh_snapshot_schedule();
+		return NULL;
+	}
+
+	bs->refcnt++;
+	return bs;
+}
+
+/**
+ * @return the pathname of the snapshot file.
+ */
+const char *
+browse_host_snapshot_path(const struct bh_snapshot *bs)
+{
+	bh_snapshot_check(bs);
+	return bs->path;
+}
+
+/**
+ * @return the size of the snapshot file.
+ */
+filesize_t
+browse_host_snapshot_size(const struct bh_snapshot *bs)
+{
+	bh_snapshot_check(bs);
+	return bs->size;
+}
+
+/**
+ * Record that we are starting to send the snapshot.
+ */
+void
+browse_host_snapshot_sending(const struct bh_snapshot *bs)
+{
+	bh_snapshot_check(bs);
+	browse_host_stats_count(bs->flags);
+}
+
+/**
+ * Record that the snapshot was fully sent.
+ */
+void
+browse_host_snapshot_served(const struct bh_snapshot *bs)
+{
+	bh_snapshot_check(bs);
+	browse_host_stats_served(bs->flags);
+}
+
+/**
+ * Start building the next snapshot, creating its file.
+ *
+ * @return TRUE if OK.
+ */
+static bool
+bh_snapshot_build_open(struct bh_snapshot_build *sb)
+{
+	char name[32];
+	int ret;
+
+	g_assert(-1 == sb->fd);
+	g_assert(NULL == sb->path);
+	g_assert(sb->kind < BH_SNAP_COUNT);
+
+	str_bprintf(ARYLEN(name), "%s.%u.z",
+		bh_snapshot_name[sb->kind], ++bh_snapshot_serial);
+	sb->path = make_pathname(bh_snapshot_dir, name);
+	sb->fd = file_create(sb->path, O_WRONLY | O_TRUNC, BH_SNAPSHOT_MODE);
+
+	if (-1 == sb->fd)
+		return FALSE;
+
+	sb->z.zalloc = zlib_alloc_func;
+	sb->z.zfree = zlib_free_func;
+	sb->z.opaque = NULL;
+
+	ret = deflateInit(&sb->z, Z_BEST_COMPRESSION);
+
+	if (Z_OK != ret) {
+		g_warning("%s(): unable to initialize compressor: %s",
+			G_STRFUNC, zlib_strerror(ret));
+		return FALSE;
+	}
+
+	sb->zinit = TRUE;
+	sb->size = 0;
+	browse_host_setup(&sb->bh, bh_snapshot_flags[sb->kind]);
+
+	return TRUE;
+}
+
+/**
+ * Close the snapshot being built, installing it as the current one
+ * when ``ok'' is TRUE or discarding it otherwise.
+ */
+static void
+bh_snapshot_build_close(struct bh_snapshot_build *sb, bool ok)
+{
+	browse_host_release(&sb->bh);
+	sb->bh.special.magic = 0;
+
+	if (sb->zinit) {
+		deflateEnd(&sb->z);
+		sb->zinit = FALSE;
+	}
+
+	if (-1 != sb->fd && 0 != fd_close(&sb->fd)) {
+		g_warning("%s(): cannot close \"%s\": %m", G_STRFUNC, sb->path);
+		ok = FALSE;
+	}
+
+	if (NULL == sb->path)
+		return;
+
+	if (ok) {
+		struct bh_snapshot *bs;
+
+		WALLOC0(bs);
+		bs->magic = BH_SNAPSHOT_MAGIC;
+		bs->refcnt = 1;
+		bs->flags = bh_snapshot_flags[sb->kind];
+		bs->path = atom_str_get(sb->path);
+		bs->size = sb->size;
+		bs->built = tm_time();
+
+		browse_host_snapshot_release(&bh_snapshots[sb->kind]);
+		bh_snapshots[sb->kind] = bs;
+
+		if (GNET_PROPERTY(upload_debug)) {
+			g_debug("%s(): %s snapshot is %s byte%s",
+				G_STRFUNC, bh_snapshot_name[sb->kind],
+				uint64_to_string(bs->size), plural(bs->size));
+		}
+	} else {
+		bh_snapshot_unlink(sb->path);
+	}
+
+	HFREE_NULL(sb->path);
+}
+
+/**
+ * Compress generated data into the snapshot file.
+ *
+ * @param sb		the snapshot building context
+ * @param len		amount of data in the input buffer
+ * @param final		whether this is the end of the data
+ *
+ * @return TRUE if OK.
+ */
+static bool
+bh_snapshot_deflate(struct bh_snapshot_build *sb, size_t len, bool final)
+{
+	z_streamp z = &sb->z;
+
+	g_assert(len <= sizeof sb->ibuf);
+
+	z->next_in = (void *) sb->ibuf;
+	z->avail_in = len;
+
+	for (;;) {
+		size_t n;
+		int ret;
+
+		z->next_out = (void *) sb->obuf;
+		z->avail_out = sizeof sb->obuf;
+
+		ret = deflate(z, final ? Z_FINISH : Z_NO_FLUSH);
+
+		if (Z_OK != ret && Z_STREAM_END != ret && Z_BUF_ERROR != ret) {
+			g_warning("%s(): deflate() failed: %s",
+				G_STRFUNC, zlib_strerror(ret));
+			return FALSE;
+		}
+
+		n = sizeof sb->obuf - z->avail_out;
+
+		if (0 != n && UNSIGNED(write(sb->fd, sb->obuf, n)) != n) {
+			g_warning("%s(): cannot write to \"%s\": %m", G_STRFUNC, sb->path);
+			return FALSE;
+		}
+
+		sb->size += n;
+
+		if (final) {
+			if (Z_STREAM_END == ret)
+				break;
+		} else if (0 == z->avail_in && 0 != z->avail_out) {
+			break;
+		}
+	}
+
+	return TRUE;
+}
+
+/**
+ * Background task step: generate and compress all the snapshots in turn.
+ */
+static bgret_t
+bh_snapshot_build_step(bgtask_t *unused_bt, void *data, int ticks)
+{
+	struct bh_snapshot_build *sb = data;
+	int i;
+
+	bh_snapshot_build_check(sb);
+	(void) unused_bt;
+
+	for (i = 0; i < ticks; i++) {
+		ssize_t r;
+
+		if (-1 == sb->fd && !bh_snapshot_build_open(sb))
+			return BGR_ERROR;
+
+		r = (*sb->bh.special.read)(&sb->bh.special, ARYLEN(sb->ibuf));
+
+		/*
+		 * Abort if the library changed whilst we were building: the
+		 * data we generated so far are no longer accurate.
+		 */
+
+		if (
+			sb->generation != bh_snapshot_generation ||
+			GNET_PROPERTY(library_rebuilding)
+		)
+			return BGR_ERROR;
+
+		if (r < 0 || !bh_snapshot_deflate(sb, r, 0 == r))
+			return BGR_ERROR;
+
+		if (0 == r) {
+			bh_snapshot_build_close(sb, TRUE);
+			if (++sb->kind >= BH_SNAP_COUNT)
+				return BGR_NEXT;
+		}
+	}
+
+	return BGR_MORE;
+}
+
+/**
+ * Free snapshot building context.
+ */
+static void
+bh_snapshot_build_free(void *data)
+{
+	struct bh_snapshot_build *sb = data;
+
+	bh_snapshot_build_check(sb);
+
+	bh_snapshot_build_close(sb, FALSE);
+	sb->magic = 0;
+	WFREE(sb);
+}
+
+/**
+ * Called when snapshot building is done.
+ */
+static void
+bh_snapshot_build_done(bgtask_t *bt, void *data,
+	bgstatus_t status, void *unused_arg)
+{
+	struct bh_snapshot_build *sb = data;
+
+	bh_snapshot_build_check(sb);
+	(void) unused_arg;
+
+	g_assert(bt == bh_snapshot_task);
+
+	bh_snapshot_task = NULL;
+
+	if (GNET_PROPERTY(upload_debug)) {
+		g_debug("%s(): browse host snapshots %s",
+			G_STRFUNC, bgstatus_to_string(status));
+	}
+
+	/*
+	 * If the library changed whilst we were building, we'll be
+	 * rescheduled when it is rebuilt.
+	 */
+}
+
+/**
+ * Callout queue callback to launch snapshot building.
+ */
+static void
+bh_snapshot_build_launch(cqueue_t *cq, void *unused_obj)
+{
+	static const bgstep_cb_t step[] = { bh_snapshot_build_step };
+	struct bh_snapshot_build *sb;
+
+	(void) unused_obj;
+	cq_zero(cq, &bh_snapshot_ev);
+
+	if (
+		bh_snapshot_task != NULL ||
+		NULL == bh_snapshot_dir ||
+		GNET_PROPERTY(library_rebuilding)
+	)
+		return;
+
+	WALLOC0(sb);
+	sb->magic = BH_SNAPSHOT_BUILD_MAGIC;
+	sb->fd = -1;
+	sb->generation = bh_snapshot_generation;
+
+	bh_snapshot_task = bg_task_create_stopped(NULL, "Browse Host snapshot",
+		step, N_ITEMS(step), sb, bh_snapshot_build_free,
+		bh_snapshot_build_done, NULL);
+
+	if (NULL == bh_snapshot_task) {
+		bh_snapshot_build_free(sb);		/* Shutdowning */
+		return;
+	}
+
+	bg_task_run(bh_snapshot_task);
+}
+
+/**
+ * Schedule snapshot building.
+ */
+static void
+bh_snapshot_schedule(void)
+{
+	if (NULL == bh_snapshot_ev) {
+		bh_snapshot_ev = cq_main_insert(BH_SNAPSHOT_DELAY,
+			bh_snapshot_build_launch, NULL);
+	}
+}
+
+/**
+ * Signal that the library content changed, making current snapshots stale.
+ *
+ * New snapshots are built after some delay, which is restarted at each call
+ * so that bursts of changes only trigger one rebuild.
+ */
+void
+browse_host_library_changed(void)
+{
+	bh_snapshot_generation++;
+	bh_snapshot_invalidate();
+	cq_cancel(&bh_snapshot_ev);
+
+	if (!GNET_PROPERTY(library_rebuilding))
+		bh_snapshot_schedule();
+}
+
+/**
+ * Property listener invoked when the library starts or stops being rebuilt.
+ */
+static bool
+bh_library_rebuilding_changed(property_t unused_prop)
+{
+	(void) unused_prop;
+
+	browse_host_library_changed();
+	return FALSE;
+}
+
+/**
+ * Remove all the snapshot files left over in the directory, from a
+ * previous session.
+ */
+static void
+bh_snapshot_cleanup(const char *dir)
+{
+	DIR *d;
+	struct dirent *dentry;
+
+	d = opendir(dir);
+	if (NULL == d) {
+		g_warning("can't open directory %s: %m", dir);
+		return;
+	}
+
+	while (NULL != (dentry = readdir(d))) {
+		const char *filename = dir_entry_filename(dentry);
+		char *pathname;
+
+		if ('.' == filename[0])
+			continue;
+
+		pathname = make_pathname(dir, filename);
+		bh_snapshot_unlink(pathname);
+		HFREE_NULL(pathname);
+	}
+
+	closedir(d);
+}
+
+/**
+ * Initialize Browse Host snapshots.
+ */
+void
+bh_upload_init(void)
+{
+	char *dir;
+
+	dir = make_pathname(settings_config_dir(), BH_SNAPSHOT_DIR);
+
+	if (is_directory(dir)) {
+		bh_snapshot_cleanup(dir);
+	} else if (0 != create_directory(dir, DEFAULT_DIRECTORY_MODE)) {
+		g_warning("%s(): cannot create %s: %m -- no browse host snapshots",
+			G_STRFUNC, dir);
+		HFREE_NULL(dir);
+	}
+
+	bh_snapshot_dir = dir;
+
+	gnet_prop_add_prop_changed_listener(PROP_LIBRARY_REBUILDING,
+		bh_library_rebuilding_changed, TRUE);
+}
+
+/**
+ * Shutdown Browse Host snapshots, removing their files.
+ */
+void
+bh_upload_close(void)
+{
+	gnet_prop_remove_prop_changed_listener(PROP_LIBRARY_REBUILDING,
+		bh_library_rebuilding_changed);
+
+	cq_cancel(&bh_snapshot_ev);
+
+	if (bh_snapshot_task != NULL)
+		bg_task_cancel(bh_snapshot_task);
+
+	g_assert(NULL == bh_snapshot_task);	/* Cancellation was synchronous */
+
+	bh_snapshot_invalidate();
+	HFREE_NULL(bh_snapshot_dir);
+}
+
 /* vi: set ts=4 sw=4 cindent: */
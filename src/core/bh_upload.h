@@ -58,6 +58,7 @@ enum {
 	BH_F_DEFLATE = 1 << 0		/**< Deflate output */
 };
 
+struct bh_snapshot;
 struct gnutella_host;
 struct tx_deflate_cb;
 struct tx_link_cb;
@@ -72,6 +73,17 @@ struct special_upload *browse_host_open(
 	struct wrap_io *wio,
 	int flags);
 
+struct bh_snapshot *browse_host_snapshot_get(int flags);
+void browse_host_snapshot_release(struct bh_snapshot **bs_ptr);
+const char *browse_host_snapshot_path(const struct bh_snapshot *bs);
+filesize_t browse_host_snapshot_size(const struct bh_snapshot *bs);
+void browse_host_snapshot_sending(const struct bh_snapshot *bs);
+void browse_host_snapshot_served(const struct bh_snapshot *bs);
+void browse_host_library_changed(void);
+
+void bh_upload_init(void);
+void bh_upload_close(void);
+
 #endif /* _core_bh_upload_h_ */
 
 /* vi: set ts=4 sw=4 cindent: */
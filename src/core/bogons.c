@@ -43,6 +43,7 @@
 #include "lib/iprange.h"
 #include "lib/parse.h"
 #include "lib/path.h"
+#include "lib/rwlock.h"
 #include "lib/str.h"
 #include "lib/tm.h"
 #include "lib/walloc.h"
@@ -59,6 +60,29 @@ static const char bogons_what[] = "Bogus IP addresses";
 static struct iprange_db *bogons_db; /**< The database of bogus CIDR ranges */
 static time_t bogons_mtime;			 /**< Modification time of loaded file */
 
+/*
+ * Query hits are checked by worker threads, so lookups may run concurrently
+ * with the reloading of the database, which happens in the main thread.
+ */
+static rwlock_t bogons_lock = RWLOCK_INIT;
+
+/**
+ * Install new database, freeing the previous one.
+ */
+static void
+bogons_install(struct iprange_db *db, time_t mtime)
+{
+	struct iprange_db *old;
+
+	rwlock_wlock(&bogons_lock);
+	old = bogons_db;
+	bogons_db = db;
+	bogons_mtime = mtime;
+	rwlock_wunlock(&bogons_lock);
+
+	iprange_free(&old);
+}
+
 /**
  * Load bogons data from the supplied FILE.
  *
@@ -73,12 +97,15 @@ bogons_load(FILE *f)
 	int bits;
 	iprange_err_t error;
 	filestat_t buf;
+	struct iprange_db *db;
+	time_t mtime = 0;
+	unsigned count;
 
-	bogons_db = iprange_new();
+	db = iprange_new();
 	if (-1 == fstat(fileno(f), &buf)) {
 		g_warning("cannot stat %s: %m", bogons_file);
 	} else {
-		bogons_mtime = buf.st_mtime;
+		mtime = buf.st_mtime;
 	}
 
 	while (fgets(ARYLEN(line), f)) {
@@ -104,7 +131,7 @@ bogons_load(FILE *f)
 		}
 
 		bits = netmask_to_cidr(netmask);
-		error = iprange_add_cidr(bogons_db, ip, bits, 1);
+		error = iprange_add_cidr(db, ip, bits, 1);
 
 		switch (error) {
 		case IPR_ERR_OK:
@@ -118,15 +145,17 @@ bogons_load(FILE *f)
 		}
 	}
 
-	iprange_sync(bogons_db);
+	iprange_sync(db);
+	count = iprange_get_item_count(db);
 
 	if (GNET_PROPERTY(reload_debug)) {
 		g_debug("loaded %u bogus IP ranges (%u hosts)",
-			iprange_get_item_count(bogons_db),
-			iprange_get_host_count4(bogons_db));
+			count, iprange_get_host_count4(db));
 	}
 
-	return iprange_get_item_count(bogons_db);
+	bogons_install(db, mtime);
+
+	return count;
 }
 
 /**
@@ -146,7 +175,6 @@ bogons_changed(const char *filename, void *unused_udata)
 	if (f == NULL)
 		return;
 
-	bogons_close();
 	count = bogons_load(f);
 	fclose(f);
 
@@ -208,7 +236,7 @@ bogons_init(void)
 void
 bogons_close(void)
 {
-	iprange_free(&bogons_db);
+	bogons_install(NULL, 0);
 }
 
 /**
@@ -219,8 +247,14 @@ bogons_close(void)
 bool
 bogons_check(const host_addr_t ha)
 {
-	if G_UNLIKELY(NULL == bogons_db)
-		return FALSE;
+	bool bogus;
+
+	rwlock_rlock(&bogons_lock);
+
+	if G_UNLIKELY(NULL == bogons_db) {
+		bogus = FALSE;
+		goto done;
+	}
 
 	/*
 	 * If the bogons file is too ancient, there is a risk it may flag an
@@ -230,9 +264,13 @@ bogons_check(const host_addr_t ha)
 	 */
 
 	if (delta_time(tm_time(), bogons_mtime) > 15552000)	/* ~6 months */
-		return !host_addr_is_routable(ha);
+		bogus = !host_addr_is_routable(ha);
+	else
+		bogus = 0 != iprange_get_addr(bogons_db, ha);
 
-	return 0 != iprange_get_addr(bogons_db, ha);
+done:
+	rwlock_runlock(&bogons_lock);
+	return bogus;
 }
 
 /* vi: set ts=4 sw=4 cindent: */
@@ -294,6 +294,16 @@ bsched_unused(bsched_bws_t bws)
 	return uint64_saturate_sub(unused, bs->bw_urgent);
 }
 
+/**
+ * @return the name of the scheduler, for logging and reporting.
+ */
+const char *
+bsched_name(bsched_bws_t bws)
+{
+	const bsched_t *bs = bsched_get(bws);
+	return bs->name;
+}
+
 uint64
 bsched_bps(bsched_bws_t bws)
 {
@@ -98,6 +98,7 @@
 #include "lib/dualhash.h"
 #include "lib/endian.h"
 #include "lib/entropy.h"
+#include "lib/erbtree.h"
 #include "lib/file.h"
 #include "lib/file_object.h"
 #include "lib/filename.h"
@@ -115,7 +116,6 @@
 #include "lib/magnet.h"
 #include "lib/palloc.h"
 #include "lib/parse.h"
-#include "lib/plist.h"
 #include "lib/pslist.h"
 #include "lib/random.h"
 #include "lib/sequence.h"
@@ -154,6 +154,8 @@
 #define DOWNLOAD_MAX_PROXIES	8		/**< Keep that many recent proxies */
 #define DOWNLOAD_MAX_UDP_PUSH	4		/**< Contact at most 4 hosts */
 #define DOWNLOAD_CONNECT_DELAY	12		/**< Seconds between connections */
+#define DOWNLOAD_SCHED_RECHECK	5		/**< Recheck delay when nothing eligible */
+#define DOWNLOAD_SCHED_IDLE		60		/**< Recheck delay when all paused */
 #define DOWNLOAD_PIPELINE_MSECS	10000	/**< Less than 10 secs away */
 #define DOWNLOAD_FS_SPACE		16384	/**< Min filesystem free space */
 #define DOWNLOAD_PUSH_FREQ		30		/**< Each 30 secs, we allow sending... */
@@ -416,19 +418,16 @@ server_host_info(const struct dl_server *server)
  * This `dl_key' is inserted in the `dl_by_host' hash table were we find a
  * `dl_server' structure describing all the downloads for the given host.
  *
- * All `dl_server' structures are also inserted in the `dl_by_time' struct,
- * where hosts are sorted based on their retry time.
+ * All `dl_server' structures holding waiting downloads are also inserted in
+ * the `dl_by_time' tree, where hosts are sorted based on the time at which
+ * they become eligible for scheduling.
  */
 
 static hikset_t *dl_by_host;
 
-#define DHASH_SIZE	(1UL << 10)	/**< Hash list size, must be a power of 2 */
-#define DHASH_MASK 	(DHASH_SIZE - 1)
-#define DL_HASH(x)	((x) & DHASH_MASK)
-
 static struct {
-	plist_t *servers[DHASH_SIZE];	/**< Lists of servers, by retry time */
-	int change[DHASH_SIZE];			/**< Counts changes to the list */
+	erbtree_t tree;			/**< Servers with waiting downloads, by time */
+	time_t floor;			/**< Earliest allowed deferral, 0 if none */
 } dl_by_time;
 
 /**
@@ -1134,15 +1133,17 @@ dl_retry_cmp(const void *p, const void *q)
 }
 
 /**
- * Compare two `dl_server' structures based on the `retry_after' field.
+ * Compare two `dl_server' structures based on the `sched_time' field.
  * The smaller that time, the smaller the structure is.
  */
 static int
-dl_server_retry_cmp(const void *p, const void *q)
+dl_server_sched_cmp(const void *p, const void *q)
 {
 	const struct dl_server *a = p, *b = q;
+	int c;
 
-	return CMP(a->retry_after, b->retry_after);
+	c = CMP(a->sched_time, b->sched_time);
+	return 0 != c ? c : ptr_cmp(a, b);
 }
 
 /**
@@ -1311,6 +1312,8 @@ download_init(void)
 {
 	dl_by_host = hikset_create_any(
 		offsetof(struct dl_server, key), dl_key_hash, dl_key_eq);
+	erbtree_init(&dl_by_time.tree, dl_server_sched_cmp,
+		offsetof(struct dl_server, sched));
 	dl_by_addr = htable_create_any(dl_addr_hash, NULL, dl_addr_eq);
 	dl_by_guid = htable_create(HASH_KEY_FIXED, GUID_RAW_SIZE);
 	dl_by_id = hikset_create(
@@ -1757,18 +1760,22 @@ buffers_strip_trailing(struct download *d, size_t amount)
 /* ----------------------------------------- */
 
 /**
- * Insert server by retry time into the `dl_by_time' structure.
+ * Compute the time at which the server becomes eligible for scheduling.
+ *
+ * This is the latest of its retry time, of the end of the minimal delay
+ * between two connections and of the time until which it was deferred.
  */
-static void
-dl_by_time_insert(struct dl_server *server)
+static time_t
+dl_server_sched_time(const struct dl_server *server)
 {
-	uint idx = DL_HASH(server->retry_after);
+	time_t t = time_advance(server->last_connect, DOWNLOAD_CONNECT_DELAY);
 
-	g_assert(dl_server_valid(server));
+	if (delta_time(server->retry_after, t) > 0)
+		t = server->retry_after;
+	if (delta_time(server->sched_defer, t) > 0)
+		t = server->sched_defer;
 
-	dl_by_time.change[idx]++;
-	dl_by_time.servers[idx] = plist_insert_sorted(dl_by_time.servers[idx],
-		server, dl_server_retry_cmp);
+	return t;
 }
 
 /**
@@ -1777,12 +1784,76 @@ dl_by_time_insert(struct dl_server *server)
 static void
 dl_by_time_remove(struct dl_server *server)
 {
-	uint idx = DL_HASH(server->retry_after);
+	g_assert(dl_server_valid(server));
 
+	if (server->attrs & DLS_A_SCHEDULED) {
+		erbtree_remove(&dl_by_time.tree, &server->sched);
+		server->attrs &= ~DLS_A_SCHEDULED;
+	}
+}
+
+/**
+ * Update the position of the server in the `dl_by_time' structure.
+ *
+ * Only servers with waiting downloads are kept there, sorted by the time
+ * at which they become eligible for scheduling.
+ */
+static void
+dl_by_time_update(struct dl_server *server)
+{
 	g_assert(dl_server_valid(server));
 
-	dl_by_time.change[idx]++;
-	dl_by_time.servers[idx] = plist_remove(dl_by_time.servers[idx], server);
+	if (0 == server_list_length(server, DL_LIST_WAITING)) {
+		dl_by_time_remove(server);
+		return;
+	}
+
+	if (server->attrs & DLS_A_SCHEDULED) {
+		if (server->sched_time == dl_server_sched_time(server))
+			return;
+		erbtree_remove(&dl_by_time.tree, &server->sched);
+	}
+
+	server->sched_time = dl_server_sched_time(server);
+	erbtree_insert(&dl_by_time.tree, &server->sched);
+	server->attrs |= DLS_A_SCHEDULED;
+}
+
+/**
+ * Defer scheduling of server until the specified time.
+ */
+static void
+dl_by_time_defer(struct dl_server *server, time_t until)
+{
+	server->sched_defer = until;
+	dl_by_time_update(server);
+}
+
+/**
+ * Cancel any deferred scheduling of the server, because something changed
+ * in its waiting list.
+ *
+ * When this happens whilst download_pickup_queued() is running, we only
+ * allow the server to be reconsidered at the next pass.
+ */
+static void
+dl_by_time_wakeup(struct dl_server *server)
+{
+	if (delta_time(server->sched_defer, dl_by_time.floor) > 0)
+		server->sched_defer = dl_by_time.floor;
+
+	dl_by_time_update(server);
+}
+
+/**
+ * Wake up the server of a waiting download which may have become eligible
+ * for scheduling because its flags changed.
+ */
+static void
+download_sched_wakeup(const struct download *d)
+{
+	if (DL_LIST_WAITING == d->list_idx)
+		dl_by_time_wakeup(d->server);
 }
 
 /**
@@ -1852,7 +1923,6 @@ allocate_server(const struct guid *guid, const host_addr_t addr, uint16 port)
 	server->sha1_counts = htable_create(HASH_KEY_FIXED, SHA1_RAW_SIZE);
 
 	hikset_insert_key(dl_by_host, &server->key);
-	dl_by_time_insert(server);
 
 	/*
 	 * If host is reacheable directly, its GUID does not matter much to
@@ -3264,6 +3334,9 @@ server_list_insert_download_sorted(struct dl_server *server, enum dl_list idx,
 
 	server_sha1_count_inc(server, d);
 	list_insert_sorted(server_list_by_index(server, idx), d, dl_retry_cmp);
+
+	if (DL_LIST_WAITING == idx)
+		dl_by_time_wakeup(server);
 }
 
 static void
@@ -3275,6 +3348,9 @@ server_list_append_download(struct dl_server *server, enum dl_list idx,
 
 	server_sha1_count_inc(server, d);
 	list_append(server_list_by_index(server, idx), d);
+
+	if (DL_LIST_WAITING == idx)
+		dl_by_time_wakeup(server);
 }
 
 static void
@@ -3286,6 +3362,9 @@ server_list_prepend_download(struct dl_server *server, enum dl_list idx,
 
 	server_sha1_count_inc(server, d);
 	list_prepend(server_list_by_index(server, idx), d);
+
+	if (DL_LIST_WAITING == idx)
+		dl_by_time_wakeup(server);
 }
 
 static struct download *
@@ -3311,6 +3390,8 @@ server_list_remove_download(struct dl_server *server, enum dl_list idx,
 	list_remove(server->list[idx], d);
 	if (0 == server_list_length(server, idx)) {
 		list_free(&server->list[idx]);
+		if (DL_LIST_WAITING == idx)
+			dl_by_time_remove(server);
 	}
 }
 
@@ -3617,6 +3698,8 @@ download_info_change_all(fileinfo_t *old_fi, fileinfo_t *new_fi)
 		d->flags &= ~DL_F_SUSPENDED;
 		if (new_fi->flags & FI_F_SUSPEND)
 			d->flags |= DL_F_SUSPENDED;
+		else
+			download_sched_wakeup(d);
 
 		if (is_running)
 			download_queue(d, _("Requeued by file info change"));
@@ -4068,9 +4151,8 @@ download_server_retry_after(struct dl_server *server, time_t now, int hold)
 		after = MAX(after, time_advance(now, hold));
 
 	if (server->retry_after != after) {
-		dl_by_time_remove(server);
 		server->retry_after = after;
-		dl_by_time_insert(server);
+		dl_by_time_update(server);
 	}
 }
 
@@ -5333,6 +5415,8 @@ download_info_reget(struct download *d)
 		d->flags |= DL_F_SUSPENDED;
 	if (fi->flags & FI_F_PAUSED)
 		d->flags |= DL_F_PAUSED;
+
+	download_sched_wakeup(d);
 }
 
 /**
@@ -5391,6 +5475,7 @@ queue_suspend_downloads_with_file(fileinfo_t *fi, bool suspend)
 			d->flags |= DL_F_SUSPENDED;		/* Can no longer be scheduled */
 		} else {
 			d->flags &= ~DL_F_SUSPENDED;
+			download_sched_wakeup(d);
 		}
 	}
 	pslist_free_null(&sources);
@@ -6016,6 +6101,7 @@ download_connect(struct download *d)
 			server->hostname, port, SOCK_TYPE_DOWNLOAD, d->cflags | tls);
 	} else {
 		server->last_connect = tm_time();
+		dl_by_time_update(server);
 		s = socket_connect(download_addr(d), port, SOCK_TYPE_DOWNLOAD,
 				d->cflags | tls);
 	}
@@ -6582,187 +6668,207 @@ download_pick_another(const struct download *d)
 }
 
 /**
- * Pick up new downloads from the queue as needed.
+ * Record that something could become eligible at time ``when'', updating
+ * the earliest such time in ``next''.
  */
-static void
-download_pickup_queued(void)
+static inline void
+download_pickup_earliest(time_t *next, time_t when)
 {
-	time_t now = tm_time();
-	uint i;
+	if (delta_time(when, *next) < 0)
+		*next = when;
+}
+
+/**
+ * Select the waiting download to start on a server eligible for scheduling.
+ *
+ * @param server	the server whose waiting list we're scanning
+ * @param now		current time
+ * @param next		where the next time the server should be considered is set
+ *
+ * @return the download to start, NULL if none can be started now.
+ */
+static struct download *
+download_pickup_server(struct dl_server *server, time_t now, time_t *next)
+{
+	list_iter_t *iter;
+	struct download *d = NULL;
+	bool only_special = FALSE;
+	uint n = 0;
+
+	g_assert(dl_server_valid(server));
+	g_assert(server->list[DL_LIST_WAITING]);	/* Since it was scheduled */
 
 	/*
-	 * To select downloads, we iterate over the sorted `dl_by_time' list and
-	 * look for something we could schedule.
-	 *
-	 * Note that we jump from one host to the other, even if we have multiple
-	 * things to schedule on the same host: It's better to spread load among
-	 * all hosts first.
+	 * Paused or suspended downloads wake up their server when they can
+	 * be scheduled again, hence the long default delay, which is only a
+	 * safety net.
 	 */
 
-	for (i = 0; i < DHASH_SIZE; i++) {
-		plist_t *l;
-		int last_change;
+	*next = time_advance(now, DOWNLOAD_SCHED_IDLE);
 
-		if (download_queue_is_frozen())
-			break;
+	if (count_running_on_server(server) >= GNET_PROPERTY(max_host_downloads)) {
+		download_list_send_head_ping(server->list[DL_LIST_WAITING]);
 
-		if (count_running_downloads() >= GNET_PROPERTY(max_downloads))
-			break;
+		/*
+		 * Normally, special downloads are served by remote servents
+		 * regardless of the amount of upload slots or per host
+		 * restrictions (since these downloads are small, usually).
+		 *
+		 * Hence, allow such special downloads to be scheduled even
+		 * if we reached the configured local maximum.
+		 */
 
-		if (!bws_can_connect(SOCK_TYPE_DOWNLOAD))
-			break;
+		only_special = TRUE;
+	}
 
-	retry:
-		l = dl_by_time.servers[i];
-		last_change = dl_by_time.change[i];
+	/*
+	 * OK, select a download within the waiting list, but do not
+	 * remove it yet.  This will be done by download_start().
+	 */
 
-		for (/* NOTHING */; NULL != l; l = plist_next(l)) {
-			struct dl_server *server = l->data;
-			list_iter_t *iter;
-			struct download *d;
-			uint n;
-			bool only_special = FALSE;
+	iter = list_iter_before_head(server->list[DL_LIST_WAITING]);
+	while (list_iter_has_next(iter)) {
+		struct download *cur;
 
-			g_assert(dl_server_valid(server));
+		cur = list_iter_next(iter);
+		download_check(cur);
 
-			if (count_running_downloads() >= GNET_PROPERTY(max_downloads))
-				break;
+		if (cur->flags & (DL_F_SUSPENDED | DL_F_PAUSED))
+			continue;
 
-			/*
-			 * List is sorted, so as soon as we go beyond the current time,
-			 * we can stop.
-			 */
+		if (only_special && !download_is_special(cur)) {
+			download_pickup_earliest(next,
+				time_advance(now, DOWNLOAD_SCHED_RECHECK));
+			continue;
+		}
 
-			if (delta_time(now, server->retry_after) < 0)
-				break;
+		if (download_has_enough_active_sources(cur)) {
+			download_send_head_ping(cur);
+			download_pickup_earliest(next,
+				time_advance(now, DOWNLOAD_SCHED_RECHECK));
+			continue;
+		}
 
-			if (server_list_length(server, DL_LIST_WAITING) == 0)
-				continue;
+		if (
+			delta_time(now, cur->last_update) <=
+				(time_delta_t) cur->timeout_delay
+		) {
+			download_send_head_ping(cur);
+			download_pickup_earliest(next,
+				time_advance(cur->last_update, cur->timeout_delay + 1));
+			continue;
+		}
 
-			if (
-				count_running_on_server(server)
-					>= GNET_PROPERTY(max_host_downloads)
-			) {
-				download_list_send_head_ping(server->list[DL_LIST_WAITING]);
+		/* Note that we skip over paused and suspended downloads */
+		if (delta_time(now, cur->retry_after) < 0) {
+			download_pickup_earliest(next, cur->retry_after);
+			break;	/* List is sorted */
+		}
 
+		if (d) {
+			if ((NULL != d->thex) == (NULL != cur->thex)) {
 				/*
-				 * Normally, special downloads are served by remote servents
-				 * regardless of the amount of upload slots or per host
-				 * restrictions (since these downloads are small, usually).
-				 *
-				 * Hence, allow such special downloads to be scheduled even
-				 * if we reached the configured local maximum.
+				 * Pick the download with the most progress. Otherwise
+				 * we easily end up with dozens of partials from the
+				 * the server.
 				 */
 
-				only_special = TRUE;
+				if (
+					download_total_progress(d)
+						>= download_total_progress(cur)
+				) {
+					download_send_head_ping(cur);
+					continue;
+				}
 			}
 
-			/*
-			 * Avoid hammering servers.  In case we have multiple files queued
-			 * on that server, we must not issue all the requests in a short
-			 * period of time as this can be frowned upon.
-			 */
-
-			if (delta_time(now, server->last_connect) < DOWNLOAD_CONNECT_DELAY)
+			/* Give priority to THEX downloads */
+			if (d->thex && NULL == cur->thex) {
+				download_send_head_ping(cur);
 				continue;
+			}
+		}
 
-			/*
-			 * OK, select a download within the waiting list, but do not
-			 * remove it yet.  This will be done by download_start().
-			 */
-
-			g_assert(server->list[DL_LIST_WAITING]);	/* Since count != 0 */
-
-			n = 0;
-			d = NULL;
-			iter = list_iter_before_head(server->list[DL_LIST_WAITING]);
-			while (list_iter_has_next(iter)) {
-				struct download *cur;
-
-				cur = list_iter_next(iter);
-				download_check(cur);
+		if (d)
+			download_send_head_ping(d);
 
-				if (cur->flags & (DL_F_SUSPENDED | DL_F_PAUSED))
-					continue;
+		d = cur;
 
-				if (only_special && !download_is_special(cur))
-					continue;
+		/*
+		 * If there are a lot of downloads queued at a single server we
+		 * might spend a lot of time scanning the queue of a download
+		 * to pick. Thus limit the amount of items we're going to take
+		 * into account.
+		 */
 
-				if (download_has_enough_active_sources(cur)) {
-					download_send_head_ping(cur);
-					continue;
-				}
+		if (n++ > 100)
+			break;
+	}
+	list_iter_free(&iter);
 
-				if (
-					delta_time(now, cur->last_update) <=
-						(time_delta_t) cur->timeout_delay
-				) {
-					download_send_head_ping(cur);
-					continue;
-				}
+	/*
+	 * Never reconsider the server during the current pass.
+	 */
 
-				/* Note that we skip over paused and suspended downloads */
-				if (delta_time(now, cur->retry_after) < 0)
-					break;	/* List is sorted */
+	if (d != NULL || delta_time(*next, now) <= 0)
+		*next = time_advance(now, 1);
 
-				if (d) {
-					if ((NULL != d->thex) == (NULL != cur->thex)) {
-						/*
-						 * Pick the download with the most progress. Otherwise
-						 * we easily end up with dozens of partials from the
-						 * the server.
-						 */
+	return d;
+}
 
-						if (
-							download_total_progress(d)
-								>= download_total_progress(cur)
-						) {
-							download_send_head_ping(cur);
-							continue;
-						}
-					}
+/**
+ * Pick up new downloads from the queue as needed.
+ */
+static void
+download_pickup_queued(void)
+{
+	time_t now = tm_time();
 
-					/* Give priority to THEX downloads */
-					if (d->thex && NULL == cur->thex) {
-						download_send_head_ping(cur);
-						continue;
-					}
-				}
+	/*
+	 * To select downloads, we look at the head of the `dl_by_time' tree,
+	 * which only holds servers with waiting downloads, sorted by the time
+	 * at which they become eligible for scheduling.
+	 *
+	 * Each server we look at is deferred before we attempt to start any of
+	 * its downloads: to the next pass if we elected something, otherwise to
+	 * the time at which one of its waiting downloads can become eligible.
+	 * Hence the head of the tree is always a server we did not look at yet
+	 * during this pass, even when download_start() ends-up changing the tree,
+	 * and we stop as soon as the head server is not eligible.
+	 *
+	 * Note that we jump from one host to the other, even if we have multiple
+	 * things to schedule on the same host: It's better to spread load among
+	 * all hosts first.
+	 */
 
-				if (d)
-					download_send_head_ping(d);
+	dl_by_time.floor = time_advance(now, 1);
 
-				d = cur;
+	for (;;) {
+		struct dl_server *server;
+		struct download *d;
+		time_t next;
 
-				/*
-				 * If there are a lot of downloads queued at a single server we
-				 * might spend a lot of time scanning the queue of a download
-				 * to pick. Thus limit the amount of items we're going to take
-				 * into account.
-				 */
+		if (download_queue_is_frozen())
+			break;
 
-				if (n++ > 100)
-					break;
-			}
-			list_iter_free(&iter);
+		if (count_running_downloads() >= GNET_PROPERTY(max_downloads))
+			break;
 
-			if (d) {
-				download_start(d, FALSE);
-			}
+		if (!bws_can_connect(SOCK_TYPE_DOWNLOAD))
+			break;
 
+		server = erbtree_head(&dl_by_time.tree);
+		if (NULL == server || delta_time(now, server->sched_time) < 0)
+			break;
 
-			/*
-			 * It's possible that download_start() ended-up changing the
-			 * dl_by_time list we're iterating over.  That's why all changes
-			 * to that list update the dl_by_time_change variable, which we
-			 * snapshot upon entry into the loop.
-			 *		--RAM, 24/08/2002.
-			 */
+		d = download_pickup_server(server, now, &next);
+		dl_by_time_defer(server, next);
 
-			if (last_change != dl_by_time.change[i])
-				goto retry;
-		}
+		if (d != NULL)
+			download_start(d, FALSE);
 	}
+
+	dl_by_time.floor = 0;
 }
 
 /**
@@ -8237,6 +8343,7 @@ download_request_resume(struct download *d)
 	if (!FILE_INFO_FINISHED(d->file_info)) {
 		d->flags &= ~DL_F_PAUSED;
 		file_info_resume(d->file_info);
+		download_sched_wakeup(d);
 		download_resume(d);
 	}
 }
@@ -14070,6 +14177,7 @@ download_connected(struct download *d)
 	}
 
 	server->last_connect = now;
+	dl_by_time_update(server);
 	socket_nodelay(s, TRUE);
 
 	/*
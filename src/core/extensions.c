@@ -41,10 +41,13 @@
 
 #include "lib/ascii.h"
 #include "lib/atoms.h"
+#include "lib/buf.h"
 #include "lib/halloc.h"
 #include "lib/htable.h"
 #include "lib/log.h"
 #include "lib/mempcpy.h"
+#include "lib/mutex.h"
+#include "lib/phash.h"
 #include "lib/str.h"
 #include "lib/stringify.h"
 #include "lib/walloc.h"
@@ -58,63 +61,6 @@
 #define GGEP_MAXLEN	65535		/**< Maximum decompressed length */
 #define GGEP_GROW	512			/**< Minimum chunk growth when resizing */
 
-/**
- * An extension descriptor.
- *
- * The extension block is structured thusly:
- *
- *    - <.................len.......................>
- *    - <..headlen.><..........paylen...............>
- *    - +-----------+-------------------------------+
- *    - |   header  |      extension payload        |
- *    - +-----------+-------------------------------+
- *    - ^           ^
- *    - base        payload
- *
- * The "<headlen>" part is simply "<len>" - "<paylen>" so it is not stored.
- * Likewise, we store only the beginning of the payload, the base can be
- * computed if needed.
- *
- * All those pointers refer DIRECTLY to the message we received, so naturally
- * one MUST NOT alter the data we can read or we would corrupt the messages
- * before forwarding them.
- *
- * There is a slight complication introduced with GGEP extensions, since the
- * data there can be COBS encoded, and even deflated.  Therefore, reading
- * directly data from ext_phys_payload could yield compressed data, not
- * something really usable.
- *
- * Therefore, the extension structure is mostly private, and routines are
- * provided to access the data.  Decompression and decoding of COBS is lazily
- * performed when they wish to access the extension data.
- *
- * The ext_phys_xxx fields refer to the physical information about the
- * extension.  The ext_xxx() routines allow access to the virtual information
- * after decompression and COBS decoding.  Naturally, if the extension is
- * not compressed nor COBS-encoded, the ext_xxx() routine will return the
- * physical data.
- *
- * The structure here refers to the opaque data that is dynamically allocated
- * each time a new extension is found.
- */
-typedef struct extdesc {
-	const char *ext_phys_payload;	/**< Start of payload buffer */
-	const char *ext_payload;		/**< "virtual" payload */
-	uint16 ext_phys_len;		/**< Extension length (header + payload) */
-	uint16 ext_phys_paylen;		/**< Extension payload length */
-	uint16 ext_paylen;			/**< "virtual" payload length */
-	uint16 ext_rpaylen;			/**< Length of buffer for "virtual" payload */
-
-	union {
-		struct {
-			bool extu_cobs;			/**< Payload is COBS-encoded */
-			bool extu_deflate;		/**< Payload is deflated */
-			const char *extu_id;	/**< Extension ID */
-		} extu_ggep;
-	} ext_u;
-
-} extdesc_t;
-
 #define ext_phys_headlen(d)	((d)->ext_phys_len - (d)->ext_phys_paylen)
 #define ext_phys_base(d)	((d)->ext_phys_payload - ext_phys_headlen(d))
 
@@ -132,6 +78,18 @@ typedef struct extdesc {
 
 #define EXT_F_NUL_END		(1 << 0)	/**< Stop at first NUL byte */
 
+/**
+ * Attach the descriptor held in the extension vector entry.
+ *
+ * @return the (uninitialized) descriptor.
+ */
+static inline extdesc_t *
+ext_desc_attach(extvec_t *exv)
+{
+	exv->opaque = &exv->ext_desc;
+	return &exv->ext_desc;
+}
+
 static const char * const extype[] = {
 	"UNKNOWN",					/**< EXT_UNKNOWN */
 	"XML",						/**< EXT_XML */
@@ -325,17 +283,61 @@ rw_is_sorted(const char *name,
 }
 
 /**
+ * Perfect hash table of the GGEP IDs in ggeptable[], keyed by the
+ * phash_string_update() hash of the ID.
+ */
+static phash_t ggep_phash;
+
+/**
+ * Lookup GGEP ID in the perfect hash table.
+ *
+ * @param id		the ID, not necessarily NUL-terminated
+ * @param len		the ID length
+ * @param h			the phash_string_update() hash of the ID
+ * @param retkw		where the static shared string of the ID is returned
+ *
  * @return the GGEP token value upon success, EXT_T_UNKNOWN_GGEP if not found.
  * If keyword was found, its static shared string is returned in `retkw'.
  */
-static ext_token_t
-rw_ggep_screen(char *word, const char **retkw)
+static inline ext_token_t
+rw_ggep_lookup(const char *id, size_t len, uint64 h, const char **retkw)
 {
-	ext_token_t t;
+	size_t i = phash_lookup(&ggep_phash, h);
+
+	if G_LIKELY(i != PHASH_NONE) {
+		const char *name = ggeptable[i].rw_name;
+
+		if (0 == strncmp(name, id, len) && '\0' == name[len]) {
+			*retkw = name;
+			return ggeptable[i].rw_token;
+		}
+	}
+
+	*retkw = NULL;
+	return EXT_T_UNKNOWN_GGEP;
+}
+
+/**
+ * Build the perfect hash table for GGEP IDs.
+ */
+static void G_COLD
+rw_ggep_phash_init(void)
+{
+	uint64 keys[N_ITEMS(ggeptable)];
+	size_t i;
+
+	for (i = 0; i < N_ITEMS(ggeptable); i++) {
+		const char *p;
+		uint64 h = 0;
 
-	t = rw_screen(TRUE, ggeptable, N_ITEMS(ggeptable), word, retkw);
+		for (p = ggeptable[i].rw_name; *p != '\0'; p++)
+			h = phash_string_update(h, *p);
 
-	return (t == EXT_T_UNKNOWN) ? EXT_T_UNKNOWN_GGEP : t;
+		keys[i] = h;
+	}
+
+	if (!phash_build(&ggep_phash, keys, N_ITEMS(keys)))
+		g_error("%s(): GGEP ID hash collision", G_STRFUNC);
 }
 
 /**
@@ -357,6 +359,7 @@ rw_urn_screen(const char *word, const char **retkw)
  ***/
 
 static htable_t *ext_names = NULL;
+static mutex_t ext_names_mtx = MUTEX_INIT;	/* Query hits decoded by workers */
 
 /**
  * Transform the name into a printable form.
@@ -369,6 +372,8 @@ ext_name_atom(const char *name)
 	char *key;
 	char *atom;
 
+	mutex_lock(&ext_names_mtx);
+
 	/*
 	 * Look whether we already known about this name.
 	 */
@@ -376,7 +381,7 @@ ext_name_atom(const char *name)
 	atom = htable_lookup(ext_names, name);
 
 	if (atom != NULL)
-		return atom;
+		goto done;
 
 	/*
 	 * The key is always the raw name we're given.
@@ -391,6 +396,9 @@ ext_name_atom(const char *name)
 
 	htable_insert(ext_names, key, atom);
 
+done:
+	mutex_unlock(&ext_names_mtx);
+
 	return atom;
 }
 
@@ -441,6 +449,7 @@ ext_ggep_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
 		uchar flags;
 		char id[GGEP_F_IDLEN + 1];
 		uint id_len, data_length, i;
+		uint64 h = 0;
 		bool length_ended = FALSE;
 		const char *name;
 		extdesc_t *d;
@@ -466,7 +475,7 @@ ext_ggep_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
 			goto abort;
 
 		/*
-		 * Read ID, and NUL-terminate it.
+		 * Read ID, and NUL-terminate it, computing its hash on the fly.
 		 *
 		 * As a safety precaution, only allow ASCII IDs, and nothing in
 		 * the control space.  It's not really in the GGEP specs, but it's
@@ -480,6 +489,7 @@ ext_ggep_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
 			if (c == '\0' || !isascii(c) || is_ascii_cntrl(c))
 				goto abort;
 			id[i] = c;
+			h = phash_string_update(h, c);
 		}
 		id[i] = '\0';
 
@@ -566,7 +576,7 @@ ext_ggep_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
 		 * OK, at this point we have validated the GGEP header.
 		 */
 
-		WALLOC(d);
+		d = ext_desc_attach(exv);
 
 		d->ext_phys_payload = p;
 		d->ext_phys_paylen = data_length;
@@ -580,8 +590,6 @@ ext_ggep_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
 		} else
 			d->ext_payload = NULL;		/* Will lazily compute, if accessed */
 
-		exv->opaque = d;
-
 		g_assert(ext_phys_headlen(d) >= 0);
 
 		/*
@@ -592,7 +600,7 @@ ext_ggep_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
 		 */
 
 		exv->ext_type = EXT_GGEP;
-		exv->ext_token = rw_ggep_screen(id, &name);
+		exv->ext_token = rw_ggep_lookup(id, id_len, h, &name);
 		exv->ext_name = name;
 
 		if (name != NULL)
@@ -628,7 +636,6 @@ abort:
 
 	while (count--) {
 		exv--;
-		wfree(exv->opaque, sizeof(extdesc_t));
 		exv->opaque = NULL;
 	}
 
@@ -655,14 +662,13 @@ ext_urn_bad_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
 	 * Encapsulate as one big opaque chunk.
 	 */
 
-	WALLOC(d);
+	d = ext_desc_attach(exv);
 
 	d->ext_phys_payload = lastp;
 	d->ext_phys_len = d->ext_phys_paylen = p - lastp;
 	d->ext_payload = d->ext_phys_payload;
 	d->ext_paylen = d->ext_phys_paylen;
 
-	exv->opaque = d;
 	exv->ext_type = EXT_NONE;
 	exv->ext_name = NULL;
 	exv->ext_token = EXT_T_URN_BAD;
@@ -782,7 +788,7 @@ ext_huge_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
 found:
 	g_assert(payload_start);
 
-	WALLOC(d);
+	d = ext_desc_attach(exv);
 
 	d->ext_phys_payload = payload_start;
 	d->ext_phys_paylen = data_length;
@@ -790,7 +796,6 @@ found:
 	d->ext_payload = d->ext_phys_payload;
 	d->ext_paylen = d->ext_phys_paylen;
 
-	exv->opaque = d;
 	exv->ext_type = EXT_HUGE;
 	exv->ext_name = name;
 	exv->ext_token = token;
@@ -831,14 +836,13 @@ ext_xml_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
 	 * We don't analyze the XML, encapsulate as one big opaque chunk.
 	 */
 
-	WALLOC(d);
+	d = ext_desc_attach(exv);
 
 	d->ext_phys_payload = lastp;
 	d->ext_phys_len = d->ext_phys_paylen = p - lastp;
 	d->ext_payload = d->ext_phys_payload;
 	d->ext_paylen = d->ext_phys_paylen;
 
-	exv->opaque = d;
 	exv->ext_type = EXT_XML;
 	exv->ext_name = NULL;
 	exv->ext_token = EXT_T_XML;
@@ -911,14 +915,13 @@ ext_unknown_parse(const char **retp, int len, extvec_t *exv,
 	 * Encapsulate as one big opaque chunk.
 	 */
 
-	WALLOC(d);
+	d = ext_desc_attach(exv);
 
 	d->ext_phys_payload = lastp;
 	d->ext_phys_len = d->ext_phys_paylen = p - lastp;
 	d->ext_payload = d->ext_phys_payload;
 	d->ext_paylen = d->ext_phys_paylen;
 
-	exv->opaque = d;
 	exv->ext_type = EXT_UNKNOWN;
 	exv->ext_name = NULL;
 	exv->ext_token = EXT_T_UNKNOWN;
@@ -970,14 +973,13 @@ ext_none_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
 	 * Encapsulate as one big opaque chunk.
 	 */
 
-	WALLOC(d);
+	d = ext_desc_attach(exv);
 
 	d->ext_phys_payload = lastp;
 	d->ext_phys_len = d->ext_phys_paylen = p - lastp;
 	d->ext_payload = d->ext_phys_payload;
 	d->ext_paylen = d->ext_phys_paylen;
 
-	exv->opaque = d;
 	exv->ext_type = EXT_NONE;
 	exv->ext_name = NULL;
 	exv->ext_token = EXT_T_OVERHEAD;
@@ -1044,7 +1046,6 @@ ext_merge_adjacent(extvec_t *exv, extvec_t *next)
 	g_assert(
 		nd->ext_payload == NULL || nd->ext_payload == nd->ext_phys_payload);
 
-	WFREE(nd);
 	next->opaque = NULL;
 }
 
@@ -2093,15 +2094,16 @@ ext_to_string_buf(const extvec_t *e, char *buf, size_t len)
 }
 
 /**
- * Return small extension description in static buffer.
+ * Return small extension description in thread-private buffer.
  */
 const char *
 ext_to_string(const extvec_t *e)
 {
-	static char buf[80];
+	buf_t *b = buf_private(G_STRFUNC, 80);
+	char *p = buf_data(b);
 
-	ext_to_string_buf(e, ARYLEN(buf));
-	return buf;
+	ext_to_string_buf(e, p, buf_size(b));
+	return p;
 }
 
 /**
@@ -2198,8 +2200,7 @@ ext_prepare(extvec_t *exv, int exvcnt)
 }
 
 /**
- * Reset an extension vector by disposing of the opaque structures
- * and of any allocated "virtual" payload.
+ * Reset an extension vector by disposing of any allocated "virtual" payload.
  */
 void
 ext_reset(extvec_t *exv, int exvcnt)
@@ -2226,7 +2227,6 @@ ext_reset(extvec_t *exv, int exvcnt)
 			d->ext_payload = NULL;
 		}
 
-		WFREE(d);
 		e->opaque = NULL;
 	}
 }
@@ -2260,6 +2260,7 @@ ext_init(void)
 
 	rw_is_sorted("ggeptable", ggeptable, N_ITEMS(ggeptable));
 	rw_is_sorted("urntable", urntable, N_ITEMS(urntable));
+	rw_ggep_phash_init();
 }
 
 /**
@@ -2270,6 +2271,7 @@ ext_close(void)
 {
 	htable_foreach(ext_names, ext_names_kv_free, NULL);
 	htable_free_null(&ext_names);
+	phash_free(&ggep_phash);
 }
 
 /* vi: set ts=4 sw=4 cindent: */
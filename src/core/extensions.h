@@ -165,6 +165,68 @@ typedef enum ext_token {
 #define GGEP_NAME(x) ext_ggep_name(EXT_T_GGEP_ ## x)
 #define GGEP_GTKG_NAME(x) ext_ggep_name(EXT_T_GGEP_GTKG_ ## x)
 
+/**
+ * An extension descriptor.
+ *
+ * The extension block is structured thusly:
+ *
+ *    - <.................len.......................>
+ *    - <..headlen.><..........paylen...............>
+ *    - +-----------+-------------------------------+
+ *    - |   header  |      extension payload        |
+ *    - +-----------+-------------------------------+
+ *    - ^           ^
+ *    - base        payload
+ *
+ * The "<headlen>" part is simply "<len>" - "<paylen>" so it is not stored.
+ * Likewise, we store only the beginning of the payload, the base can be
+ * computed if needed.
+ *
+ * All those pointers refer DIRECTLY to the message we received, so naturally
+ * one MUST NOT alter the data we can read or we would corrupt the messages
+ * before forwarding them.
+ *
+ * There is a slight complication introduced with GGEP extensions, since the
+ * data there can be COBS encoded, and even deflated.  Therefore, reading
+ * directly data from ext_phys_payload could yield compressed data, not
+ * something really usable.
+ *
+ * Therefore, the extension structure is mostly private, and routines are
+ * provided to access the data.  Decompression and decoding of COBS is lazily
+ * performed when they wish to access the extension data.
+ *
+ * The ext_phys_xxx fields refer to the physical information about the
+ * extension.  The ext_xxx() routines allow access to the virtual information
+ * after decompression and COBS decoding.  Naturally, if the extension is
+ * not compressed nor COBS-encoded, the ext_xxx() routine will return the
+ * physical data.
+ *
+ * The structure here refers to the opaque data that is filled each time a
+ * new extension is found.  It is stored in the extension vector entry itself
+ * to avoid any memory allocation during parsing.
+ *
+ * It is private to the extension parser and only defined here so that it
+ * can be embedded in the extension vector: the ext_xxx() accessors must be
+ * used instead of the fields.
+ */
+typedef struct extdesc {
+	const char *ext_phys_payload;	/**< Start of payload buffer */
+	const char *ext_payload;		/**< "virtual" payload */
+	uint16 ext_phys_len;		/**< Extension length (header + payload) */
+	uint16 ext_phys_paylen;		/**< Extension payload length */
+	uint16 ext_paylen;			/**< "virtual" payload length */
+	uint16 ext_rpaylen;			/**< Length of buffer for "virtual" payload */
+
+	union {
+		struct {
+			bool extu_cobs;			/**< Payload is COBS-encoded */
+			bool extu_deflate;		/**< Payload is deflated */
+			const char *extu_id;	/**< Extension ID */
+		} extu_ggep;
+	} ext_u;
+
+} extdesc_t;
+
 /**
  * A public extension descriptor.
  *
@@ -191,7 +253,8 @@ typedef struct extvec {
 	const char *ext_name;	/**< Extension name (may be NULL) */
 	ext_token_t ext_token;	/**< Extension token */
 	ext_type_t ext_type;	/**< Extension type */
-	void *opaque;			/**< Internal information */
+	void *opaque;			/**< Internal information, NULL if unused */
+	extdesc_t ext_desc;		/**< Storage for the internal information */
 } extvec_t;
 
 #define MAX_EXTVEC		32	/**< Maximum amount of extensions in vector */
@@ -69,8 +69,10 @@
 #include "lib/ascii.h"
 #include "lib/atoms.h"
 #include "lib/base32.h"
+#include "lib/bstr.h"
 #include "lib/concat.h"
 #include "lib/crash.h"
+#include "lib/crc.h"
 #include "lib/cstr.h"
 #include "lib/eclist.h"
 #include "lib/endian.h"
@@ -83,6 +85,7 @@
 #include "lib/halloc.h"
 #include "lib/header.h"
 #include "lib/hikset.h"
+#include "lib/hset.h"
 #include "lib/htable.h"
 #include "lib/http_range.h"
 #include "lib/idtable.h"
@@ -90,6 +93,7 @@
 #include "lib/mempcpy.h"
 #include "lib/parse.h"
 #include "lib/path.h"
+#include "lib/pmsg.h"
 #include "lib/pow2.h"
 #include "lib/pslist.h"
 #include "lib/random.h"
@@ -217,6 +221,25 @@ static bool fileinfo_dirty = FALSE;
 static bool can_swarm = FALSE;		/**< Set by file_info_retrieve() */
 static bool can_publish_partial_sha1;
 
+/*
+ * The binary fileinfo store: a checkpoint of all the entries, plus a journal
+ * of the entries changed since that checkpoint was taken.
+ */
+
+static const char file_info_bin_file[] = "fileinfo.bin";
+static const char file_info_bin_what[] = "fileinfo checkpoint";
+static const char file_info_jnl_file[] = "fileinfo.jnl";
+
+#define FI_JNL_MAX				(4 * 1024 * 1024)	/**< Max journal size */
+#define FI_CHECKPOINT_PERIOD	(30 * 60)	/**< Max journal age, in secs */
+
+static hset_t *fi_jnl_pending;		/**< Changed fileinfo, to be journaled */
+static pslist_t *fi_jnl_removed;	/**< GUID atoms of removed entries */
+static int fi_jnl_fd = -1;			/**< Opened journal, -1 if none */
+static size_t fi_jnl_size;			/**< Current journal size */
+static uint64 fi_store_epoch;		/**< Epoch of last checkpoint */
+static time_t fi_checkpoint_time;	/**< Time of last checkpoint */
+
 #define	FILE_INFO_MAGIC32 0xD1BB1ED0U
 #define	FILE_INFO_MAGIC64 0X91E63640U
 
@@ -547,6 +570,10 @@ struct trailer {
 };
 
 static fileinfo_t *file_info_retrieve_binary(const char *pathname);
+static void file_info_journal(fileinfo_t *fi);
+static void file_info_journal_flush(void);
+static void file_info_journal_close(void);
+static void file_info_checkpoint(void);
 static void fi_free(fileinfo_t *fi);
 static void fi_update_seen_on_network(gnet_src_t srcid);
 static const char *file_info_new_outname(const char *dir, const char *name);
@@ -863,7 +890,7 @@ file_info_fd_store_binary(fileinfo_t *fi, const file_object_t *fo)
 	}
 
 	fi->dirty = FALSE;
-	fileinfo_dirty = TRUE;
+	file_info_journal(fi);
 
 	entropy_harvest_time();
 }
@@ -1346,7 +1373,7 @@ file_info_resize(fileinfo_t *fi, filesize_t size)
 
 	if (!(fi->flags & FI_F_TRANSIENT)) {
 		fi->dirty = TRUE;
-		fileinfo_dirty = TRUE;
+		file_info_journal(fi);
 	}
 }
 
@@ -2257,16 +2284,20 @@ eof:
 }
 
 /**
- * Stores a file info record to the config_dir/fileinfo file, and
- * appends it to the output file in question if needed.
+ * Is the file being seeded, and should its entry be persisted?
  */
-static void
-file_info_store_one(FILE *f, fileinfo_t *fi)
+static inline bool
+file_info_is_persisted_seed(const fileinfo_t *fi)
 {
-	slink_t *cl;
-	pslist_t *sl;
-	char *path;
+	return FI_F_SEEDING == ((FI_F_SEEDING | FI_F_NOSHARE) & fi->flags);
+}
 
+/**
+ * Check whether fileinfo must be recorded in the fileinfo database.
+ */
+static bool
+file_info_is_persistent(const fileinfo_t *fi)
+{
 	file_info_check(fi);
 
 	/*
@@ -2276,17 +2307,11 @@ file_info_store_one(FILE *f, fileinfo_t *fi)
 	 * 		--RAM, 2017-10-21
 	 */
 
-	if (FI_F_SEEDING == ((FI_F_SEEDING | FI_F_NOSHARE) & fi->flags))
-		goto persist;		/* Skip trailer writes, of course */
-
-	if (fi->flags & (FI_F_TRANSIENT | FI_F_SEEDING | FI_F_STRIPPED))
-		return;
-
-	if (fi->use_swarming && fi->dirty) {
-		file_info_store_binary(fi, FALSE);
-	}
-
-persist:
+	if (
+		!file_info_is_persisted_seed(fi) &&
+		(fi->flags & (FI_F_TRANSIENT | FI_F_SEEDING | FI_F_STRIPPED))
+	)
+		return FALSE;
 
 	/*
 	 * Keep entries for incomplete or not even started downloads so that the
@@ -2296,10 +2321,59 @@ persist:
 	if (0 == fi->refcount && fi->done == fi->size) {
 		filestat_t st;
 
-		if (-1 == stat(fi->pathname, &st)) {
-			return; 	/* Skip: not referenced, and file no longer exists */
-		}
+		if (-1 == stat(fi->pathname, &st))
+			return FALSE; 	/* Not referenced, and file no longer exists */
+	}
+
+	return TRUE;
+}
+
+/**
+ * Flush the trailer of the output file if the fileinfo is dirty.
+ */
+static void
+file_info_store_trailer(fileinfo_t *fi)
+{
+	file_info_check(fi);
+
+	/*
+	 * Seeded files skip trailer writes, of course.
+	 */
+
+	if (
+		0 == (fi->flags & (FI_F_TRANSIENT | FI_F_SEEDING | FI_F_STRIPPED)) &&
+		fi->use_swarming && fi->dirty
+	) {
+		file_info_store_binary(fi, FALSE);
 	}
+}
+
+/**
+ * Hash table iterator to flush dirty trailers.
+ */
+static void
+file_info_store_trailer_kv(void *value, void *unused_udata)
+{
+	(void) unused_udata;
+
+	file_info_store_trailer(value);
+}
+
+/**
+ * Stores a file info record to the config_dir/fileinfo file, and
+ * appends it to the output file in question if needed.
+ */
+static void
+file_info_store_one(FILE *f, fileinfo_t *fi)
+{
+	slink_t *cl;
+	pslist_t *sl;
+	char *path;
+
+	file_info_store_trailer(fi);
+
+	if (!file_info_is_persistent(fi))
+		return;
 
 	path = filepath_directory(fi->pathname);
 	fprintf(f,
@@ -2357,7 +2431,7 @@ persist:
 	if (FI_F_PAUSED & fi->flags)
 		fputs("PAUS 1\n", f);
 
-	if (FI_F_SEEDING == ((FI_F_SEEDING | FI_F_NOSHARE) & fi->flags))
+	if (file_info_is_persisted_seed(fi))
 		fputs("SEED 1\n", f);
 
 	if (!fi->file_size_known)
@@ -2438,17 +2512,38 @@ file_info_store(void)
 	hikset_foreach(fi_by_outname, file_info_store_list, f);
 
 	file_config_close(f, &fp);
-	fileinfo_dirty = FALSE;
+
+	/*
+	 * The binary checkpoint is written last so that it is not older than
+	 * the ASCII file, and will therefore be preferred at the next startup.
+	 */
+
+	file_info_checkpoint();
 }
 
 /**
  * Store global file information cache if dirty.
+ *
+ * Changed entries are appended to the journal, and the whole set is only
+ * rewritten when the journal has grown too large or is getting old.
+ * Dirty trailers of the output files are flushed as well.
  */
 void
 file_info_store_if_dirty(void)
 {
-	if (fileinfo_dirty)
-		file_info_store();
+	if (fileinfo_dirty) {
+		hikset_foreach(fi_by_outname, file_info_store_trailer_kv, NULL);
+		file_info_journal_flush();
+	}
+
+	if (
+		fi_jnl_size >= FI_JNL_MAX ||
+		(
+			fi_jnl_size != 0 &&
+			delta_time(tm_time(), fi_checkpoint_time) >= FI_CHECKPOINT_PERIOD
+		)
+	)
+		file_info_checkpoint();
 }
 
 /*
@@ -2615,6 +2710,12 @@ file_info_close(void)
 {
 	unsigned i;
 
+	/*
+	 * Changes not yet journaled were persisted by file_info_store().
+	 */
+
+	file_info_journal_close();
+
 	/*
 	 * Freeing callbacks expect that the freeing of the `fi_by_outname'
 	 * table will free the referenced `fi' (since that table MUST contain
@@ -2744,6 +2845,7 @@ transient:
 
 	fi->hashed = TRUE;
     fi->fi_handle = file_info_request_handle(fi);
+	file_info_journal(fi);
 
 	gnet_prop_incr_guint32(PROP_FI_ALL_COUNT);
 
@@ -2769,6 +2871,13 @@ file_info_hash_remove(fileinfo_t *fi)
 			fi->sha1 ? sha1_base32(fi->sha1) : "none");
 	}
 
+	hset_remove(fi_jnl_pending, fi);
+	if (0 == (fi->flags & FI_F_TRANSIENT)) {
+		fi_jnl_removed =
+			pslist_prepend_const(fi_jnl_removed, atom_guid_get(fi->guid));
+		fileinfo_dirty = TRUE;
+	}
+
 	file_info_drop_handle(fi, "Discarding file info");
 	entropy_harvest_single(PTRLEN(fi->guid));
 
@@ -2832,7 +2941,7 @@ file_info_upload_stop(fileinfo_t *fi, const char *reason)
 		}
 
 		file_info_changed(fi);
-		fileinfo_dirty = TRUE;
+		file_info_journal(fi);
 	}
 }
 
@@ -2844,6 +2953,7 @@ file_info_resume(fileinfo_t *fi)
 	if (FI_F_PAUSED & fi->flags) {
 		fi->flags &= ~FI_F_PAUSED;
 		file_info_changed(fi);
+		file_info_journal(fi);
 	}
 }
 
@@ -2855,7 +2965,7 @@ file_info_pause(fileinfo_t *fi)
 	if (!(FI_F_PAUSED & fi->flags)) {
 		fi->flags |= FI_F_PAUSED;
 		file_info_changed(fi);
-		fileinfo_dirty = TRUE;
+		file_info_journal(fi);
 	}
 }
 
@@ -3141,43 +3251,1135 @@ fi_reset_chunks(fileinfo_t *fi)
 		eslist_append(&fi->chunklist, fc);
 	}
 
-	fi->generation = 0;		/* Restarting from scratch... */
-	fi->done = 0;
-	atom_sha1_free_null(&fi->cha1);
+	fi->generation = 0;		/* Restarting from scratch... */
+	fi->done = 0;
+	atom_sha1_free_null(&fi->cha1);
+}
+
+/**
+ * Copy CHUNK info from binary trailer `trailer' into `fi'.
+ */
+static void
+fi_copy_chunks(fileinfo_t *fi, fileinfo_t *trailer)
+{
+	const struct dl_file_chunk *fc;
+
+	file_info_check(fi);
+	file_info_check(trailer);
+	g_assert(0 == eslist_count(&fi->chunklist));
+	g_assert(file_info_check_chunklist(trailer, TRUE));
+
+	fi->generation = trailer->generation;
+	if (trailer->cha1)
+		fi->cha1 = atom_sha1_get(trailer->cha1);
+
+	ESLIST_FOREACH_DATA(&trailer->chunklist, fc) {
+		dl_file_chunk_check(fc);
+		g_assert(fc->from <= fc->to);
+
+		eslist_append(&fi->chunklist, WCOPY(fc));
+	}
+
+	file_info_merge_adjacent(fi); /* Recalculates also fi->done */
+}
+
+/**
+ * Finish loading of a fileinfo record from the database, whose pathname has
+ * been filled in, checking it against the trailer of the file and against
+ * already loaded entries.
+ *
+ * The fileinfo is freed when it must be discarded.
+ *
+ * @param fi			the fileinfo record, which becomes owned by this routine
+ * @param old_filename	if non-NULL, unsanitized name of the file to rename
+ *
+ * @return TRUE if the record was kept.
+ */
+static bool
+file_info_retrieved(fileinfo_t *fi, const char *old_filename)
+{
+	fileinfo_t *dfi;
+	bool upgraded;
+	bool reload_chunks = FALSE;
+
+	/*
+	 * There can't be duplicates!
+	 */
+
+	dfi = hikset_lookup(fi_by_outname, fi->pathname);
+	if (NULL != dfi) {
+		g_warning("discarding DUPLICATE fileinfo entry for \"%s\"",
+			filepath_basename(fi->pathname));
+		goto discard;
+	}
+
+	if (0 == fi->size) {
+		fi->file_size_known = FALSE;
+	}
+
+	/*
+	 * If we deserialized an older version, bring it up to date.
+	 */
+
+	upgraded = fi_upgrade_older_version(fi);
+
+	/*
+	 * If we are processing a file being seeded, skip all the
+	 * CHNK, DONE and trailer consistency checks.
+	 *
+	 * If we are not recovering from a crash, seeded entries are
+	 * discarded.
+	 */
+
+	if (FI_F_SEEDING & fi->flags) {
+		if (crash_was_restarted()) {
+			filestat_t sb;
+
+			if (NULL == fi->sha1) {
+				g_warning("%s(): missing SHA1 for seeded file %s",
+					G_STRFUNC, fi->pathname);
+				goto discard;		/* Fileinfo DB was corrupted, drop seed */
+			}
+
+			if (!file_exists(fi->pathname)) {
+				g_warning("%s(): missing previously seeded file %s",
+					G_STRFUNC, fi->pathname);
+				goto discard;		/* User probably removed the file */
+			}
+
+			if (-1 == stat(fi->pathname, &sb)) {
+				g_warning("%s(): cannot stat seeded file %s: %m",
+					G_STRFUNC, fi->pathname);
+				goto discard;
+			}
+
+			/*
+			 * FIXME:
+			 * Would need to check that the file is still accurate if
+			 * the timestamp was changed since last modification.
+			 * For now just warn.
+			 * 		--RAM, 2017-10-23
+			 */
+
+			if (sb.st_mtime != fi->modified) {
+				bool accepted = huge_cached_is_uptodate(
+						fi->pathname, sb.st_size, sb.st_mtime);
+
+				g_warning("%s(): modified seeded file %s: "
+					"last modified=%lu, file mtime=%lu; %s",
+					G_STRFUNC, fi->pathname,
+					(ulong) fi->modified, (ulong) sb.st_mtime,
+					accepted ? "resetting!" : "discarding!");
+
+				if (!accepted)
+					goto discard;
+
+				/* This stamp is necessary to be able to upload! */
+				fi->modified = sb.st_mtime;
+				fi->stamp = fi->modified;	/* Persist new value */
+			}
+
+			if (fi->tth != NULL)
+				file_info_recomputed_tth_internal(fi, fi->tth, FALSE);
+
+			/* Seeding of file will be resumed */
+			goto ready;
+		}
+
+		if (GNET_PROPERTY(share_debug)) {
+			g_info("SHARE discarding seeded file %s", fi->pathname);
+		}
+
+		/* Drop the seeded file now */
+		goto discard;
+	}
+
+	/*
+	 * Allow reconstruction of missing information: if no CHNK
+	 * entry was found for the file, fake one, all empty, and reset
+	 * DONE and GENR to 0.
+	 *
+	 * If for instance the partition where temporary files are held
+	 * is lost, a single "grep -v ^CHNK fileinfo > fileinfo.new"
+	 * will be enough to restart without losing the collected
+	 * files.
+	 *
+	 *		--RAM, 31/12/2003
+	 */
+
+	if (0 == eslist_count(&fi->chunklist)) {
+		if (fi->file_size_known)
+			g_warning("no CHNK info for \"%s\"", fi->pathname);
+		fi_reset_chunks(fi);
+		reload_chunks = TRUE;	/* Will try to grab from trailer */
+	} else if (!file_info_check_chunklist(fi, FALSE)) {
+		if (fi->file_size_known)
+			g_warning("invalid set of CHNK info for \"%s\"",
+				fi->pathname);
+		fi_reset_chunks(fi);
+		reload_chunks = TRUE;	/* Will try to grab from trailer */
+	}
+
+	g_assert(file_info_check_chunklist(fi, TRUE));
+
+	/*
+	 * If DONE does not match the actual size described by the CHNK
+	 * set, them perhaps the fileinfo database was corrupted?
+	 */
+
+	{
+		filesize_t done = fi->done;
+
+		file_info_merge_adjacent(fi); /* Recalculates also fi->done */
+
+		/*
+		 * If DONE was missing, fi->done will still be 0.
+		 * In that case, we don't really care since we'll have
+		 * recomputed fi->done in the call above.
+		 */
+
+		if (done != 0 && fi->done != done) {
+			g_warning("inconsistent DONE info for \"%s\": "
+				"read %s, computed %s",
+				fi->pathname, filesize_to_string(done),
+				filesize_to_string2(fi->done));
+			reload_chunks = TRUE;	/* Will try to grab from trailer */
+		}
+	}
+
+	/*
+	 * If `old_filename' is not NULL, then we need to rename
+	 * the file bearing that name into the new (sanitized)
+	 * name, making sure there is no filename conflict.
+	 */
+
+	if (NULL != old_filename) {
+		const char *new_pathname;
+		char *old_path;
+		bool renamed = TRUE;
+
+		old_path = filepath_directory(fi->pathname);
+		new_pathname = file_info_new_outname(old_path,
+							filepath_basename(fi->pathname));
+		HFREE_NULL(old_path);
+		if (NULL == new_pathname)
+			goto discard;
+
+		/*
+		 * If fi->done == 0, the file might not exist on disk.
+		 */
+
+		if (-1 == rename(fi->pathname, new_pathname) && 0 != fi->done)
+			renamed = FALSE;
+
+		if (renamed) {
+			g_warning("renamed \"%s\" into sanitized \"%s\"",
+				fi->pathname, new_pathname);
+			atom_str_change(&fi->pathname, new_pathname);
+		} else {
+			g_warning("cannot rename \"%s\" into \"%s\": %m",
+				fi->pathname, new_pathname);
+		}
+		atom_str_free_null(&new_pathname);
+	}
+
+	/*
+	 * Check file trailer information.	The main file is only written
+	 * infrequently and the file's trailer can have more up-to-date
+	 * information.
+	 */
+
+	dfi = file_info_retrieve_binary(fi->pathname);
+
+	/*
+	 * If we resetted the CHNK list above, grab those from the
+	 * trailer: that cannot be worse than having to download
+	 * everything again...  If there was no valid trailer, all the
+	 * data are lost and the whole file will need to be grabbed again.
+	 */
+
+	if (dfi != NULL && reload_chunks) {
+		fi_copy_chunks(fi, dfi);
+		if (0 != eslist_count(&fi->chunklist)) {
+			g_message("recovered %s downloaded bytes "
+				"from trailer of \"%s\"",
+				filesize_to_string(fi->done), fi->pathname);
+		}
+	} else if (reload_chunks)
+		g_warning("lost all CHNK info for \"%s\" -- downloading again",
+			fi->pathname);
+
+	g_assert(file_info_check_chunklist(fi, TRUE));
+
+	/*
+	 * Special treatment for the GUID: if not present, it will be
+	 * added during retrieval, but it will be different for the
+	 * one in the fileinfo DB and the one on disk.  Set `upgraded'
+	 * to signal that, so that we resync the metainfo below.
+	 */
+
+	if (dfi && dfi->guid != fi->guid)		/* They're atoms... */
+		upgraded = TRUE;
+
+	/*
+	 * NOTE: The tigertree data is only stored in the trailer, not
+	 * in the common "fileinfo" file. Therefore, it MUST be fetched
+	 * from "dfi".
+	 */
+
+	if (dfi && dfi->tigertree.leaves && NULL == fi->tigertree.leaves) {
+		file_info_got_tigertree(fi,
+			dfi->tigertree.leaves, dfi->tigertree.num_leaves, FALSE);
+	}
+
+	if (dfi) {
+		fi->modified = dfi->modified;
+	}
+
+	if (NULL == dfi) {
+		if (is_regular(fi->pathname)) {
+			g_warning("got metainfo in fileinfo cache, "
+				"but none in \"%s\"", fi->pathname);
+			upgraded = FALSE;			/* No need to flush twice */
+			file_info_store_binary(fi, TRUE);	/* Create metainfo */
+		} else {
+			file_info_merge_adjacent(fi);		/* Compute fi->done */
+			if (fi->done > 0) {
+				g_warning("discarding cached metainfo for \"%s\": "
+					"file had %s bytes downloaded "
+					"but is now gone!", fi->pathname,
+					filesize_to_string(fi->done));
+				goto discard;
+			}
+		}
+	} else if (dfi->generation > fi->generation) {
+		g_warning("found more recent metainfo in \"%s\"", fi->pathname);
+		fi_free(fi);
+		fi = dfi;
+	} else if (dfi->generation < fi->generation) {
+		g_warning("found OUTDATED metainfo in \"%s\"", fi->pathname);
+		fi_free(dfi);
+		dfi = NULL;
+		upgraded = FALSE;				/* No need to flush twice */
+		file_info_store_binary(fi, TRUE);/* Resync metainfo */
+	} else {
+		g_assert(dfi->generation == fi->generation);
+		fi_free(dfi);
+		dfi = NULL;
+	}
+
+	/*
+	 * Check whether entry is not another's duplicate.
+	 */
+
+	dfi = file_info_lookup_dup(fi);
+
+	if (NULL != dfi) {
+		g_warning("found DUPLICATE entry for \"%s\" "
+			"(%s bytes) with \"%s\" (%s bytes)",
+			fi->pathname, filesize_to_string(fi->size),
+			dfi->pathname, filesize_to_string2(dfi->size));
+		goto discard;
+	}
+
+	/*
+	 * If we had to upgrade the fileinfo, make sure we resync
+	 * the metadata on disk as well.
+	 */
+
+	if (upgraded) {
+		g_warning("flushing upgraded metainfo in \"%s\"", fi->pathname);
+		file_info_store_binary(fi, TRUE);		/* Resync metainfo */
+	}
+
+	file_info_merge_adjacent(fi);
+
+ready:
+
+	file_info_hash_insert(fi);
+
+	if (can_publish_partial_sha1 && fi->sha1 != NULL) {
+		publisher_add(fi->sha1);
+	}
+
+	/*
+	 * We could not add the aliases immediately because the file
+	 * is formatted with ALIA coming before SIZE.  To let fi_alias()
+	 * detect conflicting entries, we need to have a valid fi->size.
+	 * And since the `fi' is hashed, we can detect duplicates in
+	 * the `aliases' list itself as an added bonus.
+	 */
+
+	if (fi->alias) {
+		pslist_t *aliases, *sl;
+
+		/* For efficiency each alias has been prepended to
+		 * the list. To preserve the order between sessions,
+		 * the original list order is restored here. */
+		aliases = pslist_reverse(fi->alias);
+		fi->alias = NULL;
+		PSLIST_FOREACH(aliases, sl) {
+			const char *s = sl->data;
+			fi_alias(fi, s, TRUE);
+			atom_str_free_null(&s);
+		}
+		pslist_free_null(&aliases);
+	}
+
+	return TRUE;
+
+discard:
+	fi_free(fi);
+	return FALSE;
+}
+
+/***
+ *** Binary fileinfo store.
+ ***/
+
+/*
+ * The ASCII fileinfo database must be rewritten entirely each time a single
+ * entry changes, and parsing it back at startup is slow when there are many
+ * downloads.  We therefore also keep a binary checkpoint of all the entries
+ * in "fileinfo.bin", and append each changed entry to "fileinfo.jnl" as it
+ * changes.  The journal is folded into a new checkpoint when it grows too
+ * large or too old, and each time the ASCII file is written.
+ *
+ * Both files start with a magic and the epoch of the checkpoint, followed
+ * by records framed as <u8 type><be32 length><be32 CRC32><payload>.
+ * A journal whose epoch does not match that of the checkpoint is stale and
+ * ignored.  Replay stops at the first torn or corrupted record, which is
+ * what a crash in the middle of an append leaves behind.
+ *
+ * The ASCII file remains the reference for users: should it be more recent
+ * than the checkpoint, e.g. after a manual edit, it is loaded instead.
+ */
+
+#define FI_STORE_MAGIC		"GTKGFIB1"
+#define FI_STORE_MAGIC_LEN	(sizeof(FI_STORE_MAGIC) - 1)
+#define FI_STORE_HDR_LEN	(FI_STORE_MAGIC_LEN + 8)	/* Magic + epoch */
+#define FI_RECORD_HDR_LEN	9		/* Type + length + CRC32 */
+
+enum fi_record_type {
+	FI_RECORD_UPDATE = 1,			/**< Full fileinfo entry */
+	FI_RECORD_REMOVE = 2			/**< GUID of removed entry */
+};
+
+/*
+ * Flags in update records.
+ */
+
+#define FI_RECORD_F_PAUSED		(1U << 0)
+#define FI_RECORD_F_SEEDING		(1U << 1)
+#define FI_RECORD_F_FSKN		(1U << 2)	/**< file_size_known */
+#define FI_RECORD_F_SWARM		(1U << 3)	/**< use_swarming */
+#define FI_RECORD_F_SHA1		(1U << 4)
+#define FI_RECORD_F_TTH			(1U << 5)
+#define FI_RECORD_F_CHA1		(1U << 6)
+
+#define FI_ULE64_MAXLEN			10	/**< Max length of an ule64 integer */
+
+/**
+ * Serialize fileinfo as the payload of an update record.
+ *
+ * @return new message holding the payload, to be freed via pmsg_free().
+ */
+static pmsg_t *
+fi_record_make(const fileinfo_t *fi)
+{
+	size_t len, plen, aliases = 0;
+	const slink_t *cl;
+	const pslist_t *sl;
+	pmsg_t *mb;
+	uint8 flags = 0;
+
+	file_info_check(fi);
+
+	/*
+	 * Compute an upper bound of the serialized size.
+	 */
+
+	plen = strlen(fi->pathname);
+	len = GUID_RAW_SIZE + FI_ULE64_MAXLEN + plen + 4 + 1 +
+		2 * SHA1_RAW_SIZE + TTH_RAW_SIZE + 5 * 8 + 2 * FI_ULE64_MAXLEN;
+
+	PSLIST_FOREACH(fi->alias, sl) {
+		const char *alias = sl->data;
+
+		if (looks_like_urn(alias))
+			continue;
+		len += FI_ULE64_MAXLEN + strlen(alias);
+		aliases++;
+	}
+
+	len += eslist_count(&fi->chunklist) * (2 * FI_ULE64_MAXLEN + 1);
+
+	if (FI_F_PAUSED & fi->flags)
+		flags |= FI_RECORD_F_PAUSED;
+	if (file_info_is_persisted_seed(fi))
+		flags |= FI_RECORD_F_SEEDING;
+	if (fi->file_size_known)
+		flags |= FI_RECORD_F_FSKN;
+	if (fi->use_swarming)
+		flags |= FI_RECORD_F_SWARM;
+	if (fi->sha1 != NULL)
+		flags |= FI_RECORD_F_SHA1;
+	if (fi->tth != NULL)
+		flags |= FI_RECORD_F_TTH;
+	if (fi->cha1 != NULL)
+		flags |= FI_RECORD_F_CHA1;
+
+	mb = pmsg_new(PMSG_P_DATA, NULL, len);
+
+	pmsg_write(mb, fi->guid, GUID_RAW_SIZE);
+	pmsg_write_string(mb, fi->pathname, plen);
+	pmsg_write_be32(mb, fi->generation);
+	pmsg_write_u8(mb, flags);
+
+	if (fi->sha1 != NULL)
+		pmsg_write(mb, fi->sha1, SHA1_RAW_SIZE);
+	if (fi->tth != NULL)
+		pmsg_write(mb, fi->tth, TTH_RAW_SIZE);
+	if (fi->cha1 != NULL)
+		pmsg_write(mb, fi->cha1, SHA1_RAW_SIZE);
+
+	pmsg_write_be64(mb, fi->size);
+	pmsg_write_be64(mb, fi->done);
+	pmsg_write_be64(mb, fi->stamp);
+	pmsg_write_be64(mb, fi->created);
+	pmsg_write_be64(mb, fi->ntime);
+
+	pmsg_write_ule64(mb, aliases);
+	PSLIST_FOREACH(fi->alias, sl) {
+		const char *alias = sl->data;
+
+		if (!looks_like_urn(alias))
+			pmsg_write_string(mb, alias, strlen(alias));
+	}
+
+	/*
+	 * Chunks are contiguous, so we only need to record their length.
+	 */
+
+	pmsg_write_ule64(mb, eslist_count(&fi->chunklist));
+	ESLIST_FOREACH(&fi->chunklist, cl) {
+		const struct dl_file_chunk *fc = eslist_data(&fi->chunklist, cl);
+
+		dl_file_chunk_check(fc);
+		pmsg_write_ule64(mb, fc->to - fc->from);
+		pmsg_write_u8(mb, fc->status);
+	}
+
+	return mb;
+}
+
+/**
+ * Deserialize the payload of an update record.
+ *
+ * As in the ASCII database, aliases are only prepended to the list, to be
+ * properly recorded by file_info_retrieved().
+ *
+ * @param data		the record payload
+ * @param len		length of the payload
+ * @param quiet		whether to stay silent about damaged records
+ *
+ * @return new fileinfo, NULL if the record was damaged.
+ */
+static fileinfo_t *
+fi_record_read(const void *data, size_t len, bool quiet)
+{
+	bstr_t *bs;
+	fileinfo_t *fi;
+	struct guid guid;
+	struct sha1 sha1;
+	struct tth tth;
+	char *s;
+	uint32 generation;
+	uint64 size, done, stamp, created, ntime, count, i;
+	uint8 flags;
+
+	bs = bstr_open(data, len, 0);
+	fi = file_info_allocate();
+
+	if (!bstr_read(bs, VARLEN(guid)))
+		goto damaged;
+
+	fi->guid = atom_guid_get(&guid);
+
+	if (!bstr_read_string(bs, NULL, &s))
+		goto damaged;
+
+	if (!is_absolute_path(s)) {
+		HFREE_NULL(s);
+		goto damaged;
+	}
+
+	fi->pathname = atom_str_get(s);
+	HFREE_NULL(s);
+
+	if (!bstr_read_be32(bs, &generation) || !bstr_read_u8(bs, &flags))
+		goto damaged;
+
+	fi->generation = generation;
+
+	if (flags & FI_RECORD_F_SHA1) {
+		if (!bstr_read(bs, VARLEN(sha1)))
+			goto damaged;
+		fi->sha1 = atom_sha1_get(&sha1);
+	}
+	if (flags & FI_RECORD_F_TTH) {
+		if (!bstr_read(bs, VARLEN(tth)))
+			goto damaged;
+		fi->tth = atom_tth_get(&tth);
+	}
+	if (flags & FI_RECORD_F_CHA1) {
+		if (!bstr_read(bs, VARLEN(sha1)))
+			goto damaged;
+		fi->cha1 = atom_sha1_get(&sha1);
+	}
+
+	if (
+		!bstr_read_be64(bs, &size) || !bstr_read_be64(bs, &done) ||
+		!bstr_read_be64(bs, &stamp) || !bstr_read_be64(bs, &created) ||
+		!bstr_read_be64(bs, &ntime)
+	)
+		goto damaged;
+
+	if (size >= ((uint64) 1UL << 63) || done > size)
+		goto damaged;
+
+	fi->size = size;
+	fi->done = done;
+	fi->stamp = stamp;
+	fi->modified = stamp;		/* Until we know better */
+	fi->created = created;
+	fi->ntime = ntime;
+	fi->file_size_known = booleanize(flags & FI_RECORD_F_FSKN);
+	fi->use_swarming = booleanize(flags & FI_RECORD_F_SWARM);
+
+	if (flags & FI_RECORD_F_PAUSED)
+		fi->flags |= FI_F_PAUSED;
+	if (flags & FI_RECORD_F_SEEDING)
+		fi->flags |= FI_F_SEEDING | FI_F_STRIPPED;
+
+	if (!bstr_read_ule64(bs, &count))
+		goto damaged;
+
+	for (i = 0; i < count; i++) {
+		if (!bstr_read_string(bs, NULL, &s))
+			goto damaged;
+		fi->alias = pslist_prepend_const(fi->alias, atom_str_get(s));
+		HFREE_NULL(s);
+	}
+
+	if (!bstr_read_ule64(bs, &count))
+		goto damaged;
+
+	for (i = 0; i < count; i++) {
+		struct dl_file_chunk *fc, *prev;
+		uint64 length;
+		uint8 status;
+		filesize_t from;
+
+		if (!bstr_read_ule64(bs, &length) || !bstr_read_u8(bs, &status))
+			goto damaged;
+
+		prev = eslist_tail(&fi->chunklist);
+		from = NULL == prev ? 0 : prev->to;
+
+		if (0 == length || length > fi->size - from || status > DL_CHUNK_DONE)
+			goto damaged;
+
+		fc = dl_file_chunk_alloc();
+		fc->from = from;
+		fc->to = from + length;
+		fc->status = DL_CHUNK_BUSY == status ? DL_CHUNK_EMPTY : status;
+		eslist_append(&fi->chunklist, fc);
+	}
+
+	bstr_free(&bs);
+	return fi;
+
+damaged:
+	if (!quiet) {
+		g_warning("%s(): damaged fileinfo record for \"%s\"",
+			G_STRFUNC, NULL == fi->pathname ? "?" : fi->pathname);
+	}
+	bstr_free(&bs);
+	fi_free(fi);
+	return NULL;
+}
+
+/**
+ * Fill the header of a record.
+ *
+ * @param hdr		where the FI_RECORD_HDR_LEN header bytes are written
+ * @param type		the record type
+ * @param payload	the record payload
+ * @param len		the payload length
+ */
+static void
+fi_record_header(char *hdr, enum fi_record_type type,
+	const void *payload, size_t len)
+{
+	hdr[0] = type;
+	poke_be32(&hdr[1], len);
+	poke_be32(&hdr[5], crc32_update(0, payload, len));
+}
+
+/**
+ * Fill the header of a store file.
+ */
+static void
+fi_store_header(char *hdr, uint64 epoch)
+{
+	memcpy(hdr, FI_STORE_MAGIC, FI_STORE_MAGIC_LEN);
+	poke_be64(&hdr[FI_STORE_MAGIC_LEN], epoch);
+}
+
+/**
+ * Hash set iterator to write an update record in the checkpoint.
+ */
+static void
+fi_store_checkpoint_one(void *value, void *data)
+{
+	const fileinfo_t *fi = value;
+	FILE *f = data;
+	char hdr[FI_RECORD_HDR_LEN];
+	pmsg_t *mb;
+
+	if (!file_info_is_persistent(fi))
+		return;
+
+	mb = fi_record_make(fi);
+	fi_record_header(hdr, FI_RECORD_UPDATE,
+		pmsg_phys_base(mb), pmsg_written_size(mb));
+	fwrite(hdr, sizeof hdr, 1, f);
+	fwrite(pmsg_phys_base(mb), pmsg_written_size(mb), 1, f);
+	pmsg_free(mb);
+}
+
+/**
+ * Close the journal file, if opened.
+ */
+static void
+fi_jnl_close(void)
+{
+	if (fi_jnl_fd >= 0)
+		fd_close(&fi_jnl_fd);
+}
+
+/**
+ * Forget about the removed entries.
+ */
+static void
+fi_jnl_removed_clear(void)
+{
+	pslist_t *sl;
+
+	PSLIST_FOREACH(fi_jnl_removed, sl) {
+		const struct guid *guid = sl->data;
+		atom_guid_free(guid);
+	}
+	pslist_free_null(&fi_jnl_removed);
+}
+
+/**
+ * Write a checkpoint of all the fileinfo entries, discarding the journal.
+ */
+static void
+file_info_checkpoint(void)
+{
+	FILE *f;
+	file_path_t fp;
+	char hdr[FI_STORE_HDR_LEN];
+	char *path;
+
+	file_path_set(&fp, settings_config_dir(), file_info_bin_file);
+	f = file_config_open_write(file_info_bin_what, &fp);
+
+	if (NULL == f)
+		return;
+
+	fi_store_header(hdr, fi_store_epoch + 1);
+	fwrite(hdr, sizeof hdr, 1, f);
+	hikset_foreach(fi_by_outname, fi_store_checkpoint_one, f);
+
+	if (!file_config_close(f, &fp))
+		return;				/* Keep journaling against the old checkpoint */
+
+	/*
+	 * Now that the new checkpoint is in place, the journal became stale
+	 * since its epoch no longer matches, so removing it is not critical.
+	 */
+
+	fi_store_epoch++;
+	fi_jnl_close();
+
+	path = make_pathname(settings_config_dir(), file_info_jnl_file);
+	if (-1 == unlink(path) && ENOENT != errno)
+		g_warning("%s(): cannot unlink \"%s\": %m", G_STRFUNC, path);
+	HFREE_NULL(path);
+
+	hset_clear(fi_jnl_pending);
+	fi_jnl_removed_clear();
+	fi_jnl_size = 0;
+	fi_checkpoint_time = tm_time();
+	fileinfo_dirty = FALSE;
+}
+
+/**
+ * Append data to the journal.
+ *
+ * Upon error, the journal is closed and flagged as being full, so that a
+ * checkpoint be taken at the next opportunity.
+ *
+ * @return TRUE if OK.
+ */
+static bool
+fi_jnl_write(const void *data, size_t len)
+{
+	ssize_t r;
+
+	g_assert(fi_jnl_fd >= 0);
+
+	r = write(fi_jnl_fd, data, len);
+
+	if (UNSIGNED(r) != len) {
+		if (-1 == r)
+			g_warning("%s(): cannot append to fileinfo journal: %m", G_STRFUNC);
+		else
+			g_warning("%s(): short write to fileinfo journal", G_STRFUNC);
+		fi_jnl_close();
+		fi_jnl_size = FI_JNL_MAX;
+		return FALSE;
+	}
+
+	fi_jnl_size += len;
+	return TRUE;
+}
+
+/**
+ * Make sure the journal is opened for appending.
+ *
+ * @return TRUE if the journal can be written to.
+ */
+static bool
+fi_jnl_open(void)
+{
+	char hdr[FI_STORE_HDR_LEN];
+	char *path;
+
+	if (fi_jnl_fd >= 0)
+		return TRUE;
+
+	/*
+	 * Once closed after an error, the journal is left alone until the
+	 * next checkpoint.
+	 */
+
+	if (fi_jnl_size != 0)
+		return FALSE;
+
+	path = make_pathname(settings_config_dir(), file_info_jnl_file);
+	fi_jnl_fd = file_create(path, O_WRONLY | O_TRUNC | O_APPEND,
+		S_IRUSR | S_IWUSR);
+	HFREE_NULL(path);
+
+	if (fi_jnl_fd < 0)
+		return FALSE;
+
+	fi_store_header(hdr, fi_store_epoch);
+	return fi_jnl_write(hdr, sizeof hdr);
+}
+
+/**
+ * Append a record to the journal.
+ *
+ * @return TRUE if OK.
+ */
+static bool
+fi_jnl_append(enum fi_record_type type, const void *payload, size_t len)
+{
+	char hdr[FI_RECORD_HDR_LEN];
+
+	fi_record_header(hdr, type, payload, len);
+
+	return fi_jnl_write(hdr, sizeof hdr) && fi_jnl_write(payload, len);
+}
+
+/**
+ * Hash set iterator to journal a changed entry.
+ */
+static void
+fi_jnl_flush_one(const void *value, void *data)
+{
+	const fileinfo_t *fi = value;
+	bool *ok = data;
+
+	if (!*ok)
+		return;
+
+	if (file_info_is_persistent(fi)) {
+		pmsg_t *mb = fi_record_make(fi);
+
+		*ok = fi_jnl_append(FI_RECORD_UPDATE,
+				pmsg_phys_base(mb), pmsg_written_size(mb));
+		pmsg_free(mb);
+	} else {
+		*ok = fi_jnl_append(FI_RECORD_REMOVE, fi->guid, GUID_RAW_SIZE);
+	}
+}
+
+/**
+ * Append all the changed entries to the journal.
+ */
+static void
+file_info_journal_flush(void)
+{
+	bool ok = TRUE;
+	pslist_t *sl;
+
+	if (!fi_jnl_open())
+		return;
+
+	/*
+	 * Removals come first: an entry removed and re-inserted under the
+	 * same GUID is also listed in the pending set.
+	 */
+
+	PSLIST_FOREACH(fi_jnl_removed, sl) {
+		if (!fi_jnl_append(FI_RECORD_REMOVE, sl->data, GUID_RAW_SIZE))
+			return;
+	}
+
+	fi_jnl_removed_clear();
+	hset_foreach(fi_jnl_pending, fi_jnl_flush_one, &ok);
+
+	if (ok) {
+		hset_clear(fi_jnl_pending);
+		fileinfo_dirty = FALSE;
+	}
+}
+
+/**
+ * Record that the fileinfo entry changed and needs to be persisted again.
+ */
+static void
+file_info_journal(fileinfo_t *fi)
+{
+	file_info_check(fi);
+
+	fileinfo_dirty = TRUE;
+
+	if (fi->hashed && 0 == (fi->flags & FI_F_TRANSIENT))
+		hset_insert(fi_jnl_pending, fi);
+}
+
+/**
+ * Close the journal, discarding changes that were not flushed yet.
+ */
+static void
+file_info_journal_close(void)
+{
+	fi_jnl_close();
+	fi_jnl_removed_clear();
+	hset_free_null(&fi_jnl_pending);
+}
+
+/**
+ * Read a whole store file.
+ *
+ * @param name		the name of the file in the configuration directory
+ * @param lenp		where the length of the file is written
+ * @param epoch		where the epoch of the file is written
+ *
+ * @return the file data, to be freed via hfree(), NULL if the file is
+ * missing or not a valid store file.
+ */
+static char *
+fi_store_slurp(const char *name, size_t *lenp, uint64 *epoch)
+{
+	char *path, *data = NULL;
+	filestat_t sb;
+	int fd;
+
+	path = make_pathname(settings_config_dir(), name);
+	fd = file_open_missing(path, O_RDONLY);
+
+	if (fd < 0)
+		goto done;
+
+	if (-1 == fstat(fd, &sb)) {
+		g_warning("%s(): cannot stat \"%s\": %m", G_STRFUNC, path);
+		goto done;
+	}
+
+	if ((filesize_t) sb.st_size < FI_STORE_HDR_LEN)
+		goto done;
+
+	data = halloc(sb.st_size);
+
+	if (sb.st_size != read(fd, data, sb.st_size)) {
+		g_warning("%s(): cannot read \"%s\": %m", G_STRFUNC, path);
+		goto failed;
+	}
+
+	if (0 != memcmp(data, FI_STORE_MAGIC, FI_STORE_MAGIC_LEN)) {
+		g_warning("%s(): \"%s\" is not a fileinfo store", G_STRFUNC, path);
+		goto failed;
+	}
+
+	*lenp = sb.st_size;
+	*epoch = peek_be64(&data[FI_STORE_MAGIC_LEN]);
+	goto done;
+
+failed:
+	HFREE_NULL(data);
+	/* FALL THROUGH */
+
+done:
+	fd_close(&fd);
+	HFREE_NULL(path);
+	return data;
+}
+
+/**
+ * Load all the records from a store file into the table indexing the
+ * latest update record by GUID.
+ *
+ * @return TRUE if the whole file was valid.
+ */
+static bool
+fi_store_load(htable_t *ht, const char *data, size_t len)
+{
+	size_t off = FI_STORE_HDR_LEN;
+
+	while (len - off >= FI_RECORD_HDR_LEN) {
+		const char *rec = &data[off];
+		const char *payload = &rec[FI_RECORD_HDR_LEN];
+		uint32 plen = peek_be32(&rec[1]);
+
+		if (
+			plen > len - off - FI_RECORD_HDR_LEN ||
+			plen < GUID_RAW_SIZE ||
+			peek_be32(&rec[5]) != crc32_update(0, payload, plen)
+		)
+			return FALSE;
+
+		switch (rec[0]) {
+		case FI_RECORD_UPDATE:
+			htable_insert_const(ht, payload, rec);
+			break;
+		case FI_RECORD_REMOVE:
+			htable_remove(ht, payload);
+			break;
+		default:
+			return FALSE;
+		}
+
+		off += FI_RECORD_HDR_LEN + plen;
+	}
+
+	return off == len;
 }
 
 /**
- * Copy CHUNK info from binary trailer `trailer' into `fi'.
+ * Table iterator to reload the latest record of each fileinfo entry.
  */
 static void
-fi_copy_chunks(fileinfo_t *fi, fileinfo_t *trailer)
+fi_store_retrieve_one(const void *unused_key, void *value, void *data)
 {
-	const struct dl_file_chunk *fc;
+	const char *rec = value;
+	size_t *kept = data;
+	fileinfo_t *fi;
 
-	file_info_check(fi);
-	file_info_check(trailer);
-	g_assert(0 == eslist_count(&fi->chunklist));
-	g_assert(file_info_check_chunklist(trailer, TRUE));
+	(void) unused_key;
 
-	fi->generation = trailer->generation;
-	if (trailer->cha1)
-		fi->cha1 = atom_sha1_get(trailer->cha1);
+	fi = fi_record_read(&rec[FI_RECORD_HDR_LEN], peek_be32(&rec[1]), FALSE);
 
-	ESLIST_FOREACH_DATA(&trailer->chunklist, fc) {
-		dl_file_chunk_check(fc);
-		g_assert(fc->from <= fc->to);
+	if (fi != NULL && file_info_retrieved(fi, NULL))
+		(*kept)++;
+}
 
-		eslist_append(&fi->chunklist, WCOPY(fc));
+/**
+ * Loads the fileinfo entries from the binary checkpoint and its journal.
+ *
+ * @return TRUE if the binary store was used, FALSE if the ASCII database
+ * must be loaded instead.
+ */
+static bool G_COLD
+file_info_retrieve_store(void)
+{
+	char *bin, *jnl = NULL, *path;
+	size_t bin_len, jnl_len, kept = 0;
+	uint64 bin_epoch, jnl_epoch;
+	filestat_t sb;
+	time_t ascii_mtime = 0;
+	htable_t *ht;
+
+	/*
+	 * The ASCII file is authoritative when it is more recent.
+	 */
+
+	path = make_pathname(settings_config_dir(), file_info_file);
+	if (-1 != stat(path, &sb))
+		ascii_mtime = sb.st_mtime;
+	HFREE_NULL(path);
+
+	path = make_pathname(settings_config_dir(), file_info_bin_file);
+	if (-1 == stat(path, &sb) || delta_time(sb.st_mtime, ascii_mtime) < 0) {
+		HFREE_NULL(path);
+		return FALSE;
 	}
+	HFREE_NULL(path);
 
-	file_info_merge_adjacent(fi); /* Recalculates also fi->done */
+	bin = fi_store_slurp(file_info_bin_file, &bin_len, &bin_epoch);
+	if (NULL == bin)
+		return FALSE;
+
+	ht = htable_create(HASH_KEY_FIXED, GUID_RAW_SIZE);
+
+	if (!fi_store_load(ht, bin, bin_len)) {
+		g_warning("%s(): corrupted fileinfo checkpoint, using \"%s\"",
+			G_STRFUNC, file_info_file);
+		htable_free_null(&ht);
+		HFREE_NULL(bin);
+		return FALSE;
+	}
+
+	fi_store_epoch = bin_epoch;
+	jnl = fi_store_slurp(file_info_jnl_file, &jnl_len, &jnl_epoch);
+
+	if (jnl != NULL) {
+		if (jnl_epoch != bin_epoch) {
+			g_warning("%s(): ignoring stale fileinfo journal", G_STRFUNC);
+		} else if (!fi_store_load(ht, jnl, jnl_len)) {
+			g_warning("%s(): fileinfo journal was truncated", G_STRFUNC);
+		}
+	}
+
+	htable_foreach(ht, fi_store_retrieve_one, &kept);
+
+	if (GNET_PROPERTY(fileinfo_debug)) {
+		g_debug("FILEINFO loaded %zu/%zu entries from binary store "
+			"(journal was %zu bytes)",
+			kept, htable_count(ht), NULL == jnl ? 0 : jnl_len);
+	}
+
+	htable_free_null(&ht);
+	HFREE_NULL(bin);
+	HFREE_NULL(jnl);
+
+	return TRUE;
 }
 
 /**
- * Loads the fileinfo database from disk, and saves a copy in fileinfo.orig.
+ * Loads the ASCII fileinfo database from disk, and saves a copy in
+ * fileinfo.orig.
  */
-void G_COLD
-file_info_retrieve(void)
+static void G_COLD
+file_info_retrieve_ascii(void)
 {
 	FILE *f;
 	char line[1024];
@@ -3189,20 +4391,6 @@ file_info_retrieve(void)
 	const char *path = NULL;
 	const char *filename = NULL;
 
-	/*
-	 * We have a complex interaction here: each time a new entry within the
-	 * download mesh is added, file_info_try_to_swarm_with() will be
-	 * called.	Moreover, the download mesh is initialized before us.
-	 *
-	 * However, we cannot enqueue a download before the download module is
-	 * initialized. And we know it is initialized now because download_init()
-	 * calls us!
-	 *
-	 *		--RAM, 20/08/2002
-	 */
-
-	can_swarm = TRUE;			/* Allows file_info_try_to_swarm_with() */
-
 	file_path_set(&fp, settings_config_dir(), file_info_file);
 	f = file_config_open_read(file_info_what, &fp, 1);
 	if (!f)
@@ -3245,10 +4433,6 @@ file_info_retrieve(void)
 		 */
 
 		if ('\0' == *line && fi) {
-			fileinfo_t *dfi;
-			bool upgraded;
-			bool reload_chunks = FALSE;
-
 			if (filename && path) {
 				char *pathname = make_pathname(path, filename);
 				fi->pathname = atom_str_get(pathname);
@@ -3260,331 +4444,9 @@ file_info_retrieve(void)
 			atom_str_free_null(&filename);
 			atom_str_free_null(&path);
 
-			/*
-			 * There can't be duplicates!
-			 */
-
-			dfi = hikset_lookup(fi_by_outname, fi->pathname);
-			if (NULL != dfi) {
-				g_warning("discarding DUPLICATE fileinfo entry for \"%s\"",
-					filepath_basename(fi->pathname));
-				goto reset;
-			}
-
-			if (0 == fi->size) {
-				fi->file_size_known = FALSE;
-			}
-
-			/*
-			 * If we deserialized an older version, bring it up to date.
-			 */
-
-			upgraded = fi_upgrade_older_version(fi);
-
-			/*
-			 * If we are processing a file being seeded, skip all the
-			 * CHNK, DONE and trailer consistency checks.
-			 *
-			 * If we are not recovering from a crash, seeded entries are
-			 * discarded.
-			 */
-
-			if (FI_F_SEEDING & fi->flags) {
-				if (crash_was_restarted()) {
-					filestat_t sb;
-
-					if (NULL == fi->sha1) {
-						g_warning("%s(): missing SHA1 for seeded file %s",
-							G_STRFUNC, fi->pathname);
-						goto reset;		/* Fileinfo DB was corrupted, drop seed */
-					}
-
-					if (!file_exists(fi->pathname)) {
-						g_warning("%s(): missing previously seeded file %s",
-							G_STRFUNC, fi->pathname);
-						goto reset;		/* User probably removed the file */
-					}
-
-					if (-1 == stat(fi->pathname, &sb)) {
-						g_warning("%s(): cannot stat seeded file %s: %m",
-							G_STRFUNC, fi->pathname);
-						goto reset;
-					}
-
-					/*
-					 * FIXME:
-					 * Would need to check that the file is still accurate if
-					 * the timestamp was changed since last modification.
-					 * For now just warn.
-					 * 		--RAM, 2017-10-23
-					 */
-
-					if (sb.st_mtime != fi->modified) {
-						bool accepted = huge_cached_is_uptodate(
-								fi->pathname, sb.st_size, sb.st_mtime);
-
-						g_warning("%s(): modified seeded file %s: "
-							"last modified=%lu, file mtime=%lu; %s",
-							G_STRFUNC, fi->pathname,
-							(ulong) fi->modified, (ulong) sb.st_mtime,
-							accepted ? "resetting!" : "discarding!");
-
-						if (!accepted)
-							goto reset;
-
-						/* This stamp is necessary to be able to upload! */
-						fi->modified = sb.st_mtime;
-						fi->stamp = fi->modified;	/* Persist new value */
-					}
-
-					if (fi->tth != NULL)
-						file_info_recomputed_tth_internal(fi, fi->tth, FALSE);
-
-					/* Seeding of file will be resumed */
-					goto ready;
-				}
-
-				if (GNET_PROPERTY(share_debug)) {
-					g_info("SHARE discarding seeded file %s", fi->pathname);
-				}
-
-				/* Drop the seeded file now */
-				goto reset;
-			}
-
-			/*
-			 * Allow reconstruction of missing information: if no CHNK
-			 * entry was found for the file, fake one, all empty, and reset
-			 * DONE and GENR to 0.
-			 *
-			 * If for instance the partition where temporary files are held
-			 * is lost, a single "grep -v ^CHNK fileinfo > fileinfo.new"
-			 * will be enough to restart without losing the collected
-			 * files.
-			 *
-			 *		--RAM, 31/12/2003
-			 */
-
-			if (0 == eslist_count(&fi->chunklist)) {
-				if (fi->file_size_known)
-					g_warning("no CHNK info for \"%s\"", fi->pathname);
-				fi_reset_chunks(fi);
-				reload_chunks = TRUE;	/* Will try to grab from trailer */
-			} else if (!file_info_check_chunklist(fi, FALSE)) {
-				if (fi->file_size_known)
-					g_warning("invalid set of CHNK info for \"%s\"",
-						fi->pathname);
-				fi_reset_chunks(fi);
-				reload_chunks = TRUE;	/* Will try to grab from trailer */
-			}
-
-			g_assert(file_info_check_chunklist(fi, TRUE));
-
-			/*
-			 * If DONE does not match the actual size described by the CHNK
-			 * set, them perhaps the fileinfo database was corrupted?
-			 */
-
-			{
-				filesize_t done = fi->done;
-
-				file_info_merge_adjacent(fi); /* Recalculates also fi->done */
-
-				/*
-				 * If DONE was missing, fi->done will still be 0.
-				 * In that case, we don't really care since we'll have
-				 * recomputed fi->done in the call above.
-				 */
-
-				if (done != 0 && fi->done != done) {
-					g_warning("inconsistent DONE info for \"%s\": "
-						"read %s, computed %s",
-						fi->pathname, filesize_to_string(done),
-						filesize_to_string2(fi->done));
-					reload_chunks = TRUE;	/* Will try to grab from trailer */
-				}
-			}
-
-			/*
-			 * If `old_filename' is not NULL, then we need to rename
-			 * the file bearing that name into the new (sanitized)
-			 * name, making sure there is no filename conflict.
-			 */
-
-			if (NULL != old_filename) {
-				const char *new_pathname;
-				char *old_path;
-				bool renamed = TRUE;
-
-				old_path = filepath_directory(fi->pathname);
-				new_pathname = file_info_new_outname(old_path,
-									filepath_basename(fi->pathname));
-				HFREE_NULL(old_path);
-				if (NULL == new_pathname)
-					goto reset;
-
-				/*
-				 * If fi->done == 0, the file might not exist on disk.
-				 */
-
-				if (-1 == rename(fi->pathname, new_pathname) && 0 != fi->done)
-					renamed = FALSE;
-
-				if (renamed) {
-					g_warning("renamed \"%s\" into sanitized \"%s\"",
-						fi->pathname, new_pathname);
-					atom_str_change(&fi->pathname, new_pathname);
-				} else {
-					g_warning("cannot rename \"%s\" into \"%s\": %m",
-						fi->pathname, new_pathname);
-				}
-				atom_str_free_null(&new_pathname);
-			}
-
-			/*
-			 * Check file trailer information.	The main file is only written
-			 * infrequently and the file's trailer can have more up-to-date
-			 * information.
-			 */
-
-			dfi = file_info_retrieve_binary(fi->pathname);
-
-			/*
-			 * If we resetted the CHNK list above, grab those from the
-			 * trailer: that cannot be worse than having to download
-			 * everything again...  If there was no valid trailer, all the
-			 * data are lost and the whole file will need to be grabbed again.
-			 */
-
-			if (dfi != NULL && reload_chunks) {
-				fi_copy_chunks(fi, dfi);
-				if (0 != eslist_count(&fi->chunklist)) {
-					g_message("recovered %s downloaded bytes "
-						"from trailer of \"%s\"",
-						filesize_to_string(fi->done), fi->pathname);
-				}
-			} else if (reload_chunks)
-				g_warning("lost all CHNK info for \"%s\" -- downloading again",
-					fi->pathname);
-
-			g_assert(file_info_check_chunklist(fi, TRUE));
-
-			/*
-			 * Special treatment for the GUID: if not present, it will be
-			 * added during retrieval, but it will be different for the
-			 * one in the fileinfo DB and the one on disk.  Set `upgraded'
-			 * to signal that, so that we resync the metainfo below.
-			 */
-
-			if (dfi && dfi->guid != fi->guid)		/* They're atoms... */
-				upgraded = TRUE;
-
-			/*
-			 * NOTE: The tigertree data is only stored in the trailer, not
-			 * in the common "fileinfo" file. Therefore, it MUST be fetched
-			 * from "dfi".
-			 */
-
-			if (dfi && dfi->tigertree.leaves && NULL == fi->tigertree.leaves) {
-				file_info_got_tigertree(fi,
-					dfi->tigertree.leaves, dfi->tigertree.num_leaves, FALSE);
-			}
-
-			if (dfi) {
-				fi->modified = dfi->modified;
-			}
-
-			if (NULL == dfi) {
-				if (is_regular(fi->pathname)) {
-					g_warning("got metainfo in fileinfo cache, "
-						"but none in \"%s\"", fi->pathname);
-					upgraded = FALSE;			/* No need to flush twice */
-					file_info_store_binary(fi, TRUE);	/* Create metainfo */
-				} else {
-					file_info_merge_adjacent(fi);		/* Compute fi->done */
-					if (fi->done > 0) {
-						g_warning("discarding cached metainfo for \"%s\": "
-							"file had %s bytes downloaded "
-							"but is now gone!", fi->pathname,
-							filesize_to_string(fi->done));
-						goto reset;
-					}
-				}
-			} else if (dfi->generation > fi->generation) {
-				g_warning("found more recent metainfo in \"%s\"", fi->pathname);
-				fi_free(fi);
-				fi = dfi;
-			} else if (dfi->generation < fi->generation) {
-				g_warning("found OUTDATED metainfo in \"%s\"", fi->pathname);
-				fi_free(dfi);
-				dfi = NULL;
-				upgraded = FALSE;				/* No need to flush twice */
-				file_info_store_binary(fi, TRUE);/* Resync metainfo */
-			} else {
-				g_assert(dfi->generation == fi->generation);
-				fi_free(dfi);
-				dfi = NULL;
-			}
-
-			/*
-			 * Check whether entry is not another's duplicate.
-			 */
-
-			dfi = file_info_lookup_dup(fi);
-
-			if (NULL != dfi) {
-				g_warning("found DUPLICATE entry for \"%s\" "
-					"(%s bytes) with \"%s\" (%s bytes)",
-					fi->pathname, filesize_to_string(fi->size),
-					dfi->pathname, filesize_to_string2(dfi->size));
-				goto reset;
-			}
-
-			/*
-			 * If we had to upgrade the fileinfo, make sure we resync
-			 * the metadata on disk as well.
-			 */
-
-			if (upgraded) {
-				g_warning("flushing upgraded metainfo in \"%s\"", fi->pathname);
-				file_info_store_binary(fi, TRUE);		/* Resync metainfo */
-			}
-
-			file_info_merge_adjacent(fi);
-
-		ready:
-
-			file_info_hash_insert(fi);
-
-			if (can_publish_partial_sha1 && fi->sha1 != NULL) {
-				publisher_add(fi->sha1);
-			}
-
-			/*
-			 * We could not add the aliases immediately because the file
-			 * is formatted with ALIA coming before SIZE.  To let fi_alias()
-			 * detect conflicting entries, we need to have a valid fi->size.
-			 * And since the `fi' is hashed, we can detect duplicates in
-			 * the `aliases' list itself as an added bonus.
-			 */
-
-			if (fi->alias) {
-				pslist_t *aliases, *sl;
-
-				/* For efficiency each alias has been prepended to
-				 * the list. To preserve the order between sessions,
-				 * the original list order is restored here. */
-				aliases = pslist_reverse(fi->alias);
-				fi->alias = NULL;
-				PSLIST_FOREACH(aliases, sl) {
-					const char *s = sl->data;
-					fi_alias(fi, s, TRUE);
-					atom_str_free_null(&s);
-				}
-				pslist_free_null(&aliases);
-			}
+			if (file_info_retrieved(fi, old_filename))
+				empty = FALSE;
 
-			empty = FALSE;
 			fi = NULL;
 			continue;
 		}
@@ -3835,6 +4697,37 @@ file_info_retrieve(void)
 	fclose(f);
 }
 
+/**
+ * Loads the fileinfo database from disk.
+ */
+void G_COLD
+file_info_retrieve(void)
+{
+	/*
+	 * We have a complex interaction here: each time a new entry within the
+	 * download mesh is added, file_info_try_to_swarm_with() will be
+	 * called.	Moreover, the download mesh is initialized before us.
+	 *
+	 * However, we cannot enqueue a download before the download module is
+	 * initialized. And we know it is initialized now because download_init()
+	 * calls us!
+	 *
+	 *		--RAM, 20/08/2002
+	 */
+
+	can_swarm = TRUE;			/* Allows file_info_try_to_swarm_with() */
+
+	if (!file_info_retrieve_store())
+		file_info_retrieve_ascii();
+
+	/*
+	 * Loading may have altered entries, which are all journaled anyway
+	 * as they are inserted: start afresh with a new checkpoint.
+	 */
+
+	file_info_checkpoint();
+}
+
 static bool
 file_info_name_is_uniq(const char *pathname)
 {
@@ -4154,7 +5047,7 @@ file_info_moved(fileinfo_t *fi, const char *pathname)
 
 	fi_event_trigger(fi, EV_FI_INFO_CHANGED);
 	file_info_changed(fi);
-	fileinfo_dirty = TRUE;
+	file_info_journal(fi);
 }
 
 /**
@@ -4462,7 +5355,7 @@ file_info_size_unknown(fileinfo_t *fi)
 	if (0 == (fi->flags & FI_F_TRANSIENT)) {
 		file_info_hash_remove_name_size(fi);
 		fi->dirty = TRUE;
-		fileinfo_dirty = TRUE;
+		file_info_journal(fi);
 	}
 
 	fi->file_size_known = FALSE;
@@ -4538,7 +5431,7 @@ file_info_size_known(struct download *d, filesize_t size)
 	fi->use_swarming = TRUE;
 	fi->size = MAX(size, fi->done);
 	fi->dirty = TRUE;
-	fileinfo_dirty = TRUE;
+	file_info_journal(fi);
 
 	if (0 == (FI_F_TRANSIENT & fi->flags)) {
 		file_info_hash_insert_name_size(fi);
@@ -4616,6 +5509,7 @@ status_ok:
 	if (DL_CHUNK_DONE == status) {
 		fi->modified = fi->stamp;
 		fi->dirty = TRUE;
+		file_info_journal(fi);
 	}
 
 again:
@@ -4916,7 +5810,7 @@ restart:
 	}
 
 	file_info_merge_adjacent(fi);
-	fileinfo_dirty = TRUE;
+	file_info_journal(fi);
 }
 
 /**
@@ -8433,6 +9327,7 @@ file_info_init(void)
 						HASH_KEY_FIXED, GUID_RAW_SIZE);
 	fi_by_outname  = hikset_create(offsetof(fileinfo_t, pathname),
 						HASH_KEY_STRING, 0);
+	fi_jnl_pending = hset_create(HASH_KEY_SELF, 0);
 
     fi_handle_map = idtable_new(32);
 
@@ -8480,6 +9375,115 @@ file_info_init_post(void)
 	fi_publish_all();
 }
 
+/**
+ * Append a chunk of given length and status to the fileinfo.
+ */
+static void G_COLD
+file_info_test_chunk(fileinfo_t *fi, filesize_t len, enum dl_chunk_status st)
+{
+	struct dl_file_chunk *fc, *prev;
+
+	prev = eslist_tail(&fi->chunklist);
+	fc = dl_file_chunk_alloc();
+	fc->from = NULL == prev ? 0 : prev->to;
+	fc->to = fc->from + len;
+	fc->status = st;
+	eslist_append(&fi->chunklist, fc);
+}
+
+/**
+ * Check that journal update records are read back as they were written.
+ */
+void G_COLD
+file_info_test(void)
+{
+	fileinfo_t *fi, *rfi;
+	struct guid guid;
+	struct sha1 sha1;
+	struct tth tth;
+	const struct dl_file_chunk *fc, *rfc;
+	pmsg_t *mb;
+	const char *data;
+	size_t len;
+
+	random_bytes(VARLEN(guid));
+	random_bytes(VARLEN(sha1));
+	random_bytes(VARLEN(tth));
+
+	fi = file_info_allocate();
+	fi->guid = atom_guid_get(&guid);
+	fi->pathname = atom_str_get("/tmp/fileinfo-test");
+	fi->generation = 7;
+	fi->sha1 = atom_sha1_get(&sha1);
+	fi->tth = atom_tth_get(&tth);
+	fi->size = 3 * 1024 * 1024 + 17;
+	fi->done = 1024 * 1024;
+	fi->stamp = 1500000000;
+	fi->created = 1400000000;
+	fi->ntime = 1450000000;
+	fi->file_size_known = TRUE;
+	fi->use_swarming = TRUE;
+	fi->flags |= FI_F_PAUSED;
+	fi->alias = pslist_prepend_const(fi->alias, atom_str_get("alias"));
+
+	file_info_test_chunk(fi, 1024 * 1024, DL_CHUNK_DONE);
+	file_info_test_chunk(fi, 1024 * 1024, DL_CHUNK_BUSY);
+	file_info_test_chunk(fi, 1024 * 1024 + 17, DL_CHUNK_EMPTY);
+
+	mb = fi_record_make(fi);
+	data = pmsg_phys_base(mb);
+	len = pmsg_written_size(mb);
+
+	rfi = fi_record_read(data, len, TRUE);
+	g_assert(rfi != NULL);
+
+	g_assert(guid_eq(fi->guid, rfi->guid));
+	g_assert(0 == strcmp(fi->pathname, rfi->pathname));
+	g_assert(fi->generation == rfi->generation);
+	g_assert(sha1_eq(fi->sha1, rfi->sha1));
+	g_assert(tth_eq(fi->tth, rfi->tth));
+	g_assert(NULL == rfi->cha1);
+	g_assert(fi->size == rfi->size);
+	g_assert(fi->done == rfi->done);
+	g_assert(fi->stamp == rfi->stamp);
+	g_assert(fi->created == rfi->created);
+	g_assert(fi->ntime == rfi->ntime);
+	g_assert(rfi->file_size_known);
+	g_assert(rfi->use_swarming);
+	g_assert(FI_F_PAUSED & rfi->flags);
+	g_assert(0 == (FI_F_SEEDING & rfi->flags));
+	g_assert(1 == pslist_length(rfi->alias));
+	g_assert(0 == strcmp("alias", rfi->alias->data));
+	g_assert(eslist_count(&fi->chunklist) == eslist_count(&rfi->chunklist));
+
+	/*
+	 * Busy chunks are read back as empty since no download owns them yet.
+	 */
+
+	rfc = eslist_head(&rfi->chunklist);
+	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
+		g_assert(rfc != NULL);
+		g_assert(fc->from == rfc->from);
+		g_assert(fc->to == rfc->to);
+		g_assert(
+			(DL_CHUNK_BUSY == fc->status ? DL_CHUNK_EMPTY : fc->status) ==
+			rfc->status);
+		rfc = eslist_next_data(&rfi->chunklist, rfc);
+	}
+
+	fi_free(rfi);
+
+	/*
+	 * A truncated record must be rejected.
+	 */
+
+	rfi = fi_record_read(data, len - 1, TRUE);
+	g_assert(NULL == rfi);
+
+	pmsg_free(mb);
+	fi_free(fi);
+}
+
 /*
  * Local Variables:
  * tab-width:4
@@ -109,6 +109,7 @@ void file_info_upload_stop(fileinfo_t *fi, const char *reason);
 void file_info_pause(fileinfo_t *);
 void file_info_resume(fileinfo_t *);
 void file_info_changed(fileinfo_t *);
+void file_info_test(void);
 fileinfo_t *file_info_by_guid(const struct guid *guid);
 void file_info_dht_query(const sha1_t *sha1);
 void file_info_dht_query_queued(fileinfo_t *fi);
@@ -710,6 +710,96 @@ ggep_stream_close(ggep_stream_t *gs)
 	return len;
 }
 
+/**
+ * Close the stream without flagging its last extension, so that the
+ * extensions written can be later appended as-is to another stream via
+ * ggep_stream_append_ext().
+ *
+ * The extensions start right after the leading GGEP magic byte, at the
+ * beginning of the buffer given to ggep_stream_init().
+ *
+ * @param gs		the GGEP stream
+ * @param last		where the offset of the flags of the last extension,
+ *					relative to the first extension, is written
+ *
+ * @return the length of the extensions written, 0 if none.
+ */
+size_t
+ggep_stream_detach(ggep_stream_t *gs, size_t *last)
+{
+	size_t len;
+
+	g_assert(!gs->begun);			/* Not in the middle of an extension! */
+	g_assert(gs->outbuf != NULL);	/* Not closed already */
+	g_assert(last != NULL);
+
+	if (gs->zd != NULL) {
+		zlib_deflater_free(gs->zd, TRUE);
+		gs->zd = NULL;
+	}
+
+	if (gs->last_fp == NULL) {
+		len = *last = 0;
+	} else {
+		g_assert(gs->magic_sent);
+
+		len = gs->o - gs->outbuf - 1;		/* Skip leading magic */
+		*last = gs->last_fp - gs->outbuf - 1;
+	}
+
+	gs->outbuf = NULL;				/* Mark stream as closed */
+
+	g_assert(len <= gs->size);
+	g_assert(0 == len || *last < len);
+
+	return len;
+}
+
+/**
+ * Append extensions which were previously written to another stream and
+ * collected through ggep_stream_detach().
+ *
+ * @param gs		the GGEP stream
+ * @param data		start of the extensions
+ * @param len		length of the extensions
+ * @param last		offset of the flags of the last extension within data
+ *
+ * @return TRUE if written successfully.  On error, the stream is left as
+ * if the write attempt had not taken place.
+ */
+bool
+ggep_stream_append_ext(ggep_stream_t *gs,
+	const void *data, size_t len, size_t last)
+{
+	char *start;
+
+	g_assert(ggep_stream_is_valid(gs));
+	g_assert(!gs->begun);
+	g_assert(0 == len || last < len);
+
+	if (0 == len)
+		return TRUE;
+
+	start = gs->o;
+
+	if (!gs->magic_sent) {
+		if (!ggep_stream_appendc(gs, GGEP_MAGIC))
+			return FALSE;
+	}
+
+	if (!ggep_stream_append(gs, data, len)) {
+		gs->o = start;
+		return FALSE;
+	}
+
+	gs->magic_sent = TRUE;
+	gs->last_fp = gs->o - len + last;
+
+	g_assert(0 == (*gs->last_fp & GGEP_F_LAST));
+
+	return TRUE;
+}
+
 /**
  * The vectorized version of ggep_stream_pack().
  *
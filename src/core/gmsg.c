@@ -53,6 +53,7 @@
 #include "if/dht/kmsg.h"
 #include "if/dht/kademlia.h"
 
+#include "lib/buf.h"
 #include "lib/endian.h"
 #include "lib/omalloc.h"
 #include "lib/once.h"
@@ -1085,6 +1086,85 @@ gmsg_headcmp(const void *h1, const void *h2)
 	return gmsg_cmp_internal(h1, h2, FALSE);
 }
 
+#define GMSG_RANK_WEIGHTS	10	/* Weights range from 0 to 9 */
+#define GMSG_RANK_HOPS		8	/* Hops are clamped to that many levels */
+
+/**
+ * Compute the rank of a message, given as a whole PDU if ``pdu'' is TRUE
+ * or as a mere Gnutella header otherwise.
+ *
+ * The rank is a coarse version of the ordering defined by gmsg_cmp(): the
+ * message weight comes first, then DHT messages are ranked below Gnutella
+ * ones of the same weight, and finally the amount of hops is used, clamped
+ * to GMSG_RANK_HOPS levels.  Messages within the same rank are considered
+ * equivalent by the message queue.
+ *
+ * @return rank between 0 and MQ_RANKS - 1.
+ */
+static uint
+gmsg_rank_internal(const void *h, bool pdu)
+{
+	uint8 f;
+	uint w, hops;
+
+	STATIC_ASSERT(GMSG_RANK_WEIGHTS * 2 * GMSG_RANK_HOPS <= MQ_RANKS);
+
+	f = gnutella_header_get_function(h);
+	w = (f == GTA_MSG_DHT && pdu) ?
+		kmsg_weight[kademlia_header_get_function(h)] : msg_weight[f];
+
+	if (VMSG_W == w && pdu)
+		w = vmsg_weight(gnutella_data(h));
+
+	w = MIN(w, GMSG_RANK_WEIGHTS - 1);
+
+	if (GTA_MSG_DHT == f)
+		return 2 * w * GMSG_RANK_HOPS;
+
+	hops = gnutella_header_get_hops(h);
+	hops = MIN(hops, GMSG_RANK_HOPS - 1);
+
+	/*
+	 * Same as in gmsg_cmp_internal(): the more hops a query has travelled,
+	 * the less prioritary it is, whereas the opposite is true for replies.
+	 */
+
+	switch (f) {
+	case GTA_MSG_INIT:
+	case GTA_MSG_SEARCH:
+	case GTA_MSG_QRP:
+		hops = GMSG_RANK_HOPS - 1 - hops;
+		break;
+	default:
+		break;
+	}
+
+	return (2 * w + 1) * GMSG_RANK_HOPS + hops;
+}
+
+/**
+ * Compute the rank of a message given as a whole PDU, for message queues.
+ *
+ * @return rank between 0 and MQ_RANKS - 1.
+ */
+uint
+gmsg_rank(const void *pdu)
+{
+	return gmsg_rank_internal(pdu, TRUE);
+}
+
+/**
+ * Compute the rank of a message for which we only have a Gnutella header,
+ * for message queues.
+ *
+ * @return rank between 0 and MQ_RANKS - 1.
+ */
+uint
+gmsg_headrank(const void *header)
+{
+	return gmsg_rank_internal(header, FALSE);
+}
+
 /**
  * Vector templates for message queue pruning.
  *
@@ -1395,7 +1475,7 @@ gmsg_infostr(const void *msg)
  * information is also printed if by chance the hop count of the message is 1
  * or 0 (for UDP messages).  Also this routine works for G2 nodes.
  *
- * @returns formatted static string:
+ * @returns formatted thread-private string:
  *
  *     msg_type (payload length) MUID [hops=x, TTL=x]
  *
@@ -1408,20 +1488,22 @@ gmsg_infostr(const void *msg)
 const char *
 gmsg_node_infostr(const gnutella_node_t *n)
 {
-	static char buf[180];
+	buf_t *b = buf_private(G_STRFUNC, 180);
+	char *buf = buf_data(b);
+	size_t len = buf_size(b);
 	uint8 hops;
 	size_t w;
 
 	if (NODE_TALKS_G2(n)) {
-		w = g2_msg_infostr_to_buf(n->data, n->size, ARYLEN(buf));
+		w = g2_msg_infostr_to_buf(n->data, n->size, buf, len);
 		hops = 1;
 	} else {
-		w = gmsg_infostr_to_buf(&n->header, ARYLEN(buf));
+		w = gmsg_infostr_to_buf(&n->header, buf, len);
 		hops = gnutella_header_get_hops(n->header);
 	}
 
 	if (hops <= 1)
-		str_bprintf(ARYPOSLEN(buf, w), " //%s//", node_infostr(n));
+		str_bprintf(&buf[w], len - w, " //%s//", node_infostr(n));
 
 	return buf;
 }
@@ -135,6 +135,8 @@ bool gmsg_is_oob_query(const void *msg);
 bool gmsg_split_is_oob_query(const void *head, const void *data);
 int gmsg_cmp(const void *pdu1, const void *pdu2);
 int gmsg_headcmp(const void *pdu1, const void *pdu2);
+uint gmsg_rank(const void *pdu);
+uint gmsg_headrank(const void *header);
 const char *gmsg_infostr(const void *msg);
 const char *gmsg_node_infostr(const struct gnutella_node *n);
 char *gmsg_infostr_full(const void *msg, size_t msg_len);
@@ -44,37 +44,151 @@
 #include "if/dht/kademlia.h"
 #include "if/gnet_property_priv.h"
 
+#include "lib/atomic.h"
 #include "lib/entropy.h"
 #include "lib/event.h"
+#include "lib/omalloc.h"
 #include "lib/random.h"
 #include "lib/sha1.h"
 #include "lib/spinlock.h"
 #include "lib/thread.h"
 #include "lib/tm.h"
+#include "lib/vmm.h"
+#include "lib/xmalloc.h"
 
 #include "lib/override.h"		/* Must be the last header included */
 
 static uint8 stats_lut[256];
 
-static gnet_stats_t gnet_stats;
-static gnet_stats_t gnet_tcp_stats;
-static gnet_stats_t gnet_udp_stats;
-
 /*
- * Thread-safe locks.
+ * Statistics are accounted in per-thread blocks, so that counting is a plain
+ * increment without any locking, whatever the calling thread.  Each block
+ * spans its own set of pages so that no two threads ever share a cache line.
+ * Blocks are summed up when statistics are read.
  *
- * The general stats accounting code is protected because there is no guarantee
- * the routines updating these stats will always be called from the main thread.
+ * Blocks are never freed: a thread reusing the small ID of a dead thread
+ * keeps accumulating into the same block, hence no count is ever lost.
+ */
+struct gnet_stats_block {
+	gnet_stats_t all;			/**< All the traffic */
+	gnet_stats_t tcp;			/**< TCP traffic only */
+	gnet_stats_t udp;			/**< UDP traffic only */
+};
+
+static struct gnet_stats_block *gnet_stats_blocks[THREAD_MAX];
+
+#define GNET_STATS_WORDS	(sizeof(gnet_stats_t) / sizeof(uint64))
+
+/*
+ * General counters can also be set to an absolute value, or raised to a
+ * maximum.  Since we cannot reset the per-thread blocks, we adjust a base
+ * value instead so that the aggregated counter reaches the target value.
  *
- * However, the routines updating the traffic statistics are NOT protected
- * because they are always called from the main thread, the one where the
- * I/O event loop is installed.  An assertion verifies this assumption.
+ * The lock only protects these adjustments, counting does not take it.
  */
+static uint64 gnet_stats_general_base[GNR_TYPE_COUNT];
 static spinlock_t gnet_stats_slk = SPINLOCK_INIT;
 
 #define GNET_STATS_LOCK		spinlock_hidden(&gnet_stats_slk)
 #define GNET_STATS_UNLOCK	spinunlock_hidden(&gnet_stats_slk)
 
+/**
+ * Allocate the statistics block for the thread.
+ */
+static struct gnet_stats_block * G_COLD
+gnet_stats_block_allocate(uint stid)
+{
+	struct gnet_stats_block *b;
+
+	g_assert(stid < N_ITEMS(gnet_stats_blocks));
+	g_assert(NULL == gnet_stats_blocks[stid]);
+
+	/*
+	 * Rounding to the page size ensures the block starts on a fresh page
+	 * and that the remainder of its last page will not be handed out.
+	 */
+
+	b = omalloc0(round_pagesize(sizeof *b));
+
+	atomic_mb();		/* Zeroed block visible before publishing it */
+	gnet_stats_blocks[stid] = b;
+
+	return b;
+}
+
+/**
+ * @return the statistics block of the current thread.
+ */
+static inline struct gnet_stats_block *
+gnet_stats_block(void)
+{
+	uint stid = thread_small_id();
+	struct gnet_stats_block *b = gnet_stats_blocks[stid];
+
+	if G_LIKELY(b != NULL)
+		return b;
+
+	return gnet_stats_block_allocate(stid);
+}
+
+/**
+ * @return the TCP or UDP statistics for the node within the thread block.
+ */
+static inline gnet_stats_t *
+gnet_stats_node(struct gnet_stats_block *b, const gnutella_node_t *n)
+{
+	return NODE_USES_UDP(n) ? &b->udp : &b->tcp;
+}
+
+/**
+ * Aggregate the statistics from all the thread blocks.
+ *
+ * @param s			where the sum is written
+ * @param offset	offset of the statistics within the thread blocks
+ */
+static void
+gnet_stats_collect(gnet_stats_t *s, size_t offset)
+{
+	uint64 *dst = (uint64 *) s;
+	uint i;
+
+	ZERO(s);
+
+	for (i = 0; i < N_ITEMS(gnet_stats_blocks); i++) {
+		const struct gnet_stats_block *b = gnet_stats_blocks[i];
+		const uint64 *src;
+		size_t j;
+
+		if (NULL == b)
+			continue;
+
+		src = const_ptr_add_offset(b, offset);
+
+		for (j = 0; j < GNET_STATS_WORDS; j++)
+			dst[j] += src[j];
+	}
+}
+
+/**
+ * Aggregate the general counter from all the thread blocks, excluding
+ * the base value.
+ */
+static uint64
+gnet_stats_collect_general(size_t i)
+{
+	uint64 value = 0;
+	uint j;
+
+	for (j = 0; j < N_ITEMS(gnet_stats_blocks); j++) {
+		const struct gnet_stats_block *b = gnet_stats_blocks[j];
+
+		if (b != NULL)
+			value += b->all.general[i];
+	}
+
+	return value;
+}
+
 /***
  *** Public functions
  ***/
@@ -90,6 +204,9 @@ gnet_stats_init(void)
 	STATIC_ASSERT(
 		UNSIGNED(MSG_G2_BASE + G2_MSG_MAX) < GTA_MSG_QRP);
 
+	/* gnet_stats_collect() handles statistics as an array of counters */
+	STATIC_ASSERT(0 == sizeof(gnet_stats_t) % sizeof(uint64));
+
 	for (i = 0; i < N_ITEMS(stats_lut); i++) {
 		uchar m = MSG_UNKNOWN;
 
@@ -172,21 +289,25 @@ gnet_stats_init(void)
 	g_assert(MSG_UNKNOWN == stats_lut[N_ITEMS(stats_lut) - 1]);
 
 #undef CASE
-
-    ZERO(&gnet_stats);
-    ZERO(&gnet_udp_stats);
 }
 
 /**
- * Generate a SHA1 digest of the supplied statistics.
+ * Generate a SHA1 digest of the statistics at given offset in thread blocks.
  */
 static void
-gnet_stats_digest(sha1_t *digest, gnet_stats_t *stats)
+gnet_stats_digest(sha1_t *digest, size_t offset)
 {
 	uint32 n = entropy_nonce();
+	gnet_stats_t *stats, *s;
+
+	/* Ensure ever-changing SHA1 */
+	stats = ptr_add_offset(gnet_stats_block(), offset);
+	stats->general[GNR_STATS_DIGEST]++;
 
-	stats->general[GNR_STATS_DIGEST]++;		/* Ensure ever-changing SHA1 */
-	SHA1_COMPUTE_NONCE(*stats, &n, digest);
+	XMALLOC(s);		/* Too large for the stack of some threads */
+	gnet_stats_collect(s, offset);
+	SHA1_COMPUTE_NONCE(*s, &n, digest);
+	XFREE_NULL(s);
 }
 
 /**
@@ -198,7 +319,7 @@ void
 gnet_stats_tcp_digest(sha1_t *digest)
 {
 	gnet_stats_inc_general(GNR_STATS_TCP_DIGEST);
-	gnet_stats_digest(digest, &gnet_tcp_stats);
+	gnet_stats_digest(digest, offsetof(struct gnet_stats_block, tcp));
 }
 
 /**
@@ -210,7 +331,7 @@ void
 gnet_stats_udp_digest(sha1_t *digest)
 {
 	gnet_stats_inc_general(GNR_STATS_UDP_DIGEST);
-	gnet_stats_digest(digest, &gnet_udp_stats);
+	gnet_stats_digest(digest, offsetof(struct gnet_stats_block, udp));
 }
 
 /**
@@ -222,9 +343,15 @@ void
 gnet_stats_general_digest(sha1_t *digest)
 {
 	uint32 n = entropy_nonce();
+	uint64 general[GNR_TYPE_COUNT];
+	uint i;
 
 	gnet_stats_inc_general(GNR_STATS_DIGEST);
-	SHA1_COMPUTE_NONCE(gnet_stats.general, &n, digest);
+
+	for (i = 0; i < N_ITEMS(general); i++)
+		general[i] = gnet_stats_get_general(i);
+
+	SHA1_COMPUTE_NONCE(general, &n, digest);
 }
 
 /**
@@ -241,15 +368,16 @@ static void
 gnet_stats_count_received_header_internal(gnutella_node_t *n,
 	size_t header_size, uint t, uint8 ttl, uint8 hops)
 {
-	gnet_stats_t *stats = NODE_USES_UDP(n) ? &gnet_udp_stats : &gnet_tcp_stats;
+	struct gnet_stats_block *b = gnet_stats_block();
+	gnet_stats_t *stats = gnet_stats_node(b, n);
 	uint i;
 
     n->received++;
 
-    gnet_stats.pkg.received[MSG_TOTAL]++;
-    gnet_stats.pkg.received[t]++;
-    gnet_stats.byte.received[MSG_TOTAL] += header_size;
-    gnet_stats.byte.received[t] += header_size;
+    b->all.pkg.received[MSG_TOTAL]++;
+    b->all.pkg.received[t]++;
+    b->all.byte.received[MSG_TOTAL] += header_size;
+    b->all.byte.received[t] += header_size;
 
     stats->pkg.received[MSG_TOTAL]++;
     stats->pkg.received[t]++;
@@ -274,7 +402,6 @@ gnet_stats_count_received_header(gnutella_node_t *n)
 	uint t = stats_lut[gnutella_header_get_function(&n->header)];
 	uint8 ttl, hops;
 
-	g_assert(thread_is_main());
 	g_assert(!NODE_TALKS_G2(n));
 
 	ttl = gnutella_header_get_ttl(&n->header);
@@ -294,17 +421,18 @@ gnet_stats_count_kademlia_header(const gnutella_node_t *n, uint kt)
 {
 	uint t = stats_lut[gnutella_header_get_function(&n->header)];
 	uint i;
+	struct gnet_stats_block *b;
 	gnet_stats_t *stats;
 
-	g_assert(thread_is_main());
 	g_assert(!NODE_TALKS_G2(n));
 
-	stats = NODE_USES_UDP(n) ? &gnet_udp_stats : &gnet_tcp_stats;
+	b = gnet_stats_block();
+	stats = gnet_stats_node(b, n);
 
-    gnet_stats.pkg.received[t]--;
-    gnet_stats.pkg.received[kt]++;
-    gnet_stats.byte.received[t] -= GTA_HEADER_SIZE;
-    gnet_stats.byte.received[kt] += GTA_HEADER_SIZE;
+    b->all.pkg.received[t]--;
+    b->all.pkg.received[kt]++;
+    b->all.byte.received[t] -= GTA_HEADER_SIZE;
+    b->all.byte.received[kt] += GTA_HEADER_SIZE;
 
     stats->pkg.received[t]--;
     stats->pkg.received[kt]++;
@@ -342,13 +470,13 @@ gnet_stats_count_received_payload(const gnutella_node_t *n, const void *payload)
 	uint8 f;
 	uint t;
 	uint i;
+	struct gnet_stats_block *b;
 	gnet_stats_t *stats;
     uint32 size;
 	uint8 hops, ttl;
 
-	g_assert(thread_is_main());
-
-	stats = NODE_USES_UDP(n) ? &gnet_udp_stats : &gnet_tcp_stats;
+	b = gnet_stats_block();
+	stats = gnet_stats_node(b, n);
 	size = n->size;
 
 	/*
@@ -411,8 +539,8 @@ gnet_stats_count_received_payload(const gnutella_node_t *n, const void *payload)
 
 	g_assert(t < MSG_TOTAL);
 
-    gnet_stats.byte.received[MSG_TOTAL] += size;
-    gnet_stats.byte.received[t] += size;
+    b->all.byte.received[MSG_TOTAL] += size;
+    b->all.byte.received[t] += size;
 
     stats->byte.received[MSG_TOTAL] += size;
     stats->byte.received[t] += size;
@@ -428,8 +556,10 @@ gnet_stats_count_received_payload(const gnutella_node_t *n, const void *payload)
 
 static void
 gnet_stats_count_queued_internal(const gnutella_node_t *n,
-	uint t, uint8 hops, uint32 size, gnet_stats_t *stats)
+	uint t, uint8 hops, uint32 size)
 {
+	struct gnet_stats_block *b = gnet_stats_block();
+	gnet_stats_t *stats = gnet_stats_node(b, n);
 	uint64 *stats_pkg;
 	uint64 *stats_byte;
 
@@ -437,8 +567,8 @@ gnet_stats_count_queued_internal(const gnutella_node_t *n,
 
 	gnet_stats_randomness(n, t & 0xff, size);
 
-	stats_pkg = hops ? gnet_stats.pkg.queued : gnet_stats.pkg.gen_queued;
-	stats_byte = hops ? gnet_stats.byte.queued : gnet_stats.byte.gen_queued;
+	stats_pkg = hops ? b->all.pkg.queued : b->all.pkg.gen_queued;
+	stats_byte = hops ? b->all.byte.queued : b->all.byte.gen_queued;
 
     stats_pkg[MSG_TOTAL]++;
     stats_pkg[t]++;
@@ -459,15 +589,11 @@ gnet_stats_count_queued(const gnutella_node_t *n,
 	uint8 type, const void *base, uint32 size)
 {
 	uint t = stats_lut[type];
-	gnet_stats_t *stats;
 	uint8 hops;
 
 	g_assert(t != MSG_UNKNOWN);
-	g_assert(thread_is_main());
 	g_assert(!NODE_TALKS_G2(n));
 
-	stats = NODE_USES_UDP(n) ? &gnet_udp_stats : &gnet_tcp_stats;
-
 	/*
 	 * Adjust for Kademlia messages.
 	 */
@@ -483,22 +609,18 @@ gnet_stats_count_queued(const gnutella_node_t *n,
 		hops = gnutella_header_get_hops(base);
 	}
 
-	gnet_stats_count_queued_internal(n, t, hops, size, stats);
+	gnet_stats_count_queued_internal(n, t, hops, size);
 }
 
 void
 gnet_stats_g2_count_queued(const gnutella_node_t *n,
 	const void *base, size_t len)
 {
-	gnet_stats_t *stats;
 	uint t;
 	uint8 f;
 
-	g_assert(thread_is_main());
 	g_assert(NODE_TALKS_G2(n));
 
-	stats = NODE_USES_UDP(n) ? &gnet_udp_stats : &gnet_tcp_stats;
-
 	f = g2_msg_type(base, len);
 
 	if (f != G2_MSG_MAX) {
@@ -510,13 +632,15 @@ gnet_stats_g2_count_queued(const gnutella_node_t *n,
 	t = stats_lut[f];
 
 	/* Leaf mode => hops = 0 */
-	gnet_stats_count_queued_internal(n, t, 0, len, stats);
+	gnet_stats_count_queued_internal(n, t, 0, len);
 }
 
 static void
 gnet_stats_count_sent_internal(const gnutella_node_t *n,
-	uint t, uint8 hops, uint32 size, gnet_stats_t *stats)
+	uint t, uint8 hops, uint32 size)
 {
+	struct gnet_stats_block *b = gnet_stats_block();
+	gnet_stats_t *stats = gnet_stats_node(b, n);
 	uint64 *stats_pkg;
 	uint64 *stats_byte;
 
@@ -524,8 +648,8 @@ gnet_stats_count_sent_internal(const gnutella_node_t *n,
 
 	gnet_stats_randomness(n, t & 0xff, size);
 
-	stats_pkg = hops ? gnet_stats.pkg.relayed : gnet_stats.pkg.generated;
-	stats_byte = hops ? gnet_stats.byte.relayed : gnet_stats.byte.generated;
+	stats_pkg = hops ? b->all.pkg.relayed : b->all.pkg.generated;
+	stats_byte = hops ? b->all.byte.relayed : b->all.byte.generated;
 
     stats_pkg[MSG_TOTAL]++;
     stats_pkg[t]++;
@@ -546,15 +670,11 @@ gnet_stats_count_sent(const gnutella_node_t *n,
 	uint8 type, const void *base, uint32 size)
 {
 	uint t = stats_lut[type];
-	gnet_stats_t *stats;
 	uint8 hops;
 
 	g_assert(t != MSG_UNKNOWN);
-	g_assert(thread_is_main());
 	g_assert(!NODE_TALKS_G2(n));
 
-	stats = NODE_USES_UDP(n) ? &gnet_udp_stats : &gnet_tcp_stats;
-
 	/*
 	 * Adjust for Kademlia messages.
 	 */
@@ -570,7 +690,7 @@ gnet_stats_count_sent(const gnutella_node_t *n,
 		hops = gnutella_header_get_hops(base);
 	}
 
-	gnet_stats_count_sent_internal(n, t, hops, size, stats);
+	gnet_stats_count_sent_internal(n, t, hops, size);
 }
 
 void
@@ -578,20 +698,16 @@ gnet_stats_g2_count_sent(const gnutella_node_t *n,
 	enum g2_msg type, uint32 size)
 {
 	uint t;
-	gnet_stats_t *stats;
 
-	g_assert(thread_is_main());
 	g_assert((uint) type < UNSIGNED(G2_MSG_MAX));
 	g_assert(NODE_TALKS_G2(n));
 
-	stats = NODE_USES_UDP(n) ? &gnet_udp_stats : &gnet_tcp_stats;
-
 	t = stats_lut[MSG_G2_BASE + type];
 
 	g_assert(t != MSG_UNKNOWN);
 
 	/* Leaf mode => hops = 0 */
-	gnet_stats_count_sent_internal(n, t, 0, size, stats);
+	gnet_stats_count_sent_internal(n, t, 0, size);
 }
 
 void
@@ -599,17 +715,18 @@ gnet_stats_count_expired(const gnutella_node_t *n)
 {
     uint32 size = n->size + sizeof(n->header);
 	uint t = stats_lut[gnutella_header_get_function(&n->header)];
+	struct gnet_stats_block *b;
 	gnet_stats_t *stats;
 
-	g_assert(thread_is_main());
 	g_assert(!NODE_TALKS_G2(n));
 
-	stats = NODE_USES_UDP(n) ? &gnet_udp_stats : &gnet_tcp_stats;
+	b = gnet_stats_block();
+	stats = gnet_stats_node(b, n);
 
-    gnet_stats.pkg.expired[MSG_TOTAL]++;
-    gnet_stats.pkg.expired[t]++;
-    gnet_stats.byte.expired[MSG_TOTAL] += size;
-    gnet_stats.byte.expired[t] += size;
+    b->all.pkg.expired[MSG_TOTAL]++;
+    b->all.pkg.expired[t]++;
+    b->all.byte.expired[MSG_TOTAL] += size;
+    b->all.byte.expired[t] += size;
 
     stats->pkg.expired[MSG_TOTAL]++;
     stats->pkg.expired[t]++;
@@ -617,19 +734,19 @@ gnet_stats_count_expired(const gnutella_node_t *n)
     stats->byte.expired[t] += size;
 }
 
-#define DROP_STATS(gs,t,s) do {							\
+#define DROP_STATS(b,gs,t,s) do {						\
     if (												\
         (reason == MSG_DROP_ROUTE_LOST) ||				\
         (reason == MSG_DROP_NO_ROUTE)					\
     )													\
-        gnet_stats.general[GNR_ROUTING_ERRORS]++;		\
+        b->all.general[GNR_ROUTING_ERRORS]++;			\
 														\
-    gnet_stats.drop_reason[reason][MSG_TOTAL]++;		\
-    gnet_stats.drop_reason[reason][t]++;				\
-    gnet_stats.pkg.dropped[MSG_TOTAL]++;				\
-    gnet_stats.pkg.dropped[t]++;						\
-    gnet_stats.byte.dropped[MSG_TOTAL] += (s);			\
-    gnet_stats.byte.dropped[t] += (s);					\
+    b->all.drop_reason[reason][MSG_TOTAL]++;		\
+    b->all.drop_reason[reason][t]++;				\
+    b->all.pkg.dropped[MSG_TOTAL]++;				\
+    b->all.pkg.dropped[t]++;						\
+    b->all.byte.dropped[MSG_TOTAL] += (s);			\
+    b->all.byte.dropped[t] += (s);					\
 	gs->drop_reason[reason][MSG_TOTAL]++;				\
 	gs->drop_reason[reason][t]++;						\
     gs->pkg.dropped[MSG_TOTAL]++;						\
@@ -643,12 +760,12 @@ gnet_stats_count_dropped(gnutella_node_t *n, msg_drop_reason_t reason)
 {
 	uint32 size;
 	uint type;
+	struct gnet_stats_block *b;
 	gnet_stats_t *stats;
 
 	g_assert(UNSIGNED(reason) < MSG_DROP_REASON_COUNT);
-	g_assert(thread_is_main());
-
-	stats = NODE_USES_UDP(n) ? &gnet_udp_stats : &gnet_tcp_stats;
+	b = gnet_stats_block();
+	stats = gnet_stats_node(b, n);
 
 	if (NODE_TALKS_G2(n)) {
 		int f = g2_msg_type(n->data, n->size);
@@ -668,7 +785,7 @@ gnet_stats_count_dropped(gnutella_node_t *n, msg_drop_reason_t reason)
 		VARLEN(n->addr), VARLEN(n->port), VARLEN(reason), VARLEN(type),
 		VARLEN(size), NULL);
 
-	DROP_STATS(stats, type, size);
+	DROP_STATS(b, stats, type, size);
 	node_inc_rxdrop(n);
 
 	switch (reason) {
@@ -702,22 +819,22 @@ gnet_dht_stats_count_dropped(gnutella_node_t *n, kda_msg_t opcode,
 {
 	uint32 size;
 	uint type;
+	struct gnet_stats_block *b;
 	gnet_stats_t *stats;
 
 	g_assert(UNSIGNED(reason) < MSG_DROP_REASON_COUNT);
 	g_assert(opcode <= KDA_MSG_MAX_ID);
 	g_assert(UNSIGNED(opcode + MSG_DHT_BASE) < N_ITEMS(stats_lut));
-	g_assert(thread_is_main());
-
     size = n->size + sizeof(n->header);
 	type = stats_lut[opcode + MSG_DHT_BASE];
-	stats = NODE_USES_UDP(n) ? &gnet_udp_stats : &gnet_tcp_stats;
+	b = gnet_stats_block();
+	stats = gnet_stats_node(b, n);
 
 	entropy_harvest_small(
 		VARLEN(n->addr), VARLEN(n->port), VARLEN(reason), VARLEN(type),
 		VARLEN(size), NULL);
 
-	DROP_STATS(stats, type, size);
+	DROP_STATS(b, stats, type, size);
 	node_inc_rxdrop(n);
 }
 
@@ -731,9 +848,7 @@ gnet_stats_count_general(gnr_stats_t type, int delta)
 
 	g_assert(i < GNR_TYPE_COUNT);
 
-	GNET_STATS_LOCK;
-    gnet_stats.general[i] += delta;
-	GNET_STATS_UNLOCK;
+	gnet_stats_block()->all.general[i] += delta;
 }
 
 /**
@@ -746,9 +861,7 @@ gnet_stats_inc_general(gnr_stats_t type)
 
 	g_assert(i < GNR_TYPE_COUNT);
 
-	GNET_STATS_LOCK;
-    gnet_stats.general[i]++;
-	GNET_STATS_UNLOCK;
+	gnet_stats_block()->all.general[i]++;
 }
 
 /**
@@ -761,9 +874,7 @@ gnet_stats_dec_general(gnr_stats_t type)
 
 	g_assert(i < GNR_TYPE_COUNT);
 
-	GNET_STATS_LOCK;
-    gnet_stats.general[i]--;
-	GNET_STATS_UNLOCK;
+	gnet_stats_block()->all.general[i]--;
 }
 
 /**
@@ -773,12 +884,14 @@ void
 gnet_stats_max_general(gnr_stats_t type, uint64 value)
 {
 	size_t i = type;
+	uint64 current;
 
 	g_assert(i < GNR_TYPE_COUNT);
 
 	GNET_STATS_LOCK;
-	if (value > gnet_stats.general[i])
-		gnet_stats.general[i] = value;
+	current = gnet_stats_general_base[i] + gnet_stats_collect_general(i);
+	if (value > current)
+		gnet_stats_general_base[i] += value - current;
 	GNET_STATS_UNLOCK;
 }
 
@@ -793,7 +906,7 @@ gnet_stats_set_general(gnr_stats_t type, uint64 value)
 	g_assert(i < GNR_TYPE_COUNT);
 
 	GNET_STATS_LOCK;
-    gnet_stats.general[i] = value;
+	gnet_stats_general_base[i] = value - gnet_stats_collect_general(i);
 	GNET_STATS_UNLOCK;
 }
 
@@ -809,7 +922,7 @@ gnet_stats_get_general(gnr_stats_t type)
 	g_assert(i < GNR_TYPE_COUNT);
 
 	GNET_STATS_LOCK;
-	value = gnet_stats.general[i];
+	value = gnet_stats_general_base[i] + gnet_stats_collect_general(i);
 	GNET_STATS_UNLOCK;
 
 	return value;
@@ -820,19 +933,20 @@ gnet_stats_count_dropped_nosize(
 	const gnutella_node_t *n, msg_drop_reason_t reason)
 {
 	uint type;
+	struct gnet_stats_block *b;
 	gnet_stats_t *stats;
 
 	g_assert(UNSIGNED(reason) < MSG_DROP_REASON_COUNT);
-	g_assert(thread_is_main());
 	g_assert(!NODE_TALKS_G2(n));
 
 	type = stats_lut[gnutella_header_get_function(&n->header)];
-	stats = NODE_USES_UDP(n) ? &gnet_udp_stats : &gnet_tcp_stats;
+	b = gnet_stats_block();
+	stats = gnet_stats_node(b, n);
 
 	entropy_harvest_small(VARLEN(n->addr), VARLEN(n->port), NULL);
 
 	/* Data part of message not read */
-	DROP_STATS(stats, type, sizeof(n->header));
+	DROP_STATS(b, stats, type, sizeof(n->header));
 
 	if (GNET_PROPERTY(log_dropped_gnutella))
 		gmsg_log_split_dropped(&n->header, n->data, 0,
@@ -844,25 +958,26 @@ static void
 gnet_stats_flowc_internal(uint t,
 	uint8 function, uint8 ttl, uint8 hops, size_t size)
 {
+	struct gnet_stats_block *b = gnet_stats_block();
 	uint i;
 
 	g_assert(t < MSG_TOTAL);
 
 	i = MIN(hops, STATS_FLOWC_COLUMNS - 1);
-	gnet_stats.pkg.flowc_hops[i][t]++;
-	gnet_stats.pkg.flowc_hops[i][MSG_TOTAL]++;
-	gnet_stats.byte.flowc_hops[i][t] += size;
-	gnet_stats.byte.flowc_hops[i][MSG_TOTAL] += size;
+	b->all.pkg.flowc_hops[i][t]++;
+	b->all.pkg.flowc_hops[i][MSG_TOTAL]++;
+	b->all.byte.flowc_hops[i][t] += size;
+	b->all.byte.flowc_hops[i][MSG_TOTAL] += size;
 
 	i = MIN(ttl, STATS_FLOWC_COLUMNS - 1);
 
 	/* Cannot send a message with TTL=0 (DHT messages are not Gnutella) */
 	g_assert(function == GTA_MSG_DHT || i != 0);
 
-	gnet_stats.pkg.flowc_ttl[i][t]++;
-	gnet_stats.pkg.flowc_ttl[i][MSG_TOTAL]++;
-	gnet_stats.byte.flowc_ttl[i][t] += size;
-	gnet_stats.byte.flowc_ttl[i][MSG_TOTAL] += size;
+	b->all.pkg.flowc_ttl[i][t]++;
+	b->all.pkg.flowc_ttl[i][MSG_TOTAL]++;
+	b->all.byte.flowc_ttl[i][t] += size;
+	b->all.byte.flowc_ttl[i][MSG_TOTAL] += size;
 
 	entropy_harvest_small(VARLEN(t), VARLEN(function), VARLEN(size), NULL);
 }
@@ -876,8 +991,6 @@ gnet_stats_count_flowc(const void *head, bool head_only)
 	uint8 ttl = gnutella_header_get_ttl(head);
 	uint8 hops = gnutella_header_get_hops(head);
 
-	g_assert(thread_is_main());
-
 	if (GNET_PROPERTY(node_debug) > 3)
 		g_debug("FLOWC function=%d ttl=%d hops=%d", function, ttl, hops);
 
@@ -909,8 +1022,6 @@ gnet_stats_g2_count_flowc(const gnutella_node_t *n,
 	uint t;
 	uint8 f, ttl, hops;
 
-	g_assert(thread_is_main());
-
 	f = g2_msg_type(base, len);
 
 	if (GNET_PROPERTY(node_debug) > 3)
@@ -937,10 +1048,15 @@ gnet_stats_g2_count_flowc(const gnutella_node_t *n,
 void
 gnet_stats_get(gnet_stats_t *s)
 {
+	uint i;
+
     g_assert(s != NULL);
 
+	gnet_stats_collect(s, offsetof(struct gnet_stats_block, all));
+
 	GNET_STATS_LOCK;
-    *s = gnet_stats;
+	for (i = 0; i < N_ITEMS(gnet_stats_general_base); i++)
+		s->general[i] += gnet_stats_general_base[i];
 	GNET_STATS_UNLOCK;
 }
 
@@ -948,18 +1064,16 @@ void
 gnet_stats_tcp_get(gnet_stats_t *s)
 {
     g_assert(s != NULL);
-	g_assert(thread_is_main());
 
-    *s = gnet_tcp_stats;
+	gnet_stats_collect(s, offsetof(struct gnet_stats_block, tcp));
 }
 
 void
 gnet_stats_udp_get(gnet_stats_t *s)
 {
     g_assert(s != NULL);
-	g_assert(thread_is_main());
 
-    *s = gnet_udp_stats;
+	gnet_stats_collect(s, offsetof(struct gnet_stats_block, udp));
 }
 
 /* vi: set ts=4 sw=4 cindent: */
@@ -133,6 +133,7 @@
 #include "lib/pslist.h"
 #include "lib/random.h"
 #include "lib/ripening.h"
+#include "lib/rwlock.h"
 #include "lib/stacktrace.h"
 #include "lib/str.h"			/* For str_private() */
 #include "lib/stringify.h"
@@ -428,6 +429,12 @@ static ripening_table_t *guess_deferred;/**< Hosts with deferred processing */
 static uint64 guess_out_bw;				/**< Outgoing b/w used per period */
 static uint64 guess_target_bw;			/**< Outgoing b/w target for period */
 static int guess_alpha = GUESS_ALPHA;	/**< Concurrency query parameter */
+
+/*
+ * Query hits are decoded by worker threads, which need to check the MUIDs
+ * of our queries: the main thread write-locks the MUID set to update it.
+ */
+static rwlock_t guess_muid_lock = RWLOCK_INIT;
 static time_t guess_qk_threshtime;		/**< Stamp threshold for query keys */
 
 static void guess_discovery_enable(void);
@@ -3570,13 +3577,21 @@ guess_periodic_bw(void *unused_obj)
 
 /**
  * Is a search MUID that of a running GUESS query?
+ *
+ * This can be called from any thread.
  */
 bool
 guess_is_search_muid(const guid_t *muid)
 {
+	bool active;
+
 	if G_UNLIKELY(NULL == gmuid)
 		return FALSE;
 
+	rwlock_rlock(&guess_muid_lock);
+	active = hikset_contains(gmuid, muid);
+	rwlock_runlock(&guess_muid_lock);
+
 	/*
 	 * Because there can be delay between the end of a GUESS query and the
 	 * time by which results come back to our node, we make the MUIDs linger
@@ -3585,7 +3600,7 @@ guess_is_search_muid(const guid_t *muid)
 	 */
 
 	return
-		hikset_contains(gmuid, muid) ||					/* Active MUID */
+		active ||										/* Active MUID */
 		NULL != aging_lookup(guess_old_muids, muid);	/* Lingering MUID */
 }
 
@@ -5404,7 +5419,9 @@ guess_create(gnet_search_t sh, const guid_t *muid, const char *query,
 	gq->max_ultrapeers = MAX(gq->max_ultrapeers, GUESS_MAX_ULTRAPEERS);
 
 	hevset_insert_key(gqueries, &gq->gid);
+	rwlock_wlock(&guess_muid_lock);
 	hikset_insert_key(gmuid, &gq->muid);
+	rwlock_wunlock(&guess_muid_lock);
 
 	if (GNET_PROPERTY(guess_client_debug) > 1) {
 		g_debug("GUESS QUERY[%s] starting query for \"%s\" #%s ultras=%lu",
@@ -5477,8 +5494,10 @@ guess_free(guess_t *gq)
 	 * process hits coming late and not consider them as spam (unrequested).
 	 */
 
-	hikset_remove(gmuid, gq->muid);
 	aging_record(guess_old_muids, atom_guid_get(gq->muid));
+	rwlock_wlock(&guess_muid_lock);
+	hikset_remove(gmuid, gq->muid);
+	rwlock_wunlock(&guess_muid_lock);
 
 	hset_free_null(&gq->queried);
 	hset_free_null(&gq->deferred);
@@ -5900,6 +5919,7 @@ guess_init(void)
 		gnet_host_hash, gnet_host_equal, gnet_host_free_atom2);
 	guess_old_muids =
 		aging_make(GUESS_MUID_LINGER, guid_hash, guid_eq, guid_free_atom2);
+	aging_thread_safe(guess_old_muids);		/* Checked by hit decoders */
 	guess_deferred =
 		ripening_make(gnet_host_hash, gnet_host_equal, guess_host_available);
 
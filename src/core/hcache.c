@@ -63,15 +63,17 @@
 #include "lib/ascii.h"
 #include "lib/atoms.h"
 #include "lib/cq.h"
+#include "lib/endian.h"
+#include "lib/fd.h"
 #include "lib/file.h"
 #include "lib/getdate.h"
+#include "lib/halloc.h"
 #include "lib/hashlist.h"
-#include "lib/hset.h"
 #include "lib/htable.h"
 #include "lib/path.h"
 #include "lib/random.h"
+#include "lib/str.h"
 #include "lib/stringify.h"
-#include "lib/timestamp.h"
 #include "lib/tm.h"
 #include "lib/vmm.h"
 #include "lib/walloc.h"
@@ -87,21 +89,42 @@
 #define HCACHE_SAVE_PERIOD	63		/**< in seconds, every minute or so */
 #define MIN_RESERVE_SIZE	1024	/**< we'd like that many pongs in reserve */
 
+#define HCACHE_NIL			((uint32) -1)	/**< End of free list */
+#define HCACHE_STORE_MIN	256		/**< Initial entry array size */
+
 /**
  * An entry within the hostcache.
  *
- * We don't really store the IP/port, as those are stored in the key of
- * hash table recording all known hosts.  Rather, we store "metadata" about
- * the host.
+ * Entries are not allocated individually: they live in the flat array of
+ * the store for their class, and are referred to by index.  The host atom
+ * is the key of the hash table mapping hosts to their entry.
  */
 typedef struct hostcache_entry {
-    hcache_type_t type;				/**< Hostcache which contains this host */
-    time_t        time_added;		/**< Time when entry was added */
+	const gnet_host_t *host;		/**< Host atom, NULL if entry is free */
+	time_t        time_added;		/**< Time when entry was added */
+	hcache_type_t type;				/**< Hostcache which contains this host */
+	uint32        slot;				/**< Index in sample[], or next free */
 } hostcache_entry_t;
 
-/** No metadata for host */
-static const void *no_metadata;
-#define NO_METADATA			(no_metadata)
+/**
+ * Entry store for a host cache class.
+ *
+ * All the hosts of a class are kept in a single array, released entries
+ * being chained in a free list so that their slot can be reused by the
+ * next insertion.  The hash table maps a host to its entry index plus one,
+ * so that a NULL value still means "not found".
+ *
+ * Because the array can be reallocated, pointers to entries are only
+ * valid until the next entry allocation in the same class.
+ */
+struct hcache_store {
+	hostcache_entry_t *entry;		/**< Flat entry array */
+	htable_t *ht;					/**< Host atom -> entry index + 1 */
+	uint32 capacity;				/**< Allocated entries */
+	uint32 used;					/**< Entries ever handed out */
+	uint32 free;					/**< Head of free list, or HCACHE_NIL */
+	uint32 count;					/**< Live entries */
+};
 
 /**
  * A hostcache table.
@@ -114,6 +137,9 @@ typedef struct hostcache {
     bool        	addr_only;			/**< Use IP only, port always 0 */
     bool			dirty;     	      	/**< If updated since last disk flush */
     hash_list_t *   hostlist;           /**< Host list: IP/Port  */
+	uint32			*sample;			/**< Entry indices, for sampling */
+	uint32			sample_count;		/**< Amount of indices in sample[] */
+	uint32			sample_capacity;	/**< Allocated slots in sample[] */
 
     uint			hits;               /**< Hits to the cache */
     uint			misses;             /**< Misses to the cache */
@@ -134,6 +160,27 @@ static const char GUESS_FILE[]		= "guess";
 static const char GUESS6_FILE[]		= "guess6";
 static const char G2HUBS_FILE[]		= "g2hubs";
 
+/*
+ * Binary host cache files, named after the above with a ".bin" extension.
+ *
+ * The file starts with a header made of a 4-byte magic, followed by the
+ * format version, the size of each record and a reserved field, as
+ * big-endian 32-bit values.  The amount of records is derived from the
+ * file size.  Each record then holds:
+ *
+ *	16 bytes: address (IPv4 addresses use the leading 4 bytes)
+ *	 8 bytes: time when host was added, big-endian
+ *	 2 bytes: port, big-endian
+ *	 1 byte:  network type (4 or 6)
+ *	 5 bytes: reserved, zero
+ *
+ * Fixed-size records let us map the file and walk it without any parsing.
+ */
+#define HCACHE_BIN_MAGIC	"HCAC"
+#define HCACHE_BIN_VERSION	1
+#define HCACHE_BIN_HEADER	16		/**< Header size, in bytes */
+#define HCACHE_BIN_RECORD	32		/**< Record size, in bytes */
+
 /**
  * Names of the host caches.
  *
@@ -284,27 +331,27 @@ stop_mass_update(hostcache_t *hc)
 }
 
 /**
- * Hashtable: IP/Port -> Metadata for HCACHE_CLASS_HOST.
+ * Entry store for HCACHE_CLASS_HOST.
  */
-static htable_t *ht_known_hosts;
+static struct hcache_store store_known_hosts;
 
 /**
- * Hashtable: IP/Port -> Metadata for HCACHE_CLASS_G2.
+ * Entry store for HCACHE_CLASS_G2.
  */
-static htable_t *ht_g2_hosts;
+static struct hcache_store store_g2_hosts;
 
 /**
- * Hashtable: IP/Port -> Metadata for HCACHE_CLASS_GUESS.
+ * Entry store for HCACHE_CLASS_GUESS.
  */
-static htable_t *ht_guess_hosts;
+static struct hcache_store store_guess_hosts;
 
-static htable_t *
-hcache_ht_by_class(hcache_class_t class)
+static struct hcache_store *
+hcache_store_by_class(hcache_class_t class)
 {
 	switch (class) {
-	case HCACHE_CLASS_HOST:		return ht_known_hosts;
-	case HCACHE_CLASS_G2:		return ht_g2_hosts;
-	case HCACHE_CLASS_GUESS:	return ht_guess_hosts;
+	case HCACHE_CLASS_HOST:		return &store_known_hosts;
+	case HCACHE_CLASS_G2:		return &store_g2_hosts;
+	case HCACHE_CLASS_GUESS:	return &store_guess_hosts;
 	}
 	g_assert_not_reached();
 	return NULL;
@@ -341,24 +388,96 @@ hcache_addr_within_net(const host_addr_t addr, host_net_t net)
  *** Metadata allocation.
  ***/
 
-static hostcache_entry_t *
-hce_alloc(void)
+/**
+ * Allocate a new entry in the store, reusing a released one if possible.
+ *
+ * @return the index of the (zeroed) entry.
+ */
+static uint32
+hce_alloc(struct hcache_store *hs)
 {
-	static const hostcache_entry_t zero_hce;
-	hostcache_entry_t *hce;
+	uint32 idx;
+
+	if (hs->free != HCACHE_NIL) {
+		idx = hs->free;
+		hs->free = hs->entry[idx].slot;
+	} else {
+		if (hs->used == hs->capacity) {
+			hs->capacity = MAX(HCACHE_STORE_MIN, hs->capacity * 2);
+			HREALLOC_ARRAY(hs->entry, hs->capacity);
+		}
+		idx = hs->used++;
+	}
+
+	ZERO(&hs->entry[idx]);
+	hs->count++;
+
+	return idx;
+}
+
+/**
+ * Release entry back to the free list of the store.
+ */
+static void
+hce_free(struct hcache_store *hs, uint32 idx)
+{
+	g_assert(idx < hs->used);
+	g_assert(hs->entry[idx].host != NULL);
+	g_assert(hs->count != 0);
+
+	hs->entry[idx].host = NULL;
+	hs->count--;
+
+	/*
+	 * When the store becomes empty, forget about the free list so that
+	 * the next insertions start again at the beginning of the array.
+	 */
 
-	WALLOC(hce);
-	*hce = zero_hce;
-	return hce;
+	if (0 == hs->count) {
+		hs->used = 0;
+		hs->free = HCACHE_NIL;
+	} else {
+		hs->entry[idx].slot = hs->free;
+		hs->free = idx;
+	}
 }
 
+/**
+ * Record entry in the sampling vector of the hostcache.
+ */
 static void
-hce_free(struct hostcache_entry *hce)
+hcache_sample_add(hostcache_t *hc, hostcache_entry_t *hce)
 {
-	g_assert(hce);
-	g_assert(hce != NO_METADATA);
+	struct hcache_store *hs = hcache_store_by_class(hc->class);
+	uint32 idx = hce - hs->entry;
+
+	g_assert(idx < hs->used);
+
+	if (hc->sample_count == hc->sample_capacity) {
+		hc->sample_capacity = MAX(HCACHE_STORE_MIN, hc->sample_capacity * 2);
+		HREALLOC_ARRAY(hc->sample, hc->sample_capacity);
+	}
 
-	WFREE(hce);
+	hce->slot = hc->sample_count;
+	hc->sample[hc->sample_count++] = idx;
+}
+
+/**
+ * Remove entry from the sampling vector of the hostcache.
+ *
+ * The last index is moved to the freed slot to keep the vector dense.
+ */
+static void
+hcache_sample_remove(hostcache_t *hc, hostcache_entry_t *hce)
+{
+	struct hcache_store *hs = hcache_store_by_class(hc->class);
+	uint32 last;
+
+	g_assert(hce->slot < hc->sample_count);
+
+	last = hc->sample[--hc->sample_count];
+	hc->sample[hce->slot] = last;
+	hs->entry[last].slot = hce->slot;
 }
 
 /**
@@ -390,49 +509,46 @@ static bool
 hcache_ht_get(hcache_class_t class, const host_addr_t addr, uint16 port,
 	gnet_host_t **h, hostcache_entry_t **e)
 {
+	struct hcache_store *hs = hcache_store_by_class(class);
 	gnet_host_t host;
-	const void *k;
-	void *v;
-	bool found;
-	htable_t *ht;
+	uint idx;
 
 	gnet_host_set(&host, addr, port);
-	ht = hcache_ht_by_class(class);
 
-	found = htable_lookup_extended(ht, &host, &k, &v);
-	if (found) {
-		*h = deconstify_pointer(k);
-		*e = v;
-	}
+	idx = pointer_to_uint(htable_lookup(hs->ht, &host));
+	if (0 == idx)
+		return FALSE;
+
+	*e = &hs->entry[idx - 1];
+	*h = deconstify_pointer((*e)->host);
 
-	return found;
+	return TRUE;
 }
 
 /**
  * Add host to the hash table host cache.
  *
- * Also creates a metadata struct unless the host was added to HL_CAUGHT
- * in which case we cannot know anything about the host. Yet we cannot
- * assert that HL_CAUGHT never contains a host with metadata because when
- * HL_CAUGHT becomes empty, move all hosts from HL_VALID to HL_CAUGHT. We
- * can however assert that any host which does not have metadata is in
- * HL_CAUGHT.
+ * A new entry is taken from the store of the class and recorded in the
+ * sampling vector of the hostcache for that type.
  *
- * @return Pointer to metadata struct for the added host or NO_METADATA
- *         if no metadata was added.
+ * @return pointer to the metadata of the added host, which remains valid
+ * until the next entry allocation in the same class.
  */
 static hostcache_entry_t *
 hcache_ht_add(hcache_type_t type, const gnet_host_t *host)
 {
+	struct hcache_store *hs = hcache_store_by_class(hcache_class(type));
     hostcache_entry_t *hce;
-	htable_t *ht;
+	uint32 idx;
 
-    hce = hce_alloc();
+	idx = hce_alloc(hs);
+	hce = &hs->entry[idx];
+	hce->host = host;
     hce->type = type;
     hce->time_added = tm_time();
 
-	ht = hcache_ht_by_class(hcache_class(type));
-	htable_insert(ht, host, hce);
+	htable_insert(hs->ht, host, uint_to_pointer(idx + 1));
+	hcache_sample_add(caches[type], hce);
 
     return hce;
 }
@@ -443,36 +559,38 @@ hcache_ht_add(hcache_type_t type, const gnet_host_t *host)
 static void
 hcache_ht_remove(hcache_class_t class, gnet_host_t *host)
 {
+	struct hcache_store *hs = hcache_store_by_class(class);
 	hostcache_entry_t *hce;
-	void *value;
-	htable_t *ht;
-
-	ht = hcache_ht_by_class(class);
+	uint idx;
 
-	if (!htable_lookup_extended(ht, host, NULL, &value)) {
+	idx = pointer_to_uint(htable_lookup(hs->ht, host));
+	if (0 == idx) {
 		g_carp("%s: attempt to remove unknown host: %s",
 			  G_STRFUNC, gnet_host_to_string(host));
 		return;
 	}
-	hce = value;
-	htable_remove(ht, host);
+	htable_remove(hs->ht, host);
 
-	if (hce != NO_METADATA)
-		hce_free(hce);
+	hce = &hs->entry[idx - 1];
+	hcache_sample_remove(caches[hce->type], hce);
+	hce_free(hs, idx - 1);
 }
 
 /**
  * Get metadata for host.
  *
- * @return NULL if host was not found, NO_METADATA if no metadata was stored
- *         or a pointer to a hostcache_entry struct which holds the metadata.
+ * @return NULL if host was not found, or a pointer to the hostcache_entry
+ * which holds the metadata.
  */
 static hostcache_entry_t *
 hcache_get_metadata(hcache_class_t class, const gnet_host_t *host)
 {
-	htable_t *ht = hcache_ht_by_class(class);
+	struct hcache_store *hs = hcache_store_by_class(class);
+	uint idx;
 
-    return htable_lookup(ht, host);
+	idx = pointer_to_uint(htable_lookup(hs->ht, host));
+
+	return 0 == idx ? NULL : &hs->entry[idx - 1];
 }
 
 /**
@@ -495,7 +613,7 @@ hcache_node_is_bad(const host_addr_t addr)
 	gnet_host_set(&h, addr, 0);
     hce = hcache_get_metadata(HCACHE_CLASS_HOST, &h);
 
-    if (hce == NULL || hce == NO_METADATA)
+    if (hce == NULL)
         return FALSE;
 
     caches[hce->type]->hits++;
@@ -520,8 +638,8 @@ hcache_node_is_bad(const host_addr_t addr)
 static void
 hcache_move_entries(hostcache_t *to, hostcache_t *from)
 {
-	hash_list_iter_t *iter;
-	void *item;
+	struct hcache_store *hs;
+	uint32 i;
 
 	g_assert(to != NULL);
 	g_assert(from != NULL);
@@ -535,26 +653,36 @@ hcache_move_entries(hostcache_t *to, hostcache_t *from)
     to->hostlist = from->hostlist;
     from->hostlist = hash_list_new(NULL, NULL);
 
+	/*
+	 * The sampling vectors are swapped as well: entries keep their slot
+	 * since the whole vector moves along.
+	 */
+
+	g_assert(0 == to->sample_count);
+
+	{
+		uint32 *sample = to->sample;
+		uint32 capacity = to->sample_capacity;
+
+		to->sample = from->sample;
+		to->sample_count = from->sample_count;
+		to->sample_capacity = from->sample_capacity;
+		from->sample = sample;
+		from->sample_count = 0;
+		from->sample_capacity = capacity;
+	}
+
     /*
-     * Make sure that after switching hce->list points to the new
-     * list HL_CAUGHT
+     * Make sure that after switching hce->type points to the new cache.
      */
 
-	iter = hash_list_iterator(to->hostlist);
+	hs = hcache_store_by_class(to->class);
 
-	while (NULL != (item = hash_list_iter_next(iter))) {
-        hostcache_entry_t *hce;
-
-        hce = hcache_get_metadata(from->class, item);
-        if (hce == NULL || hce == NO_METADATA)
-            continue;
-        hce->type = to->type;
-    }
+	for (i = 0; i < to->sample_count; i++)
+		hs->entry[to->sample[i]].type = to->type;
 
 	stop_mass_update(to);
 	stop_mass_update(from);
-
-	hash_list_iter_release(&iter);
 }
 
 /**
@@ -976,6 +1104,9 @@ hcache_add_internal(hcache_type_t type, time_t added,
 		orig_key = hash_list_remove(caches[hce->type]->hostlist, host);
 		g_assert(orig_key);
 
+		hcache_sample_remove(caches[hce->type], hce);
+		hcache_sample_add(hc, hce);
+
 		if (caches[hce->type]->mass_update == 0) {
 			gnet_prop_decr_guint32(caches[hce->type]->hosts_in_catcher);
 		}
@@ -1478,10 +1609,50 @@ hcache_prune(hcache_type_t type)
     stop_mass_update(hc);
 }
 
+/**
+ * Fill `hosts' with at most `hcount' hosts drawn at random from the cache.
+ *
+ * This is a partial Fisher-Yates shuffle of the sampling vector: each
+ * picked index is swapped to the front, so no host is returned twice.
+ *
+ * @return amount of hosts filled.
+ */
+static int
+hcache_sample_fill(hostcache_t *hc, gnet_host_t *hosts, int hcount)
+{
+	const struct hcache_store *hs = hcache_store_by_class(hc->class);
+	uint32 i, n;
+
+	g_assert(hcount >= 0);
+
+	n = MIN(UNSIGNED(hcount), hc->sample_count);
+
+	for (i = 0; i < n; i++) {
+		uint32 j = i + random_value(hc->sample_count - i - 1);
+		uint32 idx = hc->sample[j];
+
+		if (j != i) {
+			hc->sample[j] = hc->sample[i];
+			hs->entry[hc->sample[j]].slot = j;
+			hc->sample[i] = idx;
+			hs->entry[idx].slot = i;
+		}
+
+		/*
+		 * Cannot do a struct copy, the host atom may be shorter than
+		 * the structure when holding an IPv4 address.
+		 */
+
+		gnet_host_copy(&hosts[i], hs->entry[idx].host);
+	}
+
+	return n;
+}
+
 /**
  * Fill `hosts', an array of `hcount' hosts already allocated with at most
- * `hcount' hosts from out caught list, without removing those hosts from
- * the list.
+ * `hcount' hosts randomly sampled from our caught list, without removing
+ * those hosts from the list.
  *
  * @param net		network preference (for HOST_ULTRA and HOST_GUESS)
  * @param type		type of host to fill in
@@ -1497,9 +1668,6 @@ hcache_fill_caught_array(host_net_t net, host_type_t type,
 	int i;
 	hostcache_t *hc = NULL;
 	hostcache_t *hc2 = NULL;
-	hset_t *seen_host =
-		hset_create_any(gnet_host_hash, gnet_host_hash2, gnet_host_equal);
-	hash_list_iter_t *iter;
 
     switch (type) {
     case HOST_ANY:
@@ -1579,62 +1747,20 @@ hcache_fill_caught_array(host_net_t net, host_type_t type,
 
 	/*
 	 * We first try to fill IPv6 addresses, or IPv4 if they only want that.
+	 *
+	 * Both caches belong to the same class, and a host can only be in one
+	 * cache of its class, hence there cannot be any duplicate.
 	 */
 
-	iter = hash_list_iterator(hc->hostlist);
-	for (i = 0; i < hcount; i++) {
-		gnet_host_t *h;
-
-		h = hash_list_iter_next(iter);
-		if (NULL == h)
-			break;
-
-		if (hset_contains(seen_host, h))
-			continue;
-
-		/*
-		 * Cannot do a struct copy, the host atom may be shorter than
-		 * the structure when holding an IPv4 address.
-		 */
-
-		gnet_host_copy(&hosts[i], h);
-
-		hset_insert(seen_host, &hosts[i]);
-	}
-	hash_list_iter_release(&iter);
+	i = hcache_sample_fill(hc, hosts, hcount);
 
 	/*
-	 * If we have an alternate cache and if we're missing entries, iterate
-	 * once again to fill up the vector.
+	 * If we have an alternate cache and if we're missing entries, sample
+	 * it to fill up the vector.
 	 */
 
-	if (NULL == hc2 || i == hcount)
-		goto done;
-
-	iter = hash_list_iterator(hc2->hostlist);
-	for (/* empty */; i < hcount; i++) {
-		gnet_host_t *h;
-
-		h = hash_list_iter_next(iter);
-		if (NULL == h)
-			break;
-
-		if (hset_contains(seen_host, h))
-			continue;
-
-		/*
-		 * Cannot do a struct copy, the host atom may be shorter than
-		 * the structure when holding an IPv4 address.
-		 */
-
-		gnet_host_copy(&hosts[i], h);
-
-		hset_insert(seen_host, &hosts[i]);
-	}
-	hash_list_iter_release(&iter);
-
-done:
-	hset_free_null(&seen_host);	/* Keys point into vector */
+	if (hc2 != NULL && i < hcount)
+		i += hcache_sample_fill(hc2, &hosts[i], hcount - i);
 
 	return i;				/* Amount of hosts we filled */
 }
@@ -1648,9 +1774,9 @@ done:
 bool
 hcache_find_nearby(host_type_t type, host_addr_t *addr, uint16 *port)
 {
-	gnet_host_t *h;
+	const struct hcache_store *hs;
 	hostcache_t *hc = NULL;
-	hash_list_iter_t *iter;
+	uint32 i;
 
     switch (type) {
     case HOST_ANY:
@@ -1678,22 +1804,21 @@ hcache_find_nearby(host_type_t type, host_addr_t *addr, uint16 *port)
 	if (!hc)
         g_error("%s: unknown host type: %d", G_STRFUNC, type);
 
-	/* iterate through whole list */
+	/* scan the whole sampling vector */
+
+	hs = hcache_store_by_class(hc->class);
+
+	for (i = 0; i < hc->sample_count; i++) {
+		const gnet_host_t *h = hs->entry[hc->sample[i]].host;
 
-	iter = hash_list_iterator(hc->hostlist);
-	while (NULL != (h = hash_list_iter_next(iter))) {
 		if (host_is_nearby(gnet_host_get_addr(h))) {
             *addr = gnet_host_get_addr(h);
             *port = gnet_host_get_port(h);
-			break;
+			hcache_unlink_host(hc, deconstify_pointer(h));
+			return TRUE;
 		}
 	}
-	hash_list_iter_release(&iter);
 
-	if (h) {
-		hcache_unlink_host(hc, h);
-		return TRUE;
-	}
 	return FALSE;
 }
 
@@ -1863,12 +1988,39 @@ hcache_free_null(hostcache_t **hc_ptr)
 
     g_assert(hc != NULL);
     g_assert(hash_list_length(hc->hostlist) == 0);
+	g_assert(0 == hc->sample_count);
 
 	hash_list_free(&hc->hostlist);
+	HFREE_NULL(hc->sample);
 	WFREE(hc);
 	*hc_ptr = NULL;
 }
 
+/**
+ * Load a host read from a persisted cache.
+ *
+ * @return TRUE if there are slots left for more hosts.
+ */
+static bool
+hcache_load_host(hostcache_t *hc, const host_addr_t addr, uint16 port,
+	time_t added, time_t now)
+{
+	/* NOTE: hcache_expire_cache() stops on the first item which has
+	 *		 not yet expired.
+	 */
+	if (
+		(time_t)-1 == added ||
+		delta_time(now, added) < 0 ||
+		delta_time(now, added) > HOSTCACHE_EXPIRY
+	) {
+		added = now - HOSTCACHE_EXPIRY;
+	}
+
+	hcache_add_internal(hc->type, added, addr, port, "on-disk cache");
+
+	return hcache_slots_left(hc->type) >= 1;
+}
+
 /**
  * Parse and load the hostcache file.
  */
@@ -1894,27 +2046,133 @@ hcache_load_file(hostcache_t *hc, FILE *f)
 		endptr = skip_ascii_spaces(endptr);
 		added = date2time(endptr, now);
 
-		/* NOTE: hcache_expire_cache() stops on the first item which has
-		 *		 not yet expired.
-		 */
-		if (
-			(time_t)-1 == added ||
-			delta_time(now, added) < 0 ||
-			delta_time(now, added) > HOSTCACHE_EXPIRY
-		) {
-			added = now - HOSTCACHE_EXPIRY;
+		if (!hcache_load_host(hc, addr, port, added, now))
+			break;
+	}
+
+	hcache_sort_by_added_time(hc->type);	/* Ensure cache sorted */
+}
+
+/**
+ * Load the records of a binary hostcache file held in memory.
+ *
+ * @return FALSE if the data is not a valid binary hostcache.
+ */
+static bool G_COLD
+hcache_load_binary(hostcache_t *hc, const char *data, size_t size)
+{
+	const char *p;
+	uint32 i, count;
+	time_t now;
+
+	if (
+		size < HCACHE_BIN_HEADER ||
+		0 != memcmp(data, HCACHE_BIN_MAGIC, 4) ||
+		HCACHE_BIN_VERSION != peek_be32(&data[4]) ||
+		HCACHE_BIN_RECORD != peek_be32(&data[8]) ||
+		0 != (size - HCACHE_BIN_HEADER) % HCACHE_BIN_RECORD
+	)
+		return FALSE;
+
+	count = (size - HCACHE_BIN_HEADER) / HCACHE_BIN_RECORD;
+
+	now = tm_time();
+	p = &data[HCACHE_BIN_HEADER];
+
+	for (i = 0; i < count; i++, p += HCACHE_BIN_RECORD) {
+		host_addr_t addr;
+
+		switch ((uint8) p[26]) {
+		case NET_TYPE_IPV4:
+			addr = host_addr_peek_ipv4(p);
+			break;
+		case NET_TYPE_IPV6:
+			addr = host_addr_peek_ipv6(p);
+			break;
+		default:
+			continue;
 		}
 
-		hcache_add_internal(hc->type, added, addr, port, "on-disk cache");
-		if (hcache_slots_left(hc->type) < 1)
+		if (!hcache_load_host(hc, addr, peek_be16(&p[24]),
+				(time_t) peek_be64(&p[16]), now))
 			break;
 	}
 
 	hcache_sort_by_added_time(hc->type);	/* Ensure cache sorted */
+
+	return TRUE;
+}
+
+/**
+ * Loads caught hosts from the binary file, if present.
+ *
+ * The file is memory-mapped when possible so that records are read
+ * directly from the page cache.
+ *
+ * @return TRUE if hosts were loaded from the binary file.
+ */
+static bool G_COLD
+hcache_retrieve_binary(hostcache_t *hc, const char *filename)
+{
+	char name[64];
+	char *path;
+	filestat_t sb;
+	void *p = MAP_FAILED;
+	char *buf = NULL;
+	size_t size = 0;
+	bool ok = FALSE;
+	int fd;
+
+	str_bprintf(ARYLEN(name), "%s.bin", filename);
+	path = make_pathname(settings_config_dir(), name);
+	fd = file_open_missing(path, O_RDONLY);
+	HFREE_NULL(path);
+
+	if (-1 == fd)
+		return FALSE;
+
+	if (-1 == fstat(fd, &sb) || !S_ISREG(sb.st_mode))
+		goto done;
+
+	if (
+		sb.st_size < HCACHE_BIN_HEADER ||
+		UNSIGNED(sb.st_size) >= MAX_INT_VAL(uint32)
+	)
+		goto done;
+
+	size = sb.st_size;
+
+#ifdef HAS_MMAP
+	p = vmm_mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (MAP_FAILED == p)
+		goto done;
+	ok = hcache_load_binary(hc, p, size);
+#else
+	buf = halloc(size);
+	if (size == UNSIGNED(read(fd, buf, size)))
+		ok = hcache_load_binary(hc, buf, size);
+#endif	/* HAS_MMAP */
+
+	if (!ok) {
+		g_warning("%s(): ignoring invalid %s file \"%s\"",
+			G_STRFUNC, hc->name, name);
+	}
+
+done:
+	fd_forget_and_close(&fd);
+	HFREE_NULL(buf);
+
+#ifdef HAS_MMAP
+	if (MAP_FAILED != p)
+		vmm_munmap(p, size);
+#endif	/* HAS_MMAP */
+
+	return ok;
 }
 
 /**
- * Loads caught hosts from text file.
+ * Loads caught hosts from binary file, or from text file if there is no
+ * valid binary file (as saved by versions which did not know about it).
  */
 static void
 hcache_retrieve(hostcache_t *hc, const char *filename)
@@ -1922,6 +2180,9 @@ hcache_retrieve(hostcache_t *hc, const char *filename)
 	file_path_t fp[1];
 	FILE *f;
 
+	if (hcache_retrieve_binary(hc, filename))
+		return;
+
 	file_path_set(fp, settings_config_dir(), filename);
 	f = file_config_open_read(hc->name, fp, N_ITEMS(fp));
 	if (f) {
@@ -1931,7 +2192,7 @@ hcache_retrieve(hostcache_t *hc, const char *filename)
 }
 
 /**
- * Write all data from cache to supplied file.
+ * Write all data from cache to supplied file, in binary form.
  */
 static void
 hcache_write(FILE *f, hostcache_t *hc)
@@ -1942,13 +2203,33 @@ hcache_write(FILE *f, hostcache_t *hc)
 	iter = hash_list_iterator(hc->hostlist);
 	while (NULL != (h = hash_list_iter_next(iter))) {
 		const hostcache_entry_t *hce;
+		host_addr_t addr;
+		char rec[HCACHE_BIN_RECORD];
 
 		hce = hcache_get_metadata(hc->class, h);
-    	if (hce == NULL || hce == NO_METADATA)
+    	if (hce == NULL)
 			continue;
 
-		fprintf(f, "%s %s\n",
-			gnet_host_to_string(h), timestamp_utc_to_string(hce->time_added));
+		ZERO(&rec);
+		addr = gnet_host_get_addr(h);
+
+		switch (host_addr_net(addr)) {
+		case NET_TYPE_IPV4:
+			poke_be32(rec, host_addr_ipv4(addr));
+			break;
+		case NET_TYPE_IPV6:
+			memcpy(rec, host_addr_ipv6(&addr), 16);
+			break;
+		case NET_TYPE_LOCAL:
+		case NET_TYPE_NONE:
+			continue;
+		}
+
+		poke_be64(&rec[16], hce->time_added);
+		poke_be16(&rec[24], gnet_host_get_port(h));
+		rec[26] = host_addr_net(addr);
+
+		fwrite(rec, sizeof rec, 1, f);
 	}
 	hash_list_iter_release(&iter);
 }
@@ -1962,18 +2243,27 @@ hcache_store(hcache_type_t type, const char *filename, hcache_type_t extra)
 {
 	FILE *f;
 	file_path_t fp;
+	char name[64];
+	char header[HCACHE_BIN_HEADER];
 
 	g_assert((uint) type < HCACHE_MAX && type != HCACHE_NONE);
 	g_assert((uint) extra < HCACHE_MAX);
 	g_assert(caches[type] != NULL);
 	g_assert(extra == HCACHE_NONE || caches[extra] != NULL);
 
-	file_path_set(&fp, settings_config_dir(), filename);
-	f = file_config_open_write(filename, &fp);
+	str_bprintf(ARYLEN(name), "%s.bin", filename);
+	file_path_set(&fp, settings_config_dir(), name);
+	f = file_config_open_write(name, &fp);
 
 	if (!f)
 		return;
 
+	memcpy(header, HCACHE_BIN_MAGIC, 4);
+	poke_be32(&header[4], HCACHE_BIN_VERSION);
+	poke_be32(&header[8], HCACHE_BIN_RECORD);
+	poke_be32(&header[12], 0);
+	fwrite(header, sizeof header, 1, f);
+
 	hcache_write(f, caches[type]);
 
 	if (extra != HCACHE_NONE)
@@ -2123,19 +2413,40 @@ hcache_periodic_save(void *unused_obj)
 	return TRUE;		/* Keep calling */
 }
 
+/**
+ * Initialize entry store for a host cache class.
+ */
+static void
+hcache_store_init(struct hcache_store *hs)
+{
+	ZERO(hs);
+	hs->ht =
+		htable_create_any(gnet_host_hash, gnet_host_hash2, gnet_host_equal);
+	hs->free = HCACHE_NIL;
+}
+
+/**
+ * Dispose of entry store, which must be empty.
+ */
+static void
+hcache_store_free(struct hcache_store *hs)
+{
+	g_assert(0 == hs->count);
+	g_assert(0 == htable_count(hs->ht));
+
+	htable_free_null(&hs->ht);
+	HFREE_NULL(hs->entry);
+}
+
 /**
  * Initialize host caches.
  */
 void G_COLD
 hcache_init(void)
 {
-	ht_known_hosts =
-		htable_create_any(gnet_host_hash, gnet_host_hash2, gnet_host_equal);
-	ht_g2_hosts =
-		htable_create_any(gnet_host_hash, gnet_host_hash2, gnet_host_equal);
-	ht_guess_hosts =
-		htable_create_any(gnet_host_hash, gnet_host_hash2, gnet_host_equal);
-	no_metadata = vmm_trap_page();
+	hcache_store_init(&store_known_hosts);
+	hcache_store_init(&store_g2_hosts);
+	hcache_store_init(&store_guess_hosts);
 
     caches[HCACHE_FRESH_ANY] = hcache_alloc(
         HCACHE_FRESH_ANY,
@@ -2310,13 +2621,9 @@ hcache_close(void)
 		hcache_free_null(&caches[type]);
 	}
 
-    g_assert(0 == htable_count(ht_known_hosts));
-    g_assert(0 == htable_count(ht_g2_hosts));
-    g_assert(0 == htable_count(ht_guess_hosts));
-
-	htable_free_null(&ht_known_hosts);
-	htable_free_null(&ht_g2_hosts);
-	htable_free_null(&ht_guess_hosts);
+	hcache_store_free(&store_known_hosts);
+	hcache_store_free(&store_g2_hosts);
+	hcache_store_free(&store_guess_hosts);
 	cq_periodic_remove(&hcache_timer_ev);
 }
 
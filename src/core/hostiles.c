@@ -59,6 +59,7 @@
 #include "lib/parse.h"
 #include "lib/path.h"
 #include "lib/random.h"
+#include "lib/rwlock.h"
 #include "lib/str.h"
 #include "lib/stringify.h"
 #include "lib/tm.h"
@@ -94,6 +95,14 @@ static struct iprange_db *hostile_db[NUM_HOSTILES];	/**< The hostile database */
 static hash_list_t *hl_dynamic_ipv4;
 static hash_list_t *hl_dynamic_ipv6;
 
+/*
+ * Query hits are checked by worker threads, so hostiles_check() may run
+ * concurrently with the updates made by the main thread.  The main thread
+ * takes the write lock when it changes the databases above, and needs no
+ * lock to read them.
+ */
+static rwlock_t hostiles_lock = RWLOCK_INIT;
+
 #define HOSTILES_DYNAMIC_PERIOD_MS	60161	/**< [ms]; about 1 minute (prime) */
 #define HOSTILES_DYNAMIC_PENALTY	43201	/**< [s]; about 12 hours (prime) */
 
@@ -264,15 +273,31 @@ hostiles_flags_to_string(const hostiles_flags_t flags)
 }
 
 /**
- * Frees all entries in the given hostiles.
+ * Install new database for the given hostiles, freeing the previous one.
  */
 static void
-hostiles_close_one(hostiles_t which)
+hostiles_install(hostiles_t which, struct iprange_db *db)
 {
+	struct iprange_db *old;
 	uint i = which;
 
 	g_assert(i < NUM_HOSTILES);
-	iprange_free(&hostile_db[i]);
+
+	rwlock_wlock(&hostiles_lock);
+	old = hostile_db[i];
+	hostile_db[i] = db;
+	rwlock_wunlock(&hostiles_lock);
+
+	iprange_free(&old);
+}
+
+/**
+ * Frees all entries in the given hostiles.
+ */
+static void
+hostiles_close_one(hostiles_t which)
+{
+	hostiles_install(which, NULL);
 }
 
 /**
@@ -288,11 +313,12 @@ hostiles_load(FILE *f, hostiles_t which)
 	int linenum = 0;
 	int bits;
 	iprange_err_t error;
+	struct iprange_db *db;
+	uint count;
 
 	g_assert(UNSIGNED(which) < NUM_HOSTILES);
-	g_assert(NULL == hostile_db[which]);
 
-	hostile_db[which] = iprange_new();
+	db = iprange_new();
 
 	while (fgets(ARYLEN(line), f)) {
 		linenum++;
@@ -317,7 +343,7 @@ hostiles_load(FILE *f, hostiles_t which)
 		}
 
 		bits = netmask_to_cidr(netmask);
-		error = iprange_add_cidr(hostile_db[which], ip, bits, 1);
+		error = iprange_add_cidr(db, ip, bits, 1);
 
 		switch (error) {
 		case IPR_ERR_OK:
@@ -333,14 +359,16 @@ hostiles_load(FILE *f, hostiles_t which)
 		}
 	}
 
-	iprange_sync(hostile_db[which]);
+	iprange_sync(db);
+	count = iprange_get_item_count(db);
 
 	if (GNET_PROPERTY(reload_debug)) {
 		g_debug("loaded %u addresses/netmasks from %s (%u hosts)",
-			iprange_get_item_count(hostile_db[which]), hostiles_what[which],
-			iprange_get_host_count4(hostile_db[which]));
+			count, hostiles_what[which], iprange_get_host_count4(db));
 	}
-	return iprange_get_item_count(hostile_db[which]);
+
+	hostiles_install(which, db);
+	return count;
 }
 
 /**
@@ -362,7 +390,6 @@ hostiles_changed(const char *filename, void *udata)
 	if (f == NULL)
 		return;
 
-	hostiles_close_one(which);
 	count = hostiles_load(f, which);
 	fclose(f);
 
@@ -586,8 +613,10 @@ hostiles_dynamic_timer(void *unused_udata)
 {
 	(void) unused_udata;
 
+	rwlock_wlock(&hostiles_lock);
 	hostiles_dynamic_expire4(FALSE);
 	hostiles_dynamic_expire6(FALSE);
+	rwlock_wunlock(&hostiles_lock);
 
 	return TRUE;		/* Keep calling */
 }
@@ -729,7 +758,11 @@ hostiles_dynamic_add(const host_addr_t addr, const char *reason,
 		uint32 ip = host_addr_ipv4(ipv4_addr);
 
 		if (!hostiles_static_check_ipv4(ip)) {
-			hostiles_flags_t nflags = hostiles_dynamic_add_ipv4(ip, flags);
+			hostiles_flags_t nflags;
+
+			rwlock_wlock(&hostiles_lock);
+			nflags = hostiles_dynamic_add_ipv4(ip, flags);
+			rwlock_wunlock(&hostiles_lock);
 
 			if (GNET_PROPERTY(spam_debug) > 1) {
 				hostiles_log_caught(ipv4_addr, reason, flags, nflags);
@@ -741,7 +774,11 @@ hostiles_dynamic_add(const host_addr_t addr, const char *reason,
 		ip = host_addr_ipv6(&addr);
 
 		if (!hostiles_static_check_ipv6(ip)) {
-			hostiles_flags_t nflags = hostiles_dynamic_add_ipv6(ip, flags);
+			hostiles_flags_t nflags;
+
+			rwlock_wlock(&hostiles_lock);
+			nflags = hostiles_dynamic_add_ipv6(ip, flags);
+			rwlock_wunlock(&hostiles_lock);
 
 			if (GNET_PROPERTY(spam_debug) > 1) {
 				hostiles_log_caught(addr, reason, flags, nflags);
@@ -789,6 +826,8 @@ hostiles_dynamic_check_ipv6(const uint8 *ipv6)
  *
  * @param ha	the host address to check.
  *
+ * This can be called from any thread.
+ *
  * @return HSTL_CLEAN if host is not hostile, the known hostile flags otherwise.
  */
 hostiles_flags_t
@@ -797,6 +836,8 @@ hostiles_check(const host_addr_t ha)
 	host_addr_t to;
 	hostiles_flags_t flags = HSTL_CLEAN;
 
+	rwlock_rlock(&hostiles_lock);
+
 	if (
 		host_addr_convert(ha, &to, NET_TYPE_IPV4) ||
 		host_addr_tunnel_client(ha, &to)
@@ -816,6 +857,8 @@ hostiles_check(const host_addr_t ha)
 			flags |= hostiles_static_check_ipv6(ip);
 	}
 
+	rwlock_runlock(&hostiles_lock);
+
 	return flags;
 }
 
@@ -1190,8 +1233,10 @@ hostiles_close(void)
 
 	gnet_prop_remove_prop_changed_listener(PROP_USE_GLOBAL_HOSTILES_TXT,
 		use_global_hostiles_txt_changed);
+	rwlock_wlock(&hostiles_lock);
 	hostiles_dynamic_expire4(TRUE);
 	hostiles_dynamic_expire6(TRUE);
+	rwlock_wunlock(&hostiles_lock);
 	hash_list_free(&hl_dynamic_ipv4);
 	hash_list_free(&hl_dynamic_ipv6);
 
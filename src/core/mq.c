@@ -40,9 +40,9 @@
 #include "gmsg.h"
 #include "gnet_stats.h"
 
-#include "lib/array_util.h"
+#include "lib/bit_array.h"
 #include "lib/cq.h"
-#include "lib/halloc.h"
+#include "lib/elist.h"
 #include "lib/htable.h"
 #include "lib/plist.h"
 #include "lib/pmsg.h"
@@ -50,7 +50,6 @@
 #include "lib/stringify.h"		/* For plural() */
 #include "lib/unsigned.h"		/* For size_saturate_add() */
 #include "lib/walloc.h"
-#include "lib/xsort_data.h"
 
 #include "if/gnet_property_priv.h"
 
@@ -58,10 +57,9 @@
 
 #define MQ_DEBUG_LVL(q)	(*q->debug)
 
-static void qlink_free(mqueue_t *q);
 static void mq_update_flowc(mqueue_t *q);
 static bool make_room_header(
-	mqueue_t *q, const char *header, uint prio, int needed, int *offset);
+	mqueue_t *q, const char *header, uint prio, int needed);
 static void mq_swift_timer(cqueue_t *cq, void *obj);
 
 /**
@@ -216,6 +214,251 @@ mq_info(const mqueue_t *q)
 	return buf;
 }
 
+/***
+ *** Flow-control index.
+ ***/
+
+/**
+ * The queue index dispatches queued messages into buckets, so that the least
+ * important messages can be located in constant time when we need to make
+ * room in a flow-controlled queue.
+ *
+ * Messages with the normal PMSG_P_DATA priority are bucketed by their rank,
+ * as computed by the user-supplied ``msg_rank'' callback.  Messages with a
+ * higher priority go to one bucket per priority, above all the ranks.
+ * Hence a lower bucket index always means a less important message.
+ *
+ * Each bucket keeps its messages in queuing order (oldest first) along with
+ * the total amount of bytes they hold.  A bitmap records non-empty buckets.
+ */
+#define MQ_BUCKETS		(MQ_RANKS + PMSG_P_COUNT - 1)
+
+/**
+ * An indexed queue item.
+ */
+struct mq_qitem {
+	plist_t *l;				/**< The queue link holding the message */
+	link_t lk;				/**< Embedded link in the bucket list */
+	int size;				/**< Message size when indexed */
+	uint bucket;			/**< Index of the bucket holding the item */
+};
+
+/**
+ * An index bucket.
+ */
+struct mq_bucket {
+	elist_t list;			/**< Indexed items, oldest first */
+	int size;				/**< Total amount of bytes in bucket */
+};
+
+struct mq_index {
+	struct mq_bucket bucket[MQ_BUCKETS];
+	bit_array_t used[BIT_ARRAY_SIZE(MQ_BUCKETS)];	/**< Non-empty buckets */
+	htable_t *items;		/**< Maps a plist_t to its struct mq_qitem */
+};
+
+/**
+ * Compute bucket index for a message.
+ *
+ * @param q			the queue
+ * @param header	the message header
+ * @param pdu		whether header points to a full PDU
+ * @param prio		the priority of the message
+ *
+ * @return bucket index
+ */
+static uint
+qindex_bucket(const mqueue_t *q, const void *header, bool pdu, uint prio)
+{
+	mq_msgrank_t rank;
+	uint r;
+
+	g_assert(prio < PMSG_P_COUNT);
+
+	if (prio != PMSG_P_DATA)
+		return MQ_RANKS + prio - 1;
+
+	rank = pdu ? q->uops->msg_rank : q->uops->msg_headrank;
+	r = NULL == rank ? 0 : (*rank)(header);
+
+	g_assert(r < MQ_RANKS);
+
+	return r;
+}
+
+/**
+ * Index linkable `l', which must not be already indexed.
+ */
+static void
+qindex_add(mqueue_t *q, plist_t *l)
+{
+	struct mq_index *qi = q->qindex;
+	struct mq_bucket *b;
+	struct mq_qitem *item;
+	const pmsg_t *mb = l->data;
+
+	g_assert(qi != NULL);
+	g_assert(mb != NULL);
+
+	WALLOC(item);
+	item->l = l;
+	item->size = pmsg_size(mb);
+	item->bucket = qindex_bucket(q, pmsg_phys_base(mb), TRUE, pmsg_prio(mb));
+
+	b = &qi->bucket[item->bucket];
+	elist_append(&b->list, item);
+	b->size += item->size;
+	bit_array_set(qi->used, item->bucket);
+
+	htable_insert(qi->items, l, item);
+}
+
+/**
+ * Remove linkable `l' from the queue index.
+ */
+static void
+qindex_remove(mqueue_t *q, plist_t *l)
+{
+	struct mq_index *qi = q->qindex;
+	struct mq_bucket *b;
+	struct mq_qitem *item;
+
+	g_assert(qi != NULL);
+
+	item = htable_lookup(qi->items, l);
+
+	if G_UNLIKELY(NULL == item) {
+		g_error("BUG: linkable %p for %s not found "
+			"(index has %zu items, queue has %d counted items, really %zd)",
+			(void *) l, mq_info(q), htable_count(qi->items),
+			q->count, plist_length(q->qhead));
+	}
+
+	b = &qi->bucket[item->bucket];
+	elist_remove(&b->list, item);
+	b->size -= item->size;
+	g_assert(b->size >= 0);
+
+	if (0 == elist_count(&b->list))
+		bit_array_clear(qi->used, item->bucket);
+
+	htable_remove(qi->items, l);
+	WFREE(item);
+}
+
+/**
+ * Create the queue index.
+ */
+static void
+qindex_create(mqueue_t *q)
+{
+	struct mq_index *qi;
+	plist_t *l;
+	uint i;
+	int n;
+
+	g_assert(NULL == q->qindex);
+
+	WALLOC(qi);
+	for (i = 0; i < MQ_BUCKETS; i++) {
+		elist_init(&qi->bucket[i].list, offsetof(struct mq_qitem, lk));
+		qi->bucket[i].size = 0;
+	}
+	bit_array_init(qi->used, MQ_BUCKETS);
+	qi->items = htable_create(HASH_KEY_SELF, 0);
+
+	q->qindex = qi;
+
+	/*
+	 * Index from the tail, where the oldest messages are, so that buckets
+	 * list their messages in queuing order.
+	 */
+
+	for (l = q->qtail, n = 0; l != NULL; l = plist_prev(l), n++) {
+		g_assert(l->data != NULL);
+		qindex_add(q, l);
+	}
+
+	if (n != q->count)
+		g_error("BUG: queue count of %d for %p is wrong (has %d)",
+			q->count, (void *) q, n);
+
+	mq_check(q, 0);
+}
+
+/**
+ * Free the queue index.
+ */
+static void
+qindex_free(mqueue_t *q)
+{
+	struct mq_index *qi = q->qindex;
+	htable_iter_t *iter;
+	void *item;
+
+	g_assert(qi != NULL);
+
+	iter = htable_iter_new(qi->items);
+	while (htable_iter_next(iter, NULL, &item)) {
+		struct mq_qitem *qt = item;
+		WFREE(qt);
+	}
+	htable_iter_release(&iter);
+
+	htable_free_null(&qi->items);
+	WFREE(qi);
+	q->qindex = NULL;
+}
+
+/**
+ * Find the first non-empty bucket in the index, starting at `from' and
+ * strictly below `limit'.
+ *
+ * @return the bucket index, (size_t) -1 if none.
+ */
+static inline size_t
+qindex_next(const struct mq_index *qi, size_t from, size_t limit)
+{
+	if (from >= limit)
+		return (size_t) -1;
+
+	return bit_array_first_set(qi->used, from, limit - 1);
+}
+
+/**
+ * Compute the amount of bytes held by messages we could drop from the
+ * buckets strictly below `limit'.
+ */
+static int
+qindex_droppable(const mqueue_t *q, size_t limit)
+{
+	const struct mq_index *qi = q->qindex;
+	const pmsg_t *tail;
+	size_t b;
+	int size = 0;
+
+	for (b = 0; (size_t) -1 != (b = qindex_next(qi, b, limit)); b++)
+		size += qi->bucket[b].size;
+
+	/*
+	 * The partially written message, if any, is necessarily at the tail of
+	 * the queue and cannot be dropped.
+	 */
+
+	tail = NULL == q->qtail ? NULL : q->qtail->data;
+
+	if (tail != NULL && pmsg_start(tail) != pmsg_phys_base(tail)) {
+		const struct mq_qitem *item = htable_lookup(qi->items, q->qtail);
+
+		g_assert(item != NULL);
+
+		if (item->bucket < limit)
+			size -= item->size;
+	}
+
+	return size;
+}
+
 #ifdef MQ_DEBUG
 /*
  * This hashtable tracks the queue owning a given glist linkable.
@@ -281,8 +524,8 @@ void
 mq_check_track(mqueue_t *q, int offset, const char *where, int line)
 {
 	int qcount;
-	int qlink_alive = 0;
-	int n;
+	htable_iter_t *iter;
+	const void *key;
 
 	g_assert(q);
 
@@ -298,38 +541,40 @@ mq_check_track(mqueue_t *q, int offset, const char *where, int line)
 			"%s has wrong q->count of %d (counted %d in list) at %s:%d",
 			mq_info(q), q->count, qcount, where, line);
 
-	if (q->qlink == NULL)
+	if (q->qindex == NULL)
 		return;
 
-	for (n = 0; n < q->qlink_count; n++) {
-		plist_t *item = q->qlink[n];
-		mqueue_t *owner;
+	iter = htable_iter_new(q->qindex->items);
 
-		if (item == NULL)
-			continue;
+	while (htable_iter_next(iter, &key, NULL)) {
+		const plist_t *item = key;
+		mqueue_t *owner;
 
-		qlink_alive++;
 		if (item->data == NULL)
-			g_error("BUG: linkable #%d/%d from %s is NULL at %s:%d",
-				n, q->qlink_count, mq_info(q), where, line);
+			g_error("BUG: indexed linkable %p from %s is NULL at %s:%d",
+				(void *) item, mq_info(q), where, line);
 
-		g_assert(qown);		/* If we have a qlink, we have added items */
+		g_assert(qown);		/* If we have an index, we have added items */
 
 		owner = htable_lookup(qown, item);
 		if (owner != q)
-			g_error("BUG: linkable #%d/%d from %s "
+			g_error("BUG: indexed linkable %p from %s "
 				"%s at %s:%d",
-				n, q->qlink_count, mq_info(q),
+				(void *) item, mq_info(q),
 				owner == NULL ?
 					"does not belong to any queue" :
 					"belongs to foreign queue",
 				where, line);
 	}
 
-	if (qlink_alive != qcount + offset)
-		g_error("BUG: qlink discrepancy for %s "
-		"(counted %d alive linkable, expected %d, queue has %d items) at %s:%d",
-		mq_info(q), qlink_alive, qcount + offset, qcount, where, line);
+	htable_iter_release(&iter);
+
+	if (htable_count(q->qindex->items) != (size_t) (qcount + offset))
+		g_error("BUG: index discrepancy for %s "
+		"(counted %zu indexed linkables, expected %d, queue has %d items) "
+		"at %s:%d",
+		mq_info(q), htable_count(q->qindex->items), qcount + offset, qcount,
+		where, line);
 }
 #else	/* !MQ_DEBUG */
 
@@ -370,8 +615,8 @@ mq_free(mqueue_t *q)
 
 	g_assert(n == q->count);
 
-	if (q->qlink)
-		qlink_free(q);
+	if (q->qindex)
+		qindex_free(q);
 
 	cq_cancel(&q->swift_ev);
 	plist_free_null(&q->qhead);
@@ -385,14 +630,18 @@ mq_free(mqueue_t *q)
  * Remove link from message queue and return the previous item.
  * The `size' parameter refers to the size of the removed message.
  *
- * The underlying message is freed and the size information on the
- * queue is updated, but not the flow-control information.
+ * The underlying message is freed, removed from the queue index, and the
+ * size information on the queue is updated, but not the flow-control
+ * information.
  */
 static plist_t *
 mq_rmlink_prev(mqueue_t *q, plist_t *l, int size)
 {
 	plist_t *prev = plist_prev(l);
 
+	if (q->qindex != NULL)
+		qindex_remove(q, l);
+
 	mq_remove_linkable(q, l);
 	q->qhead = plist_remove_link(q->qhead, l);
 	if (q->qtail == l)
@@ -499,7 +748,11 @@ mq_swift_checkpoint(mqueue_t *q, bool initial)
 	 *
 	 * These headers are used in turn to request message pruning from the
 	 * queue by comparing messages held in the queue with these headers,
-	 * using the user-supplied ``msg_headcmp'' comparison callback.
+	 * using the user-supplied ``msg_headrank'' ranking callback: all the
+	 * messages whose rank is lower than that of the template can go.
+	 *
+	 * Since the queue index keeps running byte counts per bucket, each
+	 * template costs at most a pass on the non-empty buckets below it.
 	 */
 
 	if (q->uops->msg_templates != NULL) {
@@ -510,7 +763,7 @@ mq_swift_checkpoint(mqueue_t *q, bool initial)
 			int old_size = q->size;
 			const void *base = iovec_base(&templates[i]);
 
-			if (make_room_header(q, base, PMSG_P_DATA, needed, NULL))
+			if (make_room_header(q, base, PMSG_P_DATA, needed))
 				break;
 
 			needed -= old_size - q->size;		/* Amount we removed */
@@ -610,8 +863,8 @@ mq_leave_flowc(mqueue_t *q)
 			node_addr(q->node), q->size);
 
 	q->flags &= ~(MQ_FLOWC|MQ_SWIFT);	/* Under low watermark, clear */
-	if (q->qlink)
-		qlink_free(q);
+	if (q->qindex)
+		qindex_free(q);
 
 	cq_cancel(&q->swift_ev);
 	node_tx_leave_flowc(q->node);	/* Signal end flow control */
@@ -661,7 +914,7 @@ mq_clear(mqueue_t *q)
 	 * If there are extended message blocks in the queue, freeing them
 	 * could cause the callback to attempt to queue something again.  Hence
 	 * we must mark we're clearing the queue to avoid deadly recursions that
-	 * would corrupt the qlink array.
+	 * would corrupt the queue index.
 	 */
 
 	q->flags |= MQ_CLEAR;
@@ -683,8 +936,8 @@ mq_clear(mqueue_t *q)
 
 	g_assert(q->count >= 0 && q->count <= 1);	/* At most one message */
 
-	if (q->qlink)
-		qlink_free(q);
+	if (q->qindex)
+		qindex_free(q);
 
 	q->flags &= ~MQ_CLEAR;
 
@@ -734,354 +987,32 @@ mq_flush(mqueue_t *q)
 	tx_flush(q->tx_drv);
 }
 
-/**
- * Compare two pointers to links based on their relative priorities, then
- * based on their held Gnutella messages.
- * -- qsort() callback but with an extra data parameter
- */
-static int
-qlink_cmp(const void *a, const void *b, void *data)
-{
-	const plist_t * const *l1 = a, * const *l2 = b;
-	const pmsg_t *m1 = (*l1)->data, *m2 = (*l2)->data;
-
-	if (pmsg_prio(m1) == pmsg_prio(m2)) {
-		const mqueue_t *q = data;
-		return q->uops->msg_cmp(pmsg_phys_base(m1), pmsg_phys_base(m2));
-	} else
-		return pmsg_prio(m1) < pmsg_prio(m2) ? -1 : +1;
-}
-
-/**
- * Create the `qlink' sorted array of queued items.
- */
-static void
-qlink_create(mqueue_t *q)
-{
-	plist_t *l;
-	int n;
-
-	g_assert(q->qlink == NULL);
-
-	HALLOC_ARRAY(q->qlink, q->count);
-
-	/*
-	 * Prepare sorting of queued messages.
-	 *
-	 * What's sorted is queue links, but the sorting criteria is the
-	 * user-supplied msg_cmp routine to compare the messages, when they
-	 * have the same priority.
-	 */
-
-	for (l = q->qhead, n = 0; l && n < q->count; l = plist_next(l), n++) {
-		g_assert(l->data != NULL);
-		q->qlink[n] = l;
-	}
-
-	if (l || n != q->count)
-		g_error("BUG: queue count of %d for %p is wrong (has %zd)",
-			q->count, (void *) q, plist_length(q->qhead));
-
-	/*
-	 * We use `n' and not `q->count' in case the warning above is emitted,
-	 * in which case we have garbage after the `n' first items.
-	 */
-
-	q->qlink_count = n;
-	xsort_with_data(q->qlink, n, sizeof q->qlink[0], qlink_cmp, q);
-
-	mq_check(q, 0);
-}
-
-/**
- * Free the `qlink' sorted array of queued items.
- */
-static void
-qlink_free(mqueue_t *q)
-{
-	g_assert(q->qlink);
-
-	HFREE_NULL(q->qlink);
-	q->qlink_count = 0;
-}
-
-/**
- * Insert linkable `l' within the sorted qlink array of linkables for the queue,
- * before the position indicated by `hint'.
- */
-static void
-qlink_insert_before(mqueue_t *q, int hint, plist_t *l)
-{
-	g_assert(hint >= 0 && hint < q->qlink_count);
-	g_assert(qlink_cmp(&q->qlink[hint], &l, q) >= 0);	/* `hint' >= `l' */
-	g_assert(l->data != NULL);
-
-	mq_check(q, -1);
-
-	/*
-	 * Lookup before the message for a NULL entry that we could fill.
-	 */
-
-	if (hint > 0 && q->qlink[hint - 1] == NULL) {
-		q->qlink[hint - 1] = l;
-		return;
-	}
-
-	/*
-	 * Extend the array then, and insert right at `hint' in the new array.
-	 */
-
-	q->qlink_count++;
-	HREALLOC_ARRAY(q->qlink, q->qlink_count);
-
-	ARRAY_INSERT(q->qlink, hint, q->qlink_count, l);
-}
-
-/**
- * Insert linkable `l' within the sorted qlink array of linkables.
- */
-static void
-qlink_insert(mqueue_t *q, plist_t *l)
-{
-	int low = 0;
-	int high = q->qlink_count - 1;
-	plist_t **qlink = q->qlink;
-
-	g_assert(l->data != NULL);
-
-	mq_check(q, -1);
-
-	/*
-	 * If `qlink' is empty, create a slot for the new entry.
-	 */
-
-	if (high < 0) {
-		g_assert(q->count == 1);		/* `l' is already part of the queue */
-		q->qlink_count++;
-		HREALLOC_ARRAY(q->qlink, q->qlink_count);
-		q->qlink[0] = l;
-		return;
-	}
-
-	/*
-	 * If lower than the beginning, insert at the head.
-	 */
-
-	if (qlink[low] != NULL && qlink_cmp(&l, &qlink[low], q) <= 0) {
-		qlink_insert_before(q, low, l);
-		return;
-	}
-
-	/*
-	 * If higher than the tail, insert at the tail.
-	 */
-
-	if (qlink[high] != NULL && qlink_cmp(&l, &qlink[high], q) >= 0) {
-		q->qlink_count++;
-		HREALLOC_ARRAY(q->qlink, q->qlink_count);
-		q->qlink[q->qlink_count - 1] = l;
-		return;
-	}
-
-	/*
-	 * The array is sorted, so we're going to use a dichotomic search
-	 * to find the right insertion point.  However, there can be NULLified
-	 * entries in the array, so this is not a plain dichotomic search.
-	 */
-
-	while (low <= high) {
-		int mid = low + (high - low) / 2;
-		int c;
-
-		/*
-		 * If we end up in a NULL spot, inspect the [low, high] range.
-		 */
-
-		if (qlink[mid] == NULL) {
-			int n;
-			int lowest_non_null = -1;
-			int highest_non_null = -1;
-
-			/*
-			 * Go back towards `low' to find a non-NULL entry.
-			 */
-
-			for (n = mid - 1; n >= low; n--) {
-				if (qlink[n] != NULL) {
-					lowest_non_null = n;
-					break;
-				}
-			}
-
-			/*
-			 * Go forward towards `high' to find a non-NULL entry.
-			 */
-
-			for (n = mid + 1; n <= high; n++) {
-				if (qlink[n] != NULL) {
-					highest_non_null = n;
-					break;
-				}
-			}
-
-			/*
-			 * If both `lowest_non_null' and `highest_non_null' are -1, we
-			 * have only NULLs, and the boundaries are NULL as well.
-			 */
-
-			if (lowest_non_null == -1) {
-				if (highest_non_null == -1) {
-					qlink[mid] = l;
-					return;
-				}
-				low = mid + 1;
-				continue;
-			} else if (highest_non_null == -1) {
-				high = mid - 1;
-				continue;
-			}
-
-			/*
-			 * We know that the final insertion point will be after `low'
-			 * and before `high'.  If there are only NULL entries between
-			 * the two, we're done...
-			 */
-
-			if (lowest_non_null <= low + 1 && highest_non_null >= high - 1) {
-				qlink[mid] = l;			/* Insert at the middle of the range */
-				return;
-			}
-
-			if (qlink_cmp(&l, &qlink[lowest_non_null], q) < 0) {
-				high = lowest_non_null - 1;
-				continue;
-			}
-
-			if (qlink_cmp(&l, &qlink[highest_non_null], q) > 0) {
-				low = highest_non_null + 1;
-				continue;
-			}
-
-			/*
-			 * `lowest_non_null' <= `l' <= `highest_non_null'
-			 */
-
-			low = lowest_non_null + 1;
-			high = highest_non_null - 1;
-
-			continue;
-		}
-
-		/*
-		 * Regular dichotomic case.
-		 */
-
-		c = qlink_cmp(&qlink[mid], &l, q);
-
-		if (c == 0) {
-			qlink_insert_before(q, mid, l);
-			return;
-		} else if (c < 0)
-			low = mid + 1;
-		else
-			high = mid - 1;
-	}
-
-	if (qlink[low] == NULL) {
-		qlink[low] = l;
-		return;
-	}
-
-	qlink_insert_before(q, low, l);
-}
-
-/**
- * Remove the entry in the `qlink' linkable array, allowing compaction
- * when there are too many holes.
- *
- * @param q			the message queue
- * @param l			the linkable to remove from the qlink indexer
- */
-static void
-qlink_remove(mqueue_t *q, plist_t *l)
-{
-	plist_t **qlink = q->qlink;
-	int n = q->qlink_count;
-
-	g_assert(qlink);
-	g_assert(n > 0);
-	g_assert(l->data != NULL);
-
-	mq_check(q, 0);
-
-	/*
-	 * If more entries in `qlink' than 3 times the amount of queued messages,
-	 * we have too many NULL in the array.
-	 */
-
-	if (n > q->count * 3) {
-		plist_t **dest = qlink;
-		int copied = 0;
-		bool found = FALSE;
-
-		while (n-- > 0) {
-			plist_t *entry = *qlink++;
-			if (entry == NULL)
-				continue;
-			else if (l == entry) {
-				found = TRUE;
-				continue;
-			}
-			*dest++ = entry;
-			copied++;
-		}
-
-		q->qlink_count = copied;
-
-		if (found)
-			return;
-	} else {
-		while (n-- > 0) {
-			if (l == *qlink) {
-				*qlink = NULL;
-				return;
-			}
-			qlink++;
-		}
-
-		/* Should have been found -- FALL THROUGH */
-	}
-
-	g_error("BUG: linkable %p for %s not found "
-		"(qlink has %d slots, queue has %d counted items, really %zd) at %s:%d",
-		(void *) l, mq_info(q),
-		q->qlink_count, q->count, plist_length(q->qhead),
-		_WHERE_, __LINE__);
-}
-
 /**
  * Attempt to make room in the queue to be able to enqueue the new message
  * whose header is specified.
  *
- * If `offset' is not null, it may be set with the offset within qlink where
- * the message immediately more prioritary than the new one can be found.
- * It is up to the caller to initialize it with -1 and check whether it has
- * been set.
+ * Only messages from buckets strictly below that of the new message are
+ * considered, the least important buckets first, and the oldest messages
+ * first within a bucket.
+ *
+ * When `partial' is FALSE, nothing is dropped unless we can make enough
+ * room, since the new message would be dropped anyway.
  *
  * @param q			the queue
  * @param header	pointer to the header of the new message
  * @param msglen	if non-zero, header points to a full PDU of msglen bytes
  * @param prio		the priority of the new message we want to enqueue
  * @param needed	the amount of room we want to make in the queue
- * @param offset	see above description
+ * @param partial	whether to drop messages even if we cannot make enough room
  *
  * @returns TRUE if we were able to make enough room.
  */
 static bool
 make_room_internal(mqueue_t *q,
-	const char *header, size_t msglen, uint prio, int needed, int *offset)
+	const char *header, size_t msglen, uint prio, int needed, bool partial)
 {
-	int n;
+	struct mq_index *qi;
+	size_t b, limit;
 	int dropped = 0;				/* Amount of messages dropped */
 
 	g_assert(needed > 0);
@@ -1095,116 +1026,81 @@ make_room_internal(mqueue_t *q,
 	if (q->qhead == NULL)			/* Queue is empty */
 		return FALSE;
 
-	if (q->qlink == NULL)			/* No cached sorted queue links */
-		qlink_create(q);
+	if (q->qindex == NULL)			/* No index on queued messages */
+		qindex_create(q);
+
+	qi = q->qindex;
+	limit = qindex_bucket(q, header, msglen != 0, prio);
+
+	/*
+	 * The running byte counts of the buckets tell us upfront whether we
+	 * can drop enough.
+	 */
 
-	g_assert(q->qlink);
+	if (!partial && qindex_droppable(q, limit) < needed)
+		return FALSE;
 
 	/*
-	 * Traverse the sorted links and prune as many messages as necessary.
+	 * Prune as many messages as necessary from the buckets that are less
+	 * important than the new message.
+	 *
 	 * Note that we try to prune at least one byte more than needed, hence
 	 * we stay in the loop even when needed reaches 0.
 	 *
-	 * To avoid freeing the qlink array every time we drop something, we
-	 * write NULLs at the entries we drop (which are then ignored
-	 * in the loop below).  When we break out because we found a more
-	 * prioritary message, we remember the index in the array and return it
-	 * to the caller.  If the message is finally inserted in the queue,
-	 * we can insert its plist_t link right before that index.
-	 *
-	 * This adds some complexity but it will avoid millions of calls to
-	 * qlink_cmp(), which is costly.
-	 *
-	 * The qlink array is freed when we leave flow control.  During FC, we
-	 * need to find the messages we're removing after writing them to the
-	 * network, so we can NULLify the corresponding slot in the qlink array.
+	 * If we reach the bucket of the new message, then we haven't removed
+	 * enough.  This is the only case where we don't necessarily attempt to
+	 * prune more than requested, i.e. we'll return TRUE if needed == 0.
 	 */
 
-	for (n = 0; needed >= 0 && n < q->qlink_count; n++) {
-		plist_t *item = q->qlink[n];
-		pmsg_t *cmb;
-		char *cmb_start;
-		int cmb_size;
+	for (
+		b = qindex_next(qi, 0, limit);
+		needed >= 0 && (size_t) -1 != b;
+		b = qindex_next(qi, b + 1, limit)
+	) {
+		struct mq_bucket *bucket = &qi->bucket[b];
+		struct mq_qitem *item, *next;
 
-		/*
-		 * If slot was NULLified, skip it.
-		 */
+		for (item = elist_head(&bucket->list); item != NULL; item = next) {
+			pmsg_t *cmb = item->l->data;
+			int cmb_size;
 
-		if (item == NULL)
-			continue;
+			if (needed < 0)
+				break;
 
-		cmb = item->data;
-		cmb_start = pmsg_phys_base(cmb);
+			next = elist_next_data(&bucket->list, item);
 
-		/*
-		 * Any partially written message, however unimportant, cannot be
-		 * removed or we'd break the flow of messages.
-		 */
+			/*
+			 * Any partially written message, however unimportant, cannot be
+			 * removed or we'd break the flow of messages.
+			 */
 
-		if (pmsg_start(cmb) != cmb_start)	/* Started to write it  */
-			continue;
+			if (pmsg_start(cmb) != pmsg_phys_base(cmb))	/* Started to write */
+				continue;
 
-		/*
-		 * If we reach a message equally or more important than the message
-		 * we're trying to enqueue, then we haven't removed enough.  Stop!
-		 *
-		 * This is the only case where we don't necessarily attempt to prune
-		 * more than requested, i.e. we'll return TRUE if needed == 0.
-		 * (it's necessarily >= 0 if we're in the loop)
-		 */
+			/*
+			 * Drop message.
+			 */
 
-		if (0 == msglen) {
-			if (q->uops->msg_headcmp(cmb_start, header) >= 0) {
-				if (offset != NULL)
-					*offset = n;
-				break;
-			}
-		} else {
-			if (q->uops->msg_cmp(cmb_start, header) >= 0) {
-				if (offset != NULL)
-					*offset = n;
-				break;
+			if (MQ_DEBUG_LVL(q) > 4 && q->uops->msg_log != NULL) {
+				q->uops->msg_log(cmb, "to %s %s node %s, in favor of %s",
+					(q->flags & MQ_SWIFT) ? "SWIFT" : "FLOWC",
+					NODE_USES_UDP(q->node) ? "UDP" : "TCP",
+					node_addr(q->node), msglen ?
+						gmsg_infostr_full(header, msglen) :
+						gmsg_infostr(header));
 			}
-		}
 
-		/*
-		 * If we reach a message whose priority is higher than ours, stop.
-		 * A less prioritary message cannot supersede a higher priority one,
-		 * even if its embedded Gnet message is deemed less important.
-		 */
+			if (q->uops->msg_flowc != NULL)
+				q->uops->msg_flowc(q->node, cmb);
 
-		if (pmsg_prio(cmb) > prio) {
-			if (offset != NULL)
-				*offset = n;
-			break;
-		}
+			cmb_size = pmsg_size(cmb);
+			needed -= cmb_size;
+			(void) mq_rmlink_prev(q, item->l, cmb_size);	/* Frees item */
 
-		/*
-		 * Drop message.
-		 */
+			dropped++;
 
-		if (MQ_DEBUG_LVL(q) > 4 && q->uops->msg_log != NULL) {
-			q->uops->msg_log(cmb, "to %s %s node %s, in favor of %s",
-				(q->flags & MQ_SWIFT) ? "SWIFT" : "FLOWC",
-				NODE_USES_UDP(q->node) ? "UDP" : "TCP",
-				node_addr(q->node), msglen ?
-					gmsg_infostr_full(header, msglen) : gmsg_infostr(header));
+			mq_check(q, 0);
 		}
-
-		if (q->uops->msg_flowc != NULL)
-			q->uops->msg_flowc(q->node, cmb);
-
-		cmb_size = pmsg_size(cmb);
-
-		g_assert(q->qlink[n] == item);
-
-		needed -= cmb_size;
-		q->qlink[n] = NULL;
-		(void) mq_rmlink_prev(q, item, cmb_size);
-
-		dropped++;
-
-		mq_check(q, 0);
 	}
 
 	if (dropped)
@@ -1246,32 +1142,30 @@ make_room_internal(mqueue_t *q,
  * Remove from the queue enough messages that are less prioritary than
  * the current one, so as to make sure we can enqueue it.
  *
- * If `offset' is not null, it may be set with the offset within qlink where
- * the message immediately more prioritary than `mb' can be found.  It is
- * up to the caller to initialize it with -1 and check whether it has been
- * set.
+ * Nothing is removed if we cannot make enough room.
  *
  * @returns TRUE if we were able to make enough room.
  */
 static bool
-make_room(mqueue_t *q, const pmsg_t *mb, int needed, int *offset)
+make_room(mqueue_t *q, const pmsg_t *mb, int needed)
 {
 	const char *header = pmsg_phys_base(mb);
 	uint prio = pmsg_prio(mb);
 	size_t msglen = pmsg_written_size(mb);
 
-	return make_room_internal(q, header, msglen, prio, needed, offset);
+	return make_room_internal(q, header, msglen, prio, needed, FALSE);
 }
 
 /**
  * Same as make_room(), but we are not given a "pmsg_t" as a comparison
  * point but a Gnutella header and a message priority explicitly.
+ *
+ * Messages are removed even if we cannot make enough room.
  */
 static bool
-make_room_header(
-	mqueue_t *q, const char *header, uint prio, int needed, int *offset)
+make_room_header(mqueue_t *q, const char *header, uint prio, int needed)
 {
-	return make_room_internal(q, header, 0, prio, needed, offset);
+	return make_room_internal(q, header, 0, prio, needed, TRUE);
 }
 
 /**
@@ -1281,7 +1175,6 @@ static void
 mq_puthere(mqueue_t *q, pmsg_t *mb, int msize)
 {
 	int needed;
-	int qlink_offset = -1;
 	plist_t *new = NULL;
 	bool make_room_called = FALSE;
 	bool has_normal_prio = (pmsg_prio(mb) == PMSG_P_DATA);
@@ -1299,7 +1192,7 @@ mq_puthere(mqueue_t *q, pmsg_t *mb, int msize)
 		has_normal_prio &&
 		gmsg_can_drop(pmsg_phys_base(mb), msize) &&
 		((make_room_called = TRUE)) &&			/* Call make_room() once only */
-		!make_room(q, mb, msize, &qlink_offset)
+		!make_room(q, mb, msize)
 	) {
 		g_assert(pmsg_is_unread(mb));			/* Not partially written */
 		if (MQ_DEBUG_LVL(q) > 4 && q->uops->msg_log != NULL)
@@ -1326,7 +1219,7 @@ mq_puthere(mqueue_t *q, pmsg_t *mb, int msize)
 
 	if (
 		needed > 0 &&
-		(make_room_called || !make_room(q, mb, needed, &qlink_offset))
+		(make_room_called || !make_room(q, mb, needed))
 	) {
 		/*
 		 * Close the connection only if the message is a prioritary one
@@ -1451,23 +1344,12 @@ mq_puthere(mqueue_t *q, pmsg_t *mb, int msize)
 	q->count++;
 
 	/*
-	 * If `qlink' is not NULL, insert `new' within it.
-	 *
-	 * We have two options: we called make_room() and have `qlink_offset'
-	 * set to something other than -1.  In that case, this is the offset
-	 * of the message more prioritary that us.
-	 *
-	 * We have not called make_room() yet: we need to scan the `qlink' array
-	 * to find the proper insertion place.
+	 * If we have a queue index, insert `new' within it.
 	 */
 
-	if (q->qlink) {			/* Inserted something, `qlink' is stale */
+	if (q->qindex) {
 		g_assert(new != NULL);
-
-		if (qlink_offset != -1)
-			qlink_insert_before(q, qlink_offset, new);
-		else
-			qlink_insert(q, new);
+		qindex_add(q, new);
 	}
 
 	/*
@@ -1493,7 +1375,6 @@ mq_putq(mqueue_t *q, pmsg_t *mb)
 
 static const struct mq_cops mq_cops = {
 	mq_puthere,				/**< puthere */
-	qlink_remove,			/**< qlink_remove */
 	mq_rmlink_prev,			/**< rmlink_prev */
 	mq_update_flowc,		/**< update_flowc */
 };
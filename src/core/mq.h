@@ -49,6 +49,7 @@
 typedef struct mqueue mqueue_t;
 
 struct mq_ops;
+struct mq_index;
 
 /**
  * When invoked from the message queue, this callback must return a vector
@@ -87,6 +88,24 @@ typedef void (*mq_msgcount_t)(void *node, const pmsg_t *mb);
 typedef void (*mq_msglog_t)(const pmsg_t *mb, const char *fmt, ...)
 	G_PRINTF(2, 3);
 
+#define MQ_RANKS	160		/**< Amount of distinct message ranks */
+
+/**
+ * Message ranking callback, used to dispatch queued messages into buckets
+ * during flow-control so that victims can be selected without sorting.
+ *
+ * Ranks are a coarse version of the ``msg_cmp'' ordering: when the rank of
+ * message A is lower than that of B, then A must compare lower than B.
+ * Messages with the same rank are considered equally important.
+ *
+ * When the callback is NULL, all the messages are given rank 0.
+ *
+ * @param header		the message (only its header for ``msg_headrank'')
+ *
+ * @return the message rank, between 0 and MQ_RANKS - 1.
+ */
+typedef uint (*mq_msgrank_t)(const void *header);
+
 /**
  * User-supplied parameters, which are callbacks necessary for the message
  * queue operations but which are dependent on the messages being enqueued.
@@ -94,6 +113,8 @@ typedef void (*mq_msglog_t)(const pmsg_t *mb, const char *fmt, ...)
 struct mq_uops {
 	cmp_fn_t msg_cmp;			/**< Message (priority) comparison routine */
 	cmp_fn_t msg_headcmp;		/**< Only compare message "headers" */
+	mq_msgrank_t msg_rank;		/**< Message rank, for flow-control */
+	mq_msgrank_t msg_headrank;	/**< Only rank message "headers" */
 	mq_msgtmp_t msg_templates;	/**< Get message templates for "swift" mode */
 	mq_msgcount_t msg_sent;		/**< Message sent */
 	mq_msgcount_t msg_flowc;	/**< Message dropped by flow-control */
@@ -119,7 +140,6 @@ struct mq_ops {
 
 struct mq_cops {
 	void (*puthere)(mqueue_t *q, pmsg_t *mb, int msize);
-	void (*qlink_remove)(mqueue_t *q, plist_t *l);
 	plist_t *(*rmlink_prev)(mqueue_t *q, plist_t *l, int size);
 	void (*update_flowc)(mqueue_t *q);
 };
@@ -139,9 +159,10 @@ enum mq_magic {
  * and remains in effect until we reach the low watermark, thereby providing
  * the necessary hysteresis.
  *
- * The `qlink' field is used during flow-control.  It contains a sorted (by
- * priority) array of all the items in the list.  It is dynamically allocated
- * and freed as needed.
+ * The `qindex' field is used during flow-control.  It dispatches all the
+ * items of the list into buckets, by priority and message rank, so that
+ * the least important messages can be found quickly.  It is dynamically
+ * allocated and freed as needed.
  *
  * The `header' is used to hold the function/hops/TTL of a reference message
  * to be used as a comparison point when speeding up dropping in flow-control.
@@ -153,12 +174,12 @@ struct mqueue {
 	const struct mq_cops *cops;		/**< Common operations */
 	const struct mq_uops *uops;		/**< User-defined operations */
 	txdrv_t *tx_drv;				/**< Network TX stack driver */
-	plist_t *qhead, *qtail, **qlink;
+	plist_t *qhead, *qtail;
+	struct mq_index *qindex;	/**< Flow-control index, NULL if none */
 	slist_t *qwait;			/**< Waiting queue during putq recursions */
 	cevent_t *swift_ev;		/**< Callout queue event in "swift" mode */
 	const uint32 *debug;	/**< Debug config variable for this queue */
 	int swift_elapsed;		/**< Scheduled elapsed time, in ms */
-	int qlink_count;		/**< Amount of entries in `qlink' */
 	int maxsize;			/**< Maximum size of this queue (total queued) */
 	int count;				/**< Amount of messages queued */
 	int hiwat;				/**< High watermark */
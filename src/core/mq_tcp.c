@@ -162,8 +162,6 @@ again:
 		} else {
 			if (q->uops->msg_flowc != NULL)
 				q->uops->msg_flowc(q->node, mb);	/* Done before msg freed */
-			if (q->qlink)
-				q->cops->qlink_remove(q, l);
 
 			/* drop the message, will be freed by mq_rmlink_prev() */
 			l = q->cops->rmlink_prev(q, l, pmsg_size(mb));
@@ -232,8 +230,6 @@ again:
 			if (q->uops->msg_sent != NULL)
 				q->uops->msg_sent(q->node, mb);
 			r -= iovec_len(ie);
-			if (q->qlink)
-				q->cops->qlink_remove(q, l);
 			l = q->cops->rmlink_prev(q, l, iovec_len(ie));
 		} else {
 			g_assert(r > 0 && r < pmsg_size(mb));
@@ -338,7 +334,7 @@ again:
 
 	/*
 	 * Protect against recursion: we must not invoke puthere() whilst in
-	 * the middle of another putq() or we would corrupt the qlink array:
+	 * the middle of another putq() or we would corrupt the queue index:
 	 * Messages received during recursion are inserted into the qwait list
 	 * and will be stuffed back into the queue when the initial putq() ends.
 	 *		--RAM, 2006-12-29
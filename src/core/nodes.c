@@ -104,6 +104,7 @@
 #include "lib/aging.h"
 #include "lib/ascii.h"
 #include "lib/atoms.h"
+#include "lib/buf.h"
 #include "lib/concat.h"
 #include "lib/cq.h"
 #include "lib/cstr.h"
@@ -123,6 +124,7 @@
 #include "lib/hstrfn.h"
 #include "lib/htable.h"
 #include "lib/iovec.h"
+#include "lib/latency.h"
 #include "lib/listener.h"
 #include "lib/log.h"			/* For log_printable() */
 #include "lib/nid.h"
@@ -2125,10 +2127,13 @@ node_real_remove(gnutella_node_t *n)
 	g_return_if_fail(n);
 	node_check(n);
 
-    /*
-     * Tell the frontend that the node was removed.
-     */
-    node_fire_node_removed(n);
+	/*
+	 * Tell the frontend that the node was removed, unless it is a replay
+	 * node, which was never announced through node_fire_node_added().
+	 */
+
+	if (!NODE_IS_REPLAY(n))
+		node_fire_node_removed(n);
 
 	sl_nodes = pslist_remove(sl_nodes, n);
 	hikset_remove(nodes_by_id, NODE_ID(n));
@@ -2214,48 +2219,16 @@ node_decrement_counters(const gnutella_node_t *n)
 }
 
 /**
- * The vectorized (message-wise) version of node_remove().
+ * Release the per-node state gathered whilst processing messages from the
+ * node: routing and query routing data, query tables, pending callouts,
+ * push-proxy state and the GUID registration.
+ *
+ * This is the part of node_remove() that does not depend on the node being
+ * a real connection, so that replay nodes can be disposed of as well.
  */
-static void G_PRINTF(2, 0)
-node_remove_v(gnutella_node_t *n, const char *reason, va_list ap)
+static void
+node_free_state(gnutella_node_t *n)
 {
-	node_check(n);
-	g_assert(n->status != GTA_NODE_REMOVING);
-	g_assert(!NODE_USES_UDP(n));
-
-	if (reason && no_reason != reason) {
-		str_vbprintf(ARYLEN(n->error_str), reason, ap);
-		n->remove_msg = n->error_str;
-	} else if (n->status != GTA_NODE_SHUTDOWN)	/* Preserve shutdown error */
-		n->remove_msg = NULL;
-
-	if (GNET_PROPERTY(node_debug) > 3)
-		g_debug("%s removed: %s", node_infostr(n),
-			n->remove_msg ? n->remove_msg : "<no reason>");
-
-	if (GNET_PROPERTY(node_debug) > 4) {
-		g_debug("NODE [%d.%d] %s TX=%d (drop=%d) RX=%d (drop=%d) "
-			"Dup=%d Bad=%d W=%d",
-			n->proto_major, n->proto_minor, node_infostr(n),
-			n->sent, n->tx_dropped, n->received, n->rx_dropped,
-			n->n_dups, n->n_bad, n->n_weird);
-		g_debug("NODE \"%s%s\" %s PING (drop=%d acpt=%d spec=%d sent=%d) "
-			"PONG (rcvd=%d sent=%d)",
-			(n->attrs & NODE_A_PONG_CACHING) ? "new" : "old",
-			(n->attrs & NODE_A_PONG_ALIEN) ? "-alien" : "",
-			node_addr(n),
-			n->n_ping_throttle, n->n_ping_accepted, n->n_ping_special,
-			n->n_ping_sent, n->n_pong_received, n->n_pong_sent);
-	}
-
-	if (NODE_TALKS_G2(n)) {
-		sl_g2_nodes = pslist_remove(sl_g2_nodes, n);
-	} else {
-		if (NODE_IS_ULTRA(n)) {
-			sl_up_nodes = pslist_remove(sl_up_nodes, n);
-		}
-		sl_gnet_nodes = pslist_remove(sl_gnet_nodes, n);
-	}
 	if (n->routing_data) {
 		routing_node_remove(n);
 		n->routing_data = NULL;
@@ -2300,6 +2273,107 @@ node_remove_v(gnutella_node_t *n, const char *reason, va_list ap)
 	if (n->rxfc) {
 		WFREE_TYPE_NULL(n->rxfc);
 	}
+	if (n->searchq) {
+		sq_free(n->searchq);
+		n->searchq = NULL;
+	}
+
+	cq_cancel(&n->tsync_ev);
+	cq_cancel(&n->dht_nope_ev);
+
+	node_proxying_remove(n);
+
+	if (is_host_addr(n->proxy_addr)) {
+		pproxy_set_remove(proxies, n->proxy_addr, n->proxy_port);
+		pdht_prox_publish_if_changed();
+	}
+	string_table_free(htable_ptr_cast_to_hash(&n->qseen));
+	string_table_free(hset_ptr_cast_to_hash(&n->qrelayed));
+	string_table_free(hset_ptr_cast_to_hash(&n->qrelayed_old));
+	if (n->guid) {
+		hikset_remove(nodes_by_guid, n->guid);
+		atom_guid_free_null(&n->guid);
+	}
+}
+
+/**
+ * Detach a replay node that would otherwise be removed, shut down or
+ * sent a BYE.
+ *
+ * Replay nodes are not accounted as connected nodes and have no I/O
+ * stacks, so we merely flag them as being removed: the replay layer
+ * will notice and dispose of the node via node_replay_free().
+ */
+static void G_PRINTF(2, 0)
+node_replay_detach(gnutella_node_t *n, const char *reason, va_list ap)
+{
+	g_assert(NODE_IS_REPLAY(n));
+
+	if (reason && no_reason != reason) {
+		str_vbprintf(ARYLEN(n->error_str), reason, ap);
+		n->remove_msg = n->error_str;
+	} else {
+		n->remove_msg = NULL;
+	}
+
+	if (GNET_PROPERTY(node_debug) > 3)
+		g_debug("%s detached: %s", node_infostr(n),
+			n->remove_msg ? n->remove_msg : "<no reason>");
+
+	n->status = GTA_NODE_REMOVING;
+	n->flags &= ~NODE_F_READABLE;
+}
+
+/**
+ * The vectorized (message-wise) version of node_remove().
+ */
+static void G_PRINTF(2, 0)
+node_remove_v(gnutella_node_t *n, const char *reason, va_list ap)
+{
+	node_check(n);
+	g_assert(n->status != GTA_NODE_REMOVING);
+
+	if G_UNLIKELY(NODE_IS_REPLAY(n)) {
+		node_replay_detach(n, reason, ap);
+		return;
+	}
+
+	g_assert(!NODE_USES_UDP(n));
+
+	if (reason && no_reason != reason) {
+		str_vbprintf(ARYLEN(n->error_str), reason, ap);
+		n->remove_msg = n->error_str;
+	} else if (n->status != GTA_NODE_SHUTDOWN)	/* Preserve shutdown error */
+		n->remove_msg = NULL;
+
+	if (GNET_PROPERTY(node_debug) > 3)
+		g_debug("%s removed: %s", node_infostr(n),
+			n->remove_msg ? n->remove_msg : "<no reason>");
+
+	if (GNET_PROPERTY(node_debug) > 4) {
+		g_debug("NODE [%d.%d] %s TX=%d (drop=%d) RX=%d (drop=%d) "
+			"Dup=%d Bad=%d W=%d",
+			n->proto_major, n->proto_minor, node_infostr(n),
+			n->sent, n->tx_dropped, n->received, n->rx_dropped,
+			n->n_dups, n->n_bad, n->n_weird);
+		g_debug("NODE \"%s%s\" %s PING (drop=%d acpt=%d spec=%d sent=%d) "
+			"PONG (rcvd=%d sent=%d)",
+			(n->attrs & NODE_A_PONG_CACHING) ? "new" : "old",
+			(n->attrs & NODE_A_PONG_ALIEN) ? "-alien" : "",
+			node_addr(n),
+			n->n_ping_throttle, n->n_ping_accepted, n->n_ping_special,
+			n->n_ping_sent, n->n_pong_received, n->n_pong_sent);
+	}
+
+	if (NODE_TALKS_G2(n)) {
+		sl_g2_nodes = pslist_remove(sl_g2_nodes, n);
+	} else {
+		if (NODE_IS_ULTRA(n)) {
+			sl_up_nodes = pslist_remove(sl_up_nodes, n);
+		}
+		sl_gnet_nodes = pslist_remove(sl_gnet_nodes, n);
+	}
+	node_free_state(n);
 
 	if (n->status == GTA_NODE_SHUTDOWN) {
 		if (NODE_TALKS_G2(n)) {
@@ -2323,10 +2397,6 @@ node_remove_v(gnutella_node_t *n, const char *reason, va_list ap)
 		HFREE_NULL(n->data);
 		n->allocated = 0;
 	}
-	if (n->searchq) {
-		sq_free(n->searchq);
-		n->searchq = NULL;
-	}
 	if (n->rx)					/* RX stack freed by node_real_remove() */
 		node_disable_read(n);
 	if (n->outq)				/* TX stack freed by node_real_remove() */
@@ -2340,9 +2410,6 @@ node_remove_v(gnutella_node_t *n, const char *reason, va_list ap)
 		n->flags &= ~(NODE_F_EOF_WAIT|NODE_F_BYE_WAIT);
 	}
 
-	cq_cancel(&n->tsync_ev);
-	cq_cancel(&n->dht_nope_ev);
-
 	/* Routine pre-condition asserted that n->status != GTA_NODE_REMOVING */
 
 	node_ht_connected_nodes_remove(n);
@@ -2351,19 +2418,6 @@ node_remove_v(gnutella_node_t *n, const char *reason, va_list ap)
 	n->flags &= ~(NODE_F_WRITABLE|NODE_F_READABLE|NODE_F_BYE_SENT);
 	n->last_update = tm_time();
 
-	node_proxying_remove(n);
-
-	if (is_host_addr(n->proxy_addr)) {
-		pproxy_set_remove(proxies, n->proxy_addr, n->proxy_port);
-		pdht_prox_publish_if_changed();
-	}
-	string_table_free(htable_ptr_cast_to_hash(&n->qseen));
-	string_table_free(hset_ptr_cast_to_hash(&n->qrelayed));
-	string_table_free(hset_ptr_cast_to_hash(&n->qrelayed_old));
-	if (n->guid) {
-		hikset_remove(nodes_by_guid, n->guid);
-		atom_guid_free_null(&n->guid);
-	}
 	if (n->attrs & NODE_A_CAN_HSEP)
 		hsep_connection_close(n, in_shutdown);
 
@@ -3014,6 +3068,12 @@ node_shutdown_v(gnutella_node_t *n, const char *reason, va_list args)
 {
 	node_check(n);
 
+	if G_UNLIKELY(NODE_IS_REPLAY(n)) {
+		if (n->status != GTA_NODE_REMOVING)
+			node_replay_detach(n, reason, args);
+		return;
+	}
+
 	if (n->status == GTA_NODE_SHUTDOWN) {
 		node_recursive_shutdown_v(n, "Shutdown", reason, args);
 		return;
@@ -3063,6 +3123,13 @@ node_bye_v(gnutella_node_t *n, int code, const char *reason, va_list ap)
 	char *reason_base = &reason_fmt[2];	/* Leading 2 bytes for code */
 
 	node_check(n);
+
+	if G_UNLIKELY(NODE_IS_REPLAY(n)) {
+		if (n->status != GTA_NODE_REMOVING)
+			node_replay_detach(n, reason, ap);
+		return;
+	}
+
 	g_assert(!NODE_USES_UDP(n));
 
 	if (n->status == GTA_NODE_SHUTDOWN) {
@@ -4930,6 +4997,8 @@ node_net_stack_create(gnutella_node_t *n)
 static struct mq_uops node_mq_cb = {
 	gmsg_cmp,					/* msg_cmp */
 	gmsg_headcmp,				/* msg_headcmp */
+	gmsg_rank,					/* msg_rank */
+	gmsg_headrank,				/* msg_headrank */
 	gmsg_mq_templates,			/* msg_templates */
 	node_msg_accounting,		/* msg_sent */
 	node_msg_flowc,				/* msg_flowc */
@@ -4940,6 +5009,8 @@ static struct mq_uops node_mq_cb = {
 static struct mq_uops node_g2_mq_cb = {
 	node_g2_msg_zero,			/* msg_cmp */
 	node_g2_msg_zero,			/* msg_headcmp */
+	NULL,						/* msg_rank -- all messages equal */
+	NULL,						/* msg_headrank */
 	NULL,						/* msg_templates -- can be NULL */
 	node_g2_msg_accounting,		/* msg_sent */
 	node_g2_msg_flowc,			/* msg_flowc */
@@ -9049,6 +9120,8 @@ node_parse(gnutella_node_t *n)
 	query_hashvec_t *qhv = NULL;
 	int results = 0;						/* # of results in query hits */
 	search_request_info_t *sri = NULL;
+	tm_nano_t start;
+	bool handle;
 
 	g_return_if_fail(n != NULL);
 	g_assert(NODE_IS_CONNECTED(n));
@@ -9369,7 +9442,11 @@ node_parse(gnutella_node_t *n)
 	/* Compute route (destination) then handle the message if required */
 
 route_only:
-	if (route_message(&n, &dest)) {		/* We have to handle the message */
+	latency_begin(&start);
+	handle = route_message(&n, &dest);
+	latency_end("core", func_to_pointer(route_message), &start);
+
+	if (handle) {		/* We have to handle the message */
 		node_check(n);
 
 		switch (gnutella_header_get_function(&n->header)) {
@@ -9409,7 +9486,9 @@ route_only:
 				qhvec_reset(qhv);
 			}
 
+			latency_begin(&start);
 			search_request(n, sri, qhv);
+			latency_end("core", func_to_pointer(search_request), &start);
 			break;
 
 		case GTA_MSG_SEARCH_RESULTS:
@@ -9420,7 +9499,7 @@ route_only:
 
 			/* Only handle if no unknown header flags */
 			if (0 == n->header_flags)
-				drop = search_results(n, &results);
+				drop = search_results(n, &results, ROUTE_NONE != dest.type);
 			break;
 
 		default:
@@ -9458,7 +9537,10 @@ route_only:
 					 */
 					qhv = query_hashvec;
 					qhvec_reset(qhv);
+					latency_begin(&start);
 					search_request(n, sri, qhv);
+					latency_end("core",
+						func_to_pointer(search_request), &start);
 				}
 				break;
 			default:
@@ -9853,6 +9935,200 @@ node_udp_process(gnutella_node_t *n, const struct gnutella_socket *s,
 	node_handle(n);
 }
 
+/**
+ * Create a "fake" node that is used as a placeholder when replaying
+ * Gnutella messages from a traffic dump.
+ *
+ * The node has no socket and no TX stack: it is never writable, hence
+ * nothing is ever sent back to it.  It is not part of the list of
+ * connected nodes either, so it cannot be selected for routing.
+ *
+ * @param addr		the address of the node in the dump
+ * @param port		the port of the node in the dump
+ * @param udp		whether messages were received via UDP
+ *
+ * @return a new node, to be freed with node_replay_free().
+ */
+gnutella_node_t *
+node_replay_create(const host_addr_t addr, uint16 port, bool udp)
+{
+	gnutella_node_t *n;
+
+	n = node_alloc();
+	n->id = node_id_new();
+	n->addr = n->gnet_addr = addr;
+	n->port = n->gnet_port = port;
+	n->proto_major = 0;
+	n->proto_minor = 6;
+	n->peermode = udp ? NODE_P_UDP : NODE_P_ULTRA;
+	n->hops_flow = MAX_HOP_COUNT;
+	n->last_update = n->last_tx = n->last_rx = tm_time();
+	n->routing_data = NULL;
+	n->vendor = atom_str_get(_("Replay node"));
+	n->status = GTA_NODE_CONNECTED;
+	n->flags = NODE_F_ESTABLISHED | NODE_F_READABLE;
+	n->attrs = udp ? NODE_A_UDP : 0;
+	n->attrs2 = NODE_A2_REPLAY;
+	n->up_date = GNET_PROPERTY(start_stamp);
+	n->connect_date = GNET_PROPERTY(start_stamp);
+	n->alive_pings = alive_make(n, ALIVE_MAX_PENDING);
+	n->country = gip_country(n->addr);
+
+	hikset_insert_key(nodes_by_id, &n->id);
+
+	return n;
+}
+
+/**
+ * Process a replayed Gnutella message as if it had been received from
+ * the node.
+ *
+ * @param n			the replay node
+ * @param header	the Gnutella header of the message
+ * @param data		the message payload
+ * @param size		the payload size
+ *
+ * @return whether the node is still usable after processing.
+ */
+bool
+node_replay_process(gnutella_node_t *n,
+	const gnutella_header_t *header, char *data, uint32 size)
+{
+	node_check(n);
+	g_assert(NODE_IS_CONNECTED(n));
+	g_assert(!NODE_IS_WRITABLE(n));
+
+	memcpy(n->header, header, sizeof n->header);
+	n->size = size;
+	n->data = data;
+	n->msg_flags = 0;
+
+	if (NODE_IS_UDP(n)) {
+		node_handle(n);
+	} else {
+		switch (gnutella_header_get_function(&n->header)) {
+		case GTA_MSG_SEARCH:
+			node_inc_rx_query(n);
+			break;
+		case GTA_MSG_SEARCH_RESULTS:
+			node_inc_rx_qhit(n);
+			break;
+		default:
+			break;
+		}
+		node_add_rx_given(n, n->size + GTA_HEADER_SIZE);
+		node_parse(n);
+	}
+
+	n->data = NULL;
+	n->size = 0;
+
+	return NODE_IS_CONNECTED(n);
+}
+
+/**
+ * Dispose of a replay node.
+ */
+void
+node_replay_free(gnutella_node_t *n)
+{
+	node_check(n);
+	g_assert(!NODE_IS_WRITABLE(n));
+
+	node_free_state(n);
+	node_real_remove(n);
+}
+
+/**
+ * Take a snapshot of a node and of its current message.
+ *
+ * The snapshot is a detached node: it carries the identity, addresses and
+ * attributes of the node along with a private copy of the message, so that
+ * the routines inspecting the current message can run on it from another
+ * thread, whilst the node itself keeps reading.  It is never linked to any
+ * I/O layer and counters updated on it can be brought back to the node with
+ * node_snapshot_merge().
+ *
+ * @param n		the node
+ *
+ * @return a new snapshot, to be freed with node_snapshot_free().
+ */
+gnutella_node_t *
+node_snapshot(const gnutella_node_t *n)
+{
+	gnutella_node_t *s;
+
+	node_check(n);
+
+	s = node_alloc();
+	s->id = nid_ref(NODE_ID(n));
+	s->peermode = n->peermode;
+	s->country = n->country;
+	s->vendor = NULL == n->vendor ? NULL : atom_str_get(n->vendor);
+	s->vcode = n->vcode;
+	s->addr = n->addr;
+	s->port = n->port;
+	s->gnet_addr = n->gnet_addr;
+	s->gnet_port = n->gnet_port;
+	s->status = n->status;
+	s->flags = n->flags;
+	s->attrs = n->attrs;
+	s->attrs2 = n->attrs2;
+	memcpy(s->header, n->header, sizeof s->header);
+	s->header_flags = n->header_flags;
+	s->size = n->size;
+	s->data = 0 == n->size ? NULL : wcopy(n->data, n->size);
+
+	return s;
+}
+
+/**
+ * Report the counters updated on a node snapshot to the node, if still there.
+ *
+ * @param s		the snapshot taken by node_snapshot()
+ */
+void
+node_snapshot_merge(const gnutella_node_t *s)
+{
+	gnutella_node_t *n;
+
+	node_check(s);
+
+	n = node_by_id(NODE_ID(s));
+	if (NULL == n)
+		return;
+
+	if (s->rx_dropped != 0)
+		node_add_rxdrop(n, s->rx_dropped);
+
+	n->n_weird += s->n_weird;
+	n->n_hostile += s->n_hostile;
+	n->n_spam += s->n_spam;
+	n->n_evil += s->n_evil;
+	n->attrs2 |= s->attrs2 & NODE_A2_NOT_GENUINE;
+}
+
+/**
+ * Free node snapshot, nullifying its pointer.
+ */
+void
+node_snapshot_free_null(gnutella_node_t **s_ptr)
+{
+	gnutella_node_t *s = *s_ptr;
+
+	if (s != NULL) {
+		node_check(s);
+
+		if (s->data != NULL)
+			wfree(s->data, s->size);
+		atom_str_free_null(&s->vendor);
+		nid_unref(NODE_ID(s));
+		s->magic = 0;
+		WFREE(s);
+		*s_ptr = NULL;
+	}
+}
+
 /**
  * Data indication callback for the semi-reliable UDP layer.
  *
@@ -12448,11 +12724,12 @@ node_remove_nodes_by_id(const pslist_t *node_list)
 const char *
 node_addr(const gnutella_node_t *n)
 {
-	static char buf[HOST_ADDR_PORT_BUFLEN];
+	buf_t *b = buf_private(G_STRFUNC, HOST_ADDR_PORT_BUFLEN);
+	char *p = buf_data(b);
 
 	node_check(n);
-	host_addr_port_to_string_buf(n->addr, n->port, ARYLEN(buf));
-	return buf;
+	host_addr_port_to_string_buf(n->addr, n->port, p, buf_size(b));
+	return p;
 }
 
 /**
@@ -12475,16 +12752,18 @@ node_addr2(const gnutella_node_t *n)
 const char *
 node_gnet_addr(const gnutella_node_t *n)
 {
-	static char buf[HOST_ADDR_PORT_BUFLEN];
+	buf_t *b = buf_private(G_STRFUNC, HOST_ADDR_PORT_BUFLEN);
+	char *p = buf_data(b);
 
 	node_check(n);
 
 	if (is_host_addr(n->gnet_addr))
-		host_addr_port_to_string_buf(n->gnet_addr, n->gnet_port, ARYLEN(buf));
+		host_addr_port_to_string_buf(n->gnet_addr, n->gnet_port,
+			p, buf_size(b));
 	else
-		host_addr_to_string_buf(n->addr, ARYLEN(buf));
+		host_addr_to_string_buf(n->addr, p, buf_size(b));
 
-	return buf;
+	return p;
 }
 
 /**
@@ -12518,15 +12797,16 @@ node_infostr_to_buf(const gnutella_node_t *n, char *dst, size_t size)
  *   "leaf node 1.2.3.4:5 <vendor>"
  *   "ultra node 6.7.8.9 <vendor>"
  *
- * @return pointer to static buffer.
+ * @return pointer to thread-private buffer.
  */
 const char *
 node_infostr(const gnutella_node_t *n)
 {
-	static char buf[160];
+	buf_t *b = buf_private(G_STRFUNC, 160);
+	char *p = buf_data(b);
 
-	node_infostr_to_buf(n, ARYLEN(buf));
-	return buf;
+	node_infostr_to_buf(n, p, buf_size(b));
+	return p;
 }
 
 /**
@@ -367,6 +367,7 @@ enum {
  * Second attributes.
  */
 enum {
+	NODE_A2_REPLAY		= 1 << 11,	/**< Fake node replaying a traffic dump */
 	NODE_A2_G2_HUB		= 1 << 10,	/**< Node is a G2 hub */
 	NODE_A2_SWITCH_TLS	= 1 << 9,	/**< Node will switch to TLS */
 	NODE_A2_UPGRADE_TLS	= 1 << 8,	/**< Node wants to upgrade to TLS */
@@ -499,6 +500,7 @@ enum {
 #define NODE_CAN_OOB(n)			((n)->attrs & NODE_A_CAN_OOB)
 #define NODE_CAN_HOPS_FLOW(n)	((n)->attrs & NODE_A_HOPS_FLOW)
 #define NODE_TALKS_G2(n)		((n)->attrs2 & NODE_A2_TALKS_G2)
+#define NODE_IS_REPLAY(n)		((n)->attrs2 & NODE_A2_REPLAY)
 #define NODE_NO_OOB_PROXY(n)	((n)->attrs2 & NODE_A2_NO_OOB_PROXY)
 
 /*
@@ -736,6 +738,14 @@ gnutella_node_t *node_browse_prepare(
 	gnet_host_t *host, const char *vendor, gnutella_header_t *header,
 	char *data, uint32 size);
 void node_browse_cleanup(gnutella_node_t *n);
+gnutella_node_t *node_replay_create(const host_addr_t addr, uint16 port,
+	bool udp);
+bool node_replay_process(gnutella_node_t *n,
+	const gnutella_header_t *header, char *data, uint32 size);
+void node_replay_free(gnutella_node_t *n);
+gnutella_node_t *node_snapshot(const gnutella_node_t *n);
+void node_snapshot_merge(const gnutella_node_t *s);
+void node_snapshot_free_null(gnutella_node_t **s_ptr);
 void node_kill_hostiles(void);
 void node_supports_tls(struct gnutella_node *);
 void node_supports_whats_new(struct gnutella_node *);
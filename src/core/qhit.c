@@ -56,16 +56,20 @@
 #include "if/core/main.h"			/* For main_get_build() */
 
 #include "lib/array.h"
+#include "lib/atoms.h"
 #include "lib/endian.h"
 #include "lib/getdate.h"
 #include "lib/hashing.h"
 #include "lib/hset.h"
+#include "lib/mempcpy.h"
 #include "lib/product.h"
 #include "lib/pslist.h"
 #include "lib/random.h"
 #include "lib/sequence.h"
 #include "lib/stringify.h"
 #include "lib/tm.h"
+#include "lib/walloc.h"
+#include "lib/xmalloc.h"
 
 #include "lib/override.h"			/* Must be the last header included */
 
@@ -107,6 +111,46 @@ struct found_struct {
 	unsigned open:1;			/**< Set if found_open() was used */
 };
 
+/**
+ * A pre-serialized query hit entry for a shared file.
+ *
+ * The data[] area holds, contiguously:
+ *
+ * - the head of the hit entry: 32-bit file size, NFC filename and NUL, plus
+ *   the ASCII SHA1 URN and its separator when GGEP "H" is not used.
+ * - the GGEP extensions for the hashes ("H" or "TT") and the 64-bit
+ *   file size ("LF"), as collected by ggep_stream_detach().
+ * - the trailing GGEP extensions ("PATH" and "CT").
+ *
+ * The file index and the "PRU" and "ALT" extensions vary for each hit and
+ * are inserted when the hit is built, keeping the usual extension order.
+ */
+struct qhit_record {
+	size_t size;				/**< Allocated size of this structure */
+	size_t head;				/**< Length of the entry head */
+	size_t hash;				/**< Length of the hash extensions */
+	size_t hash_last;			/**< Offset of last hash extension flags */
+	size_t tail;				/**< Length of the trailing extensions */
+	size_t tail_last;			/**< Offset of last trailing extension flags */
+	char data[1];				/**< Start of serialized data */
+};
+
+/**
+ * The pre-serialized query hit entries attached to a shared file.
+ *
+ * The attributes used to build the records are kept so that we can detect
+ * when they become stale, for instance after the SHA1 or the TTH of the
+ * file changed.
+ */
+struct qhit_cache {
+	const struct sha1 *sha1;	/**< SHA1 used (atom), NULL if none */
+	const struct tth *tth;		/**< TTH used (atom), NULL if none */
+	const char *path;			/**< Relative path used (owned by file) */
+	filesize_t size;			/**< File size used */
+	time_t ctime;				/**< Creation time used */
+	struct qhit_record *rec[2];	/**< Indexed by whether GGEP "H" is used */
+};
+
 static struct found_struct *
 found_get(void)
 {
@@ -613,6 +657,263 @@ qhit_random_index(void)
 	g_error("%s(): no luck with random number generator", G_STRFUNC);
 }
 
+/**
+ * Serialize the static parts of a query hit entry for a shared file.
+ *
+ * @param sf		the shared file
+ * @param ggep_h	whether the SHA1 is to be emitted as GGEP "H"
+ * @param sha1		the SHA1 to emit, NULL if none
+ * @param tth		the TTH to emit, NULL if none
+ * @param rp		the relative path to emit, NULL if none
+ *
+ * @return a new record, to be freed with qhit_record_free().
+ */
+static struct qhit_record *
+qhit_record_build(const shared_file_t *sf, bool ggep_h,
+	const struct sha1 *sha1, const struct tth *tth, const char *rp)
+{
+	struct qhit_record *qr;
+	size_t nlen, len, head, hash, hash_last, tail, tail_last, size;
+	filesize_t fsize;
+	ggep_stream_t gs;
+	time_t create_time;
+	uint32 fs32;
+	char *buf, *p;
+	bool ok;
+
+	nlen = shared_file_name_nfc_len(sf);
+	len = 4 + nlen + 1 + SHA1_URN_LENGTH + 1 + QHIT_MAX_GGEP +
+		(NULL == rp ? 0 : vstrlen(rp));
+	p = buf = xmalloc(len);
+
+	/*
+	 * If size is greater than 2^31-1, we store ~0 as the file size and will
+	 * use the "LF" GGEP extension to hold the real size.
+	 */
+
+	fsize = shared_file_size(sf);
+	fs32 = fsize >= (1U << 31) ? ~0U : fsize;
+
+	poke_le32(p, fs32);
+	p += 4;
+	p = mempcpy(p, shared_file_name_nfc(sf), nlen);
+	*p++ = '\0';
+
+	/*
+	 * Emit the SHA1 as a plain ASCII URN if they don't grok "H".
+	 */
+
+	if (sha1 != NULL && !ggep_h) {
+		/* Good old way: ASCII URN */
+		p = mempcpy(p, sha1_to_urn_string(sha1), SHA1_URN_LENGTH);
+		*p++ = '\x1c';
+	}
+
+	head = ptr_diff(p, buf);
+	ggep_stream_init(&gs, p, len - head);
+
+	/*
+	 * Emit the SHA1 as GGEP "H" if they said they understand it. The modern
+	 * way is GGEP "H" for binary URN but only gtk-gnutella implements it.
+	 */
+
+	if (sha1 != NULL && ggep_h) {
+		const uint8 type = tth ? GGEP_H_BITPRINT : GGEP_H_SHA1;
+
+		ok =
+			ggep_stream_begin(&gs, GGEP_NAME(H), GGEP_W_COBS) &&
+			ggep_stream_write(&gs, &type, 1) &&
+			ggep_stream_write(&gs, sha1->data, SHA1_RAW_SIZE) &&
+			(tth ? ggep_stream_write(&gs, tth->data, TTH_RAW_SIZE) : TRUE) &&
+			ggep_stream_end(&gs);
+
+		if (!ok)
+			qhit_log_ggep_write_failure("H");
+	}
+
+	/*
+	 * First LimeWire emitted TTHs as plain text urn:ttroot:<base32 TTH>.
+	 * Now they are still unaware of GGEP "H" but emit GGEP "TT" with the
+	 * hash in binary form.
+	 */
+
+	if (sha1 != NULL && !ggep_h && tth != NULL) {
+		ok = ggep_stream_pack(&gs,
+					GGEP_NAME(TT), tth->data, TTH_RAW_SIZE, GGEP_W_COBS);
+		if (!ok)
+			qhit_log_ggep_write_failure("TT");
+	}
+
+	/*
+	 * If the 32-bit size is the magic ~0 escape value, we need to emit
+	 * the real size in the "LF" extension.
+	 */
+
+	if (fs32 == ~0U) {
+		char lf[sizeof(uint64)];
+		int n;
+
+		n = ggept_filesize_encode(fsize, ARYLEN(lf));
+
+		g_assert(n > 0 && UNSIGNED(n) <= sizeof lf);
+
+		ok = ggep_stream_pack(&gs, GGEP_NAME(LF), lf, n, GGEP_W_COBS);
+		if (!ok)
+			qhit_log_ggep_write_failure("LF");
+	}
+
+	/*
+	 * The extensions follow the leading GGEP magic byte, which we strip.
+	 */
+
+	hash = ggep_stream_detach(&gs, &hash_last);
+	memmove(p, p + 1, hash);
+	p += hash;
+
+	ggep_stream_init(&gs, p, len - head - hash);
+
+	if (rp != NULL) {
+		ok = ggep_stream_pack(&gs, GGEP_NAME(PATH), rp, vstrlen(rp), 0);
+		if (!ok)
+			qhit_log_ggep_write_failure("PATH");
+	}
+
+	create_time = shared_file_creation_time(sf);
+	if ((time_t) -1 != create_time) {
+		char ct[sizeof(uint64)];
+		int n;
+
+		/*
+		 * Suppress negative values (if time_t is signed) as this would
+		 * be interpreted as a date far in this future.
+		 */
+		create_time = MAX(0, create_time);
+
+		n = ggept_ct_encode(create_time, ARYLEN(ct));
+		g_assert(UNSIGNED(n) <= sizeof ct);
+
+		ok = ggep_stream_pack(&gs, GGEP_NAME(CT), ct, n, GGEP_W_COBS);
+		if (!ok)
+			qhit_log_ggep_write_failure("CT");
+	}
+
+	tail = ggep_stream_detach(&gs, &tail_last);
+	memmove(p, p + 1, tail);
+
+	/*
+	 * Build the record.
+	 */
+
+	len = head + hash + tail;
+	size = offsetof(struct qhit_record, data) + len;
+
+	qr = walloc(size);
+	qr->size = size;
+	qr->head = head;
+	qr->hash = hash;
+	qr->hash_last = hash_last;
+	qr->tail = tail;
+	qr->tail_last = tail_last;
+	memcpy(qr->data, buf, len);
+
+	xfree(buf);
+
+	return qr;
+}
+
+/**
+ * Free query hit record.
+ */
+static void
+qhit_record_free_null(struct qhit_record **qr_ptr)
+{
+	struct qhit_record *qr = *qr_ptr;
+
+	if (qr != NULL) {
+		wfree(qr, qr->size);
+		*qr_ptr = NULL;
+	}
+}
+
+/**
+ * Free the pre-serialized query hit entries and nullify their pointer.
+ */
+void
+qhit_cache_free_null(struct qhit_cache **qc_ptr)
+{
+	struct qhit_cache *qc = *qc_ptr;
+
+	if (qc != NULL) {
+		qhit_record_free_null(&qc->rec[0]);
+		qhit_record_free_null(&qc->rec[1]);
+		atom_sha1_free_null(&qc->sha1);
+		atom_tth_free_null(&qc->tth);
+		WFREE(qc);
+		*qc_ptr = NULL;
+	}
+}
+
+/**
+ * Get the pre-serialized query hit entry for a shared file, building it
+ * when missing or when the attributes of the file it depends on changed.
+ *
+ * @param sf				the shared file
+ * @param sha1_available	whether the SHA1 of the file is to be emitted
+ * @param ggep_h			whether the SHA1 is to be emitted as GGEP "H"
+ *
+ * @return the record to use, which remains attached to the shared file.
+ */
+static const struct qhit_record *
+qhit_record_get(const shared_file_t *sf, bool sha1_available, bool ggep_h)
+{
+	struct qhit_cache *qc;
+	const struct sha1 *sha1 = NULL;
+	const struct tth *tth = NULL;
+	const char *rp;
+
+	if (sha1_available) {
+		sha1 = shared_file_sha1(sf);
+		tth = shared_file_tth(sf);
+	}
+
+	rp = shared_file_relative_path(sf);
+	qc = shared_file_qhit_cache(sf);
+
+	/*
+	 * Since we keep a reference on the hash atoms, pointer comparison is
+	 * enough to detect a change.
+	 */
+
+	if (
+		qc != NULL && (
+			qc->sha1 != sha1 || qc->tth != tth || qc->path != rp ||
+			qc->size != shared_file_size(sf) ||
+			qc->ctime != shared_file_creation_time(sf)
+		)
+	) {
+		if (GNET_PROPERTY(qhit_debug) > 1) {
+			g_debug("QHIT refreshing cached entry for %s",
+				shared_file_path(sf));
+		}
+		qc = NULL;
+	}
+
+	if G_UNLIKELY(NULL == qc) {
+		WALLOC0(qc);
+		qc->sha1 = NULL == sha1 ? NULL : atom_sha1_get(sha1);
+		qc->tth = NULL == tth ? NULL : atom_tth_get(tth);
+		qc->path = rp;
+		qc->size = shared_file_size(sf);
+		qc->ctime = shared_file_creation_time(sf);
+		shared_file_set_qhit_cache(deconstify_pointer(sf), qc);
+	}
+
+	if G_UNLIKELY(NULL == qc->rec[ggep_h])
+		qc->rec[ggep_h] = qhit_record_build(sf, ggep_h, sha1, tth, rp);
+
+	return qc->rec[ggep_h];
+}
+
 /**
  * Add file to current query hit.
  *
@@ -625,8 +926,9 @@ add_file(const shared_file_t *sf)
 	bool sha1_available;
 	gnet_host_t hvec[QHIT_MAX_ALT];
 	int hcnt = 0;
-	uint32 fs32, fs32_le, idx_le;
+	uint32 idx_le;
 	int ggep_len;
+	const struct qhit_record *qr;
 	bool ok;
 	ggep_stream_t gs;
 	size_t left, needed;
@@ -743,45 +1045,21 @@ add_file(const shared_file_t *sf)
 		return FALSE;
 
 	/*
-	 * If size is greater than 2^31-1, we store ~0 as the file size and will
-	 * use the "LF" GGEP extension to hold the real size.
+	 * The static parts of the entry are pre-serialized.
 	 */
 
-	fs32 = shared_file_size(sf) >= (1U << 31) ? ~0U : shared_file_size(sf);
+	qr = qhit_record_get(sf, sha1_available, found_ggep_h());
 
 	poke_le32(&idx_le, file_index);
 	if (!found_write(&idx_le, sizeof idx_le))
 		return FALSE;
-	poke_le32(&fs32_le, fs32);
-	if (!found_write(&fs32_le, sizeof fs32_le))
-		return FALSE;
-	if (!found_write(shared_file_name_nfc(sf), shared_file_name_nfc_len(sf)))
+	if (!found_write(qr->data, qr->head))
 		return FALSE;
 
-	/* Position equals the next byte to be written to */
-
-	if (!found_write("", 1))
-		return FALSE;
-
-	/*
-	 * We're now between the two NULs at the end of the hit entry.
-	 */
-
-	/*
-	 * Emit the SHA1 as a plain ASCII URN if they don't grok "H".
-	 */
-
-	if (sha1_available && !found_ggep_h()) {
-		const struct sha1 * const sha1 = shared_file_sha1(sf);
-
-		/* Good old way: ASCII URN */
-		if (!found_write(sha1_to_urn_string(sha1), SHA1_URN_LENGTH))
-			return FALSE;
-		if (!found_write("\x1c", 1))
-			return FALSE;
-	}
-
 	/*
+	 * We're now between the two NULs at the end of the hit entry, after
+	 * the plain ASCII URN if they don't grok "H".
+	 *
 	 * From now on, we emit GGEP extensions, if we emit at all.
 	 */
 
@@ -822,60 +1100,13 @@ add_file(const shared_file_t *sf)
 	}
 
 	/*
-	 * Emit the SHA1 as GGEP "H" if they said they understand it. The modern
-	 * way is GGEP "H" for binary URN but only gtk-gnutella implements it.
-	 */
-
-	if (sha1_available && found_ggep_h()) {
-		const struct sha1 * const sha1 = shared_file_sha1(sf);
-		const struct tth * const tth = shared_file_tth(sf);
-		const uint8 type = tth ? GGEP_H_BITPRINT : GGEP_H_SHA1;
-
-		ok =
-			ggep_stream_begin(&gs, GGEP_NAME(H), GGEP_W_COBS) &&
-			ggep_stream_write(&gs, &type, 1) &&
-			ggep_stream_write(&gs, sha1->data, SHA1_RAW_SIZE) &&
-			(tth ? ggep_stream_write(&gs, tth->data, TTH_RAW_SIZE) : TRUE) &&
-			ggep_stream_end(&gs);
-
-		if (!ok)
-			qhit_log_ggep_write_failure("H");
-	}
-
-	/*
-	 * First LimeWire emitted TTHs as plain text urn:ttroot:<base32 TTH>.
-	 * Now they are still unaware of GGEP "H" but emit GGEP "TT" with the
-	 * hash in binary form.
-	 */
-
-	if (sha1_available && !found_ggep_h()) {
-		const struct tth * const tth = shared_file_tth(sf);
-
-		if (tth) {
-			ok = ggep_stream_pack(&gs,
-						GGEP_NAME(TT), tth->data, TTH_RAW_SIZE, GGEP_W_COBS);
-			if (!ok)
-				qhit_log_ggep_write_failure("TT");
-		}
-	}
-
-	/*
-	 * If the 32-bit size is the magic ~0 escape value, we need to emit
-	 * the real size in the "LF" extension.
+	 * Hashes and 64-bit file size, pre-serialized.
 	 */
 
-	if (fs32 == ~0U) {
-		char buf[sizeof(uint64)];
-		int len;
-
-		len = ggept_filesize_encode(shared_file_size(sf), ARYLEN(buf));
-
-		g_assert(len > 0 && UNSIGNED(len) <= sizeof buf);
-
-		ok = ggep_stream_pack(&gs, GGEP_NAME(LF), buf, len, GGEP_W_COBS);
-		if (!ok)
-			qhit_log_ggep_write_failure("LF");
-	}
+	ok = ggep_stream_append_ext(&gs,
+			&qr->data[qr->head], qr->hash, qr->hash_last);
+	if (!ok)
+		qhit_log_ggep_write_failure(found_ggep_h() ? "H+LF" : "TT+LF");
 
 	/*
 	 * If we have known alternate locations, include a few of them for
@@ -891,38 +1122,14 @@ add_file(const shared_file_t *sf)
 			qhit_log_ggep_write_failure("ALT");
 	}
 
-	{
-		const char *rp = shared_file_relative_path(sf);
-
-		if (rp) {
-			ok = ggep_stream_pack(&gs, GGEP_NAME(PATH), rp, vstrlen(rp), 0);
-			if (!ok)
-				qhit_log_ggep_write_failure("PATH");
-		}
-	}
-
-	{
-		time_t create_time;
-
-		create_time = shared_file_creation_time(sf);
-		if ((time_t) -1 != create_time) {
-			char buf[sizeof(uint64)];
-			int len;
-
-			/*
-			 * Suppress negative values (if time_t is signed) as this would
-			 * be interpreted as a date far in this future.
-			 */
-			create_time = MAX(0, create_time);
-
-			len = ggept_ct_encode(create_time, ARYLEN(buf));
-			g_assert(UNSIGNED(len) <= sizeof buf);
+	/*
+	 * Relative path and creation time, pre-serialized.
+	 */
 
-			ok = ggep_stream_pack(&gs, GGEP_NAME(CT), buf, len, GGEP_W_COBS);
-			if (!ok)
-				qhit_log_ggep_write_failure("CT");
-		}
-	}
+	ok = ggep_stream_append_ext(&gs,
+			&qr->data[qr->head + qr->hash], qr->tail, qr->tail_last);
+	if (!ok)
+		qhit_log_ggep_write_failure("PATH+CT");
 
 	/*
 	 * Because we don't know exactly the size of the GGEP extension
@@ -60,10 +60,13 @@ struct gnutella_node;
 struct array;
 struct guid;
 struct pslist;
+struct qhit_cache;
 
 void qhit_init(void);
 void qhit_close(void);
 
+void qhit_cache_free_null(struct qhit_cache **qc_ptr);
+
 void qhit_send_results(struct gnutella_node *n, struct pslist *files, int count,
 	const struct guid *muid, unsigned flags);
 void qhit_build_results(const struct pslist *files,
@@ -59,8 +59,10 @@
 
 #include "g2/node.h"
 
+#include "lib/atomic.h"
 #include "lib/atoms.h"
 #include "lib/bg.h"
+#include "lib/bit_array.h"
 #include "lib/cq.h"
 #include "lib/endian.h"
 #include "lib/halloc.h"
@@ -68,6 +70,7 @@
 #include "lib/hset.h"
 #include "lib/hstrfn.h"
 #include "lib/htable.h"
+#include "lib/latency.h"
 #include "lib/mutex.h"
 #include "lib/pow2.h"
 #include "lib/pslist.h"
@@ -79,6 +82,7 @@
 #include "lib/tm.h"
 #include "lib/unsigned.h"
 #include "lib/utf8.h"
+#include "lib/vmm.h"
 #include "lib/walloc.h"
 #include "lib/wordvec.h"
 #include "lib/zlib_util.h"
@@ -193,6 +197,8 @@ struct routing_table {
 	unsigned compacted:1;	/**< Table was compacted */
 	unsigned cancelled:1;	/**< Must supersede with next version */
 	unsigned is_empty:1;	/**< Whether table is empty (all slots cleared) */
+	unsigned indexed:1;		/**< Column in transposed index is up-to-date */
+	int index_col;			/**< Column in transposed index, -1 if none */
 	/**
 	 * Whether this routing table can route the given URN query.
 	 */
@@ -1059,6 +1065,321 @@ qrt_patch_compress(struct routing_patch *rp, bgtask_t *bt,
 	return task;		/* Can be NULL if bg task layer was shutdown already */
 }
 
+/***
+ *** Transposed index of received routing tables.
+ ***/
+
+/*
+ * When running as an ultrapeer, each query is checked against the routing
+ * table of every leaf, which means one random arena probe per query word
+ * and per leaf.
+ *
+ * To avoid that, we maintain a transposed view of all the received tables:
+ * each slot of the index is a bitset whose bit #n is set when the table
+ * assigned to column #n has its corresponding slot(s) set.  The list of
+ * nodes to which a query can be routed is then computed in one pass over
+ * the few index rows the query hashes to, 64 nodes at a time.
+ *
+ * The index has a fixed resolution of QRT_INDEX_BITS.  Tables with that
+ * many slots or less are represented exactly.  Larger tables have several
+ * of their slots folded into one index slot, so the index only gives a
+ * superset of the nodes to which the query can be routed and these tables
+ * still need to be probed to confirm a positive answer.
+ *
+ * A column is refreshed each time a full PATCH sequence has been applied
+ * to the table, and is not used whilst the table is being patched.
+ */
+
+#define QRT_INDEX_BITS		16		/**< Index resolution: 64K slots */
+#define QRT_INDEX_SLOTS		(1U << QRT_INDEX_BITS)
+#define QRT_INDEX_PLANES	8		/**< Counter bit-planes, up to 255 words */
+
+static bit_array_t *qrt_index;			/**< The transposed index */
+static size_t qrt_index_width;			/**< Row width, in bit_array_t words */
+static bit_array_t *qrt_index_used;		/**< Allocated columns */
+static bit_array_t *qrt_index_exact;	/**< Columns represented exactly */
+static bit_array_t *qrt_index_result;	/**< Routable columns for a query */
+
+#define QRT_INDEX_COLUMNS	(qrt_index_width * BIT_ARRAY_BITSIZE)
+
+/**
+ * @return size of the index, in bytes, for a given row width.
+ */
+static inline size_t
+qrt_index_size(size_t width)
+{
+	return QRT_INDEX_SLOTS * width * sizeof qrt_index[0];
+}
+
+/**
+ * Double the amount of columns in the index.
+ */
+static void
+qrt_index_grow(void)
+{
+	size_t width = 0 == qrt_index_width ? 1 : 2 * qrt_index_width;
+	size_t old_columns = QRT_INDEX_COLUMNS;
+	bit_array_t *index;
+
+	index = vmm_alloc0(qrt_index_size(width));
+
+	if (qrt_index != NULL) {
+		uint s;
+
+		for (s = 0; s < QRT_INDEX_SLOTS; s++) {
+			memcpy(&index[s * width], &qrt_index[s * qrt_index_width],
+				qrt_index_width * sizeof qrt_index[0]);
+		}
+		vmm_free(qrt_index, qrt_index_size(qrt_index_width));
+	}
+
+	qrt_index = index;
+	qrt_index_width = width;
+
+	bit_array_resize(&qrt_index_used, old_columns, QRT_INDEX_COLUMNS);
+	bit_array_resize(&qrt_index_exact, old_columns, QRT_INDEX_COLUMNS);
+	bit_array_resize(&qrt_index_result, old_columns, QRT_INDEX_COLUMNS);
+
+	if (qrp_debugging(0)) {
+		g_debug("QRP transposed index now has %zu columns (%s)",
+			QRT_INDEX_COLUMNS,
+			compact_size(qrt_index_size(qrt_index_width), FALSE));
+	}
+}
+
+/**
+ * Clear a column from the index.
+ */
+static void
+qrt_index_clear_column(size_t col)
+{
+	bit_array_t *w = &BIT_ARRAY_WORD(qrt_index, col);
+	bit_array_t mask = ~BIT_ARRAY_BIT(col);
+	uint s;
+
+	for (s = 0; s < QRT_INDEX_SLOTS; s++, w += qrt_index_width)
+		*w &= mask;
+}
+
+/**
+ * Mark the indexed column of a table as being out-of-date, whilst the
+ * table is being patched.
+ */
+static void
+qrt_index_invalidate(struct routing_table *rt)
+{
+	rt->indexed = FALSE;
+}
+
+/**
+ * Release the index column used by a table, when the table is freed.
+ */
+static void
+qrt_index_release(struct routing_table *rt)
+{
+	if (rt->index_col < 0)
+		return;
+
+	if (qrt_index != NULL) {
+		qrt_index_clear_column(rt->index_col);
+		bit_array_clear(qrt_index_used, rt->index_col);
+		bit_array_clear(qrt_index_exact, rt->index_col);
+	}
+
+	rt->index_col = -1;
+	rt->indexed = FALSE;
+}
+
+/**
+ * Refresh the index column of a received table, which has just been
+ * fully patched, allocating a new column if needed.
+ */
+static void
+qrt_index_update(struct routing_table *rt)
+{
+	bit_array_t *w, bit;
+	uint i, shift;
+
+	qrt_check(rt);
+	g_assert(rt->compacted);
+	g_assert(rt->bits >= 0 && rt->slots == (1 << rt->bits));
+
+	if (rt->index_col < 0) {
+		size_t col = (size_t) -1;
+
+		if (qrt_index != NULL)
+			col = bit_array_first_clear(qrt_index_used, 0,
+					QRT_INDEX_COLUMNS - 1);
+
+		if ((size_t) -1 == col) {
+			col = QRT_INDEX_COLUMNS;
+			qrt_index_grow();
+		}
+
+		bit_array_set(qrt_index_used, col);
+		rt->index_col = col;
+	} else {
+		qrt_index_clear_column(rt->index_col);
+	}
+
+	w = &BIT_ARRAY_WORD(qrt_index, (size_t) rt->index_col);
+	bit = BIT_ARRAY_BIT((size_t) rt->index_col);
+
+	/*
+	 * Fold large tables into the index, expand smaller ones.
+	 *
+	 * The tables are usually sparse, so we skip empty bytes quickly.
+	 */
+
+	if (rt->bits >= QRT_INDEX_BITS) {
+		shift = rt->bits - QRT_INDEX_BITS;
+
+		for (i = 0; i < (uint) rt->slots; i += 8) {
+			uint j;
+
+			if (0 == rt->arena[i >> 3])
+				continue;
+
+			for (j = i; j < i + 8; j++) {
+				if (RT_SLOT_READ(rt->arena, j))
+					w[(j >> shift) * qrt_index_width] |= bit;
+			}
+		}
+	} else {
+		shift = QRT_INDEX_BITS - rt->bits;
+
+		for (i = 0; i < (uint) rt->slots; i += 8) {
+			uint j;
+
+			if (0 == rt->arena[i >> 3])
+				continue;
+
+			for (j = i; j < i + 8; j++) {
+				if (RT_SLOT_READ(rt->arena, j)) {
+					uint k;
+
+					for (k = j << shift; k < (j + 1) << shift; k++)
+						w[k * qrt_index_width] |= bit;
+				}
+			}
+		}
+	}
+
+	if (rt->bits <= QRT_INDEX_BITS)
+		bit_array_set(qrt_index_exact, rt->index_col);
+	else
+		bit_array_clear(qrt_index_exact, rt->index_col);
+
+	rt->indexed = TRUE;
+}
+
+/**
+ * Compute the set of index columns to which the query can be routed.
+ *
+ * This applies the same logic as qrp_can_route_default(), for all the
+ * columns at once: bit-sliced counters accumulate the amount of words
+ * hitting the table, which is then compared with the amount of words
+ * required to match.
+ *
+ * @return the bitset of routable columns, NULL if there is no index.
+ */
+static const bit_array_t *
+qrt_index_route(const query_hashvec_t *qhv)
+{
+	const struct query_hash *qh = qhv->vec;
+	uint i, words = 0, need;
+	size_t k;
+
+	if (NULL == qrt_index)
+		return NULL;
+
+	for (i = 0; i < qhv->count; i++) {
+		if (!qhv->has_urn || QUERY_H_WORD == qh[i].source)
+			words++;
+	}
+
+	/* 3 * hits / words >= 2 when there are at least 3 words */
+	need = words < 3 ? words : (2 * words + 2) / 3;
+
+	for (k = 0; k < qrt_index_width; k++) {
+		bit_array_t cnt[QRT_INDEX_PLANES], urn = 0, gt = 0, eq = ~0UL;
+		uint p;
+
+		ZERO(&cnt);
+
+		for (i = 0; i < qhv->count; i++) {
+			uint32 s = qh[i].hashcode >> (32 - QRT_INDEX_BITS);
+			bit_array_t x = qrt_index[s * qrt_index_width + k];
+
+			if (qhv->has_urn && QUERY_H_URN == qh[i].source) {
+				urn |= x;		/* URNs are OR-ed */
+				continue;
+			}
+
+			for (p = 0; x != 0 && p < QRT_INDEX_PLANES; p++) {
+				bit_array_t carry = cnt[p] & x;
+				cnt[p] ^= x;
+				x = carry;
+			}
+		}
+
+		if (0 == words) {
+			qrt_index_result[k] = urn;
+			continue;
+		}
+
+		for (p = QRT_INDEX_PLANES; p-- > 0; /* empty */) {
+			if (need & (1U << p)) {
+				eq &= cnt[p];
+			} else {
+				gt |= eq & cnt[p];
+				eq &= ~cnt[p];
+			}
+		}
+
+		qrt_index_result[k] = urn | gt | eq;
+	}
+
+	return qrt_index_result;
+}
+
+/**
+ * Check whether a query can be routed to a table, using the index
+ * result computed by qrt_index_route() when the table is indexed.
+ */
+static inline bool
+qrt_index_can_route(const struct routing_table *rt,
+	const query_hashvec_t *qhv, const bit_array_t *routable)
+{
+	if (routable != NULL && rt->indexed) {
+		if (!bit_array_get(routable, rt->index_col))
+			return FALSE;
+		if (bit_array_get(qrt_index_exact, rt->index_col))
+			return TRUE;
+	}
+
+	return qhv->has_urn ?
+		rt->can_route_urn(qhv, rt) :
+		rt->can_route(qhv, rt);
+}
+
+/**
+ * Free the transposed index.
+ */
+static void
+qrt_index_free(void)
+{
+	if (qrt_index != NULL) {
+		vmm_free(qrt_index, qrt_index_size(qrt_index_width));
+		qrt_index = NULL;
+	}
+
+	qrt_index_width = 0;
+	HFREE_NULL(qrt_index_used);
+	HFREE_NULL(qrt_index_exact);
+	HFREE_NULL(qrt_index_result);
+}
+
 /**
  * Create a new query routing table, with supplied `arena' and `slots'.
  * The value used for infinity is given as `max'.
@@ -1084,6 +1405,7 @@ qrt_create(const char *name, char *arena, int slots, int max)
 	rt->compacted     = FALSE;
 	rt->digest        = NULL;
 	rt->reset         = FALSE;
+	rt->index_col     = -1;
 	rt->can_route_urn = qrp_can_route_default;
 	rt->can_route     = qrp_can_route_default;
 
@@ -1127,6 +1449,7 @@ qrt_free(struct routing_table *rt)
 {
 	g_assert(rt->refcnt == 0);
 
+	qrt_index_release(rt);
 	atom_sha1_free_null(&rt->digest);
 	HFREE_NULL(rt->arena);
 	HFREE_NULL(rt->name);
@@ -1664,6 +1987,39 @@ static struct {
 
 static void qrp_cancel_computation(void);
 
+/**
+ * Counting table.
+ *
+ * To be able to update our table incrementally when files are added to
+ * or removed from the library, we keep the words of the last computation
+ * along with reference counts, all the way down to the slots of the table:
+ *
+ *   words       -> amount of files whose name contains the word
+ *   substrings  -> amount of words leading to the substring
+ *   counts[]    -> amount of substrings hashed to the slot
+ *
+ * A slot is present in the table when its count is non-zero.  Counts
+ * saturate and then stick, the slot remaining present until the next full
+ * computation, which rebuilds everything.
+ */
+struct qrp_counting {
+	htable_t *words;		/**< Word -> amount of files */
+	htable_t *substr;		/**< Substring -> amount of words */
+	uint8 *counts;			/**< Amount of substrings per slot */
+	int bits;				/**< Amount of bits for table size */
+	int slots;				/**< Amount of slots in table */
+	int filled;				/**< Amount of non-zero slots */
+	bool dirty;				/**< Whether table changed since last commit */
+};
+
+#define QRP_COUNT_MAX	MAX_INT_VAL(uint8)
+
+static struct qrp_counting *qrp_counting;	/**< Set by last computation */
+static bool qrp_counting_stale;				/**< Set when recomputing */
+
+typedef bool (*qrp_word_cb_t)(const char *word, void *data);
+typedef void (*qrp_substr_cb_t)(const char *s, size_t size, void *data);
+
 /**
  * This routine must be called to initialize the computation of the new QRP
  * based on our local files.
@@ -1672,6 +2028,7 @@ void
 qrp_prepare_computation(void)
 {
 	qrp_cancel_computation();			/* Cancel any running computation */
+	atomic_bool_set(&qrp_counting_stale, TRUE);
 
 	if (buffer.arena == NULL) {
 		buffer.arena = halloc(DEFAULT_BUF_SIZE);
@@ -1680,10 +2037,13 @@ qrp_prepare_computation(void)
 }
 
 /**
- * Add shared file to our QRP.
+ * Iterate over the unique words making up the name of a shared file,
+ * including the words coming from alias expansion.
+ *
+ * The callback returns whether the word was new, for logging purposes.
  */
-void
-qrp_add_file(const shared_file_t *sf, htable_t *words)
+static void
+qrp_file_words(const shared_file_t *sf, qrp_word_cb_t cb, void *data)
 {
 	word_vec_t *wovec;
 	uint wocnt;
@@ -1691,7 +2051,6 @@ qrp_add_file(const shared_file_t *sf, htable_t *words)
 	char **aliases, **a;
 
 	g_assert(sf != NULL);
-	g_assert(words != NULL);
 
 	g_assert(utf8_is_valid_data(shared_file_name_nfc(sf),
 				shared_file_name_nfc_len(sf)));
@@ -1718,7 +2077,7 @@ qrp_add_file(const shared_file_t *sf, htable_t *words)
 		return;
 
 	/*
-	 * Identify unique words we have not already seen in `words'.
+	 * The word vector only holds unique words.
 	 */
 
 	for (i = 0; i < wocnt; i++) {
@@ -1726,33 +2085,18 @@ qrp_add_file(const shared_file_t *sf, htable_t *words)
 
 		g_assert(word[0] != '\0');
 
-		/*
-		 * Record word if we haven't seen it yet.
-		 */
-
-		if (htable_contains(words, word)) {
-			continue;
-		} else {
-			size_t word_len = vstrlen(word);
-			size_t n = 1 + word_len;
-
-			htable_insert(words, wcopy(word, n), size_to_pointer(n));
-		}
-
-		if (qrp_debugging(8)) {
+		if ((*cb)(word, data) && qrp_debugging(8)) {
 			g_debug("new QRP word \"%s\" [from %s]",
 				word, shared_file_name_nfc(sf));
 		}
 	}
 
-	word_vec_free(wovec, wocnt);
-
 	/*
-	 * Handle aliases if needed.
+	 * Handle aliases if needed, skipping words we already processed.
 	 */
 
 	if (!shared_file_needs_aliasing(sf))
-		return;		/* Done, no aliases */
+		goto done;
 
 	aliases = alias_expand(shared_file_name_canonic(sf), " ");
 
@@ -1760,23 +2104,100 @@ qrp_add_file(const shared_file_t *sf, htable_t *words)
 
 	for (a = aliases; *a != NULL; a++) {
 		const char *word = *a;
+		char **b;
 
-		if (htable_contains(words, word)) {
-			continue;
-		} else {
-			size_t word_len = vstrlen(word);
-			size_t n = 1 + word_len;
+		for (i = 0; i < wocnt; i++) {
+			if (0 == strcmp(word, wovec[i].word))
+				goto next;
+		}
 
-			htable_insert(words, wcopy(word, n), size_to_pointer(n));
+		for (b = aliases; b != a; b++) {
+			if (0 == strcmp(word, *b))
+				goto next;
 		}
 
-		if (qrp_debugging(8)) {
+		if ((*cb)(word, data) && qrp_debugging(8)) {
 			g_debug("new QRP word \"%s\" [alias from %s]",
 				word, shared_file_name_nfc(sf));
 		}
+
+	next:
+		continue;
 	}
 
 	h_strfreev(aliases);
+
+done:
+	word_vec_free(wovec, wocnt);
+}
+
+/**
+ * Increment the reference count of a string in the table, inserting
+ * a copy of the string when not already present.
+ *
+ * @return TRUE if the string was new.
+ */
+static bool
+qrp_string_ref(htable_t *ht, const char *s)
+{
+	const void *key;
+	void *value;
+
+	if (htable_lookup_extended(ht, s, &key, &value)) {
+		htable_insert(ht, key, size_to_pointer(pointer_to_size(value) + 1));
+		return FALSE;
+	}
+
+	htable_insert(ht, wcopy(s, 1 + vstrlen(s)), size_to_pointer(1));
+	return TRUE;
+}
+
+/**
+ * Decrement the reference count of a string in the table, removing the
+ * string when its count drops to zero.
+ *
+ * @return TRUE if the string was removed.
+ */
+static bool
+qrp_string_unref(htable_t *ht, const char *s)
+{
+	const void *key;
+	void *value;
+	size_t n;
+
+	if (!htable_lookup_extended(ht, s, &key, &value))
+		return FALSE;
+
+	n = pointer_to_size(value);
+
+	if (n > 1) {
+		htable_insert(ht, key, size_to_pointer(n - 1));
+		return FALSE;
+	}
+
+	htable_remove(ht, key);
+	wfree(deconstify_pointer(key), 1 + vstrlen(key));
+	return TRUE;
+}
+
+/**
+ * qrp_file_words() callback to record word in the table.
+ */
+static bool
+qrp_word_record(const char *word, void *data)
+{
+	return qrp_string_ref(data, word);
+}
+
+/**
+ * Add shared file to our QRP.
+ */
+void
+qrp_add_file(const shared_file_t *sf, htable_t *words)
+{
+	g_assert(words != NULL);
+
+	qrp_file_words(sf, qrp_word_record, words);
 }
 
 /*
@@ -1789,51 +2210,26 @@ free_word(const void *key, void *value, void *unused_udata)
 	g_assert(size_is_positive(pointer_to_size(value)));
 
 	(void) unused_udata;
-	wfree(deconstify_pointer(key), pointer_to_size(value));
-}
-
-struct unique_substrings {		/* User data for unique_subtr() callback */
-	hset_t *unique;
-	pslist_t *head;
-};
-
-static inline void
-insert_substr(struct unique_substrings *u, const char *word, size_t size)
-{
-	if (!hset_contains(u->unique, word)) {
-		void *s;
-
-		s = wcopy(word, size);
-		hset_insert(u->unique, s);
-		u->head = pslist_prepend(u->head, s);
-	}
+	wfree(deconstify_pointer(key), 1 + vstrlen(key));
 }
 
 /**
- * Iteration callback on the hashtable containing keywords.
+ * Iterate over all the substrings of a word we need to insert in the table,
+ * all anchored at the start, whose length range from 3 to the word length.
  */
 static void
-unique_substr(const void *key, void *value, void *udata)
+qrp_word_substrings(const char *word, qrp_substr_cb_t cb, void *data)
 {
-	struct unique_substrings *u = udata;
-	const char *word = key;
 	char *s;
 	size_t len, size, i;
 
-	g_assert(size_is_positive(pointer_to_size(value)));
-
-	/*
-	 * Add all unique (i.e. not already seen) substrings from word, all
-	 * anchored at the start, whose length range from 3 to the word length.
-	 */
-
-	size = pointer_to_size(value);
+	size = 1 + vstrlen(word);
 	s = wcopy(word, size);
 	len = size - 1;				/* Trailing NUL included in size */
 
 	for (i = 0; i <= QRP_MAX_CUT_CHARS; i++) {
 
-		insert_substr(u, s, len + 1);
+		(*cb)(s, len + 1, data);
 
 		while (len > QRP_MIN_WORD_LENGTH) {
 			uint retlen;
@@ -1851,23 +2247,43 @@ unique_substr(const void *key, void *value, void *udata)
 }
 
 /**
- * Create a list of all unique substrings at least QRP_MIN_WORD_LENGTH long,
- * from words held in `ht' (keys are words, values are the word's length plus
- * the trailing NUL).
+ * qrp_word_substrings() callback to record substring in the table.
+ */
+static void
+qrp_substr_record(const char *s, size_t unused_size, void *data)
+{
+	(void) unused_size;
+	qrp_string_ref(data, s);
+}
+
+/**
+ * Iteration callback on the hashtable containing keywords.
+ */
+static void
+unique_substr(const void *key, void *unused_value, void *udata)
+{
+	(void) unused_value;
+	qrp_word_substrings(key, qrp_substr_record, udata);
+}
+
+/**
+ * Create a table of all unique substrings at least QRP_MIN_WORD_LENGTH long,
+ * from words held in `ht' (keys are words, values are the amount of files
+ * where they appear).
  *
- * @returns created list, and count in `retcount'.
+ * @returns created table, mapping substrings to the amount of words leading
+ * to them, and count in `retcount'.
  */
-static pslist_t *
+static htable_t *
 unique_substrings(htable_t *ht, int *retcount)
 {
-	struct unique_substrings u = { NULL, NULL };		/* Callback args */
+	htable_t *substr;
 
-	u.unique = hset_create(HASH_KEY_STRING, 0);
-	htable_foreach(ht, unique_substr, &u);
-	*retcount = hset_count(u.unique);
-	hset_free_null(&u.unique);		/* Created words ref'ed by u.head */
+	substr = htable_create(HASH_KEY_STRING, 0);
+	htable_foreach(ht, unique_substr, substr);
+	*retcount = htable_count(substr);
 
-	return u.head;
+	return substr;
 }
 
 /*
@@ -1887,7 +2303,7 @@ struct qrp_context {
 	enum qrp_magic magic;
 	struct routing_table **rtp;	/**< Points to routing table variable to fill */
 	struct routing_patch **rpp;	/**< Points to routing patch variable to fill */
-	pslist_t *sl_substrings;	/**< List of all substrings */
+	htable_t *substr;			/**< Unique substrings -> amount of words */
 	htable_t *words;			/**< Words making up the files */
 	bgtask_t *compress_bt;		/**< Task launched to compress patch */
 	int substrings;				/**< Amount of substrings */
@@ -1928,21 +2344,11 @@ static void
 qrp_context_free(void *p)
 {
 	struct qrp_context *ctx = p;
-	pslist_t *sl;
 
 	g_assert(ctx->magic == QRP_MAGIC);
 
 	qrp_dispose_words(&ctx->words);
-
-	PSLIST_FOREACH(ctx->sl_substrings, sl) {
-		char *word = sl->data;
-		size_t size;
-
-		size = 1 + vstrlen(word);
-		g_assert(size_is_positive(size));
-		wfree(word, size);
-	}
-	pslist_free_null(&ctx->sl_substrings);
+	qrp_dispose_words(&ctx->substr);
 
 	HFREE_NULL(ctx->table);
 
@@ -2013,8 +2419,7 @@ qrp_step_substring(struct bgtask *unused_h, void *u, int unused_ticks)
 	g_assert(ctx->magic == QRP_MAGIC);
 	g_assert(ctx->words != NULL);
 
-	ctx->sl_substrings = unique_substrings(ctx->words, &ctx->substrings);
-	qrp_dispose_words(&ctx->words);
+	ctx->substr = unique_substrings(ctx->words, &ctx->substrings);
 
 	if (qrp_debugging(1))
 		g_debug("QRP unique subwords: %d", ctx->substrings);
@@ -2053,6 +2458,68 @@ qrt_eq(const struct routing_table *rt, const char *arena, int slots)
 	return TRUE;
 }
 
+/**
+ * Free counting table and nullify its pointer.
+ */
+static void
+qrp_counting_free_null(struct qrp_counting **qc_ptr)
+{
+	struct qrp_counting *qc = *qc_ptr;
+
+	if (qc != NULL) {
+		qrp_dispose_words(&qc->words);
+		qrp_dispose_words(&qc->substr);
+		HFREE_NULL(qc->counts);
+		WFREE(qc);
+		*qc_ptr = NULL;
+	}
+}
+
+/**
+ * Build the counting table for the table size we settled on, taking over
+ * the words and substrings of the computation context.
+ */
+static void
+qrp_counting_install(struct qrp_context *ctx, int bits)
+{
+	struct qrp_counting *qc;
+	htable_iter_t *iter;
+	const void *key;
+
+	g_assert(ctx->magic == QRP_MAGIC);
+
+	WALLOC0(qc);
+	qc->words = ctx->words;
+	qc->substr = ctx->substr;
+	qc->bits = bits;
+	qc->slots = 1 << bits;
+	qc->counts = halloc0(qc->slots);
+
+	ctx->words = ctx->substr = NULL;
+
+	iter = htable_iter_new(qc->substr);
+	while (htable_iter_next(iter, &key, NULL)) {
+		uint idx = qrp_hash(key, bits);
+
+		if (0 == qc->counts[idx])
+			qc->filled++;
+		if (qc->counts[idx] < QRP_COUNT_MAX)
+			qc->counts[idx]++;
+	}
+	htable_iter_release(&iter);
+
+	qrp_counting_free_null(&qrp_counting);
+	qrp_counting = qc;
+	atomic_bool_set(&qrp_counting_stale, FALSE);
+
+	if (qrp_debugging(1)) {
+		g_debug("QRP counting table: %zu word%s, %zu substring%s, "
+			"%d/%d slots filled",
+			PLURAL(htable_count(qc->words)), PLURAL(htable_count(qc->substr)),
+			qc->filled, qc->slots);
+	}
+}
+
 /**
  * Compute QRP table, iteration step.
  */
@@ -2063,7 +2530,8 @@ qrp_step_compute(struct bgtask *h, void *u, int unused_ticks)
 	char *table = NULL;
 	int slots;
 	int bits;
-	const pslist_t *sl;
+	htable_iter_t *iter;
+	const void *key;
 	int upper_thresh;
 	int hashed = 0;
 	int filled = 0;
@@ -2087,8 +2555,9 @@ qrp_step_compute(struct bgtask *h, void *u, int unused_ticks)
 	table = halloc(slots);
 	memset(table, LOCAL_INFINITY, slots);
 
-	PSLIST_FOREACH(ctx->sl_substrings, sl) {
-		const char *word = sl->data;
+	iter = htable_iter_new(ctx->substr);
+	while (htable_iter_next(iter, &key, NULL)) {
+		const char *word = key;
 		uint idx = qrp_hash(word, bits);
 
 		hashed++;
@@ -2112,6 +2581,7 @@ qrp_step_compute(struct bgtask *h, void *u, int unused_ticks)
 			break;
 		}
 	}
+	htable_iter_release(&iter);
 
 	conflict_ratio = ctx->substrings == 0 ? 0 :
 		(int) (100.0 * (ctx->substrings - filled) / ctx->substrings);
@@ -2142,6 +2612,8 @@ qrp_step_compute(struct bgtask *h, void *u, int unused_ticks)
 		gnet_prop_set_guint32_val(PROP_QRP_CONFLICT_RATIO,
 			(uint32) conflict_ratio);
 
+		qrp_counting_install(ctx, bits);
+
 		/*
 		 * If we had already a table, compare it to the one we just built.
 		 * If they are identical, discard the new one.
@@ -2676,6 +3148,212 @@ qrp_finalize_computation(htable_t *words)
 	QRP_TASK_UNLOCK;
 }
 
+/***
+ *** Incremental updates.
+ ***/
+
+static bgstep_cb_t qrp_update_steps[] = {
+	qrp_step_create_table,
+	qrp_step_create_patches,
+	qrp_step_install_leaf,
+	qrp_step_wait_for_merged_table,
+	qrp_step_merge_with_leaves,
+	qrp_step_install_ultra,
+};
+
+/**
+ * qrp_word_substrings() callback to add substring to the counting table.
+ */
+static void
+qrp_counting_substr_add(const char *s, size_t unused_size, void *data)
+{
+	struct qrp_counting *qc = data;
+	uint idx;
+
+	(void) unused_size;
+
+	if (!qrp_string_ref(qc->substr, s))
+		return;
+
+	idx = qrp_hash(s, qc->bits);
+
+	if (0 == qc->counts[idx]) {
+		qc->filled++;
+		qc->dirty = TRUE;
+	}
+	if (qc->counts[idx] < QRP_COUNT_MAX)
+		qc->counts[idx]++;
+}
+
+/**
+ * qrp_word_substrings() callback to remove substring from the counting table.
+ */
+static void
+qrp_counting_substr_remove(const char *s, size_t unused_size, void *data)
+{
+	struct qrp_counting *qc = data;
+	uint idx;
+
+	(void) unused_size;
+
+	if (!qrp_string_unref(qc->substr, s))
+		return;
+
+	idx = qrp_hash(s, qc->bits);
+
+	if (0 == qc->counts[idx] || QRP_COUNT_MAX == qc->counts[idx])
+		return;			/* Saturated counts stick */
+
+	if (0 == --qc->counts[idx]) {
+		qc->filled--;
+		qc->dirty = TRUE;
+	}
+}
+
+/**
+ * qrp_file_words() callback to add word to the counting table.
+ */
+static bool
+qrp_counting_word_add(const char *word, void *data)
+{
+	struct qrp_counting *qc = data;
+
+	if (!qrp_string_ref(qc->words, word))
+		return FALSE;
+
+	qrp_word_substrings(word, qrp_counting_substr_add, qc);
+	return TRUE;
+}
+
+/**
+ * qrp_file_words() callback to remove word from the counting table.
+ */
+static bool
+qrp_counting_word_remove(const char *word, void *data)
+{
+	struct qrp_counting *qc = data;
+
+	if (qrp_string_unref(qc->words, word)) {
+		qrp_word_substrings(word, qrp_counting_substr_remove, qc);
+		if (qrp_debugging(8))
+			g_debug("removed QRP word \"%s\"", word);
+	}
+
+	return FALSE;
+}
+
+/**
+ * Can the local routing table be updated incrementally?
+ *
+ * This is possible only once a full computation completed, and as long
+ * as no other computation is pending.
+ */
+bool
+qrp_can_update(void)
+{
+	bool ok;
+
+	QRP_TASK_LOCK;
+	ok = qrp_counting != NULL && NULL == qrp_comp &&
+		!atomic_bool_get(&qrp_counting_stale);
+	QRP_TASK_UNLOCK;
+
+	return ok;
+}
+
+/**
+ * Incrementally add or remove shared file from the local routing table.
+ *
+ * Changes are only propagated by qrp_update_commit(), and this must only be
+ * called when qrp_can_update() says so.
+ *
+ * @param sf		the shared file
+ * @param add		TRUE when adding the file, FALSE when removing it
+ */
+void
+qrp_update_file(const shared_file_t *sf, bool add)
+{
+	g_return_if_fail(qrp_counting != NULL);
+
+	if (qrp_debugging(1)) {
+		g_debug("QRP %s file \"%s\"", add ? "adding" : "removing",
+			shared_file_name_canonic(sf));
+	}
+
+	qrp_file_words(sf,
+		add ? qrp_counting_word_add : qrp_counting_word_remove, qrp_counting);
+}
+
+/**
+ * Propagate the changes made by qrp_update_file() to the routing table.
+ *
+ * @return FALSE if the routing table must be fully recomputed instead.
+ */
+bool
+qrp_update_commit(void)
+{
+	struct qrp_counting *qc = qrp_counting;
+	struct qrp_context *ctx;
+	int i;
+
+	if (!qrp_can_update())
+		return FALSE;
+
+	if (!qc->dirty)
+		return TRUE;		/* Table did not change */
+
+	/*
+	 * If the table became too full, we need a larger one, which requires
+	 * a full computation.
+	 */
+
+	if (
+		qc->bits < MAX_TABLE_BITS &&
+		100 * qc->filled > MIN_SPARSE_RATIO * qc->slots
+	) {
+		if (qrp_debugging(1)) {
+			g_debug("QRP table too full (%d/%d slots), must recompute",
+				qc->filled, qc->slots);
+		}
+		return FALSE;
+	}
+
+	WALLOC0(ctx);
+	ctx->magic = QRP_MAGIC;
+	ctx->rtp = &local_table;
+	ctx->slots = qc->slots;
+	ctx->table = halloc(qc->slots);
+
+	for (i = 0; i < qc->slots; i++)
+		ctx->table[i] = 0 == qc->counts[i] ? LOCAL_INFINITY : 1;
+
+	qc->dirty = FALSE;
+
+	if (qrp_debugging(1)) {
+		g_debug("QRP incremental update: %d/%d slots filled",
+			qc->filled, qc->slots);
+	}
+
+	gnet_prop_set_guint32_val(PROP_QRP_SLOTS_FILLED, (uint32) qc->filled);
+	gnet_prop_set_guint32_val(PROP_QRP_FILL_RATIO,
+		(uint32) (100.0 * qc->filled / qc->slots));
+	gnet_prop_set_timestamp_val(PROP_QRP_TIMESTAMP, tm_time());
+
+	QRP_TASK_LOCK;
+
+	qrp_comp = bg_task_create_stopped(NULL, "QRP update",
+		qrp_update_steps, N_ITEMS(qrp_update_steps),
+		ctx, qrp_comp_context_free,
+		qrp_comp_done, NULL);
+
+	if (qrp_comp != NULL)
+		bg_task_run(qrp_comp);
+
+	QRP_TASK_UNLOCK;
+
+	return TRUE;
+}
+
 static void
 qrp_merge_done(bgtask_t *bt, void *u_ctx, bgstatus_t u_status, void *u_arg)
 {
@@ -4612,6 +5290,7 @@ qrt_handle_reset(
 	rt->compacted = TRUE;		/* We'll compact it on the fly */
 	rt->digest = NULL;
 	rt->reset = TRUE;
+	rt->index_col = -1;
 
 	qrcv->table = rt;
 	qrcv->shrink_factor = 1;		/* Assume none for now */
@@ -4717,6 +5396,8 @@ qrt_handle_patch(
 		qrcv->table->set_count = 0;
 		qrcv->patch = qrt_apply_patch; /* Default handler. */
 
+		qrt_index_invalidate(qrcv->table);
+
 		qrt_dynamic_bind(qrcv->table);	/* Reset initial `can_route' */
 
 		switch (qrcv->entry_bits) {
@@ -4946,6 +5627,8 @@ qrt_handle_patch(
 			rt->is_empty = FALSE;
 		}
 
+		qrt_index_update(rt);
+
 		/*
 		 * Install the table in the node, if it was a new table.
 		 * Otherwise, we only finished patching it.
@@ -5002,11 +5685,17 @@ qrt_receive_next(struct qrt_receive *qrcv, bool *done)
 	case GTA_MSGV_QRP_PATCH:
 		{
 			struct qrp_patch patch;
+			tm_nano_t start;
+			bool ok;
 
 			if (!qrp_recv_patch(n, &patch))
 				goto dropped;
 
-			return qrt_handle_patch(n, qrcv, &patch, done);
+			latency_begin(&start);
+			ok = qrt_handle_patch(n, qrcv, &patch, done);
+			latency_end("core", func_to_pointer(qrt_handle_patch), &start);
+
+			return ok;
 		}
 		break;
 	default:
@@ -5111,6 +5800,8 @@ qrp_close(void)
 	if (merged_table)
 		qrt_unref(merged_table);
 
+	qrp_counting_free_null(&qrp_counting);
+	qrt_index_free();
 	HFREE_NULL(buffer.arena);
 }
 
@@ -5431,6 +6122,7 @@ qrt_build_query_target(
 {
 	pslist_t *nodes = NULL;		/* Targets for the query */
 	const pslist_t *sl;
+	const bit_array_t *routable = NULL;
 	bool sha1_query;
 	bool whats_new;
 
@@ -5457,6 +6149,14 @@ qrt_build_query_target(
 
 	sha1_query = qhvec_has_urn(qhvec);
 
+	/*
+	 * Compute the set of indexed tables to which we can route the query,
+	 * in one pass over the transposed index.
+	 */
+
+	if (!whats_new)
+		routable = qrt_index_route(qhvec);
+
 	/*
 	 * We need to special case processing of queries with TTL=1 so that they
 	 * get set to ultra peers that support last-hop QRP only if they can
@@ -5532,9 +6232,7 @@ qrt_build_query_target(
 
 		node_inc_qrp_query(dn);			/* We have a QRT, mark we try routing */
 
-		if (!(qhvec->has_urn ?
-			  rt->can_route_urn(qhvec, rt) :
-			  rt->can_route(qhvec, rt)))
+		if (!qrt_index_can_route(rt, qhvec, routable))
 			continue;
 
 		if (!is_leaf)
@@ -82,6 +82,10 @@ void qrp_add_file(const struct shared_file *sf, struct htable *words);
 void qrp_finalize_computation(struct htable *words);
 void qrp_dispose_words(struct htable **h_ptr);
 
+bool qrp_can_update(void);
+void qrp_update_file(const struct shared_file *sf, bool add);
+bool qrp_update_commit(void);
+
 struct qrt_update *qrt_update_create(struct gnutella_node *n,
 						struct routing_table *);
 void qrt_update_free(struct qrt_update *);
@@ -0,0 +1,558 @@
+/*
+ * Copyright (c) 2026, Raphael Manfredi
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup core
+ * @file
+ *
+ * Offline replay of Gnutella traffic dumps.
+ *
+ * The traffic dumps written by the dump layer (in the "barracuda" format)
+ * are read back and each received message is fed to the regular message
+ * processing pipeline, through node_parse(), as if it had just come from
+ * the node which originally sent it.  This exercises route_message(),
+ * search_request(), QRP routing and query hit generation on real traffic,
+ * in a reproducible manner, so that changes in these areas can be
+ * benchmarked.
+ *
+ * Each distinct source found in the dump is mapped to a replay node, a
+ * fake node with no socket and no TX stack, so nothing is ever sent back
+ * to it.  To prevent any replayed message from escaping to the network,
+ * a replay can only be started when the servent is offline.
+ *
+ * The dump format does not carry any timestamp, hence we cannot honour
+ * the original pace of the traffic.  Messages are either replayed at a
+ * fixed rate, or as fast as possible, in which case the processing is
+ * done by time slices to keep the application responsive.
+ *
+ * For each message type, we measure the amount of processing time and
+ * the amount of memory allocations done whilst handling the message.
+ *
+ * @author Raphael Manfredi
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "replay.h"
+
+#include "gmsg.h"
+#include "nodes.h"
+
+#include "lib/atoms.h"
+#include "lib/cq.h"
+#include "lib/endian.h"
+#include "lib/file.h"
+#include "lib/host_addr.h"
+#include "lib/htable.h"
+#include "lib/log.h"
+#include "lib/str.h"
+#include "lib/stringify.h"
+#include "lib/tm.h"
+#include "lib/walloc.h"
+#include "lib/xmalloc.h"
+#include "lib/zalloc.h"
+
+#include "if/gnet_property_priv.h"
+
+#include "lib/override.h"		/* Must be the last header included */
+
+#define REPLAY_SLICE_MS		50		/**< Max processing slice, in ms */
+#define REPLAY_PERIOD_MS	100		/**< Period when replaying at fixed rate */
+#define REPLAY_YIELD_MS		1		/**< Delay between unthrottled slices */
+
+/**
+ * Barracuda dump header flags.
+ *
+ * These must be kept in sync with the ones used in dump.c.
+ */
+enum replay_header_flags {
+	RH_F_UDP  = (1 << 0),
+	RH_F_TCP  = (1 << 1),
+	RH_F_IPV4 = (1 << 2),
+	RH_F_IPV6 = (1 << 3),
+	RH_F_TO   = (1 << 4),
+	RH_F_CTRL = (1 << 5)
+};
+
+/**
+ * Size of the barracuda dump header: flags, 16-byte address and a port.
+ */
+#define REPLAY_HEADER_SIZE	19
+
+/**
+ * Statistics about a given processing stage.
+ */
+struct replay_stage {
+	uint64 count;				/**< Amount of messages processed */
+	uint64 bytes;				/**< Amount of bytes processed */
+	uint64 ns;					/**< Processing time, in nanoseconds */
+	uint64 allocs;				/**< Amount of memory allocations */
+};
+
+/**
+ * Replay context.
+ */
+static struct replay {
+	FILE *f;					/**< Dump file being replayed */
+	const char *path;			/**< Path of dump file (atom) */
+	char *buf;					/**< Payload buffer */
+	htable_t *nodes;			/**< Dump header -> replay node */
+	cevent_t *ev;				/**< Callout for next processing slice */
+	uint rate;					/**< Messages per second, 0 = unthrottled */
+	bool running;				/**< Whether replay is in progress */
+	tm_nano_t start;			/**< Start of replay */
+	tm_nano_t end;				/**< End of replay, when not running */
+	double cpu_user;			/**< CPU user time at start, then spent */
+	double cpu_sys;				/**< CPU system time at start, then spent */
+	uint64 records;				/**< Amount of records read */
+	uint64 replayed;			/**< Amount of messages replayed */
+	uint64 skipped;				/**< Amount of records skipped */
+	uint malformed;				/**< Amount of malformed records */
+	uint64 created;				/**< Amount of replay nodes created */
+	struct replay_stage read;	/**< Reading of the dump file */
+	struct replay_stage stage[256];	/**< Processing, by message function */
+} replay;
+
+/**
+ * @return total amount of memory allocations done so far.
+ */
+static inline uint64
+replay_allocations(void)
+{
+	return xmalloc_allocations() + zalloc_allocations();
+}
+
+/**
+ * Account processing to the given stage.
+ */
+static void
+replay_account(struct replay_stage *rs, size_t bytes,
+	const tm_nano_t *start, uint64 allocs)
+{
+	tm_nano_t end, elapsed;
+
+	tm_precise_time(&end);
+	tm_precise_elapsed(&elapsed, &end, start);
+
+	rs->count++;
+	rs->bytes += bytes;
+	rs->ns += tmn2ns(&elapsed);
+	rs->allocs += replay_allocations() - allocs;
+}
+
+/**
+ * Free replay node held in the node table.
+ */
+static bool
+replay_node_free(const void *key, void *value, void *unused_data)
+{
+	(void) unused_data;
+
+	node_replay_free(value);
+	wfree(deconstify_pointer(key), REPLAY_HEADER_SIZE);
+	return TRUE;
+}
+
+/**
+ * Get the replay node for the dump header, creating it if needed.
+ *
+ * @return the replay node, NULL if the header is not usable.
+ */
+static gnutella_node_t *
+replay_node_get(const uchar *dh)
+{
+	gnutella_node_t *n;
+	host_addr_t addr;
+	uint16 port;
+	uint8 flags = dh[0];
+
+	n = htable_lookup(replay.nodes, dh);
+	if (n != NULL)
+		return n;
+
+	if (flags & RH_F_IPV4)
+		addr = host_addr_get_ipv4(peek_be32(&dh[1]));
+	else if (flags & RH_F_IPV6)
+		addr = host_addr_peek_ipv6(&dh[1]);
+	else
+		return NULL;
+
+	port = peek_be16(&dh[17]);
+	n = node_replay_create(addr, port, booleanize(flags & RH_F_UDP));
+	htable_insert(replay.nodes, wcopy(dh, REPLAY_HEADER_SIZE), n);
+	replay.created++;
+
+	return n;
+}
+
+/**
+ * Discard a replay node that was detached during message processing.
+ */
+static void
+replay_node_discard(const uchar *dh)
+{
+	const void *key;
+	void *n;
+
+	if (htable_lookup_extended(replay.nodes, dh, &key, &n)) {
+		htable_remove(replay.nodes, dh);
+		replay_node_free(key, n, NULL);
+	}
+}
+
+/**
+ * Read exactly ``len'' bytes from the dump file.
+ *
+ * @return TRUE if we read everything, FALSE on EOF or error.
+ */
+static bool
+replay_read(void *dest, size_t len)
+{
+	return 0 == len || 1 == fread(dest, len, 1, replay.f);
+}
+
+enum replay_status {
+	REPLAY_OK = 0,				/**< Record processed */
+	REPLAY_SKIP,				/**< Record skipped */
+	REPLAY_EOF,					/**< End of dump */
+	REPLAY_ERROR				/**< Malformed dump */
+};
+
+/**
+ * Read next record from the dump and replay it if it is a received message.
+ */
+static enum replay_status
+replay_next(void)
+{
+	uchar dh[REPLAY_HEADER_SIZE];
+	uchar from[REPLAY_HEADER_SIZE];
+	gnutella_header_t header;
+	gnutella_node_t *n;
+	tm_nano_t start;
+	uint64 allocs;
+	uint8 flags, function;
+	uint16 size;
+
+	tm_precise_time(&start);
+	allocs = replay_allocations();
+
+	if (!replay_read(ARYLEN(dh)))
+		return feof(replay.f) ? REPLAY_EOF : REPLAY_ERROR;
+
+	flags = dh[0];
+
+	if ((flags & RH_F_TO) && !replay_read(ARYLEN(from)))
+		return REPLAY_ERROR;
+
+	if (!replay_read(&header, sizeof header))
+		return REPLAY_ERROR;
+
+	size = gmsg_size(&header);
+	if (!replay_read(replay.buf, size))
+		return REPLAY_ERROR;
+
+	replay.records++;
+	replay_account(&replay.read, size + sizeof header, &start, allocs);
+
+	/*
+	 * Only messages we received are replayed: the transmitted ones are
+	 * the product of our own processing.
+	 *
+	 * We also leave out BYE messages, which would tear down the replay
+	 * node, and DHT traffic, which is not handled by node_parse().
+	 */
+
+	if (flags & RH_F_TO)
+		return REPLAY_SKIP;
+
+	if (0 == (flags & (RH_F_UDP | RH_F_TCP)))
+		return REPLAY_SKIP;
+
+	function = gmsg_function(&header);
+	if (GTA_MSG_BYE == function || GTA_MSG_DHT == function)
+		return REPLAY_SKIP;
+
+	n = replay_node_get(dh);
+	if (NULL == n)
+		return REPLAY_SKIP;
+
+	tm_precise_time(&start);
+	allocs = replay_allocations();
+
+	if (!node_replay_process(n, &header, replay.buf, size))
+		replay_node_discard(dh);
+
+	replay_account(&replay.stage[function], size + sizeof header,
+		&start, allocs);
+
+	return REPLAY_OK;
+}
+
+/**
+ * Terminate the replay, releasing all the resources.
+ */
+static void
+replay_end(void)
+{
+	double user, sys;
+
+	g_assert(replay.running);
+
+	cq_cancel(&replay.ev);
+
+	tm_precise_time(&replay.end);
+	tm_cputime(&user, &sys);
+	replay.cpu_user = user - replay.cpu_user;
+	replay.cpu_sys = sys - replay.cpu_sys;
+
+	htable_foreach_remove(replay.nodes, replay_node_free, NULL);
+	htable_free_null(&replay.nodes);
+	fclose(replay.f);
+	replay.f = NULL;
+	XFREE_NULL(replay.buf);
+
+	replay.running = FALSE;
+}
+
+/**
+ * @return elapsed time since the start of the replay, in seconds.
+ */
+static double
+replay_elapsed(void)
+{
+	tm_nano_t now;
+
+	if (replay.running)
+		tm_precise_time(&now);
+	else
+		now = replay.end;
+
+	return tm_precise_elapsed_f(&now, &replay.start);
+}
+
+/**
+ * Callout queue callback to process the next slice of the dump.
+ */
+static void
+replay_slice(cqueue_t *cq, void *unused_data)
+{
+	tm_nano_t start, now;
+	uint64 target = 0;
+
+	(void) unused_data;
+
+	cq_zero(cq, &replay.ev);
+
+	tm_precise_time(&start);
+
+	if (replay.rate != 0)
+		target = (uint64) (replay.rate * replay_elapsed());
+
+	for (;;) {
+		enum replay_status status;
+
+		if (replay.rate != 0 && replay.replayed >= target)
+			break;
+
+		status = replay_next();
+
+		switch (status) {
+		case REPLAY_OK:
+			replay.replayed++;
+			break;
+		case REPLAY_SKIP:
+			replay.skipped++;
+			break;
+		case REPLAY_ERROR:
+			replay.malformed++;
+			g_warning("%s(): truncated or corrupted dump \"%s\"",
+				G_STRFUNC, replay.path);
+			/* FALL THROUGH */
+		case REPLAY_EOF:
+			replay_end();
+			g_info("replayed %s message%s from \"%s\" in %.3f secs "
+				"(%.1f msg/s)",
+				uint64_to_string(replay.replayed), plural(replay.replayed),
+				replay.path, replay_elapsed(),
+				replay.replayed / MAX(replay_elapsed(), 1e-9));
+			return;
+		}
+
+		tm_precise_time(&now);
+		if (tm_precise_elapsed_f(&now, &start) * 1000.0 >= REPLAY_SLICE_MS)
+			break;
+	}
+
+	replay.ev = cq_main_insert(
+		0 == replay.rate ? REPLAY_YIELD_MS : REPLAY_PERIOD_MS,
+		replay_slice, NULL);
+}
+
+/**
+ * Start replaying the specified dump.
+ *
+ * @param path		the path of the dump file
+ * @param rate		messages per second, 0 meaning as fast as possible
+ *
+ * @return NULL if OK, an error message otherwise.
+ */
+const char *
+replay_start(const char *path, uint rate)
+{
+	FILE *f;
+
+	g_assert(path != NULL);
+
+	if (replay.running)
+		return _("a replay is already in progress");
+
+	if (GNET_PROPERTY(online_mode))
+		return _("servent must be offline to replay traffic");
+
+	f = file_fopen(path, "rb");
+	if (NULL == f)
+		return g_strerror(errno);
+
+	atom_str_change(&replay.path, path);
+
+	replay.f = f;
+	replay.rate = rate;
+	replay.buf = xmalloc(GTA_SIZE_MASK + 1);
+	replay.nodes = htable_create(HASH_KEY_FIXED, REPLAY_HEADER_SIZE);
+	replay.records = replay.replayed = replay.skipped = 0;
+	replay.malformed = replay.created = 0;
+	ZERO(&replay.read);
+	ZERO(&replay.stage);
+	replay.running = TRUE;
+
+	tm_precise_time(&replay.start);
+	tm_cputime(&replay.cpu_user, &replay.cpu_sys);
+
+	replay.ev = cq_main_insert(REPLAY_YIELD_MS, replay_slice, NULL);
+
+	return NULL;
+}
+
+/**
+ * Stop current replay.
+ *
+ * @return TRUE if a replay was stopped.
+ */
+bool
+replay_stop(void)
+{
+	if (!replay.running)
+		return FALSE;
+
+	replay_end();
+	return TRUE;
+}
+
+/**
+ * @return whether a replay is in progress.
+ */
+bool
+replay_is_running(void)
+{
+	return replay.running;
+}
+
+/**
+ * Log statistics about a processing stage.
+ */
+static void
+replay_stage_log(logagent_t *la, const char *name,
+	const struct replay_stage *rs)
+{
+	log_info(la, "%-16s %10s %12s %10.3f %9.2f %9.2f",
+		name, uint64_to_string(rs->count), uint64_to_string2(rs->bytes),
+		rs->ns / 1e6, rs->ns / 1e3 / rs->count,
+		(double) rs->allocs / rs->count);
+}
+
+/**
+ * Log replay statistics to specified log agent.
+ */
+void
+replay_dump_log(logagent_t *la)
+{
+	double elapsed, user, sys;
+	uint i;
+
+	if (NULL == replay.path) {
+		log_info(la, "no traffic replay done yet");
+		return;
+	}
+
+	elapsed = replay_elapsed();
+
+	if (replay.running) {
+		tm_cputime(&user, &sys);
+		user -= replay.cpu_user;
+		sys -= replay.cpu_sys;
+	} else {
+		user = replay.cpu_user;
+		sys = replay.cpu_sys;
+	}
+
+	log_info(la, "replay of \"%s\" %s, %s",
+		replay.path, replay.running ? "in progress" : "done",
+		0 == replay.rate ? "unthrottled" :
+			str_smsg("at %u msg/s", replay.rate));
+	log_info(la, "records: %s read, %s replayed, %s skipped, %u malformed",
+		uint64_to_string(replay.records), uint64_to_string2(replay.replayed),
+		uint64_to_string3(replay.skipped), replay.malformed);
+	log_info(la, "%s replay node%s, %.3f secs elapsed, %.1f msg/s",
+		uint64_to_string(replay.created), plural(replay.created),
+		elapsed, replay.replayed / MAX(elapsed, 1e-9));
+	log_info(la, "CPU: %.3f secs user, %.3f secs sys, %.2f usecs/msg",
+		user, sys, (user + sys) * 1e6 / MAX(replay.replayed, 1));
+
+	log_info(la, "%-16s %10s %12s %10s %9s %9s",
+		"Stage", "Count", "Bytes", "Total ms", "Avg us", "Allocs");
+
+	if (replay.read.count != 0)
+		replay_stage_log(la, "(read)", &replay.read);
+
+	for (i = 0; i < N_ITEMS(replay.stage); i++) {
+		const struct replay_stage *rs = &replay.stage[i];
+
+		if (rs->count != 0)
+			replay_stage_log(la, gmsg_name(i), rs);
+	}
+}
+
+/**
+ * Called at shutdown time.
+ */
+void
+replay_close(void)
+{
+	if (replay.running)
+		replay_end();
+
+	atom_str_free_null(&replay.path);
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -97,6 +97,7 @@
 #include "lib/endian.h"
 #include "lib/entropy.h"
 #include "lib/glib-missing.h"
+#include "lib/getcpucount.h"
 #include "lib/gnet_host.h"
 #include "lib/halloc.h"
 #include "lib/hashing.h"
@@ -107,6 +108,7 @@
 #include "lib/idtable.h"
 #include "lib/iso3166.h"
 #include "lib/listener.h"
+#include "lib/log.h"
 #include "lib/magnet.h"
 #include "lib/mempcpy.h"
 #include "lib/nid.h"
@@ -118,8 +120,10 @@
 #include "lib/sectoken.h"
 #include "lib/str.h"
 #include "lib/stringify.h"		/* For hex_escape() */
+#include "lib/thread.h"
 #include "lib/tm.h"
 #include "lib/tokenizer.h"
+#include "lib/topk.h"
 #include "lib/urn.h"
 #include "lib/utf8.h"
 #include "lib/vector.h"
@@ -127,6 +131,7 @@
 #include "lib/walloc.h"
 #include "lib/wd.h"
 #include "lib/wordvec.h"
+#include "lib/workpool.h"
 #include "lib/wq.h"
 
 #include "lib/override.h"		/* Must be the last header included */
@@ -163,6 +168,23 @@ static sectoken_gen_t *guess_stg;		/**< GUESS token generator */
 static sectoken_gen_t *ora_stg;			/**< OOB request ack token generator */
 static aging_table_t *ora_secure;		/**< Hosts supporting secure OOB */
 
+/*
+ * Query hit decoding workers.
+ */
+#define SEARCH_DECODE_THREADS	4		/**< Max threads decoding hits */
+#define SEARCH_DECODE_PENDING	256		/**< Max hits waiting for a worker */
+
+static workpool_t *search_decode_pool;	/**< Workers decoding query hits */
+
+/*
+ * Heavy hitters among received queries, to spot floods.
+ */
+#define SEARCH_TOP_QUERIES		1024	/**< Distinct queries tracked */
+#define SEARCH_TOP_SOURCES		256		/**< Distinct query sources tracked */
+
+static topk_t *search_top_queries;		/**< Most frequent queries */
+static topk_t *search_top_sources;		/**< Hosts relaying most queries */
+
 enum search_ctrl_magic { SEARCH_CTRL_MAGIC = 0x0add8c06 };
 
 /**
@@ -1472,12 +1494,34 @@ search_filename_similar(const char *filename, const char *query)
 	return result;
 }
 
+/**
+ * Mark all the records of the set as spam.
+ */
 static void
-search_results_identify_spam(const gnutella_node_t *n, gnet_results_set_t *rs,
-	hostiles_flags_t *hostile)
+search_results_flag_all_spam(gnet_results_set_t *rs)
+{
+	const pslist_t *sl;
+
+	PSLIST_FOREACH(rs->records, sl) {
+		gnet_record_t *rc = sl->data;
+		rc->flags |= SR_SPAM;
+	}
+}
+
+/**
+ * Identify spam records in the results set, from the sole contents of the
+ * hit and from the spam databases.
+ *
+ * This does not depend on any state owned by the main thread and is
+ * therefore performed by the decoding worker when the hit is processed
+ * asynchronously.  Checks involving the query that triggered the hit are
+ * left to search_results_identify_spam().
+ */
+static void
+search_results_identify_spam_records(const gnutella_node_t *n,
+	gnet_results_set_t *rs, hostiles_flags_t *hostile)
 {
 	const pslist_t *sl;
-	uint8 has_ct = 0, has_tth = 0, has_xml = 0, expected_xml = 0;
 	bool logged = FALSE;
 
 	PSLIST_FOREACH(rs->records, sl) {
@@ -1575,7 +1619,50 @@ search_results_identify_spam(const gnutella_node_t *n, gnet_results_set_t *rs,
 			logged = TRUE;
 			rc->flags |= SR_SPAM;
 			*hostile |= HSTL_BAD_UTF8;
-		} else if (
+		}
+
+		/*
+		 * If we already determined that these results come from a spammer,
+		 * there's no need to inspect the other records.
+		 */
+
+		if (search_results_from_spammer(rs)) {
+			search_log_spam(logged ? NULL : n, rs, "hit from spammer");
+			search_results_flag_all_spam(rs);
+			return;
+		}
+	}
+}
+
+/**
+ * Identify spam in the results set, once it has been finalized.
+ *
+ * The records have already been inspected by
+ * search_results_identify_spam_records(): we now look at them in the light
+ * of the query they answer, then check the set as a whole, which requires
+ * information held by the main thread.
+ */
+static void
+search_results_identify_spam(const gnutella_node_t *n, gnet_results_set_t *rs,
+	hostiles_flags_t *hostile)
+{
+	const pslist_t *sl;
+	uint8 has_ct = 0, has_tth = 0, has_xml = 0, expected_xml = 0;
+	bool logged = FALSE;
+
+	g_assert(thread_is_main());
+
+	if (search_results_from_spammer(rs))
+		return;			/* All records already flagged */
+
+	PSLIST_FOREACH(rs->records, sl) {
+		gnet_record_t *rc = sl->data;
+		unsigned n_alt;
+
+		n_alt = rc->alt_locs ? gnet_host_vec_count(rc->alt_locs) : 0;
+
+		if (
+			0 == ((SR_SPAM | SR_IGNORED) & rc->flags) &&
 			T_LIME == rs->vcode.u32 && rs->query != NULL &&
 			0 == strcmp(rs->query, WHATS_NEW_QUERY) &&
 			is_strcaseprefix(rc->filename, WHATS_NEW_QUERY)
@@ -1736,14 +1823,7 @@ search_results_identify_spam(const gnutella_node_t *n, gnet_results_set_t *rs,
 	return;
 
 flag_all:
-	/*
-	 * Mark all records of the set as spam.
-	 */
-
-	PSLIST_FOREACH(rs->records, sl) {
-		gnet_record_t *rc = sl->data;
-		rc->flags |= SR_SPAM;
-	}
+	search_results_flag_all_spam(rs);
 }
 
 /**
@@ -1752,6 +1832,7 @@ flag_all:
  * @param muid	the query MUID used, as seen from the query hit
  * @param addr	the address from which the results come via UDP
  * @param port	the port from which results come
+ * @param token	the OOB security token held in the hit
  */
 static bool
 search_results_are_requested(const guid_t *muid,
@@ -2210,6 +2291,7 @@ search_results_handle_trailer(const gnutella_node_t *n,
 
 	if (0 == rs->hops && (ST_UDP & rs->status)) {
 		const guid_t *muid = gnutella_header_get_muid(&n->header);
+		hostiles_flags_t flags = HSTL_CLEAN;
 
 		if (!has_token)
 			token = 0;
@@ -2246,12 +2328,11 @@ search_results_handle_trailer(const gnutella_node_t *n,
 
 		/* If we have a token and did not mark hit as hostile, check source */
 
-		if (
-			((ST_GOOD_TOKEN | ST_HOSTILE) & rs->status) == ST_GOOD_TOKEN &&
-			hostiles_is_bad(n->addr)
-		) {
+		if (((ST_GOOD_TOKEN | ST_HOSTILE) & rs->status) == ST_GOOD_TOKEN)
+			flags = hostiles_check(n->addr);
+
+		if (hostiles_flags_are_bad(flags)) {
 			if (GNET_PROPERTY(search_debug) > 1) {
-				hostiles_flags_t flags = hostiles_check(n->addr);
 				g_debug("dropping UDP query hit from secure OOB: "
 					"hostile IP %s (%s)",
 					host_addr_to_string(n->addr),
@@ -2270,7 +2351,7 @@ search_results_handle_trailer(const gnutella_node_t *n,
 		rs->port > 0 &&
 		is_host_addr(ipv6_addr) &&
 		settings_running_ipv6() &&
-		!hostiles_is_bad(ipv6_addr)
+		!hostiles_flags_are_bad(hostiles_check(ipv6_addr))
 	) {
 		search_add_push_proxy(rs, ipv6_addr, rs->port);
 	}
@@ -2494,6 +2575,8 @@ static void
 search_validate_result_address(gnet_results_set_t *rs,
 	const gnutella_node_t *n, bool browse)
 {
+	hostiles_flags_t flags;
+
 	/*
 	 * Hits coming from UDP should bear the node's address, unless the
 	 * hit has a private IP because the servent did not determine its
@@ -2519,9 +2602,10 @@ search_validate_result_address(gnet_results_set_t *rs,
 
 	/* Check for hostile IP addresses */
 
-	if (hostiles_is_bad(rs->addr)) {
+	flags = hostiles_check(rs->addr);
+
+	if (hostiles_flags_are_bad(flags)) {
 		if (GNET_PROPERTY(search_debug) > 1) {
-			hostiles_flags_t flags = hostiles_check(rs->addr);
 			g_debug("dropping %s %s %s by %s: hostile source at %s (%s)",
 				NODE_IS_UDP(n) ? "UDP" : "TCP",
 				NODE_TALKS_G2(n) ? "/QH2" : "query hit",
@@ -2599,6 +2683,8 @@ search_validate_guid(gnet_results_set_t *rs,
 /**
  * Finalize information in the results set.
  *
+ * This relies on information held by the main thread.
+ *
  * @param rs		the result set being constructed
  * @param muid		the MUID of the search
  * @param browse	whether we're processing a hit from a "browse host"
@@ -2606,6 +2692,8 @@ search_validate_guid(gnet_results_set_t *rs,
 static void
 search_finalize_results(gnet_results_set_t *rs, const guid_t *muid, bool browse)
 {
+	g_assert(thread_is_main());
+
 	{
 		host_addr_t c_addr;
 
@@ -2715,6 +2803,42 @@ search_finalize_results(gnet_results_set_t *rs, const guid_t *muid, bool browse)
 	}
 }
 
+/**
+ * Complete processing of a Gnutella query hit, once it has been parsed.
+ *
+ * This performs the checks and the finalization relying on information held
+ * by the main thread.  When the hit was decoded by a worker, this is done
+ * when the decoding completes, so that the worker never has to wait for the
+ * main thread.
+ *
+ * @param n			the node from which we got the hit
+ * @param rs		the parsed results set
+ * @param muid		the MUID of the search
+ * @param browse	whether we're processing a hit from a "browse host"
+ * @param hostile	where hostile flags are updated
+ *
+ * @return NULL if OK, the reason for dropping the hit otherwise.
+ */
+static const char *
+search_results_complete(gnutella_node_t *n, gnet_results_set_t *rs,
+	const guid_t *muid, bool browse, hostiles_flags_t *hostile)
+{
+	g_assert(thread_is_main());
+
+	if ((rs->status & ST_FIREWALL) && !route_guid_pushable(rs->guid)) {
+		gnet_stats_count_dropped(n, MSG_DROP_FROM_BANNED);
+		return "firewalled origin & banned GUID";
+	}
+
+	search_finalize_results(rs, muid, browse);
+	search_results_identify_spam(n, rs, hostile);
+
+	if (GNET_PROPERTY(log_query_hits))
+		search_results_log(n, rs);
+
+	return NULL;
+}
+
 static void G_PRINTF(4, 5)
 search_record_warn(const gnutella_node_t *n,
 	const gnet_results_set_t *rs, size_t hit, const char *fmt, ...)
@@ -3379,6 +3503,7 @@ get_g2_results_set(gnutella_node_t *n, const g2_tree_t *t,
 	}
 
 	search_validate_result_address(rs, n, browse);
+	search_results_identify_spam_records(n, rs, hostile);
 	search_finalize_results(rs, muid, browse);
 	search_results_identify_spam(n, rs, hostile);
 
@@ -4040,12 +4165,6 @@ get_results_set(gnutella_node_t *n, bool browse, hostiles_flags_t *hostile)
 		goto bad_packet;
 	}
 
-	if ((rs->status & ST_FIREWALL) && !route_guid_pushable(rs->guid)) {
-        gnet_stats_count_dropped(n, MSG_DROP_FROM_BANNED);
-		badmsg = "firewalled origin & banned GUID";
-		goto bad_packet;
-	}
-
 	/*
 	 * At this point we finished processing of the query hit, successfully.
 	 */
@@ -4054,9 +4173,10 @@ get_results_set(gnutella_node_t *n, bool browse, hostiles_flags_t *hostile)
 
 	/*
 	 * Refresh push-proxies if we're downloading anything from this server.
+	 * When decoding from a worker, this is done by search_results_decoded().
 	 */
 
-	if (rs->proxies != NULL)
+	if (rs->proxies != NULL && thread_is_main())
 		download_got_push_proxies(rs->guid, rs->proxies, FALSE);
 
 	/*
@@ -4117,12 +4237,21 @@ get_results_set(gnutella_node_t *n, bool browse, hostiles_flags_t *hostile)
 					gmsg_node_infostr(n), vendor ? vendor : "????");
 	}
 
-	search_finalize_results(rs, muid, browse);
-	search_results_identify_spam(n, rs, hostile);
-	str_destroy_null(&info);
+	/*
+	 * Spam records are identified right away, by the worker if we are
+	 * decoding the hit from one.  The hit is then completed once back in the
+	 * main thread, by search_results_decoded().
+	 */
 
-	if (GNET_PROPERTY(log_query_hits))
-		search_results_log(n, rs);
+	search_results_identify_spam_records(n, rs, hostile);
+
+	if (thread_is_main()) {
+		badmsg = search_results_complete(n, rs, muid, browse, hostile);
+		if (badmsg != NULL)
+			goto bad_packet;
+	}
+
+	str_destroy_null(&info);
 
 	return rs;
 
@@ -5513,13 +5642,33 @@ search_init(void)
 	ora_stg = sectoken_gen_new(ORA_KEYS, OOB_REPLY_ACK_TIMEOUT);
 	ora_secure = aging_make(OOB_REPLY_ACK_TIMEOUT,
 		gnet_host_hash, gnet_host_equal, gnet_host_free_atom2);
+	aging_thread_safe(ora_secure);		/* Checked by hit decoders */
 
 	cq_periodic_main_add(SEARCH_GC_PERIOD * 1000, search_gc, NULL);
+
+	search_top_queries = topk_make(SEARCH_TOP_QUERIES);
+	search_top_sources = topk_make(SEARCH_TOP_SOURCES);
+
+	/*
+	 * Leave one CPU to the main thread, which still has to route hits
+	 * and dispatch the decoded ones.
+	 */
+
+	{
+		long cpus = getcpucount();
+
+		if (cpus > 1) {
+			search_decode_pool = workpool_make("hit decoder",
+				MIN(cpus - 1, SEARCH_DECODE_THREADS));
+		}
+	}
 }
 
 void G_COLD
 search_shutdown(void)
 {
+	search_decode_close();
+
 	while (sl_search_ctrl != NULL) {
 		search_ctrl_t *sch = sl_search_ctrl->data;
 
@@ -5540,6 +5689,8 @@ search_shutdown(void)
 	sectoken_gen_free_null(&guess_stg);
 	sectoken_gen_free_null(&ora_stg);
 	aging_destroy(&ora_secure);
+	topk_free_null(&search_top_queries);
+	topk_free_null(&search_top_sources);
 }
 
 /**
@@ -5788,45 +5939,28 @@ search_browse_results(gnutella_node_t *n, gnet_search_t sh, const g2_tree_t *t)
 }
 
 /**
- * This routine is called for each hit packet (Gnutella and G2) we receive.
+ * Exploit a parsed hit: update hostile and dynamic querying information,
+ * feed the downloads and the mesh, then dispatch the hit to the searches.
  *
- * @param n			the node receiving the hit
+ * @param n			the node from which the hit comes
  * @param t			the message tree (for G2, NULL for Gnutella)
- * @param results	if not NULL, where amount of results in hit is written back
+ * @param muid		the MUID of the query that produced the hit
+ * @param rs		the decoded results set, freed on return
+ * @param flags		hostile flags determined whilst decoding the hit
  *
- * @returns whether the message should be dropped, i.e. FALSE if OK.
- * If the message should not be dropped, `results' is filled with the
- * amount of results contained in the query hit.
+ * @returns whether the message should not be forwarded.
  */
 static bool
-search_results_process(gnutella_node_t *n, const g2_tree_t *t, int *results)
+search_results_handle(gnutella_node_t *n, const g2_tree_t *t,
+	const guid_t *muid, gnet_results_set_t *rs, hostiles_flags_t flags)
 {
-	gnet_results_set_t *rs;
 	pslist_t *sl;
-	bool drop_it = FALSE;
 	bool forward_it = TRUE;
 	bool dispatch_it = TRUE;
 	pslist_t *selected_searches = NULL;
 	uint32 max_items;
-	hostiles_flags_t flags;
-	const guid_t *muid;
-	guid_t muid_buf;
-
-	g_assert(!(NULL != t) == !NODE_TALKS_G2(n));
-
-	/*
-	 * Get the MUID of the query that produced this hit.
-	 */
 
-	if (NULL == t) {
-		muid = gnutella_header_get_muid(&n->header);
-	} else {
-		muid = g2_msg_get_muid(t, &muid_buf);
-		if (NULL == muid) {
-			gnet_stats_count_dropped(n, MSG_DROP_BAD_RESULT);
-			return TRUE;
-		}
-	}
+	g_assert(rs->num_recs > 0);
 
 	/*
 	 * We'll dispatch to non-frozen passive searches, and to the active search
@@ -5856,32 +5990,6 @@ search_results_process(gnutella_node_t *n, const g2_tree_t *t, int *results)
 				uint_to_pointer(sch->search_handle));
 	}
 
-	/*
-	 * Parse the packet.
-	 *
-	 * If we're not going to dispatch it to any search or auto-download files
-	 * based on the SHA1, the packet is only parsed for validation.
-	 */
-
-	if (NULL == t)
-		rs = get_results_set(n, FALSE, &flags);
-	else
-		rs = get_g2_results_set(n, t, FALSE, &flags);
-
-	if (rs == NULL) {
-        /*
-         * get_results_set takes care of telling the stats that
-         * the message was dropped.
-         */
-		drop_it = TRUE;				/* Don't forward bad packets */
-		goto final_cleanup;
-	}
-
-	g_assert(rs->num_recs > 0);
-
-	if (results != NULL)
-		*results = rs->num_recs;
-
 	/*
 	 * If we're handling a message from our immediate neighbour, grab the
 	 * vendor code from the QHD.  This is useful for 0.4 handshaked nodes
@@ -5934,8 +6042,8 @@ search_results_process(gnutella_node_t *n, const g2_tree_t *t, int *results)
 	 * to be able to throttle messages if we get too many hits.
 	 *
 	 * NB: if the dynamic query says the user is no longer interested
-	 * by the query, we won't forward the results, but we don't set
-	 * `drop_it' as this is reserved for bad packets.
+	 * by the query, we won't forward the results, but we don't flag
+	 * the message as dropped as this is reserved for bad packets.
 	 */
 
 	if (
@@ -6084,26 +6192,215 @@ search_results_process(gnutella_node_t *n, const g2_tree_t *t, int *results)
 	}
 
     search_free_r_set(rs);
-
-final_cleanup:
 	pslist_free(selected_searches);
 
-	return drop_it || !forward_it;
+	return !forward_it;
 }
 
 /**
- * This routine is called for each Query Hit packet we receive.
+ * This routine is called for each hit packet (Gnutella and G2) we receive.
+ *
+ * @param n			the node receiving the hit
+ * @param t			the message tree (for G2, NULL for Gnutella)
+ * @param results	if not NULL, where amount of results in hit is written back
  *
  * @returns whether the message should be dropped, i.e. FALSE if OK.
  * If the message should not be dropped, `results' is filled with the
  * amount of results contained in the query hit.
  */
+static bool
+search_results_process(gnutella_node_t *n, const g2_tree_t *t, int *results)
+{
+	gnet_results_set_t *rs;
+	hostiles_flags_t flags;
+	const guid_t *muid;
+	guid_t muid_buf;
+
+	g_assert(!(NULL != t) == !NODE_TALKS_G2(n));
+
+	/*
+	 * Get the MUID of the query that produced this hit.
+	 */
+
+	if (NULL == t) {
+		muid = gnutella_header_get_muid(&n->header);
+	} else {
+		muid = g2_msg_get_muid(t, &muid_buf);
+		if (NULL == muid) {
+			gnet_stats_count_dropped(n, MSG_DROP_BAD_RESULT);
+			return TRUE;
+		}
+	}
+
+	/*
+	 * Parse the packet.
+	 */
+
+	if (NULL == t)
+		rs = get_results_set(n, FALSE, &flags);
+	else
+		rs = get_g2_results_set(n, t, FALSE, &flags);
+
+	if (rs == NULL) {
+        /*
+         * get_results_set takes care of telling the stats that
+         * the message was dropped.
+         */
+		return TRUE;				/* Don't forward bad packets */
+	}
+
+	if (results != NULL)
+		*results = rs->num_recs;
+
+	return search_results_handle(n, t, muid, rs, flags);
+}
+
+enum search_decode_magic { SEARCH_DECODE_MAGIC = 0x1f4c9d2b };
+
+/**
+ * A query hit decoded by a worker thread.
+ */
+struct search_decode {
+	enum search_decode_magic magic;
+	gnutella_node_t *n;			/**< Snapshot of the node and of the hit */
+	gnet_results_set_t *rs;		/**< Decoded results, NULL if bad hit */
+	hostiles_flags_t flags;		/**< Hostile flags found whilst decoding */
+};
+
+static inline void
+search_decode_check(const struct search_decode * const sd)
+{
+	g_assert(sd != NULL);
+	g_assert(SEARCH_DECODE_MAGIC == sd->magic);
+}
+
+/**
+ * Parse and check query hit, from a worker thread.
+ */
+static void
+search_results_decode(void *arg)
+{
+	struct search_decode *sd = arg;
+
+	search_decode_check(sd);
+
+	sd->rs = get_results_set(sd->n, FALSE, &sd->flags);
+}
+
+/**
+ * Completion of query hit decoding, in the main thread.
+ *
+ * The spam records were identified by the worker.  The hit is finalized
+ * here and its classification completed, since this requires information
+ * held by the main thread, then it is dispatched.
+ */
+static void
+search_results_decoded(void *arg)
+{
+	struct search_decode *sd = arg;
+	gnet_results_set_t *rs;
+
+	search_decode_check(sd);
+
+	rs = sd->rs;
+
+	if (rs != NULL) {
+		const guid_t *muid = gnutella_header_get_muid(&sd->n->header);
+		const char *badmsg;
+
+		if (rs->proxies != NULL)
+			download_got_push_proxies(rs->guid, rs->proxies, FALSE);
+
+		badmsg = search_results_complete(sd->n, rs, muid, FALSE, &sd->flags);
+
+		if (NULL == badmsg) {
+			(void) search_results_handle(sd->n, NULL, muid, rs, sd->flags);
+		} else {
+			if (GNET_PROPERTY(qhit_bad_debug)) {
+				g_warning("BAD %s via %s: %s",
+					gmsg_node_infostr(sd->n), node_infostr(sd->n), badmsg);
+			}
+			search_free_r_set(rs);
+		}
+	}
+
+	node_snapshot_merge(sd->n);
+	node_snapshot_free_null(&sd->n);
+	sd->magic = 0;
+	WFREE(sd);
+}
+
+/**
+ * Hand Query Hit over to the decoding workers when possible.
+ *
+ * We only defer hits which stop here: the forwarding of other hits depends
+ * on their classification.  Hits from neighbours (hops=0 over TCP) are also
+ * kept, since they are used to update the node information, and so are hits
+ * for OOB-proxied queries, which are relayed to the leaf.
+ *
+ * @return TRUE if the hit was deferred.
+ */
+static bool
+search_results_defer(gnutella_node_t *n)
+{
+	struct search_decode *sd;
+
+	if (NULL == search_decode_pool)
+		return FALSE;
+
+	if (workpool_pending(search_decode_pool) >= SEARCH_DECODE_PENDING)
+		return FALSE;
+
+	if (gnutella_header_get_hops(&n->header) <= 1 && !NODE_IS_UDP(n))
+		return FALSE;
+
+	if (
+		GNET_PROPERTY(proxy_oob_queries) &&
+		NULL != oob_proxy_muid_proxied(gnutella_header_get_muid(&n->header))
+	)
+		return FALSE;
+
+	WALLOC0(sd);
+	sd->magic = SEARCH_DECODE_MAGIC;
+	sd->n = node_snapshot(n);
+
+	workpool_submit(search_decode_pool,
+		search_results_decode, search_results_decoded, sd);
+
+	return TRUE;
+}
+
+/**
+ * This routine is called for each Query Hit packet we receive.
+ *
+ * @param n			the node receiving the hit
+ * @param results	where amount of results in hit is written back
+ * @param routed	whether the hit will be forwarded if not dropped
+ *
+ * @returns whether the message should be dropped, i.e. FALSE if OK.
+ * If the message should not be dropped, `results' is filled with the
+ * amount of results contained in the query hit.  When the hit is not
+ * routed, it may be processed asynchronously, and `results' is left
+ * untouched.
+ */
 bool
-search_results(gnutella_node_t *n, int *results)
+search_results(gnutella_node_t *n, int *results, bool routed)
 {
+	if (!routed && search_results_defer(n))
+		return FALSE;
+
 	return search_results_process(n, NULL, results);
 }
 
+/**
+ * Wait for the query hits being decoded and stop the decoding workers.
+ */
+void
+search_decode_close(void)
+{
+	workpool_free_null(&search_decode_pool);
+}
+
 /**
  * This routine is called for each /QH2 packet we receive.
  */
@@ -7569,13 +7866,101 @@ search_request_listener_remove(search_request_listener_t l)
     LISTENER_REMOVE(search_request, l);
 }
 
+/**
+ * Account for a received query in the heavy hitters.
+ */
+static void
+search_top_record(query_type_t type, const char *query, const host_addr_t addr)
+{
+	const char *ip;
+
+	if G_UNLIKELY(NULL == search_top_queries)
+		return;
+
+	if (QUERY_SHA1 == type) {
+		char buf[SHA1_URN_LENGTH + 1];
+		size_t len;
+
+		len = concat_strings(ARYLEN(buf), "urn:sha1:", query, NULL_PTR);
+		topk_add(search_top_queries, buf, len, 1);
+	} else {
+		topk_add(search_top_queries, query, vstrlen(query), 1);
+	}
+
+	ip = host_addr_to_string(addr);
+	topk_add(search_top_sources, ip, vstrlen(ip), 1);
+}
+
 void
 search_request_listener_emit(
 	query_type_t type, const char *query, const host_addr_t addr, uint16 port)
 {
+	search_top_record(type, query, addr);
     LISTENER_EMIT(search_request, (type, query, addr, port));
 }
 
+struct search_top_dump {
+	logagent_t *la;
+	uint64 total;
+};
+
+static void
+search_top_dump_item(const void *key, size_t len,
+	uint64 count, uint64 error, void *data)
+{
+	const struct search_top_dump *ctx = data;
+
+	log_info(ctx->la, "%10s %8s %6.2f%%  %.*s",
+		uint64_to_string(count), uint64_to_string2(error),
+		100.0 * count / MAX(ctx->total, 1), (int) len, (const char *) key);
+}
+
+/**
+ * Dump the most frequent queries, or the hosts sending most queries.
+ *
+ * Counts are over-estimated by at most the reported error.
+ *
+ * @param la		the log agent where output is sent
+ * @param sources	if TRUE, dump query sources instead of queries
+ * @param top		maximum amount of entries to dump, 0 for all
+ */
+void
+search_top_dump_log(logagent_t *la, bool sources, size_t top)
+{
+	struct search_top_dump ctx;
+	const topk_t *tk = sources ? search_top_sources : search_top_queries;
+
+	g_assert(thread_is_main());
+
+	if (NULL == tk)
+		return;
+
+	ctx.la = la;
+	ctx.total = topk_total(tk);
+
+	log_info(la, "%s %s received, %zu/%zu tracked",
+		uint64_to_string(ctx.total), sources ? "query sources" : "queries",
+		topk_count(tk), topk_capacity(tk));
+	log_info(la, "%10s %8s %7s  %s",
+		"count", "error", "share", sources ? "source" : "query");
+
+	topk_foreach(tk, top, search_top_dump_item, &ctx);
+}
+
+/**
+ * Forget about all the queries received so far.
+ */
+void
+search_top_reset(void)
+{
+	g_assert(thread_is_main());
+
+	if (search_top_queries != NULL) {
+		topk_clear(search_top_queries);
+		topk_clear(search_top_sources);
+	}
+}
+
 /**
  * A query context.
  *
@@ -2689,6 +2689,7 @@ SETTINGS_CB(palloc_debug,			uint32,	set_palloc_debug)
 SETTINGS_CB(tm_debug,				uint32,	set_tm_debug)
 SETTINGS_CB(tmalloc_debug,			uint32,	set_tmalloc_debug)
 SETTINGS_CB(vmm_debug,				uint32,	set_vmm_debug)
+SETTINGS_CB(vmm_huge_pages,			bool,	set_vmm_huge_pages)
 SETTINGS_CB(vxml_debug,				uint32,	set_vxml_debug)
 SETTINGS_CB(xmalloc_debug,			uint32,	set_xmalloc_debug)
 SETTINGS_CB(zalloc_always_gc,		bool, 	set_zalloc_always_gc)
@@ -3108,6 +3109,11 @@ static prop_map_t property_map[] = {
         vmm_debug_changed,
         TRUE
     },
+    {
+        PROP_VMM_HUGE_PAGES,
+        vmm_huge_pages_changed,
+        TRUE
+    },
     {
         PROP_XMALLOC_DEBUG,
         xmalloc_debug_changed,
@@ -39,6 +39,7 @@
 #include "share.h"
 
 #include "alias.h"
+#include "bh_upload.h"
 #include "downloads.h"
 #include "extensions.h"
 #include "fileinfo.h"
@@ -92,6 +93,7 @@
 #include "lib/utf8.h"
 #include "lib/vsort.h"
 #include "lib/walloc.h"
+#include "lib/watcher.h"
 #include "lib/xmalloc.h"
 
 #include "lib/override.h"		/* Must be the last header included */
@@ -132,6 +134,7 @@ struct shared_file {
 	const char *name_canonic;	/**< UTF-8 canonized ver. of filename (atom!) */
 	const char *name_normal;	/**< UTF-8 normalized aliases (atom!) */
 	const char *relative_path;	/**< UTF-8 NFC string (atom) */
+	struct qhit_cache *qhit;	/**< Pre-serialized query hit data, if any */
 
 	size_t name_nfc_len;		/**< strlen(name_nfc) */
 	size_t name_canonic_len;	/**< strlen(name_canonic) */
@@ -554,6 +557,7 @@ shared_file_free(shared_file_t **sf_ptr)
 		g_assert_log(0 == (sf->flags & SHARE_F_INDEXED),
 			"%s(): invoked on file still indexed", G_STRFUNC);
 
+		qhit_cache_free_null(&sf->qhit);
 		atom_sha1_free_null(&sf->sha1);
 		atom_tth_free_null(&sf->tth);
 		atom_str_free_null(&sf->relative_path);
@@ -1508,6 +1512,7 @@ struct recursive_scan {
 	time_t start_time;			/* when scanning started */
 	slist_t *base_dirs;			/* list of string atoms */
 	slist_t *sub_dirs;			/* list of g_malloc()ed strings */
+	slist_t *dirs;				/* scanned directories, string atoms */
 	slist_t *shared_files;		/* list of struct shared_file */
 	slist_t *partial_files;		/* list of struct shared_file */
 	slist_iter_t *iter;			/* list iterator */
@@ -1548,6 +1553,7 @@ recursive_scan_new(const pslist_t *base_dirs, time_t now)
 	ctx->magic = RECURSIVE_SCAN_MAGIC;
 	ctx->start_time = now;
 	ctx->base_dirs = slist_new();
+	ctx->dirs = slist_new();
 	ctx->sub_dirs = slist_new();
 	ctx->shared_files = slist_new();
 	ctx->partial_files = slist_new();
@@ -1623,6 +1629,7 @@ recursive_scan_context_free(void *data)
 	slist_iter_free(&ctx->iter);
 	slist_free_all(&ctx->base_dirs, scan_base_dir_free);
 	slist_free_all(&ctx->sub_dirs, do_hfree);
+	slist_free_all(&ctx->dirs, scan_base_dir_free);
 	slist_free_all(&ctx->shared_files, recursive_sf_unref);
 	slist_free_all(&ctx->partial_files, recursive_sf_unref);
 
@@ -1749,6 +1756,7 @@ recursive_scan_opendir(struct recursive_scan *ctx, const char * const dir)
 		ctx->relative_path = NULL;
 	}
 	ctx->current_dir = atom_str_get(dir);
+	slist_prepend(ctx->dirs, deconstify_char(atom_str_get(dir)));
 
 	if (GNET_PROPERTY(share_debug) > 5)
 		g_debug("SHARE scanning directory \"%s\"", ctx->current_dir);
@@ -2303,11 +2311,16 @@ next:
 	return BGR_NEXT;
 }
 
+static void share_watch_update(const slist_t *dirs);
+
 static void *
-recursive_install_shared(void *unused)
+recursive_install_shared(void *data)
 {
-	(void) unused;
+	struct recursive_scan *ctx = data;
 
+	recursive_scan_check(ctx);
+
+	share_watch_update(ctx->dirs);
 	gcu_gui_update_files_scanned();		/* Final view */
 	gnet_prop_set_boolean_val(PROP_LIBRARY_REBUILDING, FALSE);
 
@@ -2429,7 +2442,7 @@ recursive_scan_step_install_shared(struct bgtask *bt, void *data, int ticks)
 	 *		--RAM, 2013-10-29
 	 */
 
-	teq_safe_rpc(THREAD_MAIN_ID, recursive_install_shared, NULL);
+	teq_safe_rpc(THREAD_MAIN_ID, recursive_install_shared, ctx);
 
 	/*
 	 * The next step is going to request the SHA1 of all the library files,
@@ -2771,8 +2784,10 @@ recursive_scan_step_update_qrp_lib(struct bgtask *bt, void *data, int ticks)
 
 		SHARED_LIBFILE_UNLOCK;
 
-		if (NULL == sf)
+		if (NULL == sf) {
+			ctx->idx++;
 			continue;
+		}
 
 		qrp_add_file(sf, ctx->words);
 		shared_file_unref(&sf);
@@ -3229,6 +3244,739 @@ share_scan(void)
 	share_lib_rescan();
 }
 
+/***
+ *** Library change tracking.
+ ***/
+
+/*
+ * Once the library has been scanned, all the shared directories are watched
+ * for changes, when the kernel supports it.  Changed files are collected
+ * and applied incrementally to the library after a short delay, to batch
+ * bursts of changes together, instead of rescanning the whole library.
+ *
+ * A new sub-directory is walked and watched, a removed one removes all the
+ * files it held.  When we lose track of changes (event queue overflow) or
+ * when too many stale entries accumulate in the library tables, we fall
+ * back to a full rescan.
+ */
+
+#define SHARE_WATCH_DELAY	(5 * 1000)	/**< ms, batching delay */
+#define SHARE_WATCH_WALK	10000		/**< Max entries walked incrementally */
+#define SHARE_WATCH_DEPTH	64			/**< Max directory depth walked */
+
+static hset_t *share_watched;			/**< Watched directories (atoms) */
+static hset_t *share_changed;			/**< Changed files (atoms) */
+static hset_t *share_changed_new;		/**< Created directories (atoms) */
+static hset_t *share_changed_gone;		/**< Removed directories (atoms) */
+static cevent_t *share_changed_ev;		/**< Scheduled change processing */
+static bool share_changed_rescan;		/**< Whether full rescan is needed */
+static uint64 share_stale;				/**< Removed entries still in tables */
+
+static void share_watch_event(enum watcher_event, const char *, void *);
+
+/**
+ * Start watching a directory.
+ *
+ * @return TRUE if directory is now watched.
+ */
+static bool
+share_watch_add(const char *dir)
+{
+	if (hset_contains(share_watched, dir))
+		return TRUE;
+
+	if (!watcher_dir_add(dir, share_watch_event, NULL))
+		return FALSE;
+
+	hset_insert(share_watched, atom_str_get(dir));
+	return TRUE;
+}
+
+/**
+ * Hash set iterator to stop watching directories no longer scanned.
+ */
+static bool
+share_watch_remove_stale(const void *key, void *data)
+{
+	const hset_t *dirs = data;
+
+	if (dirs != NULL && hset_contains(dirs, key))
+		return FALSE;
+
+	watcher_dir_remove(key);
+	atom_str_free(key);
+	return TRUE;
+}
+
+/**
+ * Update the set of watched directories after a library scan.
+ *
+ * @param dirs		the scanned directories (string atoms)
+ */
+static void
+share_watch_update(const slist_t *dirs)
+{
+	slist_iter_t *iter;
+	hset_t *scanned;
+	size_t failed = 0;
+
+	scanned = hset_create(HASH_KEY_STRING, 0);
+
+	iter = slist_iter_on_head(dirs);
+	while (slist_iter_has_item(iter)) {
+		const char *dir = slist_iter_current(iter);
+
+		hset_insert(scanned, dir);
+		if (0 == failed && !share_watch_add(dir))
+			failed++;
+		slist_iter_next(iter);
+	}
+	slist_iter_free(&iter);
+
+	hset_foreach_remove(share_watched, share_watch_remove_stale, scanned);
+	hset_free_null(&scanned);
+
+	/*
+	 * The library tables are brand new, all stale entries are gone.
+	 */
+
+	share_stale = 0;
+
+	if (GNET_PROPERTY(share_debug)) {
+		g_debug("SHARE watching %zu director%s for changes%s",
+			PLURAL_Y(hset_count(share_watched)),
+			0 == failed ? "" : " (partially)");
+	}
+}
+
+/**
+ * Is path located within the given directory?
+ */
+static bool
+share_path_is_under(const char *path, const char *dir)
+{
+	const char *s = is_strprefix(path, dir);
+
+	return s != NULL && G_DIR_SEPARATOR == *s;
+}
+
+/**
+ * Is path located within one of the removed directories?
+ */
+static bool
+share_changed_in_gone_dir(const char *path)
+{
+	hset_iter_t *iter;
+	const void *key;
+	bool under = FALSE;
+
+	if (0 == hset_count(share_changed_gone))
+		return FALSE;
+
+	iter = hset_iter_new(share_changed_gone);
+	while (hset_iter_next(iter, &key)) {
+		if (share_path_is_under(path, key)) {
+			under = TRUE;
+			break;
+		}
+	}
+	hset_iter_release(&iter);
+
+	return under;
+}
+
+/**
+ * Hash set iterator to free atoms.
+ */
+static bool
+share_changed_free_atom(const void *key, void *unused_data)
+{
+	(void) unused_data;
+	atom_str_free(key);
+	return TRUE;
+}
+
+/**
+ * Forget about all the recorded changes.
+ */
+static void
+share_changed_clear(void)
+{
+	hset_foreach_remove(share_changed, share_changed_free_atom, NULL);
+	hset_foreach_remove(share_changed_new, share_changed_free_atom, NULL);
+	hset_foreach_remove(share_changed_gone, share_changed_free_atom, NULL);
+	share_changed_rescan = FALSE;
+}
+
+/**
+ * Record path in the set, if not already present.
+ */
+static void
+share_changed_record(hset_t *set, const char *path)
+{
+	if (!hset_contains(set, path))
+		hset_insert(set, atom_str_get(path));
+}
+
+static void share_changed_process(cqueue_t *cq, void *unused_obj);
+
+/**
+ * Callback invoked by the watcher layer when a watched directory changes.
+ */
+static void
+share_watch_event(enum watcher_event ev, const char *path, void *unused_udata)
+{
+	(void) unused_udata;
+
+	if (GNET_PROPERTY(share_debug) > 5) {
+		g_debug("SHARE change event #%d on \"%s\"",
+			ev, NULL == path ? "<all>" : path);
+	}
+
+	switch (ev) {
+	case WATCHER_EV_CREATED:
+	case WATCHER_EV_CHANGED:
+	case WATCHER_EV_REMOVED:
+		if (
+			'.' == *filepath_basename(path) ||
+			!shared_file_valid_extension(path)
+		)
+			return;
+		share_changed_record(share_changed, path);
+		break;
+	case WATCHER_EV_DIR_CREATED:
+		if ('.' == *filepath_basename(path))
+			return;
+		share_changed_record(share_changed_new, path);
+		break;
+	case WATCHER_EV_DIR_REMOVED:
+	case WATCHER_EV_GONE:
+		share_changed_record(share_changed_gone, path);
+		break;
+	case WATCHER_EV_OVERFLOW:
+		share_changed_rescan = TRUE;
+		break;
+	}
+
+	if (NULL == share_changed_ev) {
+		share_changed_ev =
+			cq_main_insert(SHARE_WATCH_DELAY, share_changed_process, NULL);
+	}
+}
+
+/**
+ * Fetch file information, following the symbolic link policy of scans.
+ *
+ * @return TRUE if path designates a regular file, with ``sb'' filled.
+ */
+static bool
+share_changed_stat(const char *path, filestat_t *sb)
+{
+	if (-1 == lstat(path, sb))
+		return FALSE;
+
+	if (S_ISLNK(sb->st_mode)) {
+		if (GNET_PROPERTY(scan_ignore_symlink_regfiles))
+			return FALSE;
+		if (-1 == stat(path, sb))
+			return FALSE;
+	}
+
+	return S_ISREG(sb->st_mode);
+}
+
+/**
+ * Walk new directory, watching it and recording all its files as changed.
+ *
+ * @param dir		the directory to walk
+ * @param depth		current recursion depth
+ * @param count		amount of entries walked so far, updated
+ */
+static void
+share_changed_walk(const char *dir, uint depth, size_t *count)
+{
+	DIR *d;
+	struct dirent *dir_entry;
+
+	if (share_changed_rescan)
+		return;
+
+	if (depth >= SHARE_WATCH_DEPTH || !is_directory(dir))
+		return;
+
+	if (directory_is_unshareable(dir))
+		return;
+
+	/*
+	 * Watch before reading so that we do not miss files created meanwhile.
+	 */
+
+	if (!share_watch_add(dir)) {
+		share_changed_rescan = TRUE;
+		return;
+	}
+
+	if (NULL == (d = opendir(dir))) {
+		g_warning("can't open directory %s: %m", dir);
+		return;
+	}
+
+	while (NULL != (dir_entry = readdir(d))) {
+		const char *filename = dir_entry_filename(dir_entry);
+		filestat_t sb;
+		char *fullpath;
+
+		if ('.' == filename[0])
+			continue;			/* Hidden file, or "." or ".." */
+
+		if (++*count > SHARE_WATCH_WALK) {
+			share_changed_rescan = TRUE;
+			break;
+		}
+
+		fullpath = make_pathname(dir, filename);
+
+		if (0 == lstat(fullpath, &sb)) {
+			if (S_ISLNK(sb.st_mode) && 0 != stat(fullpath, &sb))
+				sb.st_mode = 0;		/* Broken symlink */
+
+			if (S_ISDIR(sb.st_mode)) {
+				if (
+					!GNET_PROPERTY(scan_ignore_symlink_dirs) ||
+					!is_symlink(fullpath)
+				)
+					share_changed_walk(fullpath, depth + 1, count);
+			} else if (
+				S_ISREG(sb.st_mode) && shared_file_valid_extension(filename)
+			) {
+				share_changed_record(share_changed, fullpath);
+			}
+		}
+
+		HFREE_NULL(fullpath);
+
+		if (share_changed_rescan)
+			break;
+	}
+
+	closedir(d);
+}
+
+/**
+ * Hash set iterator to stop watching directories within a removed one.
+ */
+static bool
+share_watch_remove_under(const void *key, void *data)
+{
+	const char *dir = data;
+
+	if (0 != strcmp(key, dir) && !share_path_is_under(key, dir))
+		return FALSE;
+
+	watcher_dir_remove(key);
+	atom_str_free(key);
+	return TRUE;
+}
+
+/**
+ * Hash set iterator to process removed directories.
+ */
+static void
+share_changed_dir_gone(const void *key, void *unused_data)
+{
+	(void) unused_data;
+
+	hset_foreach_remove(share_watched,
+		share_watch_remove_under, deconstify_pointer(key));
+}
+
+/**
+ * Compute the relative path of a directory to the shared directory
+ * holding it, when relative paths are to be exposed.
+ *
+ * @return string atom holding the relative path, NULL if none.
+ */
+static const char *
+share_changed_relative_path(const char *dir)
+{
+	const char *base = NULL;
+	pslist_t *sl;
+
+	if (!GNET_PROPERTY(search_results_expose_relative_paths))
+		return NULL;
+
+	PSLIST_FOREACH(shared_dirs, sl) {
+		const char *d = sl->data;
+
+		if (
+			(0 == strcmp(dir, d) || share_path_is_under(dir, d)) &&
+			(NULL == base || vstrlen(d) > vstrlen(base))
+		)
+			base = d;
+	}
+
+	return NULL == base ? NULL : get_relative_path(base, dir);
+}
+
+/**
+ * Renumber the partial files that were given an index, so that their
+ * indices follow the ones of the library, as the full rescan does.
+ */
+static void
+share_partials_reindex(void)
+{
+	hset_iter_t *iter;
+	const void *item;
+	uint64 idx = files_scanned();
+
+	hset_lock(partial_files);
+	iter = hset_iter_new(partial_files);
+
+	while (hset_iter_next(iter, &item)) {
+		shared_file_t *sf = deconstify_pointer(item);
+
+		if (0 != sf->file_index)
+			sf->file_index = ++idx;
+	}
+
+	hset_iter_release(&iter);
+	hset_unlock(partial_files);
+}
+
+/**
+ * Insert shared file in the table sorted by name.
+ *
+ * The table holds `n' slots, the last one being free.  The holes left by
+ * removed files are squeezed out first, so that the insertion point can be
+ * located by a binary search.
+ */
+static void
+share_library_sorted_insert(shared_file_t *sf, size_t n)
+{
+	shared_file_t **sorted = shared_libfile.sorted_file_table;
+	size_t i, m, lo, hi;
+
+	assert_shared_libfile_locked();
+
+	for (i = m = 0; i < n - 1; i++) {
+		if (sorted[i] != NULL)
+			sorted[m++] = sorted[i];
+	}
+
+	lo = 0;
+	hi = m;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (shared_file_sort_by_name(&sorted[mid], &sf) <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	memmove(&sorted[lo + 1], &sorted[lo], (m - lo) * sizeof sorted[0]);
+	sorted[lo] = sf;
+
+	for (i = 0; i <= m; i++)
+		sorted[i]->sort_index = i + 1;
+	for (i = m + 1; i < n; i++)
+		sorted[i] = NULL;
+}
+
+/**
+ * Append new shared file to the library tables.
+ */
+static void
+share_library_append(shared_file_t *sf)
+{
+	size_t n;
+	uint val;
+
+	shared_file_check(sf);
+
+	SHARED_LIBFILE_LOCK;
+
+	/*
+	 * As in a full rescan, the library files are indexed first and the
+	 * partial files come after them: the new file takes the next library
+	 * index and the partial files are renumbered below.
+	 */
+
+	n = shared_libfile.files_scanned + 1;
+
+	HREALLOC_ARRAY(shared_libfile.file_table, n);
+	HREALLOC_ARRAY(shared_libfile.sorted_file_table, n);
+	shared_libfile.file_table[n - 1] = sf;
+	sf->file_index = n;
+	share_library_sorted_insert(sf, n);
+	shared_libfile.files_scanned = n;
+	shared_libfile.bytes_scanned += sf->file_size;
+	shared_libfile.shared_files =
+		pslist_prepend(shared_libfile.shared_files, shared_file_ref(sf));
+
+	sf->flags |= SHARE_F_INDEXED | SHARE_F_BASENAME;
+
+	val = pointer_to_uint(
+		htable_lookup(shared_libfile.file_basenames, sf->name_nfc));
+	val = (val != 0) ? FILENAME_CLASH : sf->file_index;
+	htable_insert(shared_libfile.file_basenames, sf->name_nfc,
+		uint_to_pointer(val));
+
+	st_insert_item(shared_libfile.search_table,
+		ST_SET_PLAIN, sf->name_canonic, sf);
+	if (sf->name_normal != NULL) {
+		st_insert_item(shared_libfile.search_table,
+			ST_SET_ALIAS, sf->name_normal, sf);
+	}
+
+	SHARED_LIBFILE_UNLOCK;
+
+	share_partials_reindex();
+	upload_stats_enforce_local_filename(sf);
+}
+
+/**
+ * Add a new file to the library.
+ *
+ * @return TRUE if file was added.
+ */
+static bool
+share_changed_add(const char *path, bool qrp)
+{
+	filestat_t sb;
+	shared_file_t *sf;
+	const char *relative;
+	char *dir;
+
+	if (!share_changed_stat(path, &sb))
+		return FALSE;
+
+	dir = filepath_directory(path);
+	relative = NULL == dir ? NULL : share_changed_relative_path(dir);
+	sf = share_scan_add_file(relative, path, &sb);
+	atom_str_free_null(&relative);
+	HFREE_NULL(dir);
+
+	if (NULL == sf)
+		return FALSE;
+
+	share_library_append(sf);
+	request_sha1(sf);
+
+	if (qrp)
+		qrp_update_file(sf, TRUE);
+
+	return TRUE;
+}
+
+/**
+ * Apply recorded changes to the library.
+ */
+static void
+share_changed_apply(void)
+{
+	pslist_t *affected = NULL, *sl;
+	hset_t *kept;
+	hset_iter_t *iter;
+	const void *key;
+	uint added = 0, removed = 0;
+	bool qrp = qrp_can_update();
+	size_t i;
+
+	/*
+	 * Collect the library entries affected by the changes.
+	 */
+
+	SHARED_LIBFILE_LOCK;
+
+	for (i = 0; i < shared_libfile.files_scanned; i++) {
+		shared_file_t *sf = shared_libfile.file_table[i];
+
+		if (NULL == sf)
+			continue;
+
+		if (
+			hset_contains(share_changed, sf->file_path) ||
+			share_changed_in_gone_dir(sf->file_path)
+		)
+			affected = pslist_prepend(affected, shared_file_ref(sf));
+	}
+
+	SHARED_LIBFILE_UNLOCK;
+
+	/*
+	 * Entries for files that are still there and were not modified are kept,
+	 * the others are removed from the library.
+	 */
+
+	kept = hset_create(HASH_KEY_STRING, 0);
+
+	PSLIST_FOREACH(affected, sl) {
+		shared_file_t *sf = sl->data;
+		filestat_t sb;
+
+		if (
+			share_changed_stat(sf->file_path, &sb) &&
+			(filesize_t) sb.st_size == sf->file_size &&
+			sb.st_mtime == sf->mtime
+		) {
+			hset_insert(kept, sf->file_path);
+			continue;
+		}
+
+		if (GNET_PROPERTY(share_debug) > 1)
+			g_debug("SHARE removing \"%s\"", sf->file_path);
+
+		SHARED_LIBFILE_LOCK;
+		shared_libfile.bytes_scanned -= sf->file_size;
+		SHARED_LIBFILE_UNLOCK;
+
+		if (qrp)
+			qrp_update_file(sf, FALSE);
+
+		shared_file_remove(sf);
+		share_stale++;
+		removed++;
+	}
+
+	/*
+	 * All the remaining changed paths are new files.
+	 */
+
+	iter = hset_iter_new(share_changed);
+	while (hset_iter_next(iter, &key)) {
+		if (hset_contains(kept, key))
+			continue;
+		if (share_changed_add(key, qrp)) {
+			if (GNET_PROPERTY(share_debug) > 1)
+				g_debug("SHARE adding \"%s\"", (const char *) key);
+			added++;
+		}
+	}
+	hset_iter_release(&iter);
+
+	hset_free_null(&kept);
+	shared_file_slist_free_null(&affected);
+
+	if (0 == added + removed)
+		return;
+
+	if (GNET_PROPERTY(share_debug)) {
+		g_debug("SHARE incremental update: %u file%s added, %u removed",
+			PLURAL(added), removed);
+	}
+
+	/*
+	 * Removed entries are no longer indexed but still occupy a slot in the
+	 * library tables until the next full rescan: limit their proportion.
+	 */
+
+	if (share_stale * 4 > files_scanned())
+		share_changed_rescan = TRUE;
+
+	/*
+	 * The QRP table is updated incrementally when possible, otherwise
+	 * it is recomputed from the whole library.
+	 */
+
+	if (!qrp || !qrp_update_commit())
+		share_lib_qrp_rebuild(FALSE);
+
+	gcu_gui_update_files_scanned();
+	browse_host_library_changed();
+}
+
+/**
+ * Callout queue callback to process recorded library changes.
+ */
+static void
+share_changed_process(cqueue_t *cq, void *unused_obj)
+{
+	(void) unused_obj;
+
+	cq_zero(cq, &share_changed_ev);
+
+	/*
+	 * Wait for a running library rescan to complete: the changes recorded
+	 * meanwhile will be applied to the new library, which may already
+	 * include some of them.
+	 */
+
+	if (atomic_bool_get(&share_rebuilding)) {
+		share_changed_ev =
+			cq_main_insert(SHARE_WATCH_DELAY, share_changed_process, NULL);
+		return;
+	}
+
+	if (
+		NULL == shared_libfile.search_table ||
+		NULL == shared_libfile.file_basenames
+	)
+		share_changed_rescan = TRUE;
+
+	/*
+	 * Removed directories are processed first: a renamed directory is
+	 * reported as removed and then created, and keeps its kernel watch.
+	 */
+
+	if (!share_changed_rescan) {
+		hset_foreach(share_changed_gone, share_changed_dir_gone, NULL);
+
+		if (0 != hset_count(share_changed_new)) {
+			hset_iter_t *iter;
+			const void *key;
+			size_t count = 0;
+
+			iter = hset_iter_new(share_changed_new);
+			while (hset_iter_next(iter, &key)) {
+				share_changed_walk(key, 0, &count);
+			}
+			hset_iter_release(&iter);
+		}
+	}
+
+	if (!share_changed_rescan)
+		share_changed_apply();
+
+	if (share_changed_rescan) {
+		if (GNET_PROPERTY(share_debug))
+			g_debug("SHARE library changes require a full rescan");
+		share_scan();
+	}
+
+	share_changed_clear();
+}
+
+/**
+ * Initialize library change tracking.
+ */
+static void G_COLD
+share_watch_init(void)
+{
+	share_watched = hset_create(HASH_KEY_STRING, 0);
+	share_changed = hset_create(HASH_KEY_STRING, 0);
+	share_changed_new = hset_create(HASH_KEY_STRING, 0);
+	share_changed_gone = hset_create(HASH_KEY_STRING, 0);
+}
+
+/**
+ * Shutdown library change tracking.
+ */
+static void G_COLD
+share_watch_close(void)
+{
+	cq_cancel(&share_changed_ev);
+
+	hset_foreach_remove(share_watched, share_watch_remove_stale, NULL);
+	hset_free_null(&share_watched);
+
+	share_changed_clear();
+	hset_free_null(&share_changed);
+	hset_free_null(&share_changed_new);
+	hset_free_null(&share_changed_gone);
+}
+
 /**
  * Hash table iterator callback to free the value.
  */
@@ -3269,6 +4017,7 @@ share_close(void)
 	 * referring to OOB data that oob_close() is going to free up.
 	 */
 
+	share_watch_close();
 	share_special_close();
 	free_extensions();
 	pslist_foreach(shared_libfile.shared_files, shared_file_detach, NULL);
@@ -3718,6 +4467,33 @@ shared_file_relative_path(const shared_file_t *sf)
 			: NULL;
 }
 
+/**
+ * Get the pre-serialized query hit data attached to the shared file.
+ *
+ * @return the attached data, NULL if none.
+ */
+struct qhit_cache *
+shared_file_qhit_cache(const shared_file_t *sf)
+{
+	shared_file_check(sf);
+	return sf->qhit;
+}
+
+/**
+ * Attach pre-serialized query hit data to the shared file, disposing of
+ * any data previously attached.
+ */
+void
+shared_file_set_qhit_cache(shared_file_t *sf, struct qhit_cache *qc)
+{
+	shared_file_check(sf);
+
+	if (sf->qhit != qc) {
+		qhit_cache_free_null(&sf->qhit);
+		sf->qhit = qc;
+	}
+}
+
 /**
  * Get the pathname of a shared file.
  *
@@ -4181,6 +4957,7 @@ share_init(void)
 	oob_init();
 	oob_proxy_init();
 	share_special_init();
+	share_watch_init();
 
 	/*
 	 * We allocate an empty search_table, which will be de-allocated when we
@@ -139,6 +139,11 @@ const char *shared_file_name_canonic(const shared_file_t *sf) G_PURE;
 const char *shared_file_name_normalized(const shared_file_t *sf) G_PURE;
 bool shared_file_needs_aliasing(const shared_file_t *sf) G_PURE;
 const char *shared_file_relative_path(const shared_file_t *sf) G_PURE;
+
+struct qhit_cache;
+struct qhit_cache *shared_file_qhit_cache(const shared_file_t *sf);
+void shared_file_set_qhit_cache(shared_file_t *sf, struct qhit_cache *qc);
+
 size_t shared_file_name_nfc_len(const shared_file_t *sf) G_PURE;
 size_t shared_file_name_canonic_len(const shared_file_t *sf) G_PURE;
 size_t shared_file_name_normalized_len(const shared_file_t *sf) G_PURE;
@@ -80,6 +80,7 @@
 #include "lib/endian.h"
 #include "lib/entropy.h"
 #include "lib/fd.h"
+#include "lib/getcpucount.h"
 #include "lib/getline.h"
 #include "lib/gnet_host.h"
 #include "lib/halloc.h"
@@ -88,8 +89,11 @@
 #include "lib/once.h"
 #include "lib/pslist.h"
 #include "lib/random.h"
+#include "lib/reactor.h"
 #include "lib/str.h"
 #include "lib/stringify.h"
+#include "lib/teq.h"
+#include "lib/thread.h"
 #include "lib/timestamp.h"
 #include "lib/tm.h"
 #include "lib/unsigned.h"
@@ -135,6 +139,8 @@ static once_flag_t tls_ban_inited;
 static bool socket_is_shutdowning;	/**< Layer shutdown has started */
 static bool socket_shutdowned;		/**< Set when layer has been shutdowned */
 
+static void socket_udp_reactor_detach(gnutella_socket_t *s);
+
 static void socket_accept(void *data, int, inputevt_cond_t cond);
 static bool socket_reconnect(struct gnutella_socket *s);
 
@@ -1369,8 +1375,10 @@ socket_timer(time_t now)
 static inline void
 socket_disable(struct gnutella_socket *s)
 {
-	if (s != NULL)
+	if (s != NULL) {
+		socket_udp_reactor_detach(s);
 		socket_evt_clear(s);
+	}
 }
 
 /**
@@ -1425,6 +1433,7 @@ socket_closedown(void)
 	socket_free_null(&s_udp_listen);
 	socket_free_null(&s_udp_listen6);
 
+	reactor_stop();
 	aging_destroy(&tls_ban);
 }
 
@@ -1559,6 +1568,7 @@ socket_free(struct gnutella_socket *s)
 	if (s->flags & SOCK_F_UDP) {
 		struct udpctx *uctx = s->resource.udp;
 		if (uctx != NULL) {
+			socket_udp_reactor_detach(s);
 			WFREE_NULL(uctx->socket_addr, sizeof(socket_addr_t));
 			eslist_foreach(&uctx->queue, socket_udp_qfree, NULL);
 			cq_cancel(&uctx->queue_ev);
@@ -2837,35 +2847,36 @@ socket_udp_is_old(const gnutella_socket_t *s)
 }
 
 /**
- * Someone is sending us a datagram.  Read it into the socket's buffer.
+ * Read a datagram from an UDP socket.
  *
- * @param s				the socket which receives a datagram
+ * This routine only uses its arguments, hence it can be called from an
+ * I/O reactor thread.
+ *
+ * @param fd			the UDP socket file descriptor
+ * @param net			the network type of the socket
+ * @param buf			buffer where datagram is read
+ * @param size			size of buffer
+ * @param from_addr		written with the origin of the datagram
+ * @param dst_addr		written with the destination address, if known
+ * @param has_dst_addr	written with whether ``dst_addr'' was filled
  * @param truncation	written with whether datagram was truncated
  *
  * @return -1 on error, the size of the datagram otherwise.
  */
 static ssize_t
-socket_udp_accept(struct gnutella_socket *s, bool *truncation)
+socket_udp_recv(int fd, enum net_type net, void *buf, size_t size,
+	socket_addr_t *from_addr, host_addr_t *dst_addr, bool *has_dst_addr,
+	bool *truncation)
 {
-	socket_addr_t *from_addr;
 	struct sockaddr *from;
 	socklen_t from_len;
 	ssize_t r;
-	bool truncated = FALSE, has_dst_addr = FALSE;
-	host_addr_t dst_addr;
-
-	socket_check(s);
-	g_assert(s->flags & SOCK_F_UDP);
-	g_assert(s->type == SOCK_TYPE_UDP);
-
-	/*
-	 * Receive the datagram in the socket's buffer.
-	 */
+	bool truncated = FALSE;
 
-	from_addr = s->resource.udp->socket_addr;
+	*has_dst_addr = FALSE;
 
 	/* Initialize from_addr so that it matches the socket's network type. */
-	from_len = socket_addr_init(from_addr, s->net);
+	from_len = socket_addr_init(from_addr, net);
 	g_assert(from_len > 0);
 	g_assert(from_len == socket_addr_get_len(from_addr));
 
@@ -2885,7 +2896,7 @@ socket_udp_accept(struct gnutella_socket *s, bool *truncation)
 		struct msghdr msg;
 		iovec_t iov;
 
-		iovec_set(&iov, s->buf, s->buf_size);
+		iovec_set(&iov, buf, size);
 
 		msg = zero_msg;
 		msg.msg_name = cast_to_pointer(from);
@@ -2910,7 +2921,7 @@ socket_udp_accept(struct gnutella_socket *s, bool *truncation)
 		}
 #endif /* CMSG_LEN && CMSG_SPACE */
 
-		r = recvmsg(s->file_desc, &msg, 0);
+		r = recvmsg(fd, &msg, 0);
 
 		/* msg_flags is missing at least in some versions of IRIX. */
 #if defined(HAS_MSGHDR_MSG_FLAGS)
@@ -2918,18 +2929,87 @@ socket_udp_accept(struct gnutella_socket *s, bool *truncation)
 #endif
 
 		if ((ssize_t) -1 != r && !GNET_PROPERTY(force_local_ip)) {
-			has_dst_addr = socket_udp_extract_dst_addr(&msg, &dst_addr);
+			*has_dst_addr = socket_udp_extract_dst_addr(&msg, dst_addr);
 		}
 	}
 #else	/* !HAS_RECVMSG */
-	r = recvfrom(s->file_desc, s->buf, s->buf_size, 0,
-			cast_to_pointer(from), &from_len);
+	(void) dst_addr;
+	r = recvfrom(fd, buf, size, 0, cast_to_pointer(from), &from_len);
 #endif	/* HAS_RECVMSG */
 
 	if ((ssize_t) -1 == r)
 		return (ssize_t) -1;
 
-	g_assert((size_t) r <= s->buf_size);
+	g_assert((size_t) r <= size);
+
+	if (truncated)
+		gnet_stats_inc_general(GNR_UDP_RX_TRUNCATED);
+
+	*truncation = truncated;
+	return r;
+}
+
+/**
+ * Record the local address to which a datagram was sent.
+ *
+ * @param dst_addr		the destination address of the datagram
+ * @param from			the address of the sender
+ */
+static void
+socket_udp_dst_addr(host_addr_t dst_addr, host_addr_t from)
+{
+	static host_addr_t last_addr;
+
+	settings_addr_changed(dst_addr, from);
+
+	/*
+	 * Show the destination address only when it differs from
+	 * the last seen or if the debug level is higher than 1.
+	 */
+
+	if (
+		GNET_PROPERTY(socket_debug) > 1 ||
+		!host_addr_equiv(last_addr, dst_addr)
+	) {
+		last_addr = dst_addr;
+		if (GNET_PROPERTY(socket_debug)) {
+			g_debug("%s(): dst_addr=%s",
+				G_STRFUNC, host_addr_to_string(dst_addr));
+		}
+	}
+}
+
+/**
+ * Someone is sending us a datagram.  Read it into the socket's buffer.
+ *
+ * @param s				the socket which receives a datagram
+ * @param truncation	written with whether datagram was truncated
+ *
+ * @return -1 on error, the size of the datagram otherwise.
+ */
+static ssize_t
+socket_udp_accept(struct gnutella_socket *s, bool *truncation)
+{
+	socket_addr_t *from_addr;
+	ssize_t r;
+	bool has_dst_addr;
+	host_addr_t dst_addr;
+
+	socket_check(s);
+	g_assert(s->flags & SOCK_F_UDP);
+	g_assert(s->type == SOCK_TYPE_UDP);
+
+	/*
+	 * Receive the datagram in the socket's buffer.
+	 */
+
+	from_addr = s->resource.udp->socket_addr;
+
+	r = socket_udp_recv(s->file_desc, s->net, s->buf, s->buf_size,
+			from_addr, &dst_addr, &has_dst_addr, truncation);
+
+	if ((ssize_t) -1 == r)
+		return (ssize_t) -1;
 
 	/*
 	 * We're too low level to account for the proper bandwidth here as we
@@ -2954,32 +3034,9 @@ socket_udp_accept(struct gnutella_socket *s, bool *truncation)
 		return (ssize_t) -1;
 	}
 
-	if (has_dst_addr) {
-		static host_addr_t last_addr;
-
-		settings_addr_changed(dst_addr, s->addr);
-
-		/*
-		 * Show the destination address only when it differs from
-		 * the last seen or if the debug level is higher than 1.
-		 */
-
-		if (
-			GNET_PROPERTY(socket_debug) > 1 ||
-			!host_addr_equiv(last_addr, dst_addr)
-		) {
-			last_addr = dst_addr;
-			if (GNET_PROPERTY(socket_debug)) {
-				g_debug("%s(): dst_addr=%s",
-					G_STRFUNC, host_addr_to_string(dst_addr));
-			}
-		}
-	}
-
-	if (truncated)
-		gnet_stats_inc_general(GNR_UDP_RX_TRUNCATED);
+	if (has_dst_addr)
+		socket_udp_dst_addr(dst_addr, s->addr);
 
-	*truncation = truncated;
 	return r;
 }
 
@@ -3283,6 +3340,330 @@ socket_udp_event(void *data, int unused_source, inputevt_cond_t cond)
 	}
 }
 
+/*
+ * When I/O reactors run, UDP sockets are monitored by the reactor in charge
+ * of their file descriptor.  The reactor reads the datagrams off the kernel
+ * queue and hands them over in batches to the main thread, which processes
+ * them through the read-ahead queue of the socket.
+ *
+ * The reactor only uses the fields of the socket_reactor structure, never
+ * the socket itself, which remains owned by the main thread.
+ */
+
+#define SOCKET_REACTOR_BATCH	64	/**< Max datagrams read per I/O event */
+
+enum socket_reactor_magic { SOCKET_REACTOR_MAGIC = 0x1e3b50d9 };
+
+struct socket_reactor {
+	enum socket_reactor_magic magic;
+	gnutella_socket_t *s;		/**< The UDP socket (main thread only) */
+	int fd;						/**< Socket file descriptor */
+	enum net_type net;			/**< Network type of the socket */
+	unsigned id;				/**< Reactor thread ID */
+	unsigned event_id;			/**< I/O source, in the reactor */
+	int refcnt;					/**< Reference count */
+	bool closed;				/**< Socket was detached from reactor */
+	char *buf;					/**< Reception buffer, used by reactor */
+	size_t buf_size;			/**< Size of reception buffer */
+};
+
+static inline void
+socket_reactor_check(const struct socket_reactor * const sr)
+{
+	g_assert(sr != NULL);
+	g_assert(SOCKET_REACTOR_MAGIC == sr->magic);
+}
+
+/**
+ * A batch of datagrams read by a reactor.
+ */
+struct socket_reactor_batch {
+	struct socket_reactor *sr;	/**< The reactor context */
+	eslist_t queue;				/**< Datagrams read (struct udpq) */
+	host_addr_t dst_addr;		/**< Last destination address seen */
+	host_addr_t src_addr;		/**< Sender of datagram to dst_addr */
+	size_t bogus;				/**< Bytes from bogus origins */
+	bool has_dst_addr;			/**< Whether dst_addr was filled */
+};
+
+static bool socket_reactors_started;
+
+static void
+socket_reactor_unref(struct socket_reactor *sr)
+{
+	socket_reactor_check(sr);
+
+	if (atomic_int_dec_is_zero(&sr->refcnt)) {
+		HFREE_NULL(sr->buf);
+		sr->magic = 0;
+		WFREE(sr);
+	}
+}
+
+static void socket_reactor_udp_deliver(void *data);
+
+/**
+ * Reactor I/O callback: read pending datagrams and pass them to the
+ * main thread.
+ */
+static void
+socket_reactor_udp_event(void *data, int unused_source, inputevt_cond_t cond)
+{
+	struct socket_reactor *sr = data;
+	struct socket_reactor_batch *b;
+	unsigned i;
+
+	(void) unused_source;
+	socket_reactor_check(sr);
+
+	if G_UNLIKELY(cond & INPUT_EVENT_EXCEPTION)
+		return;		/* Will be reported by the main thread, if at all */
+
+	WALLOC0(b);
+	b->sr = sr;
+	eslist_init(&b->queue, offsetof(struct udpq, lnk));
+
+	for (i = 0; i < SOCKET_REACTOR_BATCH; i++) {
+		socket_addr_t from;
+		host_addr_t addr, dst_addr;
+		bool truncated, has_dst_addr;
+		struct udpq *uq;
+		ssize_t r;
+
+		r = socket_udp_recv(sr->fd, sr->net, sr->buf, sr->buf_size,
+				&from, &dst_addr, &has_dst_addr, &truncated);
+
+		if ((ssize_t) -1 == r) {
+			/* ECONNRESET is meaningless with UDP but happens on Windows */
+			if (!is_temporary_error(errno) && errno != ECONNRESET) {
+				s_warning("%s(): ignoring datagram reception error: %m",
+					G_STRFUNC);
+			}
+			break;
+		}
+
+		addr = socket_addr_get_addr(&from);
+
+		if G_UNLIKELY(!is_host_addr(addr)) {
+			gnet_stats_inc_general(GNR_UDP_BOGUS_SOURCE_IP);
+			b->bogus += r;
+			continue;
+		}
+
+		if G_UNLIKELY(0 == r) {
+			gnet_stats_inc_general(GNR_UDP_UNPROCESSED_MESSAGE);
+			continue;
+		}
+
+		if (has_dst_addr) {
+			b->dst_addr = dst_addr;
+			b->src_addr = addr;
+			b->has_dst_addr = TRUE;
+		}
+
+		WALLOC0(uq);
+		uq->buf = wcopy(sr->buf, r);
+		uq->len = r;
+		uq->queued = tm_time();
+		uq->truncated = booleanize(truncated);
+		uq->addr = addr;
+		uq->port = socket_addr_get_port(&from);
+
+		eslist_append(&b->queue, uq);
+	}
+
+	if (0 == eslist_count(&b->queue) && 0 == b->bogus) {
+		WFREE(b);
+		return;
+	}
+
+	atomic_int_inc(&sr->refcnt);
+	teq_safe_post(THREAD_MAIN_ID, socket_reactor_udp_deliver, b);
+}
+
+/**
+ * Main thread callback: process the datagrams read by a reactor.
+ */
+static void
+socket_reactor_udp_deliver(void *data)
+{
+	struct socket_reactor_batch *b = data;
+	struct socket_reactor *sr = b->sr;
+	gnutella_socket_t *s;
+
+	socket_reactor_check(sr);
+
+	s = sr->s;
+
+	if (atomic_bool_get(&sr->closed) || socket_shutdowned) {
+		eslist_foreach(&b->queue, socket_udp_qfree, NULL);
+		eslist_clear(&b->queue);
+	} else {
+		struct udpctx *uctx = s->resource.udp;
+		const struct udpq *uq;
+
+		if (b->bogus != 0)
+			bws_udp_count_read(b->bogus, FALSE);	/* Assume not from DHT */
+
+		if (b->has_dst_addr)
+			socket_udp_dst_addr(b->dst_addr, b->src_addr);
+
+		ESLIST_FOREACH_DATA(&b->queue, uq) {
+			uctx->queued = size_saturate_add(uctx->queued, uq->len);
+		}
+
+		eslist_append_list(&uctx->queue, &b->queue);
+		entropy_harvest_time();
+		socket_udp_flush_queue(s, MAX_UDP_LOOP_MS);
+	}
+
+	WFREE(b);
+	socket_reactor_unref(sr);
+}
+
+/**
+ * Reactor RPC: start monitoring the UDP socket.
+ */
+static void *
+socket_reactor_udp_add(void *data)
+{
+	struct socket_reactor *sr = data;
+
+	socket_reactor_check(sr);
+
+	sr->event_id = inputevt_add(sr->fd, INPUT_EVENT_R,
+		socket_reactor_udp_event, sr);
+
+	return NULL;
+}
+
+/**
+ * Reactor RPC: stop monitoring the UDP socket.
+ */
+static void *
+socket_reactor_udp_remove(void *data)
+{
+	struct socket_reactor *sr = data;
+
+	socket_reactor_check(sr);
+
+	inputevt_remove(&sr->event_id);
+
+	return NULL;
+}
+
+/**
+ * Hand UDP socket to the I/O reactor in charge of its file descriptor,
+ * if any.
+ */
+static void
+socket_udp_reactor_attach(gnutella_socket_t *s)
+{
+	struct socket_reactor *sr;
+	unsigned id;
+
+	socket_check(s);
+	g_assert(s->flags & SOCK_F_UDP);
+	g_assert(NULL == s->resource.udp->reactor);
+
+	/*
+	 * Reactors are launched on the first UDP socket creation, once the
+	 * properties have been loaded.
+	 *
+	 * A reactor only helps when it can run on another core than the main
+	 * thread, hence we launch at most one less than the amount of CPUs.
+	 */
+
+	if G_UNLIKELY(!socket_reactors_started) {
+		uint n = GNET_PROPERTY(io_reactors);
+		long cpus = getcpucount();
+
+		socket_reactors_started = TRUE;
+
+		if (n != 0 && cpus <= n) {
+			uint max = cpus > 1 ? cpus - 1 : 0;
+
+			if (GNET_PROPERTY(socket_debug)) {
+				g_debug("%s(): limiting I/O reactors to %u (%ld CPU%s)",
+					G_STRFUNC, max, PLURAL(cpus));
+			}
+			n = max;
+		}
+
+		if (n != 0) {
+			uint started = reactor_start(n);
+
+			g_info("started %u I/O reactor%s", PLURAL(started));
+		}
+	}
+
+	id = reactor_for_fd(s->file_desc);
+	if (THREAD_INVALID_ID == id)
+		return;
+
+	WALLOC0(sr);
+	sr->magic = SOCKET_REACTOR_MAGIC;
+	sr->s = s;
+	sr->fd = s->file_desc;
+	sr->net = s->net;
+	sr->id = id;
+	sr->refcnt = 1;
+	sr->buf_size = s->buf_size;
+	sr->buf = halloc(sr->buf_size);
+
+	/*
+	 * The socket stops being monitored by the main thread: the reactor
+	 * now reads the datagrams.  The source is installed synchronously so
+	 * that detaching can never miss it.
+	 */
+
+	socket_evt_clear(s);
+	s->resource.udp->reactor = sr;
+	teq_safe_rpc(id, socket_reactor_udp_add, sr);
+
+	if (GNET_PROPERTY(socket_debug)) {
+		g_debug("%s(): UDP port %u now read by %s",
+			G_STRFUNC, s->local_port, thread_id_name(id));
+	}
+}
+
+/**
+ * Take UDP socket back from its I/O reactor, if any.
+ *
+ * Datagrams already read by the reactor and not yet processed are dropped.
+ */
+static void
+socket_udp_reactor_detach(gnutella_socket_t *s)
+{
+	struct udpctx *uctx;
+	struct socket_reactor *sr;
+
+	socket_check(s);
+
+	if (!(s->flags & SOCK_F_UDP) || NULL == s->resource.udp)
+		return;
+
+	uctx = s->resource.udp;
+	sr = uctx->reactor;
+
+	if (NULL == sr)
+		return;
+
+	socket_reactor_check(sr);
+
+	/*
+	 * Remove the source synchronously, before the file descriptor can be
+	 * closed and reused.
+	 */
+
+	teq_safe_rpc(sr->id, socket_reactor_udp_remove, sr);
+
+	atomic_bool_set(&sr->closed, TRUE);
+	sr->s = NULL;
+	uctx->reactor = NULL;
+	socket_reactor_unref(sr);
+}
+
 static void
 socket_set_accept_filters(struct gnutella_socket *s)
 {
@@ -4424,6 +4805,7 @@ socket_udp_listen(host_addr_t bind_addr, uint16 port,
 
 	/* Ignore exceptions */
 	socket_evt_set(s, INPUT_EVENT_R, socket_udp_event, s);
+	socket_udp_reactor_attach(s);
 
 	/*
 	 * Enlarge the RX buffer on the UDP socket to avoid loosing incoming
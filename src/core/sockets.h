@@ -58,6 +58,7 @@ struct socket_tls_ctx {
 	bool				 	enabled;
 	enum socket_tls_stage	stage;
 	size_t snarf;			/**< Pending bytes if write failed temporarily. */
+	bool kernel_tx;			/**< Kernel encrypts sent records (kTLS) */
 
 	inputevt_cond_t			cb_cond;
 	inputevt_handler_t		cb_handler;
@@ -175,6 +176,7 @@ struct udpctx {
 	struct cevent *queue_ev;			/**< Queue processing event */
 	eslist_t queue;						/**< Queued items (read-ahead) */
 	size_t queued;						/**< Amount of bytes queued */
+	struct socket_reactor *reactor;		/**< Reactor reading datagrams */
 };
 
 static inline void
@@ -220,6 +222,12 @@ socket_uses_tls(const struct gnutella_socket *s)
 	return s->tls.enabled && s->tls.stage == SOCK_TLS_ESTABLISHED;
 }
 
+static inline bool
+socket_uses_kernel_tls(const struct gnutella_socket *s)
+{
+	return socket_uses_tls(s) && s->tls.kernel_tx;
+}
+
 static inline bool
 socket_is_corked(const struct gnutella_socket *s)
 {
@@ -29,10 +29,15 @@
  *
  * SHA-1 based spam filtering.
  *
+ * The name patterns are kept sorted by minimum size so that lookups only
+ * run the regular expressions of the entries whose size range can match.
+ * The whole database is also saved in a binary form in the configuration
+ * directory, which is used instead of spam.txt as long as it does not change.
+ *
  * @author Markus Goetz
  * @date 2003
  * @author Raphael Manfredi
- * @date 2004
+ * @date 2004, 2026
  * @author Christian Biere
  * @date 2006
  */
@@ -45,6 +50,7 @@
 
 #include "lib/atoms.h"
 #include "lib/bit_array.h"
+#include "lib/endian.h"
 #include "lib/file.h"
 #include "lib/getdate.h"
 #include "lib/halloc.h"
@@ -52,11 +58,13 @@
 #include "lib/parse.h"
 #include "lib/path.h"
 #include "lib/pslist.h"
+#include "lib/rwlock.h"
 #include "lib/str.h"
 #include "lib/tokenizer.h"
 #include "lib/utf8.h"
 #include "lib/walloc.h"
 #include "lib/watcher.h"
+#include "lib/xsort.h"
 
 #include "if/gnet_property.h"
 #include "if/gnet_property_priv.h"
@@ -65,6 +73,7 @@
 #include "lib/override.h"		/* Must be the last header included */
 
 static const char spam_text_file[] = "spam.txt";
+static const char spam_binary_file[] = "spam.bin";
 static const char spam_what[] = "Spam database";
 
 /****** BEGIN IDEAS ONLY ******/
@@ -114,11 +123,18 @@ static const char spam_what[] = "Spam database";
 /****** END IDEAS ONLY ******/
 
 struct spam_lut {
-	pslist_t *sl_names;	/* List of struct namesize_item */
+	struct namesize_item **names;	/* Sorted by increasing min_size */
+	size_t count;					/* Amount of names */
 };
 
 static struct spam_lut spam_lut;
 
+/*
+ * Query hits are classified by worker threads, so lookups may run concurrently
+ * with the reloading of the database, which happens in the main thread.
+ */
+static rwlock_t spam_lut_lock = RWLOCK_INIT;
+
 typedef enum {
 	SPAM_TAG_UNKNOWN = 0,
 	SPAM_TAG_ADDED,
@@ -152,12 +168,26 @@ spam_string_to_tag(const char *s)
 
 struct namesize_item {
 	regex_t		pattern;
+	char		*name;			/* The pattern source, for the binary form */
 	filesize_t	min_size;
 	filesize_t	max_size;
 };
 
+static void
+spam_namesize_free(struct namesize_item *item)
+{
+	regfree(&item->pattern);
+	HFREE_NULL(item->name);
+	WFREE(item);
+}
+
+/**
+ * Compile name pattern, prepending the new item to the supplied list.
+ *
+ * @return TRUE on error.
+ */
 static bool
-spam_add_name_and_size(const char *name,
+spam_add_name_and_size(pslist_t **names, const char *name,
 	filesize_t min_size, filesize_t max_size)
 {
 	struct namesize_item *item;
@@ -177,13 +207,197 @@ spam_add_name_and_size(const char *name,
 		WFREE(item);
 		return TRUE;
 	} else {
+		item->name = h_strdup(name);
 		item->min_size = min_size;
 		item->max_size = max_size;
-		spam_lut.sl_names = pslist_prepend(spam_lut.sl_names, item);
+		*names = pslist_prepend(*names, item);
 		return FALSE;
 	}
 }
 
+static int
+spam_namesize_cmp(const void *a, const void *b)
+{
+	const struct namesize_item * const *na = a, * const *nb = b;
+
+	return CMP((*na)->min_size, (*nb)->min_size);
+}
+
+/**
+ * Replace the name patterns with the supplied list, which is freed.
+ */
+static void
+spam_names_install(pslist_t *names)
+{
+	struct namesize_item **items = NULL, **old;
+	size_t i, count, old_count;
+	pslist_t *sl;
+
+	count = pslist_length(names);
+	if (count != 0)
+		HALLOC_ARRAY(items, count);
+
+	i = 0;
+	PSLIST_FOREACH(names, sl) {
+		items[i++] = sl->data;
+	}
+	pslist_free_null(&names);
+
+	if (count != 0)
+		xsort(items, count, sizeof items[0], spam_namesize_cmp);
+
+	rwlock_wlock(&spam_lut_lock);
+	old = spam_lut.names;
+	old_count = spam_lut.count;
+	spam_lut.names = items;
+	spam_lut.count = count;
+	rwlock_wunlock(&spam_lut_lock);
+
+	for (i = 0; i < old_count; i++)
+		spam_namesize_free(old[i]);
+	HFREE_NULL(old);
+}
+
+/**
+ * Save the spam database to the binary file being written.
+ *
+ * The name patterns come first, as a big-endian count followed by the
+ * minimum and maximum sizes and the length of each pattern, then the
+ * pattern itself.  The SHA-1 list follows.
+ *
+ * @return TRUE on success.
+ */
+static bool
+spam_store(FILE *f)
+{
+	char buf[8];
+	size_t i;
+
+	poke_be32(buf, spam_lut.count);
+	if (1 != fwrite(buf, 4, 1, f))
+		return FALSE;
+
+	for (i = 0; i < spam_lut.count; i++) {
+		const struct namesize_item *item = spam_lut.names[i];
+		size_t len = vstrlen(item->name);
+
+		poke_be64(buf, item->min_size);
+		fwrite(buf, 8, 1, f);
+		poke_be64(buf, item->max_size);
+		fwrite(buf, 8, 1, f);
+		poke_be32(buf, len);
+		fwrite(buf, 4, 1, f);
+		if (1 != fwrite(item->name, len, 1, f))
+			return FALSE;
+	}
+
+	return spam_sha1_store(SPAM_LIST_SPAM, f);
+}
+
+/**
+ * Restore the spam database from the payload of the binary file.
+ *
+ * @return the amount of entries loaded, (ulong) -1 if data is invalid.
+ */
+static ulong
+spam_restore(const char *data, size_t len)
+{
+	const char *p = data, *end = &data[len];
+	pslist_t *names = NULL;
+	size_t i, count;
+
+	if (len < 4)
+		return (ulong) -1;
+
+	count = peek_be32(p);
+	p += 4;
+
+	for (i = 0; i < count; i++) {
+		filesize_t min_size, max_size;
+		char *name;
+		size_t n;
+		bool failed;
+
+		if (ptr_diff(end, p) < 20)
+			goto failed;
+
+		min_size = peek_be64(p);
+		max_size = peek_be64(&p[8]);
+		n = peek_be32(&p[16]);
+		p += 20;
+
+		if (n > ptr_diff(end, p) || min_size > max_size)
+			goto failed;
+
+		name = h_strndup(p, n);
+		failed = spam_add_name_and_size(&names, name, min_size, max_size);
+		hfree(name);
+		p += n;
+
+		if (failed)
+			goto failed;
+	}
+
+	if (0 == spam_sha1_restore(SPAM_LIST_SPAM, p, ptr_diff(end, p)))
+		goto failed;
+
+	spam_names_install(names);
+
+	return count + spam_sha1_count(SPAM_LIST_SPAM);
+
+failed:
+	{
+		pslist_t *sl;
+
+		PSLIST_FOREACH(names, sl) {
+			spam_namesize_free(sl->data);
+		}
+		pslist_free_null(&names);
+	}
+
+	return (ulong) -1;
+}
+
+/**
+ * Save the spam database in binary form.
+ */
+static void
+spam_save(const char *source, FILE *src)
+{
+	file_path_t fp;
+	FILE *f;
+
+	f = spam_sha1_binary_create(&fp, spam_binary_file, source, src);
+	if (f != NULL) {
+		if (!spam_store(f))
+			g_warning("%s(): cannot write %s: %m", G_STRFUNC, fp.name);
+		file_config_close(f, &fp);
+	}
+}
+
+/**
+ * Load spam database from its binary form, if up-to-date.
+ *
+ * @return the amount of entries loaded, (ulong) -1 if not loaded.
+ */
+static ulong
+spam_load_binary(const char *source, FILE *src)
+{
+	struct spam_binary sb;
+	ulong count;
+
+	if (!spam_sha1_binary_open(&sb, spam_binary_file, source, src))
+		return (ulong) -1;
+
+	count = spam_restore(sb.data, sb.len);
+	spam_sha1_binary_close(&sb);
+
+	if ((ulong) -1 == count)
+		g_warning("%s(): ignoring invalid %s", G_STRFUNC, spam_binary_file);
+
+	return count;
+}
+
 struct spam_item {
 	struct sha1 sha1;
 	char		*name;
@@ -203,10 +417,13 @@ struct spam_item {
  * ADDED <date>
  * END
  *
+ * @param f			the opened file
+ * @param source	the pathname of the file
+ *
  * @returns the amount of entries loaded or -1 on failure.
  */
 static ulong G_COLD
-spam_load(FILE *f)
+spam_load(FILE *f, const char *source)
 {
 	static const struct spam_item zero_item;
 	struct spam_item item;
@@ -214,9 +431,16 @@ spam_load(FILE *f)
 	uint line_no = 0;
 	bit_array_t tag_used[BIT_ARRAY_SIZE(NUM_SPAM_TAGS)];
 	ulong item_count = 0;
+	pslist_t *names = NULL;
 
 	g_assert(f);
 
+	item_count = spam_load_binary(source, f);
+	if (item_count != (ulong) -1)
+		return item_count;
+
+	item_count = 0;
+
 	/* Reset state */
 	item = zero_item;
 	bit_array_init(tag_used, NUM_SPAM_TAGS);
@@ -365,7 +589,7 @@ spam_load(FILE *f)
 
 		if (item.done && !item.damaged) {
 			if (bit_array_get(tag_used, SPAM_TAG_SHA1)) {
-				spam_sha1_add(&item.sha1);
+				spam_sha1_add(SPAM_LIST_SPAM, &item.sha1);
 				item_count++;
 			}
 			if (bit_array_get(tag_used, SPAM_TAG_NAME)) {
@@ -374,7 +598,7 @@ spam_load(FILE *f)
 					item.max_size = MAX_INT_VAL(filesize_t);
 				}
 				if (
-					spam_add_name_and_size(item.name,
+					spam_add_name_and_size(&names, item.name,
 						item.min_size, item.max_size)
 				) {
 					item.damaged = TRUE;
@@ -398,7 +622,9 @@ spam_load(FILE *f)
 		}
 	}
 
-	spam_sha1_sync();
+	spam_names_install(names);
+	spam_sha1_sync(SPAM_LIST_SPAM);
+	spam_save(source, f);
 
 	return item_count;
 }
@@ -419,8 +645,7 @@ spam_changed(const char *filename, void *unused_udata)
 		char buf[80];
 		ulong count;
 
-		spam_close();
-		count = spam_load(f);
+		count = spam_load(f, filename);
 		fclose(f);
 
 		str_bprintf(ARYLEN(buf), "Reloaded %lu spam items.", count);
@@ -439,8 +664,8 @@ spam_retrieve_from_file(FILE *f, const char *path, const char *filename)
 
 	pathname = make_pathname(path, filename);
 	watcher_register(pathname, spam_changed, NULL);
+	spam_load(f, pathname);
 	HFREE_NULL(pathname);
-	spam_load(f);
 }
 
 /**
@@ -486,16 +711,7 @@ spam_init(void)
 void
 spam_close(void)
 {
-	pslist_t *sl;
-
-	PSLIST_FOREACH(spam_lut.sl_names, sl) {
-		struct namesize_item *item = sl->data;
-
-		g_assert(item);
-		regfree(&item->pattern);
-		WFREE(item);
-	}
-	pslist_free_null(&spam_lut.sl_names);
+	spam_names_install(NULL);
 	spam_sha1_close();
 }
 
@@ -508,23 +724,45 @@ spam_close(void)
 bool
 spam_check_filename_size(const char *filename, filesize_t size)
 {
-	const pslist_t *sl;
+	bool found = FALSE;
+	size_t i, lo, hi;
 
 	g_return_val_if_fail(filename, FALSE);
 
-	PSLIST_FOREACH(spam_lut.sl_names, sl) {
-		const struct namesize_item *item = sl->data;
+	rwlock_rlock(&spam_lut_lock);
+
+	/*
+	 * Only the leading entries whose minimum size is not above the file
+	 * size can match: locate the first one that is above.
+	 */
+
+	lo = 0;
+	hi = spam_lut.count;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (spam_lut.names[mid]->min_size <= size)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (i = 0; i < lo; i++) {
+		const struct namesize_item *item = spam_lut.names[i];
 
-		g_assert(item);
 		if (
-			size >= item->min_size &&
 			size <= item->max_size &&
 			0 == regexec(&item->pattern, filename, 0, NULL, 0)
 		) {
-			return TRUE;
+			found = TRUE;
+			break;
 		}
 	}
-	return FALSE;
+
+	rwlock_runlock(&spam_lut_lock);
+
+	return found;
 }
 
 /* vi: set ts=4 sw=4 cindent: */
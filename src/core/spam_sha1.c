@@ -29,10 +29,18 @@
  *
  * SHA-1 based spam filtering.
  *
+ * Each spam list (spam_sha1.txt and the SHA1 entries of spam.txt) is loaded
+ * into its own immutable digest set, which is replaced as a whole when the
+ * list is reloaded.
+ *
+ * Since parsing large lists is costly, the loaded lists are also saved in a
+ * binary form in the configuration directory, which is used instead of the
+ * text file as long as the latter does not change.
+ *
  * @author Markus Goetz
  * @date 2003
  * @author Raphael Manfredi
- * @date 2004
+ * @date 2004, 2026
  * @author Christian Biere
  * @date 2007
  */
@@ -45,12 +53,16 @@
 
 #include "lib/ascii.h"
 #include "lib/atoms.h"
-#include "lib/dbmw.h"
+#include "lib/digestset.h"
+#include "lib/endian.h"
+#include "lib/fd.h"
 #include "lib/file.h"
 #include "lib/halloc.h"
 #include "lib/path.h"
-#include "lib/sorted_array.h"
+#include "lib/rwlock.h"
 #include "lib/str.h"
+#include "lib/stringify.h"
+#include "lib/vmm.h"
 #include "lib/watcher.h"
 
 #include "if/gnet_property.h"
@@ -60,119 +72,352 @@
 
 #include "lib/override.h"		/* Must be the last header included */
 
-#define SPAM_DB_LOAD_CACHESIZE	32768	/* Large to do it mostly in RAM */
-#define SPAM_DB_RUN_CACHESIZE	128		/* During operations, less demanding */
-#define SPAM_DBMW_CACHESIZE		1024	/* DB wrapper cache size */
-
 static const char spam_sha1_file[] = "spam_sha1.txt";
+static const char spam_sha1_binary_file[] = "spam_sha1.bin";
 static const char spam_sha1_what[] = "Spam SHA-1 database";
-static char db_spambase[] = "spam_sha1";
 
-enum spam_state {
-	SPAM_UNINITIALIZED = 0,
-	SPAM_LOADING = 1,
-	SPAM_LOADED
-};
+/*
+ * Binary spam files start with a header made of the magic, the version,
+ * the modification time and the size of the text source, the length of the
+ * source path and reserved bytes, all in big-endian.  The source path follows,
+ * padded to a multiple of 8 bytes, then comes the payload.
+ */
+#define SPAM_BINARY_MAGIC	"SPMB"
+#define SPAM_BINARY_VERSION	1
+#define SPAM_BINARY_HEADER	32
 
-struct sha1_lut {
-	struct sorted_array *tab;
-	enum spam_state state;
-	union {
-		dbmw_t *dw;
-		dbmap_t *dm;
-	} d;
+/**
+ * A SHA-1 spam list.
+ */
+struct spam_sha1_list {
+	struct sha1 *pending;		/**< SHA-1s being loaded */
+	size_t count;				/**< Amount of pending SHA-1s */
+	size_t capacity;			/**< Allocated pending SHA-1s */
+	digestset_t *set;			/**< The loaded list, NULL if none */
 };
 
-static struct sha1_lut sha1_lut;
+static struct spam_sha1_list spam_sha1_lists[SPAM_LIST_COUNT];
 
-static inline G_PURE int
-sha1_cmp_func(const void *a, const void *b)
+/*
+ * Lookups are issued by the query hit decoding workers, concurrently with
+ * the (re)loading of the lists in the main thread.
+ */
+static rwlock_t sha1_lut_lock = RWLOCK_INIT;
+
+static inline struct spam_sha1_list *
+spam_sha1_list(enum spam_list which)
 {
-	return sha1_cmp(a, b);
+	g_assert(UNSIGNED(which) < SPAM_LIST_COUNT);
+
+	return &spam_sha1_lists[which];
 }
 
 /**
- * Initialize SPAM lookup up table.
+ * Install new set for the list, freeing the previous one.
  */
 static void
-spam_lut_create(void)
+spam_sha1_install(enum spam_list which, digestset_t *ds)
 {
-	if (GNET_PROPERTY(spam_lut_in_memory)) {
-		sha1_lut.tab = sorted_array_new(sizeof(struct sha1), sha1_cmp_func);
-	} else {
-		dbmap_t *dm;
-		char *path;
-
-		path = make_pathname(settings_gnet_db_dir(), db_spambase);
-		dm = dbmap_create_sdbm(SHA1_RAW_SIZE, NULL, spam_sha1_what, path,
-			O_CREAT | O_TRUNC | O_RDWR, S_IRUSR | S_IWUSR);
-		HFREE_NULL(path);
-
-		if (NULL == dm) {
-			if (GNET_PROPERTY(spam_debug))
-				g_warning("unable to create SDBM database for %s: %m",
-					db_spambase);
-			sha1_lut.tab = sorted_array_new(sizeof(struct sha1), sha1_cmp_func);
-		} else {
-			/*
-			 * During loading we use the dbmap directly, not the wrapper
-			 * since we don't care about that high-level cache layer which
-			 * is going to slow us down needlessly.
-			 */
+	struct spam_sha1_list *sl = spam_sha1_list(which);
+	digestset_t *old;
 
-			dbmap_set_volatile(dm, TRUE);
-			dbmap_set_cachesize(dm, SPAM_DB_LOAD_CACHESIZE);
-			sha1_lut.d.dm = dm;
-		}
-	}
+	rwlock_wlock(&sha1_lut_lock);
+	old = sl->set;
+	sl->set = ds;
+	rwlock_wunlock(&sha1_lut_lock);
+
+	digestset_free_null(&old);
 }
 
+/**
+ * Record SHA-1 for the list being loaded.
+ *
+ * The SHA-1 is only visible to lookups after spam_sha1_sync() is called.
+ */
 void
-spam_sha1_add(const struct sha1 *sha1)
+spam_sha1_add(enum spam_list which, const struct sha1 *sha1)
 {
-	g_assert(sha1_lut.state != SPAM_UNINITIALIZED);
+	struct spam_sha1_list *sl = spam_sha1_list(which);
+
 	g_return_if_fail(sha1);
 
-	if (sha1_lut.tab)
-		sorted_array_add(sha1_lut.tab, sha1);
-	else {
-		if (SPAM_LOADING == sha1_lut.state) {
-			dbmap_datum_t val = { NULL, 0 };
-			dbmap_insert(sha1_lut.d.dm, sha1, val);
-		} else {
-			dbmw_write(sha1_lut.d.dw, sha1, NULL, 0);
-		}
+	if (sl->count >= sl->capacity) {
+		sl->capacity = MAX(1024, sl->capacity * 2);
+		HREALLOC_ARRAY(sl->pending, sl->capacity);
+	}
+
+	sl->pending[sl->count++] = *sha1;
+}
+
+/**
+ * Replace the list with the SHA-1s added since the last synchronization.
+ */
+void
+spam_sha1_sync(enum spam_list which)
+{
+	struct spam_sha1_list *sl = spam_sha1_list(which);
+	digestset_t *ds;
+
+	ds = digestset_create(sl->pending, sl->count, SHA1_RAW_SIZE);
+
+	if (digestset_count(ds) != sl->count) {
+		g_warning("%s(): removed %zu duplicate SHA-1%s", G_STRFUNC,
+			PLURAL(sl->count - digestset_count(ds)));
 	}
+
+	HFREE_NULL(sl->pending);
+	sl->count = sl->capacity = 0;
+
+	spam_sha1_install(which, ds);
+}
+
+/**
+ * @return amount of SHA-1s in the list.
+ */
+size_t
+spam_sha1_count(enum spam_list which)
+{
+	struct spam_sha1_list *sl = spam_sha1_list(which);
+	size_t count;
+
+	rwlock_rlock(&sha1_lut_lock);
+	count = NULL == sl->set ? 0 : digestset_count(sl->set);
+	rwlock_runlock(&sha1_lut_lock);
+
+	return count;
+}
+
+/**
+ * Save the list to the binary file being written.
+ *
+ * @return TRUE on success.
+ */
+bool
+spam_sha1_store(enum spam_list which, FILE *f)
+{
+	struct spam_sha1_list *sl = spam_sha1_list(which);
+	digestset_t *empty = NULL;
+	bool ok;
+
+	/*
+	 * Only the main thread changes the lists, hence no locking here.
+	 */
+
+	if (NULL == sl->set)
+		empty = digestset_create(NULL, 0, SHA1_RAW_SIZE);
+
+	ok = digestset_write(NULL == empty ? sl->set : empty, f);
+	digestset_free_null(&empty);
+
+	return ok;
+}
+
+/**
+ * Restore the list from the payload of a binary file.
+ *
+ * @return the amount of bytes used, 0 if the data is invalid.
+ */
+size_t
+spam_sha1_restore(enum spam_list which, const void *data, size_t len)
+{
+	digestset_t *ds;
+	size_t size;
+
+	ds = digestset_open(data, len, SHA1_RAW_SIZE);
+	if (NULL == ds)
+		return 0;
+
+	size = digestset_image_size(ds);
+	spam_sha1_install(which, ds);
+
+	return size;
 }
 
-static int
-sha1_collision(const void *a, const void *b)
+/**
+ * Open the binary file compiled from the text source.
+ *
+ * @param sb		filled with the mapped binary file on success
+ * @param name		the binary file name, in the configuration directory
+ * @param source	the pathname of the text source
+ * @param src		the opened text source
+ *
+ * @return TRUE if the binary file was compiled from the current source.
+ */
+bool
+spam_sha1_binary_open(struct spam_binary *sb,
+	const char *name, const char *source, FILE *src)
 {
-	(void) a;
-	g_warning("spam_sha1_sync(): removing duplicate SHA-1 %s", sha1_base32(b));
-	return 1;
+	filestat_t st, bst;
+	const char *p;
+	size_t size, plen, off;
+	bool ok = FALSE;
+	char *path;
+	int fd;
+
+	ZERO(sb);
+
+	if (-1 == fstat(fileno(src), &st))
+		return FALSE;
+
+	path = make_pathname(settings_config_dir(), name);
+	fd = file_open_missing(path, O_RDONLY);
+	HFREE_NULL(path);
+
+	if (-1 == fd)
+		return FALSE;
+
+	if (
+		-1 == fstat(fd, &bst) || !S_ISREG(bst.st_mode) ||
+		bst.st_size < SPAM_BINARY_HEADER ||
+		UNSIGNED(bst.st_size) >= MAX_INT_VAL(uint32)
+	)
+		goto done;
+
+	size = bst.st_size;
+
+#ifdef HAS_MMAP
+	p = vmm_mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (MAP_FAILED == p)
+		goto done;
+#else
+	p = halloc(size);
+	if (size != UNSIGNED(read(fd, deconstify_pointer(p), size))) {
+		hfree(deconstify_pointer(p));
+		goto done;
+	}
+#endif	/* HAS_MMAP */
+
+	sb->map = deconstify_pointer(p);
+	sb->size = size;
+
+	plen = peek_be32(&p[24]);
+	off = SPAM_BINARY_HEADER + round_size(8, plen);
+
+	if (
+		0 != memcmp(p, SPAM_BINARY_MAGIC, 4) ||
+		SPAM_BINARY_VERSION != peek_be32(&p[4]) ||
+		peek_be64(&p[8]) != (uint64) st.st_mtime ||
+		peek_be64(&p[16]) != (uint64) st.st_size ||
+		plen != vstrlen(source) || off > size ||
+		0 != memcmp(&p[SPAM_BINARY_HEADER], source, plen)
+	) {
+		spam_sha1_binary_close(sb);
+		goto done;
+	}
+
+	sb->data = &p[off];
+	sb->len = size - off;
+	ok = TRUE;
+
+	/* FALL THROUGH */
+
+done:
+	fd_forget_and_close(&fd);
+	return ok;
 }
 
+/**
+ * Release binary file opened by spam_sha1_binary_open().
+ */
 void
-spam_sha1_sync(void)
+spam_sha1_binary_close(struct spam_binary *sb)
 {
-	if (sha1_lut.tab) {
-		sorted_array_sync(sha1_lut.tab, sha1_collision);
-	} else if (SPAM_LOADING == sha1_lut.state) {
-		dbmap_t *dm = sha1_lut.d.dm;
+	if (sb->map != NULL) {
+#ifdef HAS_MMAP
+		vmm_munmap(sb->map, sb->size);
+#else
+		hfree(sb->map);
+#endif	/* HAS_MMAP */
+	}
 
-		/*
-		 * Now that loading is finished, we can wrap the dbmap to use some
-		 * amount of high-level caching, and therefore reduce the amount
-		 * of low-level caching done.
-		 */
+	ZERO(sb);
+}
+
+/**
+ * Create binary file compiled from the text source.
+ *
+ * The caller must write the payload and then call file_config_close().
+ *
+ * @param fp		filled with the binary file location
+ * @param name		the binary file name, in the configuration directory
+ * @param source	the pathname of the text source
+ * @param src		the opened text source
+ *
+ * @return the file to write the payload to, NULL on error.
+ */
+FILE *
+spam_sha1_binary_create(file_path_t *fp,
+	const char *name, const char *source, FILE *src)
+{
+	char header[SPAM_BINARY_HEADER];
+	static const char zero[8];
+	size_t plen = vstrlen(source);
+	filestat_t st;
+	FILE *f;
+
+	if (-1 == fstat(fileno(src), &st))
+		return NULL;
+
+	file_path_set(fp, settings_config_dir(), name);
+	f = file_config_open_write(name, fp);
+	if (NULL == f)
+		return NULL;
+
+	ZERO(&header);
+	memcpy(header, SPAM_BINARY_MAGIC, 4);
+	poke_be32(&header[4], SPAM_BINARY_VERSION);
+	poke_be64(&header[8], st.st_mtime);
+	poke_be64(&header[16], st.st_size);
+	poke_be32(&header[24], plen);
+
+	fwrite(header, sizeof header, 1, f);
+	fwrite(source, plen, 1, f);
+	fwrite(zero, round_size(8, plen) - plen, 1, f);
+
+	return f;
+}
+
+/**
+ * Save the spam_sha1.txt list in binary form.
+ */
+static void
+spam_sha1_save(const char *source, FILE *src)
+{
+	file_path_t fp;
+	FILE *f;
+
+	f = spam_sha1_binary_create(&fp, spam_sha1_binary_file, source, src);
+	if (f != NULL) {
+		if (!spam_sha1_store(SPAM_LIST_SHA1, f))
+			g_warning("%s(): cannot write %s: %m", G_STRFUNC, fp.name);
+		file_config_close(f, &fp);
+	}
+}
+
+/**
+ * Load spam_sha1.txt list from its binary form, if up-to-date.
+ *
+ * @return TRUE if list was loaded.
+ */
+static bool
+spam_sha1_load_binary(const char *source, FILE *src)
+{
+	struct spam_binary sb;
+	size_t used;
+
+	if (!spam_sha1_binary_open(&sb, spam_sha1_binary_file, source, src))
+		return FALSE;
 
-		dbmap_set_cachesize(dm, SPAM_DB_RUN_CACHESIZE);
-		sha1_lut.d.dw = dbmw_create(dm, spam_sha1_what,
-			0, 0,
-			NULL, NULL, NULL,
-			SPAM_DBMW_CACHESIZE, sha1_hash, sha1_eq);
+	used = spam_sha1_restore(SPAM_LIST_SHA1, sb.data, sb.len);
+	spam_sha1_binary_close(&sb);
+
+	if (0 == used) {
+		g_warning("%s(): ignoring invalid %s", G_STRFUNC,
+			spam_sha1_binary_file);
+		return FALSE;
 	}
+
+	return TRUE;
 }
 
 /**
@@ -185,10 +430,13 @@ spam_sha1_sync(void)
  * <SHA1 #2>
  * etc...
  *
+ * @param f			the opened file
+ * @param source	the pathname of the file
+ *
  * @returns the amount of entries loaded or -1 on failure.
  */
 static ulong G_COLD
-spam_sha1_load(FILE *f)
+spam_sha1_load(FILE *f, const char *source)
 {
 	char line[1024];
 	uint line_no = 0;
@@ -196,8 +444,10 @@ spam_sha1_load(FILE *f)
 
 	g_assert(f);
 
-	spam_lut_create();
-	sha1_lut.state = SPAM_LOADING;
+	if (spam_sha1_load_binary(source, f)) {
+		item_count = spam_sha1_count(SPAM_LIST_SHA1);
+		goto done;
+	}
 
 	while (fgets(ARYLEN(line), f)) {
 		const struct sha1 *sha1;
@@ -242,13 +492,16 @@ spam_sha1_load(FILE *f)
 				G_STRFUNC, line_no);
 			continue;
 		}
-		spam_sha1_add(sha1);
+		spam_sha1_add(SPAM_LIST_SHA1, sha1);
 		item_count++;
 	}
 
-	spam_sha1_sync();
-	sha1_lut.state = SPAM_LOADED;
+	spam_sha1_sync(SPAM_LIST_SHA1);
+	spam_sha1_save(source, f);
 
+	/* FALL THROUGH */
+
+done:
 	if (GNET_PROPERTY(spam_debug))
 		g_debug("loaded %lu SPAM SHA-1 keys", item_count);
 
@@ -271,8 +524,7 @@ spam_sha1_changed(const char *filename, void *unused_udata)
 		char buf[80];
 		ulong count;
 
-		spam_sha1_close();
-		count = spam_sha1_load(f);
+		count = spam_sha1_load(f, filename);
 		fclose(f);
 
 		str_bprintf(ARYLEN(buf), "Reloaded %lu spam SHA-1 items.", count);
@@ -291,8 +543,8 @@ spam_sha1_retrieve_from_file(FILE *f, const char *path, const char *filename)
 
 	pathname = make_pathname(path, filename);
 	watcher_register(pathname, spam_sha1_changed, NULL);
+	spam_sha1_load(f, pathname);
 	HFREE_NULL(pathname);
-	spam_sha1_load(f);
 }
 
 /**
@@ -335,13 +587,15 @@ spam_sha1_init(void)
 void
 spam_sha1_close(void)
 {
-	sorted_array_free(&sha1_lut.tab);
-	if (sha1_lut.d.dw) {
-		dbmw_destroy(sha1_lut.d.dw, TRUE);
-		sha1_lut.d.dw = NULL;
-	}
+	uint i;
 
-	sha1_lut.state = SPAM_UNINITIALIZED;
+	for (i = 0; i < SPAM_LIST_COUNT; i++) {
+		struct spam_sha1_list *sl = &spam_sha1_lists[i];
+
+		spam_sha1_install(i, NULL);
+		HFREE_NULL(sl->pending);
+		sl->count = sl->capacity = 0;
+	}
 }
 
 /**
@@ -353,14 +607,23 @@ spam_sha1_close(void)
 bool
 spam_sha1_check(const struct sha1 *sha1)
 {
+	bool found = FALSE;
+	uint i;
+
 	g_return_val_if_fail(sha1, FALSE);
-	if (sha1_lut.tab)
-		return NULL != sorted_array_lookup(sha1_lut.tab, sha1);
 
-	if (sha1_lut.d.dw)
-		return dbmw_exists(sha1_lut.d.dw, sha1);
+	rwlock_rlock(&sha1_lut_lock);
+
+	for (i = 0; i < SPAM_LIST_COUNT && !found; i++) {
+		const digestset_t *ds = spam_sha1_lists[i].set;
+
+		if (ds != NULL)
+			found = digestset_contains(ds, sha1);
+	}
+
+	rwlock_runlock(&sha1_lut_lock);
 
-	return FALSE;
+	return found;
 }
 
 /* vi: set ts=4 sw=4 cindent: */
@@ -29,6 +29,8 @@
  *
  * @author Christian Biere
  * @date 2007
+ * @author Raphael Manfredi
+ * @date 2026
  */
 
 #ifndef _core_spam_sha1_h_
@@ -36,14 +38,45 @@
 
 #include "common.h"
 
+#include "lib/file.h"
+
 struct sha1;
 
+/**
+ * The spam lists holding SHA-1s, each loaded from its own file.
+ */
+enum spam_list {
+	SPAM_LIST_SHA1 = 0,		/**< Loaded from spam_sha1.txt */
+	SPAM_LIST_SPAM,			/**< Loaded from spam.txt */
+
+	SPAM_LIST_COUNT
+};
+
+/**
+ * A binary spam file, precompiled from its text source.
+ */
+struct spam_binary {
+	void *map;				/**< The mapped file */
+	size_t size;			/**< Size of the mapped file */
+	const char *data;		/**< Start of the payload */
+	size_t len;				/**< Length of the payload */
+};
+
 bool spam_sha1_check(const struct sha1 *sha1);
-void spam_sha1_add(const struct sha1 *sha1);
-void spam_sha1_sync(void);
+void spam_sha1_add(enum spam_list which, const struct sha1 *sha1);
+void spam_sha1_sync(enum spam_list which);
+size_t spam_sha1_count(enum spam_list which);
+bool spam_sha1_store(enum spam_list which, FILE *f);
+size_t spam_sha1_restore(enum spam_list which, const void *data, size_t len);
 void spam_sha1_init(void);
 void spam_sha1_close(void);
 
+bool spam_sha1_binary_open(struct spam_binary *sb,
+	const char *name, const char *source, FILE *src);
+void spam_sha1_binary_close(struct spam_binary *sb);
+FILE *spam_sha1_binary_create(file_path_t *fp,
+	const char *name, const char *source, FILE *src);
+
 #endif /* _core_spam_sha1_h_ */
 
 /* vi: set ts=4 sw=4 cindent: */
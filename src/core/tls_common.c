@@ -60,6 +60,23 @@
 #define USE_TLS_PUSHV
 #endif
 
+/*
+ * Kernel TLS offloading (kTLS) of record encryption on sending, Linux only.
+ */
+#if HAS_TLS(3, 4) && defined(I_LINUX_TLS)
+#include <linux/tls.h>
+#include <netinet/tcp.h>
+#ifdef TLS_TX
+#define USE_KTLS
+#ifndef TCP_ULP
+#define TCP_ULP		31
+#endif
+#ifndef SOL_TLS
+#define SOL_TLS		282
+#endif
+#endif	/* TLS_TX */
+#endif	/* TLS >= 3.4 && I_LINUX_TLS */
+
 #include "tls_common.h"
 
 #include "features.h"
@@ -566,6 +583,28 @@ tls_set_errno(struct gnutella_socket *s, int errnum)
 	gnutls_transport_set_errno(tls_socket_get_session(s), errnum);
 }
 
+/**
+ * Once record encryption has been offloaded to the kernel, GnuTLS no longer
+ * owns the sequence number of outgoing records: anything it would push now
+ * would corrupt the stream.  Refuse the transport write when that happens.
+ *
+ * @return TRUE if the push must be refused.
+ */
+static bool
+tls_push_offloaded(struct gnutella_socket *s)
+{
+	if G_LIKELY(!s->tls.kernel_tx)
+		return FALSE;
+
+	g_soft_assert_log(!s->tls.kernel_tx,
+		"%s(): GnuTLS writing records to %s after kernel TX offload",
+		G_STRFUNC, host_addr_port_to_string(s->addr, s->port));
+
+	tls_set_errno(s, EIO);
+	errno = EIO;
+	return TRUE;
+}
+
 #ifdef USE_TLS_PUSHV
 static inline ssize_t
 tls_pushv(gnutls_transport_ptr_t ptr, const giovec_t *iov, int iovcnt)
@@ -578,6 +617,9 @@ tls_pushv(gnutls_transport_ptr_t ptr, const giovec_t *iov, int iovcnt)
 	socket_check(s);
 	g_assert(is_valid_fd(s->file_desc));
 
+	if (tls_push_offloaded(s))
+		return -1;
+
 	/*
 	 * On Windows, we need to convert the giovec_t structure into our
 	 * emulated iovec_t, which are actually WSABUF structures, so that
@@ -621,6 +663,9 @@ tls_push(gnutls_transport_ptr_t ptr, const void *buf, size_t size)
 	socket_check(s);
 	g_assert(is_valid_fd(s->file_desc));
 
+	if (tls_push_offloaded(s))
+		return -1;
+
 	ret = s_write(s->file_desc, buf, size);
 	saved_errno = errno;
 	tls_signal_pending(s);
@@ -809,6 +854,162 @@ tls_log_audit(gnutls_session_t session, const char *message)
 }
 #endif	/* TLS >= 3.0 */
 
+#ifdef USE_KTLS
+/**
+ * Install the transmit keys of the TLS session into the kernel, so that
+ * records we send are encrypted by the kernel.
+ *
+ * Only TLS 1.2 with AES-GCM is offloaded: with TLS 1.3, GnuTLS may have to
+ * send post-handshake messages (key updates) using its own transmit state,
+ * which would no longer be in sync with the kernel.
+ *
+ * @return TRUE if the kernel now encrypts all the data sent on the socket.
+ */
+static bool
+tls_kernel_tx_install(struct gnutella_socket *s)
+{
+	gnutls_session_t session = tls_socket_get_session(s);
+	gnutls_cipher_algorithm_t cipher;
+	gnutls_datum_t mac_key, iv, key;
+	unsigned char seq[8];
+	const char *what;
+	int ret, error = 0;
+
+	if (GNUTLS_TLS1_2 != gnutls_protocol_get_version(session)) {
+		what = "protocol";
+		goto unsupported;
+	}
+
+	cipher = gnutls_cipher_get(session);
+	if (
+		GNUTLS_CIPHER_AES_128_GCM != cipher &&
+		GNUTLS_CIPHER_AES_256_GCM != cipher
+	) {
+		what = "cipher";
+		goto unsupported;
+	}
+
+	ret = gnutls_record_get_state(session, FALSE, &mac_key, &iv, &key, seq);
+	if (ret < 0) {
+		if (GNET_PROPERTY(tls_debug)) {
+			g_warning("%s(): gnutls_record_get_state() failed: %s",
+				G_STRFUNC, gnutls_strerror(ret));
+		}
+		return FALSE;
+	}
+
+	if (
+		-1 == setsockopt(s->file_desc, IPPROTO_TCP, TCP_ULP,
+			"tls", CONST_STRLEN("tls"))
+	) {
+		error = errno;
+		what = "kernel";
+		goto unsupported;
+	}
+
+	/*
+	 * With TLS 1.2, the 4-byte implicit part of the GCM nonce is the "IV"
+	 * from GnuTLS and the explicit part is the record sequence number.
+	 */
+
+#define KTLS_GCM_TX(n) G_STMT_START {									\
+	struct tls12_crypto_info_aes_gcm_ ## n ci;							\
+	g_assert(TLS_CIPHER_AES_GCM_ ## n ## _KEY_SIZE == key.size);		\
+	g_assert(TLS_CIPHER_AES_GCM_ ## n ## _SALT_SIZE <= iv.size);		\
+	ZERO(&ci);															\
+	ci.info.version = TLS_1_2_VERSION;									\
+	ci.info.cipher_type = TLS_CIPHER_AES_GCM_ ## n;						\
+	memcpy(ci.iv, seq, TLS_CIPHER_AES_GCM_ ## n ## _IV_SIZE);			\
+	memcpy(ci.rec_seq, seq, TLS_CIPHER_AES_GCM_ ## n ## _REC_SEQ_SIZE);	\
+	memcpy(ci.key, key.data, TLS_CIPHER_AES_GCM_ ## n ## _KEY_SIZE);	\
+	memcpy(ci.salt, iv.data, TLS_CIPHER_AES_GCM_ ## n ## _SALT_SIZE);	\
+	ret = setsockopt(s->file_desc, SOL_TLS, TLS_TX, &ci, sizeof ci);	\
+	ZERO(&ci);							/* Do not leave keys around */	\
+} G_STMT_END
+
+	if (GNUTLS_CIPHER_AES_128_GCM == cipher)
+		KTLS_GCM_TX(128);
+	else
+		KTLS_GCM_TX(256);
+
+#undef KTLS_GCM_TX
+
+	if (-1 == ret) {
+		error = errno;
+		what = "kernel cipher";
+		goto unsupported;
+	}
+
+	if (GNET_PROPERTY(tls_debug) > 1) {
+		g_debug("%s(): kernel now encrypts %s records sent to %s on fd=%d",
+			G_STRFUNC, gnutls_cipher_get_name(cipher),
+			host_addr_port_to_string(s->addr, s->port), s->file_desc);
+	}
+
+	return TRUE;
+
+unsupported:
+	if (GNET_PROPERTY(tls_debug) > 1) {
+		g_debug("%s(): not offloading TLS to kernel for %s: unsupported %s%s%s",
+			G_STRFUNC, host_addr_port_to_string(s->addr, s->port), what,
+			0 == error ? "" : ": ", 0 == error ? "" : g_strerror(error));
+	}
+	return FALSE;
+}
+
+/**
+ * Send a close_notify alert through the kernel TLS layer.
+ */
+static void
+tls_kernel_bye(struct gnutella_socket *s)
+{
+	static const uint8 close_notify[] = { 1, 0 };	/* Warning, close_notify */
+	char cbuf[CMSG_SPACE(sizeof(uint8))];
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+
+	ZERO(&msg);
+	ZERO(&cbuf);
+	iov.iov_base = deconstify_pointer(close_notify);
+	iov.iov_len = sizeof close_notify;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof cbuf;
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_TLS;
+	cmsg->cmsg_type = TLS_SET_RECORD_TYPE;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(uint8));
+	*CMSG_DATA(cmsg) = 21;		/* Alert record */
+
+	if (-1 == sendmsg(s->file_desc, &msg, 0) && GNET_PROPERTY(tls_debug)) {
+		g_warning("%s(): cannot send close_notify to %s: %m",
+			G_STRFUNC, host_addr_port_to_string(s->addr, s->port));
+	}
+}
+#endif	/* USE_KTLS */
+
+/**
+ * Attempt to offload record encryption on sending to the kernel, once the
+ * TLS handshake is complete.
+ *
+ * When this fails, for whatever reason, GnuTLS keeps encrypting the data.
+ */
+static void
+tls_kernel_offload(struct gnutella_socket *s)
+{
+	s->tls.kernel_tx = FALSE;
+
+#ifdef USE_KTLS
+	if (GNET_PROPERTY(tls_kernel_offload))
+		s->tls.kernel_tx = tls_kernel_tx_install(s);
+#else
+	(void) s;
+#endif	/* USE_KTLS */
+}
+
 /**
  * @return	TLS_HANDSHAKE_ERROR if the TLS handshake failed.
  *			TLS_HANDSHAKE_RETRY if the handshake is incomplete; thus
@@ -854,6 +1055,7 @@ tls_handshake(struct gnutella_socket *s)
 			tls_print_session_info(s->addr, s->port, session,
 				SOCK_CONN_INCOMING == s->direction);
 		}
+		tls_kernel_offload(s);
 		tls_signal_pending(s);
 		return TLS_HANDSHAKE_FINISHED;
 	case GNUTLS_E_AGAIN:
@@ -1162,6 +1364,7 @@ tls_write_intern(struct wrap_io *wio, const void *buf, size_t size)
 	struct gnutella_socket *s = wio->ctx;
 	ssize_t ret;
 
+	g_assert(!s->tls.kernel_tx);	/* Records now built by the kernel */
 	g_assert((0 == s->tls.snarf) ^ (NULL == buf));
 	g_assert((0 == s->tls.snarf) ^ (0 == size));
 
@@ -1395,17 +1598,56 @@ tls_no_sendto(struct wrap_io *unused_wio, const gnet_host_t *unused_to,
 	return -1;
 }
 
+/*
+ * When record encryption is offloaded to the kernel, we send plain data.
+ */
+
+static ssize_t
+tls_kernel_write(struct wrap_io *wio, const void *buf, size_t size)
+{
+	struct gnutella_socket *s = wio->ctx;
+
+	socket_check(s);
+	g_assert(socket_uses_kernel_tls(s));
+
+	return s_write(s->file_desc, buf, size);
+}
+
+static ssize_t
+tls_kernel_writev(struct wrap_io *wio, const iovec_t *iov, int iovcnt)
+{
+	struct gnutella_socket *s = wio->ctx;
+
+	socket_check(s);
+	g_assert(socket_uses_kernel_tls(s));
+
+	return s_writev(s->file_desc, iov, iovcnt);
+}
+
+static int
+tls_kernel_flush(struct wrap_io *unused_wio)
+{
+	(void) unused_wio;
+	return 0;
+}
+
 void
 tls_wio_link(struct gnutella_socket *s)
 {
 	socket_check(s);
 
-	s->wio.write = tls_write;
+	if (s->tls.kernel_tx) {
+		s->wio.write = tls_kernel_write;
+		s->wio.writev = tls_kernel_writev;
+		s->wio.flush = tls_kernel_flush;
+	} else {
+		s->wio.write = tls_write;
+		s->wio.writev = tls_writev;
+		s->wio.flush = tls_flush;
+	}
 	s->wio.read = tls_read;
-	s->wio.writev = tls_writev;
 	s->wio.readv = tls_readv;
 	s->wio.sendto = tls_no_sendto;
-	s->wio.flush = tls_flush;
 }
 
 void
@@ -1420,6 +1662,18 @@ tls_bye(struct gnutella_socket *s)
 	if ((SOCK_F_EOF | SOCK_F_SHUTDOWN) & s->flags)
 		return;
 
+	/*
+	 * GnuTLS can no longer send records itself when the kernel took over
+	 * the transmit side of the session.
+	 */
+
+#ifdef USE_KTLS
+	if (s->tls.kernel_tx) {
+		tls_kernel_bye(s);
+		return;
+	}
+#endif	/* USE_KTLS */
+
 	if (tls_flush(&s->wio) && GNET_PROPERTY(tls_debug)) {
 		g_warning("%s(): tls_flush(fd=%d) failed", G_STRFUNC, s->file_desc);
 	}
@@ -32,15 +32,50 @@
 
 #include "topless.h"
 
+#include "lib/cq.h"
+#include "lib/inputevt.h"
+#include "lib/thread.h"
+
+#include "lib/override.h"		/* Must be the last header included */
+
 #ifndef USE_TOPLESS
 bool running_topless;
 #endif	/* USE_TOPLESS */
 
+/**
+ * Native main loop, bypassing glib.
+ *
+ * Without a GUI, the only event sources are the I/O events managed by
+ * inputevt and the main callout queue, so we can wait on the I/O master
+ * file descriptor directly, with a timeout set to the next callout deadline.
+ */
+static void
+topless_native_run(void)
+{
+	bool heartbeat = thread_small_id() == cq_main_thread_id();
+	cqueue_t *cqm = cq_main();
+
+	for (;;) {
+		int timeout = heartbeat ? cq_main_timeout() : -1;
+
+		(void) inputevt_wait(timeout);
+
+		if (heartbeat && 0 == cq_main_timeout())
+			cq_heartbeat(cqm);
+	}
+}
+
+/**
+ * Run the main loop until the process exits.
+ */
 void
 topless_main_run(void)
 {
 	GMainLoop *ml;
 
+	if (inputevt_can_wait())
+		topless_native_run();
+
 #if GLIB_CHECK_VERSION(2,0,0)
 	ml = g_main_loop_new(NULL, FALSE);
 	g_main_loop_run(ml);
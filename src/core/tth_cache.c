@@ -1,6 +1,6 @@
 /*
  * Copyright (c) 2007 Christian Biere
- * Copyright (c) 2015 Raphael Manfredi
+ * Copyright (c) 2015, 2026 Raphael Manfredi
  *
  *----------------------------------------------------------------------
  * This file is part of gtk-gnutella.
@@ -28,23 +28,40 @@
  *
  * Caching of tigertree data.
  *
- * The tigertree data for each shared file is stored in a file in the directory
- * GTK_GNUTELLA_DIR/tth_cache/ in raw binary form. For example, if the root
- * hash is 5EDB4PUVFGY2UKVISQ2DMACSPNRODTTODBS52RQ, the tigertree data is
- * stored in
- * $GTK_GNUTELLA_DIR/tth_cache/5E/DB4PUVFGY2UKVISQ2DMACSPNRODTTODBS52RQ.
- * This avoids storing too many files per directory.
- *
  * Only the leaves at TTH_MAX_DEPTH or above are stored. The root hash and the
  * nodes at each level between above these leaves can be calculated from the
  * leaves.
  *
  * If the depth is 1 (root only), nothing is stored.
  *
+ * The tigertree data of all the files is appended to a single pack file,
+ * GTK_GNUTELLA_DIR/tth_cache.pack, as records made of a small header (the
+ * root hash and the amount of leaves) followed by the raw leaves.  Removing
+ * an entry appends a record with no leaves.
+ *
+ * The GTK_GNUTELLA_DIR/tth_cache.idx file is an array of (root hash, record
+ * offset, amount of leaves) sorted by root hash, which covers the pack up to
+ * a given size.  Both files are memory-mapped: lookups are binary searches
+ * in the index and leaves are copied straight out of the pack.  Records
+ * appended since the index was written are kept in a hash table, which is
+ * looked up first and merged back into the index when we exit.
+ *
+ * After each library rescan, the pack is compacted to only keep the entries
+ * referenced by shared files, plus those created during the session, as
+ * soon as enough space can be reclaimed.
+ *
+ * Older versions stored the data for each file in a file in the directory
+ * GTK_GNUTELLA_DIR/tth_cache/ in raw binary form. For example, if the root
+ * hash is 5EDB4PUVFGY2UKVISQ2DMACSPNRODTTODBS52RQ, the tigertree data was
+ * stored in
+ * $GTK_GNUTELLA_DIR/tth_cache/5E/DB4PUVFGY2UKVISQ2DMACSPNRODTTODBS52RQ.
+ * These files are still read until the first cleanup moves the shared
+ * entries to the pack and removes the directory.
+ *
  * @author Christian Biere
  * @date 2007
  * @author Raphael Manfredi
- * @date 2015
+ * @date 2015, 2026
  */
 
 #include "common.h"
@@ -54,25 +71,32 @@
 #include "settings.h"
 #include "share.h"
 
+#include "lib/atomic.h"
 #include "lib/atoms.h"
 #include "lib/base32.h"
+#include "lib/bsearch.h"
+#include "lib/compat_pio.h"
+#include "lib/endian.h"
 #include "lib/fd.h"
 #include "lib/file.h"
 #include "lib/ftw.h"
 #include "lib/halloc.h"
+#include "lib/hikset.h"
 #include "lib/hset.h"
 #include "lib/hstrfn.h"
+#include "lib/iovec.h"
+#include "lib/mutex.h"
 #include "lib/path.h"
 #include "lib/pslist.h"
-#include "lib/spinlock.h"
+#include "lib/random.h"
 #include "lib/str.h"
 #include "lib/stringify.h"
 #include "lib/thread.h"
 #include "lib/tigertree.h"
-#include "lib/timestamp.h"
+#include "lib/vmm.h"
 #include "lib/walloc.h"
+#include "lib/xsort.h"
 
-#include "if/gnet_property_priv.h"
 #include "if/core/main.h"		/* For debugging() */
 
 #include "lib/override.h"       /* Must be the last header included */
@@ -83,14 +107,76 @@
 #define TTH_FILE_MODE (S_IRUSR | S_IWUSR | S_IRGRP) /* 0640 */
 #endif
 
+#define TTH_PACK_FILE		"tth_cache.pack"
+#define TTH_INDEX_FILE		"tth_cache.idx"
+#define TTH_PACK_MAGIC		"TTHP"
+#define TTH_INDEX_MAGIC		"TTHI"
+#define TTH_PACK_VERSION	1
+#define TTH_INDEX_VERSION	1
+
+/*
+ * The pack header is made of the magic, the version and a random stamp,
+ * which is also recorded in the index so that we never use an index with
+ * a pack that was rewritten by compaction.
+ *
+ * Each record in the pack is made of a header holding the root hash, the
+ * amount of leaves (0 for a removal) and reserved bytes, followed by the
+ * raw leaves.
+ *
+ * The index header is made of the magic, the version, the amount of entries
+ * in the index, the size of the pack covered by the index and the stamp of
+ * the pack.  Each index entry holds the root hash, the offset of the record
+ * in the pack and the amount of leaves.
+ *
+ * All the numbers are stored in big-endian order.
+ */
+#define TTH_PACK_HEADER		16
+#define TTH_RECORD_HEADER	32
+#define TTH_INDEX_HEADER	32
+#define TTH_INDEX_RECORD	40
+
+#define TTH_RECORD_SIZE(n) \
+	(TTH_RECORD_HEADER + (filesize_t) (n) * TTH_RAW_SIZE)
+#define TTH_RECORD_MAX		TTH_RECORD_SIZE(TTH_MAX_LEAVES)
+
+#define TTH_PACK_SLACK		4	/**< Compact when 1/4th of the pack is unused */
+
+/**
+ * A cache entry, as recorded in the index or in the delta table.
+ */
+struct tth_cache_entry {
+	struct tth root;		/**< The root hash (key for the delta table) */
+	filesize_t offset;		/**< Offset of the record in the pack */
+	uint32 nleaves;			/**< Amount of leaves, 0 if entry was removed */
+	bool fresh;				/**< Whether entry was created this session */
+};
+
 /**
- * This lock is used to protect the creation / removal of directories
- * under the TTH cache.
+ * The TTH cache pack and its index.
  */
-static spinlock_t tth_path_lk = SPINLOCK_INIT;
+static struct tth_pack {
+	int fd;					/**< The pack file, -1 if not opened */
+	filesize_t size;		/**< Current size of the pack */
+	uint64 stamp;			/**< The random stamp of the pack */
+	void *map;				/**< The mapped pack, NULL if not mapped */
+	size_t map_size;		/**< Size of the mapped pack */
+	void *idx;				/**< The loaded index, NULL if none */
+	size_t idx_size;		/**< Size of the loaded index */
+	size_t idx_count;		/**< Amount of entries in the index */
+	hikset_t *delta;		/**< Entries not reflected by the index */
+	bool legacy;			/**< Whether old cache directory may exist */
+	bool closing;			/**< Set when shutting down */
+} tth_pack = { -1, 0, 0, NULL, 0, NULL, 0, 0, NULL, FALSE, FALSE };
 
-#define TTH_PATH_LOCK		spinlock(&tth_path_lk)
-#define TTH_PATH_UNLOCK		spinunlock(&tth_path_lk)
+/**
+ * This lock is used to protect the pack and its index, since the cleanup
+ * thread can migrate and compact entries whilst the main thread is serving
+ * tigertree data and the TTH verifying thread is inserting new entries.
+ */
+static mutex_t tth_cache_mtx = MUTEX_INIT;
+
+#define TTH_CACHE_LOCK		mutex_lock(&tth_cache_mtx)
+#define TTH_CACHE_UNLOCK	mutex_unlock(&tth_cache_mtx)
 
 static const char *
 tth_cache_directory(void)
@@ -116,41 +202,6 @@ tth_cache_pathname(const struct tth *tth)
 			&hash[0], G_DIR_SEPARATOR, &hash[2]);
 }
 
-static int
-tth_cache_file_create(const struct tth *tth)
-{
-	char *pathname;
-	int accmode;
-	int fd;
-
-	g_return_val_if_fail(tth, -1);
-
-	accmode = O_WRONLY | O_TRUNC;
-	pathname = tth_cache_pathname(tth);
-
-	/*
-	 * Critical section required since we could have a concurrent thread
-	 * deciding to remove empty directories whilst we are attempting
-	 * to create a new directory to store the new cached entry!
-	 */
-
-	TTH_PATH_LOCK;
-
-	fd = file_create_missing(pathname, accmode, TTH_FILE_MODE);
-	if (fd < 0 && ENOENT == errno) {
-		char *dir = filepath_directory(pathname);
-		if (0 == create_directory(dir, DEFAULT_DIRECTORY_MODE)) {
-			fd = file_create(pathname, accmode, TTH_FILE_MODE);
-		}
-		HFREE_NULL(dir);
-	}
-
-	TTH_PATH_UNLOCK;
-
-	HFREE_NULL(pathname);
-	return fd;
-}
-
 static int
 tth_cache_file_open(const struct tth *tth)
 {
@@ -179,64 +230,590 @@ tth_cache_file_exists(const struct tth *tth)
 	return ret;
 }
 
-void
-tth_cache_insert(const struct tth *tth, const struct tth *leaves, int n_leaves)
+static size_t
+tth_cache_leave_count(const struct tth *tth, const filestat_t *sb)
 {
-	int fd;
+	g_return_val_if_fail(tth, 0);
+	g_return_val_if_fail(sb, 0);
 
-	g_return_if_fail(tth);
-	g_return_if_fail(leaves);
-	g_return_if_fail(n_leaves >= 1);
+	if (!S_ISREG(sb->st_mode)) {
+		g_warning("%s(%s): not a regular file", G_STRFUNC, tth_base32(tth));
+		return 0;
+	}
+	if (
+		sb->st_size % TTH_RAW_SIZE ||
+		sb->st_size < TTH_RAW_SIZE ||
+		sb->st_size > TTH_MAX_LEAVES * TTH_RAW_SIZE
+	) {
+		g_warning("%s(%s): bad filesize %s", G_STRFUNC,
+			tth_base32(tth), fileoffset_t_to_string(sb->st_size));
+		return 0;
+	}
 
-	{
-		struct tth root;
+	return sb->st_size / TTH_RAW_SIZE;
+}
 
-		root = tt_root_hash(leaves, n_leaves);
-		g_return_if_fail(tth_eq(tth, &root));
-	}
+/**
+ * Read leaves from the file of the old cache directory.
+ */
+static size_t
+tth_cache_file_get_leaves(const struct tth *tth,
+	struct tth leaves[TTH_MAX_LEAVES], size_t n)
+{
+	int fd, num_leaves = 0;
 
-	if (1 == n_leaves)
-		return;
+	g_return_val_if_fail(tth, 0);
+	g_return_val_if_fail(leaves, 0);
 
-	fd = tth_cache_file_create(tth);
+	fd = tth_cache_file_open(tth);
 	if (fd >= 0) {
-		size_t size;
-		ssize_t ret;
+		filestat_t sb;
+
+		if (fstat(fd, &sb)) {
+			g_warning("%s(%s): fstat() failed: %m", G_STRFUNC, tth_base32(tth));
+		} else {
+			size_t n_leaves;
+
+			n_leaves = tth_cache_leave_count(tth, &sb);
+			n_leaves = MIN(n, n_leaves);
+			if (n_leaves > 0) {
+				size_t size;
+				ssize_t ret;
 
-		STATIC_ASSERT(TTH_RAW_SIZE == sizeof(leaves[0]));
+				STATIC_ASSERT(TTH_RAW_SIZE == sizeof(leaves[0]));
 
-		size = TTH_RAW_SIZE * n_leaves;
-		ret = write(fd, leaves, size);
-		if ((ssize_t) -1 == ret) {
-			g_warning("%s(%s): write() failed: %m", G_STRFUNC, tth_base32(tth));
-		} else if ((size_t) ret != size) {
-			g_warning("%s(%s): incomplete write()", G_STRFUNC, tth_base32(tth));
+				size = TTH_RAW_SIZE * n_leaves;
+				ret = read(fd, &leaves[0].data, size);
+				if ((size_t) ret == size) {
+					num_leaves = n_leaves;
+				}
+			}
 		}
 		fd_forget_and_close(&fd);
 	}
+	return num_leaves;
 }
 
+/**
+ * Get amount of leaves from the file of the old cache directory.
+ */
 static size_t
-tth_cache_leave_count(const struct tth *tth, const filestat_t *sb)
+tth_cache_file_get_nleaves(const struct tth *tth)
 {
-	g_return_val_if_fail(tth, 0);
-	g_return_val_if_fail(sb, 0);
+	int fd;
+	filesize_t nleaves = 0;
 
-	if (!S_ISREG(sb->st_mode)) {
-		g_warning("%s(%s): not a regular file", G_STRFUNC, tth_base32(tth));
-		return 0;
+	fd = tth_cache_file_open(tth);
+
+	if (fd >= 0) {
+		filestat_t sb;
+
+		if (fstat(fd, &sb)) {
+			g_warning("%s(%s): fstat() failed: %m", G_STRFUNC, tth_base32(tth));
+		} else {
+			nleaves = tth_cache_leave_count(tth, &sb);
+		}
+
+		fd_forget_and_close(&fd);
+	}
+
+	return nleaves;
+}
+
+/**
+ * Map file read-only in memory.
+ *
+ * @return pointer to the data, NULL on failure.
+ */
+static void *
+tth_cache_map(int fd, size_t size)
+{
+	void *p;
+
+#ifdef HAS_MMAP
+	p = vmm_mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (MAP_FAILED == p)
+		return NULL;
+#else
+	p = halloc(size);
+	if (size != UNSIGNED(compat_pread(fd, p, size, 0)))
+		HFREE_NULL(p);
+#endif	/* HAS_MMAP */
+
+	return p;
+}
+
+/**
+ * Unmap file data mapped with tth_cache_map().
+ */
+static void
+tth_cache_unmap(void *p, size_t size)
+{
+#ifdef HAS_MMAP
+	vmm_munmap(p, size);
+#else
+	(void) size;
+	hfree(p);
+#endif	/* HAS_MMAP */
+}
+
+/**
+ * Map the pack in memory to serve the leaves from the mapping.
+ *
+ * Without mmap(), the whole pack would have to be loaded, hence we simply
+ * read the records we need from the file.
+ */
+static void
+tth_cache_pack_map(void)
+{
+#ifdef HAS_MMAP
+	size_t size = tth_pack.size;
+
+	g_assert(NULL == tth_pack.map);
+
+	if (size != tth_pack.size)
+		return;		/* Cannot map the whole pack, will read() instead */
+
+	tth_pack.map = tth_cache_map(tth_pack.fd, size);
+	if (NULL == tth_pack.map) {
+		g_warning("%s(): cannot map TTH cache pack: %m", G_STRFUNC);
+		return;
+	}
+	tth_pack.map_size = size;
+#endif	/* HAS_MMAP */
+}
+
+static void
+tth_cache_pack_unmap(void)
+{
+	if (tth_pack.map != NULL) {
+		tth_cache_unmap(tth_pack.map, tth_pack.map_size);
+		tth_pack.map = NULL;
+		tth_pack.map_size = 0;
+	}
+}
+
+/**
+ * Read data from the pack, out of its mapping when it covers the data.
+ *
+ * @return TRUE if we read all the data.
+ */
+static bool
+tth_cache_pack_read(void *dst, size_t len, filesize_t offset)
+{
+	if (offset + len <= tth_pack.map_size) {
+		memcpy(dst, const_ptr_add_offset(tth_pack.map, offset), len);
+		return TRUE;
+	}
+
+	return len == UNSIGNED(compat_pread(tth_pack.fd, dst, len, offset));
+}
+
+/**
+ * Fill pack header with a new random stamp.
+ *
+ * @return the stamp of the pack.
+ */
+static uint64
+tth_cache_pack_header(char header[TTH_PACK_HEADER])
+{
+	uint64 stamp = random_u64();
+
+	memset(header, 0, TTH_PACK_HEADER);
+	memcpy(header, TTH_PACK_MAGIC, 4);
+	poke_be32(&header[4], TTH_PACK_VERSION);
+	poke_be64(&header[8], stamp);
+
+	return stamp;
+}
+
+/**
+ * Open the pack, creating it when missing or invalid.
+ *
+ * @return the opened file descriptor, -1 on error.
+ */
+static int
+tth_cache_pack_open(void)
+{
+	char header[TTH_PACK_HEADER];
+	filestat_t sb;
+	char *path;
+	int fd;
+
+	path = make_pathname(settings_config_dir(), TTH_PACK_FILE);
+	fd = file_open_missing(path, O_RDWR);
+	if (-1 == fd)
+		fd = file_create(path, O_RDWR, TTH_FILE_MODE);
+	if (-1 == fd)
+		goto done;
+
+	if (-1 == fstat(fd, &sb)) {
+		g_warning("%s(): fstat() failed: %m", G_STRFUNC);
+		fd_forget_and_close(&fd);
+		goto done;
 	}
+
 	if (
-		sb->st_size % TTH_RAW_SIZE ||
-		sb->st_size < TTH_RAW_SIZE ||
-		sb->st_size > TTH_MAX_LEAVES * TTH_RAW_SIZE
+		sb.st_size >= TTH_PACK_HEADER &&
+		sizeof header == UNSIGNED(compat_pread(fd, ARYLEN(header), 0)) &&
+		0 == memcmp(header, TTH_PACK_MAGIC, 4) &&
+		TTH_PACK_VERSION == peek_be32(&header[4])
 	) {
-		g_warning("%s(%s): bad filesize %s", G_STRFUNC,
-			tth_base32(tth), fileoffset_t_to_string(sb->st_size));
-		return 0;
+		tth_pack.size = sb.st_size;
+		tth_pack.stamp = peek_be64(&header[8]);
+		goto done;
 	}
 
-	return sb->st_size / TTH_RAW_SIZE;
+	if (0 != sb.st_size)
+		g_warning("%s(): discarding invalid %s", G_STRFUNC, path);
+
+	tth_pack.stamp = tth_cache_pack_header(header);
+
+	if (
+		-1 == ftruncate(fd, 0) ||
+		sizeof header != UNSIGNED(compat_pwrite(fd, ARYLEN(header), 0))
+	) {
+		g_warning("%s(): cannot initialize %s: %m", G_STRFUNC, path);
+		fd_forget_and_close(&fd);
+		goto done;
+	}
+
+	tth_pack.size = sizeof header;
+
+done:
+	HFREE_NULL(path);
+	return fd;
+}
+
+/**
+ * Comparison of a root hash with an index entry or another root hash.
+ */
+static int
+tth_cache_root_cmp(const void *a, const void *b)
+{
+	return memcmp(a, b, TTH_RAW_SIZE);
+}
+
+static int
+tth_cache_entry_cmp(const void *a, const void *b)
+{
+	const struct tth_cache_entry *ea = a, *eb = b;
+
+	return tth_cache_root_cmp(ea->root.data, eb->root.data);
+}
+
+/**
+ * Decode index entry.
+ */
+static void
+tth_cache_index_entry(const void *p, struct tth_cache_entry *e)
+{
+	const char *rec = p;
+
+	memcpy(e->root.data, rec, TTH_RAW_SIZE);
+	e->offset = peek_be64(&rec[24]);
+	e->nleaves = peek_be32(&rec[32]);
+	e->fresh = FALSE;
+}
+
+/**
+ * Load the index of the pack.
+ *
+ * @return the size of the pack covered by the index.
+ */
+static filesize_t
+tth_cache_index_load(void)
+{
+	filesize_t covered = TTH_PACK_HEADER;
+	filestat_t sb;
+	const char *p;
+	size_t size, count;
+	char *path;
+	int fd;
+
+	g_assert(NULL == tth_pack.idx);
+
+	path = make_pathname(settings_config_dir(), TTH_INDEX_FILE);
+	fd = file_open_missing(path, O_RDONLY);
+	HFREE_NULL(path);
+
+	if (-1 == fd)
+		return covered;
+
+	if (
+		-1 == fstat(fd, &sb) || !S_ISREG(sb.st_mode) ||
+		sb.st_size < TTH_INDEX_HEADER ||
+		UNSIGNED(sb.st_size) >= MAX_INT_VAL(uint32)
+	)
+		goto invalid;
+
+	size = sb.st_size;
+	p = tth_cache_map(fd, size);
+	if (NULL == p)
+		goto invalid;
+
+	count = peek_be32(&p[8]);
+
+	if (
+		0 != memcmp(p, TTH_INDEX_MAGIC, 4) ||
+		TTH_INDEX_VERSION != peek_be32(&p[4]) ||
+		size != TTH_INDEX_HEADER + count * TTH_INDEX_RECORD ||
+		peek_be64(&p[16]) > tth_pack.size ||
+		peek_be64(&p[24]) != tth_pack.stamp
+	) {
+		tth_cache_unmap(deconstify_pointer(p), size);
+		goto invalid;
+	}
+
+	tth_pack.idx = deconstify_pointer(p);
+	tth_pack.idx_size = size;
+	tth_pack.idx_count = count;
+	covered = MAX(covered, peek_be64(&p[16]));
+	goto done;
+
+invalid:
+	g_warning("%s(): ignoring invalid TTH cache index", G_STRFUNC);
+
+	/* FALL THROUGH */
+
+done:
+	fd_forget_and_close(&fd);
+	return covered;
+}
+
+static void
+tth_cache_index_unload(void)
+{
+	if (tth_pack.idx != NULL) {
+		tth_cache_unmap(tth_pack.idx, tth_pack.idx_size);
+		tth_pack.idx = NULL;
+		tth_pack.idx_size = 0;
+		tth_pack.idx_count = 0;
+	}
+}
+
+/**
+ * Write a new index for the pack.
+ *
+ * @param vec		the entries, sorted by root hash
+ * @param count		amount of entries
+ */
+static void
+tth_cache_index_write(const struct tth_cache_entry *vec, size_t count)
+{
+	char header[TTH_INDEX_HEADER];
+	file_path_t fp;
+	size_t i;
+	FILE *f;
+
+	file_path_set(&fp, settings_config_dir(), TTH_INDEX_FILE);
+	f = file_config_open_write("TTH cache index", &fp);
+	if (NULL == f)
+		return;
+
+	ZERO(&header);
+	memcpy(header, TTH_INDEX_MAGIC, 4);
+	poke_be32(&header[4], TTH_INDEX_VERSION);
+	poke_be32(&header[8], count);
+	poke_be64(&header[16], tth_pack.size);
+	poke_be64(&header[24], tth_pack.stamp);
+	fwrite(header, sizeof header, 1, f);
+
+	for (i = 0; i < count; i++) {
+		char rec[TTH_INDEX_RECORD];
+
+		ZERO(&rec);
+		memcpy(rec, vec[i].root.data, TTH_RAW_SIZE);
+		poke_be64(&rec[24], vec[i].offset);
+		poke_be32(&rec[32], vec[i].nleaves);
+		fwrite(rec, sizeof rec, 1, f);
+	}
+
+	file_config_close(f, &fp);
+}
+
+/**
+ * Record cache entry in the delta table.
+ */
+static void
+tth_cache_delta_set(const struct tth *tth,
+	filesize_t offset, uint32 nleaves, bool fresh)
+{
+	struct tth_cache_entry *e;
+
+	e = hikset_lookup(tth_pack.delta, tth);
+	if (NULL == e) {
+		WALLOC0(e);
+		e->root = *tth;
+		hikset_insert(tth_pack.delta, e);
+	}
+
+	e->offset = offset;
+	e->nleaves = nleaves;
+	e->fresh = fresh;
+}
+
+static void
+tth_cache_delta_free(void *value, void *unused_data)
+{
+	struct tth_cache_entry *e = value;
+
+	(void) unused_data;
+	WFREE(e);
+}
+
+static void
+tth_cache_delta_clear(void)
+{
+	hikset_foreach(tth_pack.delta, tth_cache_delta_free, NULL);
+	hikset_clear(tth_pack.delta);
+}
+
+/**
+ * Scan the pack records not covered by the index, and record them in the
+ * delta table.  Any partially written record at the end is discarded.
+ */
+static void
+tth_cache_pack_scan(filesize_t offset)
+{
+	char header[TTH_RECORD_HEADER];
+
+	while (offset + TTH_RECORD_HEADER <= tth_pack.size) {
+		struct tth tth;
+		uint32 n;
+
+		if (
+			sizeof header !=
+				UNSIGNED(compat_pread(tth_pack.fd, ARYLEN(header), offset))
+		)
+			break;
+
+		n = peek_be32(&header[24]);
+		if (1 == n || n > TTH_MAX_LEAVES)
+			break;
+		if (offset + TTH_RECORD_SIZE(n) > tth_pack.size)
+			break;
+
+		memcpy(tth.data, header, TTH_RAW_SIZE);
+		tth_cache_delta_set(&tth, offset, n, FALSE);
+		offset += TTH_RECORD_SIZE(n);
+	}
+
+	if (offset != tth_pack.size) {
+		g_warning("%s(): truncating TTH cache pack from %s to %s bytes",
+			G_STRFUNC, filesize_to_string(tth_pack.size),
+			filesize_to_string2(offset));
+		if (-1 == ftruncate(tth_pack.fd, offset))
+			g_warning("%s(): ftruncate() failed: %m", G_STRFUNC);
+		tth_pack.size = offset;
+	}
+}
+
+/**
+ * Locate entry in the pack.
+ *
+ * @return TRUE if found and not removed, filling the entry.
+ */
+static bool
+tth_cache_find(const struct tth *tth, struct tth_cache_entry *e)
+{
+	const struct tth_cache_entry *d;
+	const void *p;
+
+	if (NULL == tth_pack.delta)
+		return FALSE;		/* Cache closed */
+
+	d = hikset_lookup(tth_pack.delta, tth);
+	if (d != NULL) {
+		*e = *d;
+		return 0 != e->nleaves;
+	}
+
+	if (NULL == tth_pack.idx)
+		return FALSE;
+
+	p = bsearch(tth->data,
+			const_ptr_add_offset(tth_pack.idx, TTH_INDEX_HEADER),
+			tth_pack.idx_count, TTH_INDEX_RECORD, tth_cache_root_cmp);
+
+	if (NULL == p)
+		return FALSE;
+
+	tth_cache_index_entry(p, e);
+	return 0 != e->nleaves;
+}
+
+/**
+ * Append record to the pack.
+ *
+ * @param tth		the root hash
+ * @param leaves	the leaves (NULL when removing the entry)
+ * @param n			amount of leaves (0 when removing the entry)
+ *
+ * @return TRUE if the record was written.
+ */
+static bool
+tth_cache_append(const struct tth *tth, const struct tth *leaves, size_t n)
+{
+	char header[TTH_RECORD_HEADER];
+	iovec_t iov[2];
+	size_t size;
+	ssize_t ret;
+
+	if (-1 == tth_pack.fd)
+		return FALSE;
+
+	STATIC_ASSERT(TTH_RAW_SIZE == sizeof(leaves[0]));
+
+	ZERO(&header);
+	memcpy(header, tth->data, TTH_RAW_SIZE);
+	poke_be32(&header[24], n);
+
+	iov[0] = iov_get(header, sizeof header);
+	iov[1] = iov_get(deconstify_pointer(leaves), n * TTH_RAW_SIZE);
+	size = TTH_RECORD_SIZE(n);
+
+	ret = compat_pwritev(tth_pack.fd, iov, 0 == n ? 1 : 2, tth_pack.size);
+	if (UNSIGNED(ret) != size) {
+		if ((ssize_t) -1 == ret) {
+			g_warning("%s(%s): write() failed: %m",
+				G_STRFUNC, tth_base32(tth));
+		} else {
+			g_warning("%s(%s): incomplete write()",
+				G_STRFUNC, tth_base32(tth));
+			if (-1 == ftruncate(tth_pack.fd, tth_pack.size))
+				g_warning("%s(): ftruncate() failed: %m", G_STRFUNC);
+		}
+		return FALSE;
+	}
+
+	tth_cache_delta_set(tth, tth_pack.size, n, TRUE);
+	tth_pack.size += size;
+
+	return TRUE;
+}
+
+void
+tth_cache_insert(const struct tth *tth, const struct tth *leaves, int n_leaves)
+{
+	g_return_if_fail(tth);
+	g_return_if_fail(leaves);
+	g_return_if_fail(n_leaves >= 1);
+	g_return_if_fail(n_leaves <= TTH_MAX_LEAVES);
+
+	{
+		struct tth root;
+
+		root = tt_root_hash(leaves, n_leaves);
+		g_return_if_fail(tth_eq(tth, &root));
+	}
+
+	if (1 == n_leaves)
+		return;
+
+	TTH_CACHE_LOCK;
+	(void) tth_cache_append(tth, leaves, n_leaves);
+	TTH_CACHE_UNLOCK;
 }
 
 /**
@@ -251,20 +828,7 @@ tth_cache_lookup(const struct tth *tth, filesize_t filesize)
 
 	expected = tt_good_node_count(filesize);
 	if (expected > 1) {
-		filestat_t sb;
-		char *pathname;
-
-		pathname = tth_cache_pathname(tth);
-		if (stat(pathname, &sb)) {
-			leave_count = 0;
-			if (ENOENT != errno) {
-				g_warning("%s(%s): stat(\"%s\") failed: %m",
-					G_STRFUNC, tth_base32(tth), pathname);
-			}
-		} else {
-			leave_count = tth_cache_leave_count(tth, &sb);
-		}
-		HFREE_NULL(pathname);
+		leave_count = tth_cache_get_nleaves(tth);
 	} else {
 		leave_count = 1;
 	}
@@ -274,50 +838,68 @@ tth_cache_lookup(const struct tth *tth, filesize_t filesize)
 void
 tth_cache_remove(const struct tth *tth)
 {
-	char *pathname;
+	struct tth_cache_entry e;
 
 	g_return_if_fail(tth);
 
-	pathname = tth_cache_pathname(tth);
-	unlink(pathname);
-	HFREE_NULL(pathname);
+	TTH_CACHE_LOCK;
+	if (tth_cache_find(tth, &e) && !tth_cache_append(tth, NULL, 0))
+		tth_cache_delta_set(tth, tth_pack.size, 0, FALSE);
+	TTH_CACHE_UNLOCK;
+
+	if (atomic_bool_get(&tth_pack.legacy)) {
+		char *pathname = tth_cache_pathname(tth);
+		unlink(pathname);
+		HFREE_NULL(pathname);
+	}
+}
+
+/**
+ * @return whether we have an entry for the TTH in the cache.
+ */
+static bool
+tth_cache_exists(const struct tth *tth)
+{
+	struct tth_cache_entry e;
+	bool found;
+
+	TTH_CACHE_LOCK;
+	found = tth_cache_find(tth, &e);
+	TTH_CACHE_UNLOCK;
+
+	if (!found && atomic_bool_get(&tth_pack.legacy))
+		found = tth_cache_file_exists(tth);
+
+	return found;
 }
 
 static size_t
 tth_cache_get_leaves(const struct tth *tth,
 	struct tth leaves[TTH_MAX_LEAVES], size_t n)
 {
-	int fd, num_leaves = 0;
+	struct tth_cache_entry e;
+	size_t num_leaves = 0;
+	bool found;
 
 	g_return_val_if_fail(tth, 0);
 	g_return_val_if_fail(leaves, 0);
 
-	fd = tth_cache_file_open(tth);
-	if (fd >= 0) {
-		filestat_t sb;
-
-		if (fstat(fd, &sb)) {
-			g_warning("%s(%s): fstat() failed: %m", G_STRFUNC, tth_base32(tth));
-		} else {
-			size_t n_leaves;
+	TTH_CACHE_LOCK;
+	found = tth_cache_find(tth, &e);
+	if (found) {
+		size_t n_leaves = MIN(n, e.nleaves);
 
-			n_leaves = tth_cache_leave_count(tth, &sb);
-			n_leaves = MIN(n, n_leaves);
-			if (n_leaves > 0) {
-				size_t size;
-				ssize_t ret;
+		if (
+			tth_cache_pack_read(&leaves[0].data, TTH_RAW_SIZE * n_leaves,
+				e.offset + TTH_RECORD_HEADER)
+		)
+			num_leaves = n_leaves;
+	}
+	TTH_CACHE_UNLOCK;
 
-				STATIC_ASSERT(TTH_RAW_SIZE == sizeof(leaves[0]));
+	if (!found && atomic_bool_get(&tth_pack.legacy))
+		num_leaves = tth_cache_file_get_leaves(tth, leaves, n);
 
-				size = TTH_RAW_SIZE * n_leaves;
-				ret = read(fd, &leaves[0].data, size);
-				if ((size_t) ret == size) {
-					num_leaves = n_leaves;
-				}
-			}
-		}
-		fd_forget_and_close(&fd);
-	}
 	return num_leaves;
 }
 
@@ -364,7 +946,7 @@ tth_cache_get_tree(const struct tth *tth, filesize_t filesize,
 		}
 	}
 
-	if (tth_cache_file_exists(tth)) {
+	if (tth_cache_exists(tth)) {
 		g_warning("%s(): removing corrupted tigertree for %s",
 			G_STRFUNC, tth_base32(tth));
 		tth_cache_remove(tth);
@@ -382,26 +964,350 @@ tth_cache_get_tree(const struct tth *tth, filesize_t filesize,
 size_t
 tth_cache_get_nleaves(const struct tth *tth)
 {
-	int fd;
-	filesize_t nleaves = 0;
+	struct tth_cache_entry e;
+	size_t nleaves = 0;
+	bool found;
 
 	g_return_val_if_fail(tth != NULL, 0);
 
-	fd = tth_cache_file_open(tth);
+	TTH_CACHE_LOCK;
+	found = tth_cache_find(tth, &e);
+	if (found)
+		nleaves = e.nleaves;
+	TTH_CACHE_UNLOCK;
 
-	if (fd >= 0) {
-		filestat_t sb;
+	if (!found && atomic_bool_get(&tth_pack.legacy))
+		nleaves = tth_cache_file_get_nleaves(tth);
 
-		if (fstat(fd, &sb)) {
-			g_warning("%s(%s): fstat() failed: %m", G_STRFUNC, tth_base32(tth));
+	return nleaves;
+}
+
+/**
+ * Collect entries from the index.
+ *
+ * @param count		where the amount of entries is returned
+ *
+ * @return halloc()'ed array of entries sorted by root hash, NULL if none.
+ */
+static struct tth_cache_entry *
+tth_cache_index_entries(size_t *count)
+{
+	struct tth_cache_entry *vec;
+	size_t i;
+
+	*count = tth_pack.idx_count;
+
+	if (0 == tth_pack.idx_count)
+		return NULL;
+
+	HALLOC_ARRAY(vec, tth_pack.idx_count);
+
+	for (i = 0; i < tth_pack.idx_count; i++) {
+		tth_cache_index_entry(
+			const_ptr_add_offset(tth_pack.idx,
+				TTH_INDEX_HEADER + i * TTH_INDEX_RECORD),
+			&vec[i]);
+	}
+
+	return vec;
+}
+
+struct tth_cache_collect {
+	struct tth_cache_entry *vec;
+	size_t n;
+	filesize_t from;
+};
+
+static void
+tth_cache_delta_collect(void *value, void *data)
+{
+	const struct tth_cache_entry *e = value;
+	struct tth_cache_collect *ctx = data;
+
+	if (e->offset >= ctx->from)
+		ctx->vec[ctx->n++] = *e;
+}
+
+/**
+ * Collect entries from the delta table.
+ *
+ * @param from		only collect entries whose record is at this offset or after
+ * @param count		where the amount of entries is returned
+ *
+ * @return halloc()'ed array of entries sorted by root hash, NULL if none.
+ */
+static struct tth_cache_entry *
+tth_cache_delta_entries(filesize_t from, size_t *count)
+{
+	struct tth_cache_collect ctx;
+	size_t n = hikset_count(tth_pack.delta);
+
+	*count = 0;
+
+	if (0 == n)
+		return NULL;
+
+	HALLOC_ARRAY(ctx.vec, n);
+	ctx.n = 0;
+	ctx.from = from;
+	hikset_foreach(tth_pack.delta, tth_cache_delta_collect, &ctx);
+	xsort(ctx.vec, ctx.n, sizeof ctx.vec[0], tth_cache_entry_cmp);
+
+	*count = ctx.n;
+	return ctx.vec;
+}
+
+/**
+ * Merge two sorted arrays of entries, the second one taking precedence,
+ * and dropping removed entries.
+ *
+ * @return halloc()'ed array of entries sorted by root hash, NULL if none.
+ */
+static struct tth_cache_entry *
+tth_cache_merge(
+	const struct tth_cache_entry *a, size_t na,
+	const struct tth_cache_entry *b, size_t nb, size_t *count)
+{
+	struct tth_cache_entry *vec;
+	size_t i = 0, j = 0, n = 0;
+
+	*count = 0;
+
+	if (0 == na + nb)
+		return NULL;
+
+	HALLOC_ARRAY(vec, na + nb);
+
+	while (i < na || j < nb) {
+		const struct tth_cache_entry *e;
+
+		if (j >= nb) {
+			e = &a[i++];
+		} else if (i >= na) {
+			e = &b[j++];
 		} else {
-			nleaves = tth_cache_leave_count(tth, &sb);
+			int c = tth_cache_entry_cmp(&a[i], &b[j]);
+
+			if (c < 0) {
+				e = &a[i++];
+			} else {
+				if (0 == c)
+					i++;		/* Superseded */
+				e = &b[j++];
+			}
 		}
 
-		fd_forget_and_close(&fd);
+		if (0 != e->nleaves)
+			vec[n++] = *e;
 	}
 
-	return nleaves;
+	*count = n;
+	return vec;
+}
+
+/**
+ * Collect all the entries of the cache.
+ *
+ * @param count		where the amount of entries is returned
+ *
+ * @return halloc()'ed array of entries sorted by root hash, NULL if none.
+ */
+static struct tth_cache_entry *
+tth_cache_entries(size_t *count)
+{
+	struct tth_cache_entry *ivec, *dvec, *vec;
+	size_t icnt, dcnt;
+
+	ivec = tth_cache_index_entries(&icnt);
+	dvec = tth_cache_delta_entries(0, &dcnt);
+	vec = tth_cache_merge(ivec, icnt, dvec, dcnt, count);
+
+	HFREE_NULL(ivec);
+	HFREE_NULL(dvec);
+
+	return vec;
+}
+
+/**
+ * Copy record from the pack to the new pack being compacted, updating the
+ * offset of the entry.
+ *
+ * @return TRUE on success.
+ */
+static bool
+tth_cache_copy(int fd, filesize_t *offset,
+	struct tth_cache_entry *e, void *buf)
+{
+	size_t size = TTH_RECORD_SIZE(e->nleaves);
+
+	if (!tth_cache_pack_read(buf, size, e->offset)) {
+		g_warning("%s(%s): cannot read record at offset %s",
+			G_STRFUNC, tth_base32(&e->root), filesize_to_string(e->offset));
+		return FALSE;
+	}
+
+	if (0 != memcmp(buf, e->root.data, TTH_RAW_SIZE)) {
+		g_warning("%s(%s): record mismatch at offset %s",
+			G_STRFUNC, tth_base32(&e->root), filesize_to_string(e->offset));
+		return FALSE;
+	}
+
+	if (size != UNSIGNED(compat_pwrite(fd, buf, size, *offset))) {
+		g_warning("%s(): cannot write compacted TTH cache: %m", G_STRFUNC);
+		return FALSE;
+	}
+
+	e->offset = *offset;
+	*offset += size;
+	return TRUE;
+}
+
+/**
+ * Compact the pack, only keeping entries referenced by shared files or
+ * created during this session.
+ *
+ * Records are copied to a new pack without holding the lock, and the
+ * changes made to the cache meanwhile are applied afterwards, before
+ * replacing the pack.
+ */
+static void
+tth_cache_compact(const hset_t *shared)
+{
+	struct tth_cache_entry *vec, *dvec = NULL, *final = NULL;
+	size_t count, dcnt, fcnt, i, n;
+	filesize_t snapshot, live, offset;
+	char header[TTH_PACK_HEADER];
+	char *path = NULL, *npath = NULL;
+	void *buf = NULL;
+	uint64 stamp;
+	int fd = -1;
+
+	TTH_CACHE_LOCK;
+	vec = tth_cache_entries(&count);
+	snapshot = tth_pack.size;
+	TTH_CACHE_UNLOCK;
+
+	if (-1 == tth_pack.fd)
+		goto done;
+
+	live = TTH_PACK_HEADER;
+
+	for (i = n = 0; i < count; i++) {
+		if (vec[i].fresh || hset_contains(shared, &vec[i].root)) {
+			live += TTH_RECORD_SIZE(vec[i].nleaves);
+			vec[n++] = vec[i];
+		}
+	}
+	count = n;
+
+	if (live >= snapshot || snapshot - live < snapshot / TTH_PACK_SLACK) {
+		if (debugging(0)) {
+			g_debug("%s(): %s of TTH cache pack used, not compacting",
+				G_STRFUNC, filesize_to_string(live));
+		}
+		goto done;
+	}
+
+	path = make_pathname(settings_config_dir(), TTH_PACK_FILE);
+	npath = h_strconcat(path, ".new", NULL_PTR);
+
+	fd = file_create(npath, O_RDWR | O_TRUNC, TTH_FILE_MODE);
+	if (-1 == fd)
+		goto done;
+
+	stamp = tth_cache_pack_header(header);
+	if (sizeof header != UNSIGNED(compat_pwrite(fd, ARYLEN(header), 0)))
+		goto failed;
+
+	buf = halloc(TTH_RECORD_MAX);
+	offset = sizeof header;
+
+	for (i = 0; i < count; i++) {
+		if (atomic_bool_get(&tth_pack.closing))
+			goto failed;
+		if (!tth_cache_copy(fd, &offset, &vec[i], buf))
+			goto failed;
+	}
+
+	/*
+	 * Apply changes made since the snapshot, which were all appended to
+	 * the pack, and swap the packs.
+	 */
+
+	TTH_CACHE_LOCK;
+
+	dvec = tth_cache_delta_entries(snapshot, &dcnt);
+
+	for (i = 0; i < dcnt; i++) {
+		if (0 != dvec[i].nleaves && !tth_cache_copy(fd, &offset, &dvec[i], buf))
+			goto unlock_failed;
+	}
+
+	if (0 != fd_fsync(fd)) {
+		g_warning("%s(): cannot flush %s: %m", G_STRFUNC, npath);
+		goto unlock_failed;
+	}
+
+	if (-1 == rename(npath, path)) {
+		g_warning("%s(): cannot rename %s as %s: %m", G_STRFUNC, npath, path);
+		goto unlock_failed;
+	}
+
+	final = tth_cache_merge(vec, count, dvec, dcnt, &fcnt);
+
+	if (debugging(0)) {
+		g_debug("%s(): compacted TTH cache pack from %s to %s bytes",
+			G_STRFUNC, filesize_to_string(tth_pack.size),
+			filesize_to_string2(offset));
+	}
+
+	tth_cache_pack_unmap();
+	fd_forget_and_close(&tth_pack.fd);
+	tth_pack.fd = fd;
+	tth_pack.size = offset;
+	tth_pack.stamp = stamp;
+	fd = -1;
+	tth_cache_pack_map();
+
+	tth_cache_index_unload();
+	tth_cache_index_write(final, fcnt);
+	(void) tth_cache_index_load();
+
+	/*
+	 * Keep the entries created during the session in the delta table
+	 * to remember they must survive subsequent compactions.
+	 */
+
+	tth_cache_delta_clear();
+
+	for (i = 0; i < fcnt; i++) {
+		if (final[i].fresh)
+			tth_cache_delta_set(&final[i].root, final[i].offset,
+				final[i].nleaves, TRUE);
+	}
+
+	TTH_CACHE_UNLOCK;
+	goto done;
+
+unlock_failed:
+	TTH_CACHE_UNLOCK;
+
+	/* FALL THROUGH */
+
+failed:
+	fd_forget_and_close(&fd);
+	if (-1 == unlink(npath))
+		g_warning("%s(): cannot unlink %s: %m", G_STRFUNC, npath);
+
+	/* FALL THROUGH */
+
+done:
+	HFREE_NULL(vec);
+	HFREE_NULL(dvec);
+	HFREE_NULL(final);
+	HFREE_NULL(buf);
+	HFREE_NULL(path);
+	HFREE_NULL(npath);
 }
 
 /**
@@ -414,24 +1320,10 @@ tth_cache_dir_rmdir(const char *path)
 	if (debugging(0))
 		g_message("%s(): removing TTH cache directory %s", G_STRFUNC, path);
 
-	/*
-	 * To avoid any conflicts with another thread attempting to create a
-	 * file under that directory, take a lock.
-	 *
-	 * Note that there is a race condition between the traversal that detects
-	 * the directory is empty and the time we actually attempt to remove it.
-	 * Hence, we silence any error having to deal with the directory being
-	 * non-empty and therefore non-removable.
-	 */
-
-	TTH_PATH_LOCK;
-
 	if (-1 == rmdir(path) && ENOTEMPTY != errno) {
 		g_warning("%s(): cannot remove TTH cache directory %s: %m",
 			G_STRFUNC, path);
 	}
-
-	TTH_PATH_UNLOCK;
 }
 
 
@@ -493,13 +1385,28 @@ tth_cache_file_remove(const char *path, const char *reason)
 }
 
 /**
- * ftw_foreach() callback to remove obsolete / spurious files.
+ * Context for the migration of the old cache directory.
+ */
+struct tth_cache_migrate {
+	const hset_t *shared;		/**< TTH of shared files */
+	struct tth *leaves;			/**< Buffer for reading leaves */
+	size_t migrated;			/**< Amount of migrated entries */
+};
+
+/**
+ * ftw_foreach() callback to move entries of shared files to the pack and
+ * remove all the old cached files.
  */
 static ftw_status_t
-tth_cache_cleanup_unlink(
-	const ftw_info_t *info, const filestat_t *sb, void *data)
+tth_cache_cleanup_migrate(
+	const ftw_info_t *info, const filestat_t *unused_sb, void *data)
 {
-	const hset_t *shared = data;
+	struct tth_cache_migrate *ctx = data;
+
+	(void) unused_sb;
+
+	if (atomic_bool_get(&tth_pack.closing))
+		return FTW_STATUS_CANCELLED;
 
 	if (FTW_F_DIR & info->flags)
 		return FTW_STATUS_OK;
@@ -513,7 +1420,7 @@ tth_cache_cleanup_unlink(
 		char **path;
 		struct tth tth;
 		char b32[TTH_BASE32_SIZE + 2];
-		size_t len;
+		size_t len, n;
 
 		if (FTW_F_NOSTAT & info->flags) {
 			g_warning("%s(): ignoring unaccessible cached TTH %s",
@@ -547,27 +1454,33 @@ tth_cache_cleanup_unlink(
 		/*
 		 * At this point, we have a valid TTH cache filename.
 		 *
-		 * We want to only process files created before the session started.
-		 *
-		 * The rationale is that users could start unsharing directories,
-		 * moving files around, add new files, etc..  Each time a new library
-		 * rescan occurs, we're going to create new TTH cache files, or some
-		 * cached files could become unused for a while and then files will
-		 * reappear in the library.
-		 *
-		 * By only ever cleaning up files created before the current session,
-		 * we have a higher likelyhood of processing an obsolete cache entry.
+		 * Entries which are still in use are moved to the pack, unless
+		 * they are already there.  Since the old directory is no longer
+		 * written to, all the files can then go.
 		 */
 
-		if (delta_time(sb->st_mtime, GNET_PROPERTY(session_start_stamp)) >= 0)
-			goto done;		/* Created after session started, skip */
+		if (hset_contains(ctx->shared, &tth)) {
+			struct tth_cache_entry e;
+			bool found;
+
+			TTH_CACHE_LOCK;
+			found = tth_cache_find(&tth, &e);
+			TTH_CACHE_UNLOCK;
 
-		if (!hset_contains(shared, &tth)) {
-			if (debugging(0))
-				g_debug("%s(): unshared TTH (%s)", G_STRFUNC, info->rpath);
-			(void) tth_cache_file_unlink(info->fpath, "unshared");
+			if (!found) {
+				n = tth_cache_file_get_leaves(&tth,
+						ctx->leaves, TTH_MAX_LEAVES);
+				if (n > 1) {
+					tth_cache_insert(&tth, ctx->leaves, n);
+					ctx->migrated++;
+				}
+			}
+		} else if (debugging(0)) {
+			g_debug("%s(): unshared TTH (%s)", G_STRFUNC, info->rpath);
 		}
 
+		(void) tth_cache_file_unlink(info->fpath, "migrated");
+
 		/* FALL THROUGH */
 
 	done:
@@ -579,42 +1492,41 @@ tth_cache_cleanup_unlink(
 	return FTW_STATUS_ERROR;
 }
 
-static int tth_cache_cleanups;
-
 /**
- * Main entry point for the thread that cleans up the TTH cache.
+ * Move entries from the old cache directory to the pack, then remove it.
  */
-static void *
-tth_cache_cleanup_thread(void *unused_arg)
+static void
+tth_cache_migrate(const char *rootdir, const hset_t *shared)
 {
-	hset_t *shared;
-	const char *rootdir = tth_cache_directory();
+	struct tth_cache_migrate ctx;
 	pslist_t *dirstack;
 	uint32 flags;
 	ftw_status_t res;
 
-	(void) unused_arg;
-
-	if (!is_directory(rootdir))
-		goto done;			/* No TTH cache */
-
 	/*
-	 * First pass: spot all file entries that are older than our start
-	 * time (i.e. were created in another session) and which cannot be
-	 * associated with a shared file.
+	 * First pass: move the entries of shared files to the pack, and
+	 * remove all the files.
 	 */
 
-	shared = share_tthset_get();
+	ZERO(&ctx);
+	ctx.shared = shared;
+	HALLOC_ARRAY(ctx.leaves, TTH_MAX_LEAVES);
+
 	flags = FTW_O_PHYS | FTW_O_MOUNT | FTW_O_ALL;
-	res = ftw_foreach(rootdir, flags, 0, tth_cache_cleanup_unlink, shared);
-	share_tthset_free(shared);
+	res = ftw_foreach(rootdir, flags, 0, tth_cache_cleanup_migrate, &ctx);
+	HFREE_NULL(ctx.leaves);
 
 	if (res != FTW_STATUS_OK) {
-		g_warning("%s(): initial traversal failed with %d, aborting",
-			G_STRFUNC, res);
-		goto done;
+		if (res != FTW_STATUS_CANCELLED) {
+			g_warning("%s(): initial traversal failed with %d, aborting",
+				G_STRFUNC, res);
+		}
+		return;
 	}
 
+	if (0 != ctx.migrated)
+		g_message("moved %zu TTH cache entries to pack", ctx.migrated);
+
 	/*
 	 * Second pass: spot empty directories and remove them.
 	 */
@@ -624,9 +1536,34 @@ tth_cache_cleanup_thread(void *unused_arg)
 	(void) ftw_foreach(rootdir, flags, 0, tth_cache_cleanup_rmdir, &dirstack);
 	pslist_free(dirstack);
 
-	/* FALL THROUGH */
+	tth_cache_dir_rmdir(rootdir);
 
-done:
+	if (!is_directory(rootdir))
+		atomic_bool_set(&tth_pack.legacy, FALSE);
+}
+
+static int tth_cache_cleanups;
+
+/**
+ * Main entry point for the thread that cleans up the TTH cache.
+ */
+static void *
+tth_cache_cleanup_thread(void *unused_arg)
+{
+	hset_t *shared;
+	const char *rootdir = tth_cache_directory();
+
+	(void) unused_arg;
+
+	shared = share_tthset_get();
+
+	if (atomic_bool_get(&tth_pack.legacy) && is_directory(rootdir))
+		tth_cache_migrate(rootdir, shared);
+
+	if (!atomic_bool_get(&tth_pack.closing))
+		tth_cache_compact(shared);
+
+	share_tthset_free(shared);
 	atomic_int_dec(&tth_cache_cleanups);
 	return NULL;
 }
@@ -648,16 +1585,55 @@ tth_cache_cleanup(void)
 	}
 }
 
+/**
+ * Open the TTH cache pack and load its index.
+ */
 void
 tth_cache_init(void)
 {
-	/* NOTHING */
+	filesize_t covered;
+
+	tth_pack.delta = hikset_create(
+		offsetof(struct tth_cache_entry, root), HASH_KEY_FIXED, TTH_RAW_SIZE);
+	tth_pack.legacy = is_directory(tth_cache_directory());
+
+	tth_pack.fd = tth_cache_pack_open();
+	if (-1 == tth_pack.fd)
+		return;
+
+	covered = tth_cache_index_load();
+	tth_cache_pack_scan(covered);
+	tth_cache_pack_map();
 }
 
+/**
+ * Close the TTH cache, writing the index for the current pack if needed.
+ */
 void
 tth_cache_close(void)
 {
-	/* NOTHING */
+	atomic_bool_set(&tth_pack.closing, TRUE);
+
+	while (0 != atomic_int_get(&tth_cache_cleanups))
+		thread_sleep_ms(100);		/* Wait for cleanup thread to abort */
+
+	if (NULL == tth_pack.delta)
+		return;
+
+	if (tth_pack.fd != -1 && 0 != hikset_count(tth_pack.delta)) {
+		struct tth_cache_entry *vec;
+		size_t count;
+
+		vec = tth_cache_entries(&count);
+		tth_cache_index_write(vec, count);
+		HFREE_NULL(vec);
+	}
+
+	tth_cache_pack_unmap();
+	tth_cache_index_unload();
+	fd_forget_and_close(&tth_pack.fd);
+	tth_cache_delta_clear();
+	hikset_free_null(&tth_pack.delta);
 }
 
 /* vi: set ts=4 sw=4 cindent: */
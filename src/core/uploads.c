@@ -478,7 +478,8 @@ use_sendfile(struct upload *u)
 {
 	upload_check(u);
 #if defined(HAS_MMAP) || defined(HAS_SENDFILE)
-	return !sendfile_failed && !socket_uses_tls(u->socket);
+	return !sendfile_failed &&
+		(!socket_uses_tls(u->socket) || socket_uses_kernel_tls(u->socket));
 #else
 	return FALSE;
 #endif /* USE_MMAP || HAS_SENDFILE */
@@ -1607,6 +1608,7 @@ upload_free_resources(struct upload *u)
 
 	atom_str_free_null(&u->name);
 	file_object_close(&u->file);
+	browse_host_snapshot_release(&u->bh_snapshot);
 
 #ifdef HAS_MMAP
 	if (u->sendfile_ctx.map) {
@@ -1691,6 +1693,7 @@ upload_clone(struct upload *u)
 	cu->bio = NULL;						/* Recreated on each transfer */
 	cu->sf = NULL;						/* File re-opened each time */
 	cu->file = NULL;					/* File re-opened each time */
+	cu->bh_snapshot = NULL;				/* Released by the parent upload */
 	cu->sendfile_ctx.map = NULL;		/* File re-opened each time */
 	cu->accounted = FALSE;
 	cu->browse_host = FALSE;
@@ -4707,7 +4710,7 @@ upload_http_status_sent(struct upload *u)
 	u->start_date = u->last_update;		/* We're really starting to send now */
 	upload_fire_upload_info_changed(u);	/* Update GUI for the send starting time */
 
-	if (upload_is_special(u)) {
+	if (upload_is_special(u) && NULL == u->bh_snapshot) {
 		gnet_host_t peer;
 
 		gnet_host_set(&peer, u->socket->addr, u->socket->port);
@@ -4767,7 +4770,10 @@ upload_http_status_sent(struct upload *u)
 		if (0 != u->bw_cap)
 			u->bw_cap = bio_set_cap(u->bio, u->bw_cap);
 
-		upload_stats_file_begin(u->sf);
+		if (u->bh_snapshot != NULL)
+			browse_host_snapshot_sending(u->bh_snapshot);
+		else
+			upload_stats_file_begin(u->sf);
 	}
 }
 
@@ -5622,6 +5628,38 @@ upload_handle_connection_header(struct upload *u, header_t *header)
 	}
 }
 
+/**
+ * Attempt to serve a browse host request from the pre-computed snapshot
+ * of our library, for the specified browse host flags.
+ *
+ * @return TRUE if the snapshot file was opened and will be sent.
+ */
+static bool
+upload_browse_snapshot(struct upload *u, int flags)
+{
+	struct bh_snapshot *bs;
+
+	g_assert(NULL == u->bh_snapshot);
+	g_assert(NULL == u->file);
+
+	bs = browse_host_snapshot_get(flags);
+	if (NULL == bs)
+		return FALSE;
+
+	u->file = file_object_open(browse_host_snapshot_path(bs), O_RDONLY);
+	if (NULL == u->file) {
+		browse_host_snapshot_release(&bs);
+		return FALSE;
+	}
+
+	u->bh_snapshot = bs;
+	u->file_size = browse_host_snapshot_size(bs);
+
+	g_assert(u->file_size != 0);	/* A deflated stream is never empty */
+
+	return TRUE;
+}
+
 /**
  * Handle request for special uploads.
  *
@@ -5643,22 +5681,6 @@ upload_request_special(struct upload *u, const header_t *header)
 		const char *buf;
 		char name[1024];
 
-		if (supports_chunked(u, header)) {
-			flags |= BH_F_CHUNKED;
-			if (!u->head_only) {
-				upload_http_extra_line_add(u,
-					"Transfer-Encoding: chunked\r\n");
-			}
-		} else {
-			/*
-			 * If browsing our host with a client that cannot allow chunked
-			 * transmission encoding, we have no choice but to indicate the
-			 * end of the transmission with EOF since we don't want to
-			 * compute the length of the data in advance.
-			 */
-			u->keep_alive = FALSE;
-		}
-
 		/*
 		 * Look at an Accept: line with "application/x-gnutella-packets".
 		 * If we get that, then we can send query hits backs.  Otherwise,
@@ -5713,6 +5735,35 @@ upload_request_special(struct upload *u, const header_t *header)
 			upload_http_extra_line_add(u, content_encoding);
 		}
 
+		if (upload_browse_snapshot(u, flags)) {
+			/*
+			 * We have a pre-computed deflated snapshot of our library
+			 * for this format: its length is known and it will be sent
+			 * as a plain file, so there is no need for chunking.
+			 */
+
+			u->pos = 0;
+			u->skip = 0;
+			u->end = u->file_size - 1;
+			u->cb_length_arg.u = u;
+			upload_http_extra_prio_callback_add(u,
+				upload_http_content_length_add, &u->cb_length_arg);
+		} else if (supports_chunked(u, header)) {
+			flags |= BH_F_CHUNKED;
+			if (!u->head_only) {
+				upload_http_extra_line_add(u,
+					"Transfer-Encoding: chunked\r\n");
+			}
+		} else {
+			/*
+			 * If browsing our host with a client that cannot allow chunked
+			 * transmission encoding, we have no choice but to indicate the
+			 * end of the transmission with EOF since we don't want to
+			 * compute the length of the data in advance.
+			 */
+			u->keep_alive = FALSE;
+		}
+
 		str_bprintf(ARYLEN(name),
 				_("<Browse Host %sRequest> [%s%s%s]"),
 				(flags & BH_F_G2) ? "G2 " : "",
@@ -6726,6 +6777,8 @@ upload_writable(void *obj, int unused_source, inputevt_cond_t cond)
 		if (u->sf) {
 			upload_stats_file_complete(u->sf, u->end - u->skip + 1);
 			u->accounted = TRUE;	/* Called upload_stats_file_complete() */
+		} else if (u->bh_snapshot != NULL) {
+			browse_host_snapshot_served(u->bh_snapshot);
 		}
 		upload_completed(u);
 	}
@@ -75,6 +75,7 @@ struct upload {
 	struct file_object *file;		/**< uploaded file */
 	struct dl_file_info *file_info;	/**< For PFSP: only set when partial file */
 	struct special_upload *special;	/**< For special ops like browsing */
+	struct bh_snapshot *bh_snapshot;/**< Browse Host snapshot we're sending */
 	const char *name;
 	const struct sha1 *sha1;		/**< SHA1 of requested file */
 	struct shared_file *thex;		/**< THEX owner we're uploading */
@@ -27,6 +27,11 @@
  *
  * Tigertree hash verification.
  *
+ * Large files are hashed in parallel: the data read sequentially by the
+ * verification thread is handed over by chunks to a pool of workers that
+ * compute the roots of the file segments, which are then combined into
+ * the leaves and root of the tree.
+ *
  * @author Jeroen Asselman
  * @date 2003
  */
@@ -42,19 +47,49 @@
 #include "if/gnet_property_priv.h"
 
 #include "lib/base32.h"
+#include "lib/getcpucount.h"
 #include "lib/halloc.h"
 #include "lib/once.h"
+#include "lib/semaphore.h"
 #include "lib/stringify.h"
 #include "lib/tiger.h"
 #include "lib/tigertree.h"
 #include "lib/tm.h"
+#include "lib/walloc.h"
+#include "lib/workpool.h"
 
 #include "lib/override.h"		/* Must be the last inclusion */
 
+#define VERIFY_TTH_PARALLEL_MIN	(64 * 1024 * 1024)	/**< Min size for workers */
+#define VERIFY_TTH_THREADS		4			/**< Max threads hashing segments */
+#define VERIFY_TTH_CHUNK		TTH_SEGMENT_MAX	/**< Data handed to a worker */
+#define VERIFY_TTH_INFLIGHT		(2 * VERIFY_TTH_THREADS)	/**< Max chunks */
+
+/**
+ * A chunk of file data, whose segment roots are computed by a worker.
+ */
+struct verify_tth_chunk {
+	char *data;					/**< VERIFY_TTH_CHUNK bytes */
+	size_t len;					/**< Amount of data held */
+	filesize_t seg_size;		/**< Size of segments */
+	struct tth *dst;			/**< Where segment roots are written */
+};
+
 static struct {
 	struct verify	*verify;
 	TTH_CONTEXT		*context;
 	struct tth		digest;
+	workpool_t		*pool;			/**< Segment hashers, NULL if none */
+	semaphore_t		*inflight;		/**< Tokens for chunks being hashed */
+	bool			parallel;		/**< Current file hashed by workers */
+	filesize_t		size;			/**< Size of current file */
+	filesize_t		seg_size;		/**< Segment size for current file */
+	struct tth		*nodes;			/**< Segment roots, in file order */
+	size_t			n_nodes;		/**< Amount of segments in file */
+	size_t			next_node;		/**< First segment of current chunk */
+	struct verify_tth_chunk *chunk;	/**< Chunk being filled */
+	struct tth		*leaves;		/**< Leaves, when hashed by workers */
+	size_t			n_leaves;		/**< Amount of leaves */
 } verify_tth;
 
 static const char *
@@ -63,20 +98,153 @@ verify_tth_name(void)
 	return "TTH";
 }
 
+/**
+ * Grab tokens from the semaphore limiting the amount of chunks in flight.
+ */
+static void
+verify_tth_acquire(int amount)
+{
+	while (!semaphore_acquire(verify_tth.inflight, amount, NULL)) {
+		if (EINTR != errno)
+			s_error("%s(): cannot acquire semaphore: %m", G_STRFUNC);
+	}
+}
+
+/**
+ * Wait until all the chunks submitted to workers have been hashed.
+ */
+static void
+verify_tth_drain(void)
+{
+	if (NULL == verify_tth.pool)
+		return;
+
+	verify_tth_acquire(VERIFY_TTH_INFLIGHT);
+	semaphore_release(verify_tth.inflight, VERIFY_TTH_INFLIGHT);
+}
+
+/**
+ * Compute the segment roots of a chunk, in a worker thread.
+ */
+static void
+verify_tth_chunk_hash(void *arg)
+{
+	struct verify_tth_chunk *c = arg;
+	size_t i, offset;
+
+	for (i = 0, offset = 0; offset < c->len; i++, offset += c->seg_size) {
+		c->dst[i] = tt_segment_hash(&c->data[offset],
+			MIN(c->seg_size, c->len - offset));
+	}
+
+	HFREE_NULL(c->data);
+	WFREE(c);
+	semaphore_release(verify_tth.inflight, 1);
+}
+
+/**
+ * Discard the chunk being filled, if any, giving back its token.
+ */
+static void
+verify_tth_chunk_discard(void)
+{
+	struct verify_tth_chunk *c = verify_tth.chunk;
+
+	if (NULL == c)
+		return;
+
+	HFREE_NULL(c->data);
+	WFREE_TYPE_NULL(verify_tth.chunk);
+	semaphore_release(verify_tth.inflight, 1);
+}
+
+/**
+ * Hand over the chunk being filled to the workers.
+ */
+static void
+verify_tth_chunk_submit(void)
+{
+	struct verify_tth_chunk *c = verify_tth.chunk;
+	size_t n;
+
+	g_assert(c != NULL);
+	g_assert(c->len != 0);
+
+	n = (c->len + c->seg_size - 1) / c->seg_size;
+
+	g_assert(verify_tth.next_node + n <= verify_tth.n_nodes);
+
+	c->dst = &verify_tth.nodes[verify_tth.next_node];
+	verify_tth.next_node += n;
+	verify_tth.chunk = NULL;
+
+	workpool_submit(verify_tth.pool, verify_tth_chunk_hash, NULL, c);
+}
+
 static void
 verify_tth_reset(filesize_t size)
 {
-	if G_LIKELY(verify_tth.context != NULL)
+	if G_UNLIKELY(NULL == verify_tth.context)
+		return;
+
+	/*
+	 * Chunks of a previous file whose hashing was aborted may still be
+	 * processed by the workers, and they write to the nodes array.
+	 */
+
+	verify_tth_chunk_discard();
+	verify_tth_drain();
+	HFREE_NULL(verify_tth.nodes);
+
+	verify_tth.size = size;
+	verify_tth.parallel =
+		verify_tth.pool != NULL && size >= VERIFY_TTH_PARALLEL_MIN;
+
+	if (verify_tth.parallel) {
+		verify_tth.seg_size = tt_segment_size(size);
+		verify_tth.n_nodes = tt_segment_count(size);
+		verify_tth.next_node = 0;
+		HALLOC_ARRAY(verify_tth.nodes, verify_tth.n_nodes);
+	} else {
 		tt_init(verify_tth.context, size);
+	}
 }
 
 static int
 verify_tth_update(const void *data, size_t size)
 {
+	const char *p = data;
+
 	if G_UNLIKELY(NULL == verify_tth.context)
 		return -1;
 
-	tt_update(verify_tth.context, data, size);
+	if (!verify_tth.parallel) {
+		tt_update(verify_tth.context, data, size);
+		return 0;
+	}
+
+	while (size != 0) {
+		struct verify_tth_chunk *c = verify_tth.chunk;
+		size_t n;
+
+		if (NULL == c) {
+			verify_tth_acquire(1);
+			WALLOC0(c);
+			c->data = halloc(VERIFY_TTH_CHUNK);
+			c->seg_size = verify_tth.seg_size;
+			verify_tth.chunk = c;
+		}
+
+		n = MIN(size, VERIFY_TTH_CHUNK - c->len);
+		memcpy(&c->data[c->len], p, n);
+		c->len += n;
+		p += n;
+		size -= n;
+
+		if (VERIFY_TTH_CHUNK == c->len)
+			verify_tth_chunk_submit();
+	}
+
 	return 0;
 }
 
@@ -86,7 +254,24 @@ verify_tth_final(void)
 	if G_UNLIKELY(NULL == verify_tth.context)
 		return -1;
 
-	tt_digest(verify_tth.context, &verify_tth.digest);
+	if (!verify_tth.parallel) {
+		tt_digest(verify_tth.context, &verify_tth.digest);
+		return 0;
+	}
+
+	if (verify_tth.chunk != NULL)
+		verify_tth_chunk_submit();
+
+	verify_tth_drain();
+
+	if (verify_tth.next_node != verify_tth.n_nodes)
+		return -1;
+
+	verify_tth.n_leaves = tt_segment_leaves(verify_tth.leaves,
+		verify_tth.nodes, verify_tth.n_nodes, verify_tth.size);
+	verify_tth.digest = tt_root_hash(verify_tth.leaves, verify_tth.n_leaves);
+	HFREE_NULL(verify_tth.nodes);
+
 	return 0;
 }
 
@@ -108,6 +293,10 @@ const struct tth *
 verify_tth_leaves(const struct verify *ctx)
 {
 	g_return_val_if_fail(verify_status(ctx) == VERIFY_DONE, NULL);
+
+	if (verify_tth.parallel)
+		return verify_tth.leaves;
+
 	return tt_leaves(verify_tth.context);
 }
 
@@ -115,14 +304,34 @@ size_t
 verify_tth_leave_count(const struct verify *ctx)
 {
 	g_return_val_if_fail(verify_status(ctx) == VERIFY_DONE, 0);
+
+	if (verify_tth.parallel)
+		return verify_tth.n_leaves;
+
 	return tt_leave_count(verify_tth.context);
 }
 
 static void G_COLD
 verify_tth_init_once(void)
 {
+	long cpus = getcpucount();
+
 	verify_tth.context = halloc(tt_size());
 	verify_tth.verify = verify_new(&verify_hash_tth);
+
+	/*
+	 * Leave one CPU to the verification thread, which reads the data.
+	 */
+
+	if (cpus > 1) {
+		verify_tth.pool = workpool_make("TTH hasher",
+			MIN(cpus - 1, VERIFY_TTH_THREADS));
+	}
+
+	if (verify_tth.pool != NULL) {
+		verify_tth.inflight = semaphore_create(VERIFY_TTH_INFLIGHT);
+		HALLOC_ARRAY(verify_tth.leaves, TTH_MAX_LEAVES);
+	}
 }
 
 void G_COLD
@@ -158,6 +367,12 @@ verify_tth_shutdown(void)
 void G_COLD
 verify_tth_close(void)
 {
+	workpool_free_null(&verify_tth.pool);	/* Waits for pending chunks */
+	verify_tth_chunk_discard();
+	semaphore_destroy(&verify_tth.inflight);
+
+	HFREE_NULL(verify_tth.nodes);
+	HFREE_NULL(verify_tth.leaves);
 	HFREE_NULL(verify_tth.context);
 }
 
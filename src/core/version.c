@@ -47,6 +47,7 @@
 
 #include "lib/ascii.h"
 #include "lib/base16.h"
+#include "lib/buf.h"
 #include "lib/getdate.h"
 #include "lib/log.h"
 #include "lib/misc.h"
@@ -124,63 +125,65 @@ version_dump(const char *str, const version_t *ver, const char *cmptag)
 
 /**
  * @return a user-friendly description of the extended version.
- * NB: returns pointer to static data.
+ * NB: returns pointer to thread-private data.
  */
 const char *
 version_ext_str(const version_ext_t *vext, bool full)
 {
-	static char str[120];
+	buf_t *b = buf_private(G_STRFUNC, 120);
+	char *str = buf_data(b);
+	size_t len = buf_size(b);
 	const version_t *ver = &vext->version;
 	int rw;
 	bool has_extra = FALSE;
 	bool need_closing = FALSE;
 
-	rw = str_bprintf(ARYLEN(str), "%u.%u", ver->major, ver->minor);
+	rw = str_bprintf(str, len, "%u.%u", ver->major, ver->minor);
 
 	if (ver->patchlevel)
-		rw += str_bprintf(ARYPOSLEN(str, rw), ".%u", ver->patchlevel);
+		rw += str_bprintf(&str[rw], len - rw, ".%u", ver->patchlevel);
 
 	if (ver->tag) {
-		rw += str_bprintf(ARYPOSLEN(str, rw), "%c", ver->tag);
+		rw += str_bprintf(&str[rw], len - rw, "%c", ver->tag);
 		if (ver->taglevel)
-			rw += str_bprintf(ARYPOSLEN(str, rw), "%u", ver->taglevel);
+			rw += str_bprintf(&str[rw], len - rw, "%u", ver->taglevel);
 	}
 
 	if (ver->build)
-		rw += str_bprintf(ARYPOSLEN(str, rw), "-%u", ver->build);
+		rw += str_bprintf(&str[rw], len - rw, "-%u", ver->build);
 
 	if (vext->commit_len != 0) {
-		static char digest[SHA1_BASE16_SIZE + 1];
+		char digest[SHA1_BASE16_SIZE + 1];
 		size_t offset = MIN(vext->commit_len, SHA1_BASE16_SIZE);
 
 		sha1_to_base16_buf(&vext->commit, ARYLEN(digest));
 		digest[offset] = '\0';
-		rw += str_bprintf(ARYPOSLEN(str, rw), "-g%s", digest);
+		rw += str_bprintf(&str[rw], len - rw, "-g%s", digest);
 	}
 
 	if (vext->dirty)
-		rw += str_bprintf(ARYPOSLEN(str, rw), "-dirty");
+		rw += str_bprintf(&str[rw], len - rw, "-dirty");
 
 	if (ver->timestamp || (full && vext->osname != NULL)) {
-		rw += str_bprintf(ARYPOSLEN(str, rw), " (");
+		rw += str_bprintf(&str[rw], len - rw, " (");
 		need_closing = TRUE;
 	}
 
 	if (ver->timestamp) {
 		struct tm *tmp = localtime(&ver->timestamp);
-		rw += str_bprintf(ARYPOSLEN(str, rw), "%d-%02d-%02d",
+		rw += str_bprintf(&str[rw], len - rw, "%d-%02d-%02d",
 			tmp->tm_year + 1900, tmp->tm_mon + 1, tmp->tm_mday);
 		has_extra = TRUE;
 	}
 
 	if (full && vext->osname != NULL) {
 		if (has_extra)
-			rw += str_bprintf(ARYPOSLEN(str, rw), "; ");
-		rw += str_bprintf(ARYPOSLEN(str, rw), "%s", vext->osname);
+			rw += str_bprintf(&str[rw], len - rw, "; ");
+		rw += str_bprintf(&str[rw], len - rw, "%s", vext->osname);
 	}
 
 	if (need_closing)
-		rw += str_bprintf(ARYPOSLEN(str, rw), ")");
+		rw += str_bprintf(&str[rw], len - rw, ")");
 
 	return str;
 }
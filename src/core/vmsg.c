@@ -70,13 +70,13 @@
 #include "lib/atoms.h"
 #include "lib/base16.h"
 #include "lib/endian.h"
-#include "lib/hashing.h"
 #include "lib/hashlist.h"
 #include "lib/hset.h"
 #include "lib/mempcpy.h"
 #include "lib/misc.h"			/* hexadecimal conversions */
 #include "lib/nid.h"
 #include "lib/patricia.h"
+#include "lib/phash.h"
 #include "lib/pmsg.h"
 #include "lib/random.h"
 #include "lib/str.h"
@@ -86,6 +86,7 @@
 #include "lib/urn.h"
 #include "lib/vendors.h"
 #include "lib/walloc.h"
+#include "lib/xmalloc.h"
 
 #include "lib/override.h"	/* Must be the last header included */
 
@@ -97,8 +98,6 @@ static gnutella_vendor_t *v_tmp_data = (void *) &v_tmp[GTA_HEADER_SIZE];
 #define VMSG_PAYLOAD_MAX \
 	((sizeof v_tmp) - GTA_HEADER_SIZE - sizeof(gnutella_vendor_t))
 
-static hset_t *hs_vmsg;
-
 /*
  * Vendor message handler.
  */
@@ -141,25 +140,20 @@ vmsg_pmsg_info_check(const struct vmsg_pmsg_info * const pmi)
 	g_assert(VMSG_PMI_MAGIC == pmi->magic);
 }
 
-static uint
-vmsg_hash_func(const void *key)
-{
-	const struct vmsg *vmsg = key;
-	return u32_hash(vmsg->vendor) ^ u16_hash(vmsg->id);
-}
-
-static uint
-vmsg_hash_func2(const void *key)
-{
-	const struct vmsg *vmsg = key;
-	return u32_hash2(vmsg->vendor) ^ u16_hash2(vmsg->id);
-}
+/*
+ * Known vendor messages are looked up through a perfect hash table keyed
+ * by vendor code and selector, which gives an index in vmsg_known[].
+ */
+static phash_t vmsg_phash;
+static const struct vmsg **vmsg_known;
 
-static bool
-vmsg_eq_func(const void *p, const void *q)
+/**
+ * @return the perfect hash key for the vendor message.
+ */
+static inline uint64
+vmsg_key(uint32 vendor, uint16 id)
 {
-	const struct vmsg *a = p, *b = q;
-	return a->vendor == b->vendor && a->id == b->id;
+	return (uint64) vendor << 16 | id;
 }
 
 /**
@@ -176,19 +170,20 @@ static bool
 find_message(struct vmsg *vmsg_ptr,
 	vendor_code_t vc, uint16 id, uint16 version)
 {
-	struct vmsg key, *value;
+	const struct vmsg *value;
+	size_t i;
 
-	key.vendor = vc.u32;
-	key.id = id;
+	i = phash_lookup(&vmsg_phash, vmsg_key(vc.u32, id));
+	if G_UNLIKELY(PHASH_NONE == i)
+		return FALSE;
 
-	value = hset_lookup(hs_vmsg, &key);
-	if (value) {
-		*vmsg_ptr = *value;
-		vmsg_ptr->version = version;
-		return TRUE;
-	} else {
+	value = vmsg_known[i];
+	if G_UNLIKELY(value->vendor != vc.u32 || value->id != id)
 		return FALSE;
-	}
+
+	*vmsg_ptr = *value;
+	vmsg_ptr->version = version;
+	return TRUE;
 }
 
 /**
@@ -3578,17 +3573,30 @@ vmsg_close_weight(void)
 void G_COLD
 vmsg_init(void)
 {
-	size_t i;
+	size_t i, n;
 	char data[VMSG_TYPE_LEN];
 	gnutella_vendor_t *weight_key = (void *) data;
+	uint64 keys[N_ITEMS(vmsg_map)];
 
 	vmsg_init_weight();
 
-	hs_vmsg = hset_create_any(vmsg_hash_func, vmsg_hash_func2, vmsg_eq_func);
+	XMALLOC_ARRAY(vmsg_known, N_ITEMS(vmsg_map));
 
-	for (i = 0; i < N_ITEMS(vmsg_map); i++) {
-		const void *key = &vmsg_map[i];
-		hset_insert(hs_vmsg, key);
+	for (i = n = 0; i < N_ITEMS(vmsg_map); i++) {
+		const struct vmsg *vm = &vmsg_map[i];
+
+		/*
+		 * Messages are identified by vendor and selector only: all the
+		 * versions of a message share the same handler and the map being
+		 * sorted, we only need to keep the first entry.
+		 */
+
+		if (0 == n || vmsg_known[n - 1]->vendor != vm->vendor ||
+			vmsg_known[n - 1]->id != vm->id
+		) {
+			vmsg_known[n] = vm;
+			keys[n++] = vmsg_key(vm->vendor, vm->id);
+		}
 
 		gnutella_vendor_set_code(weight_key, vmsg_map[i].vendor);
 		gnutella_vendor_set_selector_id(weight_key, vmsg_map[i].id);
@@ -3600,6 +3608,9 @@ vmsg_init(void)
 		}
 	}
 
+	if (!phash_build(&vmsg_phash, keys, n))
+		g_error("%s(): duplicate entries in vmsg_map[]", G_STRFUNC);
+
 	head_pings = hash_list_new(guid_hash, guid_eq);
 	head_ping_ev = cq_main_insert(HEAD_PING_PERIODIC_MS, head_ping_timer, NULL);
 }
@@ -3611,7 +3622,8 @@ vmsg_close(void)
 	head_ping_expire(TRUE);
 	hash_list_free(&head_pings);
 	cq_cancel(&head_ping_ev);
-	hset_free_null(&hs_vmsg);
+	phash_free(&vmsg_phash);
+	XFREE_NULL(vmsg_known);
 }
 
 /* vi: set ts=4 sw=4 cindent: */
@@ -25,6 +25,7 @@
 #ifndef _if_core_downloads_h_
 #define _if_core_downloads_h_
 
+#include "lib/erbtree.h"
 #include "lib/event.h"			/* For frequency_t */
 #include "lib/hashlist.h"
 #include "lib/htable.h"
@@ -100,6 +101,9 @@ struct dl_server {
 	time_t retry_after;		/**< Time at which we may retry from this host */
 	time_t dns_lookup;		/**< Last DNS lookup for hostname */
 	time_t last_connect;	/**< When we last connected to that server */
+	time_t sched_time;		/**< When server is next eligible for scheduling */
+	time_t sched_defer;		/**< Do not consider server before that time */
+	rbnode_t sched;			/**< Embedded node in scheduling tree */
 	struct vernum parq_version; /**< Supported queueing version */
 	uint speed_avg;			/**< Average (EMA) upload speed, in bytes/sec */
 	unsigned latency;		/**< HTTP latency, in ms (EMA) */
@@ -328,6 +332,7 @@ enum {
  * Server attributes.
  */
 enum {
+	DLS_A_SCHEDULED		= 1 << 20,	/**< Server in scheduling tree */
 	DLS_A_NO_TLS_UPGRD	= 1 << 19,	/**< Server cannot handle TLS upgrades */
 	DLS_A_PIPELINING	= 1 << 18,	/**< Server known to support pipelining */
 	DLS_A_NO_PIPELINE	= 1 << 17,	/**< Server chokes when pipelining */
@@ -1,5 +1,5 @@
 /*
- * Generated on Sat Apr  5 12:09:15 2014 by enum-msg.pl -- DO NOT EDIT
+ * Generated on Sun Oct 18 12:16:20 2026 by enum-msg.pl -- DO NOT EDIT
  *
  * Command: ../../../scripts/enum-msg.pl msg.lst
  */
@@ -54,6 +54,8 @@ typedef enum {
 	MSG_TYPE_COUNT
 } msg_type_t;
 
+const char *gnet_msg_type_name(msg_type_t x);
+
 const char *gnet_msg_type_description(msg_type_t x);
 
 #endif /* _if_gen_msg_h_ */
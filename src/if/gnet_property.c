@@ -1136,6 +1136,12 @@ gboolean gnet_property_variable_send_oob_ind_reliably     = TRUE;
 static const gboolean gnet_property_variable_send_oob_ind_reliably_default = TRUE;
 guint32  gnet_property_variable_adns_debug     = 0;
 static const guint32  gnet_property_variable_adns_debug_default = 0;
+gboolean gnet_property_variable_tls_kernel_offload     = FALSE;
+static const gboolean gnet_property_variable_tls_kernel_offload_default = FALSE;
+gboolean gnet_property_variable_vmm_huge_pages     = TRUE;
+static const gboolean gnet_property_variable_vmm_huge_pages_default = TRUE;
+guint32  gnet_property_variable_io_reactors     = 1;
+static const guint32  gnet_property_variable_io_reactors_default = 1;
 
 static prop_set_t *gnet_property;
 
@@ -8379,7 +8385,7 @@ gnet_prop_init(void) {
      * General data:
      */
     gnet_property->props[343].name = "spam_lut_in_memory";
-    gnet_property->props[343].desc = _("If TRUE, the spam SHA1 database is kept in memory. If FALSE, it is kept in a fast disk database, which saves a large amount of core memory and reduces the overall footprint, at the cost of an increased I/O level. However, the DB cache has a 90 percent hit rate, so the actual overhead is barely noticeable when running as an ultra node and should remain completely unnoticed when running as a leaf.");
+    gnet_property->props[343].desc = _("Obsolete, no longer used: the spam SHA1 table is now always kept in memory as a sorted array, which is more compact than the former disk database.");
     gnet_property->props[343].ev_changed = event_new("spam_lut_in_memory_changed");
     gnet_property->props[343].save = TRUE;
     gnet_property->props[343].internal = FALSE;
@@ -8508,7 +8514,7 @@ gnet_prop_init(void) {
      * General data:
      */
     gnet_property->props[349].name = "zalloc_always_gc";
-    gnet_property->props[349].desc = _("Whether the zone-based memory allocator should always keep the zones in garbage-collecting mode, thereby maximizing the chances of being able to quickly reclaim empty zones after an allocation burst. This causes a slight CPU overhead at block free time but the memory footprint will remain much lower. To further minimize the footprint, you can also set spam_lut_in_memory to FALSE.");
+    gnet_property->props[349].desc = _("Whether the zone-based memory allocator should always keep the zones in garbage-collecting mode, thereby maximizing the chances of being able to quickly reclaim empty zones after an allocation burst. This causes a slight CPU overhead at block free time but the memory footprint will remain much lower. To further minimize the footprint, you can also set dht_storage_in_memory to FALSE.");
     gnet_property->props[349].ev_changed = event_new("zalloc_always_gc_changed");
     gnet_property->props[349].save = TRUE;
     gnet_property->props[349].internal = FALSE;
@@ -11442,6 +11448,66 @@ gnet_prop_init(void) {
     gnet_property->props[489].data.guint32.max   = 20;
     gnet_property->props[489].data.guint32.min   = 0;
 
+
+    /*
+     * PROP_TLS_KERNEL_OFFLOAD:
+     *
+     * General data:
+     */
+    gnet_property->props[490].name = "tls_kernel_offload";
+    gnet_property->props[490].desc = _("Whether TLS record encryption of sent data should be offloaded to the kernel (kTLS) when supported, which lets TLS uploads use sendfile().");
+    gnet_property->props[490].ev_changed = event_new("tls_kernel_offload_changed");
+    gnet_property->props[490].save = TRUE;
+    gnet_property->props[490].internal = FALSE;
+    gnet_property->props[490].vector_size = 1;
+	mutex_init(&gnet_property->props[490].lock);
+
+    /* Type specific data: */
+    gnet_property->props[490].type               = PROP_TYPE_BOOLEAN;
+    gnet_property->props[490].data.boolean.def   = (void *) &gnet_property_variable_tls_kernel_offload_default;
+    gnet_property->props[490].data.boolean.value = (void *) &gnet_property_variable_tls_kernel_offload;
+
+
+    /*
+     * PROP_VMM_HUGE_PAGES:
+     *
+     * General data:
+     */
+    gnet_property->props[491].name = "vmm_huge_pages";
+    gnet_property->props[491].desc = _("Whether large memory regions should be backed by transparent huge pages, to reduce TLB pressure on large processes.");
+    gnet_property->props[491].ev_changed = event_new("vmm_huge_pages_changed");
+    gnet_property->props[491].save = TRUE;
+    gnet_property->props[491].internal = FALSE;
+    gnet_property->props[491].vector_size = 1;
+	mutex_init(&gnet_property->props[491].lock);
+
+    /* Type specific data: */
+    gnet_property->props[491].type               = PROP_TYPE_BOOLEAN;
+    gnet_property->props[491].data.boolean.def   = (void *) &gnet_property_variable_vmm_huge_pages_default;
+    gnet_property->props[491].data.boolean.value = (void *) &gnet_property_variable_vmm_huge_pages;
+
+
+    /*
+     * PROP_IO_REACTORS:
+     *
+     * General data:
+     */
+    gnet_property->props[492].name = "io_reactors";
+    gnet_property->props[492].desc = _("Amount of I/O reactor threads reading UDP datagrams off the main thread, so that the kernel receive queues are emptied even when the main thread is busy.  TCP connections are still serviced by the main thread.  At most one less reactor than the amount of CPUs is launched, hence none on a single-CPU machine.  When 0, all the I/O is done by the main thread.  Changes are taken into account at the next startup.");
+    gnet_property->props[492].ev_changed = event_new("io_reactors_changed");
+    gnet_property->props[492].save = TRUE;
+    gnet_property->props[492].internal = FALSE;
+    gnet_property->props[492].vector_size = 1;
+	mutex_init(&gnet_property->props[492].lock);
+
+    /* Type specific data: */
+    gnet_property->props[492].type               = PROP_TYPE_GUINT32;
+    gnet_property->props[492].data.guint32.def   = (void *) &gnet_property_variable_io_reactors_default;
+    gnet_property->props[492].data.guint32.value = (void *) &gnet_property_variable_io_reactors;
+    gnet_property->props[492].data.guint32.choices = NULL;
+    gnet_property->props[492].data.guint32.max   = 16;
+    gnet_property->props[492].data.guint32.min   = 0;
+
     gnet_property->by_name = htable_create(HASH_KEY_STRING, 0);
     for (n = 0; n < GNET_PROPERTY_NUM; n ++) {
         htable_insert(gnet_property->by_name,
@@ -526,6 +526,9 @@ typedef enum {
     PROP_RUNNING_TOPLESS,
     PROP_SEND_OOB_IND_RELIABLY,
     PROP_ADNS_DEBUG,
+    PROP_TLS_KERNEL_OFFLOAD,
+    PROP_VMM_HUGE_PAGES,
+    PROP_IO_REACTORS,
     GNET_PROPERTY_END
 } gnet_property_t;
 
@@ -540,6 +540,9 @@ extern const gboolean gnet_property_variable_lock_sleep_trace;
 extern const gboolean gnet_property_variable_running_topless;
 extern const gboolean gnet_property_variable_send_oob_ind_reliably;
 extern const guint32  gnet_property_variable_adns_debug;
+extern const gboolean gnet_property_variable_tls_kernel_offload;
+extern const gboolean gnet_property_variable_vmm_huge_pages;
+extern const guint32  gnet_property_variable_io_reactors;
 
 
 prop_set_t *gnet_prop_init(void);
@@ -1703,7 +1703,7 @@ gui_prop_init(void) {
      * General data:
      */
     gui_property->props[64].name = "search_stats_delcoef";
-    gui_property->props[64].desc = _("A deletion coefficient, so that small non-significant results can be dropped.  The lower it is, the more search statistics will be kept in memory.");
+    gui_property->props[64].desc = _("A deletion coefficient, so that small non-significant results can be dropped.  The lower it is, the more search statistics will be kept in memory.  Only used by the GTK1 interface: the GTK2 one tracks the most frequent terms with bounded memory and needs no pruning.");
     gui_property->props[64].ev_changed = event_new("search_stats_delcoef_changed");
     gui_property->props[64].save = TRUE;
     gui_property->props[64].internal = FALSE;
@@ -42,6 +42,7 @@
 #include "entropy.h"
 #include "hashing.h"		/* For integer_hash_fast() */
 #include "hset.h"
+#include "latency.h"
 #include "log.h"
 #include "mutex.h"
 #include "once.h"
@@ -996,6 +997,7 @@ cq_expire_internal(cqueue_t *cq, cevent_t *ev)
 {
 	cq_service_t fn;
 	void *arg;
+	tm_nano_t start;
 
 	assert_mutex_is_owned(&cq->cq_lock);
 
@@ -1044,7 +1046,9 @@ cq_expire_internal(cqueue_t *cq, cevent_t *ev)
 	g_assert(fn != NULL);
 
 	CQ_UNLOCK(cq);
+	latency_begin(&start);
 	(*fn)(cq, arg);		/* Callback invoked with queue unlocked */
+	latency_end("callout", func_to_pointer(fn), &start);
 	CQ_LOCK(cq);
 
 	/*
@@ -2213,6 +2217,58 @@ cq_main_dispatch(void)
 		thread_kill(callout_queue->cq_stid, TSIG_1);
 }
 
+/**
+ * Compute how long the thread running the main callout queue can wait before
+ * it needs to heartbeat the queue again.
+ *
+ * This is meant to be used by event loops driving the main callout queue
+ * themselves: the regular heartbeat period is shortened when the next
+ * event is due sooner, thereby improving timer precision.
+ *
+ * @return delay in milliseconds until the next heartbeat is due.
+ */
+int
+cq_main_timeout(void)
+{
+	cqueue_t *cq = cq_main();
+	time_delta_t elapsed, delay;
+	cq_time_t now;
+	tm_t tv;
+	int i;
+
+	tm_now_exact(&tv);
+
+	CQ_LOCK(cq);
+
+	elapsed = tm_elapsed_ms(&tv, &cq->cq_last_heartbeat);
+	delay = cq->cq_period;
+	now = cq->cq_time;
+
+	/*
+	 * Buckets are sorted by increasing trigger time and span more than
+	 * a period, so events due before the next regular heartbeat can only
+	 * be at the head of the current bucket or of the next one.
+	 */
+
+	for (i = 0; i < 2; i++) {
+		const cevent_t *ev =
+			cq->cq_hash[(EV_HASH(now) + i) & HASH_MASK].ch_head;
+
+		if (ev != NULL) {
+			if (ev->ce_time <= now)
+				delay = 0;
+			else if (ev->ce_time - now < (cq_time_t) delay)
+				delay = ev->ce_time - now;
+		}
+	}
+
+	CQ_UNLOCK(cq);
+
+	delay -= MAX(elapsed, 0);
+
+	return MAX(delay, 0);
+}
+
 /**
  * Halt the callout queue, during final shutdown.
  */
@@ -94,6 +94,7 @@ double cq_main_coverage(int old_ticks);
 
 void cq_init(cq_invoke_t idle, const uint32 *debug);
 void cq_main_dispatch(void);
+int cq_main_timeout(void);
 void cq_halt(void);
 void cq_close(void);
 
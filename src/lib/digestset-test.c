@@ -0,0 +1,330 @@
+/*
+ * digestset-test -- digest set tests and benchmarking.
+ *
+ * Copyright (c) 2026 Raphael Manfredi <Raphael_Manfredi@pobox.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+
+#include "lib/digestset.h"
+#include "lib/misc.h"
+#include "lib/progname.h"
+#include "lib/rand31.h"
+#include "lib/sorted_array.h"
+#include "lib/stringify.h"
+#include "lib/tm.h"
+#include "lib/xmalloc.h"
+
+#define DEFAULT_COUNT		100000		/* Keys in the set */
+#define DEFAULT_LOOKUPS		1000000		/* Lookups to time */
+#define DEFAULT_KEYSIZE		20			/* SHA-1 */
+
+static size_t key_size;
+static bool verbose_mode;
+
+static void G_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-hV] [-c keys] [-n lookups] [-p percent] [-s key_size]\n"
+		"       [-R seed]\n"
+		"  -c : sets amount of keys in the set (default = %u)\n"
+		"  -h : prints this help message\n"
+		"  -n : sets amount of lookups to time (default = %u)\n"
+		"  -p : percentage of lookups for keys in the set (default = 1)\n"
+		"  -s : sets key size, in bytes (default = %u)\n"
+		"  -R : seed for repeatable random key sequence\n"
+		"  -V : verbose mode -- print status after each successful test\n"
+		, getprogname(), DEFAULT_COUNT, DEFAULT_LOOKUPS, DEFAULT_KEYSIZE);
+	exit(EXIT_FAILURE);
+}
+
+static int
+key_cmp(const void *a, const void *b)
+{
+	return memcmp(a, b, key_size);	/* Global variable */
+}
+
+static double
+chrono(const tm_t *start)
+{
+	tm_t end;
+
+	tm_now_exact(&end);
+	return tm_elapsed_f(&end, start);
+}
+
+static void
+report(const char *what, double elapsed, size_t n)
+{
+	printf("%-26s %8.3fs", what, elapsed);
+	if (n != 0)
+		printf("  (%.1f ns/op)", elapsed * 1e9 / n);
+	putchar('\n');
+	fflush(stdout);
+}
+
+/**
+ * Generate the lookup keys: a fraction of them are picked from the set,
+ * the others are random and therefore (most probably) absent.
+ */
+static void *
+generate_lookups(const void *keys, size_t cnt, size_t n, uint percent)
+{
+	char *lookups = xmalloc(n * key_size);
+	size_t i;
+
+	rand31_bytes(lookups, n * key_size);
+
+	for (i = 0; i < n; i++) {
+		if (UNSIGNED(rand31_value(99)) < percent) {
+			size_t k = rand31_value(cnt - 1);
+			memcpy(&lookups[i * key_size],
+				const_ptr_add_offset(keys, k * key_size), key_size);
+		}
+	}
+
+	return lookups;
+}
+
+static void
+check_present(const digestset_t *ds, const void *keys, size_t cnt)
+{
+	size_t i;
+
+	for (i = 0; i < cnt; i++) {
+		const void *k = const_ptr_add_offset(keys, i * key_size);
+
+		if (!digestset_contains(ds, k) || !digestset_lookup(ds, k))
+			g_error("key #%zu not found in set", i);
+	}
+
+	if (verbose_mode)
+		printf("all %zu keys found in set - OK\n", cnt);
+}
+
+static size_t
+check_lookups(const digestset_t *ds, struct sorted_array *sa,
+	const void *lookups, size_t n)
+{
+	size_t i, found = 0;
+
+	for (i = 0; i < n; i++) {
+		const void *k = const_ptr_add_offset(lookups, i * key_size);
+		bool expected = NULL != sorted_array_lookup(sa, k);
+
+		if (expected != digestset_contains(ds, k))
+			g_error("lookup #%zu mismatch with Bloom filter", i);
+		if (expected != digestset_lookup(ds, k))
+			g_error("lookup #%zu mismatch without Bloom filter", i);
+		if (expected)
+			found++;
+	}
+
+	if (verbose_mode)
+		printf("all %zu lookups (%zu hits) match - OK\n", n, found);
+
+	return found;
+}
+
+static digestset_t *
+reopen(const digestset_t *ds, const void *keys, size_t cnt)
+{
+	digestset_t *copy;
+	size_t size = digestset_image_size(ds);
+	void *image;
+	FILE *f;
+	tm_t start;
+
+	f = tmpfile();
+	if (NULL == f)
+		g_error("cannot create temporary file: %m");
+
+	if (!digestset_write(ds, f) || 0 != fflush(f))
+		g_error("cannot write image: %m");
+
+	if (UNSIGNED(ftell(f)) != size)
+		g_error("image is %ld bytes, expected %zu", ftell(f), size);
+
+	image = xmalloc(size);
+	rewind(f);
+	if (1 != fread(image, size, 1, f))
+		g_error("cannot read back image: %m");
+	fclose(f);
+
+	tm_now_exact(&start);
+	copy = digestset_open(image, size, key_size);
+	report("open from image", chrono(&start), 0);
+
+	if (NULL == copy)
+		g_error("cannot re-open image");
+	if (digestset_count(copy) != digestset_count(ds))
+		g_error("re-opened set has %zu keys, expected %zu",
+			digestset_count(copy), digestset_count(ds));
+
+	check_present(copy, keys, cnt);
+
+	/* Corrupt the order of the keys, which must be detected */
+
+	if (digestset_count(ds) > 1) {
+		char *last = ptr_add_offset(image, size - key_size);
+		memcpy(last, last - key_size, key_size);
+		if (NULL != digestset_open(image, size, key_size))
+			g_error("corrupted image was not detected");
+	}
+
+	xfree(image);
+	return copy;
+}
+
+static void
+test(size_t cnt, size_t n, uint percent)
+{
+	struct sorted_array *sa;
+	digestset_t *ds, *copy;
+	void *keys, *lookups;
+	size_t i, found = 0;
+	tm_t start;
+
+	printf("%zu key%s of %zu bytes, %zu lookup%s with %u%% of hits\n",
+		PLURAL(cnt), key_size, PLURAL(n), percent);
+
+	keys = xmalloc(cnt * key_size);
+	rand31_bytes(keys, cnt * key_size);
+
+	tm_now_exact(&start);
+	ds = digestset_create(keys, cnt, key_size);
+	report("digestset_create()", chrono(&start), 0);
+
+	tm_now_exact(&start);
+	sa = sorted_array_new(key_size, key_cmp);
+	for (i = 0; i < cnt; i++)
+		sorted_array_add(sa, const_ptr_add_offset(keys, i * key_size));
+	sorted_array_sync(sa, NULL);
+	report("sorted_array build", chrono(&start), 0);
+
+	check_present(ds, keys, cnt);
+	copy = reopen(ds, keys, cnt);
+
+	lookups = generate_lookups(keys, cnt, n, percent);
+	(void) check_lookups(ds, sa, lookups, n);
+
+#define TIMEIT(what, expr) G_STMT_START {					\
+	found = 0;												\
+	tm_now_exact(&start);									\
+	for (i = 0; i < n; i++) {								\
+		const void *k = const_ptr_add_offset(lookups, i * key_size);	\
+		if (expr)											\
+			found++;										\
+	}														\
+	report(what, chrono(&start), n);						\
+} G_STMT_END
+
+	TIMEIT("digestset_contains()", digestset_contains(ds, k));
+	TIMEIT("digestset_lookup()", digestset_lookup(ds, k));
+	TIMEIT("sorted_array_lookup()", NULL != sorted_array_lookup(sa, k));
+	TIMEIT("bsearch()",
+		NULL != bsearch(k, sorted_array_item(sa, 0),
+			sorted_array_count(sa), key_size, key_cmp));
+
+#undef TIMEIT
+
+	if (verbose_mode)
+		printf("%zu hit%s\n", PLURAL(found));
+
+	digestset_free_null(&ds);
+	digestset_free_null(&copy);
+	sorted_array_free(&sa);
+	xfree(keys);
+	xfree(lookups);
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	size_t count = DEFAULT_COUNT;
+	size_t lookups = DEFAULT_LOOKUPS;
+	uint percent = 1;
+	unsigned rseed = 0;
+	int c;
+	const char options[] = "c:hn:p:s:R:V";
+
+	progstart(argc, argv);
+	key_size = DEFAULT_KEYSIZE;
+
+	while ((c = getopt(argc, argv, options)) != EOF) {
+		switch (c) {
+		case 'c':			/* amount of keys in the set */
+			count = atol(optarg);
+			break;
+		case 'n':			/* amount of lookups */
+			lookups = atol(optarg);
+			break;
+		case 'p':			/* percentage of hits */
+			percent = atoi(optarg);
+			break;
+		case 's':			/* key size */
+			key_size = atol(optarg);
+			break;
+		case 'R':			/* randomize in a repeatable way */
+			rseed = atoi(optarg);
+			break;
+		case 'V':			/* verbose mode */
+			verbose_mode = TRUE;
+			break;
+		case 'h':			/* show help */
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if ((argc -= optind) != 0)
+		usage();
+
+	if (key_size < DIGESTSET_KEYMIN) {
+		fprintf(stderr, "%s: key size must be at least %u bytes\n",
+			getprogname(), DIGESTSET_KEYMIN);
+		exit(EXIT_FAILURE);
+	}
+
+	if (0 == count || percent > 100)
+		usage();
+
+	rand31_set_seed(rseed);
+	printf("using random seed %u\n", rand31_current_seed());
+
+	test(count, lookups, percent);
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
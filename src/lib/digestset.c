@@ -0,0 +1,527 @@
+/*
+ * Copyright (c) 2026, Raphael Manfredi
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Immutable sets of cryptographic digests.
+ *
+ * A digest set is built once from a list of digests (SHA-1, TTH, ...) and
+ * then only queried, possibly concurrently since nothing is ever modified.
+ *
+ * Because digests are uniformly distributed, we can directly use their bits
+ * instead of hashing them:
+ *
+ * - A blocked Bloom filter is first checked: the leading bytes of the key
+ *   select one 64-byte block (a single cache line), in which the next bytes
+ *   give the bits to probe.  Most keys absent from the set are rejected
+ *   without touching the keys at all.
+ *
+ * - Keys that pass the filter are looked for in the sorted array of keys,
+ *   through an interpolation search that converges in a couple of probes,
+ *   falling back to a plain binary search when interpolation does not pay.
+ *
+ * The set can be serialized as an image, which can be re-opened without
+ * having to sort the keys or rebuild the filter.
+ *
+ * @author Raphael Manfredi
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "digestset.h"
+
+#include "endian.h"
+#include "halloc.h"
+#include "smsort.h"
+#include "walloc.h"
+
+#include "override.h"		/* Must be the last header included */
+
+#define DIGESTSET_BLOCK		64		/**< Bloom block size (one cache line) */
+#define DIGESTSET_BITS		10		/**< Bloom filter bits per key */
+#define DIGESTSET_PROBES	6		/**< Bits probed per key in its block */
+#define DIGESTSET_INTERP	8		/**< Max interpolation probes */
+#define DIGESTSET_LINEAR	8		/**< Smaller ranges are just bisected */
+#define DIGESTSET_RADIX		16		/**< Max bits used to distribute keys */
+
+#define DIGESTSET_BLOCK_BITS	(DIGESTSET_BLOCK * 8)
+#define DIGESTSET_PROBE_BITS	9	/**< log2(DIGESTSET_BLOCK_BITS) */
+
+/*
+ * The image is made of a header followed by the Bloom filter blocks and
+ * the sorted keys.  The header holds the magic, the version, the key size,
+ * the amount of keys and the amount of Bloom filter blocks, in big-endian.
+ */
+#define DIGESTSET_IMAGE_MAGIC	"DSET"
+#define DIGESTSET_VERSION		1
+#define DIGESTSET_HEADER		24
+
+enum digestset_magic { DIGESTSET_MAGIC = 0x2f4b10d3 };
+
+struct digestset {
+	enum digestset_magic magic;
+	size_t keysize;			/**< Size of each key, in bytes */
+	size_t count;			/**< Amount of keys */
+	size_t blocks;			/**< Amount of Bloom filter blocks */
+	uint8 *bloom;			/**< The Bloom filter blocks */
+	char *keys;				/**< The sorted keys */
+};
+
+static inline void
+digestset_check(const struct digestset * const ds)
+{
+	g_assert(ds != NULL);
+	g_assert(DIGESTSET_MAGIC == ds->magic);
+}
+
+/**
+ * Compute amount of Bloom filter blocks for a given amount of keys.
+ */
+static size_t
+digestset_blocks(size_t count)
+{
+	return (count * DIGESTSET_BITS + DIGESTSET_BLOCK_BITS - 1) /
+		DIGESTSET_BLOCK_BITS;
+}
+
+static inline const char *
+digestset_key(const digestset_t *ds, size_t i)
+{
+	return &ds->keys[i * ds->keysize];
+}
+
+/**
+ * @return the Bloom filter block for the key.
+ */
+static inline uint8 *
+digestset_block(const digestset_t *ds, const void *key)
+{
+	size_t b = ((uint64) peek_be32(key) * ds->blocks) >> 32;
+
+	return &ds->bloom[b * DIGESTSET_BLOCK];
+}
+
+static void
+digestset_bloom_add(uint8 *block, const void *key)
+{
+	uint64 h = peek_be64(const_ptr_add_offset(key, 4));
+	uint i;
+
+	for (i = 0; i < DIGESTSET_PROBES; i++, h >>= DIGESTSET_PROBE_BITS) {
+		uint bit = h & (DIGESTSET_BLOCK_BITS - 1);
+		block[bit >> 3] |= 1U << (bit & 7);
+	}
+}
+
+static inline bool
+digestset_bloom_test(const uint8 *block, const void *key)
+{
+	uint64 h = peek_be64(const_ptr_add_offset(key, 4));
+	uint i;
+
+	for (i = 0; i < DIGESTSET_PROBES; i++, h >>= DIGESTSET_PROBE_BITS) {
+		uint bit = h & (DIGESTSET_BLOCK_BITS - 1);
+		if (0 == (block[bit >> 3] & (1U << (bit & 7))))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static bool
+digestset_less(void *m, size_t i, size_t j)
+{
+	const digestset_t *ds = m;
+
+	return memcmp(digestset_key(ds, i), digestset_key(ds, j), ds->keysize) < 0;
+}
+
+static void
+digestset_swap(void *m, size_t i, size_t j)
+{
+	const digestset_t *ds = m;
+	void *a = deconstify_pointer(digestset_key(ds, i));
+	void *b = deconstify_pointer(digestset_key(ds, j));
+
+	SWAP(a, b, ds->keysize);
+}
+
+/**
+ * Copy keys to the set, sorted.
+ *
+ * Since keys are uniformly distributed, we first distribute them in buckets
+ * according to their leading bits, which leaves only a few keys to sort in
+ * each bucket.
+ */
+static void
+digestset_sort(digestset_t *ds, const void *keys, size_t count)
+{
+	size_t i, nb, *pos;
+	uint bits = 0;
+
+	while (bits < DIGESTSET_RADIX && (2UL << bits) <= count)
+		bits++;
+
+	if (0 == bits) {
+		memcpy(ds->keys, keys, count * ds->keysize);
+		smsort_ext(ds, 0, count, digestset_less, digestset_swap);
+		return;
+	}
+
+	nb = 1UL << bits;
+	HALLOC0_ARRAY(pos, nb + 1);
+
+	for (i = 0; i < count; i++) {
+		const void *k = const_ptr_add_offset(keys, i * ds->keysize);
+		pos[(peek_be32(k) >> (32 - bits)) + 1]++;
+	}
+
+	for (i = 1; i < nb; i++)
+		pos[i] += pos[i - 1];
+
+	/*
+	 * Once all the keys are distributed, pos[b] is the start of bucket b + 1.
+	 */
+
+	for (i = 0; i < count; i++) {
+		const void *k = const_ptr_add_offset(keys, i * ds->keysize);
+		size_t j = pos[peek_be32(k) >> (32 - bits)]++;
+
+		memcpy(deconstify_pointer(digestset_key(ds, j)), k, ds->keysize);
+	}
+
+	for (i = 0; i < nb; i++) {
+		size_t start = 0 == i ? 0 : pos[i - 1];
+		size_t n = pos[i] - start;
+
+		if (n > 1)
+			smsort_ext(ds, start, n, digestset_less, digestset_swap);
+	}
+
+	HFREE_NULL(pos);
+}
+
+/**
+ * Allocate a new set.
+ */
+static digestset_t *
+digestset_alloc(size_t count, size_t blocks, size_t keysize)
+{
+	digestset_t *ds;
+	size_t bsize = blocks * DIGESTSET_BLOCK;
+
+	WALLOC0(ds);
+	ds->magic = DIGESTSET_MAGIC;
+	ds->keysize = keysize;
+	ds->count = count;
+	ds->blocks = blocks;
+
+	if (count != 0) {
+		ds->bloom = halloc0(bsize + count * keysize);
+		ds->keys = ptr_add_offset(ds->bloom, bsize);
+	}
+
+	return ds;
+}
+
+/**
+ * Create a new set from a list of keys.
+ *
+ * Duplicate keys are only kept once.
+ *
+ * @param keys		the keys, in any order
+ * @param count		amount of keys
+ * @param keysize	size of each key, in bytes
+ *
+ * @return the new set, to be freed with digestset_free_null().
+ */
+digestset_t *
+digestset_create(const void *keys, size_t count, size_t keysize)
+{
+	digestset_t *ds;
+	size_t i, n;
+
+	g_assert(keys != NULL || 0 == count);
+	g_assert(keysize >= DIGESTSET_KEYMIN);
+	g_assert(count <= MAX_INT_VAL(uint32));
+
+	ds = digestset_alloc(count, digestset_blocks(count), keysize);
+
+	if (0 == count)
+		return ds;
+
+	digestset_sort(ds, keys, count);
+
+	/*
+	 * Remove duplicates, keeping the Bloom filter sized for the original
+	 * amount of keys since the memory is already allocated anyway.
+	 */
+
+	for (i = n = 1; i < count; i++) {
+		const char *k = digestset_key(ds, i);
+
+		if (0 == memcmp(k, digestset_key(ds, n - 1), keysize))
+			continue;
+		if (i != n)
+			memcpy(deconstify_pointer(digestset_key(ds, n)), k, keysize);
+		n++;
+	}
+
+	ds->count = n;
+
+	for (i = 0; i < n; i++) {
+		const char *k = digestset_key(ds, i);
+		digestset_bloom_add(digestset_block(ds, k), k);
+	}
+
+	return ds;
+}
+
+/**
+ * Open a set from its image, as written by digestset_write().
+ *
+ * The image is copied, hence it can be discarded once the set is opened.
+ *
+ * @param image		the image data
+ * @param len		length of the image data, which may hold trailing data
+ * @param keysize	expected key size
+ *
+ * @return the set, NULL if the image is invalid.
+ */
+digestset_t *
+digestset_open(const void *image, size_t len, size_t keysize)
+{
+	const char *p = image;
+	digestset_t *ds;
+	uint32 count, blocks;
+	uint64 size;
+	size_t i;
+
+	g_assert(image != NULL || 0 == len);
+
+	if (len < DIGESTSET_HEADER)
+		return NULL;
+
+	if (
+		0 != memcmp(p, DIGESTSET_IMAGE_MAGIC, 4) ||
+		DIGESTSET_VERSION != peek_be32(&p[4]) ||
+		keysize != peek_be32(&p[8])
+	)
+		return NULL;
+
+	count = peek_be32(&p[12]);
+	blocks = peek_be32(&p[16]);
+	size = DIGESTSET_HEADER +
+		(uint64) blocks * DIGESTSET_BLOCK + (uint64) count * keysize;
+
+	if (size > len || (0 == count) != (0 == blocks))
+		return NULL;
+
+	ds = digestset_alloc(count, blocks, keysize);
+
+	if (0 == count)
+		return ds;
+
+	memcpy(ds->bloom, &p[DIGESTSET_HEADER], size - DIGESTSET_HEADER);
+
+	/*
+	 * Make sure keys are sorted, or lookups would silently fail.
+	 */
+
+	for (i = 1; i < count; i++) {
+		const char *k = digestset_key(ds, i);
+
+		if (memcmp(digestset_key(ds, i - 1), k, keysize) >= 0)
+			goto invalid;
+	}
+
+	return ds;
+
+invalid:
+	digestset_free_null(&ds);
+	return NULL;
+}
+
+/**
+ * Free set and nullify its pointer.
+ */
+void
+digestset_free_null(digestset_t **ds_ptr)
+{
+	digestset_t *ds = *ds_ptr;
+
+	if (ds != NULL) {
+		digestset_check(ds);
+		HFREE_NULL(ds->bloom);
+		ds->magic = 0;
+		WFREE(ds);
+		*ds_ptr = NULL;
+	}
+}
+
+/**
+ * Look for key in the sorted array of keys.
+ *
+ * Interpolation on the leading 32 bits of the keys is used for the first
+ * probes, then we bisect, so that we keep a logarithmic worst case when
+ * keys are not evenly spread.
+ *
+ * The bounds used for interpolating are the leading bits of the keys probed
+ * so far, to avoid touching more memory than the probed keys.
+ *
+ * @return TRUE if key is present.
+ */
+static bool
+digestset_search(const digestset_t *ds, const void *key)
+{
+	size_t lo = 0, hi = ds->count;		/* Range is [lo, hi) */
+	uint64 a = 0, b = MAX_INT_VAL(uint32);	/* Leading bits within range */
+	uint32 k = peek_be32(key);
+	uint probes = 0;
+
+	while (lo < hi) {
+		const char *item;
+		size_t mid;
+		int c;
+
+		if (probes++ < DIGESTSET_INTERP && hi - lo > DIGESTSET_LINEAR)
+			mid = lo + (k - a) * (hi - lo) / (b - a + 1);
+		else
+			mid = lo + (hi - lo) / 2;
+
+		item = digestset_key(ds, mid);
+		c = memcmp(key, item, ds->keysize);
+
+		if (0 == c)
+			return TRUE;
+		if (c < 0) {
+			hi = mid;
+			b = peek_be32(item);
+		} else {
+			lo = mid + 1;
+			a = peek_be32(item);
+		}
+	}
+
+	return FALSE;
+}
+
+/**
+ * Check whether key is part of the set.
+ *
+ * @param ds		the set
+ * @param key		the key, of the set's key size
+ *
+ * @return TRUE if key is present.
+ */
+bool
+digestset_contains(const digestset_t *ds, const void *key)
+{
+	digestset_check(ds);
+	g_assert(key != NULL);
+
+	if (0 == ds->count)
+		return FALSE;
+
+	if (!digestset_bloom_test(digestset_block(ds, key), key))
+		return FALSE;
+
+	return digestset_search(ds, key);
+}
+
+/**
+ * Check whether key is part of the set, without consulting the Bloom filter.
+ *
+ * This is only meant for benchmarking: digestset_contains() is always
+ * faster when the key is absent, and barely slower when it is present.
+ *
+ * @return TRUE if key is present.
+ */
+bool
+digestset_lookup(const digestset_t *ds, const void *key)
+{
+	digestset_check(ds);
+	g_assert(key != NULL);
+
+	return digestset_search(ds, key);
+}
+
+/**
+ * @return amount of keys in the set.
+ */
+size_t
+digestset_count(const digestset_t *ds)
+{
+	digestset_check(ds);
+
+	return ds->count;
+}
+
+/**
+ * @return size of the image of the set, as written by digestset_write().
+ */
+size_t
+digestset_image_size(const digestset_t *ds)
+{
+	digestset_check(ds);
+
+	return DIGESTSET_HEADER +
+		ds->blocks * DIGESTSET_BLOCK + ds->count * ds->keysize;
+}
+
+/**
+ * Write the image of the set to the supplied stream.
+ *
+ * @return TRUE on success.
+ */
+bool
+digestset_write(const digestset_t *ds, FILE *f)
+{
+	char header[DIGESTSET_HEADER];
+	size_t size;
+
+	digestset_check(ds);
+	g_assert(f != NULL);
+
+	ZERO(&header);
+	memcpy(header, DIGESTSET_IMAGE_MAGIC, 4);
+	poke_be32(&header[4], DIGESTSET_VERSION);
+	poke_be32(&header[8], ds->keysize);
+	poke_be32(&header[12], ds->count);
+	poke_be32(&header[16], ds->blocks);
+
+	if (1 != fwrite(header, sizeof header, 1, f))
+		return FALSE;
+
+	if (0 == ds->count)
+		return TRUE;
+
+	size = ds->blocks * DIGESTSET_BLOCK + ds->count * ds->keysize;
+
+	return 1 == fwrite(ds->bloom, size, 1, f);
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2026, Raphael Manfredi
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Immutable sets of cryptographic digests.
+ *
+ * @author Raphael Manfredi
+ * @date 2026
+ */
+
+#ifndef _digestset_h_
+#define _digestset_h_
+
+#define DIGESTSET_KEYMIN	12	/**< Minimum key size, in bytes */
+
+typedef struct digestset digestset_t;
+
+/*
+ * Public interface.
+ */
+
+digestset_t *digestset_create(const void *keys, size_t count, size_t keysize);
+digestset_t *digestset_open(const void *image, size_t len, size_t keysize);
+void digestset_free_null(digestset_t **ds_ptr);
+
+bool digestset_contains(const digestset_t *ds, const void *key);
+bool digestset_lookup(const digestset_t *ds, const void *key);
+size_t digestset_count(const digestset_t *ds);
+size_t digestset_image_size(const digestset_t *ds);
+bool digestset_write(const digestset_t *ds, FILE *f);
+
+#endif /* _digestset_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
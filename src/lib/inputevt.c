@@ -115,11 +115,13 @@ typedef struct {
 #include "halloc.h"
 #include "hashlist.h"
 #include "htable.h"
+#include "latency.h"
 #include "log.h"			/* For s_error() */
 #include "misc.h"
 #include "mutex.h"
 #include "plist.h"
 #include "pslist.h"
+#include "spinlock.h"
 #include "stacktrace.h"
 #include "stringify.h"
 #include "thread.h"			/* For thread_in_syscall_set() */
@@ -212,6 +214,21 @@ struct new_relay {
 static const inputevt_handler_t zero_handler;
 static int (*default_poll_func)(GPollFD *, unsigned, int);
 
+/**
+ * Statistics for inputevt_wait(), reported every INPUTEVT_WAIT_REPORT
+ * dispatched events when debugging.
+ */
+struct inputevt_wait_stats {
+	uint64 wakeups;			/**< Returns from the blocking wait */
+	uint64 timeouts;		/**< Wakeups that did not yield any event */
+	uint64 events;			/**< Events dispatched */
+	uint64 period_wakeups;	/**< Wakeups in current reporting period */
+	uint64 period_events;	/**< Events dispatched in current period */
+	double period_cpu;		/**< CPU time at the start of current period */
+};
+
+#define INPUTEVT_WAIT_REPORT	10000
+
 struct poll_ctx {
 	mutex_t lock;				/**< Thread-safe lock */
 	inputevt_relay_t **relay;	/**< The relay contexts */
@@ -227,6 +244,9 @@ struct poll_ctx {
 	unsigned num_poll_idx;		/**< Length of used_poll_idx array */
 	unsigned max_poll_idx;
 	unsigned num_ready;			/**< Used for /dev/poll only */
+	unsigned reactor;			/**< Reactor number, 0 for the main loop */
+	unsigned stid;				/**< Thread dispatching events */
+	struct inputevt_wait_stats wstats;	/**< Statistics for inputevt_wait() */
 	unsigned initialized:1;		/**< TRUE if the context has been initialized */
 	unsigned dispatching:1;		/**< TRUE if dispatching events */
 	unsigned collecting:1;		/**< TRUE when collecing / waiting for events */
@@ -283,6 +303,56 @@ get_global_poll_ctx(void)
 	return &ctx;
 }
 
+/*
+ * Reactors are threads running their own I/O event loop, with their own
+ * context.  Sources added from a reactor are monitored by that reactor, and
+ * the reactor number is encoded in the upper bits of the returned IDs so
+ * that inputevt_remove() can find the proper context from any thread.
+ */
+
+#define INPUTEVT_REACTOR_MAX	32		/**< Maximum amount of reactors */
+#define INPUTEVT_ID_SHIFT		24		/**< Reactor number within IDs */
+#define INPUTEVT_ID_MASK		((1U << INPUTEVT_ID_SHIFT) - 1)
+
+static struct poll_ctx *poll_ctx_reactor[INPUTEVT_REACTOR_MAX + 1];
+static struct poll_ctx *poll_ctx_thread[THREAD_MAX];
+static spinlock_t poll_ctx_slk = SPINLOCK_INIT;
+
+/**
+ * @return the context of the current thread, the global one if the thread
+ * is not a reactor.
+ */
+static inline struct poll_ctx *
+get_poll_ctx(void)
+{
+	struct poll_ctx *ctx = poll_ctx_thread[thread_small_id()];
+
+	return NULL == ctx ? get_global_poll_ctx() : ctx;
+}
+
+/**
+ * @return the context managing the source with the given external ID.
+ */
+static inline struct poll_ctx *
+get_id_poll_ctx(unsigned id)
+{
+	unsigned r = id >> INPUTEVT_ID_SHIFT;
+	struct poll_ctx *ctx;
+
+	if G_LIKELY(0 == r)
+		return get_global_poll_ctx();
+
+	g_assert_log(r <= INPUTEVT_REACTOR_MAX,
+		"%s(): invalid ID %u", G_STRFUNC, id);
+
+	ctx = poll_ctx_reactor[r];
+
+	g_assert_log(ctx != NULL,
+		"%s(): ID %u refers to stopped reactor #%u", G_STRFUNC, id, r);
+
+	return ctx;
+}
+
 /**
  * Start "collecting" events through a possibly blocking system call.
  */
@@ -993,11 +1063,16 @@ inputevt_handle(const struct poll_ctx *ctx, int fd, inputevt_cond_t condition)
 			continue;
 
 		if (condition & relay->condition) {
+			/*
+			 * Save the handler: it is reset if the handler removes itself.
+			 */
+			const void *handler = func_to_pointer(relay->handler);
+			tm_nano_t start;
+
 			data_available = 0;		/* FIXME: not thread-safe */
+			latency_begin(&start);
 
 			if G_UNLIKELY(inputevt_trace) {
-				void *handler = relay->handler;
-
 				s_info("%s(): calling %s()...",
 					G_STRFUNC, stacktrace_function_name(handler));
 
@@ -1008,17 +1083,22 @@ inputevt_handle(const struct poll_ctx *ctx, int fd, inputevt_cond_t condition)
 			} else {
 				relay->handler(relay->data, fd, condition);
 			}
+
+			latency_end("I/O", handler, &start);
 		}
 	}
 }
 
 /**
  * Our main I/O event dispatching loop.
+ *
+ * @return the amount of events dispatched.
  */
-static void G_HOT
+static unsigned G_HOT
 inputevt_timer(struct poll_ctx *ctx)
 {
 	int num_events;
+	unsigned dispatched = 0;
 
 	g_assert(ctx != NULL);
 
@@ -1031,7 +1111,7 @@ inputevt_timer(struct poll_ctx *ctx)
 	if (ctx->dispatching) {
 		CTX_UNLOCK(ctx);
 		s_critical("%s(): called recursively / concurrently", G_STRFUNC);
-		return;
+		return 0;
 	}
 
 	num_events = (*ctx->event_check_all)(ctx);
@@ -1076,6 +1156,7 @@ inputevt_timer(struct poll_ctx *ctx)
 
 			inputevt_handle(ctx, event->fd, event->condition);
 			WFREE(event);
+			dispatched++;
 		}
 
 		pslist_free_null(&evlist);
@@ -1108,6 +1189,7 @@ inputevt_timer(struct poll_ctx *ctx)
 			int fd = pointer_to_int(iter->data);
 
 			inputevt_handle(ctx, fd, INPUT_EVENT_R);
+			dispatched++;
 		}
 
 		plist_free_null(&list);
@@ -1121,6 +1203,8 @@ inputevt_timer(struct poll_ctx *ctx)
 	}
 
 	CTX_UNLOCK(ctx);
+
+	return dispatched;
 }
 
 /**
@@ -1135,7 +1219,7 @@ dispatch_poll(GIOChannel *unused_source,
 	(void) unused_cond;
 	(void) unused_source;
 
-	inputevt_timer(ctx);
+	(void) inputevt_timer(ctx);
 	return TRUE;
 }
 
@@ -1212,7 +1296,8 @@ inputevt_remove(unsigned *id_ptr)
 	if G_UNLIKELY(0 == id)
 		return;
 
-	ctx = get_global_poll_ctx();
+	ctx = get_id_poll_ctx(id);
+	id &= INPUTEVT_ID_MASK;
 	g_assert(ctx->initialized);
 	g_assert(ctx->ht);
 	g_assert(0 != id);
@@ -1422,7 +1507,7 @@ inputevt_process_added(struct poll_ctx *ctx)
 void
 inputevt_set_readable(int fd)
 {
-	struct poll_ctx *ctx = get_global_poll_ctx();
+	struct poll_ctx *ctx = get_poll_ctx();
 	void *key = int_to_pointer(fd);
 
 	if (inputevt_debug > 3) {
@@ -1455,7 +1540,8 @@ init_with_kqueue(struct poll_ctx *ctx)
 
 	g_assert(CTX_IS_LOCKED(ctx));
 
-	g_main_context_set_poll_func(NULL, default_poll_func);
+	if (0 == ctx->reactor)
+		g_main_context_set_poll_func(NULL, default_poll_func);
 	ctx->master_fd = fd;
 	ctx->polling_method = "kqueue()";
 	ctx->collect_events = NULL; /* master fd can be polled */
@@ -1485,7 +1571,8 @@ init_with_devpoll(struct poll_ctx *ctx)
 
 	g_assert(CTX_IS_LOCKED(ctx));
 
-	g_main_context_set_poll_func(NULL, default_poll_func);
+	if (0 == ctx->reactor)
+		g_main_context_set_poll_func(NULL, default_poll_func);
 	ctx->master_fd = fd;
 	ctx->polling_method = "/dev/poll";
 	ctx->collect_events = collect_events_with_devpoll;
@@ -1515,7 +1602,8 @@ init_with_epoll(struct poll_ctx *ctx)
 
 	g_assert(CTX_IS_LOCKED(ctx));
 
-	g_main_context_set_poll_func(NULL, default_poll_func);
+	if (0 == ctx->reactor)
+		g_main_context_set_poll_func(NULL, default_poll_func);
 	ctx->master_fd = fd;
 	ctx->polling_method = "epoll()";
 	ctx->collect_events = NULL; /* master fd can be polled */
@@ -1567,19 +1655,16 @@ inputevt_thread_id(void)
 }
 
 /**
- * Performs module initialization.
- * @param use_poll If TRUE, kqueue(), epoll(), /dev/poll etc. won't be used.
+ * Initialize common parts of a context, dispatched by the current thread.
  */
-void
-inputevt_init(int use_poll)
+static void
+inputevt_ctx_init(struct poll_ctx *ctx)
 {
-	struct poll_ctx *ctx;
-
-	ctx = get_global_poll_ctx();
-	inputevt_stid = thread_small_id();
-
 	g_assert(!ctx->initialized);
+
 	ctx->initialized = TRUE;
+	ctx->stid = thread_small_id();
+	ctx->master_fd = -1;
 	ctx->ht = htable_create(HASH_KEY_SELF, 0);
 	ctx->readable = hash_list_new(NULL, NULL);
 	mutex_init(&ctx->lock);
@@ -1590,6 +1675,48 @@ inputevt_init(int use_poll)
 	 */
 
 	htable_thread_safe(ctx->ht);
+}
+
+/**
+ * Release resources held by a context.
+ */
+static void
+inputevt_ctx_free(struct poll_ctx *ctx)
+{
+	CTX_LOCK(ctx);
+
+	inputevt_purge_removed(ctx);
+	htable_free_null(&ctx->ht);
+	hash_list_free(&ctx->readable);
+	HFREE_NULL(ctx->used_poll_idx);
+	HFREE_NULL(ctx->used_event_id);
+	XFREE_NULL(ctx->relay);
+	XFREE_NULL(ctx->pfd_arr);
+#ifdef HAS_KQUEUE
+	XFREE_NULL(ctx->kev_arr);
+#endif
+#ifdef HAS_EPOLL
+	XFREE_NULL(ctx->ep_arr);
+#endif
+	fd_close(&ctx->master_fd);
+	ctx->initialized = FALSE;
+
+	CTX_UNLOCK(ctx);
+	mutex_destroy(&ctx->lock);
+}
+
+/**
+ * Performs module initialization.
+ * @param use_poll If TRUE, kqueue(), epoll(), /dev/poll etc. won't be used.
+ */
+void
+inputevt_init(int use_poll)
+{
+	struct poll_ctx *ctx;
+
+	ctx = get_global_poll_ctx();
+	inputevt_stid = thread_small_id();
+	inputevt_ctx_init(ctx);
 
 	CTX_LOCK(ctx);
 
@@ -1646,7 +1773,7 @@ inputevt_add(int fd, inputevt_cond_t cond,
 	safety_assert(is_open_fd(fd));
 	safety_assert(is_a_socket(fd) || is_a_fifo(fd));
 
-	ctx = get_global_poll_ctx();
+	ctx = get_poll_ctx();
 
 	g_assert(ctx->initialized);
 	g_assert(ctx->ht != NULL);
@@ -1708,6 +1835,9 @@ cond_is_okay:
 			id = 1;
 			ctx->num_ev_reserved = 1;
 		}
+
+		g_assert_log(id <= INPUTEVT_ID_MASK,
+			"%s(): too many sources in %s", G_STRFUNC, thread_name());
 	}
 
 	if (ctx->collecting) {
@@ -1723,7 +1853,7 @@ cond_is_okay:
 
 	CTX_UNLOCK(ctx);
 
-	return id;
+	return id | (ctx->reactor << INPUTEVT_ID_SHIFT);
 }
 
 /**
@@ -1737,7 +1867,130 @@ inputevt_dispatch(void)
 {
 	struct poll_ctx *ctx = get_global_poll_ctx();
 
-	inputevt_timer(ctx);
+	(void) inputevt_timer(ctx);
+}
+
+/**
+ * Account for a wakeup of inputevt_wait(), reporting when debugging.
+ *
+ * @param ctx			the context on which we waited
+ * @param dispatched	amount of events dispatched at this wakeup
+ */
+static void
+inputevt_wait_account(struct poll_ctx *ctx, unsigned dispatched)
+{
+	struct inputevt_wait_stats *ws = &ctx->wstats;
+
+	ws->wakeups++;
+	ws->period_wakeups++;
+	ws->events += dispatched;
+	ws->period_events += dispatched;
+
+	if (0 == dispatched)
+		ws->timeouts++;
+
+	if G_UNLIKELY(ws->period_events >= INPUTEVT_WAIT_REPORT) {
+		double cpu = tm_cputime(NULL, NULL);
+
+		if (inputevt_debug) {
+			double scale = INPUTEVT_WAIT_REPORT / (double) ws->period_events;
+
+			s_debug("INPUTEVT %s in %s: %.1f wakeups and %.3f CPU ms "
+				"per %u events (%s wakeups, %s events, %s timeouts overall)",
+				ctx->polling_method, thread_name(),
+				ws->period_wakeups * scale,
+				(cpu - ws->period_cpu) * 1000.0 * scale,
+				INPUTEVT_WAIT_REPORT,
+				uint64_to_string(ws->wakeups), uint64_to_string2(ws->events),
+				uint64_to_string3(ws->timeouts));
+		}
+
+		ws->period_wakeups = ws->period_events = 0;
+		ws->period_cpu = cpu;
+	}
+}
+
+/**
+ * Can we wait for I/O events ourselves, without going through the glib
+ * main loop?
+ *
+ * This requires a master file descriptor that can be polled to know
+ * whether any of the monitored sources are ready, i.e. kqueue() or epoll().
+ *
+ * @return TRUE if inputevt_wait() can be used.
+ */
+bool
+inputevt_can_wait(void)
+{
+	struct poll_ctx *ctx = get_poll_ctx();
+
+	return ctx->initialized &&
+		is_valid_fd(ctx->master_fd) && NULL == ctx->collect_events;
+}
+
+/**
+ * Wait for I/O events and dispatch all the ready ones in one batch.
+ *
+ * This is meant to replace the glib main loop when there is no GUI to run:
+ * we block on the master file descriptor directly, for at most the supplied
+ * timeout, which the caller derives from its next timer deadline.
+ *
+ * Readiness stays level-triggered: I/O handlers throttled by the bandwidth
+ * schedulers routinely leave data unread and rely on being notified again.
+ *
+ * @param timeout_ms	maximum waiting time, in milliseconds (-1 = infinite)
+ *
+ * @return the amount of I/O events dispatched.
+ */
+unsigned
+inputevt_wait(int timeout_ms)
+{
+	struct poll_ctx *ctx = get_poll_ctx();
+	struct pollfd pfd;
+	unsigned dispatched = 0;
+	int r;
+
+	g_assert(inputevt_can_wait());
+	g_assert_log(thread_small_id() == ctx->stid,
+		"%s() called from %s but I/O events are dispatched by %s",
+		G_STRFUNC, thread_name(), thread_id_name(ctx->stid));
+
+	CTX_LOCK(ctx);
+
+	/*
+	 * Do not block if we have pending fake "readable" events.
+	 */
+
+	if (hash_list_length(ctx->readable) > 0)
+		timeout_ms = 0;
+
+	pfd.fd = ctx->master_fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	/*
+	 * Since compat_poll() already accounts for the system call, we pass
+	 * a timeout of 0 to inputevt_collect_start(), as in the poll() case.
+	 */
+
+	inputevt_collect_start(ctx, 0);
+	r = compat_poll(&pfd, 1, timeout_ms);
+	inputevt_collect_end(ctx, 0);
+
+	if (-1 == r && !is_temporary_error(errno))
+		s_warning("%s(): poll() failed on %s: %m", G_STRFUNC,
+			ctx->polling_method);
+
+	if (r > 0 || hash_list_length(ctx->readable) > 0) {
+		CTX_UNLOCK(ctx);
+		dispatched = inputevt_timer(ctx);
+	} else {
+		CTX_UNLOCK(ctx);
+	}
+
+	inputevt_wait_account(ctx, dispatched);
+
+	return dispatched;
 }
 
 /**
@@ -1745,26 +1998,130 @@ inputevt_dispatch(void)
  */
 void
 inputevt_close(void)
+{
+	inputevt_stid = THREAD_INVALID_ID;
+	inputevt_ctx_free(get_global_poll_ctx());
+}
+
+/**
+ * Turn the current thread into a reactor, running its own I/O event loop.
+ *
+ * Sources subsequently added by the thread through inputevt_add() are
+ * monitored by its own context, and their events are dispatched when the
+ * thread calls inputevt_wait().  The returned IDs can be given to
+ * inputevt_remove() from any thread.
+ *
+ * This requires kqueue() or epoll(), since there is no glib main loop to
+ * poll the sources otherwise.
+ *
+ * @return TRUE if the thread is now a reactor, FALSE on error with errno set.
+ */
+bool
+inputevt_reactor_init(void)
 {
 	struct poll_ctx *ctx;
+	unsigned r, stid = thread_small_id();
 
-	ctx = get_global_poll_ctx();
-	inputevt_stid = THREAD_INVALID_ID;
+	g_assert_log(stid != inputevt_stid,
+		"%s(): %s already runs the main I/O event loop",
+		G_STRFUNC, thread_name());
+	g_assert_log(NULL == poll_ctx_thread[stid],
+		"%s(): %s is already a reactor", G_STRFUNC, thread_name());
+
+	/*
+	 * The main loop must be initialized first: it captures the glib
+	 * default poll function, which reactors must leave alone.
+	 */
+
+	g_assert(get_global_poll_ctx()->initialized);
+
+	XMALLOC0(ctx);
+
+	spinlock(&poll_ctx_slk);
+
+	for (r = 1; r <= INPUTEVT_REACTOR_MAX; r++) {
+		if (NULL == poll_ctx_reactor[r]) {
+			poll_ctx_reactor[r] = ctx;
+			break;
+		}
+	}
+
+	spinunlock(&poll_ctx_slk);
+
+	if (r > INPUTEVT_REACTOR_MAX) {
+		xfree(ctx);
+		errno = EMFILE;
+		return FALSE;
+	}
+
+	ctx->reactor = r;
+	inputevt_ctx_init(ctx);
 
 	CTX_LOCK(ctx);
 
-	inputevt_purge_removed(ctx);
-	htable_free_null(&ctx->ht);
-	hash_list_free(&ctx->readable);
-	HFREE_NULL(ctx->used_poll_idx);
-	HFREE_NULL(ctx->used_event_id);
-	XFREE_NULL(ctx->relay);
-	XFREE_NULL(ctx->pfd_arr);
-	fd_close(&ctx->master_fd);
-	ctx->initialized = FALSE;
+	if (init_with_kqueue(ctx) && init_with_epoll(ctx)) {
+		int saved_errno = errno;
+
+		CTX_UNLOCK(ctx);
+		inputevt_ctx_free(ctx);
+		poll_ctx_reactor[r] = NULL;
+		xfree(ctx);
+		errno = saved_errno;
+		return FALSE;
+	}
 
 	CTX_UNLOCK(ctx);
-	mutex_destroy(&ctx->lock);
+
+	fd_set_close_on_exec(ctx->master_fd);
+	poll_ctx_thread[stid] = ctx;
+
+	if (inputevt_debug) {
+		s_debug("INPUTEVT %s is reactor #%u using %s",
+			thread_name(), r, ctx->polling_method);
+	}
+
+	return TRUE;
+}
+
+/**
+ * Stop being a reactor, releasing the I/O event loop of the current thread.
+ *
+ * Sources still registered are forgotten, and their IDs must no longer
+ * be used.
+ */
+void
+inputevt_reactor_close(void)
+{
+	unsigned stid = thread_small_id();
+	struct poll_ctx *ctx = poll_ctx_thread[stid];
+
+	g_assert_log(ctx != NULL,
+		"%s(): %s is not a reactor", G_STRFUNC, thread_name());
+
+	if (inputevt_debug) {
+		size_t count = htable_count(ctx->ht);
+
+		s_debug("INPUTEVT %s stops being reactor #%u, "
+			"with %zu file descriptor%s still monitored",
+			thread_name(), ctx->reactor, PLURAL(count));
+	}
+
+	poll_ctx_thread[stid] = NULL;
+	poll_ctx_reactor[ctx->reactor] = NULL;
+	inputevt_ctx_free(ctx);
+	xfree(ctx);
+}
+
+/**
+ * Is the thread running an I/O event loop, either the main one or that
+ * of a reactor?
+ */
+bool
+inputevt_is_loop_thread(unsigned id)
+{
+	g_assert(id < THREAD_MAX);
+
+	return id == inputevt_stid || poll_ctx_thread[id] != NULL;
 }
 
 /* vi: set ts=4 sw=4 cindent: */
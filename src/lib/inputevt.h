@@ -72,6 +72,11 @@ typedef void (*inputevt_handler_t) (
 void inputevt_init(int use_poll);
 void inputevt_close(void);
 void inputevt_dispatch(void);
+bool inputevt_can_wait(void);
+unsigned inputevt_wait(int timeout_ms);
+bool inputevt_reactor_init(void);
+void inputevt_reactor_close(void);
+bool inputevt_is_loop_thread(unsigned id);
 
 void inputevt_set_debug(unsigned level);
 void inputevt_set_trace(bool on);
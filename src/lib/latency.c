@@ -0,0 +1,555 @@
+/*
+ * Copyright (c) 2026, Raphael Manfredi
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Latency histograms for event handlers.
+ *
+ * Each instrumented site (typically the address of a callback routine, be
+ * it an I/O handler or a callout queue event) gets its own log-linear
+ * histogram, in the spirit of HDR histograms: values are bucketed by their
+ * power of two, and each power of two is further split linearly into
+ * LATENCY_SUB sub-buckets.  This gives a constant relative precision of
+ * about 12% over the whole range, for a fixed and small memory footprint.
+ *
+ * Recording a value is constant time: a hash table lookup to locate the
+ * site, then a few increments.  Each thread records into its own table,
+ * guarded by a lock that only reporting routines can contend for, hence
+ * the instrumentation can be left on permanently.
+ *
+ * Usage is:
+ *
+ *     tm_nano_t start;
+ *
+ *     latency_begin(&start);
+ *     (*handler)(...);
+ *     latency_end("what", func_to_pointer(handler), &start);
+ *
+ * @author Raphael Manfredi
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "latency.h"
+
+#include "htable.h"
+#include "log.h"
+#include "mutex.h"
+#include "pow2.h"
+#include "spinlock.h"
+#include "stacktrace.h"
+#include "stringify.h"
+#include "thread.h"
+#include "tm.h"
+#include "xmalloc.h"
+#include "xsort.h"
+
+#include "override.h"		/* Must be the last header included */
+
+#define LATENCY_SUB_BITS	3		/**< 8 sub-buckets per power of 2 */
+#define LATENCY_SUB			(1U << LATENCY_SUB_BITS)
+#define LATENCY_MAX_BITS	40		/**< Up to 2^40 ns, about 18 minutes */
+#define LATENCY_BUCKETS		((LATENCY_MAX_BITS - LATENCY_SUB_BITS + 1) * \
+								LATENCY_SUB)
+
+enum latency_site_magic { LATENCY_SITE_MAGIC = 0x40d7a9e3 };
+
+/**
+ * A latency histogram for a given site.
+ */
+struct latency_site {
+	enum latency_site_magic magic;
+	const char *what;			/**< Static string, kind of site */
+	const void *site;			/**< Site address, key in table */
+	uint64 count;				/**< Amount of recorded values */
+	uint64 total;				/**< Sum of recorded values, in ns */
+	uint64 max;					/**< Maximum value recorded, in ns */
+	uint32 bucket[LATENCY_BUCKETS];
+};
+
+static inline void
+latency_site_check(const struct latency_site * const ls)
+{
+	g_assert(ls != NULL);
+	g_assert(LATENCY_SITE_MAGIC == ls->magic);
+}
+
+/**
+ * Summary of a site, used for reporting.
+ */
+struct latency_summary {
+	const char *what;
+	const void *site;
+	uint64 count;
+	uint64 total;
+	uint64 max;
+	uint64 p50;
+	uint64 p90;
+	uint64 p99;
+	uint64 p999;
+};
+
+/**
+ * The sites recorded by a thread.
+ *
+ * Only the owning thread inserts and updates sites, the lock being taken
+ * by the other threads only to collect or reset the histograms.  Blocks
+ * are never freed, a reused thread small ID inheriting the sites.
+ */
+struct latency_thread {
+	htable_t *sites;			/**< site -> struct latency_site */
+	spinlock_t lock;
+};
+
+static struct latency_thread *latency_threads[THREAD_MAX];
+static mutex_t latency_mtx = MUTEX_INIT;
+static bool latency_disabled;			/**< Enabled by default */
+static tm_nano_t latency_since;			/**< Time of last reset */
+
+#define LATENCY_LOCK		mutex_lock(&latency_mtx)
+#define LATENCY_UNLOCK		mutex_unlock(&latency_mtx)
+
+#define LATENCY_THREAD_LOCK(lt)		spinlock_hidden(&(lt)->lock)
+#define LATENCY_THREAD_UNLOCK(lt)	spinunlock_hidden(&(lt)->lock)
+
+/**
+ * Compute histogram bucket index for a value.
+ */
+static inline uint
+latency_bucket(uint64 v)
+{
+	uint shift, idx;
+
+	if (v < LATENCY_SUB)
+		return v;
+
+	shift = highest_bit_set64(v) - LATENCY_SUB_BITS;
+	idx = (shift + 1) * LATENCY_SUB + ((v >> shift) & (LATENCY_SUB - 1));
+
+	return MIN(idx, LATENCY_BUCKETS - 1);
+}
+
+/**
+ * @return highest value that would be recorded into the given bucket.
+ */
+static uint64
+latency_bucket_value(uint idx)
+{
+	uint shift;
+
+	g_assert(idx < LATENCY_BUCKETS);
+
+	if (idx < LATENCY_SUB)
+		return idx;
+
+	shift = idx / LATENCY_SUB - 1;
+
+	return ((uint64) (LATENCY_SUB + idx % LATENCY_SUB) << shift) +
+		((uint64) 1 << shift) - 1;
+}
+
+/**
+ * Allocate the latency block for the thread.
+ */
+static struct latency_thread * G_COLD
+latency_thread_allocate(uint stid)
+{
+	struct latency_thread *lt;
+
+	g_assert(stid < N_ITEMS(latency_threads));
+	g_assert(NULL == latency_threads[stid]);
+
+	XMALLOC0(lt);
+	lt->sites = htable_create(HASH_KEY_SELF, 0);
+	spinlock_init(&lt->lock);
+
+	LATENCY_LOCK;
+	if G_UNLIKELY(0 == latency_since.tv_sec)
+		tm_precise_time(&latency_since);
+	LATENCY_UNLOCK;
+
+	atomic_mb();		/* Initialized block visible before publishing it */
+	latency_threads[stid] = lt;
+
+	return lt;
+}
+
+/**
+ * Mark the beginning of a measurement.
+ *
+ * @param start		where the starting time is recorded
+ */
+void
+latency_begin(tm_nano_t *start)
+{
+	if G_UNLIKELY(latency_disabled) {
+		start->tv_sec = 0;
+		start->tv_nsec = 0;
+	} else {
+		tm_precise_time(start);
+	}
+}
+
+/**
+ * Record latency for a site.
+ *
+ * @param what		static string, describing the kind of site
+ * @param site		the site address (routine being called, usually)
+ * @param ns		the measured latency, in nanoseconds
+ */
+void
+latency_record(const char *what, const void *site, uint64 ns)
+{
+	uint stid = thread_small_id();
+	struct latency_thread *lt = latency_threads[stid];
+	struct latency_site *ls;
+
+	if G_UNLIKELY(NULL == lt)
+		lt = latency_thread_allocate(stid);
+
+	LATENCY_THREAD_LOCK(lt);
+
+	ls = htable_lookup(lt->sites, site);
+
+	if G_UNLIKELY(NULL == ls) {
+		XMALLOC0(ls);
+		ls->magic = LATENCY_SITE_MAGIC;
+		ls->what = what;
+		ls->site = site;
+		htable_insert(lt->sites, site, ls);
+	}
+
+	latency_site_check(ls);
+
+	ls->count++;
+	ls->total += ns;
+	ls->max = MAX(ls->max, ns);
+	ls->bucket[latency_bucket(ns)]++;
+
+	LATENCY_THREAD_UNLOCK(lt);
+}
+
+/**
+ * Mark the end of a measurement started with latency_begin().
+ *
+ * @param what		static string, describing the kind of site
+ * @param site		the site address (routine being called, usually)
+ * @param start		the starting time, filled by latency_begin()
+ */
+void
+latency_end(const char *what, const void *site, const tm_nano_t *start)
+{
+	tm_nano_t end, elapsed;
+
+	if G_UNLIKELY(0 == start->tv_sec && 0 == start->tv_nsec)
+		return;		/* Tracking was disabled when latency_begin() ran */
+
+	tm_precise_time(&end);
+	tm_precise_elapsed(&elapsed, &end, start);
+
+	/*
+	 * Since we are using the wall clock, ignore negative values caused
+	 * by adjustments of the system time.
+	 */
+
+	if G_UNLIKELY(elapsed.tv_sec < 0)
+		return;
+
+	latency_record(what, site, tmn2ns(&elapsed));
+}
+
+/**
+ * Turn latency tracking on or off.
+ */
+void
+latency_enable(bool on)
+{
+	latency_disabled = !on;
+}
+
+/**
+ * @return whether latency tracking is enabled.
+ */
+bool
+latency_is_enabled(void)
+{
+	return !latency_disabled;
+}
+
+static bool
+latency_site_free(const void *unused_key, void *value, void *unused_data)
+{
+	struct latency_site *ls = value;
+
+	(void) unused_key;
+	(void) unused_data;
+
+	latency_site_check(ls);
+	ls->magic = 0;
+	xfree(ls);
+
+	return TRUE;
+}
+
+/**
+ * Discard all the recorded latencies.
+ */
+void
+latency_reset(void)
+{
+	uint i;
+
+	LATENCY_LOCK;
+
+	for (i = 0; i < N_ITEMS(latency_threads); i++) {
+		struct latency_thread *lt = latency_threads[i];
+
+		if (NULL == lt)
+			continue;
+
+		LATENCY_THREAD_LOCK(lt);
+		htable_foreach_remove(lt->sites, latency_site_free, NULL);
+		LATENCY_THREAD_UNLOCK(lt);
+	}
+
+	tm_precise_time(&latency_since);
+	LATENCY_UNLOCK;
+}
+
+/**
+ * Add the histogram of a thread site to the merged sites.
+ */
+static void
+latency_merge_site(const void *key, void *value, void *data)
+{
+	const struct latency_site *ls = value;
+	htable_t *merged = data;
+	struct latency_site *ms;
+	uint i;
+
+	latency_site_check(ls);
+
+	ms = htable_lookup(merged, key);
+
+	if (NULL == ms) {
+		XMALLOC0(ms);
+		ms->magic = LATENCY_SITE_MAGIC;
+		ms->what = ls->what;
+		ms->site = ls->site;
+		htable_insert(merged, key, ms);
+	}
+
+	ms->count += ls->count;
+	ms->total += ls->total;
+	ms->max = MAX(ms->max, ls->max);
+
+	for (i = 0; i < LATENCY_BUCKETS; i++)
+		ms->bucket[i] += ls->bucket[i];
+}
+
+/**
+ * Merge the sites recorded by all the threads.
+ *
+ * @return new table of merged sites, to be freed with latency_merge_free().
+ */
+static htable_t *
+latency_merge(void)
+{
+	htable_t *merged = htable_create(HASH_KEY_SELF, 0);
+	uint i;
+
+	for (i = 0; i < N_ITEMS(latency_threads); i++) {
+		struct latency_thread *lt = latency_threads[i];
+
+		if (NULL == lt)
+			continue;
+
+		LATENCY_THREAD_LOCK(lt);
+		htable_foreach(lt->sites, latency_merge_site, merged);
+		LATENCY_THREAD_UNLOCK(lt);
+	}
+
+	return merged;
+}
+
+/**
+ * Free table returned by latency_merge().
+ */
+static void
+latency_merge_free(htable_t *merged)
+{
+	htable_foreach_remove(merged, latency_site_free, NULL);
+	htable_free_null(&merged);
+}
+
+/**
+ * @return amount of sites for which we have recorded latencies.
+ */
+size_t
+latency_site_count(void)
+{
+	htable_t *merged;
+	size_t count;
+
+	merged = latency_merge();
+	count = htable_count(merged);
+	latency_merge_free(merged);
+
+	return count;
+}
+
+/**
+ * @return the value at the given percentile (expressed in 1/1000) for a site.
+ */
+static uint64
+latency_site_percentile(const struct latency_site *ls, uint permille)
+{
+	uint64 target, seen = 0;
+	uint i;
+
+	latency_site_check(ls);
+	g_assert(permille <= 1000);
+
+	if (0 == ls->count)
+		return 0;
+
+	target = (ls->count * permille + 999) / 1000;
+	target = MAX(target, 1);
+
+	for (i = 0; i < LATENCY_BUCKETS; i++) {
+		seen += ls->bucket[i];
+		if (seen >= target)
+			return MIN(latency_bucket_value(i), ls->max);
+	}
+
+	return ls->max;
+}
+
+struct latency_fill {
+	struct latency_summary *vec;
+	size_t count;
+	size_t capacity;
+};
+
+static void
+latency_summarize(const void *unused_key, void *value, void *data)
+{
+	const struct latency_site *ls = value;
+	struct latency_fill *filler = data;
+	struct latency_summary *sum;
+
+	(void) unused_key;
+	latency_site_check(ls);
+
+	if (filler->count >= filler->capacity)
+		return;
+
+	sum = &filler->vec[filler->count++];
+	sum->what = ls->what;
+	sum->site = ls->site;
+	sum->count = ls->count;
+	sum->total = ls->total;
+	sum->max = ls->max;
+	sum->p50 = latency_site_percentile(ls, 500);
+	sum->p90 = latency_site_percentile(ls, 900);
+	sum->p99 = latency_site_percentile(ls, 990);
+	sum->p999 = latency_site_percentile(ls, 999);
+}
+
+#define LATENCY_CMP(field)										\
+static int														\
+latency_cmp_ ## field(const void *a, const void *b)				\
+{																\
+	const struct latency_summary *sa = a, *sb = b;				\
+	return CMP(sb->field, sa->field);	/* Decreasing order */	\
+}
+
+LATENCY_CMP(total)
+LATENCY_CMP(max)
+LATENCY_CMP(count)
+LATENCY_CMP(p99)
+
+#undef LATENCY_CMP
+
+/**
+ * Dump latency histograms summary to specified log agent.
+ *
+ * @param la		the logging agent
+ * @param how		how to sort the sites
+ * @param top		amount of sites to show, 0 meaning all of them
+ */
+void
+latency_dump_log(logagent_t *la, enum latency_sort how, size_t top)
+{
+	struct latency_fill filler;
+	htable_t *merged;
+	tm_nano_t now;
+	size_t i;
+	cmp_fn_t cmp;
+
+	merged = latency_merge();
+	filler.capacity = htable_count(merged);
+	filler.count = 0;
+	XMALLOC_ARRAY(filler.vec, MAX(filler.capacity, 1));
+	htable_foreach(merged, latency_summarize, &filler);
+	latency_merge_free(merged);
+
+	switch (how) {
+	case LATENCY_SORT_MAX:		cmp = latency_cmp_max;		break;
+	case LATENCY_SORT_COUNT:	cmp = latency_cmp_count;	break;
+	case LATENCY_SORT_P99:		cmp = latency_cmp_p99;		break;
+	case LATENCY_SORT_TOTAL:
+	default:					cmp = latency_cmp_total;	break;
+	}
+
+	xqsort(filler.vec, filler.count, sizeof filler.vec[0], cmp);
+
+	tm_precise_time(&now);
+	log_info(la, "latency tracking is %s, %zu site%s recorded over %.3f secs",
+		latency_disabled ? "off" : "on",
+		PLURAL(filler.count), tm_precise_elapsed_f(&now, &latency_since));
+	log_info(la, "%10s %10s %9s %9s %9s %9s %10s  %s",
+		"calls", "total ms", "p50 us", "p90 us", "p99 us", "p99.9 us",
+		"max us", "site");
+
+	if (0 == top)
+		top = filler.count;
+
+	for (i = 0; i < filler.count && i < top; i++) {
+		const struct latency_summary *sum = &filler.vec[i];
+
+		log_info(la, "%10s %10.2f %9.1f %9.1f %9.1f %9.1f %10.1f  %s %s()",
+			uint64_to_string(sum->count),
+			sum->total / 1e6,
+			sum->p50 / 1e3, sum->p90 / 1e3, sum->p99 / 1e3, sum->p999 / 1e3,
+			sum->max / 1e3,
+			sum->what, stacktrace_routine_name(sum->site, FALSE));
+	}
+
+	xfree(filler.vec);
+}
+
+/* vi: set ts=4 sw=4 cindent: */
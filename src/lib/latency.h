@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2026, Raphael Manfredi
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Latency histograms for event handlers.
+ *
+ * @author Raphael Manfredi
+ * @date 2026
+ */
+
+#ifndef _latency_h_
+#define _latency_h_
+
+#include "tm.h"
+
+struct logagent;
+
+/**
+ * Sorting criteria for latency_dump_log().
+ */
+enum latency_sort {
+	LATENCY_SORT_TOTAL = 0,		/**< By total time spent in handler */
+	LATENCY_SORT_MAX,			/**< By maximum latency observed */
+	LATENCY_SORT_COUNT,			/**< By amount of calls */
+	LATENCY_SORT_P99			/**< By 99th percentile */
+};
+
+/*
+ * Public interface.
+ */
+
+void latency_begin(tm_nano_t *start);
+void latency_end(const char *what, const void *site, const tm_nano_t *start);
+void latency_record(const char *what, const void *site, uint64 ns);
+
+void latency_enable(bool on);
+bool latency_is_enabled(void);
+void latency_reset(void);
+size_t latency_site_count(void);
+void latency_dump_log(struct logagent *la, enum latency_sort how, size_t top);
+
+#endif /* _latency_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,290 @@
+/*
+ * phash-test -- perfect hash table tests.
+ *
+ * Copyright (c) 2026 Raphael Manfredi <Raphael_Manfredi@pobox.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+
+#include "lib/misc.h"
+#include "lib/phash.h"
+#include "lib/progname.h"
+#include "lib/rand31.h"
+#include "lib/str.h"
+#include "lib/stringify.h"
+#include "lib/xmalloc.h"
+
+#define DEFAULT_KEYS	1000		/* Largest key set */
+#define DEFAULT_PROBES	10000		/* Absent keys looked up per set */
+
+static bool verbose_mode;
+
+static void G_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-hV] [-c keys] [-p probes] [-R seed]\n"
+		"  -c : sets size of the largest key set (default = %u)\n"
+		"  -h : prints this help message\n"
+		"  -p : sets amount of absent keys to probe (default = %u)\n"
+		"  -R : seed for repeatable random key sets\n"
+		"  -V : verbose mode -- print status after each successful test\n"
+		, getprogname(), DEFAULT_KEYS, DEFAULT_PROBES);
+	exit(EXIT_FAILURE);
+}
+
+static uint64
+random_key(void)
+{
+	return (uint64) rand31_u32() << 32 | rand31_u32();
+}
+
+/**
+ * Hash a string the way callers do, one character at a time.
+ */
+static uint64
+string_key(const char *s)
+{
+	uint64 h = 0;
+
+	while ('\0' != *s)
+		h = phash_string_update(h, *s++);
+
+	return h;
+}
+
+static bool
+key_is_present(const uint64 *keys, size_t n, uint64 key)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		if (keys[i] == key)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/**
+ * Build a table for the set of keys, then look up all the keys and a set
+ * of keys that are not part of the set.
+ */
+static void
+test_keys(const uint64 *keys, size_t n, size_t probes, const char *what)
+{
+	phash_t ph;
+	size_t i, size, used = 0, hits = 0;
+
+	if (!phash_build(&ph, keys, n))
+		g_error("cannot build table for %zu %s key%s", n, what, plural(n));
+
+	if (ph.size < 4 * n)
+		g_error("table of %zu slots for %zu keys", ph.size, n);
+
+	for (i = 0; i < ph.size; i++) {
+		if (ph.slot[i] != 0)
+			used++;
+	}
+
+	if (used != n)
+		g_error("%zu slot%s used for %zu keys", PLURAL(used), n);
+
+	for (i = 0; i < n; i++) {
+		size_t idx = phash_lookup(&ph, keys[i]);
+
+		if (idx != i) {
+			g_error("%s key #%zu found at index %zd",
+				what, i, PHASH_NONE == idx ? -1 : (ssize_t) idx);
+		}
+	}
+
+	/*
+	 * An absent key can map to a used slot, in which case the key at the
+	 * returned index must differ so that callers can reject it.
+	 */
+
+	for (i = 0; i < probes; i++) {
+		uint64 key = random_key();
+		size_t idx;
+
+		if (key_is_present(keys, n, key))
+			continue;
+
+		idx = phash_lookup(&ph, key);
+
+		if (PHASH_NONE == idx)
+			continue;
+
+		hits++;
+
+		if (idx >= n)
+			g_error("absent key mapped to index %zu, out of %zu", idx, n);
+		if (keys[idx] == key)
+			g_error("absent key matched key #%zu", idx);
+	}
+
+	/*
+	 * With a load factor below 1/4, most absent keys hit an empty slot.
+	 */
+
+	if (probes >= 100 && hits > probes / 2) {
+		g_error("%zu absent key%s out of %zu mapped to a used slot",
+			PLURAL(hits), probes);
+	}
+
+	size = ph.size;
+	phash_free(&ph);
+
+	if (ph.slot != NULL || ph.size != 0)
+		g_error("table not reset after freeing");
+
+	if (verbose_mode) {
+		printf("%zu %s key%s in %zu slots, %zu/%zu absent key%s "
+			"rejected by compare - OK\n",
+			n, what, plural(n), size, hits, PLURAL(probes));
+	}
+}
+
+static void
+test_random(size_t n, size_t probes)
+{
+	uint64 *keys;
+	size_t i;
+
+	XMALLOC_ARRAY(keys, n);
+
+	for (i = 0; i < n; i++) {
+		do {
+			keys[i] = random_key();
+		} while (key_is_present(keys, i, keys[i]));
+	}
+
+	test_keys(keys, n, probes, "random");
+	xfree(keys);
+}
+
+static void
+test_strings(size_t n, size_t probes)
+{
+	uint64 *keys;
+	size_t i;
+
+	XMALLOC_ARRAY(keys, n);
+
+	/*
+	 * Short identifiers differing by one or two characters, like the
+	 * protocol identifiers this is meant for.
+	 */
+
+	for (i = 0; i < n; i++) {
+		char id[16];
+
+		str_bprintf(id, sizeof id, "ID%zu", i);
+		keys[i] = string_key(id);
+	}
+
+	test_keys(keys, n, probes, "string");
+	xfree(keys);
+}
+
+static void
+test_duplicates(void)
+{
+	uint64 keys[3];
+	phash_t ph;
+
+	keys[0] = string_key("GTKG");
+	keys[1] = string_key("GUE");
+	keys[2] = string_key("GTKG");
+
+	if (phash_build(&ph, keys, N_ITEMS(keys)))
+		g_error("table built with duplicate keys");
+
+	if (verbose_mode)
+		printf("duplicate keys refused - OK\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	size_t count = DEFAULT_KEYS;
+	size_t probes = DEFAULT_PROBES;
+	unsigned rseed = 0;
+	size_t n;
+	int c;
+	const char options[] = "c:hp:R:V";
+
+	progstart(argc, argv);
+
+	while ((c = getopt(argc, argv, options)) != EOF) {
+		switch (c) {
+		case 'c':			/* largest key set */
+			count = atol(optarg);
+			break;
+		case 'p':			/* amount of absent keys */
+			probes = atol(optarg);
+			break;
+		case 'R':			/* randomize in a repeatable way */
+			rseed = atoi(optarg);
+			break;
+		case 'V':			/* verbose mode */
+			verbose_mode = TRUE;
+			break;
+		case 'h':			/* show help */
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if ((argc -= optind) != 0)
+		usage();
+
+	if (0 == count)
+		usage();
+
+	rand31_set_seed(rseed);
+
+	if (verbose_mode)
+		printf("using random seed %u\n", rand31_initial_seed());
+
+	for (n = 1; n <= count; n = n < 10 ? n + 1 : n * 3) {
+		test_random(n, probes);
+		test_strings(n, probes);
+	}
+
+	test_duplicates();
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
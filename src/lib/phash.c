@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2026, Raphael Manfredi
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Perfect hashing of static key sets.
+ *
+ * This is meant for small tables of protocol identifiers that are known
+ * at compile time and looked up for every incoming message, where a
+ * binary search or a general-purpose hash table costs more than it should.
+ *
+ * The table is built once at initialization time, deterministically: we
+ * try a fixed sequence of odd multipliers for increasing table sizes,
+ * until all the keys land in distinct slots.  With a load factor below 1/4,
+ * a suitable multiplier is found after a few hundred attempts at most for
+ * sets of a hundred keys.
+ *
+ * @author Raphael Manfredi
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "phash.h"
+
+#include "pow2.h"
+#include "xmalloc.h"
+
+#include "override.h"		/* Must be the last header included */
+
+#define PHASH_ATTEMPTS	4096	/**< Multipliers tried for a given size */
+#define PHASH_MAXBITS	16		/**< Largest table: 2^16 slots */
+
+/**
+ * Generate the next multiplier to try (splitmix64 sequence).
+ */
+static uint64
+phash_next_mult(uint64 *state)
+{
+	uint64 z;
+
+	z = (*state += UINT64_CONST(0x9e3779b97f4a7c15));
+	z = (z ^ (z >> 30)) * UINT64_CONST(0xbf58476d1ce4e5b9);
+	z = (z ^ (z >> 27)) * UINT64_CONST(0x94d049bb133111eb);
+	z ^= z >> 31;
+
+	return z | 1;		/* Must be odd */
+}
+
+/**
+ * Attempt to place all the keys in the table with the current multiplier.
+ *
+ * @return TRUE if there was no collision.
+ */
+static bool
+phash_try(phash_t *ph, const uint64 *keys, size_t n)
+{
+	size_t i;
+
+	memset(ph->slot, 0, ph->size * sizeof ph->slot[0]);
+
+	for (i = 0; i < n; i++) {
+		size_t s = phash_slot(ph, keys[i]);
+
+		if (ph->slot[s] != 0)
+			return FALSE;
+
+		ph->slot[s] = i + 1;
+	}
+
+	return TRUE;
+}
+
+/**
+ * Build a perfect hash table for the given set of keys.
+ *
+ * The index of each key in the array is what phash_lookup() will later
+ * return for that key.
+ *
+ * @param ph		the table to initialize
+ * @param keys		the set of keys, which must all be distinct
+ * @param n			amount of keys
+ *
+ * @return TRUE if OK, FALSE if the keys were not distinct.
+ */
+bool
+phash_build(phash_t *ph, const uint64 *keys, size_t n)
+{
+	uint64 state = 0;
+	size_t i, j;
+	int bits;
+
+	g_assert(ph != NULL);
+	g_assert(keys != NULL);
+	g_assert(n != 0 && n < (1U << PHASH_MAXBITS) / 4);
+
+	/*
+	 * Two identical keys would always collide: check that first, since
+	 * the sets are small and this is done once.
+	 */
+
+	for (i = 0; i < n; i++) {
+		for (j = i + 1; j < n; j++) {
+			if (keys[i] == keys[j])
+				return FALSE;
+		}
+	}
+
+	for (bits = highest_bit_set(n) + 3; bits <= PHASH_MAXBITS; bits++) {
+		ph->size = (size_t) 1 << bits;
+		ph->shift = 64 - bits;
+		XMALLOC_ARRAY(ph->slot, ph->size);
+
+		for (i = 0; i < PHASH_ATTEMPTS; i++) {
+			ph->mult = phash_next_mult(&state);
+			if (phash_try(ph, keys, n))
+				return TRUE;
+		}
+
+		XFREE_NULL(ph->slot);
+	}
+
+	g_error("%s(): cannot build table for %zu keys", G_STRFUNC, n);
+}
+
+/**
+ * Free the slot table.
+ */
+void
+phash_free(phash_t *ph)
+{
+	g_assert(ph != NULL);
+
+	XFREE_NULL(ph->slot);
+	ph->size = 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2026, Raphael Manfredi
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Perfect hashing of static key sets.
+ *
+ * @author Raphael Manfredi
+ * @date 2026
+ */
+
+#ifndef _phash_h_
+#define _phash_h_
+
+#define PHASH_NONE		((size_t) -1)	/**< Signals a key not in the set */
+
+/**
+ * A perfect hash table.
+ *
+ * The key set is known beforehand and never changes: a multiplier is
+ * chosen so that the top bits of the product of each key by the multiplier
+ * are distinct for all the keys, and these bits index a slot table giving
+ * back the index of the key in the original set.
+ *
+ * Lookups are therefore a multiplication, a shift and a single memory
+ * access.  Since a key not in the set can map to an occupied slot, callers
+ * need to compare the original key at the returned index.
+ */
+typedef struct phash {
+	uint64 mult;		/**< Odd multiplier */
+	uint shift;			/**< Right shift to get the slot from the product */
+	size_t size;		/**< Amount of slots */
+	uint16 *slot;		/**< Slot table, holds index + 1, 0 for empty */
+} phash_t;
+
+/**
+ * Compute the slot of a key.
+ */
+static inline size_t
+phash_slot(const phash_t *ph, uint64 key)
+{
+	return (key * ph->mult) >> ph->shift;
+}
+
+/**
+ * Lookup key in the perfect hash table.
+ *
+ * @return the index of the key within the set used to build the table if
+ * the key can be part of the set, PHASH_NONE if it surely is not.
+ */
+static inline size_t
+phash_lookup(const phash_t *ph, uint64 key)
+{
+	uint16 v = ph->slot[phash_slot(ph, key)];
+
+	return 0 == v ? PHASH_NONE : v - 1U;
+}
+
+/**
+ * Incrementally compute the hash of a string, one character at a time,
+ * so that callers can hash the data whilst validating it.
+ *
+ * @param h		the hash computed so far, 0 initially
+ * @param c		the next character
+ *
+ * @return the updated hash value.
+ */
+static inline uint64
+phash_string_update(uint64 h, uchar c)
+{
+	return (h ^ c) * UINT64_CONST(0x100000001b3);	/* FNV-1a */
+}
+
+/*
+ * Public interface.
+ */
+
+bool phash_build(phash_t *ph, const uint64 *keys, size_t n);
+void phash_free(phash_t *ph);
+
+#endif /* _phash_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
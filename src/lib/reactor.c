@@ -0,0 +1,273 @@
+/*
+ * Copyright (c) 2026, Raphael Manfredi
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * I/O reactors.
+ *
+ * A reactor is a thread running its own I/O event loop, so that the
+ * processing of I/O events can be spread over several cores instead of
+ * being done entirely by the main thread.
+ *
+ * Each reactor monitors the sources it adds through inputevt_add() and has
+ * an I/O thread event queue, so work is handed to it with reactor_post()
+ * and results are sent back to the main thread with teq_post() or
+ * teq_safe_post().  Sources are sharded among reactors by file descriptor,
+ * so that a given connection is always serviced by the same thread.
+ *
+ * Reactors are optional: when none is running, reactor_post() returns FALSE
+ * and callers must process the I/O from the main thread as usual.
+ *
+ * The socket layer uses reactors to read UDP datagrams, when the
+ * "io_reactors" property is non-zero and there is more than one CPU.
+ * TCP connections, along with their RX and TX stacks, are still serviced
+ * by the main thread.
+ *
+ * @author Raphael Manfredi
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "reactor.h"
+
+#include "atomic.h"
+#include "fd.h"
+#include "inputevt.h"
+#include "log.h"
+#include "str.h"
+#include "stringify.h"
+#include "teq.h"
+#include "thread.h"
+
+#include "override.h"		/* Must be the last header included */
+
+#define REACTOR_MAX		16		/**< Maximum amount of reactors */
+
+/**
+ * A reactor thread.
+ */
+static struct reactor {
+	unsigned stid;				/**< Thread running the reactor */
+	bool ready;					/**< Set once the reactor can accept work */
+	bool launched;				/**< Set once the reactor is initialized */
+	char name[24];				/**< Thread name */
+} reactors[REACTOR_MAX];
+
+static unsigned reactor_started;	/**< Amount of reactors launched */
+static bool reactor_run;			/**< Cleared to request termination */
+
+/**
+ * No-op event, used to wake up reactors.
+ */
+static void
+reactor_wakeup(void *unused_arg)
+{
+	(void) unused_arg;
+}
+
+/**
+ * Reactor thread main loop.
+ */
+static void *
+reactor_main(void *arg)
+{
+	struct reactor *r = arg;
+
+	thread_set_name(r->name);
+
+	if (!inputevt_reactor_init()) {
+		s_warning("%s(): cannot run I/O event loop in %s: %m",
+			G_STRFUNC, thread_name());
+		atomic_bool_set(&r->launched, TRUE);
+		return NULL;
+	}
+
+	teq_io_create();
+	atomic_bool_set(&r->ready, TRUE);
+	atomic_bool_set(&r->launched, TRUE);
+
+	while (atomic_bool_get(&reactor_run))
+		(void) inputevt_wait(-1);
+
+	atomic_bool_set(&r->ready, FALSE);
+	inputevt_reactor_close();
+
+	return NULL;
+}
+
+/**
+ * Launch I/O reactors.
+ *
+ * @param n		amount of reactors wanted
+ *
+ * Returns once all the launched reactors are either ready to accept work or
+ * have failed to initialize.
+ *
+ * @return the amount of reactors launched, which may be less than requested.
+ */
+unsigned
+reactor_start(unsigned n)
+{
+	unsigned i;
+
+	g_assert_log(0 == reactor_started,
+		"%s(): %u reactor%s already started", G_STRFUNC, PLURAL(reactor_started));
+
+	n = MIN(n, REACTOR_MAX);
+	atomic_bool_set(&reactor_run, TRUE);
+
+	for (i = 0; i < n; i++) {
+		struct reactor *r = &reactors[reactor_started];
+		int id;
+
+		str_bprintf(r->name, sizeof r->name, "I/O reactor #%u", reactor_started);
+		r->ready = r->launched = FALSE;
+
+		id = thread_create(reactor_main, r,
+				THREAD_F_NO_POOL, THREAD_STACK_DFLT);
+
+		if (-1 == id) {
+			s_warning("%s(): cannot launch reactor #%u: %m",
+				G_STRFUNC, reactor_started);
+			break;
+		}
+
+		r->stid = id;
+		reactor_started++;
+	}
+
+	/*
+	 * Wait for the reactors to settle, so that reactor_stop() knows which
+	 * ones run their I/O event loop and need to be woken up.
+	 */
+
+	for (i = 0; i < reactor_started; i++) {
+		while (!atomic_bool_get(&reactors[i].launched))
+			thread_yield();
+	}
+
+	return reactor_started;
+}
+
+/**
+ * Stop all the reactors, waiting for their threads to exit.
+ *
+ * Sources they were still monitoring are forgotten.
+ */
+void
+reactor_stop(void)
+{
+	unsigned i;
+
+	atomic_bool_set(&reactor_run, FALSE);
+
+	for (i = 0; i < reactor_started; i++) {
+		struct reactor *r = &reactors[i];
+
+		/* Post a no-op event to get the reactor out of its I/O wait */
+
+		if (atomic_bool_get(&r->ready))
+			teq_safe_post(r->stid, reactor_wakeup, NULL);
+	}
+
+	for (i = 0; i < reactor_started; i++) {
+		struct reactor *r = &reactors[i];
+
+		if (-1 == thread_join(r->stid, NULL)) {
+			s_warning("%s(): cannot join %s: %m",
+				G_STRFUNC, thread_id_name(r->stid));
+		}
+	}
+
+	reactor_started = 0;
+}
+
+/**
+ * @return the amount of reactors ready to accept work.
+ */
+unsigned
+reactor_count(void)
+{
+	unsigned i, n = 0;
+
+	for (i = 0; i < reactor_started; i++) {
+		if (atomic_bool_get(&reactors[i].ready))
+			n++;
+	}
+
+	return n;
+}
+
+/**
+ * Select the reactor in charge of servicing a file descriptor.
+ *
+ * @param fd		the file descriptor
+ *
+ * @return the thread ID of the reactor, THREAD_INVALID_ID if the I/O on
+ * that file descriptor must be processed by the main thread.
+ */
+unsigned
+reactor_for_fd(int fd)
+{
+	struct reactor *r;
+
+	g_assert(is_valid_fd(fd));
+
+	if (0 == reactor_started)
+		return THREAD_INVALID_ID;
+
+	r = &reactors[fd % reactor_started];
+
+	return atomic_bool_get(&r->ready) ? r->stid : THREAD_INVALID_ID;
+}
+
+/**
+ * Hand work on a file descriptor to the reactor in charge of it.
+ *
+ * The routine is invoked in the reactor thread, from its I/O event loop.
+ *
+ * @param fd		the file descriptor
+ * @param routine	the routine to invoke in the reactor
+ * @param data		argument for the routine
+ *
+ * @return TRUE if the work was posted, FALSE if there is no reactor ready
+ * for that file descriptor and the caller must process it itself.
+ */
+bool
+reactor_post(int fd, notify_fn_t routine, void *data)
+{
+	unsigned id = reactor_for_fd(fd);
+
+	g_assert(routine != NULL);
+
+	if (THREAD_INVALID_ID == id)
+		return FALSE;
+
+	teq_safe_post(id, routine, data);
+	return TRUE;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2026, Raphael Manfredi
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * I/O reactors.
+ *
+ * @author Raphael Manfredi
+ * @date 2026
+ */
+
+#ifndef _reactor_h_
+#define _reactor_h_
+
+/*
+ * Public interface.
+ */
+
+unsigned reactor_start(unsigned n);
+void reactor_stop(void);
+unsigned reactor_count(void);
+unsigned reactor_for_fd(int fd);
+bool reactor_post(int fd, notify_fn_t routine, void *data);
+
+#endif /* _reactor_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -39,6 +39,7 @@
 #include "hashing.h"			/* For binary_hash() */
 #include "host_addr.h"
 #include "random.h"
+#include "spinlock.h"
 #include "tea.h"
 #include "unsigned.h"
 #include "walloc.h"
@@ -56,8 +57,12 @@ struct sectoken_gen {
 	size_t keycnt;				/**< Amount of keys in the keys[] array */
 	cevent_t *rotate_ev;		/**< Rotate event */
 	time_delta_t refresh;		/**< Refresh period in seconds */
+	spinlock_t lock;			/**< Protects keys[] during rotation */
 };
 
+#define SECTOKEN_LOCK(s)	spinlock_hidden(&(s)->lock)
+#define SECTOKEN_UNLOCK(s)	spinunlock_hidden(&(s)->lock)
+
 static inline void
 sectoken_gen_check(const sectoken_gen_t * const stg)
 {
@@ -101,6 +106,7 @@ sectoken_generate_n(sectoken_gen_t *stg, size_t n,
 	char block[8];
 	char enc[8];
 	char *p = block;
+	tea_key_t key;
 
 	sectoken_gen_check(stg);
 	g_assert(tok != NULL);
@@ -108,6 +114,15 @@ sectoken_generate_n(sectoken_gen_t *stg, size_t n,
 	g_assert(n < stg->keycnt);
 	g_assert((NULL != data) == (len != 0));
 
+	/*
+	 * Tokens can be validated from any thread, whilst keys are rotated
+	 * by the main thread.
+	 */
+
+	SECTOKEN_LOCK(stg);
+	key = stg->keys[n];
+	SECTOKEN_UNLOCK(stg);
+
 	switch (host_addr_net(addr)) {
 	case NET_TYPE_IPV4:
 		p = poke_be32(p, host_addr_ipv4(addr));
@@ -134,7 +149,7 @@ sectoken_generate_n(sectoken_gen_t *stg, size_t n,
 	STATIC_ASSERT(sizeof(tok->v) == sizeof(uint32));
 	STATIC_ASSERT(sizeof(block) == sizeof(enc));
 
-	tea_encrypt(&stg->keys[n], enc, ARYLEN(block));
+	tea_encrypt(&key, enc, ARYLEN(block));
 
 	/*
 	 * If they gave contextual data, encrypt them by block of TEA_BLOCK_SIZE
@@ -165,7 +180,7 @@ sectoken_generate_n(sectoken_gen_t *stg, size_t n,
 			 * output with XOR.
 			 */
 
-			tea_encrypt(&stg->keys[n], denc, ARYLEN(block));
+			tea_encrypt(&key, denc, ARYLEN(block));
 
 			for (i = 0; i < sizeof denc; i++)
 				enc[i] ^= denc[i];
@@ -273,17 +288,23 @@ sectoken_rotate(cqueue_t *cq, void *obj)
 {
 	size_t i;
 	sectoken_gen_t *stg = obj;
+	tea_key_t key;
 
 	sectoken_gen_check(stg);
 
 	cq_zero(cq, &stg->rotate_ev);
 	stg->rotate_ev = cq_main_insert(stg->refresh * 1000, sectoken_rotate, stg);
 
+	random_strong_bytes(VARLEN(key));
+
+	SECTOKEN_LOCK(stg);
+
 	for (i = 0; i < stg->keycnt - 1; i++)
 		stg->keys[i + 1] = stg->keys[i];
 
-	/* 0 is most recent key */
-	random_strong_bytes(VARLEN(stg->keys[0]));
+	stg->keys[0] = key;		/* 0 is most recent key */
+
+	SECTOKEN_UNLOCK(stg);
 }
 
 /**
@@ -329,6 +350,7 @@ sectoken_gen_new(size_t keys, time_delta_t refresh)
 	WALLOC_ARRAY(stg->keys, keys);
 	stg->keycnt = keys;
 	stg->refresh = refresh;
+	spinlock_init(&stg->lock);
 
 	for (i = 0; i < stg->keycnt; i++)
 		random_strong_bytes(VARLEN(stg->keys[i]));
@@ -351,6 +373,7 @@ sectoken_gen_free_null(sectoken_gen_t **stg_ptr)
 
 		cq_cancel(&stg->rotate_ev);
 		WFREE_ARRAY_NULL(stg->keys, stg->keycnt);
+		spinlock_destroy(&stg->lock);
 		stg->magic = 0;
 		WFREE(stg);
 		*stg_ptr = NULL;
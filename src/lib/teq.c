@@ -379,6 +379,15 @@ teq_destroy(struct teq *teq)
 
 	if (teq_is_io(teq)) {
 		struct teq_io *teq_io = TEQ_IO(teq);
+
+		/*
+		 * When the thread was an I/O reactor, its event loop is already
+		 * gone and the waiter source was released with it.
+		 */
+
+		if (inputevt_is_loop_thread(teq->stid))
+			inputevt_remove(&teq_io->event_id);
+		waiter_destroy_null(&teq_io->w);
 		teq->magic = 0;
 		WFREE(teq_io);
 	} else {
@@ -1458,9 +1467,9 @@ teq_io_allocate(unsigned id)
 		"but main I/O event loop is not configured yet",
 		G_STRFUNC, thread_name());
 
-	g_assert_log(inputevt_thread_id() == id,
+	g_assert_log(inputevt_is_loop_thread(id),
 		"%s(): attempt to allocate I/O thread event queue in %s() "
-		"but main I/O event loop runs in %s",
+		"but main I/O event loop runs in %s and thread is not a reactor",
 		G_STRFUNC, thread_name(), thread_id_name(inputevt_thread_id()));
 
 	WALLOC0(teq_io);
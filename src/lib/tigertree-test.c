@@ -0,0 +1,226 @@
+/*
+ * tigertree-test -- segmented tigertree hashing tests.
+ *
+ * Copyright (c) 2026 Raphael Manfredi <Raphael_Manfredi@pobox.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+
+#include "lib/misc.h"
+#include "lib/progname.h"
+#include "lib/rand31.h"
+#include "lib/stringify.h"
+#include "lib/tigertree.h"
+#include "lib/xmalloc.h"
+
+#define DEFAULT_COUNT	10					/* Random file sizes tested */
+#define DEFAULT_SIZE	(4 * 1024 * 1024)	/* Largest random file size */
+#define FEED_CHUNK		7777				/* Odd chunk size for tt_update() */
+
+static bool verbose_mode;
+
+static void G_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-hV] [-c count] [-s size] [-R seed]\n"
+		"  -c : sets amount of random file sizes (default = %u)\n"
+		"  -h : prints this help message\n"
+		"  -s : sets largest random file size (default = %u)\n"
+		"  -R : seed for repeatable random data\n"
+		"  -V : verbose mode -- print status after each successful test\n"
+		, getprogname(), DEFAULT_COUNT, DEFAULT_SIZE);
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * Hash data split into segments of a given size, the last one being shorter
+ * when the size does not divide the data length.
+ *
+ * @return the amount of segment roots written to ``nodes''.
+ */
+static size_t
+split_hash(struct tth *nodes, const char *data, size_t size, size_t seg)
+{
+	size_t i, n = 0;
+
+	if (0 == size)
+		nodes[n++] = tt_segment_hash(data, 0);
+
+	for (i = 0; i < size; i += seg) {
+		nodes[n++] = tt_segment_hash(&data[i], MIN(seg, size - i));
+	}
+
+	return n;
+}
+
+static void
+test_size(const char *data, size_t size)
+{
+	struct tth hash, root, *nodes, *leaves;
+	size_t i, seg, n_nodes, n_leaves, splits = 0;
+	TTH_CONTEXT *ctx;
+
+	ctx = xmalloc(tt_size());
+	XMALLOC_ARRAY(nodes, size / TTH_BLOCKSIZE + 1);
+	XMALLOC_ARRAY(leaves, TTH_MAX_LEAVES);
+
+	/*
+	 * The reference: serial hashing, data being fed in odd chunks.
+	 */
+
+	tt_init(ctx, size);
+	for (i = 0; i < size; i += FEED_CHUNK) {
+		tt_update(ctx, &data[i], MIN(FEED_CHUNK, size - i));
+	}
+	tt_digest(ctx, &hash);
+
+	/*
+	 * Through the segment API, as done when hashing in parallel.
+	 */
+
+	n_nodes = split_hash(nodes, data, size, tt_segment_size(size));
+
+	if (n_nodes != tt_segment_count(size)) {
+		g_error("file of %zu bytes split into %zu segment%s, expected %zu",
+			size, PLURAL(n_nodes), tt_segment_count(size));
+	}
+
+	n_leaves = tt_segment_leaves(leaves, nodes, n_nodes, size);
+	root = tt_root_hash(leaves, n_leaves);
+
+	if (n_leaves != tt_leave_count(ctx)) {
+		g_error("file of %zu bytes has %zu lea%s, expected %zu",
+			size, PLURAL_F(n_leaves), tt_leave_count(ctx));
+	}
+	if (0 != memcmp(leaves, tt_leaves(ctx), n_leaves * sizeof leaves[0]))
+		g_error("file of %zu bytes has wrong segment leaves", size);
+	if (0 != memcmp(&root, &hash, sizeof root))
+		g_error("file of %zu bytes has wrong segment root", size);
+
+	/*
+	 * The root of any aligned power of 2 amount of blocks is a node of the
+	 * tree, so combining smaller segments must also give the root, even
+	 * when several segments make up one leaf.
+	 */
+
+	for (seg = TTH_BLOCKSIZE; seg < size; seg *= 2) {
+		n_nodes = split_hash(nodes, data, size, seg);
+		root = tt_root_hash(nodes, n_nodes);
+
+		if (0 != memcmp(&root, &hash, sizeof root)) {
+			g_error("file of %zu bytes has wrong root when split into "
+				"%zu segment%s of %zu bytes", size, PLURAL(n_nodes), seg);
+		}
+		splits++;
+	}
+
+	if (verbose_mode) {
+		printf("file of %zu bytes: %zu segment%s, %zu lea%s, "
+			"%zu split%s - OK\n",
+			size, PLURAL(tt_segment_count(size)), PLURAL_F(n_leaves),
+			PLURAL(splits));
+	}
+
+	xfree(leaves);
+	xfree(nodes);
+	xfree(ctx);
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	static const size_t sizes[] = {
+		0, 1, 1023, 1024, 1025, 20 * 1024 + 333,
+		256 * 1024 - 1, 256 * 1024, 256 * 1024 + 333,
+		512 * 1024 + 1, 1024 * 1024 + 333, 2 * 1024 * 1024 + 7,
+		4 * 1024 * 1024 + 1023,
+	};
+	size_t count = DEFAULT_COUNT;
+	size_t maxsize = DEFAULT_SIZE;
+	unsigned rseed = 0;
+	char *data;
+	size_t i, len;
+	int c;
+	const char options[] = "c:hs:R:V";
+
+	progstart(argc, argv);
+
+	while ((c = getopt(argc, argv, options)) != EOF) {
+		switch (c) {
+		case 'c':			/* amount of random sizes */
+			count = atol(optarg);
+			break;
+		case 's':			/* largest random size */
+			maxsize = atol(optarg);
+			break;
+		case 'R':			/* randomize in a repeatable way */
+			rseed = atoi(optarg);
+			break;
+		case 'V':			/* verbose mode */
+			verbose_mode = TRUE;
+			break;
+		case 'h':			/* show help */
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if ((argc -= optind) != 0)
+		usage();
+
+	if (0 == maxsize)
+		usage();
+
+	rand31_set_seed(rseed);
+
+	if (verbose_mode)
+		printf("using random seed %u\n", rand31_initial_seed());
+
+	len = MAX(maxsize, sizes[N_ITEMS(sizes) - 1]);
+	data = xmalloc(len);
+	rand31_bytes(data, len);
+
+	for (i = 0; i < N_ITEMS(sizes); i++) {
+		test_size(data, sizes[i]);
+	}
+
+	for (i = 0; i < count; i++) {
+		test_size(data, rand31_value(maxsize));
+	}
+
+	xfree(data);
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
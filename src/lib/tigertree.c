@@ -402,6 +402,131 @@ tt_root_hash(const struct tth *src, size_t n_leaves)
 	}
 }
 
+/**
+ * Compute the size of the segments into which a file of given size can be
+ * split to have each of them hashed independently, possibly in parallel.
+ *
+ * The segment size is a power of 2 multiple of TTH_BLOCKSIZE that is either
+ * the size covered by the leaves of the tree at the good depth, or divides
+ * it.  Therefore, each segment root is a node of the full tree.
+ *
+ * @param filesize		the size of the whole file
+ *
+ * @return the segment size in bytes.
+ */
+filesize_t
+tt_segment_size(filesize_t filesize)
+{
+	filesize_t slice = tt_blocks_per_leaf(filesize) * TTH_BLOCKSIZE;
+
+	return MIN(slice, TTH_SEGMENT_MAX);
+}
+
+/**
+ * @return amount of segments of tt_segment_size() bytes in the file.
+ */
+size_t
+tt_segment_count(filesize_t filesize)
+{
+	filesize_t seg = tt_segment_size(filesize);
+
+	return 0 == filesize ? 1 : (filesize + seg - 1) / seg;
+}
+
+/**
+ * Compute the root of the tree covering the data of a file segment.
+ *
+ * All the segments but the last one of the file must be exactly
+ * tt_segment_size() bytes long for their roots to be nodes of the tree.
+ *
+ * This routine does not use any shared state and can be run concurrently
+ * from several threads.
+ *
+ * @param data		the segment data
+ * @param len		length of the data
+ *
+ * @return the root of the segment.
+ */
+struct tth
+tt_segment_hash(const void *data, size_t len)
+{
+	struct tth stack[56];
+	union {
+		uint64 u64;	/* Better alignment */
+		char bytes[TTH_BLOCKSIZE + 1];
+	} block;
+	const char *p = data;
+	filesize_t n = 0;
+	unsigned si = 0;
+
+	g_assert(0 == len || data != NULL);
+
+	block.bytes[0] = 0x00;
+
+	/*
+	 * Like tt_block() and tt_collapse(), we keep a stack of the roots of
+	 * the complete subtrees seen so far, largest first.
+	 */
+
+	do {
+		size_t amount = MIN(len, TTH_BLOCKSIZE);
+		filesize_t m;
+
+		memcpy(&block.bytes[1], p, amount);
+		tiger(block.bytes, amount + 1, stack[si++].data);
+		p += amount;
+		len -= amount;
+
+		for (m = ++n; 0 == (m & 1); m /= 2) {
+			tt_internal_hash(&stack[si - 2], &stack[si - 1], &stack[si - 2]);
+			si--;
+		}
+	} while (len != 0);
+
+	/*
+	 * Odd nodes are promoted to the upper level, hence the remaining
+	 * subtrees are combined from the smallest one.
+	 */
+
+	while (si > 1) {
+		tt_internal_hash(&stack[si - 2], &stack[si - 1], &stack[si - 2]);
+		si--;
+	}
+
+	return stack[0];
+}
+
+/**
+ * Compute the leaves of the tree at the good depth, from the segment roots.
+ *
+ * @param dst		where leaves are written, TTH_MAX_LEAVES entries at most
+ * @param nodes		the roots of all the segments, in file order
+ * @param n_nodes	amount of segment roots, as given by tt_segment_count()
+ * @param filesize	the size of the whole file
+ *
+ * @return the amount of leaves written to ``dst''.
+ */
+size_t
+tt_segment_leaves(struct tth *dst,
+	const struct tth *nodes, size_t n_nodes, filesize_t filesize)
+{
+	filesize_t slice = tt_blocks_per_leaf(filesize) * TTH_BLOCKSIZE;
+	size_t i, n = 0, per_leaf;
+
+	g_assert(dst != NULL);
+	g_assert(nodes != NULL);
+	g_assert(n_nodes == tt_segment_count(filesize));
+
+	per_leaf = slice / tt_segment_size(filesize);
+
+	for (i = 0; i < n_nodes; i += per_leaf) {
+		g_assert(n < TTH_MAX_LEAVES);
+		dst[n++] = tt_root_hash(&nodes[i], MIN(per_leaf, n_nodes - i));
+	}
+
+	return n;
+}
+
 void
 tt_init(TTH_CONTEXT *ctx, filesize_t filesize)
 {
@@ -502,6 +627,121 @@ tt_check_digest(const char * const expected, const void *data, size_t size)
 			expected, digest);
 		g_error("Tigertree implementation is defective.");
 	}
+
+	/*
+	 * Hashing by segments must yield the same leaves and root.
+	 */
+
+	{
+		struct tth nodes[2], leaves[2], root;
+		size_t i, n_nodes, n_leaves;
+		filesize_t seg = tt_segment_size(size);
+		const char *p = data;
+
+		n_nodes = tt_segment_count(size);
+		g_assert(n_nodes <= N_ITEMS(nodes));
+
+		for (i = 0; i < n_nodes; i++) {
+			nodes[i] = tt_segment_hash(&p[i * seg],
+				MIN(seg, size - i * seg));
+		}
+
+		n_leaves = tt_segment_leaves(leaves, nodes, n_nodes, size);
+		root = tt_root_hash(leaves, n_leaves);
+
+		if (
+			n_leaves != tt_leave_count(&ctx) ||
+			0 != memcmp(leaves, tt_leaves(&ctx), n_leaves * sizeof leaves[0]) ||
+			0 != memcmp(&root, &hash, sizeof root)
+		)
+			g_error("Tigertree segment hashing is defective.");
+	}
+}
+
+/**
+ * Hash data split into segments of a given size, the last one being shorter
+ * when the size does not divide the data length.
+ *
+ * @return the amount of segment roots written to ``nodes''.
+ */
+static size_t G_COLD
+tt_check_split(struct tth *nodes, const char *data, size_t size, size_t seg)
+{
+	size_t i, n = 0;
+
+	for (i = 0; i < size; i += seg) {
+		nodes[n++] = tt_segment_hash(&data[i], MIN(seg, size - i));
+	}
+
+	return n;
+}
+
+/**
+ * Check that hashing a file split into many segments, with an uneven last
+ * segment, yields the same root as the serial computation.
+ *
+ * This is run at startup, hence the file size must remain small.
+ */
+static void G_COLD
+tt_check_segments(size_t size)
+{
+	struct tth hash, root, *nodes, *leaves;
+	size_t i, seg, n_nodes, n_leaves;
+	TTH_CONTEXT ctx;
+	char *data;
+
+	g_assert(size % TTH_BLOCKSIZE != 0);	/* Uneven last segment */
+
+	data = halloc(size);
+	nodes = halloc((size / TTH_BLOCKSIZE + 1) * sizeof nodes[0]);
+	leaves = halloc(TTH_MAX_LEAVES * sizeof leaves[0]);
+
+	for (i = 0; i < size; i++) {
+		data[i] = (i * 7 + i / TTH_BLOCKSIZE) & 0xff;
+	}
+
+	tt_init(&ctx, size);
+	tt_update(&ctx, data, size);
+	tt_digest(&ctx, &hash);
+
+	/*
+	 * Through the segment API, as done when hashing in parallel.
+	 */
+
+	n_nodes = tt_check_split(nodes, data, size, tt_segment_size(size));
+
+	if (n_nodes != tt_segment_count(size))
+		g_error("Tigertree segment count is defective.");
+
+	n_leaves = tt_segment_leaves(leaves, nodes, n_nodes, size);
+	root = tt_root_hash(leaves, n_leaves);
+
+	if (
+		n_leaves != tt_leave_count(&ctx) ||
+		0 != memcmp(leaves, tt_leaves(&ctx), n_leaves * sizeof leaves[0]) ||
+		0 != memcmp(&root, &hash, sizeof root)
+	)
+		g_error("Tigertree segment hashing is defective.");
+
+	/*
+	 * The root of any aligned power of 2 amount of blocks is a node of the
+	 * tree, so combining smaller segments must also give the root, even
+	 * when several segments make up one leaf.
+	 */
+
+	for (seg = TTH_BLOCKSIZE; seg < size; seg *= 2) {
+		n_nodes = tt_check_split(nodes, data, size, seg);
+		root = tt_root_hash(nodes, n_nodes);
+
+		if (0 != memcmp(&root, &hash, sizeof root)) {
+			g_error("Tigertree hashing of %zu segments of %zu bytes "
+				"is defective.", n_nodes, seg);
+		}
+	}
+
+	HFREE_NULL(leaves);
+	HFREE_NULL(nodes);
+	HFREE_NULL(data);
 }
 
 void G_COLD
@@ -526,6 +766,12 @@ tt_check(void)
 		memset(buf, 'A', sizeof buf);
 		tt_check_digest("PZMRYHGY6LTBEH63ZWAHDORHSYTLO4LEFUIKHWY", ARYLEN(buf));
 	}
+
+	/*
+	 * test case: many segments making up a leaf, the last one not a
+	 * multiple of a block -- more sizes are checked by tigertree-test
+	 */
+	tt_check_segments(20 * 1024 + 333);
 }
 
 /* vi: set ts=4 sw=4 cindent: */
@@ -72,6 +72,12 @@
  */
 #define TTH_BLOCKSIZE	1024
 
+/*
+ * Maximum size of a segment hashed independently (see tt_segment_hash()),
+ * must be a power of 2 multiple of TTH_BLOCKSIZE.
+ */
+#define TTH_SEGMENT_MAX	(1024 * 1024)
+
 
 struct TTH_CONTEXT;
 typedef struct TTH_CONTEXT TTH_CONTEXT;
@@ -99,5 +105,11 @@ unsigned tt_good_depth(filesize_t filesize);
 unsigned tt_depth(size_t leaves);
 filesize_t tt_slice_size(filesize_t size, size_t nleaves);
 
+filesize_t tt_segment_size(filesize_t filesize);
+size_t tt_segment_count(filesize_t filesize);
+struct tth tt_segment_hash(const void *data, size_t len);
+size_t tt_segment_leaves(struct tth *dst,
+		const struct tth *nodes, size_t n_nodes, filesize_t filesize);
+
 #endif /* _tigertree_h_ */
 /* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,351 @@
+/*
+ * topk-test -- streaming top-k tracker tests.
+ *
+ * Copyright (c) 2026 Raphael Manfredi <Raphael_Manfredi@pobox.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+
+#include "lib/misc.h"
+#include "lib/progname.h"
+#include "lib/rand31.h"
+#include "lib/stringify.h"
+#include "lib/topk.h"
+#include "lib/xmalloc.h"
+
+#define DEFAULT_CAPACITY	64			/* Monitored keys */
+#define DEFAULT_ITEMS		200000		/* Items in the stream */
+#define DEFAULT_KEYS		5000		/* Distinct keys in the stream */
+#define HEAVY_KEYS			8			/* Keys getting half the stream */
+
+static bool verbose_mode;
+
+static void G_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-hV] [-c capacity] [-k keys] [-n items] [-R seed]\n"
+		"  -c : sets amount of monitored keys (default = %u)\n"
+		"  -h : prints this help message\n"
+		"  -k : sets amount of distinct keys (default = %u)\n"
+		"  -n : sets amount of items in the stream (default = %u)\n"
+		"  -R : seed for repeatable random stream\n"
+		"  -V : verbose mode -- print status after each successful test\n"
+		, getprogname(), DEFAULT_CAPACITY, DEFAULT_KEYS, DEFAULT_ITEMS);
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * Context for the topk_foreach() check.
+ */
+struct check_ctx {
+	const uint64 *counts;	/* True counts, indexed by key */
+	size_t keys;			/* Amount of distinct keys */
+	uint64 last;			/* Last count seen */
+	uint64 sum;				/* Sum of the counts seen */
+	size_t seen;			/* Amount of keys seen */
+};
+
+static void
+check_counter(const void *key, size_t len, uint64 count, uint64 error,
+	void *data)
+{
+	struct check_ctx *ctx = data;
+	uint32 k;
+	uint64 f;
+
+	if (len != sizeof k)
+		g_error("key #%zu has length %zu", ctx->seen, len);
+
+	memcpy(&k, key, sizeof k);
+
+	if (k >= ctx->keys)
+		g_error("unknown key %u", k);
+	if (ctx->seen != 0 && count > ctx->last) {
+		g_error("key %u has count %s, after %s: not in decreasing order",
+			k, uint64_to_string(count), uint64_to_string2(ctx->last));
+	}
+	if (error > count) {
+		g_error("key %u has error %s above its count %s",
+			k, uint64_to_string(error), uint64_to_string2(count));
+	}
+
+	/*
+	 * The count must over-estimate the true count, and by no more than
+	 * the reported error.
+	 */
+
+	f = ctx->counts[k];
+
+	if (count < f) {
+		g_error("key %u has count %s, below its true count %s",
+			k, uint64_to_string(count), uint64_to_string2(f));
+	}
+	if (count - error > f) {
+		g_error("key %u has count %s with error %s, true count is %s",
+			k, uint64_to_string(count), uint64_to_string2(error),
+			uint64_to_string3(f));
+	}
+
+	ctx->last = count;
+	ctx->sum += count;
+	ctx->seen++;
+}
+
+static void
+test_exact(size_t capacity)
+{
+	topk_t *tk;
+	uint64 *counts;
+	uint32 k;
+	size_t i;
+
+	tk = topk_make(capacity);
+	XMALLOC0_ARRAY(counts, capacity);
+
+	/*
+	 * As long as there are fewer keys than counters, counts are exact.
+	 */
+
+	for (i = 0; i < 10 * capacity; i++) {
+		uint32 amount = 1 + rand31_value(3);
+
+		k = rand31_value(capacity - 1);
+		topk_add(tk, &k, sizeof k, amount);
+		counts[k] += amount;
+	}
+
+	for (k = 0; k < capacity; k++) {
+		uint64 count, error;
+
+		if (0 == counts[k])
+			continue;
+
+		if (!topk_lookup(tk, &k, sizeof k, &count, &error))
+			g_error("key %u not monitored", k);
+		if (count != counts[k] || error != 0) {
+			g_error("key %u has count %s (error %s), expected exact %s",
+				k, uint64_to_string(count), uint64_to_string2(error),
+				uint64_to_string3(counts[k]));
+		}
+		if (topk_estimate(tk, &k, sizeof k) != count)
+			g_error("key %u estimate differs from its count", k);
+	}
+
+	topk_clear(tk);
+
+	if (topk_count(tk) != 0 || topk_total(tk) != 0)
+		g_error("tracker not empty after clearing");
+
+	for (k = 0; k < capacity; k++) {
+		if (topk_lookup(tk, &k, sizeof k, NULL, NULL))
+			g_error("key %u still monitored after clearing", k);
+	}
+
+	topk_free_null(&tk);
+
+	if (tk != NULL)
+		g_error("tracker pointer not nullified");
+
+	if (verbose_mode)
+		printf("exact counts below capacity of %zu - OK\n", capacity);
+
+	xfree(counts);
+}
+
+/**
+ * Pick next key in the stream.
+ *
+ * Half of the items go to a few heavy hitters, the other half are spread
+ * uniformly over all the keys.  With a ramp, the stream starts with each
+ * light key in turn, to flush the counters before the heavy hitters come.
+ */
+static uint32
+next_key(size_t i, size_t items, size_t keys, bool ramp)
+{
+	if (ramp && i < items / 2)
+		return HEAVY_KEYS + i % (keys - HEAVY_KEYS);
+
+	if (rand31_value(1))
+		return rand31_value(HEAVY_KEYS - 1);
+
+	return rand31_value(keys - 1);
+}
+
+static void
+test_bounds(size_t capacity, size_t items, size_t keys, bool ramp)
+{
+	topk_t *tk;
+	uint64 *counts, total = 0, threshold;
+	struct check_ctx ctx;
+	size_t i, heavy = 0, n;
+	uint32 k;
+
+	tk = topk_make(capacity);
+	XMALLOC0_ARRAY(counts, keys);
+
+	for (i = 0; i < items; i++) {
+		uint32 amount = 1 + rand31_value(3);
+
+		k = next_key(i, items, keys, ramp);
+		topk_add(tk, &k, sizeof k, amount);
+		counts[k] += amount;
+		total += amount;
+	}
+
+	if (topk_total(tk) != total) {
+		g_error("total is %s, expected %s",
+			uint64_to_string(topk_total(tk)), uint64_to_string2(total));
+	}
+	if (topk_count(tk) != MIN(capacity, keys)) {
+		g_error("%zu key%s monitored, expected %zu",
+			PLURAL(topk_count(tk)), MIN(capacity, keys));
+	}
+
+	ZERO(&ctx);
+	ctx.counts = counts;
+	ctx.keys = keys;
+
+	n = topk_foreach(tk, 0, check_counter, &ctx);
+
+	if (n != topk_count(tk) || ctx.seen != n) {
+		g_error("iterated over %zu key%s out of %zu",
+			PLURAL(n), topk_count(tk));
+	}
+
+	/*
+	 * Evicted keys never hand over more than they received, so the counts
+	 * cannot sum up to more than the total.
+	 */
+
+	if (ctx.sum > total) {
+		g_error("counts sum up to %s, above total %s",
+			uint64_to_string(ctx.sum), uint64_to_string2(total));
+	}
+
+	/*
+	 * Any key seen more than total / capacity times must be monitored,
+	 * and no estimate may be below the true count.
+	 */
+
+	threshold = total / capacity;
+
+	for (k = 0; k < keys; k++) {
+		if (topk_estimate(tk, &k, sizeof k) < counts[k]) {
+			g_error("key %u estimated at %s, below its true count %s",
+				k, uint64_to_string(topk_estimate(tk, &k, sizeof k)),
+				uint64_to_string2(counts[k]));
+		}
+
+		if (counts[k] > threshold) {
+			heavy++;
+			if (!topk_lookup(tk, &k, sizeof k, NULL, NULL)) {
+				g_error("heavy key %u (count %s, threshold %s) not monitored",
+					k, uint64_to_string(counts[k]),
+					uint64_to_string2(threshold));
+			}
+		}
+	}
+
+	if (0 == heavy && capacity > 4 * HEAVY_KEYS && keys > capacity)
+		g_error("no heavy hitter in the stream, test is meaningless");
+
+	ctx.sum = 0;
+	ctx.seen = 0;
+	n = topk_foreach(tk, HEAVY_KEYS, check_counter, &ctx);
+	if (n != MIN(HEAVY_KEYS, topk_count(tk)))
+		g_error("limited iteration returned %zu key%s", PLURAL(n));
+
+	if (verbose_mode) {
+		printf("%zu heavy hitter%s among %zu keys found by %zu counters "
+			"in %s stream of %zu items - OK\n",
+			PLURAL(heavy), keys, capacity, ramp ? "ramped" : "random", items);
+	}
+
+	topk_free_null(&tk);
+	xfree(counts);
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	size_t capacity = DEFAULT_CAPACITY;
+	size_t items = DEFAULT_ITEMS;
+	size_t keys = DEFAULT_KEYS;
+	unsigned rseed = 0;
+	int c;
+	const char options[] = "c:hk:n:R:V";
+
+	progstart(argc, argv);
+
+	while ((c = getopt(argc, argv, options)) != EOF) {
+		switch (c) {
+		case 'c':			/* amount of counters */
+			capacity = atol(optarg);
+			break;
+		case 'k':			/* amount of distinct keys */
+			keys = atol(optarg);
+			break;
+		case 'n':			/* amount of items */
+			items = atol(optarg);
+			break;
+		case 'R':			/* randomize in a repeatable way */
+			rseed = atoi(optarg);
+			break;
+		case 'V':			/* verbose mode */
+			verbose_mode = TRUE;
+			break;
+		case 'h':			/* show help */
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if ((argc -= optind) != 0)
+		usage();
+
+	if (0 == capacity || keys <= HEAVY_KEYS)
+		usage();
+
+	rand31_set_seed(rseed);
+
+	if (verbose_mode)
+		printf("using random seed %u\n", rand31_initial_seed());
+
+	test_exact(capacity);
+	test_bounds(capacity, items, keys, FALSE);
+	test_bounds(capacity, items, keys, TRUE);
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
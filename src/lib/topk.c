@@ -0,0 +1,607 @@
+/*
+ * Copyright (c) 2026, Raphael Manfredi
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Streaming top-k (heavy hitters) tracking with bounded memory.
+ *
+ * This implements the SpaceSaving algorithm from Metwally, Agrawal and
+ * El Abbadi: at most "capacity" keys are monitored, each with a counter.
+ * When a key that is not monitored shows up and all the counters are used,
+ * the key with the lowest count is evicted and the newcomer inherits its
+ * count, which is then an over-estimation of the true count, the maximum
+ * error being recorded along with the counter.
+ *
+ * Counters are kept in a "stream summary": a list of buckets sorted by
+ * increasing count, each bucket linking all the counters sharing the same
+ * value.  Incrementing a counter by one therefore only moves it to the next
+ * bucket, and the lowest counter is always at hand, which makes updates
+ * constant time.
+ *
+ * A Count-Min sketch of all the keys seen is maintained alongside, which
+ * caps the count inherited by a newcomer: without it, a key seen once would
+ * always be credited with its amount on top of the count of the key it
+ * evicts.  The inherited count never goes below the evicted one, so that
+ * counts remain over-estimated.  The sketch can also be queried for keys
+ * that are not monitored.
+ *
+ * These objects are not thread-safe: the caller must serialize accesses.
+ *
+ * @author Raphael Manfredi
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "topk.h"
+
+#include "hashing.h"
+#include "htable.h"
+#include "pow2.h"
+#include "unsigned.h"
+#include "walloc.h"
+#include "xmalloc.h"
+
+#include "override.h"		/* Must be the last header included */
+
+#define TOPK_DEPTH		4		/**< Amount of rows in the Count-Min sketch */
+#define TOPK_WIDTH		4		/**< Sketch columns per monitored key */
+
+enum topk_magic { TOPK_MAGIC = 0x2a91c5f7 };
+
+struct topk_bucket;
+
+/**
+ * A monitored key.
+ */
+struct topk_counter {
+	const void *key;				/**< Copy of the key */
+	size_t len;						/**< Key length */
+	uint64 error;					/**< Maximum over-estimation */
+	struct topk_bucket *bucket;		/**< Bucket holding the count */
+	struct topk_counter *prev;		/**< Previous counter in bucket */
+	struct topk_counter *next;		/**< Next counter in bucket */
+};
+
+/**
+ * All the counters sharing the same value.
+ */
+struct topk_bucket {
+	uint64 value;					/**< Count of all counters in bucket */
+	struct topk_bucket *prev;		/**< Bucket with lower value */
+	struct topk_bucket *next;		/**< Bucket with higher value */
+	struct topk_counter *head;		/**< Counters in the bucket */
+};
+
+struct topk {
+	enum topk_magic magic;
+	size_t capacity;				/**< Max amount of monitored keys */
+	size_t count;					/**< Amount of counters in use */
+	uint64 total;					/**< Sum of all amounts added */
+	struct topk_counter *counters;	/**< Counter arena */
+	struct topk_bucket *buckets;	/**< Bucket arena */
+	struct topk_bucket *free;		/**< Free buckets, linked by next */
+	struct topk_bucket *min;		/**< Bucket with the lowest value */
+	struct topk_bucket *max;		/**< Bucket with the highest value */
+	htable_t *index;				/**< Monitored counters, by key */
+	uint32 *sketch;					/**< Count-Min sketch, row by row */
+	size_t width;					/**< Sketch row width, a power of 2 */
+};
+
+static inline void
+topk_check(const struct topk * const tk)
+{
+	g_assert(tk != NULL);
+	g_assert(TOPK_MAGIC == tk->magic);
+}
+
+static uint
+topk_counter_hash(const void *p)
+{
+	const struct topk_counter *c = p;
+	return binary_hash(c->key, c->len);
+}
+
+static uint
+topk_counter_hash2(const void *p)
+{
+	const struct topk_counter *c = p;
+	return binary_hash2(c->key, c->len);
+}
+
+static bool
+topk_counter_eq(const void *a, const void *b)
+{
+	const struct topk_counter *ca = a, *cb = b;
+	return ca->len == cb->len && 0 == memcmp(ca->key, cb->key, ca->len);
+}
+
+/**
+ * Locate the counter monitoring a key.
+ *
+ * @return the counter, NULL if the key is not monitored.
+ */
+static struct topk_counter *
+topk_counter_lookup(const topk_t *tk, const void *key, size_t len)
+{
+	struct topk_counter c;
+
+	c.key = key;
+	c.len = len;
+
+	return htable_lookup(tk->index, &c);
+}
+
+/**
+ * Add an amount to the Count-Min sketch for a key, if non-zero.
+ *
+ * @return the estimated count for the key, after the addition.
+ */
+static uint64
+topk_sketch_update(const topk_t *tk, const void *key, size_t len,
+	uint32 amount)
+{
+	uint h1 = binary_hash(key, len);
+	uint h2 = binary_hash2(key, len) | 1;
+	uint32 *row = tk->sketch;
+	uint32 estimate = MAX_INT_VAL(uint32);
+	size_t i;
+
+	for (i = 0; i < TOPK_DEPTH; i++, row += tk->width) {
+		uint32 *cell = &row[(h1 + i * h2) & (tk->width - 1)];
+
+		if (amount != 0)
+			*cell = uint32_saturate_add(*cell, amount);
+		estimate = MIN(estimate, *cell);
+	}
+
+	return estimate;
+}
+
+/**
+ * Get a bucket from the free list.
+ */
+static struct topk_bucket *
+topk_bucket_alloc(topk_t *tk, uint64 value)
+{
+	struct topk_bucket *b = tk->free;
+
+	g_assert(b != NULL);	/* One more bucket than counters */
+
+	tk->free = b->next;
+	b->value = value;
+	b->head = NULL;
+
+	return b;
+}
+
+/**
+ * Return a bucket to the free list if it no longer holds any counter.
+ */
+static void
+topk_bucket_reclaim(topk_t *tk, struct topk_bucket *b)
+{
+	if (b->head != NULL)
+		return;
+
+	if (b->prev != NULL)
+		b->prev->next = b->next;
+	else
+		tk->min = b->next;
+
+	if (b->next != NULL)
+		b->next->prev = b->prev;
+	else
+		tk->max = b->prev;
+
+	b->prev = NULL;
+	b->next = tk->free;
+	tk->free = b;
+}
+
+/**
+ * Detach a counter from its bucket, which is left in place even if empty.
+ */
+static void
+topk_counter_unlink(struct topk_counter *c)
+{
+	struct topk_bucket *b = c->bucket;
+
+	if (c->prev != NULL)
+		c->prev->next = c->next;
+	else
+		b->head = c->next;
+
+	if (c->next != NULL)
+		c->next->prev = c->prev;
+
+	c->bucket = NULL;
+	c->prev = c->next = NULL;
+}
+
+/**
+ * Attach a counter to the bucket for a given value, creating it as needed.
+ *
+ * @param tk		the top-k tracker
+ * @param c			the (detached) counter
+ * @param from		bucket from which to look upwards, NULL for the lowest
+ * @param value		the new counter value
+ */
+static void
+topk_counter_place(topk_t *tk, struct topk_counter *c,
+	struct topk_bucket *from, uint64 value)
+{
+	struct topk_bucket *prev, *b;
+
+	prev = NULL == from ? NULL : from->prev;
+	b = NULL == from ? tk->min : from;
+
+	/*
+	 * Increments being usually small, this stops at the next bucket.
+	 */
+
+	while (b != NULL && b->value < value) {
+		prev = b;
+		b = b->next;
+	}
+
+	if (NULL == b || b->value != value) {
+		struct topk_bucket *nb = topk_bucket_alloc(tk, value);
+
+		nb->prev = prev;
+		nb->next = b;
+
+		if (prev != NULL)
+			prev->next = nb;
+		else
+			tk->min = nb;
+
+		if (b != NULL)
+			b->prev = nb;
+		else
+			tk->max = nb;
+
+		b = nb;
+	}
+
+	c->bucket = b;
+	c->prev = NULL;
+	c->next = b->head;
+	if (b->head != NULL)
+		b->head->prev = c;
+	b->head = c;
+}
+
+/**
+ * Set the key of a counter, releasing any previous one.
+ */
+static void
+topk_counter_set_key(struct topk_counter *c, const void *key, size_t len)
+{
+	if (c->key != NULL)
+		wfree(deconstify_pointer(c->key), c->len);
+
+	c->key = wcopy(key, len);
+	c->len = len;
+}
+
+/**
+ * Reset all the counters and buckets.
+ */
+static void
+topk_reset(topk_t *tk)
+{
+	size_t i;
+
+	for (i = 0; i < tk->count; i++) {
+		struct topk_counter *c = &tk->counters[i];
+
+		wfree(deconstify_pointer(c->key), c->len);
+		ZERO(c);
+	}
+
+	/* One bucket more than counters, see topk_counter_bump() */
+
+	for (i = 0; i <= tk->capacity; i++) {
+		struct topk_bucket *b = &tk->buckets[i];
+
+		ZERO(b);
+		b->next = i < tk->capacity ? &tk->buckets[i + 1] : NULL;
+	}
+
+	tk->free = &tk->buckets[0];
+	tk->min = tk->max = NULL;
+	tk->count = 0;
+	tk->total = 0;
+}
+
+/**
+ * Increment a monitored counter.
+ */
+static void
+topk_counter_bump(topk_t *tk, struct topk_counter *c, uint32 amount)
+{
+	struct topk_bucket *b = c->bucket;
+
+	/*
+	 * The old bucket is only reclaimed after the counter was placed, so
+	 * that we can start looking from there: this is why we need one more
+	 * bucket than counters.
+	 */
+
+	topk_counter_unlink(c);
+	topk_counter_place(tk, c, b, b->value + amount);
+	topk_bucket_reclaim(tk, b);
+}
+
+/**
+ * Create a new top-k tracker.
+ *
+ * @param capacity		maximum amount of keys monitored
+ *
+ * @return a new tracker, to be freed with topk_free_null().
+ */
+topk_t *
+topk_make(size_t capacity)
+{
+	topk_t *tk;
+
+	g_assert(capacity != 0);
+	g_assert(capacity < MAX_INT_VAL(uint32) / (TOPK_DEPTH * TOPK_WIDTH));
+
+	XMALLOC0(tk);
+	tk->magic = TOPK_MAGIC;
+	tk->capacity = capacity;
+	tk->width = next_pow2(capacity * TOPK_WIDTH);
+	XMALLOC0_ARRAY(tk->counters, capacity);
+	XMALLOC0_ARRAY(tk->buckets, capacity + 1);
+	XMALLOC0_ARRAY(tk->sketch, TOPK_DEPTH * tk->width);
+	tk->index = htable_create_any(topk_counter_hash, topk_counter_hash2,
+		topk_counter_eq);
+
+	topk_reset(tk);
+
+	return tk;
+}
+
+/**
+ * Free top-k tracker and nullify its pointer.
+ */
+void
+topk_free_null(topk_t **tk_ptr)
+{
+	topk_t *tk = *tk_ptr;
+
+	if (tk != NULL) {
+		topk_check(tk);
+
+		topk_reset(tk);
+		htable_free_null(&tk->index);
+		XFREE_NULL(tk->counters);
+		XFREE_NULL(tk->buckets);
+		XFREE_NULL(tk->sketch);
+		tk->magic = 0;
+		xfree(tk);
+		*tk_ptr = NULL;
+	}
+}
+
+/**
+ * Forget about all the keys seen so far.
+ */
+void
+topk_clear(topk_t *tk)
+{
+	topk_check(tk);
+
+	htable_clear(tk->index);
+	topk_reset(tk);
+	memset(tk->sketch, 0, TOPK_DEPTH * tk->width * sizeof tk->sketch[0]);
+}
+
+/**
+ * Record occurrences of a key.
+ *
+ * @param tk		the top-k tracker
+ * @param key		the key
+ * @param len		the key length, in bytes
+ * @param amount	amount of occurrences
+ */
+void
+topk_add(topk_t *tk, const void *key, size_t len, uint32 amount)
+{
+	struct topk_counter *c;
+	struct topk_bucket *b;
+	uint64 estimate, value;
+
+	topk_check(tk);
+	g_assert(key != NULL);
+	g_assert(len != 0);
+
+	if G_UNLIKELY(0 == amount)
+		return;
+
+	tk->total += amount;
+	estimate = topk_sketch_update(tk, key, len, amount);
+
+	c = topk_counter_lookup(tk, key, len);
+	if (c != NULL) {
+		topk_counter_bump(tk, c, amount);
+		return;
+	}
+
+	/*
+	 * As long as there are free counters, keys were never evicted and
+	 * their counts are exact.
+	 */
+
+	if (tk->count < tk->capacity) {
+		c = &tk->counters[tk->count++];
+		topk_counter_set_key(c, key, len);
+		c->error = 0;
+		htable_insert(tk->index, c, c);
+		topk_counter_place(tk, c, NULL, amount);
+		return;
+	}
+
+	/*
+	 * Evict one of the keys with the lowest count.  The newcomer inherits
+	 * that count, unless the sketch gives a lower (yet still over-estimated)
+	 * count for it.
+	 *
+	 * The new count must not go below the evicted one though: a key evicted
+	 * earlier could have had that count, and if the lowest count were allowed
+	 * to decrease, the key could come back with less than its true count.
+	 */
+
+	b = tk->min;
+	c = b->head;
+	value = MAX(b->value, MIN(b->value + amount, estimate));
+
+	htable_remove(tk->index, c);
+	topk_counter_unlink(c);
+	topk_counter_set_key(c, key, len);
+	c->error = value - amount;
+	htable_insert(tk->index, c, c);
+	topk_counter_place(tk, c, NULL, value);
+	topk_bucket_reclaim(tk, b);
+}
+
+/**
+ * Lookup a monitored key.
+ *
+ * @param tk		the top-k tracker
+ * @param key		the key
+ * @param len		the key length, in bytes
+ * @param count		if non-NULL, written with the estimated count
+ * @param error		if non-NULL, written with the maximum over-estimation
+ *
+ * @return TRUE if the key is monitored.
+ */
+bool
+topk_lookup(const topk_t *tk, const void *key, size_t len,
+	uint64 *count, uint64 *error)
+{
+	const struct topk_counter *c;
+
+	topk_check(tk);
+
+	c = topk_counter_lookup(tk, key, len);
+	if (NULL == c)
+		return FALSE;
+
+	if (count != NULL)
+		*count = c->bucket->value;
+	if (error != NULL)
+		*error = c->error;
+
+	return TRUE;
+}
+
+/**
+ * Estimate the count of any key, monitored or not.
+ *
+ * @return an upper bound of the amount of occurrences of the key.
+ */
+uint64
+topk_estimate(const topk_t *tk, const void *key, size_t len)
+{
+	const struct topk_counter *c;
+
+	topk_check(tk);
+
+	c = topk_counter_lookup(tk, key, len);
+	if (c != NULL)
+		return c->bucket->value;
+
+	return topk_sketch_update(tk, key, len, 0);
+}
+
+/**
+ * @return amount of monitored keys.
+ */
+size_t
+topk_count(const topk_t *tk)
+{
+	topk_check(tk);
+	return tk->count;
+}
+
+/**
+ * @return maximum amount of monitored keys.
+ */
+size_t
+topk_capacity(const topk_t *tk)
+{
+	topk_check(tk);
+	return tk->capacity;
+}
+
+/**
+ * @return sum of all the amounts recorded.
+ */
+uint64
+topk_total(const topk_t *tk)
+{
+	topk_check(tk);
+	return tk->total;
+}
+
+/**
+ * Iterate over the monitored keys, by decreasing count.
+ *
+ * The callback must not modify the tracker.
+ *
+ * @param tk		the top-k tracker
+ * @param n			maximum amount of keys to iterate over, 0 for all
+ * @param cb		the callback to invoke on each key
+ * @param data		additional callback argument
+ *
+ * @return the amount of keys iterated over.
+ */
+size_t
+topk_foreach(const topk_t *tk, size_t n, topk_cb_t cb, void *data)
+{
+	const struct topk_bucket *b;
+	size_t i = 0;
+
+	topk_check(tk);
+	g_assert(cb != NULL);
+
+	if (0 == n)
+		n = tk->count;
+
+	for (b = tk->max; b != NULL && i < n; b = b->prev) {
+		const struct topk_counter *c;
+
+		for (c = b->head; c != NULL && i < n; c = c->next, i++) {
+			(*cb)(c->key, c->len, b->value, c->error, data);
+		}
+	}
+
+	return i;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2026, Raphael Manfredi
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Streaming top-k (heavy hitters) tracking with bounded memory.
+ *
+ * @author Raphael Manfredi
+ * @date 2026
+ */
+
+#ifndef _topk_h_
+#define _topk_h_
+
+typedef struct topk topk_t;
+
+/**
+ * Callback invoked by topk_foreach() on each tracked key.
+ *
+ * @param key		the key
+ * @param len		the key length, in bytes
+ * @param count		estimated count, an upper bound of the true count
+ * @param error		maximum over-estimation of the count
+ * @param data		user-supplied argument
+ */
+typedef void (*topk_cb_t)(const void *key, size_t len,
+	uint64 count, uint64 error, void *data);
+
+/*
+ * Public interface.
+ */
+
+topk_t *topk_make(size_t capacity);
+void topk_free_null(topk_t **tk_ptr);
+void topk_clear(topk_t *tk);
+
+void topk_add(topk_t *tk, const void *key, size_t len, uint32 amount);
+bool topk_lookup(const topk_t *tk, const void *key, size_t len,
+	uint64 *count, uint64 *error);
+uint64 topk_estimate(const topk_t *tk, const void *key, size_t len);
+
+size_t topk_count(const topk_t *tk);
+size_t topk_capacity(const topk_t *tk);
+uint64 topk_total(const topk_t *tk);
+size_t topk_foreach(const topk_t *tk, size_t n, topk_cb_t cb, void *data);
+
+#endif /* _topk_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
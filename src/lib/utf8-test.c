@@ -0,0 +1,331 @@
+/*
+ * utf8-test -- UTF-8 canonization tests and benchmarking.
+ *
+ * Copyright (c) 2026 Raphael Manfredi <Raphael_Manfredi@pobox.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#define UTF8_BENCHMARKING_SOURCE
+
+#include "common.h"
+
+#include "halloc.h"
+#include "log.h"
+#include "mempcpy.h"
+#include "parse.h"
+#include "progname.h"
+#include "random.h"
+#include "stringify.h"
+#include "tm.h"
+#include "utf8.h"
+#include "xmalloc.h"
+
+#define QUERY_MAXLEN	256		/* Maximum query length we read */
+#define SYNTH_QUERIES	10000	/* Amount of synthetic queries we generate */
+#define RANDOM_LOOPS	100000	/* Amount of random equivalence checks */
+
+/*
+ * Keywords used to build a synthetic query corpus, when no captured
+ * corpus is supplied.
+ */
+static const char *keywords[] = {
+	"The", "Beatles", "linux", "ISO", "x86_64", "mp3", "FLAC", "live",
+	"1999", "Remastered", "[HD]", "(2010)", "ubuntu-22.04", "Vol.2",
+	"Greatest_Hits", "feat.", "DJ", "mix", "Part#1", "avi", "MKV", "O'Neil",
+	"rock&roll", "C++", "1080p", "ep.01", "soundtrack", "Jazz", "a-ha",
+	"\xc3\x89" "dith_Piaf", "Bj\xc3\xb6rk", "\xe6\x9d\xb1\xe4\xba\xac",
+	"Na\xc3\xafve", "caf\xc3\xa9",
+};
+
+static char **queries;
+static size_t queries_count;
+static size_t queries_ascii;
+
+static void G_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-h] [-f file] [-n loops]\n"
+		"  -f : read captured query corpus from file, one query per line\n"
+		"  -h : prints this help message\n"
+		"  -n : amount of benchmarking loops over the corpus (default 10)\n"
+		, getprogname());
+	exit(EXIT_FAILURE);
+}
+
+static void
+query_add(const char *q)
+{
+	static size_t capacity;
+
+	if (queries_count >= capacity) {
+		capacity = MAX(1024, capacity * 2);
+		XREALLOC_ARRAY(queries, capacity);
+	}
+
+	queries[queries_count++] = xstrdup(q);
+
+	if (is_ascii_string(q))
+		queries_ascii++;
+}
+
+static void
+corpus_load(const char *file)
+{
+	FILE *f;
+	char buf[QUERY_MAXLEN];
+	size_t invalid = 0;
+
+	f = fopen(file, "r");
+	if (NULL == f)
+		s_fatal_exit(EXIT_FAILURE, "cannot open \"%s\": %m", file);
+
+	while (fgets(buf, sizeof buf, f) != NULL) {
+		char *nl = strchr(buf, '\n');
+
+		if (nl != NULL)
+			*nl = '\0';
+
+		if ('\0' == buf[0])
+			continue;
+
+		if (!utf8_is_valid_string(buf)) {
+			invalid++;
+			continue;
+		}
+
+		query_add(buf);
+	}
+
+	fclose(f);
+
+	s_info("loaded %'zu quer%s from \"%s\", ignored %'zu invalid line%s",
+		PLURAL_Y(queries_count), file, PLURAL(invalid));
+}
+
+static void
+corpus_generate(void)
+{
+	size_t i;
+
+	for (i = 0; i < SYNTH_QUERIES; i++) {
+		char buf[QUERY_MAXLEN];
+		size_t j, n = 1 + random_value(5);
+		bool ascii = random_value(99) < 92;	/* Most queries are ASCII */
+		char *p = buf;
+
+		for (j = 0; j < n; j++) {
+			const char *w;
+			size_t len;
+
+			do {
+				w = keywords[random_value(N_ITEMS(keywords) - 1)];
+			} while (ascii && !is_ascii_string(w));
+
+			len = strlen(w);
+			if (ptr_diff(p, buf) + len + 2 > sizeof buf)
+				break;
+
+			if (j != 0)
+				*p++ = ' ';
+			p = mempcpy(p, w, len);
+		}
+		*p = '\0';
+
+		query_add(buf);
+	}
+
+	s_info("generated %'zu synthetic quer%s",
+		PLURAL_Y(queries_count));
+}
+
+static void
+check_equivalence(const char *q)
+{
+	char *fast, *slow;
+
+	fast = utf8_canonize(q);
+	slow = utf8_canonize_utf32(q);
+
+	g_assert_log(0 == strcmp(fast, slow),
+		"%s(): \"%s\" canonized as \"%s\" instead of \"%s\"",
+		G_STRFUNC, q, fast, slow);
+
+	hfree(fast);
+	hfree(slow);
+}
+
+static void
+test_ascii_span(void)
+{
+	char buf[64];
+	size_t i, j;
+
+	/*
+	 * Place a non-ASCII byte at every position and every alignment.
+	 */
+
+	for (i = 0; i < 16; i++) {
+		for (j = 0; j < 32; j++) {
+			char *s = &buf[i];
+
+			memset(buf, 'a', sizeof buf);
+			buf[sizeof buf - 1] = '\0';
+			g_assert(is_ascii_string(s));
+
+			s[j] = '\xe9';
+			g_assert(!is_ascii_string(s));
+			g_assert(!utf8_is_valid_string(s));	/* Lone Latin-1 byte */
+
+			s[j] = '\0';
+			g_assert(is_ascii_string(s));
+			g_assert(utf8_is_valid_string(s));
+		}
+	}
+}
+
+static void
+test_equivalence(void)
+{
+	size_t i;
+
+	for (i = 0; i < queries_count; i++)
+		check_equivalence(queries[i]);
+
+	/*
+	 * Random strings over the whole ASCII range, with a bias towards
+	 * spaces and punctuation to exercise separator collapsing.
+	 */
+
+	for (i = 0; i < RANDOM_LOOPS; i++) {
+		char buf[16];
+		size_t j, n = random_value(sizeof buf - 1);
+
+		for (j = 0; j < n; j++) {
+			buf[j] = random_value(3) ?
+				1 + random_value(0x7e) : (uchar) " .-_\n\t"[random_value(5)];
+		}
+		buf[n] = '\0';
+
+		check_equivalence(buf);
+	}
+
+	s_info("%s(): %'zu corpus quer%s and %'zu random strings OK",
+		G_STRFUNC, PLURAL_Y(queries_count), (size_t) RANDOM_LOOPS);
+}
+
+typedef char *(canonize_fn_t)(const char *src);
+
+static double
+timeit(canonize_fn_t *fn, size_t loops)
+{
+	tm_nano_t start, end;
+	size_t i, j;
+
+	tm_precise_time(&start);
+
+	for (i = 0; i < loops; i++) {
+		for (j = 0; j < queries_count; j++) {
+			char *r = (*fn)(queries[j]);
+			hfree(r);
+		}
+	}
+
+	tm_precise_time(&end);
+
+	return tm_precise_elapsed_f(&end, &start) / (loops * queries_count);
+}
+
+static void
+benchmark_canonize(size_t loops)
+{
+	double fast, slow;
+
+	slow = timeit(utf8_canonize_utf32, loops);
+	fast = timeit(utf8_canonize, loops);
+
+	s_info("%s(): %'zu quer%s (%zu%% ASCII), %'zu loop%s:",
+		G_STRFUNC, PLURAL_Y(queries_count),
+		queries_count != 0 ? queries_ascii * 100 / queries_count : 0,
+		PLURAL(loops));
+	s_info("\tutf8_canonize_utf32(): %'zu ns", (size_t) (slow * 1e9));
+	s_info("\tutf8_canonize():       %'zu ns", (size_t) (fast * 1e9));
+	s_info("\tspeedup:               %.2fx", fast > 0.0 ? slow / fast : 0.0);
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	int c;
+	const char options[] = "f:hn:";
+	const char *file = NULL;
+	size_t loops = 10;
+
+	progstart(argc, argv);
+
+	while ((c = getopt(argc, argv, options)) != EOF) {
+		switch (c) {
+		case 'f':			/* query corpus */
+			file = optarg;
+			break;
+		case 'n':			/* benchmarking loops */
+			{
+				int error;
+				loops = parse_uint32(optarg, NULL, 10, &error);
+				if (error != 0 || 0 == loops)
+					usage();
+			}
+			break;
+		case 'h':			/* show help */
+			/* FALL THROUGH */
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if (0 != (argc -= optind))
+		usage();
+
+	locale_init();
+
+	if (file != NULL)
+		corpus_load(file);
+	else
+		corpus_generate();
+
+	test_ascii_span();
+	test_equivalence();
+	benchmark_canonize(loops);
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
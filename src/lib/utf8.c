@@ -167,6 +167,12 @@ static iconv_t cd_utf8_to_iso8859_1 = (iconv_t) -1;
 
 #define UTF8_CPU_CACHELINE	32		/* Length of cache in bytes, for prefetch */
 
+#if CHAR_BIT == 8
+#define IS_NON_NUL_ASCII(p) (*(const int8 *) (p) > 0)
+#else
+#define IS_NON_NUL_ASCII(p) (!(*(p) & ~0x7f) && (*(p) > 0))
+#endif
+
 enum utf8_cd {
 	UTF8_CD_ISO8859_1,
 	UTF8_CD_ISO8859_6,
@@ -971,6 +977,62 @@ utf8_char_len_probe(const char *s)
 	return 0xE0 == uc ? 3 : 4;
 }
 
+#define ONEMASK ((size_t) (-1) / 0xff)	/* 0x01010101 on 32-bit machine */
+
+/**
+ * Skip the leading run of non-NUL ASCII characters in a string.
+ *
+ * Data are scanned one machine word at a time: a word holds only non-NUL
+ * ASCII bytes when none of its bytes has its high bit set and when
+ * subtracting 0x01 from each byte does not cause any borrow.
+ *
+ * @param str		a NUL-terminated string
+ *
+ * @return pointer to the first byte in the string that is either the
+ * trailing NUL or a byte with its high bit set.
+ */
+static const char *
+utf8_ascii_span(const char *str)
+{
+	const char *s;
+
+	/*
+	 * Handle any initial misaligned bytes.
+	 */
+
+	for (s = str; pointer_to_ulong(s) & (sizeof(size_t) - 1); s++) {
+		if (!IS_NON_NUL_ASCII(s))
+			return s;
+	}
+
+	/*
+	 * Handle complete blocks.
+	 *
+	 * As in utf8_strlen(), this may read past the trailing NUL byte but
+	 * cannot cross a page boundary since we only read aligned words.
+	 */
+
+	for (;; s += sizeof(size_t)) {
+		size_t u;
+
+		G_PREFETCH_R(&s[UTF8_CPU_CACHELINE]);
+
+		u = *(size_t *) s;
+
+		if (((u - ONEMASK) | u) & (ONEMASK * 0x80))
+			break;			/* Word holds a NUL or a non-ASCII byte */
+	}
+
+	/*
+	 * Locate the offending byte within the block.
+	 */
+
+	while (IS_NON_NUL_ASCII(s))
+		s++;
+
+	return s;
+}
+
 /**
  * Determine whether a string is UTF-8 encoded.
  *
@@ -981,15 +1043,21 @@ utf8_char_len_probe(const char *s)
 bool
 utf8_is_valid_string(const char *src)
 {
-	const char *s;
-	uint clen;
+	const char *s = src;
+
+	for (;;) {
+		uint clen;
+
+		s = utf8_ascii_span(s);		/* ASCII is always valid UTF-8 */
+
+		if ('\0' == *s)
+			return TRUE;
 
-	for (s = src; '\0' != *s; s += clen) {
 		if (0 == (clen = utf8_char_len(s)))
 			return FALSE;
-	}
 
-	return TRUE;
+		s += clen;
+	}
 }
 
 /**
@@ -1065,8 +1133,6 @@ utf8_data_char_count(const char *src, size_t len)
 	return n;
 }
 
-#define ONEMASK ((size_t) (-1) / 0xff)	/* 0x01010101 on 32-bit machine */
-
 /**
  * Quickly compute the amount of UTF-8 codepoints in the string, without
  * validating that the string is a valid UTF-8 one.
@@ -2650,19 +2716,10 @@ charset_to_utf8(const char *cs, const char *src, size_t src_len)
 	return result;
 }
 
-#if CHAR_BIT == 8
-#define IS_NON_NUL_ASCII(p) (*(const int8 *) (p) > 0)
-#else
-#define IS_NON_NUL_ASCII(p) (!(*(p) & ~0x7f) && (*(p) > 0))
-#endif
-
 bool
 is_ascii_string(const char *s)
 {
-	while (IS_NON_NUL_ASCII(s))
-		++s;
-
-	return '\0' == *s;
+	return '\0' == *utf8_ascii_span(s);
 }
 
 static inline const char *
@@ -5673,10 +5730,125 @@ utf32_canonize(const uint32 *src0)
 }
 
 /**
- * Apply the NFKD/NFC algo to have nomalized keywords (string is halloc()-ed)
+ * How an ASCII character is handled by utf8_canonize_ascii().
+ */
+enum utf8_ascii_canon_type {
+	UTF8_ASCII_CANON_SKIP = 0,		/**< Character is removed */
+	UTF8_ASCII_CANON_KEEP,			/**< Character kept, clears space state */
+	UTF8_ASCII_CANON_PASS,			/**< Character kept, space state intact */
+	UTF8_ASCII_CANON_SPACE			/**< Character becomes a separator */
+};
+
+/**
+ * Canonization of ASCII characters, indexed by the character value.
+ *
+ * This is computed by unicode_compose_init() from the outcome of the
+ * generic UTF-32 canonization steps, so that utf8_canonize_ascii() yields
+ * the very same output as utf32_canonize() would.
+ */
+static struct utf8_ascii_canon {
+	uint8 c;			/**< Case-folded character */
+	uint8 type;			/**< An enum utf8_ascii_canon_type value */
+} utf8_ascii_canon[0x80];
+
+/**
+ * Fill the utf8_ascii_canon[] table.
+ *
+ * ASCII characters are left intact by NFKD decomposition and by NFC
+ * composition, they fold to a single ASCII character and they all lie
+ * in the same Unicode block: the only steps that matter are therefore
+ * the case folding and the filtering done by utf32_filter_char().
+ */
+static void
+utf8_ascii_canon_init(void)
+{
+	uint i, block = utf32_block_id(0x0020);
+
+	for (i = 1; i < N_ITEMS(utf8_ascii_canon); i++) {
+		struct utf8_ascii_canon *ac = &utf8_ascii_canon[i];
+		uint32 folded[4], uc;
+		size_t n;
+		bool space;
+
+		n = utf32_case_fold_char(i, folded, N_ITEMS(folded));
+
+		g_assert_log(1 == n && UTF8_IS_ASCII(folded[0]),
+			"%s(): U+%04X folds to %zu chars", G_STRFUNC, i, n);
+		g_assert(NULL == utf32_decompose_lookup(folded[0], TRUE));
+		g_assert(block == utf32_block_id(folded[0]));
+
+		uc = folded[0];
+		ac->c = uc;
+
+		space = TRUE;
+		if (uc == utf32_filter_char(uc, &space, FALSE)) {
+			ac->type = space ? UTF8_ASCII_CANON_PASS : UTF8_ASCII_CANON_KEEP;
+			continue;
+		}
+
+		space = FALSE;
+		if (0x0020 == utf32_filter_char(uc, &space, FALSE)) {
+			g_assert(space);
+			ac->type = UTF8_ASCII_CANON_SPACE;
+		} else {
+			g_assert(!space);
+			ac->type = UTF8_ASCII_CANON_SKIP;
+		}
+	}
+}
+
+/**
+ * Canonize a pure ASCII string, without going through UTF-32.
+ *
+ * @param src	the NUL-terminated ASCII string
+ * @param len	the length of the string
+ *
+ * @return the canonized string, halloc()-ed.
+ */
+static char *
+utf8_canonize_ascii(const char *src, size_t len)
+{
+	const uchar *s;
+	char *dst, *p;
+	bool space = TRUE;		/* Prevents adding a leading space */
+
+	g_assert(unicode_compose_init_passed);
+
+	dst = p = halloc(len + 1);
+
+	for (s = (const uchar *) src; '\0' != *s; s++) {
+		const struct utf8_ascii_canon *ac = &utf8_ascii_canon[*s];
+
+		switch (ac->type) {
+		case UTF8_ASCII_CANON_KEEP:
+			space = FALSE;
+			/* FALL THROUGH */
+		case UTF8_ASCII_CANON_PASS:
+			*p++ = ac->c;
+			break;
+		case UTF8_ASCII_CANON_SPACE:
+			if (!space && '\0' != s[1])
+				*p++ = 0x20;
+			space = TRUE;
+			break;
+		case UTF8_ASCII_CANON_SKIP:
+			break;
+		}
+	}
+
+	*p = '\0';
+
+	g_assert(ptr_diff(p, dst) <= len);
+
+	return dst;
+}
+
+/**
+ * Apply the NFKD/NFC algo to have nomalized keywords through UTF-32,
+ * with no shortcut for ASCII strings (string is halloc()-ed).
  */
 char *
-utf8_canonize(const char *src)
+utf8_canonize_utf32(const char *src)
 {
 	uint32 *dst32;
 
@@ -5709,6 +5881,26 @@ utf8_canonize(const char *src)
 	return cast_to_char_ptr(dst32);
 }
 
+/**
+ * Apply the NFKD/NFC algo to have nomalized keywords (string is halloc()-ed)
+ */
+char *
+utf8_canonize(const char *src)
+{
+	const char *end;
+
+	/*
+	 * The vast majority of strings we canonize (queries, filenames) are
+	 * pure ASCII, and these can be processed without any conversion.
+	 */
+
+	end = utf8_ascii_span(src);
+	if ('\0' == *end)
+		return utf8_canonize_ascii(src, ptr_diff(end, src));
+
+	return utf8_canonize_utf32(src);
+}
+
 /**
  * Helper function to sort the lists of ``utf32_compose_roots''.
  */
@@ -5842,6 +6034,7 @@ unicode_compose_init(void)
 		}
 	}
 
+	utf8_ascii_canon_init();
 	unicode_compose_init_passed = TRUE;
 }
 
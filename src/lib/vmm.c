@@ -344,6 +344,11 @@ static struct vmm_stats {
 	uint64 hole_invalidated;		/**< Times we invalidate cached hole */
 	uint64 hole_updated;			/**< Times we updated the cached hole */
 	uint64 hole_unchanged;			/**< Times we left the cached hole as-is */
+	uint64 huge_aligned;			/**< Regions placed on huge page boundary */
+	uint64 huge_advised;			/**< Regions advised for huge pages */
+	uint64 huge_advised_pages;		/**< Pages advised for huge pages */
+	uint64 huge_released_pages;		/**< Huge-aligned pages given back */
+	AU64(huge_advise_failed);		/**< Failed madvise(MADV_HUGEPAGE) */
 	size_t user_memory;				/**< Amount of "user" memory allocated */
 	size_t user_pages;				/**< Amount of "user" memory pages used */
 	size_t user_blocks;				/**< Amount of "user" memory blocks */
@@ -442,6 +447,7 @@ static tmalloc_t *vmm_magazine[VMM_MAGAZINE_PAGEMAX];
 
 static bool safe_to_log;			/**< True when we can log */
 static bool stop_freeing;			/**< No longer release memory */
+static bool vmm_huge_pages = TRUE;	/**< Use huge pages for large regions */
 static uint32 vmm_debug;			/**< Debug level */
 static int sp_direction;			/**< Growing direction of the stack */
 static const void *vmm_base;		/**< Where we'll start allocating */
@@ -588,6 +594,73 @@ round_pagesize(size_t n)
 	return round_pagesize_fast(n);
 }
 
+/*
+ * Huge pages.
+ *
+ * Large regions obtained from the kernel are placed on a huge page boundary
+ * when possible and advised for transparent huge pages, to limit the TLB
+ * pressure on processes with a large resident set.  The huge page size is
+ * not queried: 2 MiB is what the common architectures use, and the advice
+ * is harmless if the kernel does not support it.
+ */
+#define VMM_HUGE_PAGESIZE	(2 * 1024 * 1024)
+#define VMM_HUGE_PAGEMASK	(VMM_HUGE_PAGESIZE - 1)
+#define VMM_HUGE_MIN		VMM_HUGE_PAGESIZE	/**< Minimum region size */
+
+/**
+ * Rounds pointer up to the next huge page boundary.
+ */
+static inline G_PURE ALWAYS_INLINE const void *
+huge_page_round_up(const void *p)
+{
+	unsigned long addr = pointer_to_ulong(p);
+
+	addr = (addr + VMM_HUGE_PAGEMASK) & ~(unsigned long) VMM_HUGE_PAGEMASK;
+	return ulong_to_pointer(addr);
+}
+
+/**
+ * Rounds pointer down to the previous huge page boundary.
+ */
+static inline G_PURE ALWAYS_INLINE const void *
+huge_page_round_down(const void *p)
+{
+	unsigned long addr = pointer_to_ulong(p);
+
+	addr &= ~(unsigned long) VMM_HUGE_PAGEMASK;
+	return ulong_to_pointer(addr);
+}
+
+/**
+ * Compute the amount of bytes in the region that huge pages can cover.
+ *
+ * @param p			start of the region
+ * @param size		size of the region
+ * @param start		if non-NULL, written with first huge page boundary
+ *
+ * @return length of the huge-aligned interior of the region, 0 if none.
+ */
+static size_t
+huge_page_interior(const void *p, size_t size, const void **start)
+{
+	const void *first = huge_page_round_up(p);
+	const void *last = huge_page_round_down(const_ptr_add_offset(p, size));
+
+	if (start != NULL)
+		*start = first;
+
+	return ptr_cmp(first, last) < 0 ? ptr_diff(last, first) : 0;
+}
+
+/**
+ * @return whether a region of ``size'' bytes is eligible for huge pages.
+ */
+static inline bool
+vmm_huge_eligible(size_t size)
+{
+	return vmm_huge_pages && size >= VMM_HUGE_MIN;
+}
+
 /**
  * Rounds pointer down so that it is aligned to the start of the page.
  */
@@ -1006,6 +1079,88 @@ vmm_find_hole(size_t size)
 	return NULL;
 }
 
+/**
+ * Find a hole in the virtual memory map where we could allocate "size" bytes
+ * starting on a huge page boundary.
+ *
+ * We look for a hole large enough to leave room for the alignment, and then
+ * place the region at the aligned spot closest to where vmm_find_hole()
+ * would have put it.  The unused part of the hole remains available for
+ * smaller allocations.
+ *
+ * This routine must be called with the pmap write-locked.
+ *
+ * @return aligned address within a hole, or the result of vmm_find_hole()
+ * for the plain size if there is no hole large enough.
+ */
+static const void *
+vmm_find_huge_hole(size_t size)
+{
+	size_t slack = VMM_HUGE_PAGESIZE - kernel_pagesize;
+	const void *p;
+
+	g_assert(kernel_pagesize < VMM_HUGE_PAGESIZE);
+	assert_rwlock_is_owned(&vmm_pmap()->lock);
+
+	if G_UNLIKELY(!vmm_fully_inited)
+		return NULL;
+
+	p = vmm_probe_hole(vmm_pmap(), size + slack);
+
+	if (NULL == p)
+		return vmm_find_hole(size);
+
+	/*
+	 * When addresses are increasing, the hole starts at `p' and we want
+	 * the lowest aligned address.  Otherwise, the hole ends at `p + size +
+	 * slack' and we want the highest aligned address.
+	 */
+
+	if (kernel_mapaddr_increasing)
+		p = huge_page_round_up(p);
+	else
+		p = huge_page_round_down(const_ptr_add_offset(p, slack));
+
+	VMM_STATS_LOCK;
+	vmm_stats.huge_aligned++;
+	VMM_STATS_UNLOCK;
+
+	return p;
+}
+
+/**
+ * Advise the kernel that the huge-aligned interior of the region should be
+ * backed by transparent huge pages.
+ */
+static void
+vmm_madvise_huge(void *p, size_t size)
+{
+#if defined(HAS_MADVISE) && defined(MADV_HUGEPAGE)
+	const void *start;
+	size_t len = huge_page_interior(p, size, &start);
+
+	if (0 == len)
+		return;
+
+	if (0 == madvise(deconstify_pointer(start), len, MADV_HUGEPAGE)) {
+		VMM_STATS_LOCK;
+		vmm_stats.huge_advised++;
+		vmm_stats.huge_advised_pages += pagecount_fast(len);
+		VMM_STATS_UNLOCK;
+	} else {
+		VMM_STATS_INCX(huge_advise_failed);
+
+		if (vmm_debugging(0)) {
+			s_miniwarn("VMM cannot advise huge pages for %'zuKiB at %p: %m",
+				len / 1024, start);
+		}
+	}
+#else
+	(void) p;
+	(void) size;
+#endif	/* HAS_MADVISE && MADV_HUGEPAGE */
+}
+
 /**
  * Discard region at specified index within the pmap.
  */
@@ -1896,6 +2051,8 @@ alloc_pages(size_t size, bool update_pmap)
 		rwlock_wlock(&pm->lock);
 		if (G_UNLIKELY(stop_freeing)) {
 			hole = NULL;
+		} else if (vmm_huge_eligible(size)) {
+			hole = vmm_find_huge_hole(size);
 		} else {
 			hole = vmm_find_hole(size);
 		}
@@ -1983,6 +2140,9 @@ allocated:
 	if (update_pmap)
 		rwlock_wunlock(&pm->lock);
 
+	if (vmm_huge_eligible(size))
+		vmm_madvise_huge(p, size);
+
 	return p;
 }
 
@@ -2012,6 +2172,16 @@ free_pages_intern(void *p, size_t size, bool update_pmap)
 	if (G_UNLIKELY(stop_freeing))
 		goto pmap_update;
 
+	if (vmm_huge_eligible(size)) {
+		size_t len = huge_page_interior(p, size, NULL);
+
+		if (len != 0) {
+			VMM_STATS_LOCK;
+			vmm_stats.huge_released_pages += pagecount_fast(len);
+			VMM_STATS_UNLOCK;
+		}
+	}
+
 #if defined(HAS_MMAP) || defined(MINGW32)
 	vmm_free_fragment(G_STRFUNC, p, size);
 #elif defined(HAS_POSIX_MEMALIGN) || defined(HAS_MEMALIGN)
@@ -5786,6 +5956,18 @@ set_vmm_debug(uint32 level)
 	vmm_debug = level;
 }
 
+/**
+ * Set whether large regions should be backed by huge pages, when the kernel
+ * supports transparent huge pages.
+ *
+ * This only affects subsequent allocations.
+ */
+void
+set_vmm_huge_pages(bool val)
+{
+	vmm_huge_pages = val;
+}
+
 /**
  * Set the VMM allocation strategy.
  *
@@ -5864,6 +6046,26 @@ vmm_stats_digest(sha1_t *digest)
 	SHA1_COMPUTE_NONCE(vmm_stats, &n, digest);
 }
 
+/**
+ * Fetch current VMM memory usage, in bytes.
+ *
+ * @param user		where amount of "user" memory is written, if non-NULL
+ * @param blocks	where amount of "user" memory blocks is written, if non-NULL
+ * @param core		where amount of "core" memory is written, if non-NULL
+ */
+void
+vmm_memory_usage(size_t *user, size_t *blocks, size_t *core)
+{
+	VMM_STATS_LOCK;
+	if (user != NULL)
+		*user = vmm_stats.user_memory;
+	if (blocks != NULL)
+		*blocks = vmm_stats.user_blocks;
+	if (core != NULL)
+		*core = vmm_stats.core_memory;
+	VMM_STATS_UNLOCK;
+}
+
 /**
  * Dump page cache statistics to specified logging agent.
  */
@@ -5972,6 +6174,11 @@ vmm_dump_stats_log(logagent_t *la, unsigned options)
 	DUMP(magazine_freeings_frag);
 	DUMP(hints_followed);
 	DUMP(hints_ignored);
+	DUMP(huge_aligned);
+	DUMP(huge_advised);
+	DUMP(huge_advised_pages);
+	DUMP(huge_released_pages);
+	DUMP64(huge_advise_failed);
 	DUMP(alloc_from_cache);
 	DUMP(alloc_from_cache_pages);
 	DUMP(alloc_direct_core);
@@ -6102,6 +6309,20 @@ vmm_dump_stats_log(logagent_t *la, unsigned options)
 	DUMP("mapped_pages", mapped_pages);
 	DUMP("native_pages", native_pages);
 
+	/*
+	 * Estimated huge page coverage of our native memory, in percents.
+	 * Regions freed by parts may not have been advised, so this is only
+	 * an approximation.
+	 */
+
+	{
+		uint64 huge = stats.huge_advised_pages > stats.huge_released_pages ?
+			stats.huge_advised_pages - stats.huge_released_pages : 0;
+
+		DUMP("huge_pages_coverage", 0 == native_pages ? 0 :
+			(size_t) MIN(100, huge * 100 / native_pages));
+	}
+
 	/*
 	 * "computed_native_pages" MUST be equal to "native_pages" or it means
 	 * we're not accounting the allocated pages correctly, either in the
@@ -141,6 +141,7 @@ void *vmm_move(void *base, size_t size);
 void *vmm_core_move(void *base, size_t size);
 
 void set_vmm_debug(uint32 level);
+void set_vmm_huge_pages(bool val);
 bool vmm_is_debugging(uint32 level) G_PURE;
 void vmm_crash_mode(void);
 bool vmm_is_crashing(void);
@@ -163,6 +164,7 @@ void vmm_dump_pcache_log(struct logagent *la);
 struct sha1;
 
 void vmm_stats_digest(struct sha1 *digest);
+void vmm_memory_usage(size_t *user, size_t *blocks, size_t *core);
 
 void vmm_madvise_free(void *p, size_t size);
 void vmm_madvise_normal(void *p, size_t size);
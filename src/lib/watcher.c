@@ -30,18 +30,29 @@
  * Periodically monitors file and invoke processing callback
  * should the file change.
  *
+ * Directories can also be watched for changes in the files they hold,
+ * when the kernel can notify us (Linux inotify).
+ *
  * @author Raphael Manfredi
- * @date 2004
+ * @date 2004, 2026
  */
 
 #include "common.h"
 
+#ifdef I_SYS_INOTIFY
+#include <sys/inotify.h>
+#define USE_INOTIFY
+#endif
+
 #include "watcher.h"
 
 #include "atoms.h"
 #include "cq.h"
+#include "fd.h"
 #include "halloc.h"
 #include "hikset.h"
+#include "htable.h"
+#include "log.h"
 #include "once.h"
 #include "path.h"
 #include "walloc.h"
@@ -49,6 +60,7 @@
 #include "override.h"		/* Must be the last header included */
 
 #define MONITOR_PERIOD_MS	(30*1000)	/**< 30 seconds */
+#define WATCHER_DIR_PERIOD_MS	1000	/**< Reading of kernel events */
 
 /**
  * A monitored file.
@@ -206,6 +218,369 @@ watcher_unregister_path(const file_path_t *fp)
 	HFREE_NULL(path);
 }
 
+/***
+ *** Directory watching.
+ ***/
+
+#ifdef USE_INOTIFY
+
+#define WATCHER_INOTIFY_MASK \
+	(IN_CREATE | IN_CLOSE_WRITE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+	 IN_MOVE_SELF | IN_ONLYDIR | IN_EXCL_UNLINK)
+
+/**
+ * A watched directory.
+ */
+struct watched_dir {
+	const char *dir;		/**< Directory being watched (atom) */
+	int wd;					/**< Kernel watch descriptor, -1 if aliased */
+	watcher_dir_cb_t cb;	/**< Callback to invoke on changes */
+	void *udata;			/**< User supplied data to hand-out to callback */
+};
+
+static hikset_t *watched_dirs;	/**< dir -> struct watched_dir */
+static htable_t *watched_wds;	/**< wd -> struct watched_dir */
+static int watcher_ifd = -1;	/**< The inotify descriptor */
+static cperiodic_t *watcher_dir_ev;
+
+static void watcher_dir_flush(void);
+
+/**
+ * Read pending kernel events -- callout queue periodic callback.
+ *
+ * The inotify descriptor is neither a socket nor a pipe, so we poll it
+ * in non-blocking mode instead of registering it to the I/O layer.
+ */
+static bool
+watcher_dir_timer(void *unused_udata)
+{
+	(void) unused_udata;
+
+	watcher_dir_flush();
+	return TRUE;		/* Keep calling */
+}
+
+/**
+ * Configure directory watching, once.
+ */
+static void
+watcher_dir_init_once(void)
+{
+	watcher_ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+	if (-1 == watcher_ifd) {
+		s_warning("%s(): cannot watch directories: %m", G_STRFUNC);
+		return;
+	}
+
+	watched_dirs = hikset_create(
+		offsetof(struct watched_dir, dir), HASH_KEY_STRING, 0);
+	watched_wds = htable_create(HASH_KEY_SELF, 0);
+	watcher_dir_ev =
+		cq_periodic_main_add(WATCHER_DIR_PERIOD_MS, watcher_dir_timer, NULL);
+}
+
+/**
+ * @return whether we can watch directories.
+ */
+static bool
+watcher_dir_init(void)
+{
+	static once_flag_t watcher_dir_inited;
+
+	ONCE_FLAG_RUN(watcher_dir_inited, watcher_dir_init_once);
+
+	return watcher_ifd != -1;
+}
+
+/**
+ * Notify all the registered callbacks that events were lost.
+ */
+static void
+watcher_dir_overflow(void)
+{
+	struct watched_dir *w;
+	hikset_iter_t *iter;
+	struct { watcher_dir_cb_t cb; void *udata; } seen[8];
+	size_t i, n = 0;
+
+	/*
+	 * Each distinct callback is invoked once, and we collect them before
+	 * invoking any since callbacks can unregister directories.
+	 */
+
+	iter = hikset_iter_new(watched_dirs);
+
+	while (hikset_iter_next(iter, (void *) &w)) {
+		for (i = 0; i < n; i++) {
+			if (seen[i].cb == w->cb && seen[i].udata == w->udata)
+				break;
+		}
+		if (i == n && n < N_ITEMS(seen)) {
+			seen[n].cb = w->cb;
+			seen[n].udata = w->udata;
+			n++;
+		}
+	}
+
+	hikset_iter_release(&iter);
+
+	for (i = 0; i < n; i++) {
+		(*seen[i].cb)(WATCHER_EV_OVERFLOW, NULL, seen[i].udata);
+	}
+}
+
+/**
+ * Dispatch kernel event to the callback of the watched directory.
+ */
+static void
+watcher_dir_dispatch(const struct inotify_event *ev)
+{
+	struct watched_dir *w;
+	enum watcher_event what;
+	char *path;
+
+	if (ev->mask & IN_Q_OVERFLOW) {
+		watcher_dir_overflow();
+		return;
+	}
+
+	w = htable_lookup(watched_wds, int_to_pointer(ev->wd));
+
+	if (NULL == w)
+		return;			/* Late event for a directory no longer watched */
+
+	/*
+	 * The kernel drops the watch when the directory is removed or when
+	 * its filesystem is unmounted.
+	 */
+
+	if (ev->mask & IN_IGNORED) {
+		htable_remove(watched_wds, int_to_pointer(ev->wd));
+		w->wd = -1;
+		(*w->cb)(WATCHER_EV_GONE, w->dir, w->udata);
+		return;
+	}
+
+	if (ev->mask & IN_MOVE_SELF) {
+		(*w->cb)(WATCHER_EV_GONE, w->dir, w->udata);
+		return;
+	}
+
+	if (0 == ev->len)
+		return;
+
+	if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+		what = (ev->mask & IN_ISDIR) ? WATCHER_EV_DIR_REMOVED : WATCHER_EV_REMOVED;
+	else if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+		what = (ev->mask & IN_ISDIR) ? WATCHER_EV_DIR_CREATED : WATCHER_EV_CREATED;
+	else if (ev->mask & IN_ISDIR)
+		return;
+	else if (ev->mask & IN_CLOSE_WRITE)
+		what = WATCHER_EV_CHANGED;
+	else
+		return;
+
+	path = make_pathname(w->dir, ev->name);
+	(*w->cb)(what, path, w->udata);
+	HFREE_NULL(path);
+}
+
+/**
+ * Read and dispatch all the pending kernel events.
+ */
+static void
+watcher_dir_flush(void)
+{
+	union {
+		struct inotify_event ev;
+		char buf[8192];
+	} u;
+
+	g_assert(watcher_ifd != -1);
+
+	for (;;) {
+		ssize_t r;
+		const char *p;
+
+		r = read(watcher_ifd, u.buf, sizeof u.buf);
+
+		if ((ssize_t) -1 == r) {
+			if (EINTR == errno)
+				continue;
+			if (!is_temporary_error(errno))
+				s_warning("%s(): read error: %m", G_STRFUNC);
+			break;
+		}
+
+		if (0 == r)
+			break;
+
+		for (p = u.buf; p < &u.buf[r]; /* empty */) {
+			const struct inotify_event *ev = (const void *) p;
+
+			watcher_dir_dispatch(ev);
+			p += sizeof *ev + ev->len;
+		}
+	}
+}
+
+/**
+ * Free watched directory structure.
+ */
+static void
+watcher_dir_free(struct watched_dir *w)
+{
+	atom_str_free(w->dir);
+	WFREE(w);
+}
+
+/**
+ * Stop watching a directory.
+ */
+static void
+watcher_dir_unwatch(struct watched_dir *w)
+{
+	if (w->wd != -1 && w == htable_lookup(watched_wds, int_to_pointer(w->wd))) {
+		htable_remove(watched_wds, int_to_pointer(w->wd));
+		if (-1 == inotify_rm_watch(watcher_ifd, w->wd) && EINVAL != errno)
+			s_warning("%s(): cannot unwatch %s: %m", G_STRFUNC, w->dir);
+	}
+}
+
+/**
+ * Free watched directory -- hash table iterator callback.
+ */
+static void
+free_watched_kv(void *value, void *unused_udata)
+{
+	struct watched_dir *w = value;
+
+	(void) unused_udata;
+	watcher_dir_free(w);
+}
+
+/**
+ * Release directory watching resources.
+ */
+static void
+watcher_dir_close(void)
+{
+	if (NULL == watched_dirs)
+		return;
+
+	cq_periodic_remove(&watcher_dir_ev);
+	hikset_foreach(watched_dirs, free_watched_kv, NULL);
+	hikset_free_null(&watched_dirs);
+	htable_free_null(&watched_wds);
+	fd_close(&watcher_ifd);
+}
+
+#endif	/* USE_INOTIFY */
+
+/**
+ * Watch directory for changes in the files it holds.
+ *
+ * Only the directory itself is watched, not its sub-directories, which
+ * need to be registered separately.  Changes are reported asynchronously
+ * from the main thread.
+ *
+ * If the directory was already watched, the previous callback is replaced.
+ *
+ * @param dir	the directory to watch (string duplicated)
+ * @param cb	the callback to invoke when files change
+ * @param udata	extra data to pass to the callback
+ *
+ * @return TRUE if directory is watched, FALSE if we cannot watch it, either
+ * because the kernel does not support it or because of resource limits.
+ */
+bool
+watcher_dir_add(const char *dir, watcher_dir_cb_t cb, void *udata)
+{
+#ifdef USE_INOTIFY
+	struct watched_dir *w, *ow;
+	int wd;
+
+	g_assert(dir != NULL);
+	g_assert(cb != NULL);
+
+	if (!watcher_dir_init())
+		return FALSE;
+
+	wd = inotify_add_watch(watcher_ifd, dir, WATCHER_INOTIFY_MASK);
+
+	if (-1 == wd) {
+		if (ENOSPC == errno) {
+			s_warning_once_per(LOG_PERIOD_HOUR,
+				"%s(): too many watched directories, "
+				"see /proc/sys/fs/inotify/max_user_watches", G_STRFUNC);
+		} else {
+			s_warning("%s(): cannot watch %s: %m", G_STRFUNC, dir);
+		}
+		return FALSE;
+	}
+
+	w = hikset_lookup(watched_dirs, dir);
+
+	if (NULL == w) {
+		WALLOC0(w);
+		w->dir = atom_str_get(dir);
+		hikset_insert_key(watched_dirs, &w->dir);
+	}
+
+	w->wd = wd;
+	w->cb = cb;
+	w->udata = udata;
+
+	/*
+	 * The same directory reached through another path (via symbolic links)
+	 * yields the same watch descriptor: events are then reported under the
+	 * first path only.
+	 */
+
+	ow = htable_lookup(watched_wds, int_to_pointer(wd));
+
+	if (NULL == ow)
+		htable_insert(watched_wds, int_to_pointer(wd), w);
+	else if (ow != w)
+		w->wd = -1;
+
+	return TRUE;
+#else
+	(void) dir;
+	(void) cb;
+	(void) udata;
+	return FALSE;
+#endif	/* USE_INOTIFY */
+}
+
+/**
+ * Stop watching directory.
+ */
+void
+watcher_dir_remove(const char *dir)
+{
+#ifdef USE_INOTIFY
+	struct watched_dir *w;
+
+	g_assert(dir != NULL);
+
+	if (NULL == watched_dirs)
+		return;
+
+	w = hikset_lookup(watched_dirs, dir);
+
+	if (NULL == w)
+		return;
+
+	watcher_dir_unwatch(w);
+	hikset_remove(watched_dirs, w->dir);
+	watcher_dir_free(w);
+#else
+	(void) dir;
+#endif	/* USE_INOTIFY */
+}
+
 /**
  * Configure the watcher layer, once.
  */
@@ -248,6 +623,10 @@ watcher_close(void)
 {
 	hikset_foreach(monitored, free_monitored_kv, NULL);
 	hikset_free_null(&monitored);
+
+#ifdef USE_INOTIFY
+	watcher_dir_close();
+#endif
 }
 
 /* vi: set ts=4 sw=4 cindent: */
@@ -43,6 +43,28 @@
  */
 typedef void (*watcher_cb_t)(const char *filename, void *udata);
 
+/**
+ * Events reported on watched directories.
+ */
+enum watcher_event {
+	WATCHER_EV_CREATED = 0,		/**< File created or moved in */
+	WATCHER_EV_CHANGED,			/**< File was written to and closed */
+	WATCHER_EV_REMOVED,			/**< File deleted or moved out */
+	WATCHER_EV_DIR_CREATED,		/**< Sub-directory created or moved in */
+	WATCHER_EV_DIR_REMOVED,		/**< Sub-directory deleted or moved out */
+	WATCHER_EV_GONE,			/**< Watched directory moved or removed */
+	WATCHER_EV_OVERFLOW			/**< Events lost, must resynchronize */
+};
+
+/**
+ * The callback invoked when a file changes in a watched directory.
+ *
+ * The path is that of the changed file, or of the watched directory for
+ * WATCHER_EV_GONE, and is NULL for WATCHER_EV_OVERFLOW.
+ */
+typedef void (*watcher_dir_cb_t)(
+	enum watcher_event ev, const char *path, void *udata);
+
 /*
  * Public interface.
  */
@@ -54,6 +76,8 @@ void watcher_unregister(const char *filename);
 void watcher_register_path(
 	const file_path_t *fp, watcher_cb_t cb, void *udata);
 void watcher_unregister_path(const file_path_t *fp);
+bool watcher_dir_add(const char *dir, watcher_dir_cb_t cb, void *udata);
+void watcher_dir_remove(const char *dir);
 
 #endif /* _watcher_h_ */
 
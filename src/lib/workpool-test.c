@@ -0,0 +1,314 @@
+/*
+ * workpool-test -- worker pool tests.
+ *
+ * Copyright (c) 2026 Raphael Manfredi <Raphael_Manfredi@pobox.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+
+#include "lib/atomic.h"
+#include "lib/misc.h"
+#include "lib/progname.h"
+#include "lib/stringify.h"
+#include "lib/teq.h"
+#include "lib/thread.h"
+#include "lib/tm.h"
+#include "lib/workpool.h"
+#include "lib/xmalloc.h"
+
+#define DEFAULT_JOBS		10000		/* Jobs submitted */
+#define DEFAULT_WORKERS		4			/* Threads in the pool */
+
+static bool verbose_mode;
+
+static void G_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-hV] [-c jobs] [-n workers]\n"
+		"  -c : sets amount of jobs to submit (default = %u)\n"
+		"  -h : prints this help message\n"
+		"  -n : sets amount of worker threads (default = %u)\n"
+		"  -V : verbose mode -- print status after each successful test\n"
+		, getprogname(), DEFAULT_JOBS, DEFAULT_WORKERS);
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * A job: compute the sum of the first `n' integers.
+ */
+struct job {
+	uint n;				/* Input */
+	uint64 sum;			/* Computed by the worker */
+	uint worker;		/* Thread which ran the job */
+	uint completer;		/* Thread which ran the completion */
+	bool done;			/* Completion was run */
+};
+
+static uint completed;	/* Amount of completions run */
+static uint processed;	/* Amount of jobs run, for jobs without completion */
+
+static void
+job_work(void *arg)
+{
+	struct job *j = arg;
+	uint i;
+
+	j->sum = 0;
+	for (i = 1; i <= j->n; i++)
+		j->sum += i;
+
+	j->worker = thread_small_id();
+}
+
+static void
+job_count(void *arg)
+{
+	job_work(arg);
+	atomic_uint_inc(&processed);
+}
+
+static void
+job_done(void *arg)
+{
+	struct job *j = arg;
+
+	if (j->done)
+		g_error("completion for job %u run twice", j->n);
+
+	j->completer = thread_small_id();
+	j->done = TRUE;
+	completed++;		/* Completions are run by the submitting thread */
+}
+
+static struct job *
+jobs_make(size_t cnt)
+{
+	struct job *jobs;
+	size_t i;
+
+	XMALLOC0_ARRAY(jobs, cnt);
+
+	for (i = 0; i < cnt; i++)
+		jobs[i].n = i;
+
+	return jobs;
+}
+
+static void
+jobs_check(const struct job *jobs, size_t cnt, bool with_done)
+{
+	uint me = thread_small_id();
+	size_t i;
+
+	for (i = 0; i < cnt; i++) {
+		const struct job *j = &jobs[i];
+		uint64 expected = (uint64) j->n * (j->n + 1) / 2;
+
+		if (j->sum != expected) {
+			g_error("job #%zu computed %s, expected %s",
+				i, uint64_to_string(j->sum), uint64_to_string2(expected));
+		}
+		if (j->worker == me)
+			g_error("job #%zu was run by the submitting thread", i);
+		if (with_done && !j->done)
+			g_error("job #%zu was not completed", i);
+		if (with_done && j->completer != me)
+			g_error("job #%zu completed in thread #%u", i, j->completer);
+	}
+}
+
+static void
+test_completion(size_t cnt, uint workers)
+{
+	workpool_t *wp;
+	struct job *jobs;
+	size_t i;
+	tm_t start, end;
+
+	wp = workpool_make("test worker", workers);
+	if (NULL == wp)
+		g_error("cannot create pool of %u worker%s", PLURAL(workers));
+
+	if (0 == workpool_count(wp) || workpool_count(wp) > workers) {
+		g_error("pool has %u worker%s, expected at most %u",
+			PLURAL(workpool_count(wp)), workers);
+	}
+
+	jobs = jobs_make(cnt);
+	completed = 0;
+
+	tm_now_exact(&start);
+
+	for (i = 0; i < cnt; i++)
+		workpool_submit(wp, job_work, job_done, &jobs[i]);
+
+	while (completed != cnt) {
+		if (0 == teq_dispatch())
+			thread_sleep_ms(1);
+	}
+
+	tm_now_exact(&end);
+
+	if (0 != workpool_pending(wp))
+		g_error("%zu job%s still pending", PLURAL(workpool_pending(wp)));
+
+	jobs_check(jobs, cnt, TRUE);
+	workpool_free_null(&wp);
+
+	if (completed != cnt)
+		g_error("got %u completion%s for %zu jobs", PLURAL(completed), cnt);
+
+	if (verbose_mode) {
+		printf("%zu job%s completed by %u worker%s in %.3fs - OK\n",
+			PLURAL(cnt), PLURAL(workers), tm_elapsed_f(&end, &start));
+	}
+
+	xfree(jobs);
+}
+
+static void
+test_drain(size_t cnt, uint workers)
+{
+	workpool_t *wp;
+	struct job *jobs;
+	size_t i;
+
+	wp = workpool_make("test drain", workers);
+	if (NULL == wp)
+		g_error("cannot create pool of %u worker%s", PLURAL(workers));
+
+	jobs = jobs_make(cnt);
+	completed = 0;
+
+	for (i = 0; i < cnt; i++)
+		workpool_submit(wp, job_work, job_done, &jobs[i]);
+
+	/*
+	 * Freeing the pool must let the workers process all the pending jobs
+	 * and run all their completions before returning.
+	 */
+
+	workpool_free_null(&wp);
+
+	if (wp != NULL)
+		g_error("pool pointer not nullified");
+	if (completed != cnt)
+		g_error("got %u completion%s for %zu jobs", PLURAL(completed), cnt);
+
+	jobs_check(jobs, cnt, TRUE);
+
+	if (verbose_mode)
+		printf("%zu pending job%s completed when freeing pool - OK\n",
+			PLURAL(cnt));
+
+	xfree(jobs);
+}
+
+static void
+test_no_completion(size_t cnt, uint workers)
+{
+	workpool_t *wp;
+	struct job *jobs;
+	size_t i;
+
+	wp = workpool_make("test count", workers);
+	if (NULL == wp)
+		g_error("cannot create pool of %u worker%s", PLURAL(workers));
+
+	jobs = jobs_make(cnt);
+	processed = 0;
+	completed = 0;
+
+	for (i = 0; i < cnt; i++)
+		workpool_submit(wp, job_count, NULL, &jobs[i]);
+
+	workpool_free_null(&wp);
+
+	if (atomic_uint_get(&processed) != cnt) {
+		g_error("processed %u job%s out of %zu",
+			PLURAL(atomic_uint_get(&processed)), cnt);
+	}
+	if (completed != 0)
+		g_error("got %u unexpected completion%s", PLURAL(completed));
+
+	jobs_check(jobs, cnt, FALSE);
+
+	if (verbose_mode)
+		printf("%zu job%s without completion processed - OK\n", PLURAL(cnt));
+
+	xfree(jobs);
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	size_t count = DEFAULT_JOBS;
+	uint workers = DEFAULT_WORKERS;
+	int c;
+	const char options[] = "c:hn:V";
+
+	progstart(argc, argv);
+
+	while ((c = getopt(argc, argv, options)) != EOF) {
+		switch (c) {
+		case 'c':			/* amount of jobs */
+			count = atol(optarg);
+			break;
+		case 'n':			/* amount of workers */
+			workers = atoi(optarg);
+			break;
+		case 'V':			/* verbose mode */
+			verbose_mode = TRUE;
+			break;
+		case 'h':			/* show help */
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if ((argc -= optind) != 0)
+		usage();
+
+	if (0 == workers)
+		usage();
+
+	teq_create();		/* Completions are posted to us */
+
+	test_completion(count, workers);
+	test_drain(count, workers);
+	test_no_completion(count, workers);
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,259 @@
+/*
+ * Copyright (c) 2026, Raphael Manfredi
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Pools of worker threads.
+ *
+ * A pool is a set of threads fed from a single asynchronous queue: the
+ * first idle worker picks the next job and runs its work routine.  Once
+ * the work is done, the completion routine is posted back to the thread
+ * which submitted the job, through its thread event queue, so that the
+ * result can be exploited there without any locking.
+ *
+ * Work routines may issue RPCs to the submitting thread (typically to
+ * access data structures owned by the main thread) since the pool never
+ * blocks that thread without dispatching its events.
+ *
+ * @author Raphael Manfredi
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "workpool.h"
+
+#include "aq.h"
+#include "atomic.h"
+#include "log.h"
+#include "str.h"
+#include "teq.h"
+#include "thread.h"
+#include "walloc.h"
+
+#include "override.h"		/* Must be the last header included */
+
+#define WORKPOOL_MAX		16		/**< Maximum amount of workers in a pool */
+
+enum workpool_magic { WORKPOOL_MAGIC = 0x5e1d3a07 };
+
+/**
+ * A pool of worker threads.
+ */
+struct workpool {
+	enum workpool_magic magic;
+	aqueue_t *jobs;				/**< Pending jobs, NULL asks a worker to exit */
+	unsigned count;				/**< Amount of workers launched */
+	unsigned running;			/**< Amount of workers still running */
+	char name[32];				/**< Name of the worker threads */
+};
+
+static inline void
+workpool_check(const struct workpool * const wp)
+{
+	g_assert(wp != NULL);
+	g_assert(WORKPOOL_MAGIC == wp->magic);
+}
+
+/**
+ * A job submitted to the pool.
+ */
+struct workpool_job {
+	workpool_fn_t work;			/**< Routine to run in a worker */
+	notify_fn_t done;			/**< Completion, run in the submitter */
+	void *arg;					/**< Argument for both routines */
+	unsigned stid;				/**< Thread which submitted the job */
+};
+
+/**
+ * Worker thread main loop.
+ */
+static void *
+workpool_main(void *arg)
+{
+	workpool_t *wp = arg;
+	struct workpool_job *job;
+
+	workpool_check(wp);
+
+	thread_set_name(wp->name);
+
+	while (NULL != (job = aq_remove(wp->jobs))) {
+		(*job->work)(job->arg);
+
+		if (job->done != NULL)
+			teq_safe_post(job->stid, job->done, job->arg);
+
+		WFREE(job);
+	}
+
+	atomic_uint_dec(&wp->running);
+
+	return NULL;
+}
+
+/**
+ * Create a new pool of worker threads.
+ *
+ * @param name		name given to the worker threads
+ * @param n			amount of workers wanted
+ *
+ * @return the new pool, NULL if no worker could be launched.
+ */
+workpool_t *
+workpool_make(const char *name, unsigned n)
+{
+	workpool_t *wp;
+	unsigned i;
+
+	g_assert(name != NULL);
+
+	WALLOC0(wp);
+	wp->magic = WORKPOOL_MAGIC;
+	wp->jobs = aq_make();
+	str_bprintf(ARYLEN(wp->name), "%s", name);
+
+	n = MIN(n, WORKPOOL_MAX);
+
+	for (i = 0; i < n; i++) {
+		int id;
+
+		atomic_uint_inc(&wp->running);
+
+		id = thread_create(workpool_main, wp,
+				THREAD_F_DETACH | THREAD_F_NO_POOL, THREAD_STACK_DFLT);
+
+		if (-1 == id) {
+			s_warning("%s(): cannot launch %s worker #%u: %m",
+				G_STRFUNC, name, i);
+			atomic_uint_dec(&wp->running);
+			break;
+		}
+
+		wp->count++;
+	}
+
+	if (0 == wp->count) {
+		aq_destroy_null(&wp->jobs);
+		wp->magic = 0;
+		WFREE(wp);
+		return NULL;
+	}
+
+	return wp;
+}
+
+/**
+ * Stop the workers and free the pool, nullifying its pointer.
+ *
+ * Pending jobs are processed before the workers exit, and all the completion
+ * routines have been run when we return.  The calling thread must be the one
+ * which submitted the jobs.
+ */
+void
+workpool_free_null(workpool_t **wp_ptr)
+{
+	workpool_t *wp = *wp_ptr;
+	unsigned i;
+
+	if (NULL == wp)
+		return;
+
+	workpool_check(wp);
+
+	for (i = 0; i < wp->count; i++)
+		aq_put(wp->jobs, NULL);
+
+	/*
+	 * Workers may be waiting for an RPC or have posted completions to
+	 * us, so keep dispatching our events whilst they finish.
+	 */
+
+	while (0 != atomic_uint_get(&wp->running)) {
+		if (0 == teq_dispatch())
+			thread_sleep_ms(1);
+	}
+
+	(void) teq_dispatch();		/* Last completions posted before exiting */
+
+	aq_destroy_null(&wp->jobs);
+	wp->magic = 0;
+	WFREE(wp);
+	*wp_ptr = NULL;
+}
+
+/**
+ * @return the amount of worker threads in the pool.
+ */
+unsigned
+workpool_count(const workpool_t *wp)
+{
+	workpool_check(wp);
+
+	return wp->count;
+}
+
+/**
+ * @return the amount of jobs waiting for a worker.
+ */
+size_t
+workpool_pending(const workpool_t *wp)
+{
+	workpool_check(wp);
+
+	return aq_count(wp->jobs);
+}
+
+/**
+ * Submit a job to the pool.
+ *
+ * The completion routine, if any, is invoked with the same argument in the
+ * context of the calling thread, which must therefore have a thread event
+ * queue.
+ *
+ * @param wp		the worker pool
+ * @param work		the routine to run in a worker thread
+ * @param done		the completion routine (may be NULL)
+ * @param arg		argument for both routines
+ */
+void
+workpool_submit(workpool_t *wp, workpool_fn_t work, notify_fn_t done, void *arg)
+{
+	struct workpool_job *job;
+
+	workpool_check(wp);
+	g_assert(work != NULL);
+	g_assert(NULL == done || teq_is_supported(thread_small_id()));
+
+	WALLOC(job);
+	job->work = work;
+	job->done = done;
+	job->arg = arg;
+	job->stid = thread_small_id();
+
+	aq_put(wp->jobs, job);
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2026, Raphael Manfredi
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Pools of worker threads.
+ *
+ * @author Raphael Manfredi
+ * @date 2026
+ */
+
+#ifndef _workpool_h_
+#define _workpool_h_
+
+typedef struct workpool workpool_t;
+
+/**
+ * A work routine, invoked in one of the worker threads of the pool.
+ */
+typedef void (*workpool_fn_t)(void *arg);
+
+/*
+ * Public interface.
+ */
+
+workpool_t *workpool_make(const char *name, unsigned n);
+void workpool_free_null(workpool_t **wp_ptr);
+
+unsigned workpool_count(const workpool_t *wp);
+size_t workpool_pending(const workpool_t *wp);
+void workpool_submit(workpool_t *wp,
+	workpool_fn_t work, notify_fn_t done, void *arg);
+
+#endif /* _workpool_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -6877,6 +6877,38 @@ xmalloc_stats_digest(sha1_t *digest)
 	SHA1_COMPUTE_NONCE(xstats, &n, digest);
 }
 
+/**
+ * Fetch current xmalloc() user memory usage.
+ *
+ * @param memory	where amount of allocated bytes is written, if non-NULL
+ * @param blocks	where amount of allocated blocks is written, if non-NULL
+ */
+void
+xmalloc_memory_usage(size_t *memory, size_t *blocks)
+{
+	XSTATS_LOCK;
+	if (memory != NULL)
+		*memory = xstats.user_memory;
+	if (blocks != NULL)
+		*blocks = xstats.user_blocks;
+	XSTATS_UNLOCK;
+}
+
+/**
+ * @return total amount of xmalloc() allocations made so far.
+ */
+uint64
+xmalloc_allocations(void)
+{
+	uint64 n;
+
+	XSTATS_LOCK;
+	n = xstats.allocations;
+	XSTATS_UNLOCK;
+
+	return n;
+}
+
 /**
  * Dump xmalloc usage statistics to specified logging agent.
  */
@@ -167,6 +167,8 @@ void xmalloc_dump_freelist_log(struct logagent *la);
 size_t xmalloc_freelist_check(struct logagent *la, unsigned flags);
 
 void xmalloc_stats_digest(struct sha1 *digest);
+void xmalloc_memory_usage(size_t *memory, size_t *blocks);
+uint64 xmalloc_allocations(void);
 
 void xgc(void);
 void xmalloc_long_term(void);
@@ -3860,6 +3860,38 @@ zalloc_stats_digest(sha1_t *digest)
 	SHA1_COMPUTE_NONCE(zstats, &n, digest);
 }
 
+/**
+ * Fetch current zalloc() user memory usage.
+ *
+ * @param memory	where amount of allocated bytes is written, if non-NULL
+ * @param blocks	where amount of allocated blocks is written, if non-NULL
+ */
+void
+zalloc_memory_usage(size_t *memory, size_t *blocks)
+{
+	ZSTATS_LOCK;
+	if (memory != NULL)
+		*memory = zstats.user_memory;
+	if (blocks != NULL)
+		*blocks = zstats.user_blocks;
+	ZSTATS_UNLOCK;
+}
+
+/**
+ * @return total amount of zalloc() allocations made so far.
+ */
+uint64
+zalloc_allocations(void)
+{
+	uint64 n;
+
+	ZSTATS_LOCK;
+	n = zstats.allocations;
+	ZSTATS_UNLOCK;
+
+	return n;
+}
+
 /**
  * Dump zone status to specified log agent.
  */
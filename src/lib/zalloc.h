@@ -100,6 +100,8 @@ void zgc(bool overloaded);
 void zalloc_long_term(void);
 
 void zalloc_stats_digest(struct sha1 *digest);
+void zalloc_memory_usage(size_t *memory, size_t *blocks);
+uint64 zalloc_allocations(void);
 
 void zinit(void);
 void zclose(void);
@@ -41,6 +41,7 @@
 #define CORE_SOURCES
 
 #include "core/ban.h"
+#include "core/bh_upload.h"
 #include "core/bogons.h"
 #include "core/bsched.h"
 #include "core/clock.h"
@@ -84,6 +85,7 @@
 #include "core/pdht.h"
 #include "core/pproxy.h"
 #include "core/publisher.h"
+#include "core/replay.h"
 #include "core/routing.h"
 #include "core/rx.h"
 #include "core/search.h"
@@ -95,6 +97,7 @@
 #include "core/tls_common.h"
 #include "core/topless.h"
 #include "core/tsync.h"
+#include "core/tth_cache.h"
 #include "core/tx.h"
 #include "core/udp.h"
 #include "core/uhc.h"
@@ -715,7 +718,9 @@ gtk_gnutella_exit(int exit_code)
 	DO(file_info_store_if_dirty);	/* For safety, will run again below */
 	DO(file_info_close_pre);
 	DO_BOOL(node_bye_all, byeall);
+	DO(search_decode_close);	/* Drain hits decoded by workers */
 	DO(upload_close);	/* Done before upload_stats_close() for stats update */
+	DO(bh_upload_close);
 	DO(upload_stats_close);
 	DO(parq_close_pre);
 	DO(verify_sha1_close);
@@ -935,6 +940,7 @@ gtk_gnutella_exit(int exit_code)
 	DO(ntp_close);
 	DO(gdht_close);
 	DO(sq_close);
+	DO(replay_close);		/* Before any layer used by replay nodes */
 	DO(dh_close);
 	DO(dq_close);
 	DO(hsep_close);
@@ -982,6 +988,7 @@ gtk_gnutella_exit(int exit_code)
 	DO(misc_close);
 	DO(mingw_close);
 	DO(verify_tth_close);
+	DO(tth_cache_close);	/* After verify_tth_close() */
 	DO(inputevt_close);
 	DO(locale_close);
 	DO(wq_close);
@@ -2554,6 +2561,7 @@ main(int argc, char **argv)
 	gwc_init();
 	verify_sha1_init();
 	verify_tth_init();
+	tth_cache_init();
 	move_init();
 	ignore_init();
 	word_vec_init();
@@ -2572,6 +2580,7 @@ main(int argc, char **argv)
 	dmesh_init();			/* MUST be done BEFORE download_init() */
 	download_init();		/* MUST be done AFTER file_info_init() */
 	upload_init();
+	bh_upload_init();
 	shell_init();
 	ban_init();
 	whitelist_init();
@@ -2630,6 +2639,7 @@ main(int argc, char **argv)
 	http_test();
 	vxml_test();
 	g2_tree_test();
+	file_info_test();
 
 	if (OPT(topless))
 		gnet_prop_set_boolean_val(PROP_RUNNING_TOPLESS, TRUE);
@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) 2026, Raphael Manfredi
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup shell
+ * @file
+ *
+ * The "latency" command.
+ *
+ * @author Raphael Manfredi
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "cmd.h"
+
+#include "lib/ascii.h"
+#include "lib/latency.h"
+#include "lib/log.h"
+#include "lib/options.h"
+#include "lib/parse.h"
+
+#include "lib/override.h"		/* Must be the last header included */
+
+#define LATENCY_TOP_DEFAULT		20		/**< Default amount of sites shown */
+
+static enum shell_reply
+shell_exec_latency_show(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	const char *opt_a, *opt_n, *opt_s;
+	const option_t options[] = {
+		{ "a",  &opt_a },			/* show all sites */
+		{ "n:", &opt_n },			/* amount of sites to show */
+		{ "s:", &opt_s },			/* sorting criterion */
+	};
+	enum latency_sort how = LATENCY_SORT_TOTAL;
+	uint32 top = LATENCY_TOP_DEFAULT;
+	logagent_t *la;
+	int parsed;
+
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	parsed = shell_options_parse(sh, argv, options, N_ITEMS(options));
+	if (parsed < 0)
+		return REPLY_ERROR;
+
+	if (opt_n != NULL) {
+		int error;
+
+		top = parse_uint32(opt_n, NULL, 10, &error);
+		if (error != 0) {
+			shell_set_formatted(sh, "cannot parse -n: %s", g_strerror(error));
+			return REPLY_ERROR;
+		}
+	}
+
+	if (opt_a != NULL)
+		top = 0;
+
+	if (opt_s != NULL) {
+		if (0 == ascii_strcasecmp(opt_s, "total"))
+			how = LATENCY_SORT_TOTAL;
+		else if (0 == ascii_strcasecmp(opt_s, "max"))
+			how = LATENCY_SORT_MAX;
+		else if (0 == ascii_strcasecmp(opt_s, "count"))
+			how = LATENCY_SORT_COUNT;
+		else if (0 == ascii_strcasecmp(opt_s, "p99"))
+			how = LATENCY_SORT_P99;
+		else {
+			shell_set_formatted(sh, "Unknown sorting criterion \"%s\"", opt_s);
+			return REPLY_ERROR;
+		}
+	}
+
+	la = log_agent_string_make(0, NULL);
+	latency_dump_log(la, how, top);
+
+	shell_write(sh, "100~\n");
+	shell_write(sh, log_agent_string_get(la));
+	shell_write(sh, ".\n");
+
+	log_agent_free_null(&la);
+
+	return REPLY_READY;
+}
+
+static enum shell_reply
+shell_exec_latency_reset(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	latency_reset();
+	return REPLY_READY;
+}
+
+static enum shell_reply
+shell_exec_latency_on(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	latency_enable(TRUE);
+	return REPLY_READY;
+}
+
+static enum shell_reply
+shell_exec_latency_off(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	latency_enable(FALSE);
+	return REPLY_READY;
+}
+
+/**
+ * Handle the latency command.
+ */
+enum shell_reply
+shell_exec_latency(struct gnutella_shell *sh, int argc, const char *argv[])
+{
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	/*
+	 * The "show" string is optional.
+	 */
+
+	if (argc < 2 || '-' == *argv[1])
+		return shell_exec_latency_show(sh, argc, argv);
+
+#define CMD(name) G_STMT_START { \
+	if (0 == ascii_strcasecmp(argv[1], #name)) \
+		return shell_exec_latency_ ## name(sh, argc - 1, argv + 1); \
+} G_STMT_END
+
+	CMD(show);
+	CMD(reset);
+	CMD(on);
+	CMD(off);
+
+#undef CMD
+
+	shell_set_formatted(sh, _("Unknown operation \"%s\""), argv[1]);
+	return REPLY_ERROR;
+}
+
+const char *
+shell_summary_latency(void)
+{
+	return "Show event handler latency percentiles";
+}
+
+const char *
+shell_help_latency(int argc, const char *argv[])
+{
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	if (argc > 1) {
+		if (0 == ascii_strcasecmp(argv[1], "show")) {
+			return "latency [show] [-a] [-n count] [-s total|max|count|p99]\n"
+				"shows latency percentiles of the most offending handlers\n"
+				"since the last reset, in microseconds.\n"
+				"-a : show all the recorded sites.\n"
+				"-n : amount of sites to show (default is 20).\n"
+				"-s : sorting criterion (default is total).\n";
+		}
+		else if (0 == ascii_strcasecmp(argv[1], "reset")) {
+			return "latency reset\n"
+				"discards all the recorded latencies.\n";
+		}
+		else if (0 == ascii_strcasecmp(argv[1], "on")) {
+			return "latency on\n"
+				"turns latency tracking on (the default).\n";
+		}
+		else if (0 == ascii_strcasecmp(argv[1], "off")) {
+			return "latency off\n"
+				"turns latency tracking off.\n";
+		}
+	} else {
+		return
+			"latency [show] [-a] [-n count] [-s total|max|count|p99]\n"
+			"latency reset\n"
+			"latency on|off\n"
+			;
+	}
+	return NULL;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,434 @@
+/*
+ * Copyright (c) 2026, Raphael Manfredi
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup shell
+ * @file
+ *
+ * The "metrics" command.
+ *
+ * Exports the internal counters in the OpenMetrics text format, so that
+ * they can be scraped by monitoring tools without having to parse the
+ * human-oriented output of "stats" or "memory".
+ *
+ * The command runs in its own thread.  Data that is only safely accessible
+ * from the main thread (bandwidth schedulers, node queues) is snapshot via
+ * a quick RPC, then formatted and emitted family by family from the shell
+ * thread, so that the main loop is never blocked by the formatting.
+ *
+ * @author Raphael Manfredi
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "cmd.h"
+
+#include "core/bsched.h"
+#include "core/gnet_stats.h"
+#include "core/mq.h"
+#include "core/nodes.h"
+
+#include "lib/ascii.h"
+#include "lib/pslist.h"
+#include "lib/str.h"
+#include "lib/stringify.h"
+#include "lib/teq.h"
+#include "lib/vmm.h"
+#include "lib/xmalloc.h"
+#include "lib/zalloc.h"
+
+#include "lib/override.h"		/* Must be the last header included */
+
+#define METRICS_PREFIX	"gtkg_"
+
+/**
+ * Snapshot of a bandwidth scheduler, taken from the main thread.
+ */
+struct metrics_bws {
+	const char *name;
+	uint64 bps;
+	uint64 avg_bps;
+	uint64 limit;
+	bool saturated;
+};
+
+/**
+ * Snapshot of a node's TX message queue, taken from the main thread.
+ */
+struct metrics_mq {
+	char addr[HOST_ADDR_PORT_BUFLEN];
+	int size;
+	int maxsize;
+	int count;
+	mq_status_t status;
+};
+
+/**
+ * Main thread snapshot.
+ */
+struct metrics_snapshot {
+	struct metrics_bws bws[NUM_BSCHED_BWS];
+	struct metrics_mq *mq;
+	size_t mq_count;
+};
+
+static const char * const metrics_mq_status[] = {
+	"empty",		/* MQ_S_EMPTY */
+	"delay",		/* MQ_S_DELAY */
+	"warnzone",		/* MQ_S_WARNZONE */
+	"flowc",		/* MQ_S_FLOWC */
+	"swift",		/* MQ_S_SWIFT */
+};
+
+/**
+ * Collect data that can only be accessed from the main thread.
+ *
+ * This runs in the main thread and must therefore be quick: only raw values
+ * are copied, no formatting is done here.
+ */
+static void *
+metrics_snapshot_main(void *arg)
+{
+	struct metrics_snapshot *ms = arg;
+	const pslist_t *sl;
+	size_t n, i;
+
+	for (i = 0; i < N_ITEMS(ms->bws); i++) {
+		struct metrics_bws *b = &ms->bws[i];
+
+		b->name = bsched_name(i);
+		b->bps = bsched_bps(i);
+		b->avg_bps = bsched_avg_bps(i);
+		b->limit = bsched_bw_per_second(i);
+		b->saturated = bsched_saturated(i);
+	}
+
+	n = pslist_length(node_all_nodes());
+	XMALLOC0_ARRAY(ms->mq, n);
+
+	i = 0;
+	PSLIST_FOREACH(node_all_nodes(), sl) {
+		const gnutella_node_t *node = sl->data;
+		struct metrics_mq *m;
+
+		if (NULL == node->outq || !NODE_IS_CONNECTED(node))
+			continue;
+
+		g_assert(i < n);
+
+		m = &ms->mq[i++];
+		clamp_strcpy(ARYLEN(m->addr), node_gnet_addr(node));
+		m->size = mq_size(node->outq);
+		m->maxsize = mq_maxsize(node->outq);
+		m->count = mq_count(node->outq);
+		m->status = mq_status(node->outq);
+	}
+	ms->mq_count = i;
+
+	return NULL;
+}
+
+/**
+ * Append label value to string, escaped as mandated by OpenMetrics.
+ */
+static void
+metrics_label_cat(str_t *s, const char *value)
+{
+	const char *p;
+	char c;
+
+	for (p = value; '\0' != (c = *p); p++) {
+		switch (c) {
+		case '\\':	STR_CAT(s, "\\\\"); break;
+		case '"':	STR_CAT(s, "\\\""); break;
+		case '\n':	STR_CAT(s, "\\n"); break;
+		default:	str_putc(s, c); break;
+		}
+	}
+}
+
+/**
+ * Emit the "# TYPE" and "# HELP" lines for a metric family.
+ */
+static void
+metrics_family(str_t *s, const char *name, const char *type, const char *help)
+{
+	str_catf(s, "# TYPE " METRICS_PREFIX "%s %s\n", name, type);
+	str_catf(s, "# HELP " METRICS_PREFIX "%s %s\n", name, help);
+}
+
+/**
+ * Emit a single sample with one label.
+ */
+static void
+metrics_sample(str_t *s, const char *name, const char *label,
+	const char *value, uint64 v)
+{
+	str_catf(s, METRICS_PREFIX "%s", name);
+	if (label != NULL) {
+		str_catf(s, "{%s=\"", label);
+		metrics_label_cat(s, value);
+		STR_CAT(s, "\"}");
+	}
+	str_catf(s, " %s\n", uint64_to_string(v));
+}
+
+/**
+ * Flush formatted family to the shell and reset the string for the next one.
+ */
+static void
+metrics_flush(struct gnutella_shell *sh, str_t *s)
+{
+	shell_write(sh, str_2c(s));
+	str_reset(s);
+}
+
+static void
+metrics_emit_messages(struct gnutella_shell *sh, str_t *s,
+	const gnet_stats_t *gs)
+{
+	int i;
+
+#define MSG_FAMILY(field, help) G_STMT_START {					\
+	metrics_family(s, "messages_" #field, "counter", help);		\
+	for (i = 0; i < MSG_TYPE_COUNT - 1; i++) {					\
+		metrics_sample(s, "messages_" #field "_total", "type",	\
+			gnet_msg_type_name(i), gs->pkg.field[i]);			\
+	}															\
+	metrics_flush(sh, s);										\
+} G_STMT_END
+
+#define BYTE_FAMILY(field, help) G_STMT_START {					\
+	metrics_family(s, "message_bytes_" #field, "counter", help);\
+	for (i = 0; i < MSG_TYPE_COUNT - 1; i++) {					\
+		metrics_sample(s, "message_bytes_" #field "_total", "type",	\
+			gnet_msg_type_name(i), gs->byte.field[i]);			\
+	}															\
+	metrics_flush(sh, s);										\
+} G_STMT_END
+
+	MSG_FAMILY(received,	"Messages received, per type.");
+	MSG_FAMILY(generated,	"Messages generated locally, per type.");
+	MSG_FAMILY(relayed,		"Messages relayed, per type.");
+	MSG_FAMILY(dropped,		"Messages dropped, per type.");
+	MSG_FAMILY(expired,		"Messages expired, per type.");
+	MSG_FAMILY(queued,		"Messages queued for sending, per type.");
+	BYTE_FAMILY(received,	"Message bytes received, per type.");
+	BYTE_FAMILY(relayed,	"Message bytes relayed, per type.");
+	BYTE_FAMILY(dropped,	"Message bytes dropped, per type.");
+
+#undef MSG_FAMILY
+#undef BYTE_FAMILY
+
+	metrics_family(s, "messages_dropped_reason", "counter",
+		"Messages dropped, per reason.");
+	for (i = 0; i < MSG_DROP_REASON_COUNT; i++) {
+		metrics_sample(s, "messages_dropped_reason_total", "reason",
+			gnet_stats_drop_reason_name(i), gs->drop_reason[i][MSG_TOTAL]);
+	}
+	metrics_flush(sh, s);
+
+	metrics_family(s, "general", "unknown",
+		"General statistics counters, as shown by \"stats\".");
+	for (i = 0; i < GNR_TYPE_COUNT; i++) {
+		metrics_sample(s, "general", "name",
+			gnet_stats_general_to_string(i), gs->general[i]);
+	}
+	metrics_flush(sh, s);
+
+	metrics_family(s, "dht_routing", "gauge", "DHT routing table counts.");
+	for (i = GNR_DHT_ROUTING_BUCKETS; i <= GNR_DHT_ROUTING_PENDING_NODES; i++) {
+		metrics_sample(s, "dht_routing", "name",
+			gnet_stats_general_to_string(i), gs->general[i]);
+	}
+	metrics_flush(sh, s);
+}
+
+static void
+metrics_emit_bws(struct gnutella_shell *sh, str_t *s,
+	const struct metrics_snapshot *ms)
+{
+	size_t i;
+
+#define BWS_FAMILY(field, family, help) G_STMT_START {			\
+	metrics_family(s, family, "gauge", help);					\
+	for (i = 0; i < N_ITEMS(ms->bws); i++) {					\
+		metrics_sample(s, family, "scheduler",					\
+			ms->bws[i].name, ms->bws[i].field);					\
+	}															\
+	metrics_flush(sh, s);										\
+} G_STMT_END
+
+	BWS_FAMILY(bps,			"bsched_bytes_per_second",
+		"Bandwidth used during last scheduling period.");
+	BWS_FAMILY(avg_bps,		"bsched_avg_bytes_per_second",
+		"Average bandwidth used by scheduler.");
+	BWS_FAMILY(limit,		"bsched_limit_bytes_per_second",
+		"Bandwidth allotted to scheduler per second.");
+	BWS_FAMILY(saturated,	"bsched_saturated",
+		"Whether scheduler used more than its allotted bandwidth.");
+
+#undef BWS_FAMILY
+}
+
+static void
+metrics_emit_mq(struct gnutella_shell *sh, str_t *s,
+	const struct metrics_snapshot *ms)
+{
+	size_t i, j;
+	uint64 states[N_ITEMS(metrics_mq_status)];
+
+#define MQ_FAMILY(field, family, help) G_STMT_START {			\
+	metrics_family(s, family, "gauge", help);					\
+	for (i = 0; i < ms->mq_count; i++) {						\
+		metrics_sample(s, family, "node",						\
+			ms->mq[i].addr, ms->mq[i].field);					\
+	}															\
+	metrics_flush(sh, s);										\
+} G_STMT_END
+
+	MQ_FAMILY(size,		"mq_bytes",			"Bytes held in node TX queue.");
+	MQ_FAMILY(count,	"mq_messages",		"Messages held in node TX queue.");
+	MQ_FAMILY(maxsize,	"mq_max_bytes",		"Maximum size of node TX queue.");
+
+#undef MQ_FAMILY
+
+	metrics_family(s, "mq_state", "stateset",
+		"Flow-control state of node TX queue.");
+	for (i = 0; i < ms->mq_count; i++) {
+		for (j = 0; j < N_ITEMS(metrics_mq_status); j++) {
+			str_catf(s, METRICS_PREFIX "mq_state{node=\"");
+			metrics_label_cat(s, ms->mq[i].addr);
+			str_catf(s, "\"," METRICS_PREFIX "mq_state=\"%s\"} %d\n",
+				metrics_mq_status[j], j == UNSIGNED(ms->mq[i].status));
+		}
+	}
+	metrics_flush(sh, s);
+
+	ZERO(&states);
+	for (i = 0; i < ms->mq_count; i++) {
+		unsigned status = ms->mq[i].status;
+		if (status < N_ITEMS(states))
+			states[status]++;
+	}
+
+	metrics_family(s, "mq_queues", "gauge",
+		"Amount of node TX queues in each flow-control state.");
+	for (j = 0; j < N_ITEMS(metrics_mq_status); j++) {
+		metrics_sample(s, "mq_queues", "state",
+			metrics_mq_status[j], states[j]);
+	}
+	metrics_flush(sh, s);
+}
+
+static void
+metrics_emit_memory(struct gnutella_shell *sh, str_t *s)
+{
+	size_t user, blocks, core;
+
+	metrics_family(s, "memory_bytes", "gauge",
+		"Memory currently allocated, per allocator.");
+	vmm_memory_usage(&user, NULL, &core);
+	metrics_sample(s, "memory_bytes", "allocator", "vmm_user", user);
+	metrics_sample(s, "memory_bytes", "allocator", "vmm_core", core);
+	xmalloc_memory_usage(&user, NULL);
+	metrics_sample(s, "memory_bytes", "allocator", "xmalloc", user);
+	zalloc_memory_usage(&user, NULL);
+	metrics_sample(s, "memory_bytes", "allocator", "zalloc", user);
+	metrics_flush(sh, s);
+
+	metrics_family(s, "memory_blocks", "gauge",
+		"Memory blocks currently allocated, per allocator.");
+	vmm_memory_usage(NULL, &blocks, NULL);
+	metrics_sample(s, "memory_blocks", "allocator", "vmm_user", blocks);
+	xmalloc_memory_usage(NULL, &blocks);
+	metrics_sample(s, "memory_blocks", "allocator", "xmalloc", blocks);
+	zalloc_memory_usage(NULL, &blocks);
+	metrics_sample(s, "memory_blocks", "allocator", "zalloc", blocks);
+	metrics_flush(sh, s);
+}
+
+/**
+ * Handle the metrics command.
+ */
+enum shell_reply
+shell_exec_metrics(struct gnutella_shell *sh, int argc, const char *argv[])
+{
+	struct metrics_snapshot *ms;
+	gnet_stats_t *gs;
+	str_t *s;
+
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	/*
+	 * Large structures are allocated on the heap since this command runs
+	 * in a thread with a small stack.
+	 */
+
+	XMALLOC0(ms);
+	XMALLOC(gs);
+
+	gnet_stats_get(gs);
+	(void) teq_rpc(THREAD_MAIN_ID, metrics_snapshot_main, ms);
+
+	s = str_new(4096);
+
+	shell_write(sh, "100~\n");
+
+	metrics_emit_messages(sh, s, gs);
+	metrics_emit_bws(sh, s, ms);
+	metrics_emit_mq(sh, s, ms);
+	metrics_emit_memory(sh, s);
+
+	shell_write(sh, "# EOF\n");
+	shell_write(sh, ".\n");
+
+	str_destroy_null(&s);
+	XFREE_NULL(ms->mq);
+	XFREE_NULL(ms);
+	XFREE_NULL(gs);
+
+	return REPLY_READY;
+}
+
+const char *
+shell_summary_metrics(void)
+{
+	return "Export statistics in OpenMetrics format";
+}
+
+const char *
+shell_help_metrics(int argc, const char *argv[])
+{
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	return "metrics\n"
+		"dumps message counters, bandwidth schedulers, node queues and\n"
+		"memory usage in the OpenMetrics text exposition format.\n";
+}
+
+/* vi: set ts=4 sw=4 cindent: */
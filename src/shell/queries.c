@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2026, Raphael Manfredi
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup shell
+ * @file
+ *
+ * The "queries" command.
+ *
+ * @author Raphael Manfredi
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "cmd.h"
+
+#include "core/search.h"
+
+#include "lib/ascii.h"
+#include "lib/log.h"
+#include "lib/options.h"
+#include "lib/parse.h"
+
+#include "lib/override.h"		/* Must be the last header included */
+
+#define QUERIES_TOP_DEFAULT		20		/**< Default amount of entries shown */
+
+static enum shell_reply
+shell_exec_queries_show(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	const char *opt_a, *opt_n, *opt_s;
+	const option_t options[] = {
+		{ "a",  &opt_a },			/* show all tracked entries */
+		{ "n:", &opt_n },			/* amount of entries to show */
+		{ "s",  &opt_s },			/* show sources instead of queries */
+	};
+	uint32 top = QUERIES_TOP_DEFAULT;
+	logagent_t *la;
+	int parsed;
+
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	parsed = shell_options_parse(sh, argv, options, N_ITEMS(options));
+	if (parsed < 0)
+		return REPLY_ERROR;
+
+	if (opt_n != NULL) {
+		int error;
+
+		top = parse_uint32(opt_n, NULL, 10, &error);
+		if (error != 0) {
+			shell_set_formatted(sh, "cannot parse -n: %s", g_strerror(error));
+			return REPLY_ERROR;
+		}
+	}
+
+	if (opt_a != NULL)
+		top = 0;
+
+	la = log_agent_string_make(0, NULL);
+	search_top_dump_log(la, opt_s != NULL, top);
+
+	shell_write(sh, "100~\n");
+	shell_write(sh, log_agent_string_get(la));
+	shell_write(sh, ".\n");
+
+	log_agent_free_null(&la);
+
+	return REPLY_READY;
+}
+
+static enum shell_reply
+shell_exec_queries_reset(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	search_top_reset();
+	return REPLY_READY;
+}
+
+/**
+ * Handle the queries command.
+ */
+enum shell_reply
+shell_exec_queries(struct gnutella_shell *sh, int argc, const char *argv[])
+{
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	/*
+	 * The "show" string is optional.
+	 */
+
+	if (argc < 2 || '-' == *argv[1])
+		return shell_exec_queries_show(sh, argc, argv);
+
+#define CMD(name) G_STMT_START { \
+	if (0 == ascii_strcasecmp(argv[1], #name)) \
+		return shell_exec_queries_ ## name(sh, argc - 1, argv + 1); \
+} G_STMT_END
+
+	CMD(show);
+	CMD(reset);
+
+#undef CMD
+
+	shell_set_formatted(sh, _("Unknown operation \"%s\""), argv[1]);
+	return REPLY_ERROR;
+}
+
+const char *
+shell_summary_queries(void)
+{
+	return "Show most frequent incoming queries";
+}
+
+const char *
+shell_help_queries(int argc, const char *argv[])
+{
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	if (argc > 1) {
+		if (0 == ascii_strcasecmp(argv[1], "show")) {
+			return "queries [show] [-a] [-n count] [-s]\n"
+				"shows the most frequent queries received since the last\n"
+				"reset, along with the maximum over-estimation of counts.\n"
+				"-a : show all the tracked entries.\n"
+				"-n : amount of entries to show (default is 20).\n"
+				"-s : show hosts sending most queries instead.\n";
+		}
+		else if (0 == ascii_strcasecmp(argv[1], "reset")) {
+			return "queries reset\n"
+				"discards all the recorded queries.\n";
+		}
+	} else {
+		return
+			"queries [show] [-a] [-n count] [-s]\n"
+			"queries reset\n"
+			;
+	}
+	return NULL;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,207 @@
+/*
+ * Copyright (c) 2026, Raphael Manfredi
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup shell
+ * @file
+ *
+ * The "replay" command.
+ *
+ * @author Raphael Manfredi
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "cmd.h"
+
+#include "core/replay.h"
+
+#include "lib/ascii.h"
+#include "lib/log.h"
+#include "lib/options.h"
+#include "lib/parse.h"
+
+#include "lib/override.h"		/* Must be the last header included */
+
+static enum shell_reply
+shell_exec_replay_start(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	const char *opt_r;
+	const option_t options[] = {
+		{ "r:", &opt_r },			/* replay rate */
+	};
+	const char *error;
+	uint32 rate = 0;
+	int parsed;
+
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	parsed = shell_options_parse(sh, argv, options, N_ITEMS(options));
+	if (parsed < 0)
+		return REPLY_ERROR;
+
+	argv += parsed;		/* args[0] is first command argument */
+	argc -= parsed;		/* counts only command arguments now */
+
+	if (argc < 1) {
+		shell_set_msg(sh, _("Missing dump file argument"));
+		return REPLY_ERROR;
+	}
+
+	if (opt_r != NULL) {
+		int err;
+
+		rate = parse_uint32(opt_r, NULL, 10, &err);
+		if (err != 0) {
+			shell_set_formatted(sh, "cannot parse -r: %s", g_strerror(err));
+			return REPLY_ERROR;
+		}
+	}
+
+	error = replay_start(argv[0], rate);
+	if (error != NULL) {
+		shell_set_formatted(sh, "cannot replay \"%s\": %s", argv[0], error);
+		return REPLY_ERROR;
+	}
+
+	shell_set_msg(sh, _("Replay started"));
+	return REPLY_READY;
+}
+
+static enum shell_reply
+shell_exec_replay_stop(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	if (!replay_stop()) {
+		shell_set_msg(sh, _("No replay in progress"));
+		return REPLY_ERROR;
+	}
+
+	shell_set_msg(sh, _("Replay stopped"));
+	return REPLY_READY;
+}
+
+static enum shell_reply
+shell_exec_replay_status(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	logagent_t *la;
+
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	la = log_agent_string_make(0, NULL);
+	replay_dump_log(la);
+
+	shell_write(sh, "100~\n");
+	shell_write(sh, log_agent_string_get(la));
+	shell_write(sh, ".\n");
+
+	log_agent_free_null(&la);
+
+	return REPLY_READY;
+}
+
+/**
+ * Handle the replay command.
+ */
+enum shell_reply
+shell_exec_replay(struct gnutella_shell *sh, int argc, const char *argv[])
+{
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	/*
+	 * The "status" string is optional.
+	 */
+
+	if (argc < 2)
+		return shell_exec_replay_status(sh, argc, argv);
+
+#define CMD(name) G_STMT_START { \
+	if (0 == ascii_strcasecmp(argv[1], #name)) \
+		return shell_exec_replay_ ## name(sh, argc - 1, argv + 1); \
+} G_STMT_END
+
+	CMD(start);
+	CMD(stop);
+	CMD(status);
+
+#undef CMD
+
+	shell_set_formatted(sh, _("Unknown operation \"%s\""), argv[1]);
+	return REPLY_ERROR;
+}
+
+const char *
+shell_summary_replay(void)
+{
+	return "Replay Gnutella traffic dumps offline";
+}
+
+const char *
+shell_help_replay(int argc, const char *argv[])
+{
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	if (argc > 1) {
+		if (0 == ascii_strcasecmp(argv[1], "start")) {
+			return "replay start [-r rate] file\n"
+				"replays the messages received in the traffic dump file\n"
+				"through the message processing pipeline.\n"
+				"The servent must be offline.\n"
+				"-r : replay rate in messages per second (default is 0,\n"
+				"     meaning as fast as possible).\n";
+		}
+		else if (0 == ascii_strcasecmp(argv[1], "stop")) {
+			return "replay stop\n"
+				"stops the replay in progress.\n";
+		}
+		else if (0 == ascii_strcasecmp(argv[1], "status")) {
+			return "replay [status]\n"
+				"shows statistics about the current or last replay:\n"
+				"message rate, CPU time, and per-message processing time\n"
+				"and memory allocations.\n";
+		}
+	} else {
+		return
+			"replay [status]\n"
+			"replay start [-r rate] file\n"
+			"replay stop\n"
+			;
+	}
+	return NULL;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -10714,7 +10714,6 @@ create_dlg_prefs (void)
   GtkWidget *checkbutton_gnet_compact_query;
   GtkObject *spinbutton_config_hops_random_factor_adj;
   GtkWidget *spinbutton_config_hops_random_factor;
-  GtkWidget *checkbutton_config_spam_lut_in_memory;
   GtkWidget *frame_expert_gnet_message_size;
   GtkWidget *table69;
   GtkWidget *label569;
@@ -13735,16 +13734,6 @@ create_dlg_prefs (void)
                     (GtkAttachOptions) (0), 0, 0);
   gtk_spin_button_set_numeric (GTK_SPIN_BUTTON (spinbutton_config_hops_random_factor), TRUE);
 
-  checkbutton_config_spam_lut_in_memory = gtk_check_button_new_with_label (_("Store SPAM SHA1 table in memory"));
-  gtk_widget_set_name (checkbutton_config_spam_lut_in_memory, "checkbutton_config_spam_lut_in_memory");
-  gtk_widget_ref (checkbutton_config_spam_lut_in_memory);
-  gtk_object_set_data_full (GTK_OBJECT (dlg_prefs), "checkbutton_config_spam_lut_in_memory", checkbutton_config_spam_lut_in_memory,
-                            (GtkDestroyNotify) gtk_widget_unref);
-  gtk_widget_show (checkbutton_config_spam_lut_in_memory);
-  gtk_table_attach (GTK_TABLE (table33), checkbutton_config_spam_lut_in_memory, 0, 2, 2, 3,
-                    (GtkAttachOptions) (GTK_FILL),
-                    (GtkAttachOptions) (0), 0, 0);
-
   frame_expert_gnet_message_size = gtk_frame_new (_("Gnutella message size limits"));
   gtk_widget_set_name (frame_expert_gnet_message_size, "frame_expert_gnet_message_size");
   gtk_widget_ref (frame_expert_gnet_message_size);
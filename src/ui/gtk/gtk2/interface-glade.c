@@ -4882,9 +4882,6 @@ create_main_window_search_stats_tab (void)
   GtkWidget *label101;
   GtkObject *spinbutton_search_stats_update_interval_adj;
   GtkWidget *spinbutton_search_stats_update_interval;
-  GtkWidget *label102;
-  GtkObject *spinbutton_search_stats_delcoef_adj;
-  GtkWidget *spinbutton_search_stats_delcoef;
   GtkWidget *scrolledwindow66;
   GtkWidget *treeview_search_stats;
   GtkWidget *hbox66;
@@ -4926,18 +4923,6 @@ create_main_window_search_stats_tab (void)
   gtk_widget_show (spinbutton_search_stats_update_interval);
   gtk_box_pack_start (GTK_BOX (hbox67), spinbutton_search_stats_update_interval, FALSE, FALSE, 0);
 
-  label102 = gtk_label_new_with_mnemonic (_("_Deletion coeff. (0-100)"));
-  gtk_widget_set_name (label102, "label102");
-  gtk_widget_show (label102);
-  gtk_box_pack_start (GTK_BOX (hbox67), label102, FALSE, FALSE, 0);
-  gtk_label_set_justify (GTK_LABEL (label102), GTK_JUSTIFY_RIGHT);
-
-  spinbutton_search_stats_delcoef_adj = gtk_adjustment_new (1, 0, 100, 1, 10, 0);
-  spinbutton_search_stats_delcoef = gtk_spin_button_new (GTK_ADJUSTMENT (spinbutton_search_stats_delcoef_adj), 1, 0);
-  gtk_widget_set_name (spinbutton_search_stats_delcoef, "spinbutton_search_stats_delcoef");
-  gtk_widget_show (spinbutton_search_stats_delcoef);
-  gtk_box_pack_end (GTK_BOX (hbox67), spinbutton_search_stats_delcoef, FALSE, FALSE, 0);
-
   scrolledwindow66 = gtk_scrolled_window_new (NULL, NULL);
   gtk_widget_set_name (scrolledwindow66, "scrolledwindow66");
   gtk_widget_show (scrolledwindow66);
@@ -5009,8 +4994,6 @@ create_main_window_search_stats_tab (void)
   GLADE_HOOKUP_OBJECT (main_window_search_stats_tab, option_menu_search_stats_type, "option_menu_search_stats_type");
   GLADE_HOOKUP_OBJECT (main_window_search_stats_tab, label101, "label101");
   GLADE_HOOKUP_OBJECT (main_window_search_stats_tab, spinbutton_search_stats_update_interval, "spinbutton_search_stats_update_interval");
-  GLADE_HOOKUP_OBJECT (main_window_search_stats_tab, label102, "label102");
-  GLADE_HOOKUP_OBJECT (main_window_search_stats_tab, spinbutton_search_stats_delcoef, "spinbutton_search_stats_delcoef");
   GLADE_HOOKUP_OBJECT (main_window_search_stats_tab, scrolledwindow66, "scrolledwindow66");
   GLADE_HOOKUP_OBJECT (main_window_search_stats_tab, treeview_search_stats, "treeview_search_stats");
   GLADE_HOOKUP_OBJECT (main_window_search_stats_tab, hbox66, "hbox66");
@@ -10471,7 +10454,6 @@ create_dlg_prefs_gnet_tab (void)
   GtkWidget *spinbutton_config_hops_random_factor;
   GtkWidget *label518;
   GtkWidget *checkbutton_gnet_compact_query;
-  GtkWidget *checkbutton_config_spam_lut_in_memory;
   GtkWidget *label362;
   GtkWidget *frame_expert_gnet_message_size;
   GtkWidget *table85;
@@ -11720,13 +11702,6 @@ create_dlg_prefs_gnet_tab (void)
                     (GtkAttachOptions) (GTK_FILL),
                     (GtkAttachOptions) (0), 4, 0);
 
-  checkbutton_config_spam_lut_in_memory = gtk_check_button_new_with_mnemonic (_("Store SPAM SHA1 table in memory"));
-  gtk_widget_set_name (checkbutton_config_spam_lut_in_memory, "checkbutton_config_spam_lut_in_memory");
-  gtk_widget_show (checkbutton_config_spam_lut_in_memory);
-  gtk_table_attach (GTK_TABLE (table51), checkbutton_config_spam_lut_in_memory, 0, 2, 2, 3,
-                    (GtkAttachOptions) (GTK_FILL),
-                    (GtkAttachOptions) (0), 4, 0);
-
   label362 = gtk_label_new (_("Other"));
   gtk_widget_set_name (label362, "label362");
   gtk_widget_show (label362);
@@ -12028,7 +12003,6 @@ create_dlg_prefs_gnet_tab (void)
   GLADE_HOOKUP_OBJECT (dlg_prefs_gnet_tab, spinbutton_config_hops_random_factor, "spinbutton_config_hops_random_factor");
   GLADE_HOOKUP_OBJECT (dlg_prefs_gnet_tab, label518, "label518");
   GLADE_HOOKUP_OBJECT (dlg_prefs_gnet_tab, checkbutton_gnet_compact_query, "checkbutton_gnet_compact_query");
-  GLADE_HOOKUP_OBJECT (dlg_prefs_gnet_tab, checkbutton_config_spam_lut_in_memory, "checkbutton_config_spam_lut_in_memory");
   GLADE_HOOKUP_OBJECT (dlg_prefs_gnet_tab, label362, "label362");
   GLADE_HOOKUP_OBJECT (dlg_prefs_gnet_tab, frame_expert_gnet_message_size, "frame_expert_gnet_message_size");
   GLADE_HOOKUP_OBJECT (dlg_prefs_gnet_tab, table85, "table85");
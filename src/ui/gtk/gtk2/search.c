@@ -35,6 +35,7 @@
 #include "gtk/gui.h"
 
 #include "search_cb.h"
+#include "search_model.h"
 
 #include "gtk/columns.h"
 #include "gtk/drag.h"
@@ -74,24 +75,31 @@ static struct sorting_context search_list_sort;
 /** For cyclic updates of the tooltip. */
 static tree_view_motion_t *tvm_search;
 
+/** Maximum amount of queued records inserted in the view at each flush */
+#define SEARCH_GUI_FLUSH_MAX	500
+
 struct result_data {
-	GtkTreeIter iter;
+	search_model_row_t row;	/**< Must be first: row in the search model */
 
 	record_t *record;
-	guint children;		/**< count of children */
 	gnet_search_t sh;	/**< Search handle */
 	enum gui_color color;
 };
 
+static inline struct result_data *
+result_data_from_row(search_model_row_t *row)
+{
+	STATIC_ASSERT(0 == offsetof(struct result_data, row));
+
+	return (struct result_data *) row;
+}
+
 static inline struct result_data *
 get_result_data(GtkTreeModel *model, GtkTreeIter *iter)
 {
-	static const GValue zero_value;
-	GValue value = zero_value;
 	struct result_data *rd;
 
-	gtk_tree_model_get_value(model, iter, 0, &value);
-	rd = g_value_get_pointer(&value);
+	rd = result_data_from_row(search_model_iter_row(model, iter));
 	record_check(rd->record);
 	g_assert(rd->record->refcount > 0);
 	return rd;
@@ -103,27 +111,11 @@ search_gui_get_record(GtkTreeModel *model, GtkTreeIter *iter)
 	return get_result_data(model, iter)->record;
 }
 
-void
-search_gui_set_data(GtkTreeModel *model, struct result_data *rd)
-{
-	static const GValue zero_value;
-	GValue value = zero_value;
-
-	g_value_init(&value, G_TYPE_POINTER);
-	g_value_set_pointer(&value, rd);
-	gtk_tree_store_set_value(GTK_TREE_STORE(model), &rd->iter, 0, &value);
-}
-
 /* Refresh the display/sorting */
 static inline void
 search_gui_data_changed(GtkTreeModel *model, struct result_data *rd)
 {
-#if 0
-	/* THIS DOES NOT KEEP THE ROWS IN ORDER */
-	tree_model_iter_changed(model, &rd->iter);
-#else
-	search_gui_set_data(model, rd);
-#endif
+	search_model_row_changed(model, &rd->row);
 }
 
 struct synchronize_search_list {
@@ -214,7 +206,8 @@ cell_renderer(GtkTreeViewColumn *column, GtkCellRenderer *cell,
 		text = compact_size(data->record->size, show_metric_units());
 		break;
 	case c_sr_count:
-		text = data->children ? uint32_to_string(1 + data->children) : NULL;
+		text = data->row.children ?
+			uint32_to_string(1 + data->row.children) : NULL;
 		break;
 	case c_sr_loc:
 		if (ISO3166_INVALID != rs->country)
@@ -394,33 +387,21 @@ result_data_free(search_t *search, struct result_data *rd)
 	WFREE(rd);
 }
 
-static gboolean
-prepare_remove_record(GtkTreeModel *model, GtkTreePath *unused_path,
-	GtkTreeIter *iter, gpointer udata)
+/**
+ * Search model callback invoked on each row when the results are cleared.
+ */
+static void
+search_gui_clear_row(search_model_row_t *row, void *udata)
 {
-	struct result_data *rd;
-	record_t *rc;
-	search_t *search;
+	struct result_data *rd = result_data_from_row(row);
+	search_t *search = udata;
 
-	(void) unused_path;
+	record_check(rd->record);
 
-	search = udata;
-	rd = get_result_data(model, iter);
-	rc = rd->record;
+	if (rd->record->sha1 && NULL == rd->row.parent)
+		htable_remove(search->parents, rd);
 
-	if (rc->sha1) {
-		struct result_data *parent;
-
-		parent = find_parent(search, rd);
-		if (rd == parent) {
-			htable_remove(search->parents, rd);
-		} else if (parent) {
-			parent->children--;
-			search_gui_set_data(model, parent);
-		}
-	}
 	result_data_free(search, rd);
-	return FALSE;
 }
 
 static void
@@ -453,8 +434,7 @@ search_gui_clear_tree(search_t *search)
 	stopped = search_gui_start_massive_update(search);
 
 	model = gtk_tree_view_get_model(GTK_TREE_VIEW(search->tree));
-	gtk_tree_model_foreach(model, prepare_remove_record, search);
-	gtk_tree_store_clear(GTK_TREE_STORE(model));
+	search_model_clear(model, search_gui_clear_row, search);
 
 	if (stopped)
 		search_gui_end_massive_update(search);
@@ -475,19 +455,6 @@ search_gui_clear_search(search_t *search)
 	g_assert(0 == htable_count(search->parents));
 }
 
-static gboolean
-search_gui_is_sorted(struct search *search)
-{
-	GtkTreeModel *model;
-	GtkTreeSortable *sortable;
-
-	g_return_val_if_fail(search, FALSE);
-
-	model = gtk_tree_view_get_model(GTK_TREE_VIEW(search->tree));
-	sortable = GTK_TREE_SORTABLE(model);
-	return gtk_tree_sortable_get_sort_column_id(sortable, NULL, NULL);
-}
-
 static void
 search_gui_disable_sort(struct search *search)
 {
@@ -641,7 +608,7 @@ search_gui_cmp_size(const struct result_data *a, const struct result_data *b)
 static int
 search_gui_cmp_count(const struct result_data *a, const struct result_data *b)
 {
-	return SEARCH_GUI_CMP(a, b, children);
+	return SEARCH_GUI_CMP(a, b, row.children);
 }
 
 static int
@@ -860,53 +827,40 @@ static void
 remove_selected_file(void *iter_ptr, void *search_ptr)
 {
 	GtkTreeModel *model;
-	GtkTreeIter *iter;
-	GtkTreeIter child;
+	search_model_row_t *heir;
 	struct result_data *rd;
 	struct search *search;
 	record_t *rc;
+	bool parent;
 
 	search = search_ptr;
-	iter = iter_ptr;
 	model = gtk_tree_view_get_model(GTK_TREE_VIEW(search->tree));
 
 	g_assert(search->items > 0);
 	search->items--;
 
-	rd = get_result_data(model, iter);
+	rd = get_result_data(model, iter_ptr);
 	rc = rd->record;
 
 	/* First get the record, it must be unreferenced at the end */
 	g_assert(rc->refcount > 1);
 
-	if (gtk_tree_model_iter_nth_child(model, &child, iter, 0)) {
-		struct result_data *child_data, tmp;
-		guint children;
-
-		child_data = get_result_data(model, &child);
-
-		/*
-		 * Copy the contents of the first child's row into the parent's row
-		 */
-
-		children = rd->children;
-		tmp = *rd;
-		*rd = *child_data;
-		*child_data = tmp;
+	/*
+	 * When removing the parent of a group, the model promotes its first
+	 * child, which becomes the new parent for the SHA1.
+	 */
 
-		rd->iter = *iter;
-		rd->children = children;
+	parent = NULL != rc->sha1 && NULL == rd->row.parent;
+	heir = search_model_remove(model, &rd->row);
 
-		/* And remove the child's row */
-		iter = &child;
-	} else {
-		/*
-		 * The row has no children, it's either a child or a top-level node
-		 * without children.
-		 */
+	if (parent) {
+		htable_remove(search->parents, rd);
+		if (heir != NULL) {
+			struct result_data *hd = result_data_from_row(heir);
+			htable_insert(search->parents, hd, hd);
+		}
 	}
-	prepare_remove_record(model, NULL, iter, search);
-	gtk_tree_store_remove(GTK_TREE_STORE(model), iter);
+	result_data_free(search, rd);
 	w_tree_iter_free(iter_ptr);
 }
 
@@ -1253,10 +1207,7 @@ search_gui_show_search(struct search *search)
 static GtkTreeModel *
 create_results_model(void)
 {
-	GtkTreeStore *store;
-
-	store = gtk_tree_store_new(1, G_TYPE_POINTER);
-	return GTK_TREE_MODEL(store);
+	return search_model_new();
 }
 
 static void
@@ -1388,10 +1339,15 @@ search_gui_start_massive_update(struct search *search)
 	if (search->frozen)
 		return FALSE;
 
+	/*
+	 * Sorting is left enabled: the search model merges each batch of new
+	 * rows into the already sorted ones, whereas turning sorting back on
+	 * would sort all the rows again.
+	 */
+
 	model = gtk_tree_view_get_model(GTK_TREE_VIEW(search->tree));
 	g_object_freeze_notify(G_OBJECT(search->tree));
 	g_object_freeze_notify(G_OBJECT(model));
-	search_gui_disable_sort(search);
 	search->frozen = TRUE;
 
 	return TRUE;
@@ -1535,62 +1491,59 @@ GSList *
 search_gui_record_get_children(search_t *search, record_t *record)
 {
 	struct result_data *parent;
-	GtkTreeModel *model;
-	GtkTreeIter iter;
 	GSList *children;
 
 	g_return_val_if_fail(search, NULL);
 	g_return_val_if_fail(record, NULL);
 	record_check(record);
 
-	model = gtk_tree_view_get_model(GTK_TREE_VIEW(search->tree));
-	g_return_val_if_fail(model, NULL);
-
 	children = NULL;
 	parent = find_parent2(search, record->sha1, record->size);
 
-	if (
-		parent->record == record &&
-		gtk_tree_model_iter_children(model, &iter, &parent->iter)
-	) {
-		do {
-			children = g_slist_prepend(children,
-							search_gui_get_record(model, &iter));
-		} while (gtk_tree_model_iter_next(model, &iter));
+	if (parent != NULL && parent->record == record) {
+		uint i = parent->row.children;
+
+		while (i-- != 0) {
+			struct result_data *rd = result_data_from_row(parent->row.child[i]);
+			children = g_slist_prepend(children, rd->record);
+		}
 	}
-	return g_slist_reverse(children);
+	return children;
 }
 
+/**
+ * Attach a queued record to the parent row of its SHA1, if any, before
+ * it gets inserted in the model.
+ */
 static void
-search_gui_flush_queue_data(search_t *search, GtkTreeModel *model,
-	struct result_data *rd)
+search_gui_flush_queue_data(search_t *search, struct result_data *rd)
 {
-	GtkTreeIter *parent_iter;
 	record_t *rc;
 
 	rc = rd->record;
 	record_check(rc);
 
+	rd->row.parent = NULL;
+
 	if (rc->sha1) {
 		struct result_data *parent;
 
 		parent = find_parent(search, rd);
-		parent_iter = parent ? &parent->iter : NULL;
 		if (parent) {
 			record_check(parent->record);
-			parent->children++;
-			search_gui_data_changed(model, parent);
+			rd->row.parent = &parent->row;
 		} else {
 			htable_insert(search->parents, rd, rd);
 		}
-	} else {
-		parent_iter = NULL;
 	}
-
-	gtk_tree_store_append(GTK_TREE_STORE(model), &rd->iter, parent_iter);
-	search_gui_set_data(model, rd);
 }
 
+/**
+ * Insert the next batch of queued records into the view.
+ *
+ * The whole batch is handed to the model at once, which merges it into
+ * the already sorted rows instead of resorting everything.
+ */
 static void
 search_gui_flush_queue(search_t *search)
 {
@@ -1598,22 +1551,22 @@ search_gui_flush_queue(search_t *search)
 	g_return_if_fail(search->tree);
 
 	if (slist_length(search->queue) > 0) {
+		search_model_row_t *rows[SEARCH_GUI_FLUSH_MAX];
 		GtkTreeModel *model;
-		guint max_items;
 		struct result_data *data;
-		bool stopped;
-
-		stopped = search_gui_start_massive_update(search);
+		size_t n = 0;
 
 		model = gtk_tree_view_get_model(GTK_TREE_VIEW(search->tree));
-		max_items = search_gui_is_sorted(search) ? 100 : 500;
 
-		while (max_items-- > 0 && NULL != (data = slist_shift(search->queue))) {
-			search_gui_flush_queue_data(search, model, data);
+		while (n < N_ITEMS(rows)) {
+			data = slist_shift(search->queue);
+			if (NULL == data)
+				break;
+			search_gui_flush_queue_data(search, data);
+			rows[n++] = &data->row;
 		}
 
-		if (stopped)
-			search_gui_end_massive_update(search);
+		search_model_insert(model, rows, n);
 	}
 }
 
@@ -0,0 +1,999 @@
+/*
+ * Copyright (c) 2026, Raphael Manfredi
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup gtk
+ * @file
+ *
+ * Search results tree model.
+ *
+ * This is a two-level GtkTreeModel dedicated to search results: top-level
+ * rows are either records without a SHA1 or the first record seen for a
+ * given SHA1 and size, and the second level holds the other records bearing
+ * the same SHA1 and size.
+ *
+ * Contrary to a GtkTreeStore, rows are not copied into generic nodes holding
+ * an array of GValue: the model only keeps arrays of pointers to the rows,
+ * which are embedded in the caller's own data structure.  All the cell
+ * contents are therefore computed lazily by the cell data functions of the
+ * view, which are only invoked for visible rows.
+ *
+ * Rows are inserted by batches: each batch is sorted according to the
+ * current sorting column and then merged into the already sorted rows, so
+ * that the cost of keeping the view sorted is proportional to the batch
+ * size, not to the amount of rows held.
+ *
+ * @author Raphael Manfredi
+ * @date 2026
+ */
+
+#include "gtk/gui.h"
+
+#include "search_model.h"
+
+#include "lib/halloc.h"
+#include "lib/xsort_data.h"
+
+#include "lib/override.h"		/* Must be the last header included */
+
+/*
+ * The "unsorted" column ID only appeared in GTK+ 2.6.
+ */
+#ifndef GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID
+#define GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID	(-2)
+#endif
+
+#define SEARCH_MODEL_CHILDREN	4	/**< Initial children slots per parent */
+#define SEARCH_MODEL_ROWS		1024	/**< Initial top-level slots */
+
+/**
+ * Sorting function attached to a column.
+ */
+struct search_model_sort {
+	GtkTreeIterCompareFunc func;
+	void *data;
+	GDestroyNotify destroy;
+};
+
+struct _SearchModel {
+	GObject parent;
+	int stamp;						/**< Validates our iterators */
+	search_model_row_t **rows;		/**< Top-level rows, in display order */
+	uint count;						/**< Amount of top-level rows */
+	uint capacity;					/**< Allocated slots in rows[] */
+	int sort_column;				/**< Current sorting column ID */
+	GtkSortType order;				/**< Current sorting order */
+	struct search_model_sort *sort;	/**< Sorting functions, by column */
+	uint sort_count;				/**< Amount of entries in sort[] */
+};
+
+struct _SearchModelClass {
+	GObjectClass parent_class;
+};
+
+static GObjectClass *parent_class;
+
+typedef void (*search_model_signal_t)(GtkTreeModel *,
+	GtkTreePath *, GtkTreeIter *);
+
+static inline void
+search_model_iter_set(const SearchModel *m, GtkTreeIter *iter,
+	search_model_row_t *row)
+{
+	iter->stamp = m->stamp;
+	iter->user_data = row;
+	iter->user_data2 = NULL;
+	iter->user_data3 = NULL;
+}
+
+static inline search_model_row_t *
+search_model_iter_get(const SearchModel *m, const GtkTreeIter *iter)
+{
+	g_assert(iter != NULL);
+	g_assert(iter->stamp == m->stamp);
+
+	return iter->user_data;
+}
+
+static inline search_model_row_t **
+search_model_level(const SearchModel *m, const search_model_row_t *parent)
+{
+	return NULL == parent ? m->rows : parent->child;
+}
+
+static inline uint
+search_model_level_count(const SearchModel *m, const search_model_row_t *parent)
+{
+	return NULL == parent ? m->count : parent->children;
+}
+
+static GtkTreePath *
+search_model_path(const search_model_row_t *row)
+{
+	GtkTreePath *path = gtk_tree_path_new();
+
+	if (row->parent != NULL)
+		gtk_tree_path_append_index(path, row->parent->index);
+	gtk_tree_path_append_index(path, row->index);
+
+	return path;
+}
+
+/**
+ * Emit a row signal on the given row.
+ */
+static void
+search_model_signal(SearchModel *m, search_model_row_t *row,
+	search_model_signal_t signal)
+{
+	GtkTreePath *path = search_model_path(row);
+	GtkTreeIter iter;
+
+	search_model_iter_set(m, &iter, row);
+	(*signal)(GTK_TREE_MODEL(m), path, &iter);
+	gtk_tree_path_free(path);
+}
+
+/***
+ *** Sorting.
+ ***/
+
+static inline bool
+search_model_is_sorted(const SearchModel *m)
+{
+	return m->sort_column >= 0 &&
+		UNSIGNED(m->sort_column) < m->sort_count &&
+		m->sort[m->sort_column].func != NULL;
+}
+
+/**
+ * Compare two rows according to the current sorting column and order.
+ */
+static int
+search_model_cmp(SearchModel *m,
+	search_model_row_t *a, search_model_row_t *b)
+{
+	const struct search_model_sort *s = &m->sort[m->sort_column];
+	GtkTreeIter ia, ib;
+	int ret;
+
+	search_model_iter_set(m, &ia, a);
+	search_model_iter_set(m, &ib, b);
+	ret = (*s->func)(GTK_TREE_MODEL(m), &ia, &ib, s->data);
+
+	return GTK_SORT_DESCENDING == m->order ? -ret : ret;
+}
+
+/**
+ * Sorting callback for arrays of rows.
+ */
+static int
+search_model_row_cmp(const void *a, const void *b, void *data)
+{
+	search_model_row_t * const *ra = a, * const *rb = b;
+
+	return search_model_cmp(data, *ra, *rb);
+}
+
+/**
+ * Find the position at which a row must be inserted in a sorted level,
+ * after all the rows comparing equal to it.
+ *
+ * @param m		the model
+ * @param level	the array of rows making the level
+ * @param n		amount of rows to consider in the level
+ * @param row	the row we want to insert
+ *
+ * @return the insertion index, between 0 and n.
+ */
+static uint
+search_model_bound(SearchModel *m, search_model_row_t **level, uint n,
+	search_model_row_t *row)
+{
+	uint lo = 0, hi = n;
+
+	while (lo < hi) {
+		uint mid = lo + (hi - lo) / 2;
+
+		if (search_model_cmp(m, level[mid], row) > 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return lo;
+}
+
+/**
+ * Is the row misplaced in its level with respect to the sorting order?
+ */
+static bool
+search_model_misplaced(SearchModel *m, const search_model_row_t *row)
+{
+	search_model_row_t **level = search_model_level(m, row->parent);
+	uint n = search_model_level_count(m, row->parent);
+	uint i = row->index;
+
+	if (!search_model_is_sorted(m))
+		return FALSE;
+
+	return
+		(i > 0 && search_model_cmp(m, level[i - 1], level[i]) > 0) ||
+		(i + 1 < n && search_model_cmp(m, level[i], level[i + 1]) > 0);
+}
+
+/**
+ * Sort a level of the model and let the views know about the new order.
+ *
+ * @param m			the model
+ * @param parent	the parent row, NULL for the top-level
+ */
+static void
+search_model_sort_level(SearchModel *m, search_model_row_t *parent)
+{
+	search_model_row_t **level = search_model_level(m, parent);
+	uint i, n = search_model_level_count(m, parent);
+	bool moved = FALSE;
+	int *new_order;
+
+	if (n < 2 || !search_model_is_sorted(m))
+		return;
+
+	xsort_with_data(level, n, sizeof level[0], search_model_row_cmp, m);
+
+	/*
+	 * Rows still bear their former index, which is what the views need.
+	 */
+
+	HALLOC_ARRAY(new_order, n);
+
+	for (i = 0; i < n; i++) {
+		new_order[i] = level[i]->index;
+		if (level[i]->index != i) {
+			level[i]->index = i;
+			moved = TRUE;
+		}
+	}
+
+	if (moved) {
+		GtkTreePath *path;
+
+		if (NULL == parent) {
+			path = gtk_tree_path_new();
+			gtk_tree_model_rows_reordered(GTK_TREE_MODEL(m),
+				path, NULL, new_order);
+		} else {
+			GtkTreeIter iter;
+
+			path = search_model_path(parent);
+			search_model_iter_set(m, &iter, parent);
+			gtk_tree_model_rows_reordered(GTK_TREE_MODEL(m),
+				path, &iter, new_order);
+		}
+		gtk_tree_path_free(path);
+	}
+
+	HFREE_NULL(new_order);
+}
+
+/**
+ * Sort the whole model, after a change of the sorting column or order.
+ */
+static void
+search_model_sort_all(SearchModel *m)
+{
+	uint i;
+
+	if (!search_model_is_sorted(m))
+		return;
+
+	search_model_sort_level(m, NULL);
+
+	for (i = 0; i < m->count; i++) {
+		search_model_sort_level(m, m->rows[i]);
+	}
+}
+
+/***
+ *** Insertion and removal.
+ ***/
+
+/**
+ * Insert the top-level rows of a batch.
+ *
+ * @param m		the model
+ * @param batch	the rows to insert, will be sorted in place
+ * @param n		amount of rows in the batch
+ */
+static void
+search_model_insert_top(SearchModel *m, search_model_row_t **batch, uint n)
+{
+	uint i, first, total = m->count + n;
+
+	if (total > m->capacity) {
+		m->capacity = MAX(total, MAX(m->capacity * 2, SEARCH_MODEL_ROWS));
+		HREALLOC_ARRAY(m->rows, m->capacity);
+	}
+
+	if (search_model_is_sorted(m)) {
+		uint old = m->count, w = total;
+
+		/*
+		 * Sort the batch, then merge it backwards into the existing rows,
+		 * locating the position of each new row by binary search so that
+		 * the amount of comparisons stays logarithmic in the model size.
+		 */
+
+		xsort_with_data(batch, n, sizeof batch[0], search_model_row_cmp, m);
+
+		first = old;
+		i = n;
+		while (i-- != 0) {
+			uint pos = search_model_bound(m, m->rows, old, batch[i]);
+			uint moved = old - pos;
+
+			w -= moved;
+			memmove(&m->rows[w], &m->rows[pos], moved * sizeof m->rows[0]);
+			m->rows[--w] = batch[i];
+			old = pos;
+			first = w;
+		}
+		g_assert(w == old);
+	} else {
+		first = m->count;
+		memcpy(&m->rows[first], batch, n * sizeof batch[0]);
+	}
+
+	m->count = total;
+
+	for (i = first; i < total; i++) {
+		m->rows[i]->index = i;
+	}
+
+	/*
+	 * The batch is now in display order, hence emitting the insertions
+	 * in that order makes each path valid at the time of the signal.
+	 */
+
+	for (i = 0; i < n; i++) {
+		search_model_signal(m, batch[i], gtk_tree_model_row_inserted);
+	}
+}
+
+/**
+ * Insert a row as a child of its parent, which must already be in the model.
+ */
+static void
+search_model_insert_child(SearchModel *m, search_model_row_t *row)
+{
+	search_model_row_t *parent = row->parent;
+	uint i, pos;
+
+	g_assert(parent != NULL);
+	g_assert(NULL == parent->parent);
+
+	if (parent->children == parent->capacity) {
+		parent->capacity = MAX(parent->capacity * 2, SEARCH_MODEL_CHILDREN);
+		HREALLOC_ARRAY(parent->child, parent->capacity);
+	}
+
+	pos = search_model_is_sorted(m) ?
+		search_model_bound(m, parent->child, parent->children, row) :
+		parent->children;
+
+	memmove(&parent->child[pos + 1], &parent->child[pos],
+		(parent->children - pos) * sizeof parent->child[0]);
+	parent->child[pos] = row;
+	parent->children++;
+
+	for (i = pos; i < parent->children; i++) {
+		parent->child[i]->index = i;
+	}
+
+	search_model_signal(m, row, gtk_tree_model_row_inserted);
+	if (1 == parent->children)
+		search_model_signal(m, parent, gtk_tree_model_row_has_child_toggled);
+}
+
+/**
+ * Insert a batch of rows in the model.
+ *
+ * Each row must have its parent set, or NULL for a top-level row.  A parent
+ * can be part of the same batch.
+ *
+ * @param model		the search model
+ * @param rows		the rows to insert (array is reordered)
+ * @param n			amount of rows
+ */
+void
+search_model_insert(GtkTreeModel *model, search_model_row_t **rows, size_t n)
+{
+	SearchModel *m = SEARCH_MODEL(model);
+	uint i, top;
+	bool resort = FALSE;
+
+	g_return_if_fail(rows != NULL);
+	g_return_if_fail(n <= MAX_INT_VAL(uint) - m->count);
+
+	/*
+	 * Move top-level rows at the head of the array, then insert them all
+	 * at once, so that parents are present before their children.
+	 */
+
+	for (i = top = 0; i < n; i++) {
+		search_model_row_t *row = rows[i];
+
+		g_assert(0 == row->children);
+		g_assert(NULL == row->child);
+
+		if (NULL == row->parent) {
+			rows[i] = rows[top];
+			rows[top++] = row;
+		}
+	}
+
+	if (top != 0)
+		search_model_insert_top(m, rows, top);
+
+	for (i = top; i < n; i++) {
+		search_model_row_t *parent = rows[i]->parent;
+
+		search_model_insert_child(m, rows[i]);
+		search_model_signal(m, parent, gtk_tree_model_row_changed);
+		if (!resort && search_model_misplaced(m, parent))
+			resort = TRUE;
+	}
+
+	/*
+	 * The amount of children of a parent can be a sorting criterion.
+	 */
+
+	if (resort)
+		search_model_sort_level(m, NULL);
+}
+
+/**
+ * Remove a row from the model.
+ *
+ * When the row has children, the first child takes the place of the row
+ * and inherits the other children, so that the group stays visible.
+ *
+ * @param model		the search model
+ * @param row		the row to remove
+ *
+ * @return the promoted child, NULL if the row had no children.
+ */
+search_model_row_t *
+search_model_remove(GtkTreeModel *model, search_model_row_t *row)
+{
+	SearchModel *m = SEARCH_MODEL(model);
+	search_model_row_t *parent = row->parent;
+	search_model_row_t *heir = NULL;
+	search_model_row_t **level;
+	uint i, n;
+	GtkTreePath *path;
+
+	g_return_val_if_fail(row != NULL, NULL);
+
+	if (row->children != 0) {
+		g_assert(NULL == parent);
+
+		/*
+		 * Remove the first child from the group first, then let it step in
+		 * for the row being removed.
+		 */
+
+		heir = row->child[0];
+		search_model_remove(model, heir);
+
+		heir->parent = NULL;
+		heir->child = row->child;
+		heir->children = row->children;
+		heir->capacity = row->capacity;
+		heir->index = row->index;
+		m->rows[row->index] = heir;
+
+		for (i = 0; i < heir->children; i++) {
+			heir->child[i]->parent = heir;
+		}
+
+		row->child = NULL;
+		row->children = row->capacity = 0;
+
+		search_model_row_changed(model, heir);
+		return heir;
+	}
+
+	level = search_model_level(m, parent);
+	n = search_model_level_count(m, parent);
+
+	g_assert(row->index < n);
+	g_assert(level[row->index] == row);
+
+	path = search_model_path(row);
+
+	memmove(&level[row->index], &level[row->index + 1],
+		(n - row->index - 1) * sizeof level[0]);
+	n--;
+
+	for (i = row->index; i < n; i++) {
+		level[i]->index = i;
+	}
+
+	if (NULL == parent) {
+		m->count = n;
+	} else {
+		parent->children = n;
+		if (0 == n) {
+			parent->capacity = 0;
+			HFREE_NULL(parent->child);
+		}
+	}
+
+	gtk_tree_model_row_deleted(model, path);
+	gtk_tree_path_free(path);
+
+	if (parent != NULL) {
+		if (0 == parent->children) {
+			search_model_signal(m, parent,
+				gtk_tree_model_row_has_child_toggled);
+		}
+		search_model_row_changed(model, parent);
+	}
+
+	return NULL;
+}
+
+/**
+ * Signal that the data behind a row changed, moving the row if its position
+ * in the sorting order is affected.
+ */
+void
+search_model_row_changed(GtkTreeModel *model, search_model_row_t *row)
+{
+	SearchModel *m = SEARCH_MODEL(model);
+
+	g_return_if_fail(row != NULL);
+
+	search_model_signal(m, row, gtk_tree_model_row_changed);
+
+	if (search_model_misplaced(m, row))
+		search_model_sort_level(m, row->parent);
+}
+
+/**
+ * Remove all the rows from the model.
+ *
+ * @param model		the search model
+ * @param cb		if non-NULL, invoked on each row once it was removed
+ * @param data		additional callback argument
+ */
+void
+search_model_clear(GtkTreeModel *model, search_model_row_cb_t cb, void *data)
+{
+	SearchModel *m = SEARCH_MODEL(model);
+	search_model_row_t **rows = m->rows;
+	uint i, n = m->count;
+
+	/*
+	 * Delete from the end so that the views do not have to renumber
+	 * anything, then detach the rows.
+	 */
+
+	for (i = n; i != 0; i--) {
+		GtkTreePath *path = gtk_tree_path_new_from_indices(i - 1, -1);
+
+		m->count = i - 1;
+		gtk_tree_model_row_deleted(model, path);
+		gtk_tree_path_free(path);
+	}
+
+	m->rows = NULL;
+	m->capacity = 0;
+
+	for (i = 0; i < n; i++) {
+		search_model_row_t *row = rows[i];
+		uint j;
+
+		for (j = 0; j < row->children; j++) {
+			if (cb != NULL)
+				(*cb)(row->child[j], data);
+		}
+		HFREE_NULL(row->child);
+		row->children = row->capacity = 0;
+		if (cb != NULL)
+			(*cb)(row, data);
+	}
+
+	HFREE_NULL(rows);
+}
+
+/**
+ * Get the row to which an iterator refers.
+ */
+search_model_row_t *
+search_model_iter_row(GtkTreeModel *model, const GtkTreeIter *iter)
+{
+	return search_model_iter_get(SEARCH_MODEL(model), iter);
+}
+
+/***
+ *** GtkTreeModel interface.
+ ***/
+
+static GtkTreeModelFlags
+search_model_get_flags(GtkTreeModel *unused_model)
+{
+	(void) unused_model;
+	return GTK_TREE_MODEL_ITERS_PERSIST;
+}
+
+static int
+search_model_get_n_columns(GtkTreeModel *unused_model)
+{
+	(void) unused_model;
+	return 1;
+}
+
+static GType
+search_model_get_column_type(GtkTreeModel *unused_model, int column)
+{
+	(void) unused_model;
+	g_return_val_if_fail(0 == column, G_TYPE_INVALID);
+	return G_TYPE_POINTER;
+}
+
+static gboolean
+search_model_get_iter(GtkTreeModel *model, GtkTreeIter *iter,
+	GtkTreePath *path)
+{
+	SearchModel *m = SEARCH_MODEL(model);
+	int depth = gtk_tree_path_get_depth(path);
+	int *idx = gtk_tree_path_get_indices(path);
+	search_model_row_t *row;
+
+	if (depth < 1 || depth > 2 || idx[0] < 0 || UNSIGNED(idx[0]) >= m->count)
+		return FALSE;
+
+	row = m->rows[idx[0]];
+
+	if (2 == depth) {
+		if (idx[1] < 0 || UNSIGNED(idx[1]) >= row->children)
+			return FALSE;
+		row = row->child[idx[1]];
+	}
+
+	search_model_iter_set(m, iter, row);
+	return TRUE;
+}
+
+static GtkTreePath *
+search_model_get_path(GtkTreeModel *model, GtkTreeIter *iter)
+{
+	return search_model_path(search_model_iter_get(SEARCH_MODEL(model), iter));
+}
+
+static void
+search_model_get_value(GtkTreeModel *model, GtkTreeIter *iter,
+	int column, GValue *value)
+{
+	g_return_if_fail(0 == column);
+
+	g_value_init(value, G_TYPE_POINTER);
+	g_value_set_pointer(value,
+		search_model_iter_get(SEARCH_MODEL(model), iter));
+}
+
+static gboolean
+search_model_iter_next(GtkTreeModel *model, GtkTreeIter *iter)
+{
+	SearchModel *m = SEARCH_MODEL(model);
+	search_model_row_t *row = search_model_iter_get(m, iter);
+	uint next = row->index + 1;
+
+	if (next >= search_model_level_count(m, row->parent))
+		return FALSE;
+
+	search_model_iter_set(m, iter, search_model_level(m, row->parent)[next]);
+	return TRUE;
+}
+
+static gboolean
+search_model_iter_nth_child(GtkTreeModel *model, GtkTreeIter *iter,
+	GtkTreeIter *parent, int n)
+{
+	SearchModel *m = SEARCH_MODEL(model);
+	search_model_row_t *row = NULL;
+
+	if (parent != NULL) {
+		row = search_model_iter_get(m, parent);
+		if (row->parent != NULL)
+			return FALSE;		/* Only two levels */
+	}
+
+	if (n < 0 || UNSIGNED(n) >= search_model_level_count(m, row))
+		return FALSE;
+
+	search_model_iter_set(m, iter, search_model_level(m, row)[n]);
+	return TRUE;
+}
+
+static gboolean
+search_model_iter_children(GtkTreeModel *model, GtkTreeIter *iter,
+	GtkTreeIter *parent)
+{
+	return search_model_iter_nth_child(model, iter, parent, 0);
+}
+
+static gboolean
+search_model_iter_has_child(GtkTreeModel *model, GtkTreeIter *iter)
+{
+	return 0 != search_model_iter_get(SEARCH_MODEL(model), iter)->children;
+}
+
+static int
+search_model_iter_n_children(GtkTreeModel *model, GtkTreeIter *iter)
+{
+	SearchModel *m = SEARCH_MODEL(model);
+
+	return NULL == iter ? m->count : search_model_iter_get(m, iter)->children;
+}
+
+static gboolean
+search_model_iter_parent(GtkTreeModel *model, GtkTreeIter *iter,
+	GtkTreeIter *child)
+{
+	SearchModel *m = SEARCH_MODEL(model);
+	search_model_row_t *row = search_model_iter_get(m, child);
+
+	if (NULL == row->parent)
+		return FALSE;
+
+	search_model_iter_set(m, iter, row->parent);
+	return TRUE;
+}
+
+static void
+search_model_tree_model_init(GtkTreeModelIface *iface)
+{
+	iface->get_flags = search_model_get_flags;
+	iface->get_n_columns = search_model_get_n_columns;
+	iface->get_column_type = search_model_get_column_type;
+	iface->get_iter = search_model_get_iter;
+	iface->get_path = search_model_get_path;
+	iface->get_value = search_model_get_value;
+	iface->iter_next = search_model_iter_next;
+	iface->iter_children = search_model_iter_children;
+	iface->iter_has_child = search_model_iter_has_child;
+	iface->iter_n_children = search_model_iter_n_children;
+	iface->iter_nth_child = search_model_iter_nth_child;
+	iface->iter_parent = search_model_iter_parent;
+}
+
+/***
+ *** GtkTreeSortable interface.
+ ***/
+
+static gboolean
+search_model_get_sort_column_id(GtkTreeSortable *sortable,
+	int *column, GtkSortType *order)
+{
+	SearchModel *m = SEARCH_MODEL(sortable);
+
+	if (column != NULL)
+		*column = m->sort_column;
+	if (order != NULL)
+		*order = m->order;
+
+	return GTK_TREE_SORTABLE_DEFAULT_SORT_COLUMN_ID != m->sort_column &&
+		GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID != m->sort_column;
+}
+
+static void
+search_model_set_sort_column_id(GtkTreeSortable *sortable,
+	int column, GtkSortType order)
+{
+	SearchModel *m = SEARCH_MODEL(sortable);
+
+	if (m->sort_column == column && m->order == order)
+		return;
+
+	m->sort_column = column;
+	m->order = order;
+
+	gtk_tree_sortable_sort_column_changed(sortable);
+
+	/*
+	 * When sorting is turned off, rows keep their current order and new
+	 * rows are appended at the end.
+	 */
+
+	search_model_sort_all(m);
+}
+
+static void
+search_model_set_sort_func(GtkTreeSortable *sortable, int column,
+	GtkTreeIterCompareFunc func, void *data, GDestroyNotify destroy)
+{
+	SearchModel *m = SEARCH_MODEL(sortable);
+	struct search_model_sort *s;
+
+	g_return_if_fail(column >= 0);
+
+	if (UNSIGNED(column) >= m->sort_count) {
+		uint n = column + 1;
+
+		HREALLOC_ARRAY(m->sort, n);
+		memset(&m->sort[m->sort_count], 0,
+			(n - m->sort_count) * sizeof m->sort[0]);
+		m->sort_count = n;
+	}
+
+	s = &m->sort[column];
+	if (s->destroy != NULL)
+		(*s->destroy)(s->data);
+
+	s->func = func;
+	s->data = data;
+	s->destroy = destroy;
+
+	if (column == m->sort_column)
+		search_model_sort_all(m);
+}
+
+static void
+search_model_set_default_sort_func(GtkTreeSortable *unused_sortable,
+	GtkTreeIterCompareFunc unused_func, void *unused_data,
+	GDestroyNotify unused_destroy)
+{
+	(void) unused_sortable;
+	(void) unused_func;
+	(void) unused_data;
+	(void) unused_destroy;
+
+	g_carp("%s(): no default sorting for search results", G_STRFUNC);
+}
+
+static gboolean
+search_model_has_default_sort_func(GtkTreeSortable *unused_sortable)
+{
+	(void) unused_sortable;
+	return FALSE;
+}
+
+static void
+search_model_tree_sortable_init(GtkTreeSortableIface *iface)
+{
+	iface->get_sort_column_id = search_model_get_sort_column_id;
+	iface->set_sort_column_id = search_model_set_sort_column_id;
+	iface->set_sort_func = search_model_set_sort_func;
+	iface->set_default_sort_func = search_model_set_default_sort_func;
+	iface->has_default_sort_func = search_model_has_default_sort_func;
+}
+
+/***
+ *** Object life-cycle.
+ ***/
+
+static void
+search_model_init(SearchModel *m)
+{
+	m->stamp = GPOINTER_TO_INT(m);
+	m->sort_column = GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID;
+	m->order = GTK_SORT_ASCENDING;
+}
+
+static void
+search_model_finalize(GObject *object)
+{
+	SearchModel *m = SEARCH_MODEL(object);
+	uint i;
+
+	/*
+	 * Rows belong to the caller, who is expected to clear the model first.
+	 * We can only release our own arrays now, without signalling anything.
+	 */
+
+	for (i = 0; i < m->count; i++) {
+		search_model_row_t *row = m->rows[i];
+
+		HFREE_NULL(row->child);
+		row->children = row->capacity = 0;
+	}
+	HFREE_NULL(m->rows);
+	m->count = m->capacity = 0;
+
+	for (i = 0; i < m->sort_count; i++) {
+		struct search_model_sort *s = &m->sort[i];
+
+		if (s->destroy != NULL)
+			(*s->destroy)(s->data);
+	}
+	HFREE_NULL(m->sort);
+	m->sort_count = 0;
+
+	G_OBJECT_CLASS(parent_class)->finalize(object);
+}
+
+static void
+search_model_class_init(SearchModelClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+	parent_class = g_type_class_peek_parent(klass);
+	object_class->finalize = search_model_finalize;
+}
+
+/**
+ * Register the search model type.
+ */
+GType
+search_model_get_type(void)
+{
+	static GType search_model_type;
+
+	if (!search_model_type) {
+		static const GTypeInfo search_model_info = {
+			sizeof(SearchModelClass),
+			NULL,		/* base_init */
+			NULL,		/* base_finalize */
+			(GClassInitFunc) search_model_class_init,
+			NULL,		/* class_finalize */
+			NULL,		/* class_data */
+			sizeof(SearchModel),
+			0,			/* n_preallocs */
+			(GInstanceInitFunc) search_model_init,
+			NULL		/* value_table */
+		};
+		static const GInterfaceInfo tree_model_info = {
+			(GInterfaceInitFunc) search_model_tree_model_init,
+			NULL,		/* interface_finalize */
+			NULL		/* interface_data */
+		};
+		static const GInterfaceInfo tree_sortable_info = {
+			(GInterfaceInitFunc) search_model_tree_sortable_init,
+			NULL,		/* interface_finalize */
+			NULL		/* interface_data */
+		};
+
+		search_model_type = g_type_register_static(G_TYPE_OBJECT,
+			"SearchModel", &search_model_info, 0);
+		g_type_add_interface_static(search_model_type,
+			GTK_TYPE_TREE_MODEL, &tree_model_info);
+		g_type_add_interface_static(search_model_type,
+			GTK_TYPE_TREE_SORTABLE, &tree_sortable_info);
+	}
+
+	return search_model_type;
+}
+
+/**
+ * Create a new, empty and unsorted, search model.
+ */
+GtkTreeModel *
+search_model_new(void)
+{
+	return GTK_TREE_MODEL(g_object_new(SEARCH_TYPE_MODEL, NULL_PTR));
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2026, Raphael Manfredi
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup gtk
+ * @file
+ *
+ * Search results tree model.
+ *
+ * @author Raphael Manfredi
+ * @date 2026
+ */
+
+#ifndef _gtk2_search_model_h_
+#define _gtk2_search_model_h_
+
+#include "gtk/gui.h"
+
+/**
+ * A row of the search results model.
+ *
+ * It is meant to be embedded at the head of the structure held by the
+ * caller, so that no separate allocation is needed for each row.  The
+ * caller sets the parent before inserting the row, and must not touch any
+ * other field afterwards.
+ */
+typedef struct search_model_row {
+	struct search_model_row *parent;	/**< Parent row, NULL at top-level */
+	struct search_model_row **child;	/**< Children, in display order */
+	uint children;						/**< Amount of children */
+	uint capacity;						/**< Allocated slots in child[] */
+	uint index;							/**< Position within its level */
+} search_model_row_t;
+
+typedef void (*search_model_row_cb_t)(search_model_row_t *row, void *data);
+
+#define SEARCH_TYPE_MODEL	(search_model_get_type())
+#define SEARCH_MODEL(obj) \
+	(G_TYPE_CHECK_INSTANCE_CAST((obj), SEARCH_TYPE_MODEL, SearchModel))
+#define SEARCH_IS_MODEL(obj) \
+	(G_TYPE_CHECK_INSTANCE_TYPE((obj), SEARCH_TYPE_MODEL))
+
+typedef struct _SearchModel SearchModel;
+typedef struct _SearchModelClass SearchModelClass;
+
+/*
+ * Public interface.
+ */
+
+GType search_model_get_type(void);
+GtkTreeModel *search_model_new(void);
+
+search_model_row_t *search_model_iter_row(GtkTreeModel *, const GtkTreeIter *);
+void search_model_insert(GtkTreeModel *, search_model_row_t **rows, size_t n);
+search_model_row_t *search_model_remove(GtkTreeModel *, search_model_row_t *);
+void search_model_row_changed(GtkTreeModel *, search_model_row_t *);
+void search_model_clear(GtkTreeModel *, search_model_row_cb_t cb, void *data);
+
+#endif /* _gtk2_search_model_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
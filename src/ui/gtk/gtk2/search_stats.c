@@ -32,14 +32,17 @@
  * each has been seen.
  *
  * @note
- * This uses the glib hash tables and lists, but a much more efficient
- * implementation could be done with a specialized hash table /
- * re-keyable binary tree.
+ * Terms are tallied by streaming top-k trackers, hence only the most
+ * frequent ones are kept and memory usage is bounded, regardless of the
+ * amount of distinct terms seen.  Counts are upper bounds.
  *
  * @author Raphael Manfredi
  * @date 2001-2003
  * @author Michael Tesch
  * @date 2002
+ *
+ * @author Raphael Manfredi
+ * @date 2026
  */
 
 #include "gtk/gui.h"
@@ -52,22 +55,17 @@
 #include "if/bridge/ui2c.h"
 
 #include "lib/concat.h"
-#include "lib/htable.h"
+#include "lib/topk.h"
 #include "lib/utf8.h"
-#include "lib/walloc.h"
 #include "lib/wordvec.h"
 #include "lib/override.h"		/* Must be the last header included */
 
-/* This is what the stat_hash's 'val' points to */
-struct term_counts {
-	guint32 period_cnt;
-	guint32 total_cnt;
-	guint32 periods;
-};
+#define SEARCH_STATS_TERMS	2048	/**< Amount of terms tracked */
 
 static unsigned stat_count;
 
-static htable_t *stat_hash;
+static topk_t *stat_total;		/**< Most frequent terms overall */
+static topk_t *stat_period;		/**< Most frequent terms during period */
 static GtkListStore *store_search_stats;
 static GtkTreeView *treeview_search_stats;
 static GtkLabel *label_search_stats_count;
@@ -78,19 +76,6 @@ static GtkSortType search_stats_sort_order;
 static int search_stats_sort_column;
 #endif	/* Gtk+ >= 2.6.0 */
 
-static bool
-free_hash_entry(const void *key, void *value, void *unused_data)
-{
-	struct term_counts *val = value;
-	char *s = deconstify_pointer(key);
-
-	(void) unused_data;
-
-	wfree(s, 1 + vstrlen(s));
-	WFREE(val);
-	return TRUE;
-}
-
 /**
  * Save Search Stats sort order.
  */
@@ -227,66 +212,52 @@ search_stats_notify_routed(query_type_t unused_type, const char *unused_search,
  *** Private functions
  ***/
 
-/* this sucks -- too slow */
 static void
 empty_hash_table(void)
 {
-	if (!stat_hash)
+	if (NULL == stat_total)
 		return;
 
-	htable_foreach_remove(stat_hash, free_hash_entry, NULL);
+	topk_clear(stat_total);
+	topk_clear(stat_period);
 }
 
 /**
  * Helper func for stats_display -
- *  does two things:
+ *  sticks the most frequent search terms in treeview_search_stats.
  *
- *  - clears out aged / infrequent search terms
- *  - sticks the rest of the search terms in treeview_search_stats
+ * Keys include their trailing NUL, hence are plain C strings.
  */
-static bool
-stats_hash_to_treeview(const void *key, void *value, void *unused_udata)
+static void
+stats_topk_to_treeview(const void *key, size_t len,
+	uint64 count, uint64 unused_error, void *unused_udata)
 {
-	struct term_counts *val = value;
+	uint64 period_cnt;
 	GtkTreeIter iter;
 	char *s;
 
+	(void) unused_error;
 	(void) unused_udata;
 
-	/* update counts */
-	val->periods = val->period_cnt ? 0 : (val->periods + 1);
-	val->total_cnt += val->period_cnt;
-
-	/* try to keep the number of infrequent terms down */
-	if (
-		(1.0 * val->total_cnt / (val->periods + 2.0)) * 100 <
-			GUI_PROPERTY(search_stats_delcoef)
-	) {
-		free_hash_entry(key, value, NULL);
-		return TRUE;
-	}
+	if (!topk_lookup(stat_period, key, len, &period_cnt, NULL))
+		period_cnt = 0;
 
 	stat_count++;
 
 	/* update the display */
 
-	s = key ? unknown_to_utf8_normalized(key, UNI_NORM_GUI, NULL) : NULL;
+	s = unknown_to_utf8_normalized(key, UNI_NORM_GUI, NULL);
 
 	gtk_list_store_append(store_search_stats, &iter);
 	gtk_list_store_set(store_search_stats, &iter,
 		0, s,
-		1, (gulong) val->period_cnt,
-		2, (gulong) val->total_cnt,
+		1, (gulong) period_cnt,
+		2, (gulong) count,
 		(-1));
 
 	if (key != s) {
 		G_FREE_NULL(s);
 	}
-
-	/* new period begins */
-	val->period_cnt = 0;
-
-	return FALSE;
 }
 
 /**
@@ -324,23 +295,14 @@ search_stats_gui_disable(void)
 static void
 search_stats_tally(const word_vec_t *vec)
 {
-	struct term_counts *val;
+	size_t len;
 
 	if (vec->word[1] == '\0' || vec->word[2] == '\0')
 		return;
 
-	val = htable_lookup(stat_hash, vec->word);
-
-	if (val) {
-		val->period_cnt++;
-	} else {
-		const char *key;
-
-		WALLOC0(val);
-		val->period_cnt = vec->amount;
-		key = wcopy(vec->word, 1 + vstrlen(vec->word));
-		htable_insert(stat_hash, key, val);
-	}
+	len = 1 + vstrlen(vec->word);		/* Include trailing NUL */
+	topk_add(stat_total, vec->word, len, vec->amount);
+	topk_add(stat_period, vec->word, len, vec->amount);
 }
 
 
@@ -449,8 +411,11 @@ search_stats_gui_update_display(void)
 		sorting_disabled = TRUE;
 		search_stats_gui_sort_save();
 	}
-	/* insert the hash table contents into the sorted treeview */
-	htable_foreach_remove(stat_hash, stats_hash_to_treeview, NULL);
+	/* insert the most frequent terms into the sorted treeview */
+	topk_foreach(stat_total, 0, stats_topk_to_treeview, NULL);
+
+	/* new period begins */
+	topk_clear(stat_period);
 
 	tm_now_exact(&end_time);
 	elapsed = tm_elapsed_ms(&end_time, &start_time);
@@ -541,7 +506,8 @@ search_stats_gui_init(void)
 	tree_view_restore_widths(treeview, PROP_SEARCH_STATS_COL_WIDTHS);
 	tree_view_set_fixed_height_mode(treeview, TRUE);
 
-	stat_hash = htable_create(HASH_KEY_STRING, 0);
+	stat_total = topk_make(SEARCH_STATS_TERMS);
+	stat_period = topk_make(SEARCH_STATS_TERMS);
 	main_gui_add_timer(search_stats_gui_timer);
 }
 
@@ -550,7 +516,8 @@ search_stats_gui_shutdown(void)
 {
     search_stats_gui_set_type(NO_SEARCH_STATS);
 	empty_hash_table();
-    htable_free_null(&stat_hash);
+	topk_free_null(&stat_total);
+	topk_free_null(&stat_period);
 }
 
 /* vi: set ts=4 sw=4 cindent: */
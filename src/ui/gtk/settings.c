@@ -3993,6 +3993,7 @@ static prop_map_t property_map[] = {
         "spinbutton_search_stats_update_interval",
         FREQ_UPDATES, 0
     ),
+#ifdef USE_GTK1
     PROP_ENTRY(
         gui_main_window,
         PROP_SEARCH_STATS_DELCOEF,
@@ -4001,6 +4002,7 @@ static prop_map_t property_map[] = {
         "spinbutton_search_stats_delcoef",
         FREQ_UPDATES, 0
     ),
+#endif /* USE_GTK1 */
     PROP_ENTRY(
         gui_dlg_prefs,
         PROP_USE_NETMASKS,
@@ -5043,14 +5045,6 @@ static prop_map_t property_map[] = {
         "checkbutton_config_dht_storage_in_memory",
         FREQ_UPDATES, 0
     ),
-    PROP_ENTRY(
-        gui_dlg_prefs,
-        PROP_SPAM_LUT_IN_MEMORY,
-        update_togglebutton,
-        TRUE,
-        "checkbutton_config_spam_lut_in_memory",
-        FREQ_UPDATES, 0
-    ),
     PROP_ENTRY(
         gui_main_window,
         PROP_SEARCH_HANDLE_IGNORED_FILES,